@@ -0,0 +1,11 @@
+# Training workload of a -DMPC_PGO=GENERATE build, run by `make pgo-train`:
+# laps of the offline simulator on every backend, one pass of the solver
+# benchmark and, when LOG is set, a replay of that telemetry log. The
+# outcome of the runs does not matter, only the profiles they leave.
+foreach(backend ipopt kernels rti riccati admm mppi)
+  execute_process(COMMAND ${MPC_SIM} --track ${TRACK} --laps 2 --backend ${backend})
+endforeach()
+execute_process(COMMAND ${MPC_BENCH} --track ${TRACK} --reps 1)
+if(LOG)
+  execute_process(COMMAND ${MPC_REPLAY} ${LOG})
+endif()
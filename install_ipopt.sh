@@ -1,9 +1,21 @@
-# Pass the Ipopt source directory as the first argument
+# Pass the Ipopt source directory as the first argument.
+#
+# Multithreaded linear solvers for long horizons (see --solver-threads):
+# HSL=DIR builds MA86 and MA97 with OpenMP from the coinhsl sources in
+# DIR (licensed separately from http://www.hsl.rl.ac.uk/ipopt/), and
+# PARDISO=LIB links the Pardiso library LIB from pardiso-project.org.
+#
+# BLAS and LAPACK, in place of the reference ones Ipopt would download,
+# which leave the dense blocks of the factorization many times slower:
+# BLAS=eigen builds the BLAS of src/Eigen-3.3/blas under the reference
+# LAPACK, BLAS=openblas and BLAS=mkl link those installed for both, and
+# any other value is taken as the linker flags of a BLAS with LAPACK.
 if [ -z $1 ]
 then
     echo "Specifiy the location of the Ipopt source directory in the first argument."
     exit
 fi
+mpcdir=$(cd "$(dirname "$0")" && pwd)
 cd $1
 
 prefix=/usr/local
@@ -13,19 +25,54 @@ echo "Building Ipopt from ${srcdir}"
 echo "Saving headers and libraries to ${prefix}"
 
 # BLAS
-cd $srcdir/ThirdParty/Blas
-./get.Blas
-mkdir -p build && cd build
-../configure --prefix=$prefix --disable-shared --with-pic
-make install
-
-# Lapack
-cd $srcdir/ThirdParty/Lapack
-./get.Lapack
-mkdir -p build && cd build
-../configure --prefix=$prefix --disable-shared --with-pic \
-    --with-blas="$prefix/lib/libcoinblas.a -lgfortran"
-make install
+blas="$prefix/lib/libcoinblas.a -lgfortran"
+lapack=$prefix/lib/libcoinlapack.a
+case "$BLAS" in
+  "")
+    cd $srcdir/ThirdParty/Blas
+    ./get.Blas
+    mkdir -p build && cd build
+    ../configure --prefix=$prefix --disable-shared --with-pic
+    make install
+    ;;
+  eigen)
+    eigen=$mpcdir/src/Eigen-3.3/blas
+    mkdir -p $srcdir/ThirdParty/EigenBlas && cd $srcdir/ThirdParty/EigenBlas
+    for f in single double complex_single complex_double xerbla
+    do
+        g++ -O3 -fPIC -w -c $eigen/$f.cpp -o $f.o
+    done
+    for f in $eigen/f2c/*.c
+    do
+        gcc -O2 -fPIC -c $f -o $(basename $f .c).o
+    done
+    ar rcs $prefix/lib/libeigen_blas.a *.o
+    blas="$prefix/lib/libeigen_blas.a -lstdc++"
+    ;;
+  openblas)
+    blas=-lopenblas
+    lapack=-lopenblas
+    ;;
+  mkl)
+    blas=-lmkl_rt
+    lapack=-lmkl_rt
+    ;;
+  *)
+    blas=$BLAS
+    lapack=$BLAS
+    ;;
+esac
+
+# Lapack, unless the BLAS brings its own
+if [ "$lapack" = "$prefix/lib/libcoinlapack.a" ]
+then
+    cd $srcdir/ThirdParty/Lapack
+    ./get.Lapack
+    mkdir -p build && cd build
+    ../configure --prefix=$prefix --disable-shared --with-pic \
+        --with-blas="$blas"
+    make install
+fi
 
 # ASL
 cd $srcdir//ThirdParty/ASL
@@ -35,11 +82,30 @@ cd $srcdir//ThirdParty/ASL
 cd $srcdir/ThirdParty/Mumps
 ./get.Mumps
 
+# HSL, with OpenMP for MA86 and MA97
+openmp=""
+if [ -n "$HSL" ]
+then
+    rm -rf $srcdir/ThirdParty/HSL/coinhsl
+    cp -r $HSL $srcdir/ThirdParty/HSL/coinhsl
+    openmp="-fopenmp"
+fi
+
+# Pardiso
+pardiso=""
+if [ -n "$PARDISO" ]
+then
+    pardiso="--with-pardiso=$PARDISO -fopenmp"
+    openmp="-fopenmp"
+fi
+
 # build everything
 cd $srcdir
 ./configure --prefix=$prefix coin_skip_warn_cxxflags=yes \
-    --with-blas="$prefix/lib/libcoinblas.a -lgfortran" \
-    --with-lapack=$prefix/lib/libcoinlapack.a
+    --with-blas="$blas" \
+    --with-lapack="$lapack" \
+    ADD_CFLAGS="$openmp" ADD_FFLAGS="$openmp" LDFLAGS="$openmp" \
+    ${pardiso:+"$pardiso"}
 make
 make test
 make -j1 install
\ No newline at end of file
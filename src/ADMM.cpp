@@ -0,0 +1,399 @@
+#include "ADMM.h"
+#include "Tuning.h"
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// ADMM parameters, as in OSQP: the proximal term, the relaxation, the
+// tolerances and the scale of rho on equality rows.
+static const double sigma = 1e-6;
+static const double alpha = 1.6;
+static const double eps_abs = 1e-4;
+static const double eps_rel = 1e-4;
+static const double eq_scale = 1e3;
+static const int max_iterations = 200;
+// Iterations between rho adaptations, and the change worth a refactor.
+static const int rho_interval = 25;
+static const double rho_change = 5;
+
+// Position of state s and actuator j of stage k in the Layout<N> order.
+// Each kinematic constraint row has the index of its state, and the bound
+// row of an actuator the index of the actuator.
+template <size_t N>
+static size_t StateVar(size_t s, size_t k) {
+  return Layout<N>::State(s, k);
+}
+
+template <size_t N>
+static size_t InputVar(size_t j, size_t k) {
+  return Layout<N>::Input(j, k);
+}
+
+// Variable of the error i of the terminal cost (see TerminalCost.h).
+template <size_t N>
+static size_t TerminalVar(size_t i) {
+  const size_t vars[n_terminal] = { StateVar<N>(4, N - 1), StateVar<N>(5, N - 1), StateVar<N>(3, N - 1),
+                                    InputVar<N>(0, N - 2), InputVar<N>(1, N - 2) };
+  return vars[i];
+}
+
+template <size_t N>
+ADMM<N>::ADMM(double dt, double Lf)
+    : model_(dt, Lf),
+      xref_(StateMatrix::Zero()),
+      weights_(default_weights),
+      terminal_(TerminalMatrix::Zero()),
+      initialized_(false),
+      analyzed_(false),
+      iterations_(0),
+      converged_(false),
+      X_(StateMatrix::Zero()),
+      U_(InputVector::Zero()),
+      coeffs_(Eigen::Vector4d::Zero()),
+      q_(Eigen::VectorXd::Zero(n_w)),
+      l_(Eigen::VectorXd::Zero(n_rows)),
+      u_(Eigen::VectorXd::Zero(n_rows)),
+      refinements_(0),
+      rho_(0.1),
+      rho_rows_(Eigen::VectorXd::Zero(n_rows)),
+      w_(Eigen::VectorXd::Zero(n_w)),
+      z_(Eigen::VectorXd::Zero(n_rows)),
+      y_(Eigen::VectorXd::Zero(n_rows)) {
+  typedef Eigen::Triplet<double> Triplet;
+
+  // Constraint pattern: the identity on every state and dense stage
+  // blocks for the dynamics, filled in for each linearization, then the
+  // identity on the actuators for their bounds.
+  std::vector<Triplet> a;
+  for (size_t k = 0; k < N; k++) {
+    for (size_t s = 0; s < 6; s++) {
+      a.push_back(Triplet(StateVar<N>(s, k), StateVar<N>(s, k), 1));
+    }
+  }
+  for (size_t k = 0; k + 1 < N; k++) {
+    for (size_t s = 0; s < 6; s++) {
+      for (size_t t = 0; t < 6; t++) {
+        a.push_back(Triplet(StateVar<N>(s, k + 1), StateVar<N>(t, k), 0));
+      }
+      for (size_t j = 0; j < 2; j++) {
+        a.push_back(Triplet(StateVar<N>(s, k + 1), InputVar<N>(j, k), 0));
+      }
+    }
+  }
+  for (size_t j = 0; j < 2; j++) {
+    for (size_t k = 0; k < N - 1; k++) {
+      size_t i = InputVar<N>(j, k);
+      a.push_back(Triplet(i, i, 1));
+      l_(i) = j == 0 ? -max_delta : -max_a;
+      u_(i) = j == 0 ? max_delta : max_a;
+    }
+  }
+  A_.resize(n_rows, n_w);
+  A_.setFromTriplets(a.begin(), a.end());
+  A_.makeCompressed();
+  SetWeights(default_weights);
+}
+
+template <size_t N>
+ADMM<N>::~ADMM() {}
+
+template <size_t N>
+void ADMM<N>::SetWeights(const Weights& weights) {
+  typedef Eigen::Triplet<double> Triplet;
+  weights_ = weights;
+  const double w_state[6] = { 0, 0, 0, weights_.v, weights_.cte, weights_.epsi };
+  const double w_input[2] = { weights_.delta, weights_.a };
+  const double w_rate[2] = { weights_.ddelta, weights_.da };
+
+  // Constant cost Hessian; duplicate entries are summed.
+  std::vector<Triplet> p;
+  for (size_t k = 0; k < N; k++) {
+    for (size_t s = 0; s < 6; s++) {
+      p.push_back(Triplet(StateVar<N>(s, k), StateVar<N>(s, k), 2 * w_state[s] + sigma));
+    }
+  }
+  for (size_t j = 0; j < 2; j++) {
+    for (size_t k = 0; k < N - 1; k++) {
+      size_t i = InputVar<N>(j, k);
+      p.push_back(Triplet(i, i, 2 * w_input[j] + sigma));
+    }
+    for (size_t k = 0; k + 2 < N; k++) {
+      size_t i0 = InputVar<N>(j, k);
+      size_t i1 = InputVar<N>(j, k + 1);
+      p.push_back(Triplet(i0, i0, 2 * w_rate[j]));
+      p.push_back(Triplet(i1, i1, 2 * w_rate[j]));
+      p.push_back(Triplet(i0, i1, -2 * w_rate[j]));
+      p.push_back(Triplet(i1, i0, -2 * w_rate[j]));
+    }
+  }
+  // The terminal cost, its entries kept when zero so that the pattern of
+  // the factorization stays that of the symbolic analysis.
+  for (size_t i = 0; i < n_terminal; i++) {
+    for (size_t j = 0; j < n_terminal; j++) {
+      p.push_back(Triplet(TerminalVar<N>(i), TerminalVar<N>(j), 2 * terminal_(i, j)));
+    }
+  }
+  P_sigma_.resize(n_w, n_w);
+  P_sigma_.setFromTriplets(p.begin(), p.end());
+
+  ReferenceCost();
+}
+
+template <size_t N>
+void ADMM<N>::SetTerminalCost(const TerminalMatrix& cost) {
+  terminal_ = cost;
+  SetWeights(weights_);
+}
+
+template <size_t N>
+void ADMM<N>::SetReference(double cte_ref, double epsi_ref, double v_ref) {
+  xref_.row(3).setConstant(v_ref);
+  xref_.row(4).setConstant(cte_ref);
+  xref_.row(5).setConstant(epsi_ref);
+  ReferenceCost();
+}
+
+template <size_t N>
+void ADMM<N>::SetStageReference(const double* cte_ref, const double* epsi_ref, const double* v_ref) {
+  for (size_t k = 0; k < N; k++) {
+    xref_(3, k) = v_ref[k];
+    xref_(4, k) = cte_ref[k];
+    xref_(5, k) = epsi_ref[k];
+  }
+  ReferenceCost();
+}
+
+template <size_t N>
+void ADMM<N>::ReferenceCost() {
+  for (size_t k = 0; k < N; k++) {
+    q_(StateVar<N>(3, k)) = -2 * weights_.v * xref_(3, k);
+    q_(StateVar<N>(4, k)) = -2 * weights_.cte * xref_(4, k);
+    q_(StateVar<N>(5, k)) = -2 * weights_.epsi * xref_(5, k);
+  }
+  // The actuators of the terminal cost have no reference, nor any other
+  // linear term.
+  Eigen::Matrix<double, n_terminal, 1> ref;
+  ref << xref_(4, N - 1), xref_(5, N - 1), xref_(3, N - 1), 0, 0;
+  Eigen::Matrix<double, n_terminal, 1> linear = -2 * terminal_ * ref;
+  for (size_t i = 0; i < n_terminal; i++) {
+    q_(TerminalVar<N>(i)) = (i < 3 ? q_(TerminalVar<N>(i)) : 0) + linear(i);
+  }
+}
+
+template <size_t N>
+void ADMM<N>::SetMixedPrecision(int refinements) {
+  refinements_ = std::max(refinements, 0);
+  analyzed_ = false;
+}
+
+template <size_t N>
+void ADMM<N>::Reset() {
+  initialized_ = false;
+}
+
+template <size_t N>
+void ADMM<N>::Rollout(const StateVector& x0) {
+  X_.col(0) = x0;
+  for (size_t k = 0; k < N - 1; k++) {
+    model_.Stage(k).Step(X_.col(k).data(), U_.data() + 2 * k, coeffs_, X_.col(k + 1).data());
+  }
+}
+
+template <size_t N>
+void ADMM<N>::Setup(const StateVector& x0) {
+  // Linearized dynamics along the simulated plan:
+  // x_{k+1} - A x_k - B u_k = xs_{k+1} - A xs_k - B us_k.
+  KinematicModel::StateJacobian As[N - 1];
+  KinematicModel::InputJacobian Bs[N - 1];
+  KinematicModel::CoeffJacobian Es[N - 1];
+  LinearizeStages(model_, N - 1, X_, U_.data(), coeffs_, As, Bs, Es, discretization_);
+  for (size_t k = 0; k + 1 < N; k++) {
+    const KinematicModel::StateJacobian& A = As[k];
+    const KinematicModel::InputJacobian& B = Bs[k];
+    Eigen::Matrix<double, 6, 1> c = X_.col(k + 1);
+    c.noalias() -= A * X_.col(k);
+    c.noalias() -= B * U_.template segment<2>(2 * k);
+    for (size_t s = 0; s < 6; s++) {
+      size_t row = StateVar<N>(s, k + 1);
+      for (size_t t = 0; t < 6; t++) {
+        A_.coeffRef(row, StateVar<N>(t, k)) = -A(s, t);
+      }
+      for (size_t j = 0; j < 2; j++) {
+        A_.coeffRef(row, InputVar<N>(j, k)) = -B(s, j);
+      }
+      l_(row) = c(s);
+      u_(row) = c(s);
+    }
+  }
+  for (size_t s = 0; s < 6; s++) {
+    l_(StateVar<N>(s, 0)) = x0(s);
+    u_(StateVar<N>(s, 0)) = x0(s);
+  }
+
+  // Warm start: the simulated plan, and the multipliers of the last
+  // frame one stage later.
+  for (size_t k = 0; k < N; k++) {
+    for (size_t s = 0; s < 6; s++) {
+      w_(StateVar<N>(s, k)) = X_(s, k);
+    }
+  }
+  for (size_t k = 0; k + 1 < N; k++) {
+    for (size_t j = 0; j < 2; j++) {
+      w_(InputVar<N>(j, k)) = U_(2 * k + j);
+    }
+  }
+  if (initialized_) {
+    for (size_t s = 0; s < 6; s++) {
+      for (size_t k = 0; k + 1 < N; k++) {
+        y_(StateVar<N>(s, k)) = y_(StateVar<N>(s, k + 1));
+      }
+    }
+    for (size_t j = 0; j < 2; j++) {
+      for (size_t k = 0; k + 2 < N; k++) {
+        y_(InputVar<N>(j, k)) = y_(InputVar<N>(j, k + 1));
+      }
+    }
+  } else {
+    y_.setZero();
+  }
+  z_ = (A_ * w_).cwiseMax(l_).cwiseMin(u_);
+}
+
+template <size_t N>
+void ADMM<N>::Factorize() {
+  for (size_t i = 0; i < n_rows; i++) {
+    rho_rows_(i) = l_(i) == u_(i) ? eq_scale * rho_ : rho_;
+  }
+  SparseMatrix AtR = A_.transpose() * rho_rows_.asDiagonal();
+  M_ = P_sigma_ + AtR * A_;
+  if (refinements_ > 0) {
+    M_f_ = M_.cast<float>();
+    if (!analyzed_) {
+      ldlt_f_.analyzePattern(M_f_);
+      analyzed_ = true;
+    }
+    ldlt_f_.factorize(M_f_);
+    return;
+  }
+  if (!analyzed_) {
+    ldlt_.analyzePattern(M_);
+    analyzed_ = true;
+  }
+  ldlt_.factorize(M_);
+}
+
+// Overwrite x with the solution of M_ x = x.
+template <size_t N>
+void ADMM<N>::SolveKKT(Eigen::VectorXd& x) {
+  if (refinements_ == 0) {
+    x = ldlt_.solve(x);
+    return;
+  }
+  kkt_rhs_ = x;
+  kkt_f_ = x.cast<float>();
+  kkt_f_ = ldlt_f_.solve(kkt_f_);
+  x = kkt_f_.cast<double>();
+  for (int r = 0; r < refinements_; r++) {
+    kkt_f_ = (kkt_rhs_ - M_ * x).cast<float>();
+    kkt_f_ = ldlt_f_.solve(kkt_f_);
+    x += kkt_f_.cast<double>();
+  }
+}
+
+template <size_t N>
+void ADMM<N>::SolveQP() {
+  iterations_ = 0;
+  converged_ = false;
+  for (int it = 0; it < max_iterations; it++) {
+    rhs_ = rho_rows_.cwiseProduct(z_) - y_;
+    w_tilde_ = A_.transpose() * rhs_;
+    w_tilde_ += sigma * w_ - q_;
+    SolveKKT(w_tilde_);
+    z_tilde_ = A_ * w_tilde_;
+
+    w_ = alpha * w_tilde_ + (1 - alpha) * w_;
+    z_tilde_ = alpha * z_tilde_ + (1 - alpha) * z_;
+    z_ = (z_tilde_ + y_.cwiseQuotient(rho_rows_)).cwiseMax(l_).cwiseMin(u_);
+    y_ += rho_rows_.cwiseProduct(z_tilde_ - z_);
+    iterations_++;
+
+    // Primal and dual residuals against their scaled tolerances.
+    Aw_ = A_ * w_;
+    Eigen::VectorXd Pw = P_sigma_ * w_ - sigma * w_;
+    Eigen::VectorXd Aty = A_.transpose() * y_;
+    double prim = (Aw_ - z_).template lpNorm<Eigen::Infinity>();
+    double dual = (Pw + q_ + Aty).template lpNorm<Eigen::Infinity>();
+    double prim_scale = std::max(Aw_.template lpNorm<Eigen::Infinity>(), z_.template lpNorm<Eigen::Infinity>());
+    double dual_scale = std::max(std::max(Pw.template lpNorm<Eigen::Infinity>(), Aty.template lpNorm<Eigen::Infinity>()),
+                                 q_.template lpNorm<Eigen::Infinity>());
+    if (prim <= eps_abs + eps_rel * prim_scale && dual <= eps_abs + eps_rel * dual_scale) {
+      converged_ = true;
+      break;
+    }
+
+    // Balance the residuals; refactor only for a significant change.
+    if ((it + 1) % rho_interval == 0) {
+      double ratio = sqrt((prim / std::max(prim_scale, 1e-12)) / std::max(dual / std::max(dual_scale, 1e-12), 1e-12));
+      double rho = std::min(std::max(rho_ * ratio, 1e-6), 1e6);
+      if (rho > rho_change * rho_ || rho < rho_ / rho_change) {
+        rho_ = rho;
+        Factorize();
+      }
+    }
+  }
+}
+
+template <size_t N>
+double ADMM<N>::Feedback(const StateVector& state, const Eigen::Vector4d& coeffs) {
+  if (initialized_) {
+    // The previous plan, one stage later.
+    for (size_t i = 0; i + 2 < n_u; i++) {
+      U_(i) = U_(i + 2);
+    }
+  } else {
+    U_.setZero();
+  }
+  coeffs_ = coeffs;
+  Rollout(state);
+  Setup(state);
+  Factorize();
+  SolveQP();
+
+  // ADMM meets the bounds only up to its tolerance.
+  for (size_t k = 0; k + 1 < N; k++) {
+    for (size_t j = 0; j < 2; j++) {
+      size_t i = InputVar<N>(j, k);
+      U_(2 * k + j) = std::min(std::max(w_(i), l_(i)), u_(i));
+    }
+  }
+  Rollout(state);
+  initialized_ = true;
+  return Cost();
+}
+
+template <size_t N>
+double ADMM<N>::Cost() const {
+  double cost = 0;
+  for (size_t k = 0; k < N; k++) {
+    cost += weights_.cte * pow(X_(4, k) - xref_(4, k), 2);
+    cost += weights_.epsi * pow(X_(5, k) - xref_(5, k), 2);
+    cost += weights_.v * pow(X_(3, k) - xref_(3, k), 2);
+  }
+  for (size_t k = 0; k < N - 1; k++) {
+    cost += weights_.delta * pow(U_(2 * k), 2);
+    cost += weights_.a * pow(U_(2 * k + 1), 2);
+  }
+  for (size_t k = 0; k < N - 2; k++) {
+    cost += weights_.ddelta * pow(U_(2 * k + 2) - U_(2 * k), 2);
+    cost += weights_.da * pow(U_(2 * k + 3) - U_(2 * k + 1), 2);
+  }
+  Eigen::Matrix<double, n_terminal, 1> e;
+  e << X_(4, N - 1) - xref_(4, N - 1), X_(5, N - 1) - xref_(5, N - 1), X_(3, N - 1) - xref_(3, N - 1),
+      U_(2 * (N - 2)), U_(2 * (N - 2) + 1);
+  cost += e.dot(terminal_ * e);
+  return cost;
+}
+
+#define INSTANTIATE(N) template class ADMM<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -0,0 +1,153 @@
+#ifndef ADMM_H
+#define ADMM_H
+
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/SparseCore"
+#include "Eigen-3.3/Eigen/SparseCholesky"
+#include "KinematicModel.h"
+#include "Layout.h"
+#include "TerminalCost.h"
+#include "Tuning.h"
+
+// Gauss-Newton SQP for the kinematic model of FG_eval with the sparse QP
+// solved by an OSQP-style ADMM.
+//
+// Each feedback step shifts the last actuator plan, simulates it from the
+// measured state and linearizes the model along it. The QP keeps all
+// states and actuators of the horizon as variables, in the order of
+// Layout<N>, with the linearized dynamics as equality rows and the
+// actuator bounds as box rows:
+//
+//   min 0.5 w' P w + q' w   subject to   l <= A w <= u
+//
+// Every ADMM iteration is one solve with the factorization of
+// P + sigma I + A' diag(rho) A. Its sparsity never changes, so the
+// symbolic analysis is done once; the numeric factorization is redone
+// once per frame for the new linearization, and within a frame only when
+// rho is adapted. The iterate is warm started from the simulated plan
+// and the shifted multipliers of the previous frame.
+//
+// With mixed precision the factorization and its solves are in float,
+// and each solve is refined against the double-precision matrix (see
+// SetMixedPrecision).
+template <size_t N>
+class ADMM {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef Layout<N> L;
+  enum : int { n_u = L::n_inputs, n_w = L::n_vars, n_rows = L::n_constraints + L::n_inputs };
+
+  typedef Eigen::Matrix<double, 6, N> StateMatrix;
+  typedef Eigen::Matrix<double, n_u, 1> InputVector;
+
+  ADMM(double dt, double Lf);
+
+  virtual ~ADMM();
+
+  void SetReference(double cte_ref, double epsi_ref, double v_ref);
+
+  // References of every stage, N values each (see RTI::SetStageReference).
+  void SetStageReference(const double* cte_ref, const double* epsi_ref, const double* v_ref);
+
+  // Cost weights; default_weights until set.
+  void SetWeights(const Weights& weights);
+
+  // Terminal cost of the last stage (see TerminalCost.h), none (zero)
+  // until set.
+  void SetTerminalCost(const TerminalMatrix& cost);
+
+  // Time step of the first stage and growth of the later ones (see
+  // KinematicModel), the step of the constructor and 1 until set. Takes
+  // effect from the next feedback step; Reset first to drop the plan.
+  void SetTimestep(double dt, double growth = 1) {
+    model_.dt = dt;
+    model_.growth = growth;
+  }
+
+  // Understeer of the model (see YawGain, Kinematics.h), 0 until set.
+  void SetUndersteer(double understeer) { model_.understeer = understeer; }
+
+  // Factor P + sigma I + A' diag(rho) A in float and follow each solve
+  // with it by refinements corrections for the residual, taken in double.
+  // 0, the default, factors in double.
+  void SetMixedPrecision(int refinements);
+
+  // Perform one SQP step from initial state [x, y, psi, v, cte, epsi]
+  // and polynomial coefficients. Returns the cost of the new plan.
+  double Feedback(const StateVector& state, const Eigen::Vector4d& coeffs);
+
+  // Actuator plan, [delta_0, a_0, delta_1, a_1, ...].
+  const InputVector& Inputs() const { return U_; }
+
+  // State plan, one stage of [x, y, psi, v, cte, epsi] per column.
+  const StateMatrix& States() const { return X_; }
+
+  // ADMM iterations of the last feedback step, and whether they met the
+  // tolerances.
+  int Iterations() const { return iterations_; }
+  bool Converged() const { return converged_; }
+
+  void Reset();
+
+ private:
+  typedef Eigen::SparseMatrix<double> SparseMatrix;
+  typedef Eigen::SparseMatrix<float> InnerMatrix;
+
+  KinematicModel model_;
+
+  // Reference state of every stage; only v, cte and epsi are set.
+  StateMatrix xref_;
+  Weights weights_;
+  TerminalMatrix terminal_;
+
+  bool initialized_;
+  bool analyzed_;
+  int iterations_;
+  bool converged_;
+
+  StateMatrix X_;
+  InputVector U_;
+  Eigen::Vector4d coeffs_;
+  // Exponentials of the stages (see BasicDiscretization).
+  KinematicModel::Discretization discretization_[N - 1];
+
+  // QP data. P_sigma_ is P + sigma I.
+  SparseMatrix P_sigma_;
+  SparseMatrix A_;
+  SparseMatrix M_;
+  Eigen::VectorXd q_;
+  Eigen::VectorXd l_;
+  Eigen::VectorXd u_;
+  Eigen::SimplicialLDLT<SparseMatrix> ldlt_;
+
+  // Mixed precision: M_ and its factor in float, and the right-hand side
+  // and residual of the refinements.
+  int refinements_;
+  InnerMatrix M_f_;
+  Eigen::SimplicialLDLT<InnerMatrix> ldlt_f_;
+  Eigen::VectorXd kkt_rhs_;
+  Eigen::VectorXf kkt_f_;
+
+  // ADMM iterate and step sizes.
+  double rho_;
+  Eigen::VectorXd rho_rows_;
+  Eigen::VectorXd w_;
+  Eigen::VectorXd z_;
+  Eigen::VectorXd y_;
+  Eigen::VectorXd w_tilde_;
+  Eigen::VectorXd z_tilde_;
+  Eigen::VectorXd rhs_;
+  Eigen::VectorXd Aw_;
+
+  void Rollout(const StateVector& x0);
+  void Setup(const StateVector& x0);
+  void Factorize();
+  void SolveKKT(Eigen::VectorXd& x);
+  void SolveQP();
+  // The linear cost terms of the references.
+  void ReferenceCost();
+  double Cost() const;
+};
+
+#endif /* ADMM_H */
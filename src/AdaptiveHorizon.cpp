@@ -0,0 +1,111 @@
+#include "AdaptiveHorizon.h"
+#include <math.h>
+#include <algorithm>
+
+// Speeds at which the horizons change, one band per horizon.
+static const double band_speed = 25;
+static const double speed_hysteresis = 3;
+
+// Curvature of the reference from which a turn is tight, 1/m, and the
+// fraction of it below which it no longer is.
+static const double tight_curvature = 0.02;
+static const double tight_release = 0.75;
+
+// Time step in a tight turn, relative to the usual one.
+static const double tight_dt_scale = 0.75;
+
+// A horizon is kept this many frames before the next change, unless its
+// solves overrun.
+static const size_t min_hold = 20;
+
+// Fractions of the budget above which the horizon steps down and below
+// which a longer one is tried.
+static const double high_load = 0.8;
+static const double low_load = 0.5;
+
+// Weight of a new solve time.
+static const double solve_alpha = 0.2;
+
+size_t HorizonIndex(size_t horizon) {
+  for (size_t i = 0; i < n_horizons; i++) {
+    if (mpc_horizons[i] == horizon) {
+      return i;
+    }
+  }
+  return n_horizons;
+}
+
+HorizonPolicy::HorizonPolicy(double budget, size_t initial, double dt)
+    : budget_(budget), initial_(HorizonIndex(initial)), dt_(dt) {
+  Reset();
+}
+
+void HorizonPolicy::Reset() {
+  current_ = initial_;
+  speed_index_ = initial_;
+  ceiling_ = n_horizons - 1;
+  tight_ = false;
+  held_ = 0;
+  std::fill(solve_time_, solve_time_ + n_horizons, 0.0);
+}
+
+double HorizonPolicy::Expected(size_t i) const {
+  if (solve_time_[i] > 0) {
+    return solve_time_[i];
+  }
+  // Scale the nearest measured horizon's time with the square of the
+  // horizon, in between the linear stage-wise solvers and Ipopt.
+  for (size_t d = 1; d < n_horizons; d++) {
+    size_t j = n_horizons;
+    if (i >= d && solve_time_[i - d] > 0) {
+      j = i - d;
+    } else if (i + d < n_horizons && solve_time_[i + d] > 0) {
+      j = i + d;
+    }
+    if (j < n_horizons) {
+      double r = double(mpc_horizons[i]) / mpc_horizons[j];
+      return solve_time_[j] * r * r;
+    }
+  }
+  return 0;
+}
+
+HorizonChoice HorizonPolicy::Choose(double v, double curvature) {
+  while (speed_index_ + 1 < n_horizons && v > band_speed * (speed_index_ + 1) + speed_hysteresis) {
+    speed_index_++;
+  }
+  while (speed_index_ > 0 && v < band_speed * speed_index_ - speed_hysteresis) {
+    speed_index_--;
+  }
+  curvature = fabs(curvature);
+  if (curvature > tight_curvature) {
+    tight_ = true;
+  } else if (curvature < tight_curvature * tight_release) {
+    tight_ = false;
+  }
+
+  bool overrun = Expected(current_) > budget_ * high_load;
+  if (overrun) {
+    ceiling_ = current_ > 0 ? current_ - 1 : 0;
+  } else if (ceiling_ + 1 < n_horizons && Expected(ceiling_ + 1) < budget_ * low_load) {
+    ceiling_++;
+  }
+
+  size_t wanted = std::min(std::min(speed_index_ + (tight_ ? 1 : 0), n_horizons - 1), ceiling_);
+  held_++;
+  if (wanted != current_ && ((overrun && wanted < current_) || held_ >= min_hold)) {
+    current_ = wanted;
+    held_ = 0;
+  }
+  HorizonChoice choice = { mpc_horizons[current_], tight_ ? dt_ * tight_dt_scale : dt_ };
+  return choice;
+}
+
+void HorizonPolicy::Solved(size_t horizon, double seconds) {
+  size_t i = HorizonIndex(horizon);
+  if (i == n_horizons) {
+    return;
+  }
+  double& t = solve_time_[i];
+  t = t > 0 ? t + solve_alpha * (seconds - t) : seconds;
+}
@@ -0,0 +1,60 @@
+#ifndef ADAPTIVE_HORIZON_H
+#define ADAPTIVE_HORIZON_H
+
+#include <stddef.h>
+#include "Layout.h"
+
+// Run-time choice of the horizon and time step of the next solve among the
+// compiled horizons (MPC_FOR_EACH_HORIZON).
+//
+// The speed picks the horizon: faster needs more stages to look as far
+// ahead in distance, slower wastes them. A tight turn of the reference
+// takes one horizon longer and a finer step. The measured solve times cap
+// the horizon so that solves stay within the budget: an overrun steps down
+// at once, and a longer horizon is only tried again when its expected
+// solve time leaves ample headroom. Every boundary has hysteresis and a
+// horizon is held for some frames before the next change, since the new
+// solver starts cold.
+struct HorizonChoice {
+  size_t horizon;
+  double dt;
+};
+
+class HorizonPolicy {
+ public:
+  // Keep solves within budget seconds, starting from initial, which must
+  // be a compiled horizon, and the time step dt outside tight turns.
+  HorizonPolicy(double budget, size_t initial, double dt);
+
+  // Horizon and step for a frame at speed v whose reference bends with
+  // curvature at the vehicle.
+  HorizonChoice Choose(double v, double curvature);
+
+  // Feed back how long a solve over horizon took, in seconds.
+  void Solved(size_t horizon, double seconds);
+
+  // Forget the solve times and start over from initial.
+  void Reset();
+
+ private:
+  double budget_;
+  size_t initial_;
+  double dt_;
+  // Indices into mpc_horizons.
+  size_t current_;
+  size_t speed_index_;
+  size_t ceiling_;
+  bool tight_;
+  // Frames since the last change of horizon.
+  size_t held_;
+  // Moving average of the solve times of every horizon, 0 until measured.
+  double solve_time_[n_horizons];
+
+  // Expected solve time over horizon index i, 0 when nothing is known.
+  double Expected(size_t i) const;
+};
+
+// Index of horizon in mpc_horizons, or n_horizons if it was not compiled.
+size_t HorizonIndex(size_t horizon);
+
+#endif /* ADAPTIVE_HORIZON_H */
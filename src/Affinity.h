@@ -0,0 +1,110 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <algorithm>
+#include <thread>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#endif
+
+// Pin a thread to one CPU, taken modulo the number of CPUs. Returns false
+// when the platform has no thread affinity or refuses it.
+inline bool PinThread(std::thread::native_handle_type thread, int cpu) {
+#ifdef __linux__
+  int n_cpus = std::max(int(std::thread::hardware_concurrency()), 1);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % n_cpus, &set);
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+  (void)thread;
+  (void)cpu;
+  return false;
+#endif
+}
+
+// Pin the calling thread.
+inline bool PinCurrentThread(int cpu) {
+#ifdef __linux__
+  return PinThread(pthread_self(), cpu);
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+// The NUMA node of a CPU, from the nodeN entry sysfs lists for it, or -1
+// when unknown.
+inline int CpuNode(int cpu) {
+#ifdef __linux__
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR* dir = opendir(path);
+  if (!dir) {
+    return -1;
+  }
+  int node = -1;
+  while (dirent* entry = readdir(dir)) {
+    if (sscanf(entry->d_name, "node%d", &node) == 1) {
+      break;
+    }
+    node = -1;
+  }
+  closedir(dir);
+  return node;
+#else
+  (void)cpu;
+  return -1;
+#endif
+}
+
+// The NUMA node of the CPU the calling thread runs on, or -1.
+inline int CurrentNode() {
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  return cpu < 0 ? -1 : CpuNode(cpu);
+#else
+  return -1;
+#endif
+}
+
+// Run a thread under SCHED_FIFO at priority (1 to 99), so that it preempts
+// every ordinary thread of its CPU as soon as it is runnable. Needs
+// CAP_SYS_NICE or an rtprio limit; returns false when refused.
+inline bool SetThreadRealtime(std::thread::native_handle_type thread, int priority) {
+#ifdef __linux__
+  sched_param param;
+  param.sched_priority = priority;
+  return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+#else
+  (void)thread;
+  (void)priority;
+  return false;
+#endif
+}
+
+inline bool SetCurrentRealtime(int priority) {
+#ifdef __linux__
+  return SetThreadRealtime(pthread_self(), priority);
+#else
+  (void)priority;
+  return false;
+#endif
+}
+
+// Lock every page of the process, present and future, into memory, so
+// that no frame waits for a page fault. Needs CAP_IPC_LOCK or a large
+// enough memlock limit.
+inline bool LockMemory() {
+#ifdef __linux__
+  return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#else
+  return false;
+#endif
+}
+
+#endif /* AFFINITY_H */
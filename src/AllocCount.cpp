@@ -0,0 +1,189 @@
+#include "AllocCount.h"
+#include <string.h>
+
+#ifdef MPC_COUNT_ALLOCS
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Threads beyond this many share the last slot.
+static const int max_slots = 256;
+
+// The counts of one thread. Counted with atomic adds, as the last slot is
+// shared, on a cache line of its own.
+struct alignas(64) AllocSlot {
+  std::atomic<uint64_t> count[n_stages + 1];
+  std::atomic<uint64_t> bytes[n_stages + 1];
+};
+
+// Zero-initialized before any constructor runs, so allocations made
+// during static initialization count as well.
+static AllocSlot slots[max_slots];
+static std::atomic<int> n_slots(0);
+
+// Initial-exec TLS, which never allocates when touched: the counting runs
+// inside malloc.
+#define MPC_ALLOC_TLS static thread_local __attribute__((tls_model("initial-exec")))
+MPC_ALLOC_TLS int thread_slot = -1;
+MPC_ALLOC_TLS int thread_stage = n_stages;
+
+static void Count(size_t size) {
+  if (thread_slot < 0) {
+    int slot = n_slots.fetch_add(1, std::memory_order_relaxed);
+    thread_slot = slot < max_slots ? slot : max_slots - 1;
+  }
+  AllocSlot& slot = slots[thread_slot];
+  slot.count[thread_stage].fetch_add(1, std::memory_order_relaxed);
+  slot.bytes[thread_stage].fetch_add(size, std::memory_order_relaxed);
+}
+
+static uint64_t SlotTotal(const AllocSlot& slot) {
+  uint64_t total = 0;
+  for (int s = 0; s <= n_stages; s++) {
+    total += slot.count[s].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+size_t AllocCount() {
+  int n = std::min(n_slots.load(std::memory_order_relaxed), max_slots);
+  uint64_t total = 0;
+  for (int i = 0; i < n; i++) {
+    total += SlotTotal(slots[i]);
+  }
+  return size_t(total);
+}
+
+size_t ThreadAllocCount() {
+  return thread_slot < 0 ? 0 : size_t(SlotTotal(slots[thread_slot]));
+}
+
+StageAllocs AllocsByStage() {
+  StageAllocs allocs;
+  memset(&allocs, 0, sizeof(allocs));
+  int n = std::min(n_slots.load(std::memory_order_relaxed), max_slots);
+  for (int i = 0; i < n; i++) {
+    for (int s = 0; s <= n_stages; s++) {
+      allocs.count[s] += slots[i].count[s].load(std::memory_order_relaxed);
+      allocs.bytes[s] += slots[i].bytes[s].load(std::memory_order_relaxed);
+    }
+  }
+  return allocs;
+}
+
+AllocScope::AllocScope(Stage stage) : previous_(thread_stage) {
+  thread_stage = int(stage);
+}
+
+AllocScope::~AllocScope() {
+  thread_stage = previous_;
+}
+
+void AllocScope::Switch(Stage stage) {
+  thread_stage = int(stage);
+}
+
+#ifdef __GLIBC__
+// With glibc the C allocator is interposed as well, on top of its own
+// entry points, and operator new counts through malloc.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size) {
+  Count(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+  Count(n * size);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) {
+  Count(size);
+  return __libc_realloc(p, size);
+}
+}
+
+static void* Allocate(size_t size) {
+  return std::malloc(size ? size : 1);
+}
+#else
+static void* Allocate(size_t size) {
+  Count(size);
+  return std::malloc(size ? size : 1);
+}
+#endif
+
+void* operator new(size_t size) {
+  void* p = Allocate(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+
+// C++14 sized deallocation.
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  std::free(p);
+}
+
+#else
+
+size_t AllocCount() {
+  return 0;
+}
+
+size_t ThreadAllocCount() {
+  return 0;
+}
+
+StageAllocs AllocsByStage() {
+  StageAllocs allocs;
+  memset(&allocs, 0, sizeof(allocs));
+  return allocs;
+}
+
+AllocScope::AllocScope(Stage) : previous_(0) {}
+
+AllocScope::~AllocScope() {}
+
+void AllocScope::Switch(Stage) {}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Metrics.h"
+
+// Heap allocations, counted per thread and per stage of the pipeline.
+//
+// Counting is compiled in with -DMPC_COUNT_ALLOCS (cmake -DMPC_COUNT_ALLOCS=ON),
+// which replaces the global allocation functions, and with glibc malloc,
+// calloc and realloc as well, so the allocations of Ipopt and its linear
+// solvers count too. Every thread counts into a slot of its own, under the
+// stage of its innermost AllocScope. Otherwise all counts are 0, and
+// checks built on them pass trivially.
+
+// Allocations made so far, by all threads and by the calling thread.
+size_t AllocCount();
+size_t ThreadAllocCount();
+
+// Allocations and bytes requested by all threads, by stage; the last
+// entry holds those made outside any AllocScope.
+struct StageAllocs {
+  uint64_t count[n_stages + 1];
+  uint64_t bytes[n_stages + 1];
+};
+
+StageAllocs AllocsByStage();
+
+// Count the allocations of the calling thread under stage until Switch
+// or the end of the scope, which restores the stage before it.
+class AllocScope {
+ public:
+  explicit AllocScope(Stage stage);
+  ~AllocScope();
+
+  void Switch(Stage stage);
+
+ private:
+  int previous_;
+};
+
+#endif /* ALLOC_COUNT_H */
@@ -0,0 +1,357 @@
+#include "AsyncFile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "Logger.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MPC_IO_URING 1
+#endif
+#endif
+
+#ifdef MPC_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+
+#ifdef MPC_IO_URING
+
+// The system calls, which the C library does not wrap.
+static int RingSetup(unsigned entries, io_uring_params* params) {
+  return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int RingEnter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+  return int(syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0));
+}
+
+static int RingRegister(int fd, unsigned opcode, const void* arg, unsigned n) {
+  return int(syscall(__NR_io_uring_register, fd, opcode, arg, n));
+}
+
+struct AsyncFile::Ring {
+  int fd;
+  // The submission and completion rings and the submission entries, as
+  // mapped; the rings share a mapping with IORING_FEAT_SINGLE_MMAP.
+  void* sq_map;
+  size_t sq_size;
+  void* cq_map;
+  size_t cq_size;
+  io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  io_uring_cqe* cqes;
+
+  // Whether the buffers are registered, for IORING_OP_WRITE_FIXED, or
+  // written from with IORING_OP_WRITEV.
+  bool fixed;
+  char* buffers;
+  // Of every buffer: its bytes, where they go in the file and how many of
+  // them are written; the rest of the buffer for WRITEV.
+  size_t length[n_buffers];
+  uint64_t at[n_buffers];
+  size_t written[n_buffers];
+  iovec rest[n_buffers];
+  vector<size_t> spare;
+  // Entries queued and not yet submitted, and writes in flight.
+  unsigned queued;
+  unsigned in_flight;
+
+  Ring()
+      : fd(-1), sq_map(MAP_FAILED), sq_size(0), cq_map(MAP_FAILED), cq_size(0), sqes(NULL), sqes_size(0),
+        fixed(false), buffers(NULL), queued(0), in_flight(0) {}
+
+  ~Ring() {
+    if (sqes) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_map != MAP_FAILED && cq_map != sq_map) {
+      munmap(cq_map, cq_size);
+    }
+    if (sq_map != MAP_FAILED) {
+      munmap(sq_map, sq_size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    free(buffers);
+  }
+
+  bool Map() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = RingSetup(n_buffers, &params);
+    if (fd < 0) {
+      return false;
+    }
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+      sq_size = cq_size = max(sq_size, cq_size);
+    }
+    sq_map = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+      return false;
+    }
+    cq_map = single ? sq_map
+                    : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_map == MAP_FAILED) {
+      return false;
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* entries = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (entries == MAP_FAILED) {
+      return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(entries);
+    char* sq = static_cast<char*>(sq_map);
+    char* cq = static_cast<char*>(cq_map);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    void* memory;
+    if (posix_memalign(&memory, 4096, n_buffers * buffer_size) != 0) {
+      return false;
+    }
+    buffers = static_cast<char*>(memory);
+    iovec iov[n_buffers];
+    for (size_t i = 0; i < n_buffers; i++) {
+      iov[i].iov_base = buffers + i * buffer_size;
+      iov[i].iov_len = buffer_size;
+      spare.push_back(n_buffers - 1 - i);
+    }
+    fixed = RingRegister(fd, IORING_REGISTER_BUFFERS, iov, n_buffers) == 0;
+    return true;
+  }
+
+  // Queue a write of the rest of buffer i to file fd.
+  void Prepare(int file, size_t i) {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe& sqe = sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = file;
+    sqe.off = at[i] + written[i];
+    sqe.user_data = i;
+    char* begin = buffers + i * buffer_size + written[i];
+    size_t left = length[i] - written[i];
+    if (fixed) {
+      sqe.opcode = IORING_OP_WRITE_FIXED;
+      sqe.addr = uint64_t(uintptr_t(begin));
+      sqe.len = unsigned(left);
+      sqe.buf_index = uint16_t(i);
+    } else {
+      rest[i].iov_base = begin;
+      rest[i].iov_len = left;
+      sqe.opcode = IORING_OP_WRITEV;
+      sqe.addr = uint64_t(uintptr_t(&rest[i]));
+      sqe.len = 1;
+    }
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+    in_flight++;
+  }
+};
+
+static bool RingAllowed() {
+  const char* setting = getenv("MPC_IO_URING");
+  return !setting || strcmp(setting, "0") != 0;
+}
+
+#else
+
+struct AsyncFile::Ring {};
+
+#endif
+
+AsyncFile::AsyncFile() : fd_(-1), offset_(0), failed_(false), tried_ring_(false) {}
+
+AsyncFile::~AsyncFile() {
+  Close();
+}
+
+bool AsyncFile::Open(const string& path) {
+  Close();
+  lock_guard<mutex> lock(mutex_);
+#ifdef MPC_IO_URING
+  if (!tried_ring_) {
+    tried_ring_ = true;
+    if (RingAllowed()) {
+      ring_.reset(new Ring);
+      if (!ring_->Map()) {
+        MPC_LOG(LogLevel::Info, "No io_uring (%s), writing logs with pwrite", strerror(errno));
+        ring_.reset();
+      } else if (!ring_->fixed) {
+        MPC_LOG(LogLevel::Info, "Could not register the io_uring buffers of a log, writing from them unregistered");
+      }
+    }
+  }
+#endif
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  offset_ = 0;
+  failed_ = false;
+  return fd_ >= 0;
+}
+
+bool AsyncFile::IsOpen() const {
+  lock_guard<mutex> lock(mutex_);
+  return fd_ >= 0;
+}
+
+bool AsyncFile::Async() const {
+  lock_guard<mutex> lock(mutex_);
+  return bool(ring_);
+}
+
+void AsyncFile::WriteNow(const char* data, size_t length, uint64_t offset) {
+  while (length > 0) {
+    ssize_t n = pwrite(fd_, data, length, off_t(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      failed_ = true;
+      return;
+    }
+    data += n;
+    length -= size_t(n);
+    offset += uint64_t(n);
+  }
+}
+
+void AsyncFile::Write(const char* data, size_t length) {
+  lock_guard<mutex> lock(mutex_);
+  if (fd_ < 0) {
+    return;
+  }
+  if (!ring_) {
+    WriteNow(data, length, offset_);
+    offset_ += length;
+    return;
+  }
+#ifdef MPC_IO_URING
+  while (length > 0) {
+    while (ring_ && ring_->spare.empty()) {
+      Reap(true);
+    }
+    if (!ring_) {
+      WriteNow(data, length, offset_);
+      offset_ += length;
+      return;
+    }
+    Ring& ring = *ring_;
+    size_t i = ring.spare.back();
+    ring.spare.pop_back();
+    size_t n = min(length, size_t(buffer_size));
+    memcpy(ring.buffers + i * buffer_size, data, n);
+    ring.length[i] = n;
+    ring.at[i] = offset_;
+    ring.written[i] = 0;
+    Queue(i);
+    offset_ += n;
+    data += n;
+    length -= n;
+  }
+  // Submit what this write queued, and take what completed meanwhile.
+  Reap(false);
+#endif
+}
+
+void AsyncFile::Queue(size_t i) {
+#ifdef MPC_IO_URING
+  ring_->Prepare(fd_, i);
+#else
+  (void)i;
+#endif
+}
+
+void AsyncFile::Reap(bool wait) {
+#ifdef MPC_IO_URING
+  Ring& ring = *ring_;
+  unsigned head = *ring.cq_head;
+  bool ready = head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+  if (ring.queued > 0 || (wait && !ready)) {
+    bool block = wait && !ready;
+    int submitted = RingEnter(ring.fd, ring.queued, block ? 1 : 0, block ? IORING_ENTER_GETEVENTS : 0);
+    if (submitted < 0 && errno != EINTR) {
+      // The ring is of no use any more: write what it holds here, and the
+      // rest as well.
+      MPC_LOG(LogLevel::Warning, "io_uring failed (%s), writing logs with pwrite", strerror(errno));
+      for (size_t i = 0; i < n_buffers; i++) {
+        if (find(ring.spare.begin(), ring.spare.end(), i) == ring.spare.end()) {
+          WriteNow(ring.buffers + i * buffer_size + ring.written[i], ring.length[i] - ring.written[i],
+                   ring.at[i] + ring.written[i]);
+        }
+      }
+      ring_.reset();
+      return;
+    }
+    if (submitted > 0) {
+      ring.queued -= unsigned(submitted);
+    }
+  }
+  unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const io_uring_cqe& cqe = ring.cqes[head & *ring.cq_mask];
+    size_t i = size_t(cqe.user_data);
+    ring.in_flight--;
+    if (cqe.res < 0) {
+      // Write it here; a failure there is the file's.
+      WriteNow(ring.buffers + i * buffer_size + ring.written[i], ring.length[i] - ring.written[i],
+               ring.at[i] + ring.written[i]);
+      ring.spare.push_back(i);
+    } else if (cqe.res == 0) {
+      failed_ = true;
+      ring.spare.push_back(i);
+    } else if ((ring.written[i] += size_t(cqe.res)) < ring.length[i]) {
+      Queue(i);
+    } else {
+      ring.spare.push_back(i);
+    }
+  }
+  __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+#else
+  (void)wait;
+#endif
+}
+
+bool AsyncFile::Flush() {
+  lock_guard<mutex> lock(mutex_);
+#ifdef MPC_IO_URING
+  while (ring_ && (ring_->in_flight > 0 || ring_->queued > 0)) {
+    Reap(ring_->in_flight > 0);
+  }
+#endif
+  return !failed_;
+}
+
+bool AsyncFile::Close() {
+  bool ok = Flush();
+  lock_guard<mutex> lock(mutex_);
+  if (fd_ >= 0) {
+    ok = close(fd_) == 0 && ok;
+    fd_ = -1;
+  }
+  return ok;
+}
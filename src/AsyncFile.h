@@ -0,0 +1,78 @@
+#ifndef ASYNC_FILE_H
+#define ASYNC_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// A file written from start to end, for the logs and recordings: the
+// telemetry recording (TelemetryLog.h), the columnar log and the flight
+// recorder's dumps (RunLog.h).
+//
+// On Linux the writes go through an io_uring of the file's own, with a
+// fixed set of buffers registered with the kernel: Write copies the bytes
+// into free buffers and queues one write of each at its offset in the
+// file, and the kernel copies them into the page cache while the writer
+// goes on. The thread that writes waits only when every buffer is still
+// in flight, or in Flush. Where io_uring is missing or not allowed (an
+// older kernel, a seccomp filter), or with MPC_IO_URING=0 in the
+// environment, Write writes with pwrite on the calling thread instead,
+// which for the loggers is the background thread of Scheduler.h as it
+// was with stdio. Buffers that cannot be registered, beyond the locked
+// memory limit, are written from as they are.
+//
+// A server that is killed loses the writes in flight, as it lost what
+// stdio had buffered. Every method takes a lock of the file, so any
+// thread may write.
+class AsyncFile {
+ public:
+  // The buffers of a file, and their size; a longer write takes several.
+  enum : size_t { n_buffers = 8, buffer_size = 128 << 10 };
+
+  AsyncFile();
+
+  virtual ~AsyncFile();
+
+  // Create or truncate path, closing the file open before. False when it
+  // cannot be created.
+  bool Open(const std::string& path);
+
+  bool IsOpen() const;
+
+  // Append length bytes of data; they are copied, so data may be reused
+  // as soon as it returns.
+  void Write(const char* data, size_t length);
+
+  // Wait until every write so far has completed, and is in the page
+  // cache as after fflush. False when one failed since the file was
+  // opened.
+  bool Flush();
+
+  // Flush and close; false when a write or the close failed.
+  bool Close();
+
+  // Whether writes go through io_uring.
+  bool Async() const;
+
+ private:
+  struct Ring;
+
+  mutable std::mutex mutex_;
+  int fd_;
+  uint64_t offset_;
+  bool failed_;
+  // The io_uring and its buffers, set up on the first Open, or NULL.
+  std::unique_ptr<Ring> ring_;
+  bool tried_ring_;
+
+  // Write on the calling thread.
+  void WriteNow(const char* data, size_t length, uint64_t offset);
+  // Take the completions there are, or wait for one when wait is set.
+  void Reap(bool wait);
+  // Queue the rest of buffer i for writing.
+  void Queue(size_t i);
+};
+
+#endif /* ASYNC_FILE_H */
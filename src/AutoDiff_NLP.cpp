@@ -0,0 +1,349 @@
+#include "AutoDiff_NLP.h"
+#include <algorithm>
+#include <map>
+#include <math.h>
+#include "Eigen-3.3/unsupported/Eigen/AutoDiff"
+#include "CostResiduals.h"
+#include "Kinematics.h"
+#include "LinearConstraints.h"
+#include "ObstacleConstraints.h"
+#include "Trace.h"
+
+using namespace Ipopt;
+
+namespace Eigen {
+
+// AutoDiffScalar.h has no atan, which KinematicStep takes of the slope of
+// the reference.
+template <typename DerType>
+inline AutoDiffScalar<typename internal::remove_all<DerType>::type::PlainObject>
+atan(const AutoDiffScalar<DerType>& x) {
+  using std::atan;
+  typedef typename internal::traits<typename internal::remove_all<DerType>::type>::Scalar Scalar;
+  return AutoDiffScalar<typename internal::remove_all<DerType>::type::PlainObject>(
+      atan(x.value()), x.derivatives() * (Scalar(1) / (Scalar(1) + x.value() * x.value())));
+}
+
+}  // namespace Eigen
+
+// Scalars carrying the gradient in the eight variables of a stage, and
+// scalars carrying the gradient of those, for the second derivatives.
+typedef Eigen::Matrix<double, 8, 1> StageGradient;
+typedef Eigen::AutoDiffScalar<StageGradient> Dual;
+typedef Eigen::AutoDiffScalar<Eigen::Matrix<Dual, 8, 1> > Dual2;
+
+// Jacobian of the step of the stage variables z = (state, delta, a).
+static void StageJacobian(const BicycleModel<>& model, const double* z, const double* c, double dt,
+                          Eigen::Matrix<double, 6, 8>& jac) {
+  Dual zd[8];
+  for (size_t j = 0; j < 8; j++) {
+    zd[j] = Dual(z[j], 8, j);
+  }
+  Dual next[6];
+  model.Step(zd, zd + 6, c, Dual(dt), next);
+  for (size_t s = 0; s < 6; s++) {
+    jac.row(s) = next[s].derivatives().transpose();
+  }
+}
+
+// Hessian of sum_s lambda[s] f_s(z) of the same step.
+static void StageHessian(const BicycleModel<>& model, const double* z, const double* c, double dt,
+                         const double* lambda, Eigen::Matrix<double, 8, 8>& hes) {
+  Dual2 zd[8];
+  for (size_t j = 0; j < 8; j++) {
+    zd[j].value() = Dual(z[j], 8, j);
+    for (size_t k = 0; k < 8; k++) {
+      zd[j].derivatives()(k) = Dual(j == k ? 1.0 : 0.0);
+    }
+  }
+  Dual2 next[6];
+  model.Step(zd, zd + 6, c, Dual2(dt), next);
+  Dual2 sum = lambda[0] * next[0];
+  for (size_t s = 1; s < 6; s++) {
+    sum += lambda[s] * next[s];
+  }
+  for (size_t j = 0; j < 8; j++) {
+    hes.row(j) = sum.derivatives()(j).derivatives().transpose();
+  }
+}
+
+template <size_t N>
+size_t AutoDiff_NLP<N>::StageVar(size_t i, size_t j) {
+  return j < 6 ? L::State(j, i) : L::Input(j - 6, i);
+}
+
+template <size_t N>
+AutoDiff_NLP<N>::AutoDiff_NLP() {
+  // The nonzeros of a stage are those of its derivatives at a point where
+  // none of them vanishes by chance: no zero angle, actuator or
+  // coefficient, and distinct multipliers.
+  const BicycleModel<> model(Lf, 0.01);
+  const double z[8] = { 0.3, -0.2, 0.37, 7.3, 0.25, -0.11, 0.13, 0.7 };
+  const double c[4] = { 0.5, -0.3, 0.02, -0.004 };
+  const double lambda[6] = { 0.9, -1.3, 0.7, 1.1, -0.6, 1.7 };
+  Eigen::Matrix<double, 6, 8> jac;
+  Eigen::Matrix<double, 8, 8> hes;
+  StageJacobian(model, z, c, 0.1, jac);
+  StageHessian(model, z, c, 0.1, lambda, hes);
+  for (size_t s = 0; s < 6; s++) {
+    for (size_t j = 0; j < n_stage; j++) {
+      if (jac(s, j) != 0) {
+        stage_jac_.push_back(std::make_pair(s, j));
+      }
+    }
+  }
+  for (size_t j = 0; j < n_stage; j++) {
+    for (size_t k = 0; k <= j; k++) {
+      if (hes(j, k) != 0) {
+        stage_hes_.push_back(std::make_pair(j, k));
+      }
+    }
+  }
+
+  // Initial constraints
+  for (size_t s = 0; s < 6; s++) {
+    jac_row_.push_back(L::Row(s, 0));
+    jac_col_.push_back(L::State(s, 0));
+  }
+  // Kinematic constraints, in the order eval_jac_g writes them: for each
+  // row the next state, then the pattern of the stage.
+  for (size_t i = 0; i < N - 1; i++) {
+    for (size_t s = 0; s < 6; s++) {
+      jac_row_.push_back(L::Row(s, i + 1));
+      jac_col_.push_back(L::State(s, i + 1));
+      for (size_t k = 0; k < stage_jac_.size(); k++) {
+        if (stage_jac_[k].first == s) {
+          jac_row_.push_back(L::Row(s, i + 1));
+          jac_col_.push_back(StageVar(i, stage_jac_[k].second));
+        }
+      }
+    }
+  }
+  LinearJacobianStructure<N>(jac_row_, jac_col_);
+  ObstacleJacobianStructure<N>(jac_row_, jac_col_);
+
+  // As in Kernel_NLP, each Hessian entry is stored once.
+  std::map<std::pair<size_t, size_t>, size_t> hes_index;
+  auto AddHes = [&](size_t row, size_t col) {
+    std::pair<size_t, size_t> key(row, col);
+    auto it = hes_index.find(key);
+    if (it != hes_index.end()) {
+      return it->second;
+    }
+    size_t k = hes_row_.size();
+    hes_row_.push_back(row);
+    hes_col_.push_back(col);
+    hes_index[key] = k;
+    return k;
+  };
+
+  // Cost Hessian
+  for (size_t i = 0; i < N; i++) {
+    h_cte_[i] = AddHes(L::cte(i), L::cte(i));
+    h_epsi_[i] = AddHes(L::epsi(i), L::epsi(i));
+    h_v_[i] = AddHes(L::v(i), L::v(i));
+  }
+  for (size_t i = 0; i < N - 1; i++) {
+    h_delta_[i] = AddHes(L::delta(i), L::delta(i));
+    h_a_[i] = AddHes(L::a(i), L::a(i));
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    h_ddelta_[i] = AddHes(L::delta(i + 1), L::delta(i));
+    h_da_[i] = AddHes(L::a(i + 1), L::a(i));
+  }
+  for (size_t i = 0; i < n_terminal; i++) {
+    for (size_t j = i; j < n_terminal; j++) {
+      size_t row, col;
+      TerminalHessianEntry<N>(i, j, row, col);
+      h_terminal_[TerminalEntry(i, j)] = AddHes(row, col);
+    }
+  }
+  // Constraint Hessians. The stage variables are in increasing layout
+  // order, so j >= k is the lower triangle.
+  for (size_t i = 0; i < N - 1; i++) {
+    for (size_t k = 0; k < stage_hes_.size(); k++) {
+      h_stage_.push_back(AddHes(StageVar(i, stage_hes_[k].first), StageVar(i, stage_hes_[k].second)));
+    }
+  }
+  std::vector<size_t> obstacle_row, obstacle_col;
+  ObstacleHessianStructure<N>(obstacle_row, obstacle_col);
+  for (size_t k = 0; k < obstacle_row.size(); k++) {
+    h_obstacle_[k] = AddHes(obstacle_row[k], obstacle_col[k]);
+  }
+
+#ifdef MPC_PARALLEL_STAGES
+  if (N >= parallel_stages_min) {
+    pool_.reset(new Eigen::NonBlockingThreadPool(int(stage_threads - 1)));
+  }
+#endif
+}
+
+template <size_t N>
+AutoDiff_NLP<N>::~AutoDiff_NLP() {}
+
+template <size_t N>
+void AutoDiff_NLP<N>::AddFootprint(Footprint& footprint) const {
+  Kernel_NLP<N>::AddFootprint(footprint);
+  footprint.sparsity_bytes += VectorBytes(stage_jac_) + VectorBytes(stage_hes_) + VectorBytes(jac_row_) +
+                              VectorBytes(jac_col_) + VectorBytes(hes_row_) + VectorBytes(hes_col_) +
+                              VectorBytes(h_stage_);
+}
+
+template <size_t N>
+bool AutoDiff_NLP<N>::get_nlp_info(Index& n, Index& m, Index& nnz_jac_g,
+                                   Index& nnz_h_lag, TNLP::IndexStyleEnum& index_style) {
+  n = L::nlp_vars;
+  m = L::nlp_constraints;
+  nnz_jac_g = jac_row_.size();
+  nnz_h_lag = hes_row_.size();
+  index_style = TNLP::C_STYLE;
+  return true;
+}
+
+template <size_t N>
+bool AutoDiff_NLP<N>::eval_jac_g(Index n, const Number* x, bool new_x, Index m,
+                                 Index nele_jac, Index* iRow, Index* jCol,
+                                 Number* values) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_jac_g");
+  if (values == NULL) {
+    for (Index k = 0; k < nele_jac; k++) {
+      iRow[k] = jac_row_[k];
+      jCol[k] = jac_col_[k];
+    }
+    return true;
+  }
+
+  for (size_t s = 0; s < 6; s++) {
+    values[s] = 1;
+  }
+  EvalStages(x, NULL, values);
+  ObstacleJacobianValues<N>(x, this->params,
+                            LinearJacobianValues<N>(values + 6 + (N - 1) * (6 + stage_jac_.size())));
+  return true;
+}
+
+template <size_t N>
+bool AutoDiff_NLP<N>::eval_h(Index n, const Number* x, bool new_x, Number obj_factor,
+                             Index m, const Number* lambda, bool new_lambda,
+                             Index nele_hess, Index* iRow, Index* jCol,
+                             Number* values) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_h");
+  if (values == NULL) {
+    for (Index k = 0; k < nele_hess; k++) {
+      iRow[k] = hes_row_[k];
+      jCol[k] = hes_col_[k];
+    }
+    return true;
+  }
+
+  for (Index k = 0; k < nele_hess; k++) {
+    values[k] = 0;
+  }
+
+  // The stages first, each on entries of its own; the cost terms add to
+  // some of the same entries. Without the curvature of the constraints
+  // there are only the cost terms (see CostResiduals.h).
+  if (!this->gauss_newton) {
+    EvalStages(x, lambda, values);
+  }
+
+  const Weights w = this->ParamWeights();
+  for (size_t i = 0; i < N; i++) {
+    values[h_cte_[i]] += obj_factor * 2 * w.cte;
+    values[h_epsi_[i]] += obj_factor * 2 * w.epsi;
+    values[h_v_[i]] += obj_factor * 2 * w.v;
+  }
+  for (size_t i = 0; i < N - 1; i++) {
+    double rates = (i > 0 ? 1 : 0) + (i < N - 2 ? 1 : 0);
+    values[h_delta_[i]] += obj_factor * 2 * (w.delta + rates * w.ddelta);
+    values[h_a_[i]] += obj_factor * 2 * (w.a + rates * w.da);
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    values[h_ddelta_[i]] -= obj_factor * 2 * w.ddelta;
+    values[h_da_[i]] -= obj_factor * 2 * w.da;
+  }
+  for (size_t k = 0; k < h_terminal_.size(); k++) {
+    values[h_terminal_[k]] += obj_factor * 2 * this->params[terminal_start + k];
+  }
+  if (!this->gauss_newton) {
+    ObstacleHessianValues<N>(lambda, h_obstacle_, values);
+  }
+  return true;
+}
+
+template <size_t N>
+void AutoDiff_NLP<N>::EvalStages(const Number* x, const Number* lambda, Number* values) {
+  pass_.x = x;
+  pass_.lambda = lambda;
+  pass_.values = values;
+  pass_.c = &this->params[coeffs_start];
+  pass_.understeer = this->params[understeer_idx];
+  double dt = this->params[dt_idx];
+  for (size_t i = 0; i < N - 1; i++) {
+    pass_.dt[i] = dt;
+    dt *= this->params[dt_growth_idx];
+  }
+
+#ifdef MPC_PARALLEL_STAGES
+  if (pool_) {
+    // Chunk 0 runs on the calling thread, as in MPPI.
+    const size_t chunk = (N - 1 + stage_threads - 1) / stage_threads;
+    chunks_pending_ = stage_threads - 1;
+    for (size_t k = 1; k < stage_threads; k++) {
+      pool_->Schedule([this, k, chunk]() {
+        EvalStageRange(std::min(k * chunk, N - 1), std::min((k + 1) * chunk, N - 1));
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        if (--chunks_pending_ == 0) {
+          chunks_done_.notify_one();
+        }
+      });
+    }
+    EvalStageRange(0, chunk);
+    std::unique_lock<std::mutex> lock(chunks_mutex_);
+    chunks_done_.wait(lock, [this]() { return chunks_pending_ == 0; });
+    return;
+  }
+#endif
+  EvalStageRange(0, N - 1);
+}
+
+template <size_t N>
+void AutoDiff_NLP<N>::EvalStageRange(size_t begin, size_t end) {
+  const BicycleModel<> model(Lf, pass_.understeer);
+  const size_t jac_per_stage = 6 + stage_jac_.size();
+  for (size_t i = begin; i < end; i++) {
+    double z[n_stage];
+    for (size_t j = 0; j < n_stage; j++) {
+      z[j] = pass_.x[StageVar(i, j)];
+    }
+    if (pass_.lambda == NULL) {
+      Eigen::Matrix<double, 6, 8> jac;
+      StageJacobian(model, z, pass_.c, pass_.dt[i], jac);
+      // g = x_{i+1} - f(z)
+      Number* J = pass_.values + 6 + i * jac_per_stage;
+      for (size_t s = 0; s < 6; s++) {
+        *J++ = 1;
+        for (size_t k = 0; k < stage_jac_.size(); k++) {
+          if (stage_jac_[k].first == s) {
+            *J++ = -jac(s, stage_jac_[k].second);
+          }
+        }
+      }
+    } else {
+      double l[6];
+      for (size_t s = 0; s < 6; s++) {
+        l[s] = pass_.lambda[L::Row(s, i + 1)];
+      }
+      Eigen::Matrix<double, 8, 8> hes;
+      StageHessian(model, z, pass_.c, pass_.dt[i], l, hes);
+      const size_t* h = &h_stage_[i * stage_hes_.size()];
+      for (size_t k = 0; k < stage_hes_.size(); k++) {
+        pass_.values[h[k]] -= hes(stage_hes_[k].first, stage_hes_[k].second);
+      }
+    }
+  }
+}
+
+#define INSTANTIATE(N) template class AutoDiff_NLP<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -0,0 +1,110 @@
+#ifndef AUTODIFF_NLP_H
+#define AUTODIFF_NLP_H
+
+#include <array>
+#include <utility>
+#include <vector>
+#include "Kernel_NLP.h"
+#ifdef MPC_PARALLEL_STAGES
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+#endif
+
+// Ipopt problem for FG_eval with the derivatives of the kinematic
+// constraints taken in forward mode (unsupported/Eigen/AutoDiff) through
+// BicycleModel::Step, one stage at a time.
+//
+// The problem is small and its stages are independent: each constraint
+// row of stage i depends only on the eight variables z = (state_i,
+// delta_i, a_i). The Jacobian of a stage is the AutoDiffScalar of z on
+// fixed-size vectors, and the Hessian of its part of the Lagrangian the
+// same again on scalars that already carry a gradient, all on the stack,
+// with no tape to record or replay. Unlike the kernels of Kernel_NLP it
+// follows whatever step the model takes, RK4 included. The cost and the
+// constraint values are those of Kernel_NLP.
+//
+// With MPC_PARALLEL_STAGES, horizons of at least parallel_stages_min
+// stages split the stages of each derivative evaluation into
+// stage_threads contiguous chunks, one on the calling thread and the rest
+// on a pool of the problem's own. Each stage writes its own entries, and
+// the AutoDiff scalars live on the stack of the thread that evaluates it.
+#ifdef MPC_PARALLEL_STAGES
+const size_t parallel_stages_min = 16;
+const size_t stage_threads = 4;
+#endif
+
+template <size_t N>
+class AutoDiff_NLP : public Kernel_NLP<N> {
+ public:
+  typedef Layout<N> L;
+
+  AutoDiff_NLP();
+
+  virtual ~AutoDiff_NLP();
+
+  void AddFootprint(Footprint& footprint) const;
+
+  bool get_nlp_info(Ipopt::Index& n, Ipopt::Index& m, Ipopt::Index& nnz_jac_g,
+                    Ipopt::Index& nnz_h_lag, Ipopt::TNLP::IndexStyleEnum& index_style);
+
+  bool eval_jac_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                  Ipopt::Index m, Ipopt::Index nele_jac, Ipopt::Index* iRow,
+                  Ipopt::Index* jCol, Ipopt::Number* values);
+
+  bool eval_h(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Number obj_factor, Ipopt::Index m, const Ipopt::Number* lambda,
+              bool new_lambda, Ipopt::Index nele_hess, Ipopt::Index* iRow,
+              Ipopt::Index* jCol, Ipopt::Number* values);
+
+ private:
+  // The variables of a stage: the six states, delta and a.
+  enum : size_t { n_stage = 8 };
+
+  // Nonzeros of the derivatives of a stage, the same for every stage: the
+  // (state row, variable) pairs of the Jacobian and the (variable,
+  // variable) pairs of the lower triangle of the Hessian.
+  std::vector<std::pair<size_t, size_t> > stage_jac_, stage_hes_;
+
+  // Jacobian and Hessian structures, and the position of each stage
+  // Hessian entry (stage_hes_.size() per stage) and of each cost term.
+  std::vector<Ipopt::Index> jac_row_, jac_col_;
+  std::vector<Ipopt::Index> hes_row_, hes_col_;
+  std::vector<size_t> h_stage_;
+  std::array<size_t, N> h_cte_, h_epsi_, h_v_;
+  std::array<size_t, N - 1> h_delta_, h_a_;
+  std::array<size_t, N - 2> h_ddelta_, h_da_;
+  std::array<size_t, n_terminal * (n_terminal + 1) / 2> h_terminal_;
+  std::array<size_t, 2 * (N - 1)> h_obstacle_;
+
+  // What the stages of the evaluation under way read and write: the
+  // iterate, the multipliers (NULL for the Jacobian), the values, and the
+  // model, reference and step of each stage.
+  struct StagePass {
+    const Ipopt::Number* x;
+    const Ipopt::Number* lambda;
+    Ipopt::Number* values;
+    const double* c;
+    double understeer;
+    std::array<double, N - 1> dt;
+  };
+  StagePass pass_;
+
+#ifdef MPC_PARALLEL_STAGES
+  std::unique_ptr<Eigen::NonBlockingThreadPool> pool_;
+  std::mutex chunks_mutex_;
+  std::condition_variable chunks_done_;
+  size_t chunks_pending_;
+#endif
+
+  // Layout index of variable j of stage i.
+  static size_t StageVar(size_t i, size_t j);
+
+  // Fill pass_ for x, lambda and values, and evaluate every stage.
+  void EvalStages(const Ipopt::Number* x, const Ipopt::Number* lambda, Ipopt::Number* values);
+  // Stages [begin, end) of pass_.
+  void EvalStageRange(size_t begin, size_t end);
+};
+
+#endif /* AUTODIFF_NLP_H */
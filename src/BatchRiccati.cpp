@@ -0,0 +1,127 @@
+#include "BatchRiccati.h"
+#include <algorithm>
+#include <chrono>
+#include "Tuning.h"
+
+template <size_t N>
+BatchRiccati<N>::BatchRiccati(size_t count, double dt, double Lf, double v_ref)
+    : count_(count),
+      dt_(dt),
+      Lf_(Lf),
+      growth_(1),
+      understeer_(0),
+      weights_(default_weights),
+      plans_(count * n_u, 0.0),
+      v_ref_(count, v_ref),
+      warm_(count, 0),
+      ranges_pending_(0) {
+  SetThreads(1);
+}
+
+template <size_t N>
+BatchRiccati<N>::~BatchRiccati() {}
+
+template <size_t N>
+typename BatchRiccati<N>::Solver* BatchRiccati<N>::NewSolver() const {
+  Solver* solver = new Solver(dt_, Lf_);
+  solver->SetWeights(weights_);
+  solver->SetTimestep(dt_, growth_);
+  solver->SetUndersteer(understeer_);
+  return solver;
+}
+
+template <size_t N>
+void BatchRiccati<N>::SetWeights(const Weights& weights) {
+  weights_ = weights;
+  for (auto& solver : solvers_) {
+    solver->SetWeights(weights);
+  }
+}
+
+template <size_t N>
+void BatchRiccati<N>::SetTimestep(double dt, double growth) {
+  dt_ = dt;
+  growth_ = growth;
+  for (auto& solver : solvers_) {
+    solver->SetTimestep(dt, growth);
+  }
+}
+
+template <size_t N>
+void BatchRiccati<N>::SetUndersteer(double understeer) {
+  understeer_ = understeer;
+  for (auto& solver : solvers_) {
+    solver->SetUndersteer(understeer);
+  }
+}
+
+template <size_t N>
+void BatchRiccati<N>::SetThreads(size_t threads) {
+  threads = std::min(std::max<size_t>(threads, 1), std::max<size_t>(count_, 1));
+  pool_.reset(threads > 1 ? new Eigen::NonBlockingThreadPool(int(threads - 1)) : NULL);
+  while (solvers_.size() < threads) {
+    solvers_.emplace_back(NewSolver());
+  }
+  solvers_.resize(threads);
+  starts_.resize(threads + 1);
+  for (size_t t = 0; t <= threads; t++) {
+    starts_[t] = t * count_ / threads;
+  }
+}
+
+template <size_t N>
+void BatchRiccati<N>::SolveRange(size_t t, const double* states, const double* coeffs, const Sink& sink) {
+  typedef std::chrono::steady_clock Clock;
+  Solver& solver = *solvers_[t];
+  for (size_t i = starts_[t]; i < starts_[t + 1]; i++) {
+    Clock::time_point start = Clock::now();
+    double* plan = &plans_[i * n_u];
+    solver.SetReference(0, 0, v_ref_[i]);
+    solver.Resume(warm_[i] ? plan : NULL);
+    solver.Feedback(Eigen::Map<const StateVector>(states + 6 * i),
+                    Eigen::Map<const Eigen::Vector4d>(coeffs + 4 * i));
+    std::copy(solver.Inputs().data(), solver.Inputs().data() + n_u, plan);
+    warm_[i] = 1;
+    sink(i, solver, std::chrono::duration<double>(Clock::now() - start).count());
+  }
+}
+
+template <size_t N>
+void BatchRiccati<N>::Solve(const double* states, const double* coeffs, const Sink& sink) {
+  // Range 0 runs on the calling thread.
+  ranges_pending_ = solvers_.size() - 1;
+  for (size_t t = 1; t < solvers_.size(); t++) {
+    pool_->Schedule([this, t, states, coeffs, &sink]() {
+      SolveRange(t, states, coeffs, sink);
+      std::lock_guard<std::mutex> lock(ranges_mutex_);
+      if (--ranges_pending_ == 0) {
+        ranges_done_.notify_one();
+      }
+    });
+  }
+  SolveRange(0, states, coeffs, sink);
+  if (solvers_.size() > 1) {
+    std::unique_lock<std::mutex> lock(ranges_mutex_);
+    ranges_done_.wait(lock, [this]() { return ranges_pending_ == 0; });
+  }
+}
+
+template <size_t N>
+void BatchRiccati<N>::Reset() {
+  std::fill(warm_.begin(), warm_.end(), 0);
+}
+
+template <size_t N>
+size_t BatchRiccati<N>::InstanceBytes() const {
+  return n_u * sizeof(double) + sizeof(double) + sizeof(unsigned char);
+}
+
+template <size_t N>
+size_t BatchRiccati<N>::Bytes() const {
+  return sizeof(*this) + count_ * InstanceBytes() + solvers_.size() * sizeof(Solver) +
+         starts_.capacity() * sizeof(size_t);
+}
+
+#define INSTANTIATE(N) template class BatchRiccati<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -0,0 +1,109 @@
+#ifndef BATCH_RICCATI_H
+#define BATCH_RICCATI_H
+
+#include <stddef.h>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+#include "RiccatiSQP.h"
+#include "Weights.h"
+
+// Many vehicles on the Riccati SQP backend, without an MPC, or even a
+// RiccatiSQP, for each of them.
+//
+// What a vehicle carries from one solve to the next is its actuator plan,
+// the warm start: the duals of the interior point start afresh in every
+// QP and everything else of a solve is scratch. So the batch keeps its
+// instances structure-of-arrays, by field: one array of the plans, the
+// 2 (N - 1) values of instance i at i * n_u, and one of the reference
+// speeds and of whether there is a plan yet. A solver per thread is the
+// scratch, reused by every instance that thread solves: it resumes the
+// instance's plan (RiccatiSQP::Resume), runs its feedback step and the
+// plan goes back into the array. An instance takes 8 * 2 (N - 1) + 9
+// bytes, 169 for N = 11, where an MPC takes what every backend of it
+// holds, tens of kilobytes, each a heap block of its own.
+//
+// The instances are split in ranges of consecutive ones, one per thread,
+// the calling one included; the states and coefficients are read where
+// the caller keeps them, rows of consecutive instances too. The solve of
+// an instance does not depend on the thread nor on the others, so the
+// results are those of one RiccatiSQP per vehicle. Weights, time steps and
+// understeer are those of the whole batch; sensitivity updates and the
+// terminal cost are not taken.
+template <size_t N>
+class BatchRiccati {
+ public:
+  typedef RiccatiSQP<N> Solver;
+  enum : int { n_u = Solver::n_u };
+
+  // Called for instance i on the thread that solved it, with the solver
+  // still holding its plan and trajectory, and the seconds its solve took.
+  typedef std::function<void(size_t i, const Solver& solver, double seconds)> Sink;
+
+  BatchRiccati(size_t count, double dt, double Lf, double v_ref);
+
+  ~BatchRiccati();
+
+  size_t Count() const { return count_; }
+
+  void SetWeights(const Weights& weights);
+
+  // See RiccatiSQP::SetTimestep; Reset first to drop the plans.
+  void SetTimestep(double dt, double growth = 1);
+
+  void SetUndersteer(double understeer);
+
+  // Reference speed of instance i, that of the constructor until set.
+  void SetReferenceSpeed(size_t i, double v_ref) { v_ref_[i] = v_ref; }
+
+  // Spread the instances over threads threads, the calling one included.
+  void SetThreads(size_t threads);
+
+  // One feedback step of every instance from its row of states, six
+  // values [x, y, psi, v, cte, epsi] each, and of coeffs, four each,
+  // warm started from its last plan; sink takes each result.
+  void Solve(const double* states, const double* coeffs, const Sink& sink);
+
+  // Actuator plan of instance i, [delta_0, a_0, ...], or NULL before its
+  // first solve.
+  const double* Plan(size_t i) const { return warm_[i] ? &plans_[i * n_u] : NULL; }
+
+  // Forget every plan, so the next solves start cold.
+  void Reset();
+
+  // Storage of the instances, and of the whole batch with the solvers.
+  size_t InstanceBytes() const;
+  size_t Bytes() const;
+
+ private:
+  size_t count_;
+  // The settings of the batch, for the solvers of new threads.
+  double dt_;
+  double Lf_;
+  double growth_;
+  double understeer_;
+  Weights weights_;
+
+  // The instance arrays.
+  std::vector<double> plans_;
+  std::vector<double> v_ref_;
+  std::vector<unsigned char> warm_;
+
+  // The scratch solver of every thread, and the first instance of its
+  // range; the last entry is count_.
+  std::vector<std::unique_ptr<Solver> > solvers_;
+  std::vector<size_t> starts_;
+
+  std::unique_ptr<Eigen::NonBlockingThreadPool> pool_;
+  std::mutex ranges_mutex_;
+  std::condition_variable ranges_done_;
+  size_t ranges_pending_;
+
+  Solver* NewSolver() const;
+  void SolveRange(size_t t, const double* states, const double* coeffs, const Sink& sink);
+};
+
+#endif /* BATCH_RICCATI_H */
@@ -0,0 +1,269 @@
+#include "BinaryProtocol.h"
+#include <string.h>
+#include <algorithm>
+#include "Metrics.h"
+
+using namespace std;
+
+// Byte order is spelled out so that the framing does not depend on the
+// host.
+static uint64_t GetLE(const char* p, size_t n) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++) {
+    v |= uint64_t(uint8_t(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+static void PutLE(string& out, uint64_t v, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out += char((v >> (8 * i)) & 0xff);
+  }
+}
+
+static double GetF64(const char* p) {
+  uint64_t bits = GetLE(p, 8);
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+static double GetF32(const char* p) {
+  uint32_t bits = uint32_t(GetLE(p, 4));
+  float v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+static void PutF64(string& out, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  PutLE(out, bits, 8);
+}
+
+static void PutF32(string& out, double v) {
+  float f = float(v);
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  PutLE(out, bits, 4);
+}
+
+static void PutHeader(string& out, uint16_t type, Framing framing, size_t n0, size_t n1) {
+  PutLE(out, binary_magic, 4);
+  PutLE(out, type, 2);
+  PutLE(out, framing == Framing::Binary32 ? binary_float32 : 0, 2);
+  PutLE(out, n0, 4);
+  PutLE(out, n1, 4);
+}
+
+static void PutArray(string& out, Framing framing, const double* values, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (framing == Framing::Binary32) {
+      PutF32(out, values[i]);
+    } else {
+      PutF64(out, values[i]);
+    }
+  }
+}
+
+// Read n points of the arrays at p into x and y.
+static void GetPoints(const char* p, size_t element, size_t stride, size_t n, double* x, double* y) {
+  const char* py = p + stride * element;
+  for (size_t i = 0; i < n; i++) {
+    if (element == 4) {
+      x[i] = GetF32(p + i * 4);
+      y[i] = GetF32(py + i * 4);
+    } else {
+      x[i] = GetF64(p + i * 8);
+      y[i] = GetF64(py + i * 8);
+    }
+  }
+}
+
+BinaryMessage DecodeBinary(const char* data, size_t length, Framing& framing, Telemetry& frame,
+                           WaypointWindow* window) {
+  if (length < binary_header_size || GetLE(data, 4) != binary_magic) {
+    return BinaryMessage::Invalid;
+  }
+  uint16_t type = uint16_t(GetLE(data + 4, 2));
+  uint16_t flags = uint16_t(GetLE(data + 6, 2));
+  uint64_t n = GetLE(data + 8, 4);
+  uint64_t n_window = GetLE(data + 12, 4);
+  Framing requested = flags & binary_float32 ? Framing::Binary32 : Framing::Binary64;
+
+  if (type == binary_hello) {
+    framing = requested;
+    return BinaryMessage::Hello;
+  }
+  if (type != binary_telemetry && type != binary_waypoints) {
+    return BinaryMessage::Invalid;
+  }
+
+  size_t element = requested == Framing::Binary32 ? 4 : 8;
+  size_t fields = type == binary_waypoints ? 7 * 8 : 6 * 8;
+  if (length < binary_header_size + fields + 2 * n * element) {
+    return BinaryMessage::Invalid;
+  }
+  if (type == binary_waypoints && (!window || n > n_window || n_window > Telemetry::max_points)) {
+    // A window past the capacity is not taken in part: the waypoints kept
+    // of it would not be those the gateway numbers.
+    if (window && n <= n_window && n_window > Telemetry::max_points) {
+      CountEvent(Counter::RejectedWaypoints, n_window);
+    }
+    return BinaryMessage::Invalid;
+  }
+  const char* p = data + binary_header_size;
+  uint64_t first = 0;
+  size_t kept = 0;
+  if (type == binary_waypoints) {
+    // The waypoints not sent must all be in the window.
+    first = GetLE(p + 6 * 8, 8);
+    kept = size_t(n_window - n);
+    if (kept > 0 && (first < window->first || kept > window->n || first - window->first > window->n - kept)) {
+      CountEvent(Counter::WaypointResends);
+      framing = requested;
+      return BinaryMessage::Resend;
+    }
+    CountEvent(Counter::WaypointsReused, kept);
+  }
+  frame.px = GetF64(p);
+  frame.py = GetF64(p + 8);
+  frame.psi = GetF64(p + 16);
+  frame.v = GetF64(p + 24);
+  frame.delta = GetF64(p + 32);
+  frame.a = GetF64(p + 40);
+  p += fields;
+
+  if (type == binary_waypoints) {
+    size_t offset = size_t(first - window->first);
+    copy(window->x + offset, window->x + offset + kept, frame.ptsx);
+    copy(window->y + offset, window->y + offset + kept, frame.ptsy);
+    GetPoints(p, element, size_t(n), size_t(n), frame.ptsx + kept, frame.ptsy + kept);
+    frame.n_points = size_t(n_window);
+    frame.first_waypoint = first;
+    copy(frame.ptsx, frame.ptsx + frame.n_points, window->x);
+    copy(frame.ptsy, frame.ptsy + frame.n_points, window->y);
+    window->first = first;
+    window->n = frame.n_points;
+  } else {
+    frame.n_points = n < Telemetry::max_points ? size_t(n) : Telemetry::max_points;
+    if (n > frame.n_points) {
+      CountEvent(Counter::RejectedWaypoints, n - frame.n_points);
+    }
+    GetPoints(p, element, size_t(n), frame.n_points, frame.ptsx, frame.ptsy);
+    frame.first_waypoint = no_waypoint_id;
+  }
+  frame.framing = requested;
+  frame.tick = false;
+  NormalizeTelemetry(frame);
+  return BinaryMessage::Telemetry;
+}
+
+void WriteBinaryHello(string& out, Framing framing, bool resend) {
+  out.clear();
+  PutHeader(out, binary_hello, framing, 0, 0);
+  if (resend) {
+    out[6] = char(out[6] | binary_resend);
+  }
+}
+
+void WriteBinaryCommand(string& out, Framing framing,
+                        double steering_angle, double throttle,
+                        const double* mpc_x, const double* mpc_y, size_t n_mpc,
+                        const double* next_x, const double* next_y, size_t n_next) {
+  out.clear();
+  PutHeader(out, binary_command, framing, n_mpc, n_next);
+  PutF64(out, steering_angle);
+  PutF64(out, throttle);
+  PutArray(out, framing, mpc_x, n_mpc);
+  PutArray(out, framing, mpc_y, n_mpc);
+  PutArray(out, framing, next_x, n_next);
+  PutArray(out, framing, next_y, n_next);
+}
+
+void WriteBinaryWaypoints(string& out, Framing framing,
+                          double x, double y, double psi, double speed, double steering_angle, double throttle,
+                          const double* ptsx, const double* ptsy, size_t n, uint64_t first, size_t n_new) {
+  n_new = n_new < n ? n_new : n;
+  out.clear();
+  PutHeader(out, binary_waypoints, framing, n_new, n);
+  PutF64(out, x);
+  PutF64(out, y);
+  PutF64(out, psi);
+  PutF64(out, speed);
+  PutF64(out, steering_angle);
+  PutF64(out, throttle);
+  PutLE(out, first, 8);
+  PutArray(out, framing, ptsx + n - n_new, n_new);
+  PutArray(out, framing, ptsy + n - n_new, n_new);
+}
+
+// Values of a problem, and of a solution besides its plan.
+static const size_t problem_values = 13;
+static const size_t solution_values = 2;
+
+bool DecodeBinaryProblems(const char* data, size_t length, Framing& framing, uint64_t& id, size_t& horizon,
+                          vector<OfflineProblem>& problems, size_t max_problems) {
+  if (length < binary_header_size + 8 || GetLE(data, 4) != binary_magic ||
+      GetLE(data + 4, 2) != binary_problems) {
+    return false;
+  }
+  uint16_t flags = uint16_t(GetLE(data + 6, 2));
+  uint64_t n = GetLE(data + 8, 4);
+  framing = flags & binary_float32 ? Framing::Binary32 : Framing::Binary64;
+  size_t element = framing == Framing::Binary32 ? 4 : 8;
+  if (n > max_problems || length < binary_header_size + 8 + n * problem_values * element) {
+    return false;
+  }
+  horizon = size_t(GetLE(data + 12, 4));
+  id = GetLE(data + binary_header_size, 8);
+  problems.resize(n);
+  const char* p = data + binary_header_size + 8;
+  for (size_t i = 0; i < n; i++) {
+    double values[problem_values];
+    for (size_t k = 0; k < problem_values; k++, p += element) {
+      values[k] = element == 4 ? GetF32(p) : GetF64(p);
+    }
+    OfflineProblem& problem = problems[i];
+    copy(values, values + 6, problem.state);
+    copy(values + 6, values + 10, problem.coeffs);
+    problem.cte_ref = values[10];
+    problem.epsi_ref = values[11];
+    problem.v_ref = values[12];
+  }
+  return true;
+}
+
+void WriteBinaryProblems(string& out, Framing framing, uint64_t id, size_t horizon,
+                         const OfflineProblem* problems, size_t n) {
+  out.clear();
+  out.reserve(binary_header_size + 8 + n * problem_values * 8);
+  PutHeader(out, binary_problems, framing, n, horizon);
+  PutLE(out, id, 8);
+  for (size_t i = 0; i < n; i++) {
+    const OfflineProblem& problem = problems[i];
+    const double refs[3] = { problem.cte_ref, problem.epsi_ref, problem.v_ref };
+    PutArray(out, framing, problem.state, 6);
+    PutArray(out, framing, problem.coeffs, 4);
+    PutArray(out, framing, refs, 3);
+  }
+}
+
+void WriteBinarySolutions(string& out, Framing framing, uint64_t id, size_t horizon,
+                          const OfflineSolution* solutions, const uint32_t* indices, size_t n) {
+  const size_t stages = horizon > 0 ? horizon - 1 : 0;
+  out.clear();
+  out.reserve(binary_header_size + 8 + n * (8 + (solution_values + 2 * stages) * 8));
+  PutHeader(out, binary_solutions, framing, n, horizon);
+  PutLE(out, id, 8);
+  for (size_t i = 0; i < n; i++) {
+    const OfflineSolution& solution = solutions[indices[i]];
+    const double values[solution_values] = { solution.cost, solution.solve_time };
+    PutLE(out, indices[i], 4);
+    PutLE(out, (solution.ok ? 1 : 0) | (solution.usable ? 2 : 0), 2);
+    PutLE(out, uint64_t(min(max(solution.iterations, 0), 0xffff)), 2);
+    PutArray(out, framing, values, solution_values);
+    PutArray(out, framing, solution.delta, stages);
+    PutArray(out, framing, solution.a, stages);
+  }
+}
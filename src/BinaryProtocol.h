@@ -0,0 +1,139 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Pipeline.h"
+#include "Telemetry.h"
+
+// Binary framing on uWS::OpCode::BINARY, for gateways that do not need
+// the simulator's Socket.IO text. All fields are little-endian.
+//
+// Every frame starts with a 16 byte header:
+//   uint32 magic   "MPC1"
+//   uint16 type    1 = hello, 2 = telemetry, 3 = command, 4 = waypoints,
+//                  5 = problems, 6 = solutions
+//   uint16 flags   bit 0: the arrays are float32 instead of float64
+//                  bit 1: on a hello from the server, send whole windows
+//   uint32 n0      length of the first pair of arrays
+//   uint32 n1      length of the second pair of arrays
+// followed by
+//   hello:      nothing
+//   telemetry:  float64 x, y, psi, speed, steering_angle, throttle,
+//               then ptsx[n0], ptsy[n0], all as the simulator
+//               reports them (speed in mph, steering positive right)
+//   command:    float64 steering_angle, throttle,
+//               then mpc_x[n0], mpc_y[n0], next_x[n1], next_y[n1]
+//   waypoints:  float64 x, y, psi, speed, steering_angle, throttle,
+//               uint64 first, then ptsx[n0], ptsy[n0]: telemetry whose
+//               window is the n1 waypoints numbered first to
+//               first + n1 - 1, of which only the last n0 are sent
+//   problems:   uint64 id, then n0 problems over the horizon of n1 states,
+//               0 for the server's, each x, y, psi, v, cte, epsi,
+//               coeffs[4], cte_ref, epsi_ref, v_ref (see OfflineProblem)
+//   solutions:  uint64 id, then n0 solutions over n1 states, each uint32
+//               index of its problem, uint16 bit 0: converged, bit 1:
+//               usable, uint16 iterations, then cost, solve_time,
+//               delta[n1 - 1], a[n1 - 1]
+//
+// A client negotiates the binary framing by sending a hello, which the
+// server answers with a hello carrying the precision it will use. Binary
+// telemetry is answered with a command frame in the precision of the
+// telemetry's flags; text telemetry keeps getting text replies.
+//
+// Waypoints frames spare a gateway whose window slides along the road
+// resending the waypoints it already sent: it numbers the waypoints of a
+// connection in the order they come along the road, and sends each one
+// once. The server keeps the window of every connection (WaypointWindow)
+// and takes the first n1 - n0 waypoints from it, so they are neither sent
+// nor parsed again, and the numbers let the sliding-window fit update by
+// the waypoints that changed without comparing any. n1 is at most
+// Telemetry::max_points. A frame that needs waypoints the window does not
+// hold, as the first of a connection does unless it sends them all
+// (n0 = n1), is answered with a hello with bit 1 set instead of a
+// command; the gateway then sends its next window whole.
+//
+// Problems frames are the offline queries of tools, on connections of
+// their own to /solve rather than of vehicles (see MPCBatch::Submit): the
+// server solves the problems of a frame on its batch workers and answers
+// with solutions frames of the same id and precision as they come, in
+// any order and as many as it has each time, until it has sent one of
+// every problem. A frame it cannot take, or one without problems, is
+// answered with an empty solutions frame of n0 = n1 = 0.
+
+const uint32_t binary_magic = 0x3143504d;  // "MPC1"
+const uint16_t binary_hello = 1;
+const uint16_t binary_telemetry = 2;
+const uint16_t binary_command = 3;
+const uint16_t binary_waypoints = 4;
+const uint16_t binary_problems = 5;
+const uint16_t binary_solutions = 6;
+const uint16_t binary_float32 = 1;
+const uint16_t binary_resend = 2;
+const size_t binary_header_size = 16;
+
+enum class BinaryMessage {
+  Hello,
+  Telemetry,
+  // A waypoints frame that needs waypoints its connection's window does
+  // not hold: to be answered with WriteBinaryHello(out, framing, true).
+  Resend,
+  // Bad magic, unknown type, or a truncated frame.
+  Invalid
+};
+
+// The numbered waypoints a connection sent last, in map coordinates, that
+// its next waypoints frame builds on. Empty on a new connection.
+struct WaypointWindow {
+  uint64_t first;
+  size_t n;
+  double x[Telemetry::max_points];
+  double y[Telemetry::max_points];
+
+  WaypointWindow() : first(0), n(0) {}
+};
+
+// Decode a binary frame. For a hello or a resend, framing is set to the
+// requested framing; for telemetry and waypoints, frame is filled and frame.framing
+// set from the flags. Waypoints beyond Telemetry::max_points are ignored.
+// Waypoints frames take the waypoints they do not carry from window,
+// which they then replace, and are invalid without one.
+BinaryMessage DecodeBinary(const char* data, size_t length, Framing& framing, Telemetry& frame,
+                           WaypointWindow* window = NULL);
+
+// Write the hello answer for framing into out; with resend, the one that
+// asks for the next window whole.
+void WriteBinaryHello(std::string& out, Framing framing, bool resend = false);
+
+// Write a gateway's waypoints frame into out, reusing its capacity, with
+// the fields as the simulator reports them: the window is the n waypoints
+// of ptsx and ptsy, numbered from first, of which the last n_new are sent.
+void WriteBinaryWaypoints(std::string& out, Framing framing,
+                          double x, double y, double psi, double speed, double steering_angle, double throttle,
+                          const double* ptsx, const double* ptsy, size_t n, uint64_t first, size_t n_new);
+
+// Write a command frame into out, reusing its capacity.
+void WriteBinaryCommand(std::string& out, Framing framing,
+                        double steering_angle, double throttle,
+                        const double* mpc_x, const double* mpc_y, size_t n_mpc,
+                        const double* next_x, const double* next_y, size_t n_next);
+
+// Decode a problems frame into its id, horizon and problems, reusing the
+// capacity of problems, and framing from its flags. False when data is
+// not one, or holds more than max_problems.
+bool DecodeBinaryProblems(const char* data, size_t length, Framing& framing, uint64_t& id, size_t& horizon,
+                          std::vector<OfflineProblem>& problems, size_t max_problems);
+
+// Write a query's problems frame into out, reusing its capacity.
+void WriteBinaryProblems(std::string& out, Framing framing, uint64_t id, size_t horizon,
+                         const OfflineProblem* problems, size_t n);
+
+// Write a solutions frame into out, reusing its capacity: those of the
+// problems of a query numbered indices[0] to indices[n - 1], over horizon
+// states, solutions[indices[i]] for each.
+void WriteBinarySolutions(std::string& out, Framing framing, uint64_t id, size_t horizon,
+                          const OfflineSolution* solutions, const uint32_t* indices, size_t n);
+
+#endif /* BINARY_PROTOCOL_H */
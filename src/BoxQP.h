@@ -0,0 +1,136 @@
+#ifndef BOX_QP_H
+#define BOX_QP_H
+
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+
+// Primal active-set solver for the box-constrained convex QP
+//
+//   min 0.5 x' H x + g' x   subject to   lb <= x <= ub
+//
+// with H positive definite and n variables. Each iteration solves for the
+// minimizer over the free variables with the others held at their bound,
+// then either adds the first bound that step runs into or, at a minimizer,
+// releases the bound with the most negative multiplier. The result is the
+// exact solution, reached in a few iterations when few bounds are active.
+//
+// The working storage has a fixed maximum size, so solving does not touch
+// the heap.
+template <int n, class Scalar = double>
+class BoxQP {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef Eigen::Matrix<Scalar, n, 1> Vector;
+  typedef Eigen::Matrix<Scalar, n, n> Matrix;
+
+  // Solve from the starting point x, which is first clipped onto the box
+  // and is overwritten with the solution. Returns the number of
+  // iterations, or -1 if max_iterations was reached first.
+  int Solve(const Matrix& H, const Vector& g, const Vector& lb, const Vector& ub,
+            Vector& x, int max_iterations = 4 * n) {
+    for (int i = 0; i < n; i++) {
+      if (x(i) <= lb(i)) {
+        x(i) = lb(i);
+        bound_[i] = -1;
+      } else if (x(i) >= ub(i)) {
+        x(i) = ub(i);
+        bound_[i] = 1;
+      } else {
+        bound_[i] = 0;
+      }
+    }
+
+    for (int it = 0; it < max_iterations; it++) {
+      grad_.noalias() = H * x;
+      grad_ += g;
+
+      int n_free = 0;
+      for (int i = 0; i < n; i++) {
+        if (bound_[i] == 0) {
+          free_[n_free++] = i;
+        }
+      }
+
+      if (n_free > 0) {
+        // Newton step on the free variables.
+        Hff_.resize(n_free, n_free);
+        rhs_.resize(n_free);
+        for (int a = 0; a < n_free; a++) {
+          for (int b = 0; b < n_free; b++) {
+            Hff_(a, b) = H(free_[a], free_[b]);
+          }
+          rhs_(a) = -grad_(free_[a]);
+        }
+        llt_.compute(Hff_);
+        step_ = llt_.solve(rhs_);
+
+        // Stop at the first bound in the way.
+        Scalar alpha = 1;
+        int blocking = -1;
+        int side = 0;
+        for (int a = 0; a < n_free; a++) {
+          int i = free_[a];
+          Scalar p = step_(a);
+          if (p < 0 && x(i) + p < lb(i)) {
+            Scalar t = (lb(i) - x(i)) / p;
+            if (t < alpha) {
+              alpha = t;
+              blocking = i;
+              side = -1;
+            }
+          } else if (p > 0 && x(i) + p > ub(i)) {
+            Scalar t = (ub(i) - x(i)) / p;
+            if (t < alpha) {
+              alpha = t;
+              blocking = i;
+              side = 1;
+            }
+          }
+        }
+        for (int a = 0; a < n_free; a++) {
+          x(free_[a]) += alpha * step_(a);
+        }
+        if (blocking >= 0) {
+          x(blocking) = side < 0 ? lb(blocking) : ub(blocking);
+          bound_[blocking] = side;
+          continue;
+        }
+        grad_.noalias() = H * x;
+        grad_ += g;
+      }
+
+      // Minimizer for this working set: release the bound whose
+      // multiplier has the wrong sign, if any.
+      int release = -1;
+      Scalar worst = Scalar(-1e-10);
+      for (int i = 0; i < n; i++) {
+        Scalar mu = bound_[i] < 0 ? grad_(i) : bound_[i] > 0 ? -grad_(i) : 0;
+        if (mu < worst) {
+          worst = mu;
+          release = i;
+        }
+      }
+      if (release < 0) {
+        return it + 1;
+      }
+      bound_[release] = 0;
+    }
+    return -1;
+  }
+
+ private:
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, 0, n, n> SubMatrix;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1, 0, n, 1> SubVector;
+
+  // -1 at the lower bound, 1 at the upper bound, 0 free.
+  int bound_[n];
+  int free_[n];
+  Vector grad_;
+  SubMatrix Hff_;
+  SubVector rhs_;
+  SubVector step_;
+  Eigen::LLT<SubMatrix> llt_;
+};
+
+#endif /* BOX_QP_H */
@@ -0,0 +1,111 @@
+#include "Calibration.h"
+#include <math.h>
+#include <algorithm>
+#include "Logger.h"
+#include "Tuning.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const vector<BackendCandidate>& BackendCandidates() {
+  static const vector<BackendCandidate> candidates = {
+    { "ipopt", MPCBackend::Ipopt, "", false },
+    { "ipopt-lbfgs", MPCBackend::Ipopt, "limited-memory", false },
+    { "ipopt-gn", MPCBackend::Ipopt, "", true },
+    { "kernels", MPCBackend::IpoptKernels, "", false },
+    { "kernels-gn", MPCBackend::IpoptKernels, "", true },
+    { "autodiff", MPCBackend::IpoptAutoDiff, "", false },
+    { "rti", MPCBackend::RTI, "", false },
+    { "riccati", MPCBackend::Riccati, "", false },
+    { "admm", MPCBackend::ADMM, "", false },
+    { "mppi", MPCBackend::MPPI, "", false },
+  };
+  return candidates;
+}
+
+void ApplyBackend(const BackendCandidate& candidate, ControllerOptions& options) {
+  options.backend = candidate.backend;
+  options.ipopt.hessian_approximation = candidate.hessian_approximation;
+  options.ipopt.gauss_newton = candidate.gauss_newton;
+}
+
+static double Percentile(vector<double> times, double p) {
+  if (times.empty()) {
+    return 0;
+  }
+  size_t k = min(times.size() - 1, size_t(p * times.size()));
+  nth_element(times.begin(), times.begin() + k, times.end());
+  return times[k];
+}
+
+// The first actuators of every frame, steering in units of max_delta.
+struct Actuators {
+  double delta;
+  double a;
+};
+
+static BackendTrial Try(const BackendCandidate& candidate, ControllerOptions options, const Track& track,
+                        size_t solves, vector<Actuators>& actuators) {
+  ApplyBackend(candidate, options);
+  Controller controller(options);
+  Telemetry frame;
+  Command command;
+  command.ws = NULL;
+  vector<double> times;
+  size_t converged = 0;
+  actuators.clear();
+  for (size_t k = 0; k < solves; k++) {
+    WarmUpFrame(track, k, solves, options.ref_v, frame);
+    command.framing = frame.framing;
+    command.received = frame.received;
+    command.arrived = command.received;
+    controller.Solve(frame, command);
+    if (k > 0) {
+      times.push_back(duration<double>(PipelineClock::now() - frame.received).count());
+    }
+    const Observation& o = command.observation;
+    converged += o.ok;
+    actuators.push_back({ -o.steering_angle / max_delta, o.throttle });
+  }
+  BackendTrial trial;
+  trial.candidate = candidate;
+  trial.p50 = Percentile(times, 0.5);
+  trial.p90 = Percentile(times, 0.9);
+  trial.deviation = 0;
+  trial.converged = solves ? double(converged) / solves : 0;
+  trial.agrees = true;
+  return trial;
+}
+
+size_t CalibrateBackend(const ControllerOptions& options, const Track& track, size_t solves, double tolerance,
+                        const vector<BackendCandidate>& candidates, vector<BackendTrial>& trials) {
+  trials.clear();
+  vector<Actuators> reference;
+  vector<Actuators> actuators;
+  size_t chosen = 0;
+  for (size_t c = 0; c < candidates.size(); c++) {
+    BackendTrial trial = Try(candidates[c], options, track, solves, c == 0 ? reference : actuators);
+    if (c > 0) {
+      double squares = 0;
+      for (size_t k = 0; k < solves; k++) {
+        double d_delta = actuators[k].delta - reference[k].delta;
+        double d_a = actuators[k].a - reference[k].a;
+        squares += d_delta * d_delta + d_a * d_a;
+      }
+      trial.deviation = solves ? sqrt(squares / solves) : 0;
+      trial.agrees = trial.deviation <= tolerance;
+    }
+    trials.push_back(trial);
+    MPC_LOG(LogLevel::Info, "Calibration: %-12s p50 %7.3f ms, p90 %7.3f ms, %5.1f%% converged, deviation %.4f%s",
+            trial.candidate.name, trial.p50 * 1e3, trial.p90 * 1e3, trial.converged * 100, trial.deviation,
+            trial.agrees ? "" : " (disagrees)");
+    if (trial.agrees && trial.p90 < trials[chosen].p90) {
+      chosen = c;
+    }
+  }
+  if (!trials.empty()) {
+    MPC_LOG(LogLevel::Info, "Calibration chose %s over %zu frames of the warm-up track (tolerance %.3f)",
+            trials[chosen].candidate.name, solves, tolerance);
+  }
+  return chosen;
+}
@@ -0,0 +1,52 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stddef.h>
+#include <vector>
+#include "Controller.h"
+#include "Track.h"
+
+// Choice of the fastest backend for the host at startup. Every candidate
+// solves the same warm-up frames along a track (see WarmUpFrame) with the
+// rest of the options as given; the exact-Hessian Ipopt backend is the
+// reference the others must agree with. A candidate agrees when the RMS
+// difference of its first actuators from the reference's, steering in
+// units of max_delta and throttle as is, is within the tolerance over the
+// frames; of those that agree, the one with the lowest p90 solve time
+// wins. The first solve of each, which records the tapes and sizes the
+// buffers, is left out of the times.
+struct BackendCandidate {
+  const char* name;
+  MPCBackend backend;
+  // Empty, or "limited-memory" (see IpoptOptions::hessian_approximation),
+  // and whether the Hessian is Gauss-Newton (IpoptOptions::gauss_newton).
+  const char* hessian_approximation;
+  bool gauss_newton;
+};
+
+// Every backend, and Ipopt with the limited-memory and the Gauss-Newton
+// Hessians.
+const std::vector<BackendCandidate>& BackendCandidates();
+
+struct BackendTrial {
+  BackendCandidate candidate;
+  // Steady-state solve times in seconds.
+  double p50;
+  double p90;
+  // RMS actuator difference from the reference, and the share of its
+  // solves that converged.
+  double deviation;
+  double converged;
+  bool agrees;
+};
+
+// Try the candidates in order, the reference first, on solves frames of
+// track. Returns the index in trials of the one chosen, which is the
+// reference when no other agrees, after logging every trial.
+size_t CalibrateBackend(const ControllerOptions& options, const Track& track, size_t solves, double tolerance,
+                        const std::vector<BackendCandidate>& candidates, std::vector<BackendTrial>& trials);
+
+// Set the backend and the Hessian approximation of candidate in options.
+void ApplyBackend(const BackendCandidate& candidate, ControllerOptions& options);
+
+#endif /* CALIBRATION_H */
@@ -0,0 +1,152 @@
+#include "ClosestPoint.h"
+#include <math.h>
+#include "Eigen-3.3/unsupported/Eigen/Polynomials"
+#include "Horner.h"
+
+// Roots of the quintic past the machine precision of its largest
+// coefficient are not roots of it.
+static const double negligible = 1e-12;
+
+// Squared distance from (px, py) to the reference at x.
+static double Distance2(const Eigen::Vector4d& c, double px, double py, double x) {
+  double dy = Polyval<3>(c, x) - py;
+  return (x - px) * (x - px) + dy * dy;
+}
+
+// Of the real parts of the roots of the degree K polynomial p[0] + ... +
+// p[K] x^K, the one nearest as above, replacing best when nearer.
+template <int K>
+static void NearestRoot(const double* p, const Eigen::Vector4d& c, double px, double py, double& best,
+                        double& best_d2) {
+  Eigen::Matrix<double, K + 1, 1> poly;
+  for (int k = 0; k <= K; k++) {
+    poly[k] = p[k];
+  }
+  Eigen::PolynomialSolver<double, K> solver(poly);
+  for (int k = 0; k < K; k++) {
+    double x = solver.roots()[k].real();
+    double d2 = Distance2(c, px, py, x);
+    if (d2 < best_d2) {
+      best = x;
+      best_d2 = d2;
+    }
+  }
+}
+
+// Derivative of the quintic p at x.
+static double Slope(const double* p, double x) {
+  double slope = 5 * p[5];
+  for (int k = 4; k >= 1; k--) {
+    slope = slope * x + k * p[k];
+  }
+  return slope;
+}
+
+// The nearest point of all the real roots of the quintic p, from the
+// companion matrix.
+static double Roots(const double* p, const Eigen::Vector4d& c, double px, double py) {
+  double largest = 0;
+  for (int k = 0; k < 6; k++) {
+    largest = fmax(largest, fabs(p[k]));
+  }
+  int degree = 5;
+  while (degree > 1 && fabs(p[degree]) <= negligible * largest) {
+    degree--;
+  }
+
+  // The vertical projection is a candidate too, should every root be
+  // complex.
+  double x = px;
+  double x_d2 = Distance2(c, px, py, px);
+  switch (degree) {
+    case 5:
+      NearestRoot<5>(p, c, px, py, x, x_d2);
+      break;
+    case 4:
+      NearestRoot<4>(p, c, px, py, x, x_d2);
+      break;
+    case 3:
+      NearestRoot<3>(p, c, px, py, x, x_d2);
+      break;
+    case 2:
+      NearestRoot<2>(p, c, px, py, x, x_d2);
+      break;
+    default:
+      if (p[1] != 0) {
+        NearestRoot<1>(p, c, px, py, x, x_d2);
+      }
+      break;
+  }
+
+  // Newton steps win back the digits the eigenvalues lose, kept only while
+  // they bring the point nearer.
+  for (int i = 0; i < 2; i++) {
+    double slope = Slope(p, x);
+    if (slope == 0) {
+      break;
+    }
+    double next = x - Polyval<5>(p, x) / slope;
+    double next_d2 = Distance2(c, px, py, next);
+    if (!(next_d2 <= x_d2)) {
+      break;
+    }
+    x = next;
+    x_d2 = next_d2;
+  }
+  return x;
+}
+
+ClosestPoint CubicClosestPoint(const Eigen::Vector4d& c, double px, double py) {
+  // Half the derivative of the squared distance, (x - px) + (f(x) - py)
+  // f'(x), term by term.
+  double g0 = c[0] - py;
+  double d0 = c[1];
+  double d1 = 2 * c[2];
+  double d2 = 3 * c[3];
+  double p[6];
+  p[0] = g0 * d0 - px;
+  p[1] = g0 * d1 + c[1] * d0 + 1;
+  p[2] = g0 * d2 + c[1] * d1 + c[2] * d0;
+  p[3] = c[1] * d2 + c[2] * d1 + c[3] * d0;
+  p[4] = c[2] * d2 + c[3] * d1;
+  p[5] = c[3] * d2;
+
+  // The nearest point is no farther than the vertical projection, so
+  // within d of px. Where the distance is convex over that interval, as
+  // it is unless the reference bends tighter than the vehicle is far from
+  // it, Newton's method from px finds its only minimum in a few steps.
+  double d = fabs(Polyval<3>(c, px) - py);
+  double x = px;
+  bool found = false;
+  if (Slope(p, px - d) > 0 && Slope(p, px + d) > 0) {
+    for (int i = 0; i < 8; i++) {
+      double slope = Slope(p, x);
+      if (!(slope > 0)) {
+        break;
+      }
+      double step = Polyval<5>(p, x) / slope;
+      x -= step;
+      if (!(fabs(x - px) <= d)) {
+        break;
+      }
+      if (fabs(step) <= 1e-10 * (1 + fabs(x))) {
+        found = true;
+        break;
+      }
+    }
+  }
+  if (!found) {
+    x = Roots(p, c, px, py);
+  }
+
+  double f_x;
+  double df_x;
+  Polyval<3>(c, x, f_x, df_x);
+  ClosestPoint point;
+  point.x = x;
+  point.heading = atan(df_x);
+  // Offset of the point from (px, py) along the left normal of the
+  // reference there.
+  point.cte = ((f_x - py) - df_x * (x - px)) / sqrt(1 + df_x * df_x);
+  return point;
+}
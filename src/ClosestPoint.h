@@ -0,0 +1,26 @@
+#ifndef CLOSEST_POINT_H
+#define CLOSEST_POINT_H
+
+#include "Eigen-3.3/Eigen/Core"
+
+// Point of the reference y = c0 + c1 x + c2 x^2 + c3 x^3 nearest to
+// (px, py): where the derivative of the squared distance, a quintic in x,
+// has the root of least distance. Near a gentle reference, the common
+// case, that is the only root within the vertical offset of px, which a
+// few Newton steps from px find; otherwise every root is found as an
+// eigenvalue of the fixed-size companion matrix of the quintic (Eigen's
+// PolynomialSolver), or of a lower-degree one once the cubic degenerates.
+// Nothing is allocated.
+struct ClosestPoint {
+  // Abscissa of the point.
+  double x;
+  // Signed distance to it, positive with the reference to the left of
+  // (px, py), as f(px) - py is for a reference heading along x.
+  double cte;
+  // Heading of the reference there, atan(f'(x)).
+  double heading;
+};
+
+ClosestPoint CubicClosestPoint(const Eigen::Vector4d& coeffs, double px, double py);
+
+#endif /* CLOSEST_POINT_H */
@@ -0,0 +1,146 @@
+#include "ControlTable.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+using namespace std;
+
+static const char table_magic[4] = { 'M', 'P', 'C', 'T' };
+static const uint32_t table_version = 1;
+
+ControlTable::ControlTable() : horizon_(0) {
+  for (int d = 0; d < n_dims; d++) {
+    axes_[d].lo = 0;
+    axes_[d].hi = 0;
+    axes_[d].n = 0;
+  }
+}
+
+ControlTable::ControlTable(const Axis* axes, size_t horizon) : horizon_(horizon) {
+  size_t size = 1;
+  for (int d = 0; d < n_dims; d++) {
+    axes_[d] = axes[d];
+    size *= size_t(max(axes[d].n, 1));
+  }
+  values_.assign(2 * size, NAN);
+}
+
+void ControlTable::Point(size_t i, double* p) const {
+  for (int d = 0; d < n_dims; d++) {
+    p[d] = axes_[d].At(int(i % axes_[d].n));
+    i /= axes_[d].n;
+  }
+}
+
+void ControlTable::Set(size_t i, double delta, double a) {
+  values_[2 * i] = float(delta);
+  values_[2 * i + 1] = float(a);
+}
+
+bool ControlTable::Lookup(const double* p, double& delta, double& a) const {
+  if (values_.empty()) {
+    return false;
+  }
+
+  // Cell and position within it along every axis.
+  size_t base = 0;
+  size_t stride[n_dims];
+  double t[n_dims];
+  size_t s = 1;
+  for (int d = 0; d < n_dims; d++) {
+    const Axis& axis = axes_[d];
+    stride[d] = s;
+    s *= axis.n;
+    if (axis.n < 2) {
+      t[d] = 0;
+      stride[d] = 0;
+      continue;
+    }
+    double u = (p[d] - axis.lo) / (axis.hi - axis.lo) * (axis.n - 1);
+    if (!(u >= 0 && u <= axis.n - 1)) {
+      return false;
+    }
+    int cell = min(int(u), axis.n - 2);
+    t[d] = u - cell;
+    base += cell * stride[d];
+  }
+
+  // Weighted sum over the 2^n_dims corners of the cell.
+  double sum_delta = 0;
+  double sum_a = 0;
+  for (int corner = 0; corner < (1 << n_dims); corner++) {
+    size_t i = base;
+    double w = 1;
+    for (int d = 0; d < n_dims; d++) {
+      if (corner & (1 << d)) {
+        i += stride[d];
+        w *= t[d];
+      } else {
+        w *= 1 - t[d];
+      }
+    }
+    if (w == 0) {
+      continue;
+    }
+    float corner_delta = values_[2 * i];
+    float corner_a = values_[2 * i + 1];
+    if (std::isnan(corner_delta) || std::isnan(corner_a)) {
+      return false;
+    }
+    sum_delta += w * corner_delta;
+    sum_a += w * corner_a;
+  }
+  delta = sum_delta;
+  a = sum_a;
+  return true;
+}
+
+bool ControlTable::Save(const string& path) const {
+  ofstream out(path.c_str(), ios::binary);
+  uint32_t horizon = uint32_t(horizon_);
+  out.write(table_magic, sizeof(table_magic));
+  out.write(reinterpret_cast<const char*>(&table_version), sizeof(table_version));
+  out.write(reinterpret_cast<const char*>(&horizon), sizeof(horizon));
+  for (int d = 0; d < n_dims; d++) {
+    int32_t n = axes_[d].n;
+    out.write(reinterpret_cast<const char*>(&axes_[d].lo), sizeof(double));
+    out.write(reinterpret_cast<const char*>(&axes_[d].hi), sizeof(double));
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  }
+  out.write(reinterpret_cast<const char*>(values_.data()), values_.size() * sizeof(float));
+  return bool(out);
+}
+
+bool ControlTable::Load(const string& path) {
+  *this = ControlTable();
+  ifstream in(path.c_str(), ios::binary);
+  char magic[4];
+  uint32_t version;
+  uint32_t horizon;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  in.read(reinterpret_cast<char*>(&horizon), sizeof(horizon));
+  if (!in || memcmp(magic, table_magic, sizeof(magic)) != 0 || version != table_version) {
+    return false;
+  }
+  Axis axes[n_dims];
+  for (int d = 0; d < n_dims; d++) {
+    int32_t n;
+    in.read(reinterpret_cast<char*>(&axes[d].lo), sizeof(double));
+    in.read(reinterpret_cast<char*>(&axes[d].hi), sizeof(double));
+    in.read(reinterpret_cast<char*>(&n), sizeof(n));
+    if (!in || n < 1 || n > 1024) {
+      return false;
+    }
+    axes[d].n = n;
+  }
+  ControlTable table(axes, horizon);
+  in.read(reinterpret_cast<char*>(table.values_.data()), table.values_.size() * sizeof(float));
+  if (!in) {
+    return false;
+  }
+  *this = table;
+  return true;
+}
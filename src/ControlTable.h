@@ -0,0 +1,62 @@
+#ifndef CONTROL_TABLE_H
+#define CONTROL_TABLE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Precomputed first controls of the MPC over a regular grid, interpolated
+// multilinearly.
+//
+// In the frame of the vehicle the solve depends on the speed, the errors
+// and the coefficients of the reference polynomial, and when the state has
+// not been displaced by latency compensation cte and epsi are the first
+// two coefficients: cte = c0, epsi = -atan(c1). The table is therefore
+// indexed by [v, cte, epsi, c2, c3], built offline by tools/mpc_table.cpp
+// with MPC::Solve at every grid point, and answers only inside the grid.
+class ControlTable {
+ public:
+  enum { n_dims = 5 };
+
+  // n evenly spaced values from lo to hi.
+  struct Axis {
+    double lo;
+    double hi;
+    int n;
+
+    double At(int i) const { return n > 1 ? lo + (hi - lo) * i / (n - 1) : lo; }
+  };
+
+  ControlTable();
+
+  // An empty table over the axes, for the horizon N it is built with.
+  ControlTable(const Axis* axes, size_t horizon);
+
+  size_t Size() const { return values_.size() / 2; }
+  size_t Horizon() const { return horizon_; }
+  const Axis& GetAxis(int dim) const { return axes_[dim]; }
+
+  // Coordinates of grid point i.
+  void Point(size_t i, double* p) const;
+
+  // Controls of grid point i; NaN marks a point without a solution.
+  void Set(size_t i, double delta, double a);
+
+  // Interpolated controls at p. False outside the grid or next to a point
+  // without a solution.
+  bool Lookup(const double* p, double& delta, double& a) const;
+
+  bool Save(const std::string& path) const;
+
+  // Replace the table with the one in path. False, leaving the table
+  // empty, when the file is not a table.
+  bool Load(const std::string& path);
+
+ private:
+  Axis axes_[n_dims];
+  size_t horizon_;
+  // [delta, a] per grid point, the first axis varying fastest.
+  std::vector<float> values_;
+};
+
+#endif /* CONTROL_TABLE_H */
@@ -0,0 +1,1456 @@
+#include "Controller.h"
+#include <math.h>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include "AllocCount.h"
+#include "BinaryProtocol.h"
+#include "ClosestPoint.h"
+#include "Horner.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Polyfit.h"
+#include "SteerWriter.h"
+#include "Transform.h"
+#include "Weights.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Latency assumed before the first sample: the actuator latency plus a
+// typical solve.
+static const double initial_solve = 0.05;
+
+// Weight of a new latency sample.
+static const double latency_alpha = 0.2;
+
+// Share of the time between frames a presolve may take, so that it ends
+// before the next frame comes; a gap of more than max_frame_gap is a pause,
+// not a frame interval.
+static const double presolve_share = 0.8;
+static const double max_frame_gap = 1.0;
+
+// Standard deviations of the pose the simulator reports, x, y, psi and v,
+// and of how far the vehicle strays from the model over a second.
+static const double measurement_sd[4] = { 0.1, 0.1, 0.01, 0.2 };
+static const double process_sd[4] = { 0.5, 0.5, 0.1, 2.0 };
+
+// How far the pose of a frame may be from what the last plan predicted
+// for it, in position, heading and speed, and its cross-track and heading
+// errors from those of the last plan's reference, for the frame to be
+// answered from that plan (see Controller::Replay).
+static const double replay_position = 0.1;
+static const double replay_psi = 0.01;
+static const double replay_v = 0.2;
+static const double replay_cte = 0.05;
+static const double replay_epsi = 0.01;
+
+// Lookahead of the pure pursuit of the hybrid mode, the distance covered
+// in pursuit_lookahead seconds but at least pursuit_min_lookahead metres,
+// and its throttle per m/s of speed error.
+static const double pursuit_lookahead = 0.8;
+static const double pursuit_min_lookahead = 5.0;
+static const double pursuit_speed_gain = 0.1;
+
+// Oldest plan of the two-rate mode that is still followed, and how far
+// behind the vehicle its points are still fitted.
+static const double max_plan_age = 1.0;
+static const double plan_behind = 5.0;
+
+// Farthest from the centre line, in metres, that an obstacle is still in
+// the way.
+static const double obstacle_corridor = 4.0;
+
+// The latency is predicted over in steps of at most this, so that long
+// delays still follow the arc of a turn.
+static const double max_step = 0.05;
+
+static double clip(double v, double low, double high) { return max(low, min(v, high)); }
+
+// Curvature of the reference at x.
+static double Curvature(const Eigen::Vector4d& coeffs, double x) {
+  double slope = coeffs[1] + (2 * coeffs[2] + 3 * coeffs[3] * x) * x;
+  return (2 * coeffs[2] + 6 * coeffs[3] * x) / pow(1 + slope * slope, 1.5);
+}
+
+// Steering of the arc from pose through the point of the reference a
+// lookahead further along x, for a model with the given understeer.
+static double PursuitSteer(const PoseVector& pose, const Eigen::Vector4d& coeffs, double understeer) {
+  double tx = pose[0] + max(pursuit_min_lookahead, pursuit_lookahead * pose[3]);
+  double dx = tx - pose[0];
+  double dy = Polyval<3>(coeffs, tx) - pose[1];
+  double lx = cos(pose[2]) * dx + sin(pose[2]) * dy;
+  double ly = -sin(pose[2]) * dx + cos(pose[2]) * dy;
+  double curvature = 2 * ly / (lx * lx + ly * ly);
+  return clip(atan(Lf * curvature * (1 + understeer * pose[3] * pose[3])), -max_delta, max_delta);
+}
+
+// Lateral offset of the waypoints at x = 0 in the vehicle frame: along the
+// segment between two consecutive waypoints that crosses it, or else the
+// segment of the two nearest it, extended.
+static double PathOffset(const double* xs, const double* ys, size_t n) {
+  if (n == 0) {
+    return 0;
+  }
+  if (n == 1) {
+    return ys[0];
+  }
+  size_t best = 0;
+  double best_distance = INFINITY;
+  for (size_t i = 0; i + 1 < n; i++) {
+    if ((xs[i] <= 0) != (xs[i + 1] <= 0)) {
+      best = i;
+      break;
+    }
+    double distance = min(fabs(xs[i]), fabs(xs[i + 1]));
+    if (distance < best_distance) {
+      best = i;
+      best_distance = distance;
+    }
+  }
+  double dx = xs[best + 1] - xs[best];
+  if (fabs(dx) < 1e-9) {
+    return 0.5 * (ys[best] + ys[best + 1]);
+  }
+  return ys[best] - xs[best] * (ys[best + 1] - ys[best]) / dx;
+}
+
+// Solve time the adaptive horizon keeps under, in seconds.
+static double SolveBudget(const ControllerOptions& options) {
+  return (options.deadline_ms > 0 ? options.deadline_ms : options.solve_budget_ms) / 1000.0;
+}
+
+// Latency of the actuators in seconds, besides the solve.
+static double PredictedLatency(const ControllerOptions& options) {
+  return (options.latency_ms + options.actuator_lag_ms) / 1000.0;
+}
+
+// The horizon of the options, or the default one if it was not compiled.
+static size_t CompiledHorizon(size_t horizon) {
+  if (HorizonIndex(horizon) == n_horizons) {
+    MPC_LOG(LogLevel::Warning, "No MPC for N = %zu, using 11", horizon);
+    return 11;
+  }
+  return horizon;
+}
+
+Controller::Controller(const ControllerOptions& options)
+    : options_(options),
+      horizon_(CompiledHorizon(options.horizon)),
+      policy_(SolveBudget(options), horizon_, options.dt),
+      governor_(SolveBudget(options)),
+      reference_hint_(ReferencePath::no_hint),
+      ref_v_(options.ref_v),
+      latency_(PredictedLatency(options) + initial_solve, latency_alpha),
+      filter_(options.understeer, StateFilter::Vector(measurement_sd), StateFilter::Vector(process_sd)),
+      weights_(default_weights),
+      weights_version_(0),
+      frame_interval_(options.latency_ms / 1000.0 + initial_solve),
+      speculation_(false),
+      frenet_frame_(false),
+      bytes_(0),
+      remeasure_(false),
+      n_obstacles_(0) {
+  options_.horizon = horizon_;
+  fill(dt_, dt_ + n_horizons, options.dt);
+  fill(stage_v_, stage_v_ + max_horizon, options.ref_v);
+  followed_.n = 0;
+  publishing_.valid = false;
+  publishing_.solves = 0;
+  if (options.weights) {
+    weights_ = *options.weights;
+  } else {
+    weights_version_ = CurrentWeights(weights_);
+  }
+  if (!options.scenarios.empty() && !options.candidate_offsets.empty()) {
+    MPC_LOG(LogLevel::Warning, "The scenarios replace the candidate references");
+    options_.candidate_offsets.clear();
+  }
+  options_.candidate_offsets.resize(min(options_.candidate_offsets.size(), size_t(max_candidates) - 1));
+  options_.scenarios.resize(min(options_.scenarios.size(), size_t(max_candidates) - 1));
+  size_t extra = max(options_.candidate_offsets.size(), options_.scenarios.size());
+  if (extra > 0) {
+    // The group's threads put CppAD in parallel mode.
+    options_.multi_start = 1;
+    group_.reset(new SolverGroup(extra));
+  }
+  if (options.two_rate) {
+    // The planner's thread puts CppAD in parallel mode.
+    options_.multi_start = 1;
+    planner_.reset(new Planner(options.plan_dt, options.plan_interval_ms / 1000.0, options.understeer,
+                               options.ref_v, weights_));
+  }
+  // Record the tape of the initial horizon ahead of the first frame.
+  switch (horizon_) {
+#define MPC_CREATE(N) \
+  case N:             \
+    Solver<N>();      \
+    break;
+    MPC_FOR_EACH_HORIZON(MPC_CREATE)
+#undef MPC_CREATE
+  }
+}
+
+Controller::~Controller() {
+  if (governor_.Level() >= ShedLevel::Logging) {
+    ShedLogging(false);
+  }
+}
+
+template <size_t N>
+void Controller::SetUp(MPC<N>& mpc) {
+  // Initialise with zero for cross-track error and psi error
+  // and the reference speed
+  mpc.Init(0, 0, options_.ref_v);
+  mpc.SetBackend(governor_.Level() >= ShedLevel::Backend ? options_.shed_backend : options_.backend);
+  if (options_.frenet) {
+    mpc.SetFrenet(true);
+  }
+  mpc.SetMultiStart(options_.multi_start);
+  mpc.SetCoarseStart(options_.coarse_start);
+  mpc.SetSensitivityUpdate(options_.sensitivity_update);
+  mpc.SetMixedPrecision(options_.mixed_precision);
+  mpc.SetSamplingThreads(options_.sampling_threads);
+  mpc.SetSamplingSeed(options_.sampling_seed);
+  if (options_.sampling_device_samples > 0) {
+    mpc.SetSamplingDevice(options_.sampling_device_samples);
+  }
+  mpc.SetTable(options_.table);
+  mpc.SetWarmStartNet(options_.warm_start_net);
+  mpc.SetTimestep(dt_[HorizonIndex(N)], options_.dt_growth);
+  mpc.SetUndersteer(options_.understeer);
+  mpc.SetTerminalCost(options_.terminal_cost);
+  mpc.SetSoftConstraints(options_.soft);
+  mpc.SetRateLimits(options_.rate_limits);
+  mpc.SetIpoptOptions(options_.ipopt);
+  mpc.SetMoveBlocks(options_.move_blocks);
+  mpc.SetSolutionCache(options_.solution_cache);
+  mpc.SetWeights(weights_);
+  Shed(mpc, governor_.Level());
+}
+
+template <size_t N>
+void Controller::Shed(MPC<N>& mpc, ShedLevel from) {
+  ShedLevel level = governor_.Level();
+  mpc.SetSingleStart(level >= ShedLevel::MultiStart);
+  mpc.SetIterationCap(level >= ShedLevel::Iterations ? options_.shed_max_iter : 0);
+  // A switch of backend starts the solver over.
+  bool cheaper = level >= ShedLevel::Backend;
+  if (cheaper != (from >= ShedLevel::Backend) && options_.shed_backend != options_.backend) {
+    mpc.SetBackend(cheaper ? options_.shed_backend : options_.backend);
+  }
+}
+
+void Controller::Shed(ShedLevel from) {
+  bool quiet = governor_.Level() >= ShedLevel::Logging;
+  if (quiet != (from >= ShedLevel::Logging)) {
+    ShedLogging(quiet);
+  }
+#define MPC_SHED(N)                                 \
+  if (mpc_##N##_) {                                 \
+    Shed(*mpc_##N##_, from);                        \
+  }                                                 \
+  for (size_t i = 0; i < max_candidates; i++) {     \
+    if (candidates_##N##_[i]) {                     \
+      Shed(*candidates_##N##_[i], from);            \
+    }                                               \
+  }
+  MPC_FOR_EACH_HORIZON(MPC_SHED)
+#undef MPC_SHED
+}
+
+template <size_t N>
+MPC<N>& Controller::Solver() {
+  unique_ptr<MPC<N> >& mpc = Slot(integral_constant<size_t, N>());
+  if (!mpc) {
+    mpc.reset(new MPC<N>());
+    SetUp(*mpc);
+    remeasure_ = true;
+  }
+  return *mpc;
+}
+
+bool Controller::Made(size_t horizon) const {
+  switch (horizon) {
+#define MPC_MADE(N) \
+  case N:           \
+    return bool(mpc_##N##_);
+    MPC_FOR_EACH_HORIZON(MPC_MADE)
+#undef MPC_MADE
+  }
+  return false;
+}
+
+void Controller::Measure() {
+  if (!remeasure_ || options_.memory_budget == 0) {
+    return;
+  }
+  remeasure_ = false;
+  Footprint footprint;
+  AddFootprint(footprint);
+  bytes_ = footprint.Total();
+  if (bytes_ <= options_.memory_budget) {
+    return;
+  }
+  MPC_LOG(LogLevel::Warning, "Controller at %zu KiB, past its budget of %zu KiB; releasing its spare solvers",
+          bytes_ / 1024, options_.memory_budget / 1024);
+  size_t released = 0;
+#define MPC_RELEASE(N)                              \
+  if (mpc_##N##_ && N != horizon_) {                \
+    mpc_##N##_.reset();                             \
+    released++;                                     \
+  }                                                 \
+  for (size_t i = 0; i < max_candidates; i++) {     \
+    if (candidates_##N##_[i]) {                     \
+      candidates_##N##_[i].reset();                 \
+      released++;                                   \
+    }                                               \
+  }
+  MPC_FOR_EACH_HORIZON(MPC_RELEASE)
+#undef MPC_RELEASE
+  CountEvent(Counter::BudgetRejections, released);
+  footprint = Footprint();
+  AddFootprint(footprint);
+  bytes_ = footprint.Total();
+}
+
+template <size_t N>
+MPC<N>& Controller::CandidateSolver(size_t i, double dt, bool retime, bool cold) {
+  unique_ptr<MPC<N> >& mpc = Candidates(integral_constant<size_t, N>())[i];
+  if (!mpc) {
+    mpc.reset(new MPC<N>());
+    SetUp(*mpc);
+    mpc->SetSamplingSeed(options_.sampling_seed + i);
+    if (!options_.scenarios.empty()) {
+      mpc->SetUndersteer(options_.scenarios[i - 1].understeer);
+    }
+  }
+  if (retime) {
+    mpc->SetTimestep(dt, options_.dt_growth);
+  } else if (cold) {
+    mpc->Reset();
+  }
+  mpc->SetReferenceSpeed(ref_v_);
+  mpc->SetStageReferences(NULL, NULL, options_.speed_profile ? stage_v_ : NULL);
+  return *mpc;
+}
+
+void WarmUpFrame(const Track& track, size_t k, size_t solves, double ref_v, Telemetry& frame) {
+  // Waypoints skipped between frames, so that the frames cover the track.
+  const size_t stride = 7;
+  const size_t window = 6;
+  size_t i = k * stride % track.Size();
+  double heading = track.Heading(i);
+  // Up to half a metre either side of the line, and a little askew.
+  double offset = 0.5 * (double(k % 3) - 1);
+  frame.ws = NULL;
+  frame.framing = Framing::Text;
+  frame.n_points = window;
+  track.Window(i, window, frame.ptsx, frame.ptsy);
+  frame.px = track.x[i] - offset * sin(heading);
+  frame.py = track.y[i] + offset * cos(heading);
+  frame.psi = heading + 0.02 * (double(k % 5) - 2);
+  frame.v = ref_v * double(k + 1) / double(solves);
+  frame.delta = 0;
+  frame.a = 0;
+  frame.received = PipelineClock::now();
+  frame.arrived = frame.received;
+}
+
+void Controller::WarmUp(const Track& track, size_t solves, vector<double>& times) {
+  Telemetry frame;
+  Command command;
+  command.ws = NULL;
+  for (size_t k = 0; k < solves; k++) {
+    WarmUpFrame(track, k, solves, options_.ref_v, frame);
+    command.framing = frame.framing;
+    command.received = frame.received;
+    command.arrived = frame.arrived;
+    Solve(frame, command);
+    times.push_back(duration<double>(PipelineClock::now() - frame.received).count());
+  }
+  Reset();
+}
+
+void Controller::SolveOffline(const OfflineProblem& problem, size_t horizon, OfflineSolution& solution) {
+  FollowWeights();
+  switch (horizon) {
+#define MPC_SOLVE_OFFLINE(N)               \
+  case N:                                  \
+    SolveOffline<N>(problem, solution);    \
+    break;
+    MPC_FOR_EACH_HORIZON(MPC_SOLVE_OFFLINE)
+#undef MPC_SOLVE_OFFLINE
+  }
+}
+
+template <size_t N>
+void Controller::SolveOffline(const OfflineProblem& problem, OfflineSolution& solution) {
+  MPC<N>& mpc = Solver<N>();
+  mpc.Reset();
+  mpc.Init(problem.cte_ref, problem.epsi_ref, problem.v_ref);
+  const typename MPC<N>::Result& result =
+      mpc.Solve(Eigen::Map<const StateVector>(problem.state), Eigen::Map<const Eigen::Vector4d>(problem.coeffs));
+  solution.ok = result.ok;
+  solution.usable = result.usable;
+  solution.cost = result.cost;
+  solution.iterations = result.iterations;
+  solution.solve_time = result.solve_time;
+  solution.n = N - 1;
+  copy(result.delta.data(), result.delta.data() + N - 1, solution.delta);
+  copy(result.a.data(), result.a.data() + N - 1, solution.a);
+}
+
+bool Controller::SaveState(ostream& out) const {
+  uint32_t horizons[n_horizons + 1] = { uint32_t(horizon_) };
+  size_t k = 1;
+#define MPC_LIST_HORIZON(N) horizons[k++] = N;
+  MPC_FOR_EACH_HORIZON(MPC_LIST_HORIZON)
+#undef MPC_LIST_HORIZON
+  double estimates[2] = { latency_.Seconds(), frame_interval_ };
+  out.write(reinterpret_cast<const char*>(horizons), sizeof(horizons));
+  out.write(reinterpret_cast<const char*>(estimates), sizeof(estimates));
+  out.write(reinterpret_cast<const char*>(dt_), sizeof(dt_));
+#define MPC_SAVE_STATE(N)                                              \
+  {                                                                    \
+    uint8_t present = bool(mpc_##N##_);                                \
+    out.write(reinterpret_cast<const char*>(&present), sizeof(present)); \
+    if (present && !mpc_##N##_->SaveState(out)) {                      \
+      return false;                                                    \
+    }                                                                  \
+  }
+  MPC_FOR_EACH_HORIZON(MPC_SAVE_STATE)
+#undef MPC_SAVE_STATE
+  return bool(out);
+}
+
+void Controller::AddFootprint(Footprint& footprint) const {
+  footprint.controllers++;
+  footprint.connection_bytes += sizeof(Controller);
+#define MPC_ADD_FOOTPRINT(N)                        \
+  if (mpc_##N##_) {                                 \
+    mpc_##N##_->AddFootprint(footprint);            \
+  }                                                 \
+  for (size_t i = 0; i < max_candidates; i++) {     \
+    if (candidates_##N##_[i]) {                     \
+      candidates_##N##_[i]->AddFootprint(footprint); \
+    }                                               \
+  }
+  MPC_FOR_EACH_HORIZON(MPC_ADD_FOOTPRINT)
+#undef MPC_ADD_FOOTPRINT
+}
+
+bool Controller::LoadState(istream& in) {
+  Reset();
+  uint32_t horizons[n_horizons + 1];
+  double estimates[2];
+  double dt[n_horizons];
+  in.read(reinterpret_cast<char*>(horizons), sizeof(horizons));
+  in.read(reinterpret_cast<char*>(estimates), sizeof(estimates));
+  in.read(reinterpret_cast<char*>(dt), sizeof(dt));
+  if (!in || HorizonIndex(horizons[0]) == n_horizons) {
+    return false;
+  }
+  size_t k = 1;
+  bool same = true;
+#define MPC_CHECK_HORIZON(N) same = same && horizons[k++] == N;
+  MPC_FOR_EACH_HORIZON(MPC_CHECK_HORIZON)
+#undef MPC_CHECK_HORIZON
+  if (!same) {
+    return false;
+  }
+  // The time steps first, so that the MPCs are created over them.
+  copy(dt, dt + n_horizons, dt_);
+  bool ok = true;
+#define MPC_LOAD_STATE(N)                                                \
+  if (ok) {                                                              \
+    uint8_t present = 0;                                                 \
+    in.read(reinterpret_cast<char*>(&present), sizeof(present));         \
+    if (present) {                                                       \
+      MPC<N>& mpc = Solver<N>();                                         \
+      mpc.SetTimestep(dt_[HorizonIndex(N)], options_.dt_growth);         \
+      ok = mpc.LoadState(in);                                            \
+    }                                                                    \
+    ok = ok && bool(in);                                                 \
+  }
+  MPC_FOR_EACH_HORIZON(MPC_LOAD_STATE)
+#undef MPC_LOAD_STATE
+  if (!ok) {
+    fill(dt_, dt_ + n_horizons, options_.dt);
+#define MPC_RESTORE_TIMESTEP(N)                                \
+  if (mpc_##N##_) {                                            \
+    mpc_##N##_->SetTimestep(options_.dt, options_.dt_growth); \
+  }
+    MPC_FOR_EACH_HORIZON(MPC_RESTORE_TIMESTEP)
+#undef MPC_RESTORE_TIMESTEP
+    Reset();
+    return false;
+  }
+  horizon_ = horizons[0];
+  latency_.Reset(estimates[0]);
+  frame_interval_ = estimates[1];
+  return true;
+}
+
+void Controller::FollowWeights() {
+  if (!options_.weights && WeightsVersion() != weights_version_) {
+    weights_version_ = CurrentWeights(weights_);
+#define MPC_SET_WEIGHTS(N)                          \
+    if (mpc_##N##_) {                               \
+      mpc_##N##_->SetWeights(weights_);             \
+    }                                               \
+    for (size_t i = 0; i < max_candidates; i++) {   \
+      if (candidates_##N##_[i]) {                   \
+        candidates_##N##_[i]->SetWeights(weights_); \
+      }                                             \
+    }
+    MPC_FOR_EACH_HORIZON(MPC_SET_WEIGHTS)
+#undef MPC_SET_WEIGHTS
+    if (planner_) {
+      planner_->SetWeights(weights_);
+    }
+  }
+}
+
+void Controller::Reset() {
+#define MPC_RESET(N)                                \
+  if (mpc_##N##_) {                                 \
+    mpc_##N##_->Reset();                            \
+  }                                                 \
+  for (size_t i = 0; i < max_candidates; i++) {     \
+    if (candidates_##N##_[i]) {                     \
+      candidates_##N##_[i]->Reset();                \
+    }                                               \
+  }
+  MPC_FOR_EACH_HORIZON(MPC_RESET)
+#undef MPC_RESET
+  horizon_ = options_.horizon;
+  policy_.Reset();
+  ShedLevel shed = governor_.Level();
+  governor_.Reset();
+  Shed(shed);
+  fitter_ = WindowPolyfit<3, Telemetry::max_points>();
+  reference_hint_ = ReferencePath::no_hint;
+  latency_.Reset(PredictedLatency(options_) + initial_solve);
+  filter_.Reset();
+  stored_.valid = false;
+  followed_.n = 0;
+  publishing_.valid = false;
+  publishing_.solves = 0;
+  published_.Write(publishing_);
+  pursuing_ = false;
+  handoff_ = false;
+  if (planner_) {
+    planner_->Reset();
+  }
+  frame_interval_ = options_.latency_ms / 1000.0 + initial_solve;
+  last_received_ = PipelineClock::time_point();
+  last_viz_ = PipelineClock::time_point();
+  speculation_ = false;
+}
+
+void Controller::Prepare() {
+  bool speculate = speculation_;
+  speculation_ = false;
+  switch (horizon_) {
+#define MPC_PREPARE(N)                                                                    \
+  case N:                                                                                 \
+    Solver<N>().Prepare();                                                                \
+    if (speculate) {                                                                      \
+      Solver<N>().Presolve(speculative_state_, speculative_coeffs_, speculative_deadline_); \
+    }                                                                                     \
+    break;
+    MPC_FOR_EACH_HORIZON(MPC_PREPARE)
+#undef MPC_PREPARE
+  }
+}
+
+void Controller::KeepWarm() {
+  switch (horizon_) {
+#define MPC_KEEP_WARM(N)    \
+  case N:                   \
+    Solver<N>().KeepWarm(); \
+    break;
+    MPC_FOR_EACH_HORIZON(MPC_KEEP_WARM)
+#undef MPC_KEEP_WARM
+  }
+}
+
+void Controller::Delivered(const Command& command, PipelineClock::time_point now) {
+  // From the arrival, so that a frame's wait before it was read is
+  // predicted over as well.
+  latency_.Add(duration<double>(now - command.arrived).count() + PredictedLatency(options_));
+  followed_ = command.actuation;
+  followed_from_ = now;
+}
+
+bool Controller::FollowUp(PipelineClock::time_point now, PipelineClock::duration min_gap, Framing framing,
+                          string& msg) const {
+  const ActuationPlan& p = followed_;
+  if (p.n == 0 || now - followed_from_ < min_gap) {
+    return false;
+  }
+  // The stage of the plan now falls in, as Replay finds it, and how far
+  // into it. The follow-up goes through the same emulated latency as the
+  // delivered command, so the plan's time is that since the delivery.
+  double elapsed = duration<double>(now - followed_from_).count();
+  double start = 0;
+  double step = p.dt;
+  size_t k = 0;
+  while (k < p.n && start + step <= elapsed) {
+    start += step;
+    step *= p.growth;
+    k++;
+  }
+  if (k == p.n) {
+    return false;
+  }
+  // Linear from the actuators of stage k to those of the next, which the
+  // last one holds. The MPC holds them over a stage; the ramp takes the
+  // steps out of the commands, and meets the plan at every boundary.
+  size_t next = min(k + 1, p.n - 1);
+  double f = (elapsed - start) / step;
+  double steering = p.steering[k] + f * (p.steering[next] - p.steering[k]);
+  double throttle = p.throttle[k] + f * (p.throttle[next] - p.throttle[k]);
+  if (framing == Framing::Text) {
+    WriteSteer(msg, steering, throttle, NULL, NULL, 0, NULL, NULL, 0, options_.viz);
+  } else {
+    WriteBinaryCommand(msg, framing, steering, throttle, NULL, NULL, 0, NULL, NULL, 0);
+  }
+  return true;
+}
+
+template <size_t N>
+void Controller::SolveWith(const StateVector& state, const Eigen::Vector4d& coeffs, double dt,
+                           bool cold, PipelineClock::time_point deadline, Plan& plan) {
+  MPC<N>& mpc = Solver<N>();
+  double& mpc_dt = dt_[HorizonIndex(N)];
+  bool retime = dt != mpc_dt;
+  if (retime) {
+    mpc.SetTimestep(dt, options_.dt_growth);
+    mpc_dt = dt;
+  } else if (cold) {
+    // The warm start is from the last time this horizon was used.
+    mpc.Reset();
+  }
+  mpc.SetReferenceSpeed(ref_v_);
+  mpc.SetStageReferences(NULL, NULL, options_.speed_profile ? stage_v_ : NULL);
+  // The problem along the path, from the state's pose in map coordinates
+  // and the curvature over as far as the horizon may reach.
+  const bool frenet = frenet_frame_ && mpc.Frenet();
+  if (frenet) {
+    double horizon_time = 0;
+    double step = dt;
+    for (size_t k = 0; k + 1 < N; k++) {
+      horizon_time += step;
+      step *= options_.dt_growth;
+    }
+    double c = cos(frenet_pose_[2]);
+    double s = sin(frenet_pose_[2]);
+    double n;
+    double mu;
+    options_.reference->Frenet(frenet_pose_[0] + state[0] * c - state[1] * s,
+                               frenet_pose_[1] + state[0] * s + state[1] * c, frenet_pose_[2] + state[2],
+                               max(state[3], ref_v_) * horizon_time, reference_hint_, frenet_station_, n, mu,
+                               frenet_coeffs_);
+    frenet_state_ << 0, n, mu, state[3], -n, mu;
+  }
+  const StateVector& problem = frenet ? frenet_state_ : state;
+  const Eigen::Vector4d& reference = frenet ? frenet_coeffs_ : coeffs;
+  // The station of the state, predicted ahead of the frame's pose, for
+  // the plan library.
+  bool library = options_.plan_library && options_.reference && reference_hint_ != ReferencePath::no_hint;
+  double station = frenet ? frenet_station_ : 0;
+  if (library && !frenet) {
+    station = options_.reference->Sample(reference_hint_).s + state[0];
+  }
+  if (handoff_) {
+    mpc.SetGuess(pursuit_delta_, pursuit_a_);
+    handoff_ = false;
+  } else if (library && mpc.NeedsGuess(problem)) {
+    PlanLibrary::Plan guess;
+    if (options_.plan_library->Find(station, problem[3], problem[4], problem[5], guess)) {
+      PlanLibrary::Resample(guess, N - 1, dt, options_.dt_growth, library_delta_, library_a_);
+      mpc.SetGuess(library_delta_, library_a_);
+      CountEvent(Counter::LibraryStarts);
+    } else {
+      CountEvent(Counter::LibraryMisses);
+    }
+  }
+  mpc.SetObstacles(obstacles_, n_obstacles_);
+  const typename MPC<N>::Result* results[max_candidates];
+  size_t n = group_ && !frenet
+                 ? min(max(options_.candidate_offsets.size(), options_.scenarios.size()), group_->Threads()) + 1
+                 : 1;
+  // At the budget, only the candidates made already solve.
+  size_t made = 1;
+  while (made < n && Candidates(integral_constant<size_t, N>())[made]) {
+    made++;
+  }
+  if (made < n && AtBudget()) {
+    CountEvent(Counter::BudgetRejections, n - made);
+    n = made;
+  }
+  remeasure_ = remeasure_ || made < n;
+  size_t best = 0;
+  // The wall time of both rounds of the scenarios.
+  double solve_time = -1;
+  if (n == 1) {
+    results[0] = &mpc.Solve(problem, reference, deadline);
+  } else if (!options_.scenarios.empty()) {
+    PipelineClock::time_point start = PipelineClock::now();
+    results[0] = &SolveScenarios<N>(mpc, n, state, coeffs, dt, retime, cold, deadline);
+    solve_time = duration<double>(PipelineClock::now() - start).count();
+  } else {
+    // Candidate i follows the reference shifted sideways by its offset,
+    // which moves the path and the cross-track error alike.
+    group_->Run(n, [&](size_t i) {
+      if (i == 0) {
+        results[0] = &mpc.Solve(state, coeffs, deadline);
+        return;
+      }
+      MPC<N>& candidate = CandidateSolver<N>(i, dt, retime, cold);
+      candidate.SetObstacles(obstacles_, n_obstacles_);
+      double offset = options_.candidate_offsets[i - 1];
+      StateVector shifted_state = state;
+      shifted_state[4] += offset;
+      Eigen::Vector4d shifted = coeffs;
+      shifted[0] += offset;
+      results[i] = &candidate.Solve(shifted_state, shifted, deadline);
+    });
+    for (size_t i = 1; i < n; i++) {
+      if (results[i]->ok && (!results[best]->ok || results[i]->cost < results[best]->cost)) {
+        best = i;
+      }
+    }
+    if (best != 0) {
+      MPC_LOG(LogLevel::Debug, "Candidate offset %g: cost %g instead of %g", options_.candidate_offsets[best - 1],
+              results[best]->cost, results[0]->cost);
+    }
+  }
+  // The nominal plan, which is that of the reference as it is.
+  if (library && results[0]->ok && !results[0]->fallback && !results[0]->tabulated) {
+    PlanLibrary::Plan kept;
+    kept.cte = problem[4];
+    kept.epsi = problem[5];
+    kept.v = problem[3];
+    kept.dt = dt;
+    kept.growth = options_.dt_growth;
+    kept.cost = results[0]->cost;
+    kept.n = min<size_t>(N - 1, PlanLibrary::max_stages);
+    copy(results[0]->delta.data(), results[0]->delta.data() + kept.n, kept.steering);
+    copy(results[0]->a.data(), results[0]->a.data() + kept.n, kept.throttle);
+    options_.plan_library->Insert(station, kept);
+  }
+  const typename MPC<N>::Result& result = *results[best];
+  plan.ok = result.ok;
+  plan.usable = result.usable;
+  plan.tabulated = result.tabulated;
+  plan.cost = result.cost;
+  plan.iterations = result.iterations;
+  plan.solve_time = solve_time >= 0 ? solve_time : result.solve_time;
+  plan.delta = result.delta[0];
+  plan.a = result.a[0];
+  plan.replayed = false;
+  plan.pursued = false;
+  plan.x = result.x.data();
+  plan.y = result.y.data();
+  plan.psi = result.psi.data();
+  plan.v = result.v.data();
+  plan.deltas = result.delta.data();
+  plan.accels = result.a.data();
+  plan.n = N;
+  if (frenet) {
+    // Back from the path to the vehicle frame of the frame.
+    double c = cos(frenet_pose_[2]);
+    double s = sin(frenet_pose_[2]);
+    for (size_t k = 0; k < N; k++) {
+      double px;
+      double py;
+      double heading;
+      options_.reference->PointAt(frenet_station_ + result.x[k], result.y[k], px, py, heading);
+      double dx = px - frenet_pose_[0];
+      double dy = py - frenet_pose_[1];
+      frenet_x_[k] = dx * c + dy * s;
+      frenet_y_[k] = -dx * s + dy * c;
+      frenet_psi_[k] = heading + result.psi[k] - frenet_pose_[2];
+    }
+    plan.x = frenet_x_;
+    plan.y = frenet_y_;
+    plan.psi = frenet_psi_;
+  }
+}
+
+template <size_t N>
+const typename MPC<N>::Result& Controller::SolveScenarios(MPC<N>& mpc, size_t n, const StateVector& state,
+                                                          const Eigen::Vector4d& coeffs, double dt, bool retime,
+                                                          bool cold, PipelineClock::time_point deadline) {
+  // The state each scenario starts from: the nominal one predicted over
+  // the extra latency, backwards for less, under its own model.
+  StateVector states[max_candidates];
+  states[0] = state;
+  for (size_t i = 1; i < n; i++) {
+    const Scenario& scenario = options_.scenarios[i - 1];
+    PoseVector pose = state.head<4>();
+    int steps = int(ceil(fabs(scenario.latency) / max_step));
+    for (int k = 0; k < steps; k++) {
+      pose = MPC<11>::Predict(pose, actuators_, scenario.latency / steps, scenario.understeer);
+    }
+    double cte;
+    double epsi;
+    TrackErrors(coeffs, pose[0], pose[1], pose[2], cte, epsi);
+    states[i] << pose[0], pose[1], pose[2], pose[3], cte, epsi;
+  }
+
+  const typename MPC<N>::Result* results[max_candidates];
+  group_->Run(n, [&](size_t i) {
+    MPC<N>& scenario = i == 0 ? mpc : CandidateSolver<N>(i, dt, retime, cold);
+    scenario.SetObstacles(obstacles_, n_obstacles_);
+    results[i] = &scenario.Solve(states[i], coeffs, deadline);
+  });
+
+  // Consensus on the first control: the mean of the scenarios that have
+  // a plan, which they all solve again for, each from its own solution.
+  double delta = 0;
+  double a = 0;
+  size_t agreeing = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (results[i]->usable) {
+      delta += results[i]->delta[0];
+      a += results[i]->a[0];
+      agreeing++;
+    }
+  }
+  if (agreeing < 2) {
+    return *results[0];
+  }
+  delta /= agreeing;
+  a /= agreeing;
+  MPC_LOG(LogLevel::Debug, "Scenarios agree on delta %g, a %g, nominal %g, %g", delta, a, results[0]->delta[0],
+          results[0]->a[0]);
+  group_->Run(n, [&](size_t i) {
+    MPC<N>& scenario = i == 0 ? mpc : *Candidates(integral_constant<size_t, N>())[i];
+    scenario.FixFirstControl(delta, a);
+    results[i] = &scenario.Solve(states[i], coeffs, deadline);
+  });
+  CountEvent(Counter::ScenarioConsensus);
+  return *results[0];
+}
+
+void Controller::KeepPlan(const Plan& plan, PipelineClock::time_point received, double frame_x,
+                          double frame_y, double frame_psi, const Eigen::Vector4d& coeffs, double dt) {
+  StoredPlan& s = stored_;
+  s.valid = plan.ok && !plan.tabulated && options_.replay_frames > 0;
+  if (!s.valid) {
+    return;
+  }
+  s.n = plan.n;
+  s.dt = dt;
+  s.received = received;
+  s.frame_x = frame_x;
+  s.frame_y = frame_y;
+  s.frame_psi = frame_psi;
+  s.coeffs = coeffs;
+  s.replays = 0;
+  copy(plan.x, plan.x + plan.n, s.x);
+  copy(plan.y, plan.y + plan.n, s.y);
+  copy(plan.psi, plan.psi + plan.n, s.psi);
+  copy(plan.v, plan.v + plan.n, s.v);
+  copy(plan.deltas, plan.deltas + plan.n - 1, s.delta);
+  copy(plan.accels, plan.accels + plan.n - 1, s.a);
+}
+
+bool Controller::Replay(PipelineClock::time_point received, double frame_x, double frame_y,
+                        double frame_psi, const StateVector& state, Plan& plan) {
+  StoredPlan& s = stored_;
+  if (!s.valid || s.replays + 1 >= size_t(options_.replay_frames)) {
+    return false;
+  }
+  // The stage of the plan the frame falls in, and the time into it.
+  double elapsed = duration<double>(received - s.received).count();
+  double start = 0;
+  double step = s.dt;
+  size_t k = 0;
+  while (k + 2 < s.n && start + step <= elapsed) {
+    start += step;
+    step *= options_.dt_growth;
+    k++;
+  }
+  if (elapsed < 0 || elapsed - start > step) {
+    return false;
+  }
+  PoseVector predicted(s.x[k], s.y[k], s.psi[k], s.v[k]);
+  ActuatorVector actuators(s.delta[k], s.a[k]);
+  predicted = MPC<11>::Predict(predicted, actuators, elapsed - start, options_.understeer);
+
+  // The state in the vehicle frame of the plan.
+  double dx = frame_x - s.frame_x;
+  double dy = frame_y - s.frame_y;
+  double c = cos(s.frame_psi);
+  double sn = sin(s.frame_psi);
+  double turn = frame_psi - s.frame_psi;
+  double ct = cos(turn);
+  double st = sin(turn);
+  double x = c * dx + sn * dy + ct * state[0] - st * state[1];
+  double y = -sn * dx + c * dy + st * state[0] + ct * state[1];
+  double psi = turn + state[2];
+  double psi_error = psi - predicted[2];
+  if (hypot(x - predicted[0], y - predicted[1]) > replay_position ||
+      fabs(atan2(sin(psi_error), cos(psi_error))) > replay_psi ||
+      fabs(state[3] - predicted[3]) > replay_v) {
+    return false;
+  }
+  // The errors from the plan's reference against those from this frame's.
+  double cte;
+  double epsi;
+  TrackErrors(s.coeffs, x, y, psi, cte, epsi);
+  double epsi_error = epsi - state[5];
+  if (fabs(cte - state[4]) > replay_cte || fabs(atan2(sin(epsi_error), cos(epsi_error))) > replay_epsi) {
+    return false;
+  }
+
+  // The rest of the plan, in the vehicle frame of this frame, for display.
+  size_t n = s.n - k;
+  for (size_t i = 0; i < n; i++) {
+    double px = s.x[k + i] - (c * dx + sn * dy);
+    double py = s.y[k + i] - (-sn * dx + c * dy);
+    replay_x_[i] = ct * px + st * py;
+    replay_y_[i] = -st * px + ct * py;
+  }
+  s.replays++;
+  CountEvent(Counter::ReplayedFrames);
+  plan.ok = true;
+  plan.usable = true;
+  plan.tabulated = false;
+  plan.replayed = true;
+  plan.pursued = false;
+  plan.cost = 0;
+  plan.iterations = 0;
+  plan.solve_time = 0;
+  plan.delta = s.delta[k];
+  plan.a = s.a[k];
+  plan.x = replay_x_;
+  plan.y = replay_y_;
+  plan.n = n;
+  return true;
+}
+
+void Controller::FindObstacles(double frame_x, double frame_y, double frame_psi, const StateVector& state,
+                               size_t horizon, double dt) {
+  n_obstacles_ = 0;
+  if (!options_.obstacles) {
+    return;
+  }
+  double horizon_time = 0;
+  for (size_t k = 0; k + 1 < horizon; k++) {
+    horizon_time += dt;
+    dt *= options_.dt_growth;
+  }
+  // From the frame's pose past the predicted one, as fast as the vehicle
+  // or its reference speed goes.
+  double reach = state[0] + max(state[3], options_.ref_v) * horizon_time;
+  size_t hint = options_.reference ? reference_hint_ : ReferencePath::no_hint;
+  n_obstacles_ = options_.obstacles->Query(frame_x, frame_y, frame_psi, hint, reach, obstacle_corridor,
+                                           obstacles_);
+  for (size_t i = 0; i < n_obstacles_; i++) {
+    obstacles_[i].radius += options_.obstacle_margin;
+  }
+  CountEvent(Counter::ObstacleConstraints, n_obstacles_);
+}
+
+double Controller::ProfileSpeed(size_t horizon, double dt) {
+  const ReferencePath& path = *options_.reference;
+  double s = path.Sample(reference_hint_).s;
+  double sum = 0;
+  for (size_t k = 0; k < horizon; k++) {
+    double v = min(path.SpeedAt(s), options_.ref_v);
+    stage_v_[k] = v;
+    sum += v;
+    s += v * dt;
+    dt *= options_.dt_growth;
+  }
+  return sum / horizon;
+}
+
+void Controller::TrackErrors(const Eigen::Vector4d& coeffs, double x, double y, double psi, double& cte,
+                             double& epsi) const {
+  if (options_.exact_cte) {
+    ClosestPoint point = CubicClosestPoint(coeffs, x, y);
+    cte = point.cte;
+    epsi = psi - point.heading;
+    return;
+  }
+  double f_x;
+  double df_x;
+  Polyval<3>(coeffs, x, f_x, df_x);
+  cte = f_x - y;
+  epsi = psi - atan(df_x);
+}
+
+bool Controller::FollowPlan(PipelineClock::time_point received, double frame_x, double frame_y,
+                            double frame_psi, Eigen::Vector4d& coeffs) {
+  Planner::Path& path = plan_path_;
+  if (!planner_->Latest(path) || duration<double>(received - path.received).count() > max_plan_age) {
+    return false;
+  }
+  double xs[Planner::N];
+  double ys[Planner::N];
+  size_t n = 0;
+  double c = cos(frame_psi);
+  double s = sin(frame_psi);
+  for (size_t k = 0; k < Planner::N; k++) {
+    double dx = path.x[k] - frame_x;
+    double dy = path.y[k] - frame_y;
+    xs[n] = c * dx + s * dy;
+    ys[n] = -s * dx + c * dy;
+    if (xs[n] > -plan_behind) {
+      n++;
+    }
+  }
+  if (n < 4) {
+    return false;
+  }
+  coeffs = Polyfit<3>(xs, ys, n);
+  return true;
+}
+
+bool Controller::Pursue(const StateVector& state, const Eigen::Vector4d& coeffs, double dt, Plan& plan) {
+  if (!options_.hybrid) {
+    return false;
+  }
+  // The largest curvature of the reference over the distance the horizon
+  // covers.
+  size_t n = horizon_;
+  double horizon_time = 0;
+  double step = dt;
+  for (size_t k = 0; k + 1 < n; k++) {
+    horizon_time += step;
+    step *= options_.dt_growth;
+  }
+  double reach = max(state[3], options_.ref_v) * horizon_time;
+  double curvature = 0;
+  for (int i = 0; i <= 4; i++) {
+    curvature = max(curvature, fabs(Curvature(coeffs, state[0] + reach * i / 4)));
+  }
+  // The pursuit knows no obstacles, so it gives way to the MPC near one.
+  double share = pursuing_ ? 1 : 0.5;
+  bool gentle = curvature <= share * options_.hybrid_curvature && fabs(state[4]) <= share * options_.hybrid_cte &&
+                fabs(state[5]) <= share * options_.hybrid_epsi && n_obstacles_ == 0;
+  if (!gentle && !pursuing_) {
+    return false;
+  }
+  PursuitPlan(state, coeffs, dt, plan);
+  CountEvent(Counter::ModeSwitches, gentle != pursuing_ ? 1 : 0);
+  pursuing_ = gentle;
+  if (!gentle) {
+    MPC_LOG(LogLevel::Debug, "Leaving pure pursuit at curvature %g, cte %g, epsi %g", curvature, state[4],
+            state[5]);
+    handoff_ = true;
+    return false;
+  }
+  CountEvent(Counter::PursuitFrames);
+  return true;
+}
+
+void Controller::PursuitPlan(const StateVector& state, const Eigen::Vector4d& coeffs, double dt, Plan& plan) {
+  PipelineClock::time_point start = PipelineClock::now();
+  // The pursuit over the horizon, steering from every stage.
+  size_t n = horizon_;
+  PoseVector pose(state[0], state[1], state[2], state[3]);
+  double step = dt;
+  for (size_t k = 0; k < n; k++) {
+    pursuit_x_[k] = pose[0];
+    pursuit_y_[k] = pose[1];
+    pursuit_psi_[k] = pose[2];
+    pursuit_v_[k] = pose[3];
+    if (k + 1 < n) {
+      ActuatorVector actuators(PursuitSteer(pose, coeffs, options_.understeer),
+                               clip(pursuit_speed_gain * (options_.ref_v - pose[3]), -max_a, max_a));
+      pursuit_delta_[k] = actuators[0];
+      pursuit_a_[k] = actuators[1];
+      pose = MPC<11>::Predict(pose, actuators, step, options_.understeer);
+      step *= options_.dt_growth;
+    }
+  }
+  plan.ok = true;
+  plan.usable = true;
+  plan.tabulated = false;
+  plan.replayed = false;
+  plan.pursued = true;
+  plan.cost = 0;
+  plan.iterations = 0;
+  plan.solve_time = duration<double>(PipelineClock::now() - start).count();
+  plan.delta = pursuit_delta_[0];
+  plan.a = pursuit_a_[0];
+  plan.x = pursuit_x_;
+  plan.y = pursuit_y_;
+  plan.psi = pursuit_psi_;
+  plan.v = pursuit_v_;
+  plan.deltas = pursuit_delta_;
+  plan.accels = pursuit_a_;
+  plan.n = n;
+}
+
+void Controller::Solve(const Telemetry& frame, Command& command, bool admitted) {
+  const Telemetry& t = frame.tick ? last_frame_ : frame;
+  const double* ptsx = t.ptsx;
+  const double* ptsy = t.ptsy;
+  // The waypoints taken of the frame, nearest first.
+  size_t n_points = t.n_points;
+  if (options_.max_waypoints > 0 && n_points > options_.max_waypoints) {
+    n_points = options_.max_waypoints;
+    if (!frame.tick) {
+      CountEvent(Counter::RejectedWaypoints, t.n_points - n_points);
+    }
+  }
+  double px = t.px;
+  double py = t.py;
+  double psi = t.psi;
+  double v = t.v;
+
+  double delta = t.delta * options_.steer_gain;
+  double alpha = t.a * options_.throttle_gain;
+  actuators_ << delta, alpha;
+
+  FollowWeights();
+  // What a tick adds to the prediction: the time since its frame came.
+  double elapsed = 0;
+  if (frame.tick) {
+    elapsed = max(duration<double>(frame.received - last_received_).count(), 0.0);
+  } else {
+    double gap = 0;
+    if (last_received_ != PipelineClock::time_point()) {
+      gap = duration<double>(t.received - last_received_).count();
+      if (gap > 0 && gap < max_frame_gap) {
+        frame_interval_ += latency_alpha * (gap - frame_interval_);
+      }
+    }
+    last_received_ = t.received;
+    if (options_.filter_state) {
+      // A pause starts the filter over.
+      StateFilter::Vector z(px, py, psi, v);
+      const StateFilter::Vector& estimate = filter_.Update(z, gap < max_frame_gap ? gap : 0, delta, alpha);
+      px = estimate[0];
+      py = estimate[1];
+      psi = estimate[2];
+      v = estimate[3];
+    }
+    last_frame_ = t;
+    last_frame_.px = px;
+    last_frame_.py = py;
+    last_frame_.psi = psi;
+    last_frame_.v = v;
+  }
+  // The frame the waypoints and the reference are taken into.
+  const double frame_x = px;
+  const double frame_y = py;
+  const double frame_psi = psi;
+  PipelineClock::time_point start = PipelineClock::now();
+  uint64_t trace_start = TraceTicks();
+  PerfReading perf_start = ReadPerfCounters();
+  AllocScope allocs(Stage::Transform);
+
+  // coordinate translation
+  double xvals[Telemetry::max_points];
+  double yvals[Telemetry::max_points];
+  ToVehicleFrame(ptsx, ptsy, n_points, px, py, psi, xvals, yvals);
+
+  // offset state with the measured latency, in the vehicle frame of the
+  // measurement, which the reference is fitted in as well
+  double state[4] = { 0, 0, 0, v };
+  PoseArrays pose = { 1, &state[0], &state[1], &state[2], &state[3], &delta, &alpha };
+  double deltat = latency_.Seconds() + elapsed;
+  int steps = int(ceil(deltat / max_step));
+
+  MPC_LOG(LogLevel::Debug, "Predicting state... [dt = %g, %d steps]", deltat, steps);
+  for (int k = 0; k < steps; k++) {
+    MPC<11>::PredictBatch(pose, deltat / steps, options_.understeer);
+  }
+  // DEBUG
+  MPC_LOG(LogLevel::Debug, "State: { x = %g, y = %g, psi = %g, v = %g }", px, py, psi, v);
+  px = state[0]; py = state[1]; psi = state[2]; v = state[3];
+  // DEBUG
+  MPC_LOG(LogLevel::Debug, "State* (vehicle frame): { x = %g, y = %g, psi = %g, v = %g }", px, py, psi, v);
+  PipelineClock::time_point transformed = PipelineClock::now();
+  RecordStage(Stage::Transform, transformed - start);
+  uint64_t trace_transformed = TraceTicks();
+  PerfReading perf_transformed = ReadPerfCounters();
+  RecordStageCounters(Stage::Transform, perf_start, perf_transformed);
+  TraceComplete("transform", trace_start, trace_transformed, perf_start, perf_transformed);
+  allocs.Switch(Stage::Polyfit);
+
+  // The waypoints are fitted when there is no reference path, or when the
+  // path is no function y(x) ahead of the vehicle.
+  Eigen::Vector4d coeffs;
+  bool referenced = options_.reference &&
+                    options_.reference->Local(frame_x, frame_y, frame_psi, reference_hint_, coeffs);
+  if (!referenced && options_.window_fit) {
+    coeffs = fitter_.Update(ptsx, ptsy, n_points, frame_x, frame_y, frame_psi, t.first_waypoint);
+  } else if (!referenced) {
+    const double* fit_x = xvals;
+    const double* fit_y = yvals;
+    size_t n_fit = n_points;
+    double resampled_x[Telemetry::max_points];
+    double resampled_y[Telemetry::max_points];
+    if (options_.fit_points > 0) {
+      n_fit = ResampleWaypoints(xvals, yvals, n_points, min(options_.fit_points, Telemetry::max_points),
+                                options_.fit_spacing, resampled_x, resampled_y);
+      fit_x = resampled_x;
+      fit_y = resampled_y;
+    }
+    if (options_.fit_near_field > 0 || options_.fit_anchor) {
+      double weights[Telemetry::max_points];
+      for (size_t i = 0; i < n_fit; i++) {
+        double d = options_.fit_near_field > 0 ? hypot(fit_x[i], fit_y[i]) / options_.fit_near_field : 0;
+        weights[i] = 1 / (1 + d * d);
+      }
+      coeffs = WeightedPolyfit<3>(fit_x, fit_y, weights, n_fit, options_.fit_anchor, 0,
+                                  PathOffset(xvals, yvals, n_points));
+    } else {
+      coeffs = Polyfit<3>(fit_x, fit_y, n_fit);
+    }
+  }
+
+  PipelineClock::time_point fitted = PipelineClock::now();
+  RecordStage(Stage::Polyfit, fitted - transformed);
+  uint64_t trace_fitted = TraceTicks();
+  PerfReading perf_fitted = ReadPerfCounters();
+  RecordStageCounters(Stage::Polyfit, perf_transformed, perf_fitted);
+  TraceComplete("polyfit", trace_transformed, trace_fitted, perf_transformed, perf_fitted);
+  allocs.Switch(Stage::Solve);
+
+  // compute cross-track error (difference in y from center) and
+  // orientation error at the predicted pose
+  double cte;
+  double epsi;
+  TrackErrors(coeffs, px, py, psi, cte, epsi);
+  if (planner_) {
+    StateVector planned;
+    planned << px, py, psi, v, cte, epsi;
+    planner_->Submit(frame.received, frame_x, frame_y, frame_psi, planned, coeffs);
+    if (FollowPlan(frame.received, frame_x, frame_y, frame_psi, coeffs)) {
+      TrackErrors(coeffs, px, py, psi, cte, epsi);
+    }
+  }
+
+  StateVector state_p;
+  state_p << px, py, psi, v, cte, epsi;
+  // The path is that of the reference, not the one of the two-rate
+  // mode's planner.
+  frenet_frame_ = options_.frenet && referenced && !planner_;
+  frenet_pose_[0] = frame_x;
+  frenet_pose_[1] = frame_y;
+  frenet_pose_[2] = frame_psi;
+  Plan plan;
+  // Time step of the plan solved, for the commands that follow it.
+  double plan_dt = 0;
+  if (!Replay(frame.received, frame_x, frame_y, frame_psi, state_p, plan)) {
+    size_t horizon = horizon_;
+    double step = dt_[HorizonIndex(horizon_)];
+    if (options_.adaptive_horizon) {
+      // Curvature of the reference at the vehicle.
+      double curvature = 2 * coeffs[2] / pow(1 + coeffs[1] * coeffs[1], 1.5);
+      HorizonChoice choice = policy_.Choose(v, curvature);
+      if (choice.horizon != horizon_ || choice.dt != step) {
+        MPC_LOG(LogLevel::Info, "Horizon N = %zu, dt = %g at v = %g, curvature %g", choice.horizon,
+                choice.dt, v, curvature);
+      }
+      horizon = choice.horizon;
+      step = choice.dt;
+      if (horizon != horizon_ && !Made(horizon) && AtBudget()) {
+        // No MPC for another horizon past the budget.
+        CountEvent(Counter::BudgetRejections);
+        horizon = horizon_;
+        step = dt_[HorizonIndex(horizon_)];
+      }
+    }
+    bool cold = horizon != horizon_;
+    horizon_ = horizon;
+    PipelineClock::time_point deadline = options_.deadline_ms > 0
+        ? frame.arrived + milliseconds(options_.deadline_ms)
+        : PipelineClock::time_point::max();
+    FindObstacles(frame_x, frame_y, frame_psi, state_p, horizon_, step);
+    if (options_.speed_profile && referenced) {
+      ref_v_ = ProfileSpeed(horizon_, step);
+    }
+    if (!admitted) {
+      // The pursuit answers in the solve's stead, and the next solve
+      // starts from it.
+      PursuitPlan(state_p, coeffs, step, plan);
+      handoff_ = true;
+    } else if (!Pursue(state_p, coeffs, step, plan)) {
+      switch (horizon_) {
+#define MPC_SOLVE(N)                                               \
+  case N:                                                          \
+    SolveWith<N>(state_p, coeffs, step, cold, deadline, plan);     \
+    break;
+        MPC_FOR_EACH_HORIZON(MPC_SOLVE)
+#undef MPC_SOLVE
+      }
+      if (options_.adaptive_horizon) {
+        policy_.Solved(horizon_, plan.solve_time);
+      }
+      if (!plan.usable) {
+        // Nothing to apply of the solve: steer by the pursuit, which
+        // always has a plan, and start the next solve from it, but report
+        // the failure.
+        double solve_time = plan.solve_time;
+        PursuitPlan(state_p, coeffs, step, plan);
+        plan.ok = false;
+        plan.solve_time += solve_time;
+        handoff_ = true;
+        CountEvent(Counter::FallbackPursuit);
+      }
+    }
+    KeepPlan(plan, frame.received, frame_x, frame_y, frame_psi, coeffs, step);
+    plan_dt = step;
+    Measure();
+  }
+  if (options_.speculate && plan.ok && !plan.tabulated && !plan.replayed && !plan.pursued && !frenet_frame_) {
+    // Where the new actuators take the vehicle by the next frame, and its
+    // errors from the same reference.
+    PoseVector pose(0, 0, 0, v);
+    ActuatorVector actuators(plan.delta, plan.a);
+    int steps = int(ceil(frame_interval_ / max_step));
+    for (int k = 0; k < steps; k++) {
+      pose = MPC<11>::Predict(pose, actuators, frame_interval_ / steps, options_.understeer);
+    }
+    double cte;
+    double epsi;
+    TrackErrors(coeffs, pose[0], pose[1], pose[2], cte, epsi);
+    speculative_state_ << pose[0], pose[1], pose[2], pose[3], cte, epsi;
+    speculative_coeffs_ = coeffs;
+    speculative_deadline_ = frame.received + duration_cast<PipelineClock::duration>(
+                                              duration<double>(presolve_share * frame_interval_));
+    speculation_ = true;
+  }
+  PipelineClock::time_point solved = PipelineClock::now();
+  if (options_.load_shedding && admitted) {
+    ShedLevel shed = governor_.Level();
+    CountEvent(Counter::ShedFrames, shed != ShedLevel::None ? 1 : 0);
+    ShedLevel level = governor_.Update(duration<double>(solved - frame.arrived).count());
+    if (level != shed) {
+      Shed(shed);
+      CountEvent(level > shed ? Counter::ShedSteps : Counter::ShedRestores);
+      MPC_LOG(LogLevel::Warning, "%s %s at %.0f%% slack", level > shed ? "Shedding" : "Restoring",
+              ShedLevelName(level > shed ? level : shed), governor_.Slack() * 100);
+    }
+  }
+  RecordStage(Stage::Solve, solved - fitted);
+  uint64_t trace_solved = TraceTicks();
+  PerfReading perf_solved = ReadPerfCounters();
+  RecordStageCounters(Stage::Solve, perf_fitted, perf_solved);
+  TraceComplete("solve", trace_fitted, trace_solved, perf_fitted, perf_solved);
+  allocs.Switch(Stage::Format);
+  CountEvent(Counter::Frames);
+  CountEvent(Counter::SolverIterations, plan.iterations > 0 ? plan.iterations : 0);
+  if (!plan.ok) {
+    CountEvent(Counter::SolverFailures);
+  }
+  // tractability gaurantee
+  double steer_value = clip(plan.delta / options_.steer_gain, -1, 1);
+  double throttle_value = clip(plan.a / options_.throttle_gain, -1, 1);
+  // The rest of the plan's actuators, but for a replayed or tabulated
+  // plan, which keeps none of its own.
+  ActuationPlan& actuation = command.actuation;
+  actuation.n = 0;
+  if (!plan.replayed && !plan.tabulated && plan.n > 1) {
+    actuation.n = plan.n - 1;
+    actuation.dt = plan_dt;
+    actuation.growth = options_.dt_growth;
+    for (size_t k = 0; k < actuation.n; k++) {
+      actuation.steering[k] = -clip(plan.deltas[k] / options_.steer_gain, -1, 1);
+      actuation.throttle[k] = clip(plan.accels[k] / options_.throttle_gain, -1, 1);
+    }
+  }
+
+  MPC_LOG_EVERY_N(LogLevel::Info, 10, "[ steering = %g, throttle = %g ] cost %g, %d iterations, %.2f ms%s",
+                  -steer_value, throttle_value, plan.cost, plan.iterations,
+                  plan.solve_time * 1000, plan.tabulated ? " (table)" : "");
+
+  // Show the MPC predicted trajectory and the waypoints/reference line,
+  // in reference to the vehicle's coordinate system. The points in the
+  // simulator are connected by a Green line and a Yellow line. Between
+  // the frames due for display they are left out, which keeps the steer
+  // reply a few dozen bytes.
+  bool viz = (options_.viz_interval_ms <= 0 || last_viz_ == PipelineClock::time_point() ||
+              frame.received - last_viz_ >= milliseconds(options_.viz_interval_ms)) &&
+             governor_.Level() < ShedLevel::Viz;
+  if (viz) {
+    last_viz_ = frame.received;
+  }
+  Observation& o = command.observation;
+  o.px = t.px;
+  o.py = t.py;
+  o.psi = t.psi;
+  o.v = t.v;
+  o.cte = cte;
+  o.epsi = epsi;
+  o.steering_angle = -steer_value;
+  o.throttle = throttle_value;
+  o.ok = plan.ok;
+  o.cost = plan.cost;
+  o.iterations = plan.iterations;
+  o.solve_time = plan.solve_time;
+  o.transform_time = duration<double>(transformed - start).count();
+  o.polyfit_time = duration<double>(fitted - transformed).count();
+  o.solve_stage_time = duration<double>(solved - fitted).count();
+  o.latency = latency_.Seconds();
+  o.horizon = horizon_;
+  o.n_mpc = plan.n;
+  copy(plan.x, plan.x + plan.n, o.mpc_x);
+  copy(plan.y, plan.y + plan.n, o.mpc_y);
+
+  PublishedPlan& p = publishing_;
+  p.valid = true;
+  p.solves++;
+  p.received = frame.received;
+  p.solved = solved;
+  p.steering_angle = -steer_value;
+  p.throttle = throttle_value;
+  p.ok = plan.ok;
+  p.cost = plan.cost;
+  p.iterations = plan.iterations;
+  p.solve_time = plan.solve_time;
+  p.cte = cte;
+  p.epsi = epsi;
+  p.actuation = actuation;
+  p.n = plan.n;
+  copy(plan.x, plan.x + plan.n, p.x);
+  copy(plan.y, plan.y + plan.n, p.y);
+  published_.Write(p);
+
+  size_t n_mpc = viz ? plan.n : 0;
+  size_t n_next = viz ? n_points : 0;
+  if (frame.framing == Framing::Text) {
+    WriteSteer(command.msg, -steer_value, throttle_value,
+               plan.x, plan.y, n_mpc,
+               xvals, yvals, n_next, options_.viz);
+  } else {
+    // The framing sets the precision of the binary arrays; the lines are
+    // only decimated.
+    const double* mpc_x = plan.x;
+    const double* mpc_y = plan.y;
+    const double* next_x = xvals;
+    const double* next_y = yvals;
+    double kept[4][Telemetry::max_points];
+    if (options_.viz.tolerance > 0) {
+      n_mpc = Decimate(mpc_x, mpc_y, n_mpc, options_.viz.tolerance, kept[0], kept[1]);
+      n_next = Decimate(next_x, next_y, n_next, options_.viz.tolerance, kept[2], kept[3]);
+      mpc_x = kept[0];
+      mpc_y = kept[1];
+      next_x = kept[2];
+      next_y = kept[3];
+    }
+    WriteBinaryCommand(command.msg, frame.framing, -steer_value, throttle_value,
+                       mpc_x, mpc_y, n_mpc,
+                       next_x, next_y, n_next);
+  }
+  PipelineClock::time_point formatted = PipelineClock::now();
+  o.format_time = duration<double>(formatted - solved).count();
+  RecordStage(Stage::Format, formatted - solved);
+  PerfReading perf_formatted = ReadPerfCounters();
+  RecordStageCounters(Stage::Format, perf_solved, perf_formatted);
+  TraceComplete("format", trace_solved, TraceTicks(), perf_solved, perf_formatted);
+}
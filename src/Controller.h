@@ -0,0 +1,674 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iosfwd>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "AdaptiveHorizon.h"
+#include "ControlTable.h"
+#include "LatencyEstimate.h"
+#include "LoadShedding.h"
+#include "Layout.h"
+#include "MPC.h"
+#include "ObstacleMap.h"
+#include "Pipeline.h"
+#include "Planner.h"
+#include "PlanLibrary.h"
+#include "ReferencePath.h"
+#include "SeqLock.h"
+#include "SolverGroup.h"
+#include "StateFilter.h"
+#include "SteerWriter.h"
+#include "Telemetry.h"
+#include "Track.h"
+#include "WarmStartNet.h"
+#include "WindowPolyfit.h"
+
+// A perturbation of the model that the scenario mode plans for as well:
+// latency in seconds added to the measured one, and the understeer of the
+// model in place of ControllerOptions::understeer, as a stand-in for
+// less grip.
+struct Scenario {
+  double latency;
+  double understeer;
+};
+
+// Settings shared by all the controllers of a process.
+struct ControllerOptions {
+  MPCBackend backend;
+  // Fit the reference polynomial incrementally over the waypoint window.
+  bool window_fit;
+  // Bound of every solve after the arrival of its frame, 0 for none.
+  int deadline_ms;
+  int multi_start;
+  // Start the cold Ipopt solves, and those far off their warm start, from
+  // a coarse problem (see MPC::SetCoarseStart).
+  bool coarse_start;
+  // Largest actuator correction of the sensitivity updates of the Riccati
+  // backend (see MPC::SetSensitivityUpdate), 0 for none.
+  double sensitivity_update;
+  // Refinements of the single-precision QPs of the RTI and ADMM backends
+  // (see MPC::SetMixedPrecision), 0 to solve them in double.
+  int mixed_precision;
+  // Threads of the MPPI rollouts, and the seed of their random streams;
+  // candidate and scenario i sample from sampling_seed + i.
+  int sampling_threads;
+  uint64_t sampling_seed;
+  // Samples of the MPPI rollouts on the CUDA device, 0 to sample on the
+  // CPU (see MPC::SetSamplingDevice).
+  size_t sampling_device_samples;
+  // Actuator latency of the simulator.
+  int latency_ms;
+  // Time from the actuators a frame reports to their effect on its pose,
+  // predicted over besides the latency, and the model steering and
+  // acceleration per unit of the reported and commanded steering and
+  // throttle (see ModelCalibration.h).
+  double actuator_lag_ms;
+  double steer_gain;
+  double throttle_gain;
+  // Precomputed controls consulted before solving, shared by all
+  // controllers; may be NULL.
+  std::shared_ptr<const ControlTable> table;
+  // Net predicting the cold starts of the Ipopt backends (see
+  // MPC::SetWarmStartNet), shared by all controllers; may be NULL.
+  std::shared_ptr<const WarmStartNet> warm_start_net;
+  // Global reference path the reference polynomial is taken from instead
+  // of the telemetry's waypoints, shared by all controllers; may be NULL.
+  std::shared_ptr<const ReferencePath> reference;
+  // Plans of past solves along the reference path, shared by all
+  // controllers, which the cold starts of the Ipopt backends take their
+  // guess from (see PlanLibrary.h); NULL, or without a reference path,
+  // for none.
+  std::shared_ptr<PlanLibrary> plan_library;
+  // Solve in the coordinates of the reference path, from the pose's arc
+  // length, offset and heading along it and its curvature, instead of on
+  // the reference polynomial in the vehicle frame (see MPC::SetFrenet);
+  // with the ipopt backend only, and a single solve per frame, without
+  // candidates, scenarios or speculation. The frames the path does not
+  // cover solve in the vehicle frame.
+  bool frenet;
+  // Take the reference speed of every stage from the speed profile of the
+  // reference path, capped at ref_v (see Controller::ProfileSpeed).
+  bool speed_profile;
+  // Obstacles the Ipopt backends keep clear of by obstacle_margin metres,
+  // shared by all controllers, indexed along the reference path if there
+  // is one; may be NULL. Every frame keeps the few of them that the
+  // horizon can reach (see ObstacleMap::Query) as the constraints of its
+  // solve.
+  std::shared_ptr<const ObstacleMap> obstacles;
+  double obstacle_margin;
+  // Cost weights of these controllers alone; NULL follows the process-
+  // wide ones.
+  std::shared_ptr<const Weights> weights;
+  // Filter the reported pose of every frame (see StateFilter.h) before
+  // the latency compensation and the fit, instead of taking it as exact.
+  bool filter_state;
+  // Weigh the waypoints of the fit by 1 / (1 + (d / fit_near_field)^2)
+  // at a distance d from the vehicle, 0 for equal weights, and with
+  // fit_anchor pass the fit exactly through the path at the vehicle,
+  // interpolated between the waypoints either side of it (see
+  // WeightedPolyfit). Neither applies to the window fit or a reference
+  // path.
+  double fit_near_field;
+  bool fit_anchor;
+  // Resample the waypoints to fit_points points fit_spacing metres apart
+  // along them before the fit (see ResampleWaypoints), so that every
+  // frame fits the same number of points; 0 fits them as they come. Not
+  // for the window fit either.
+  size_t fit_points;
+  double fit_spacing;
+  // Waypoints of a frame taken, nearest first, 0 for all the frame holds
+  // (Telemetry::max_points); the rest are dropped and counted
+  // (Counter::RejectedWaypoints), as the decoders count those past the
+  // capacity of a frame.
+  size_t max_waypoints;
+  // Take the cross-track error as the distance to the nearest point of
+  // the fitted reference, and the heading error from its tangent there
+  // (see CubicClosestPoint), instead of the vertical offset at the
+  // vehicle, which grows on a curve or at an angle to the reference.
+  bool exact_cte;
+  // Reference speed in m/s, and the horizon and time grid of the MPC (see
+  // MPC::SetTimestep). The horizon is one of MPC_FOR_EACH_HORIZON.
+  double ref_v;
+  size_t horizon;
+  double dt;
+  double dt_growth;
+  // Understeer of the model (see MPC::SetUndersteer), 0 for the kinematic
+  // one; the latency compensation predicts with it as well.
+  double understeer;
+  // Add the LQR terminal cost to the last stage (see
+  // MPC::SetTerminalCost).
+  bool terminal_cost;
+  // Soft track boundary and steering rate limit (see
+  // MPC::SetSoftConstraints).
+  SoftConstraints soft;
+  // Hard rate limits of the actuators (see MPC::SetRateLimits).
+  RateLimits rate_limits;
+  // Options of the Ipopt backends (see MPC::SetIpoptOptions).
+  IpoptOptions ipopt;
+  // Lengths of the blocks of stages over which the actuators are held
+  // (see MPC::SetMoveBlocks); empty frees every stage.
+  std::vector<size_t> move_blocks;
+  // Choose the horizon and step for every frame (see AdaptiveHorizon.h),
+  // starting from the ones above, to keep solves within solve_budget_ms,
+  // or the deadline when there is one.
+  bool adaptive_horizon;
+  int solve_budget_ms;
+  // Give up optional work as the frames run out of slack within the same
+  // budget (see LoadShedding.h): the lines of the replies, Debug and Info
+  // logging, the extra starts, the Ipopt iterations beyond shed_max_iter
+  // and at last the backend, for shed_backend.
+  bool load_shedding;
+  int shed_max_iter;
+  MPCBackend shed_backend;
+  // Presolve the next frame in Prepare, from the state this frame's
+  // actuators are predicted to reach by then (see MPC::Presolve).
+  bool speculate;
+  // Least time between replies that carry the predicted trajectory and
+  // the reference line for display; the replies in between carry only the
+  // actuators, with empty lines. 0 puts them in every reply.
+  int viz_interval_ms;
+  // Decimation and rounding of those lines (see VizEncoding); each
+  // connection may change it with Controller::SetVizEncoding.
+  VizEncoding viz;
+  // Answer a frame from the last plan, without solving, when its pose is
+  // what the plan predicted for it and its reference what the plan's
+  // was, within small tolerances; every replay_frames-th frame is solved
+  // regardless. 0 solves every frame.
+  int replay_frames;
+  // Solutions every MPC keeps for problems met again (see
+  // MPC::SetSolutionCache), 0 for none.
+  size_t solution_cache;
+  // Steer by pure pursuit of the reference instead of solving while its
+  // curvature over the horizon and the errors stay within
+  // hybrid_curvature, hybrid_cte and hybrid_epsi, and switch back to the
+  // MPC, started from the pursuit's plan, once any exceeds them. The
+  // switch to the pursuit waits until all are within half of them.
+  bool hybrid;
+  double hybrid_curvature;
+  double hybrid_cte;
+  double hybrid_epsi;
+  // Track, every frame, the trajectory of a long, coarse MPC over steps of
+  // plan_dt seconds that a thread of every controller solves at most every
+  // plan_interval_ms (see Planner.h), instead of the waypoints' fit. The
+  // frame's own MPC, best one of the short horizons, then only follows it.
+  bool two_rate;
+  double plan_dt;
+  int plan_interval_ms;
+  // Lateral offsets in metres, left positive, of the candidate references
+  // solved along with the fitted one, each by an MPC of its own with its
+  // own warm start, in parallel on a thread each (see SolverGroup.h); the
+  // lowest-cost plan of those that converged is applied. Empty solves the
+  // fitted reference alone; at most max_candidates - 1.
+  std::vector<double> candidate_offsets;
+  // Model perturbations planned for besides the nominal model, each by an
+  // MPC of its own on a thread each, as for the candidates, which they
+  // replace. Every scenario solves from the state its latency predicts;
+  // the first controls of those with a plan are averaged, and all solve
+  // again from their own solutions with the first control held at the
+  // mean, which is applied with the nominal plan. Empty plans for the
+  // nominal model alone; at most max_candidates - 1.
+  std::vector<Scenario> scenarios;
+  // Memory budget of the controller in bytes, as AddFootprint counts it,
+  // 0 for none. While its solvers take more, it makes no MPC for another
+  // horizon, candidate or scenario: the adaptive horizon stays where it
+  // is and the frame solves on the MPCs made already. Once past the
+  // budget it lets go of all but the MPC of its current horizon. Both
+  // count as Counter::BudgetRejections.
+  size_t memory_budget;
+
+  ControllerOptions()
+      : backend(MPCBackend::Ipopt),
+        window_fit(false),
+        deadline_ms(0),
+        multi_start(1),
+        coarse_start(false),
+        sensitivity_update(0),
+        mixed_precision(0),
+        sampling_threads(1),
+        sampling_seed(0),
+        sampling_device_samples(0),
+        latency_ms(100),
+        actuator_lag_ms(0),
+        steer_gain(1),
+        throttle_gain(1),
+        frenet(false),
+        speed_profile(false),
+        obstacle_margin(1.5),
+        filter_state(false),
+        fit_near_field(0),
+        fit_anchor(false),
+        fit_points(0),
+        fit_spacing(5),
+        max_waypoints(0),
+        exact_cte(false),
+        ref_v(40 * mph_to_mps),
+        horizon(11),
+        dt(default_dt),
+        dt_growth(1),
+        understeer(0),
+        terminal_cost(false),
+        adaptive_horizon(false),
+        solve_budget_ms(25),
+        load_shedding(false),
+        shed_max_iter(10),
+        shed_backend(MPCBackend::RTI),
+        speculate(false),
+        viz_interval_ms(0),
+        replay_frames(0),
+        solution_cache(0),
+        hybrid(false),
+        hybrid_curvature(0.004),
+        hybrid_cte(0.3),
+        hybrid_epsi(0.05),
+        two_rate(false),
+        plan_dt(0.25),
+        plan_interval_ms(200),
+        memory_budget(0) {}
+};
+
+// Most references a controller solves for a frame, the fitted one
+// included (see ControllerOptions::candidate_offsets).
+enum : size_t { max_candidates = 5 };
+
+// Threads that every controller of the options runs besides the one that
+// solves it: the planner's and the candidates' or the scenarios'.
+inline size_t ControllerThreads(const ControllerOptions& options) {
+  return (options.two_rate ? 1 : 0) + std::max(options.candidate_offsets.size(), options.scenarios.size());
+}
+
+// Parse the comma-separated offsets of --candidates into offsets.
+inline bool ParseOffsets(const char* text, std::vector<double>& offsets) {
+  offsets.clear();
+  for (const char* p = text;;) {
+    char* end;
+    double offset = strtod(p, &end);
+    if (end == p || offsets.size() + 1 >= max_candidates) {
+      return false;
+    }
+    offsets.push_back(offset);
+    if (*end == 0) {
+      return true;
+    }
+    if (*end != ',') {
+      return false;
+    }
+    p = end + 1;
+  }
+}
+
+// Parse the comma-separated MS:K pairs of --scenarios, latency in
+// milliseconds and understeer, into scenarios.
+inline bool ParseScenarios(const char* text, std::vector<Scenario>& scenarios) {
+  scenarios.clear();
+  for (const char* p = text;;) {
+    char* end;
+    Scenario scenario;
+    scenario.latency = strtod(p, &end) / 1000;
+    if (end == p || *end != ':' || scenarios.size() + 1 >= max_candidates) {
+      return false;
+    }
+    p = end + 1;
+    scenario.understeer = strtod(p, &end);
+    if (end == p) {
+      return false;
+    }
+    scenarios.push_back(scenario);
+    if (*end == 0) {
+      return true;
+    }
+    if (*end != ',') {
+      return false;
+    }
+    p = end + 1;
+  }
+}
+
+// Frame k of solves that a vehicle on track would send, at speeds up to
+// ref_v and slightly off the line, received now (see Controller::WarmUp).
+void WarmUpFrame(const Track& track, size_t k, size_t solves, double ref_v, Telemetry& frame);
+
+// Everything that turns one vehicle's telemetry into its commands: the MPC
+// with its warm start, the windowed fit and the latency estimate. Unless
+// the options fix them, the cost weights follow the process-wide ones of
+// Weights.h from the next frame.
+//
+// The MPC of a horizon is created with the first solve over it. With the
+// adaptive horizon several of them may be kept, each warm started from
+// its own last solve; a switch starts the new one cold.
+//
+// Solve and Prepare run on one solver thread at a time; Delivered runs on
+// the event loop.
+class Controller {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  explicit Controller(const ControllerOptions& options);
+
+  ~Controller();
+
+  // Coordinate transform, latency compensation, polynomial fit and solve
+  // of a frame, writing its reply to command.msg. A tick frame solves the
+  // last frame again, its pose predicted over the time since it arrived
+  // as well as the latency; there must have been one since the Reset.
+  // A frame not admitted is answered by the pure pursuit instead of the
+  // MPC, as the cheap fallback of a solve that would miss its deadline,
+  // unless it replays the last plan (see ControllerOptions::replay_frames).
+  void Solve(const Telemetry& frame, Command& command, bool admitted = true);
+
+  // Get the next solve ready while waiting for telemetry, presolving it
+  // with options.speculate.
+  void Prepare();
+
+  // Bring the MPC of the current horizon back into the caches of the
+  // calling thread's core, between frames that come far apart (see
+  // MPC::KeepWarm).
+  void KeepWarm();
+
+  // Feed back the measured latency of a command released at now, and
+  // follow its plan's actuators from then on (see FollowUp).
+  void Delivered(const Command& command, PipelineClock::time_point now);
+
+  // Write to msg, in framing, a reply with only the actuators the last
+  // delivered plan has for now, interpolated between those of its stages,
+  // so that the commands follow the plan while the next solve runs. False
+  // when there is none to follow, within min_gap of its delivery or past
+  // its last stage. Runs on the event loop.
+  bool FollowUp(PipelineClock::time_point now, PipelineClock::duration min_gap, Framing framing,
+                std::string& msg) const;
+
+  // Copy the plan of the latest solve since the Reset to plan; false when
+  // there is none. Safe on any thread while Solve runs, which it never
+  // holds up (see SeqLock.h): for gateways, observers and recorders that
+  // want the plan apart from the replies.
+  bool LatestPlan(PublishedPlan& plan) const { return published_.Read(plan) && plan.valid; }
+
+  // Current end-to-end latency estimate, in seconds.
+  double Latency() const { return latency_.Seconds(); }
+
+  // Current estimate of the time between frames, in seconds.
+  double FrameInterval() const { return frame_interval_; }
+
+  // Horizon and time step of the last solve.
+  size_t Horizon() const { return horizon_; }
+  double Timestep() const { return dt_[HorizonIndex(horizon_)]; }
+
+  // Start over for a new vehicle: cold solve and fit, initial latency.
+  void Reset();
+
+  // Encode the lines of the replies from the next frame on as viz says,
+  // for a subscriber that asked for its own.
+  void SetVizEncoding(const VizEncoding& viz) { options_.viz = viz; }
+
+  // Solve solves frames as a vehicle on track would send them, at speeds
+  // up to the reference and slightly off the line, and then Reset. This
+  // records the tapes, initializes Ipopt and touches every buffer before
+  // the first real frame, which then solves as fast as the steady state.
+  // The wall time of every solve, in seconds, is appended to times. The
+  // solves are recorded in the metrics like any other.
+  void WarmUp(const Track& track, size_t solves, std::vector<double>& times);
+
+  // Solve an offline problem over horizon states, one of
+  // MPC_FOR_EACH_HORIZON, cold with the controller's options, weights and
+  // time step, into solution. The vehicle's warm start of the MPC is lost,
+  // so this serves controllers that solve no frames (see
+  // MPCBatch::Submit).
+  void SolveOffline(const OfflineProblem& problem, size_t horizon, OfflineSolution& solution);
+
+  // Write what a restarted process needs to carry on with this vehicle
+  // from its next frame: the horizon, the time steps, the latency and
+  // frame interval estimates and the warm start of every MPC created
+  // (see MPC::SaveState). Load reads it back after a Reset, creating the
+  // MPCs as needed, and returns false on a stream error or a state of
+  // another build of the horizons, leaving the controller reset. The fit
+  // and the speculation start over.
+  bool SaveState(std::ostream& out) const;
+  bool LoadState(std::istream& in);
+
+  // Add the memory of this controller to footprint: the object itself and
+  // every MPC created, the candidates' and scenarios' included (see
+  // MPC::AddFootprint). Not while a solve is under way.
+  void AddFootprint(Footprint& footprint) const;
+
+ private:
+  // What the reply needs of a solve, pointing into the result of the MPC
+  // that made it.
+  struct Plan {
+    bool ok;
+    // Whether the plan can be applied (see MPC::Result::usable).
+    bool usable;
+    bool tabulated;
+    // Whether the plan is the last one replayed (see Replay), or the pure
+    // pursuit's (see Pursue).
+    bool replayed;
+    bool pursued;
+    double cost;
+    int iterations;
+    double solve_time;
+    double delta;
+    double a;
+    const double* x;
+    const double* y;
+    const double* psi;
+    const double* v;
+    const double* deltas;
+    const double* accels;
+    size_t n;
+  };
+
+  // The last plan solved, in the vehicle frame of its frame, for Replay:
+  // the frame's arrival and pose, the reference, the step of the first
+  // stage and the frames answered from it since.
+  struct StoredPlan {
+    bool valid;
+    size_t n;
+    double dt;
+    PipelineClock::time_point received;
+    double frame_x;
+    double frame_y;
+    double frame_psi;
+    Eigen::Vector4d coeffs;
+    size_t replays;
+    double x[Telemetry::max_points];
+    double y[Telemetry::max_points];
+    double psi[Telemetry::max_points];
+    double v[Telemetry::max_points];
+    double delta[Telemetry::max_points];
+    double a[Telemetry::max_points];
+  };
+
+  ControllerOptions options_;
+  // Horizon of the next solve and the time step each MPC has.
+  size_t horizon_;
+  double dt_[n_horizons];
+  HorizonPolicy policy_;
+  LoadGovernor governor_;
+  WindowPolyfit<3, Telemetry::max_points> fitter_;
+  // Sample of the reference path nearest the vehicle at the last frame.
+  size_t reference_hint_;
+  // Reference speed of the solves of this frame, and with speed_profile
+  // that of every stage, whose mean it is.
+  double ref_v_;
+  double stage_v_[max_horizon];
+  LatencyEstimate latency_;
+  StateFilter filter_;
+  // The weights of all the MPCs, and the version of the process-wide ones
+  // they are.
+  Weights weights_;
+  uint64_t weights_version_;
+  // Moving average of the time between frames, and the arrival of the
+  // last one.
+  double frame_interval_;
+  PipelineClock::time_point last_received_;
+  // The last frame other than a tick, with the filtered pose when the
+  // pose is filtered.
+  Telemetry last_frame_;
+  // Arrival of the last frame whose reply carried the lines.
+  PipelineClock::time_point last_viz_;
+  // The problem to presolve in Prepare, if any: the state predicted for
+  // the next frame in the frame of the last one, its reference and the
+  // time the presolve has to end by.
+  bool speculation_;
+  StateVector speculative_state_;
+  Eigen::Vector4d speculative_coeffs_;
+  PipelineClock::time_point speculative_deadline_;
+  StoredPlan stored_;
+  // The actuators of the last command delivered, and when it was; only
+  // touched on the event loop.
+  ActuationPlan followed_;
+  PipelineClock::time_point followed_from_;
+  // The plan LatestPlan reads, and the one Solve writes it from.
+  SeqLock<PublishedPlan> published_;
+  PublishedPlan publishing_;
+  // The replayed plan in the vehicle frame of the frame it answers.
+  double replay_x_[Telemetry::max_points];
+  double replay_y_[Telemetry::max_points];
+  // Whether the hybrid mode is pursuing, and whether the next solve starts
+  // from the pursuit's plan, which is kept here.
+  bool pursuing_;
+  bool handoff_;
+  double pursuit_x_[Telemetry::max_points];
+  double pursuit_y_[Telemetry::max_points];
+  double pursuit_psi_[Telemetry::max_points];
+  double pursuit_v_[Telemetry::max_points];
+  double pursuit_delta_[Telemetry::max_points];
+  double pursuit_a_[Telemetry::max_points];
+  // The guess of the plan library, resampled onto the current horizon.
+  double library_delta_[Telemetry::max_points];
+  double library_a_[Telemetry::max_points];
+  // With options_.frenet, whether the frame has a problem along the path:
+  // its frame's pose, the station of the predicted pose and the state and
+  // curvature from it, and the plan of the solve in the vehicle frame.
+  bool frenet_frame_;
+  double frenet_pose_[3];
+  double frenet_station_;
+  StateVector frenet_state_;
+  Eigen::Vector4d frenet_coeffs_;
+  double frenet_x_[Telemetry::max_points];
+  double frenet_y_[Telemetry::max_points];
+  double frenet_psi_[Telemetry::max_points];
+  // The slow layer of the two-rate mode, and its last plan.
+  std::unique_ptr<Planner> planner_;
+  Planner::Path plan_path_;
+
+  // The memory of the controller, as last measured, and whether an MPC
+  // was made since (see ControllerOptions::memory_budget).
+  size_t bytes_;
+  bool remeasure_;
+
+  // The threads of the candidate references, if any.
+  std::unique_ptr<SolverGroup> group_;
+  // The actuators of this frame, which the scenarios predict their
+  // latency over.
+  ActuatorVector actuators_;
+  // The obstacles of this frame's solve, in its vehicle frame.
+  Obstacle obstacles_[max_obstacles];
+  size_t n_obstacles_;
+
+#define MPC_CONTROLLER_SOLVER(N)                                                 \
+  std::unique_ptr<MPC<N> > mpc_##N##_;                                           \
+  std::unique_ptr<MPC<N> >& Slot(std::integral_constant<size_t, N>) { return mpc_##N##_; } \
+  std::unique_ptr<MPC<N> > candidates_##N##_[max_candidates];                    \
+  std::unique_ptr<MPC<N> >* Candidates(std::integral_constant<size_t, N>) { return candidates_##N##_; }
+  MPC_FOR_EACH_HORIZON(MPC_CONTROLLER_SOLVER)
+#undef MPC_CONTROLLER_SOLVER
+
+  // The MPC over N states, created and set up on the first call, and
+  // that of candidate reference i > 0, created on the thread of the group
+  // that solves it.
+  template <size_t N>
+  MPC<N>& Solver();
+  // Retimed or reset, like the main one, for a solve over time step dt.
+  template <size_t N>
+  MPC<N>& CandidateSolver(size_t i, double dt, bool retime, bool cold);
+
+  // Whether the controller has made the MPC over horizon states, and
+  // whether it is at its memory budget, so that it makes no more.
+  bool Made(size_t horizon) const;
+  bool AtBudget() const { return options_.memory_budget > 0 && bytes_ >= options_.memory_budget; }
+  // Measure the controller after an MPC was made, and past the budget
+  // let go of every MPC but the one over the current horizon.
+  void Measure();
+
+  // Give a new MPC the options of the controller.
+  template <size_t N>
+  void SetUp(MPC<N>& mpc);
+
+  // Apply a change of the load shedding from level from to the
+  // governor's, to the logging and every MPC created, or to one MPC.
+  void Shed(ShedLevel from);
+  template <size_t N>
+  void Shed(MPC<N>& mpc, ShedLevel from);
+
+  // Solve over N states with time step dt, cold if the last solve was
+  // over another horizon.
+  template <size_t N>
+  void SolveWith(const StateVector& state, const Eigen::Vector4d& coeffs, double dt, bool cold,
+                 PipelineClock::time_point deadline, Plan& plan);
+
+  template <size_t N>
+  void SolveOffline(const OfflineProblem& problem, OfflineSolution& solution);
+
+  // Solve the nominal MPC and the first n - 1 scenarios on the group, and
+  // again with the first control they agree on; the nominal result.
+  template <size_t N>
+  const typename MPC<N>::Result& SolveScenarios(MPC<N>& mpc, size_t n, const StateVector& state,
+                                                const Eigen::Vector4d& coeffs, double dt, bool retime,
+                                                bool cold, PipelineClock::time_point deadline);
+
+  // Keep a plan solved with first step dt from the pose of a frame that
+  // arrived at received, with the reference coeffs, for Replay; only with
+  // options.replay_frames, and only one that converged.
+  void KeepPlan(const Plan& plan, PipelineClock::time_point received, double frame_x, double frame_y,
+                double frame_psi, const Eigen::Vector4d& coeffs, double dt);
+
+  // Fill plan from the kept one, at the time of a frame that arrived at
+  // received, if the frame's predicted state, in its vehicle frame at
+  // (frame_x, frame_y, frame_psi), is what the kept plan predicted for
+  // that time within the tolerances, with the errors from the kept
+  // reference those from the frame's, and the kept plan has answered
+  // fewer than options.replay_frames - 1 frames.
+  bool Replay(PipelineClock::time_point received, double frame_x, double frame_y, double frame_psi,
+              const StateVector& state, Plan& plan);
+
+  // Fill plan with the pure pursuit of the reference over the horizon
+  // with first step dt from state, if the hybrid mode pursues for it; on
+  // a switch back to the MPC, keep the plan for its next solve instead.
+  bool Pursue(const StateVector& state, const Eigen::Vector4d& coeffs, double dt, Plan& plan);
+
+  // Fill plan with the pure pursuit over the horizon regardless, as a
+  // converged one; also the fallback of a solve with no usable plan.
+  void PursuitPlan(const StateVector& state, const Eigen::Vector4d& coeffs, double dt, Plan& plan);
+
+  // Replace coeffs by the fit of the planner's latest plan, in the vehicle
+  // frame at (frame_x, frame_y, frame_psi), when there is a recent one.
+  bool FollowPlan(PipelineClock::time_point received, double frame_x, double frame_y, double frame_psi,
+                  Eigen::Vector4d& coeffs);
+
+  // The cross-track and heading errors of the pose (x, y, psi) in the
+  // vehicle frame from the reference coeffs: vertical, at x, or from its
+  // nearest point with options_.exact_cte.
+  void TrackErrors(const Eigen::Vector4d& coeffs, double x, double y, double psi, double& cte,
+                   double& epsi) const;
+
+  // Keep in obstacles_ the obstacles that the horizon of the given length
+  // and first step from state can reach, in the vehicle frame at
+  // (frame_x, frame_y, frame_psi), their radii grown by the margin.
+  void FindObstacles(double frame_x, double frame_y, double frame_psi, const StateVector& state,
+                     size_t horizon, double dt);
+
+  // The reference speeds over a horizon of the given length and first
+  // step from the nearest sample of the reference path into stage_v_:
+  // the profile speeds, capped at ref_v, at the stations the stages reach
+  // when each is driven at its own. Returns their mean.
+  double ProfileSpeed(size_t horizon, double dt);
+
+  void FollowWeights();
+};
+
+#endif /* CONTROLLER_H */
@@ -0,0 +1,117 @@
+#ifndef COST_RESIDUALS_H
+#define COST_RESIDUALS_H
+
+#include <stddef.h>
+#include <algorithm>
+#include "Layout.h"
+#include "TerminalCost.h"
+
+// The cost of the Ipopt problems but the slack penalty, as the weighted
+// sum of squared residuals that it is:
+//
+//   cost = sum_j w_j r_j^2,   r_j = vars[a_j] - vars[b_j] or vars[a_j] - ref_j
+//
+// the tracking errors of every state, the actuators and their changes
+// between stages. Every residual is affine in the variables, with a
+// Jacobian of ones, so the Gauss-Newton Hessian 2 J'WJ of the cost is its
+// exact Hessian, constant for given weights; a problem that drops the
+// constraints' curvature from the Hessian of the Lagrangian (see
+// IpoptOptions::gauss_newton) is left with it alone.
+//
+// no_variable stands for b_j in the residuals of one variable.
+const size_t no_variable = size_t(-1);
+
+// Call term(w_j, r_j, a_j, b_j) for every residual of the horizon of N
+// states at vars, with the references and weights of params. Scalar is
+// what vars and params hold: double, or AD<double> on a tape.
+template <size_t N, class Scalar, class V, class P, class F>
+inline void ForEachCostResidual(const V& vars, const P& params, F term) {
+  typedef Layout<N> L;
+  const Scalar w_cte = params[w_cte_idx];
+  const Scalar w_epsi = params[w_epsi_idx];
+  const Scalar w_v = params[w_v_idx];
+  const Scalar w_delta = params[w_delta_idx];
+  const Scalar w_a = params[w_a_idx];
+  const Scalar w_ddelta = params[w_ddelta_idx];
+  const Scalar w_da = params[w_da_idx];
+
+  // The part of the cost based on the reference state, stage by stage.
+  for (size_t i = 0; i < N; i++) {
+    term(w_cte, vars[L::cte(i)] - params[ref_cte_start + i], L::cte(i), no_variable);
+    term(w_epsi, vars[L::epsi(i)] - params[ref_epsi_start + i], L::epsi(i), no_variable);
+    term(w_v, vars[L::v(i)] - params[ref_v_start + i], L::v(i), no_variable);
+  }
+
+  // Minimize the use of actuators.
+  for (size_t i = 0; i < N - 1; i++) {
+    term(w_delta, Scalar(vars[L::delta(i)]), L::delta(i), no_variable);
+    term(w_a, Scalar(vars[L::a(i)]), L::a(i), no_variable);
+  }
+
+  // Minimize the value gap between sequential actuations.
+  for (size_t i = 0; i < N - 2; i++) {
+    term(w_ddelta, vars[L::delta(i + 1)] - vars[L::delta(i)], L::delta(i + 1), L::delta(i));
+    term(w_da, vars[L::a(i + 1)] - vars[L::a(i)], L::a(i + 1), L::a(i));
+  }
+}
+
+// The terminal cost e' P e (TerminalCost.h) adds to the sum, a quadratic
+// form in the variables of its errors rather than a sum of squares: it
+// too is exact for its Gauss-Newton Hessian, 2 P on those variables.
+
+// Variable of the error i of the terminal cost of a horizon of N states.
+template <size_t N>
+inline size_t TerminalVariable(size_t i) {
+  typedef Layout<N> L;
+  const size_t variables[n_terminal] = { L::cte(N - 1), L::epsi(N - 1), L::v(N - 1), L::delta(N - 2),
+                                         L::a(N - 2) };
+  return variables[i];
+}
+
+// The errors e of the terminal cost at vars.
+template <size_t N, class Scalar, class V, class P>
+inline void TerminalErrors(const V& vars, const P& params, Scalar* e) {
+  for (size_t i = 0; i < n_terminal; i++) {
+    e[i] = vars[TerminalVariable<N>(i)];
+  }
+  e[0] -= params[ref_cte_start + N - 1];
+  e[1] -= params[ref_epsi_start + N - 1];
+  e[2] -= params[ref_v_start + N - 1];
+}
+
+// e' P e at vars, with P of params.
+template <size_t N, class Scalar, class V, class P>
+inline Scalar TerminalCostValue(const V& vars, const P& params) {
+  Scalar e[n_terminal];
+  TerminalErrors<N, Scalar>(vars, params, e);
+  Scalar cost = 0;
+  for (size_t i = 0; i < n_terminal; i++) {
+    cost += params[terminal_start + TerminalEntry(i, i)] * e[i] * e[i];
+    for (size_t j = i + 1; j < n_terminal; j++) {
+      cost += 2 * params[terminal_start + TerminalEntry(i, j)] * e[i] * e[j];
+    }
+  }
+  return cost;
+}
+
+// Add the gradient 2 P e of the terminal cost at vars to grad.
+template <size_t N, class V, class P>
+inline void AddTerminalGradient(const V& vars, const P& params, double* grad) {
+  double e[n_terminal];
+  TerminalErrors<N, double>(vars, params, e);
+  for (size_t i = 0; i < n_terminal; i++) {
+    for (size_t j = 0; j < n_terminal; j++) {
+      grad[TerminalVariable<N>(i)] += 2 * params[terminal_start + TerminalEntry(i, j)] * e[j];
+    }
+  }
+}
+
+// Lower triangle entry (row, col) of the Hessian of the terminal cost at
+// TerminalEntry(i, j); its value is 2 P(i, j).
+template <size_t N>
+inline void TerminalHessianEntry(size_t i, size_t j, size_t& row, size_t& col) {
+  row = std::max(TerminalVariable<N>(i), TerminalVariable<N>(j));
+  col = std::min(TerminalVariable<N>(i), TerminalVariable<N>(j));
+}
+
+#endif /* COST_RESIDUALS_H */
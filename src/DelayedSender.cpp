@@ -0,0 +1,107 @@
+#include "DelayedSender.h"
+#include <algorithm>
+#include "Metrics.h"
+#include "Trace.h"
+
+using namespace std;
+
+// The length of a message travels as its callback data.
+static void OnWritten(uWS::WebSocket<uWS::SERVER>*, void* data, bool, void*) {
+  CountEvent(Counter::BytesWritten, uint64_t(reinterpret_cast<uintptr_t>(data)));
+}
+
+static void CountSend(uWS::WebSocket<uWS::SERVER>* ws, size_t length) {
+  if (!ws->hasEmptyQueue()) {
+    CountEvent(Counter::CongestedSends);
+  }
+  CountEvent(Counter::BytesSent, length);
+}
+
+void SendCounted(uWS::WebSocket<uWS::SERVER>* ws, const char* data, size_t length, uWS::OpCode opcode) {
+  CountSend(ws, length);
+  ws->send(data, length, opcode, OnWritten, reinterpret_cast<void*>(uintptr_t(length)));
+}
+
+PreparedMessage* PrepareCounted(char* data, size_t length, uWS::OpCode opcode) {
+  return uWS::WebSocket<uWS::SERVER>::prepareMessage(data, length, opcode, false, OnWritten);
+}
+
+void SendPreparedCounted(uWS::WebSocket<uWS::SERVER>* ws, PreparedMessage* prepared, size_t length) {
+  CountSend(ws, length);
+  ws->sendPrepared(prepared, reinterpret_cast<void*>(uintptr_t(length)));
+}
+
+DelayedSender::DelayedSender(uS::Loop* loop, int delay_ms)
+    : delay_(chrono::milliseconds(delay_ms)),
+      head_(0),
+      size_(0),
+      timer_(new uS::Timer(loop)),
+      armed_(false) {
+  timer_->setData(this);
+}
+
+DelayedSender::~DelayedSender() {
+  // The timer frees itself once the loop has closed its handle.
+  timer_->stop();
+  timer_->close();
+}
+
+void DelayedSender::Send(uWS::WebSocket<uWS::SERVER>* ws, const string& msg,
+                         uWS::OpCode opcode) {
+  if (size_ == ring_.size()) {
+    vector<Pending> grown(max<size_t>(2 * ring_.size(), 8));
+    for (size_t i = 0; i < size_; i++) {
+      swap(grown[i], At(i));
+    }
+    ring_.swap(grown);
+    head_ = 0;
+  }
+  Pending& p = At(size_++);
+  p.ws = ws;
+  p.msg.assign(msg);
+  p.opcode = opcode;
+  p.due = Clock::now() + delay_;
+  if (!armed_) {
+    Arm();
+  }
+}
+
+void DelayedSender::Cancel(uWS::WebSocket<uWS::SERVER>* ws) {
+  for (size_t i = 0; i < size_; i++) {
+    if (At(i).ws == ws) {
+      At(i).ws = NULL;
+    }
+  }
+}
+
+void DelayedSender::Arm() {
+  // The loop time the timer counts from can lag the clock, so round up
+  // and let Flush re-arm if the head is still not due.
+  auto wait = At(0).due - Clock::now();
+  auto ms = chrono::duration_cast<chrono::milliseconds>(wait).count() + 1;
+  timer_->start(OnTimer, ms > 0 ? ms : 0, 0);
+  armed_ = true;
+}
+
+void DelayedSender::Flush() {
+  armed_ = false;
+  auto now = Clock::now();
+  while (size_ > 0 && At(0).due <= now) {
+    Pending& p = At(0);
+    if (p.ws) {
+      MPC_TRACE("send");
+      auto start = Clock::now();
+      SendCounted(p.ws, p.msg.data(), p.msg.length(), p.opcode);
+      RecordStage(Stage::Send, Clock::now() - start);
+    }
+    head_ = (head_ + 1) & (ring_.size() - 1);
+    size_--;
+  }
+  if (size_ > 0) {
+    Arm();
+  }
+}
+
+void DelayedSender::OnTimer(uS::Timer* timer) {
+  static_cast<DelayedSender*>(timer->getData())->Flush();
+}
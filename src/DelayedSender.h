@@ -0,0 +1,69 @@
+#ifndef DELAYED_SENDER_H
+#define DELAYED_SENDER_H
+
+#include <uWS/uWS.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Websocket sends that count their payload in the metrics twice: as sent
+// when handed to uWS, and as written once uWS has written it out or
+// dropped it with its socket, so that the difference is what the sockets
+// still hold in their queues (mpc_send_buffered_bytes). A message to a
+// socket with a queue is also counted as congested. The prepared message
+// is for several sockets: its callback counts each of its sends.
+typedef uWS::WebSocket<uWS::SERVER>::PreparedMessage PreparedMessage;
+void SendCounted(uWS::WebSocket<uWS::SERVER>* ws, const char* data, size_t length, uWS::OpCode opcode);
+PreparedMessage* PrepareCounted(char* data, size_t length, uWS::OpCode opcode);
+void SendPreparedCounted(uWS::WebSocket<uWS::SERVER>* ws, PreparedMessage* prepared, size_t length);
+
+// Sends websocket messages a fixed delay after they are queued, using a
+// timer on the event loop instead of blocking it. This emulates the
+// actuator latency while the loop keeps reading telemetry.
+//
+// Every message has the same delay, so the queue is in release order and
+// a single timer armed for its head is enough. It is a ring whose slots
+// keep their message buffers, so once it has grown to the number of
+// messages in flight, queueing one copies it without allocating.
+class DelayedSender {
+ public:
+  DelayedSender(uS::Loop* loop, int delay_ms);
+
+  virtual ~DelayedSender();
+
+  // Queue msg for ws, to be sent delay_ms from now.
+  void Send(uWS::WebSocket<uWS::SERVER>* ws, const std::string& msg,
+            uWS::OpCode opcode = uWS::OpCode::TEXT);
+
+  // Drop the pending messages of ws, e.g. when it disconnects.
+  void Cancel(uWS::WebSocket<uWS::SERVER>* ws);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Pending {
+    uWS::WebSocket<uWS::SERVER>* ws;
+    std::string msg;
+    uWS::OpCode opcode;
+    Clock::time_point due;
+  };
+
+  Clock::duration delay_;
+  // size_ messages from head_ on, in a power of two of slots. A cancelled
+  // message stays in its slot with no socket.
+  std::vector<Pending> ring_;
+  size_t head_;
+  size_t size_;
+  uS::Timer* timer_;
+  bool armed_;
+
+  Pending& At(size_t i) { return ring_[(head_ + i) & (ring_.size() - 1)]; }
+
+  // Send the messages that are due and re-arm for the next one.
+  void Flush();
+  void Arm();
+
+  static void OnTimer(uS::Timer* timer);
+};
+
+#endif /* DELAYED_SENDER_H */
@@ -0,0 +1,57 @@
+#include "Embedded.h"
+#include <math.h>
+#include <algorithm>
+#include "Polyfit.h"
+
+// Longest step of the latency prediction, as Controller takes it.
+static const float max_step = 0.05f;
+
+template <size_t N>
+EmbeddedController<N>::EmbeddedController(float dt, float ref_v, float latency)
+    : solver_(dt, float(Lf)), latency_(latency) {
+  solver_.SetReference(0, 0, ref_v);
+}
+
+template <size_t N>
+bool EmbeddedController<N>::Step(const EmbeddedFrame& frame, EmbeddedCommand& command) {
+  const size_t n = std::min(frame.n_points, size_t(max_points));
+  if (n < 4) {
+    return false;
+  }
+
+  // The waypoints in the vehicle frame of the measurement.
+  float xs[max_points];
+  float ys[max_points];
+  const float c = cosf(frame.psi);
+  const float s = sinf(frame.psi);
+  for (size_t i = 0; i < n; i++) {
+    float dx = frame.ptsx[i] - frame.px;
+    float dy = frame.ptsy[i] - frame.py;
+    xs[i] = c * dx + s * dy;
+    ys[i] = -s * dx + c * dy;
+  }
+  typename Solver::CoeffVector coeffs = Polyfit<3>(xs, ys, n);
+
+  // The pose the actuators take effect at, in that frame.
+  float pose[4] = { 0, 0, 0, frame.v };
+  const float u[2] = { frame.delta, frame.a };
+  const BicycleModel<float> model(Lf, 0);
+  int steps = int(ceilf(latency_ / max_step));
+  for (int k = 0; k < steps; k++) {
+    model.Advance(pose, u, latency_ / steps, pose);
+  }
+
+  float f_x;
+  float df_x;
+  Polyval<3>(coeffs, pose[0], f_x, df_x);
+  typename Solver::Vector6 state;
+  state << pose[0], pose[1], pose[2], pose[3], f_x - pose[1], pose[2] - atanf(df_x);
+
+  command.cost = solver_.Feedback(state, coeffs);
+  command.delta = solver_.Inputs()(0);
+  command.a = solver_.Inputs()(1);
+  return true;
+}
+
+#define INSTANTIATE(N) template class EmbeddedController<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
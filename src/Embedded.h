@@ -0,0 +1,74 @@
+#ifndef EMBEDDED_H
+#define EMBEDDED_H
+
+#include <stddef.h>
+#include "Eigen-3.3/Eigen/Core"
+#include "RTI.h"
+
+// The deployable core of the controller in single precision, for ECUs
+// without fast double arithmetic: the frame of a telemetry message, the
+// fit of the reference polynomial (Polyfit.h), the latency prediction
+// and the RTI backend (RTI.h), all on float.
+//
+// The embedded build (MPC_EMBEDDED in CMake) compiles Embedded.cpp and
+// RTI.cpp alone, for float, without exceptions, RTTI or iostreams and
+// with EIGEN_NO_MALLOC: every matrix is fixed-size, so an
+// EmbeddedController is its whole memory and a step makes no allocation.
+// mpc_footprint reports the sizes per horizon. The desktop build, with
+// Ipopt, CppAD and the rest of Controller, is not part of it.
+//
+// The sign conventions are those of the model, as the MPC plans in: a
+// positive delta turns left; the caller maps them to its actuators.
+
+// The waypoints and the measured state of one frame, in map coordinates,
+// and the actuators last applied, which the latency is predicted over.
+struct EmbeddedFrame {
+  const float* ptsx;
+  const float* ptsy;
+  size_t n_points;
+  float px;
+  float py;
+  float psi;
+  float v;
+  float delta;
+  float a;
+};
+
+struct EmbeddedCommand {
+  float delta;
+  float a;
+  float cost;
+};
+
+template <size_t N>
+class EmbeddedController {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef RTI<N, float> Solver;
+
+  // Waypoints of a frame that are fitted, the nearest first.
+  enum : size_t { max_points = 16 };
+
+  // Solves over steps of dt towards the speed ref_v, for actuators that
+  // take effect latency seconds after the frame.
+  EmbeddedController(float dt, float ref_v, float latency);
+
+  // The command for a frame; false, leaving command as it was, when the
+  // frame has fewer than four waypoints.
+  bool Step(const EmbeddedFrame& frame, EmbeddedCommand& command);
+
+  // The preparation phase of the next step, between frames (see
+  // RTI::Prepare).
+  void Prepare() { solver_.Prepare(); }
+
+  void Reset() { solver_.Reset(); }
+
+  const Solver& Plan() const { return solver_; }
+
+ private:
+  Solver solver_;
+  float latency_;
+};
+
+#endif /* EMBEDDED_H */
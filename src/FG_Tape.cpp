@@ -0,0 +1,141 @@
+#include "FG_Tape.h"
+#include <math.h>
+#include <atomic>
+#include <random>
+#include "FG_eval.h"
+#include "Layout.h"
+#include "Logger.h"
+
+template class CppAD::ADFun<double>;
+
+static std::atomic<bool> verify_tapes(false);
+
+void SetTapeVerification(bool verify) {
+  verify_tapes = verify;
+}
+
+// Largest relative difference of the zero order sweeps of optimized and
+// original at random points and parameters around the operating range.
+static double TapeDifference(CppAD::ADFun<double>& optimized, CppAD::ADFun<double>& original, size_t n_vars) {
+  std::mt19937 random(1);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  // Positive parameters, for the time steps among them.
+  std::uniform_real_distribution<double> positive(0.05, 1);
+  std::vector<double> x(n_vars);
+  std::vector<double> p(n_params);
+  double worst = 0;
+  for (int trial = 0; trial < 4; trial++) {
+    for (double& xi : x) {
+      xi = uniform(random);
+    }
+    for (double& pi : p) {
+      pi = positive(random);
+    }
+    optimized.new_dynamic(p);
+    original.new_dynamic(p);
+    std::vector<double> a = optimized.Forward(0, x);
+    std::vector<double> b = original.Forward(0, x);
+    for (size_t i = 0; i < a.size(); i++) {
+      worst = fmax(worst, fabs(a[i] - b[i]) / fmax(1.0, fabs(b[i])));
+    }
+  }
+  return worst;
+}
+
+// Optimize tape (0 for fg, 1 for g) on fun, checking it against the
+// recording when asked.
+template <size_t N>
+static void Optimize(CppAD::ADFun<double>& fun, int tape) {
+  const char* name = tape == 0 ? "fg" : "g";
+  size_t before = fun.size_op();
+  CppAD::ADFun<double> original;
+  const bool verify = verify_tapes;
+  if (verify) {
+    original = fun;
+  }
+  fun.optimize();
+  static std::atomic<bool> reported[2] = { { false }, { false } };
+  if (!reported[tape].exchange(true)) {
+    MPC_LOG(LogLevel::Info, "Tape %s of N = %zu: %zu operations, %zu after optimize()", name, N, before,
+            size_t(fun.size_op()));
+  }
+  if (verify) {
+    double difference = TapeDifference(fun, original, Layout<N>::nlp_vars);
+    if (difference > 1e-12) {
+      MPC_LOG(LogLevel::Error, "Optimized tape %s of N = %zu differs from its recording by %g", name, N,
+              difference);
+    } else {
+      MPC_LOG(LogLevel::Info, "Optimized tape %s of N = %zu matches its recording", name, N);
+    }
+  }
+}
+
+// The stage of BicycleModel over arguments laid out as StageStep packs
+// them.
+static CppAD::ADFun<double> RecordStage() {
+  CPPAD_TESTVECTOR(AD<double>) args(stage_checkpoint_args);
+  for (size_t i = 0; i < stage_checkpoint_args; i++) {
+    args[i] = 0.0;
+  }
+  CppAD::Independent(args);
+  BicycleModel<AD<double> > model(Lf, args[13]);
+  CPPAD_TESTVECTOR(AD<double>) next(BicycleModel<AD<double> >::n_states);
+  model.Step(&args[0], &args[6], &args[8], args[12], &next[0]);
+  CppAD::ADFun<double> stage(args, next);
+  stage.optimize();
+  return stage;
+}
+
+CppAD::chkpoint_two<double>& StageCheckpoint() {
+  // Made once and kept for good: every tape that calls it refers to it.
+  static CppAD::chkpoint_two<double>* checkpoint = []() {
+    const bool parallel = CppAD::thread_alloc::num_threads() > 1;
+    return new CppAD::chkpoint_two<double>(RecordStage(), "mpc_stage", true, true, false, parallel);
+  }();
+  return *checkpoint;
+}
+
+template <size_t N, class Model>
+static void RecordModel(CppAD::ADFun<double>& fg_fun, CppAD::ADFun<double>& g_fun) {
+  typedef Layout<N> L;
+  typedef FG_eval<N, Model> Eval;
+  for (int tape = 0; tape < 2; tape++) {
+    typename Eval::ADvector avars(L::nlp_vars);
+    typename Eval::ADvector aparams(n_params);
+    for (size_t i = 0; i < L::nlp_vars; i++) {
+      avars[i] = 0.0;
+    }
+    for (size_t i = 0; i < n_params; i++) {
+      aparams[i] = 0.0;
+    }
+    CppAD::Independent(avars, 0, false, aparams);
+    typename Eval::ADvector afg(1 + L::n_constraints);
+    Eval fg_eval;
+    fg_eval(afg, avars, aparams);
+    if (tape == 0) {
+      fg_fun.Dependent(avars, afg);
+      Optimize<N>(fg_fun, tape);
+    } else {
+      typename Eval::ADvector ag(L::n_constraints);
+      for (size_t i = 0; i < L::n_constraints; i++) {
+        ag[i] = afg[1 + i];
+      }
+      g_fun.Dependent(avars, ag);
+      Optimize<N>(g_fun, tape);
+    }
+  }
+}
+
+template <size_t N>
+void RecordTapes(CppAD::ADFun<double>& fg_fun, CppAD::ADFun<double>& g_fun, bool frenet) {
+  if (frenet) {
+    RecordModel<N, FrenetModel<AD<double> > >(fg_fun, g_fun);
+  } else {
+    RecordModel<N, BicycleModel<AD<double> > >(fg_fun, g_fun);
+  }
+}
+
+#define INSTANTIATE(N) \
+  template void RecordTapes<N>(CppAD::ADFun<double>& fg_fun, CppAD::ADFun<double>& g_fun, bool frenet);
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
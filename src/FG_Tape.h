@@ -0,0 +1,43 @@
+#ifndef FG_TAPE_H
+#define FG_TAPE_H
+
+#include <stddef.h>
+#include <cppad/cppad.hpp>
+
+// The CppAD function type of the tapes is instantiated once, in
+// FG_Tape.cpp, instead of in every unit that holds or evaluates a tape.
+extern template class CppAD::ADFun<double>;
+
+// Record fg = FG_eval<N>(vars; params) on fg_fun, with the parameters as
+// dynamic parameters, and its constraints alone on g_fun, and optimize
+// both: CppAD's optimize() drops the operations that no output depends
+// on and merges the duplicates, so that every later sweep is shorter. The
+// operation counts before and after are logged for the first recording
+// of each horizon.
+//
+// With frenet the model is FrenetModel, in the coordinates of the
+// reference path, instead of BicycleModel (see MPC::SetFrenet).
+//
+// FG_Tape.cpp is the only unit that includes FG_eval.h and records on
+// AD<double>, so a change to the cost or the model recompiles just it.
+template <size_t N>
+void RecordTapes(CppAD::ADFun<double>& fg_fun, CppAD::ADFun<double>& g_fun, bool frenet = false);
+
+// With MPC_STAGE_CHECKPOINT the constraint block calls one stage of the
+// model, recorded once, as a CppAD checkpoint (chkpoint_two) instead of
+// recording the model N - 1 times, so that the tapes hold one operation
+// per stage for the dynamics instead of some forty and grow little with
+// the horizon. Its 14 arguments are the state, the actuators, the
+// coefficients, the time step and the understeer, and it returns the next
+// state. The checkpoint is made by the first recording, or in sequential
+// mode by MPCParallelSetup, which gives every thread its copy.
+CppAD::chkpoint_two<double>& StageCheckpoint();
+enum : size_t { stage_checkpoint_args = 14 };
+
+// Check every optimized tape against the unoptimized recording at a few
+// random points and parameters, logging an error on any difference
+// beyond rounding; for mpc --verify-tapes. Off by default, since it keeps
+// a second copy of the tapes while recording.
+void SetTapeVerification(bool verify);
+
+#endif /* FG_TAPE_H */
@@ -0,0 +1,112 @@
+#ifndef FG_EVAL_H
+#define FG_EVAL_H
+
+#include <cppad/cppad.hpp>
+#include "CostResiduals.h"
+#include "FG_Tape.h"
+#include "Horner.h"
+#include "Kinematics.h"
+#include "Layout.h"
+#include "LinearConstraints.h"
+
+using CppAD::AD;
+
+#ifdef MPC_STAGE_CHECKPOINT
+// One step of the bicycle through the checkpoint of the stage (see
+// StageCheckpoint, FG_Tape.h).
+inline void StageStep(const BicycleModel<AD<double> >& model, const AD<double>* x, const AD<double>* u,
+                      const AD<double>* coeffs, const AD<double>& dt, AD<double>* next) {
+  typedef BicycleModel<AD<double> > Model;
+  CPPAD_TESTVECTOR(AD<double>) args(stage_checkpoint_args);
+  CPPAD_TESTVECTOR(AD<double>) result(Model::n_states);
+  for (size_t s = 0; s < Model::n_states; s++) {
+    args[s] = x[s];
+  }
+  args[6] = u[0];
+  args[7] = u[1];
+  for (size_t k = 0; k < 4; k++) {
+    args[8 + k] = coeffs[k];
+  }
+  args[12] = dt;
+  args[13] = model.understeer;
+  StageCheckpoint()(args, result);
+  for (size_t s = 0; s < Model::n_states; s++) {
+    next[s] = result[s];
+  }
+}
+
+// The checkpoint is of the bicycle; other models are recorded as they
+// are.
+template <class Model>
+void StageStep(const Model& model, const AD<double>* x, const AD<double>* u, const AD<double>* coeffs,
+               const AD<double>& dt, AD<double>* next) {
+  model.Step(x, u, coeffs, dt, next);
+}
+#endif
+
+// fg[0] is the cost, fg[1..] the constraints of a horizon of N states of
+// Model (see BicycleModel and FrenetModel, Kinematics.h). The cost is the
+// weighted squared residuals of ForEachCostResidual, the terminal cost
+// and the penalty of the slacks after the model variables; the linear
+// rows over them (LinearConstraints.h) are not recorded.
+template <size_t N, class Model = BicycleModel<AD<double> > >
+class FG_eval {
+ public:
+  typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+  typedef Layout<N> L;
+  static_assert(size_t(Model::n_states) == size_t(L::n_states) &&
+                    size_t(Model::n_inputs) == size_t(L::n_actuators),
+                "the layout holds the states and actuators of the model");
+
+  // params holds the fitted polynomial coefficients, the reference values
+  // of every stage, the cost weights and the time grid.
+  void operator()(ADvector& fg, const ADvector& vars, const ADvector& params) {
+    const AD<double>* coeffs = &params[coeffs_start];
+    // Time step of the stage, from the first one on.
+    AD<double> dt = params[dt_idx];
+    AD<double> dt_growth = params[dt_growth_idx];
+    const Model model = Model::FromParams(params);
+
+    // The weighted squares of the tracking errors, the actuators and their
+    // changes (CostResiduals.h).
+    fg[0] = 0;
+    ForEachCostResidual<N, AD<double> >(
+        vars, params, [&fg](const AD<double>& w, const AD<double>& r, size_t, size_t) { fg[0] += w * r * r; });
+    fg[0] += TerminalCostValue<N, AD<double> >(vars, params);
+
+    // L1 penalty of the slacks.
+    fg[0] += SlackCost<N>(vars, params[w_slack_idx]);
+
+    // Initial constraints
+    fg[1 + L::x_row(0)] = vars[L::x(0)];
+    fg[1 + L::y_row(0)] = vars[L::y(0)];
+    fg[1 + L::psi_row(0)] = vars[L::psi(0)];
+    fg[1 + L::v_row(0)] = vars[L::v(0)];
+    fg[1 + L::cte_row(0)] = vars[L::cte(0)];
+    fg[1 + L::epsi_row(0)] = vars[L::epsi(0)];
+
+    // The rest of the constraints
+    for (size_t i = 0; i < N - 1; i++) {
+      // The state and the actuation at time t.
+      AD<double> x[Model::n_states];
+      AD<double> next[Model::n_states];
+      for (size_t s = 0; s < Model::n_states; s++) {
+        x[s] = vars[L::State(s, i)];
+      }
+      AD<double> u[2] = { vars[L::delta(i)], vars[L::a(i)] };
+
+      // model constraints
+#ifdef MPC_STAGE_CHECKPOINT
+      StageStep(model, x, u, coeffs, dt, next);
+#else
+      model.Step(x, u, coeffs, dt, next);
+#endif
+      for (size_t s = 0; s < Model::n_states; s++) {
+        fg[1 + L::Row(s, i + 1)] = vars[L::State(s, i + 1)] - next[s];
+      }
+      dt *= dt_growth;
+    }
+  }
+};
+
+#endif /* FG_EVAL_H */
@@ -0,0 +1,71 @@
+#include "FlightRecorder.h"
+#include <stdio.h>
+#include <algorithm>
+#include "Logger.h"
+#include "Metrics.h"
+#include "RunLog.h"
+#include "Scheduler.h"
+
+using namespace std;
+
+// Least time between two dumps.
+static const chrono::seconds dump_interval(1);
+
+FlightRecorder::FlightRecorder(const string& directory, size_t frames, double budget)
+    : directory_(directory),
+      budget_(chrono::duration_cast<PipelineClock::duration>(chrono::duration<double>(budget))),
+      observations_(max<size_t>(frames, 1)),
+      arrived_(observations_.size()),
+      next_(0),
+      count_(0),
+      snapshot_(observations_.size()),
+      snapshot_arrived_(observations_.size()),
+      writing_(false),
+      dumps_(0) {}
+
+FlightRecorder::~FlightRecorder() { Flush(); }
+
+void FlightRecorder::Record(const Observation& observation, PipelineClock::time_point arrived,
+                            PipelineClock::time_point replied) {
+  lock_guard<mutex> lock(mutex_);
+  observations_[next_] = observation;
+  arrived_[next_] = arrived;
+  next_ = (next_ + 1) % observations_.size();
+  count_ = min(count_ + 1, observations_.size());
+  if (!observation.ok) {
+    Dump("failed solve");
+  } else if (replied - arrived > budget_) {
+    Dump("latency spike");
+  }
+}
+
+void FlightRecorder::Flush() { TaskScheduler::Background().Flush(); }
+
+void FlightRecorder::Dump(const char* reason) {
+  PipelineClock::time_point now = PipelineClock::now();
+  if (writing_ || (dumps_ > 0 && now - last_dump_ < dump_interval)) {
+    return;
+  }
+  // Oldest first: the ring from next_ on once it has wrapped.
+  size_t first = count_ < observations_.size() ? 0 : next_;
+  for (size_t i = 0; i < count_; i++) {
+    size_t at = (first + i) % observations_.size();
+    snapshot_[i] = observations_[at];
+    snapshot_arrived_[i] = arrived_[at];
+  }
+  writing_ = true;
+  last_dump_ = now;
+  CountEvent(Counter::FlightDumps);
+  char name[32];
+  snprintf(name, sizeof(name), "/spike-%llu.mpcl", (unsigned long long)dumps_++);
+  string path = directory_ + name;
+  size_t n = count_;
+  MPC_LOG(LogLevel::Warning, "Flight recorder: %s, writing the last %zu frames to %s", reason, n, path.c_str());
+  TaskScheduler::Background().Post(TaskClass::Logging, [this, path, n]() {
+    if (!WriteRunLog(path, snapshot_.data(), snapshot_arrived_.data(), n)) {
+      MPC_LOG(LogLevel::Error, "Failed to write the flight recorder dump %s", path.c_str());
+    }
+    lock_guard<mutex> lock(mutex_);
+    writing_ = false;
+  });
+}
@@ -0,0 +1,65 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Pipeline.h"
+
+// Flight recorder of the frames solved last, for the context of the rare
+// spikes that the metrics average away, at the cost of a copy per frame
+// rather than of a run log kept on for hours.
+//
+// Every frame's observation (see Pipeline.h: the state, the command, the
+// solve statistics, the stage timings and the plan) goes into a ring of
+// the last frames, allocated up front, so recording takes a lock and a
+// copy and never allocates. A frame that takes longer than the budget
+// from its arrival to its reply, or whose solve fails, has the ring
+// copied into a snapshot, also allocated up front, which the background
+// scheduler writes as logging work (see Scheduler.h) to a run log of its
+// own, DIR/spike-<n>.mpcl (see RunLog.h), oldest frame first. A spike
+// while the last snapshot is still being written, or within a second of
+// it, is not dumped again: its frames are in the next dump's ring, and a
+// failing stretch writes one file a second rather than one a frame.
+class FlightRecorder {
+ public:
+  // The last frames frames, dumped to directory on frames over budget
+  // seconds.
+  FlightRecorder(const std::string& directory, size_t frames, double budget);
+
+  virtual ~FlightRecorder();
+
+  // The observation of a frame that arrived at arrived (see
+  // Telemetry::arrived) and was replied to at replied, from any thread.
+  void Record(const Observation& observation, PipelineClock::time_point arrived,
+              PipelineClock::time_point replied);
+
+  // Wait until the dumps under way are on disk.
+  void Flush();
+
+ private:
+  std::string directory_;
+  PipelineClock::duration budget_;
+
+  std::mutex mutex_;
+  // The ring: next_ is where the next frame goes, count_ the frames in it.
+  std::vector<Observation> observations_;
+  std::vector<PipelineClock::time_point> arrived_;
+  size_t next_;
+  size_t count_;
+  // The snapshot, in order, while writing_; the dumps so far and when the
+  // last was taken.
+  std::vector<Observation> snapshot_;
+  std::vector<PipelineClock::time_point> snapshot_arrived_;
+  bool writing_;
+  uint64_t dumps_;
+  PipelineClock::time_point last_dump_;
+
+  // Copy the ring into the snapshot and post its write; mutex_ is held.
+  void Dump(const char* reason);
+};
+
+#endif /* FLIGHT_RECORDER_H */
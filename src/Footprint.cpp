@@ -0,0 +1,78 @@
+#include "Footprint.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+Footprint::Footprint()
+    : tape_ops(0),
+      tape_vars(0),
+      tape_params(0),
+      tape_bytes(0),
+      sparsity_bytes(0),
+      ipopt_bytes(0),
+      solver_bytes(0),
+      cache_bytes(0),
+      connection_bytes(0),
+      problems(0),
+      solvers(0),
+      controllers(0) {}
+
+size_t Footprint::Total() const {
+  return tape_bytes + sparsity_bytes + ipopt_bytes + solver_bytes + cache_bytes + connection_bytes;
+}
+
+// A "kB" field of /proc/self/status, in bytes.
+static size_t StatusBytes(const char* field) {
+  size_t bytes = 0;
+#ifdef __linux__
+  FILE* file = fopen("/proc/self/status", "r");
+  if (!file) {
+    return 0;
+  }
+  char line[256];
+  size_t length = strlen(field);
+  while (fgets(line, sizeof(line), file)) {
+    unsigned long long kb;
+    if (strncmp(line, field, length) == 0 && line[length] == ':' &&
+        sscanf(line + length + 1, "%llu", &kb) == 1) {
+      bytes = size_t(kb) * 1024;
+      break;
+    }
+  }
+  fclose(file);
+#else
+  (void)field;
+#endif
+  return bytes;
+}
+
+void WriteFootprint(std::string& out, const Footprint& f) {
+  size_t heap_used = 0;
+  size_t heap_mapped = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+  heap_used = info.uordblks + info.hblkhd;
+  heap_mapped = info.arena + info.hblkhd;
+#elif defined(__GLIBC__)
+  struct mallinfo info = mallinfo();
+  heap_used = size_t(unsigned(info.uordblks)) + size_t(unsigned(info.hblkhd));
+  heap_mapped = size_t(unsigned(info.arena)) + size_t(unsigned(info.hblkhd));
+#endif
+  char text[1024];
+  int n = snprintf(text, sizeof(text),
+                   "{\"controllers\":%zu,\"solvers\":%zu,\"problems\":%zu,"
+                   "\"tape_ops\":%zu,\"tape_vars\":%zu,\"tape_params\":%zu,\"tape_bytes\":%zu,"
+                   "\"sparsity_bytes\":%zu,\"ipopt_estimate_bytes\":%zu,\"solver_bytes\":%zu,"
+                   "\"cache_bytes\":%zu,\"connection_bytes\":%zu,\"total_bytes\":%zu,"
+                   "\"bytes_per_controller\":%zu,"
+                   "\"heap_used_bytes\":%zu,\"heap_mapped_bytes\":%zu,"
+                   "\"resident_bytes\":%zu,\"resident_peak_bytes\":%zu}\n",
+                   f.controllers, f.solvers, f.problems, f.tape_ops, f.tape_vars, f.tape_params,
+                   f.tape_bytes, f.sparsity_bytes, f.ipopt_bytes, f.solver_bytes, f.cache_bytes,
+                   f.connection_bytes, f.Total(), f.controllers ? f.Total() / f.controllers : 0, heap_used,
+                   heap_mapped, StatusBytes("VmRSS"), StatusBytes("VmHWM"));
+  out.assign(text, n > 0 ? std::min(size_t(n), sizeof(text) - 1) : 0);
+}
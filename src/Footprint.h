@@ -0,0 +1,73 @@
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#include <stddef.h>
+#include <set>
+#include <string>
+#include <vector>
+
+// Memory of the controllers, by what holds it, for capacity planning:
+// what one more connection costs. Summed over the objects that report
+// into it, and served by the server at /memory with the heap and resident
+// set of the process (WriteFootprint).
+struct Footprint {
+  // The CppAD tapes: operations, variables and parameters recorded, and
+  // the bytes of their operation sequences and Taylor coefficients.
+  size_t tape_ops;
+  size_t tape_vars;
+  size_t tape_params;
+  size_t tape_bytes;
+  // Sparsity patterns and derivative structures of the Ipopt problems.
+  size_t sparsity_bytes;
+  // Estimated working set of Ipopt from the problem sizes (see
+  // IpoptEstimate); the factors of its linear solver come on top.
+  size_t ipopt_bytes;
+  // The solver objects with their fixed-size storage and the buffers of
+  // the backends.
+  size_t solver_bytes;
+  // Entries of the solution caches (SolutionCache.h).
+  size_t cache_bytes;
+  // Controllers and the per-connection state of the batch: instances,
+  // reply buffers and queues.
+  size_t connection_bytes;
+  // Problems, solvers and controllers counted.
+  size_t problems;
+  size_t solvers;
+  size_t controllers;
+
+  Footprint();
+
+  size_t Total() const;
+};
+
+template <class T, class A>
+inline size_t VectorBytes(const std::vector<T, A>& v) {
+  return v.capacity() * sizeof(T);
+}
+
+// A pattern of std::set rows: the tree nodes of the entries, each of a
+// size_t and three pointers and a color.
+inline size_t PatternBytes(const std::vector<std::set<size_t> >& pattern) {
+  size_t entries = 0;
+  for (const auto& row : pattern) {
+    entries += row.size();
+  }
+  return VectorBytes(pattern) + entries * (sizeof(size_t) + 4 * sizeof(void*));
+}
+
+// The working set of Ipopt for a problem of n variables, m constraints
+// and the given nonzeros: sixteen vectors of the primal-dual iterate
+// (iterate, trial point, step and their multipliers), and the values and
+// indices of the Jacobian, the Hessian and the augmented system, twice
+// (Ipopt's triplets and the copy handed to the linear solver).
+inline size_t IpoptEstimate(size_t n, size_t m, size_t nnz_jac, size_t nnz_h) {
+  const size_t triplet = sizeof(double) + 2 * sizeof(int);
+  return 16 * (n + m) * sizeof(double) + 2 * (2 * (nnz_jac + nnz_h) + n + m) * triplet;
+}
+
+// Write the footprint with the memory of the process as JSON: the heap in
+// use and mapped (mallinfo, glibc only), and the resident set and its
+// high-water mark (Linux only), in bytes; 0 where unknown.
+void WriteFootprint(std::string& out, const Footprint& footprint);
+
+#endif /* FOOTPRINT_H */
@@ -0,0 +1,56 @@
+#ifndef HORNER_H
+#define HORNER_H
+
+#include <stddef.h>
+#include "Eigen-3.3/Eigen/Core"
+
+// Degree K polynomial c[0] + c[1] x + ... + c[K] x^K in Horner form.
+//
+// C is anything indexable by [k] (Eigen::Vector4d, a raw pointer into a
+// CppAD parameter vector, ...) and T is the argument type: double,
+// CppAD::AD<double> or an Eigen array, which evaluates one polynomial per
+// lane. The first step is a multiply-add on x so no T has to be built
+// from a scalar, and on an AD tape every step records a single multiply
+// and add instead of a pow().
+
+template <int K, class C, class T>
+inline T Polyval(const C& c, const T& x) {
+  static_assert(K >= 1, "Polyval needs degree >= 1");
+  T p = c[K] * x + c[K - 1];
+  for (int k = K - 2; k >= 0; k--) {
+    p = p * x + c[k];
+  }
+  return p;
+}
+
+// Value and first derivative of the same polynomial in one pass.
+template <int K, class C, class T>
+inline void Polyval(const C& c, const T& x, T& value, T& deriv) {
+  static_assert(K >= 2, "Polyval with derivative needs degree >= 2");
+  value = c[K] * x + c[K - 1];
+  deriv = (double(K) * c[K]) * x + double(K - 1) * c[K - 1];
+  for (int k = K - 2; k >= 0; k--) {
+    value = value * x + c[k];
+    if (k > 0) {
+      deriv = deriv * x + double(k) * c[k];
+    }
+  }
+}
+
+// The same polynomial at the n values of x, written to y, which must not
+// overlap x. Each Horner step is one pass of Eigen array packets over the
+// values, so a long line or a batch of rollouts costs a few vector
+// multiply-adds per point.
+template <int K, class C, class T>
+inline void PolyvalBatch(const C& c, const T* x, size_t n, T* y) {
+  static_assert(K >= 1, "PolyvalBatch needs degree >= 1");
+  typedef Eigen::Array<T, Eigen::Dynamic, 1> Array;
+  Eigen::Map<const Array> xs(x, Eigen::Index(n));
+  Eigen::Map<Array> ys(y, Eigen::Index(n));
+  ys = c[K] * xs + c[K - 1];
+  for (int k = K - 2; k >= 0; k--) {
+    ys = ys * xs + c[k];
+  }
+}
+
+#endif /* HORNER_H */
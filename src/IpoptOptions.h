@@ -0,0 +1,71 @@
+#ifndef IPOPT_OPTIONS_H
+#define IPOPT_OPTIONS_H
+
+#include <string>
+
+// Options of the Ipopt applications of an MPC (see MPC::SetIpoptOptions),
+// set on each application once when it is created instead of on every
+// solve. Empty strings and zeros keep Ipopt's own default.
+struct IpoptOptions {
+  // "ma27", "ma57", "ma86", "ma97", "mumps", "pardiso" or "pardisomkl";
+  // which are available depends on how Ipopt was built (see
+  // install_ipopt.sh).
+  std::string linear_solver;
+  // Threads of a multithreaded linear solver (see
+  // MultithreadedLinearSolver) in every solve, 0 for the cores left to
+  // each concurrent solve (ControlCoreBudget, Scheduler.h). The solvers
+  // take them from the environment of the process, so they are applied
+  // once, by MPCLinearSolverThreads, rather than per application.
+  size_t linear_solver_threads;
+  // Convergence tolerance (tol), 0 for Ipopt's 1e-8.
+  double tol;
+  // "monotone" or "adaptive".
+  std::string mu_strategy;
+  // "exact", or "limited-memory" for an L-BFGS approximation that never
+  // evaluates the Hessian.
+  std::string hessian_approximation;
+  // With the exact Hessian, leave the curvature of the constraints out of
+  // the Hessian of the Lagrangian: the Gauss-Newton Hessian of the
+  // least-squares cost (see CostResiduals.h), evaluated without the
+  // second-order sweep of the constraints.
+  bool gauss_newton;
+  // Warm start from the previous solution and its multipliers, starting
+  // the barrier parameter at warm_mu_init and pushing the iterate
+  // warm_bound_push from the bounds; without it every solve starts the
+  // barrier at cold_mu_init from the shifted solution alone.
+  bool warm_start;
+  double warm_mu_init;
+  double warm_bound_push;
+  double cold_mu_init;
+  // Scale the variables and constraints by their typical magnitudes
+  // instead of Ipopt's gradient-based scaling (see ScaleProblem,
+  // MPC.cpp).
+  bool user_scaling;
+  // Time limit of a solve in seconds, its iteration limit (max_iter, 0
+  // for Ipopt's 3000), and the level of Ipopt's own output.
+  double max_cpu_time;
+  int max_iter;
+  int print_level;
+
+  IpoptOptions()
+      : linear_solver_threads(0),
+        tol(0),
+        gauss_newton(false),
+        warm_start(true),
+        warm_mu_init(1e-4),
+        warm_bound_push(1e-6),
+        cold_mu_init(0.1),
+        user_scaling(false),
+        max_cpu_time(0.5),
+        max_iter(0),
+        print_level(0) {}
+};
+
+// Whether the linear solver factors the KKT system on several threads:
+// MA86 and MA97 through OpenMP, and both Pardisos on threads of their own.
+inline bool MultithreadedLinearSolver(const std::string& linear_solver) {
+  return linear_solver == "ma86" || linear_solver == "ma97" || linear_solver == "pardiso" ||
+         linear_solver == "pardisomkl";
+}
+
+#endif /* IPOPT_OPTIONS_H */
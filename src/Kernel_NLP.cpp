@@ -0,0 +1,371 @@
+#include "Kernel_NLP.h"
+#include "CostResiduals.h"
+#include "Horner.h"
+#include "Kinematics.h"
+#include "LinearConstraints.h"
+#include "ObstacleConstraints.h"
+#include <map>
+#include <math.h>
+#include "Trace.h"
+
+using namespace Ipopt;
+
+template <size_t N>
+Kernel_NLP<N>::Kernel_NLP() {
+  // Initial constraints
+  for (size_t s = 0; s < 6; s++) {
+    AddJac(L::Row(s, 0), L::State(s, 0));
+  }
+  // Kinematic constraints, in the order eval_jac_g writes them.
+  for (size_t i = 0; i < N - 1; i++) {
+    AddJac(L::x_row(i + 1), L::x(i + 1));
+    AddJac(L::x_row(i + 1), L::x(i));
+    AddJac(L::x_row(i + 1), L::psi(i));
+    AddJac(L::x_row(i + 1), L::v(i));
+
+    AddJac(L::y_row(i + 1), L::y(i + 1));
+    AddJac(L::y_row(i + 1), L::y(i));
+    AddJac(L::y_row(i + 1), L::psi(i));
+    AddJac(L::y_row(i + 1), L::v(i));
+
+    AddJac(L::psi_row(i + 1), L::psi(i + 1));
+    AddJac(L::psi_row(i + 1), L::psi(i));
+    AddJac(L::psi_row(i + 1), L::v(i));
+    AddJac(L::psi_row(i + 1), L::delta(i));
+
+    AddJac(L::v_row(i + 1), L::v(i + 1));
+    AddJac(L::v_row(i + 1), L::v(i));
+    AddJac(L::v_row(i + 1), L::a(i));
+
+    AddJac(L::cte_row(i + 1), L::cte(i + 1));
+    AddJac(L::cte_row(i + 1), L::x(i));
+    AddJac(L::cte_row(i + 1), L::y(i));
+    AddJac(L::cte_row(i + 1), L::v(i));
+    AddJac(L::cte_row(i + 1), L::epsi(i));
+
+    AddJac(L::epsi_row(i + 1), L::epsi(i + 1));
+    AddJac(L::epsi_row(i + 1), L::x(i));
+    AddJac(L::epsi_row(i + 1), L::psi(i));
+    AddJac(L::epsi_row(i + 1), L::v(i));
+    AddJac(L::epsi_row(i + 1), L::delta(i));
+  }
+  LinearJacobianStructure<N>(jac_row_, jac_col_);
+  ObstacleJacobianStructure<N>(jac_row_, jac_col_);
+
+  // Each Hessian entry is stored once; terms that land on the same entry
+  // share its position.
+  std::map<std::pair<size_t, size_t>, size_t> hes_index;
+  auto AddHes = [&](size_t row, size_t col) {
+    std::pair<size_t, size_t> key(row, col);
+    auto it = hes_index.find(key);
+    if (it != hes_index.end()) {
+      return it->second;
+    }
+    size_t k = hes_row_.size();
+    hes_row_.push_back(row);
+    hes_col_.push_back(col);
+    hes_index[key] = k;
+    return k;
+  };
+
+  // Cost Hessian
+  for (size_t i = 0; i < N; i++) {
+    h_cte_[i] = AddHes(L::cte(i), L::cte(i));
+    h_epsi_[i] = AddHes(L::epsi(i), L::epsi(i));
+    h_v_[i] = AddHes(L::v(i), L::v(i));
+  }
+  for (size_t i = 0; i < N - 1; i++) {
+    h_delta_[i] = AddHes(L::delta(i), L::delta(i));
+    h_a_[i] = AddHes(L::a(i), L::a(i));
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    h_ddelta_[i] = AddHes(L::delta(i + 1), L::delta(i));
+    h_da_[i] = AddHes(L::a(i + 1), L::a(i));
+  }
+  for (size_t i = 0; i < n_terminal; i++) {
+    for (size_t j = i; j < n_terminal; j++) {
+      size_t row, col;
+      TerminalHessianEntry<N>(i, j, row, col);
+      h_terminal_[TerminalEntry(i, j)] = AddHes(row, col);
+    }
+  }
+  // Constraint Hessians, lower triangle in the blocked layout.
+  for (size_t i = 0; i < N - 1; i++) {
+    h_psi_psi_[i] = AddHes(L::psi(i), L::psi(i));
+    h_v_psi_[i] = AddHes(L::v(i), L::psi(i));
+    h_delta_v_[i] = AddHes(L::delta(i), L::v(i));
+    h_x_x_[i] = AddHes(L::x(i), L::x(i));
+    h_epsi_v_[i] = AddHes(L::epsi(i), L::v(i));
+    h_epsi_epsi_[i] = AddHes(L::epsi(i), L::epsi(i));
+    h_v_v_[i] = AddHes(L::v(i), L::v(i));
+  }
+  std::vector<size_t> obstacle_row, obstacle_col;
+  ObstacleHessianStructure<N>(obstacle_row, obstacle_col);
+  for (size_t k = 0; k < obstacle_row.size(); k++) {
+    h_obstacle_[k] = AddHes(obstacle_row[k], obstacle_col[k]);
+  }
+}
+
+template <size_t N>
+Kernel_NLP<N>::~Kernel_NLP() {}
+
+template <size_t N>
+void Kernel_NLP<N>::AddFootprint(Footprint& footprint) const {
+  footprint.sparsity_bytes += VectorBytes(jac_row_) + VectorBytes(jac_col_) + VectorBytes(hes_row_) +
+                              VectorBytes(hes_col_);
+}
+
+template <size_t N>
+void Kernel_NLP<N>::AddJac(size_t row, size_t col) {
+  jac_row_.push_back(row);
+  jac_col_.push_back(col);
+}
+
+template <size_t N>
+bool Kernel_NLP<N>::get_nlp_info(Index& n, Index& m, Index& nnz_jac_g,
+                                 Index& nnz_h_lag, TNLP::IndexStyleEnum& index_style) {
+  n = L::nlp_vars;
+  m = L::nlp_constraints;
+  nnz_jac_g = jac_row_.size();
+  nnz_h_lag = hes_row_.size();
+  index_style = TNLP::C_STYLE;
+  return true;
+}
+
+template <size_t N>
+bool Kernel_NLP<N>::eval_f(Index n, const Number* x, bool new_x, Number& obj_value) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_f");
+  double cost = 0;
+  ForEachCostResidual<N, double>(x, this->params, [&cost](double w, double r, size_t, size_t) {
+    cost += w * r * r;
+  });
+  cost += TerminalCostValue<N, double>(x, this->params);
+  cost += SlackCost<N>(x, this->params[w_slack_idx]);
+  obj_value = cost;
+  return true;
+}
+
+template <size_t N>
+bool Kernel_NLP<N>::eval_grad_f(Index n, const Number* x, bool new_x, Number* grad_f) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_grad_f");
+  for (Index j = 0; j < n; j++) {
+    grad_f[j] = 0;
+  }
+  ForEachCostResidual<N, double>(x, this->params, [grad_f](double w, double r, size_t a, size_t b) {
+    grad_f[a] += 2 * w * r;
+    if (b != no_variable) {
+      grad_f[b] -= 2 * w * r;
+    }
+  });
+  AddTerminalGradient<N>(x, this->params, grad_f);
+  for (size_t i = L::cte_slack_start; i < L::nlp_vars; i++) {
+    grad_f[i] = this->params[w_slack_idx];
+  }
+  return true;
+}
+
+template <size_t N>
+bool Kernel_NLP<N>::eval_g(Index n, const Number* x, bool new_x, Index m, Number* g) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_g");
+  const double* c = &this->params[coeffs_start];
+  const double dt_growth = this->params[dt_growth_idx];
+  double dt = this->params[dt_idx];
+
+  g[L::x_row(0)] = x[L::x(0)];
+  g[L::y_row(0)] = x[L::y(0)];
+  g[L::psi_row(0)] = x[L::psi(0)];
+  g[L::v_row(0)] = x[L::v(0)];
+  g[L::cte_row(0)] = x[L::cte(0)];
+  g[L::epsi_row(0)] = x[L::epsi(0)];
+
+  const BicycleModel<> model = BicycleModel<>::FromParams(this->params);
+  for (size_t i = 0; i < N - 1; i++) {
+    double state[6];
+    double next[6];
+    for (size_t s = 0; s < 6; s++) {
+      state[s] = x[L::State(s, i)];
+    }
+    const double u[2] = { x[L::delta(i)], x[L::a(i)] };
+    model.Step(state, u, c, dt, next);
+    for (size_t s = 0; s < 6; s++) {
+      g[L::Row(s, i + 1)] = x[L::State(s, i + 1)] - next[s];
+    }
+    dt *= dt_growth;
+  }
+  LinearRows<N>(x, g, L::n_constraints);
+  ObstacleRows<N>(x, this->params, g);
+  return true;
+}
+
+template <size_t N>
+bool Kernel_NLP<N>::eval_jac_g(Index n, const Number* x, bool new_x, Index m,
+                               Index nele_jac, Index* iRow, Index* jCol,
+                               Number* values) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_jac_g");
+  if (values == NULL) {
+    for (Index k = 0; k < nele_jac; k++) {
+      iRow[k] = jac_row_[k];
+      jCol[k] = jac_col_[k];
+    }
+    return true;
+  }
+
+  const double* c = &this->params[coeffs_start];
+  const double dt_growth = this->params[dt_growth_idx];
+  const double understeer = this->params[understeer_idx];
+  double dt = this->params[dt_idx];
+  Number* J = values;
+  for (size_t s = 0; s < 6; s++) {
+    *J++ = 1;
+  }
+  for (size_t i = 0; i < N - 1; i++) {
+    double px = x[L::x(i)];
+    double psi = x[L::psi(i)];
+    double v = x[L::v(i)];
+    double epsi = x[L::epsi(i)];
+    double delta = x[L::delta(i)];
+
+    double cos_psi = cos(psi);
+    double sin_psi = sin(psi);
+    double cos_epsi = cos(epsi);
+    double sin_epsi = sin(epsi);
+    double f_x;
+    double df;
+    Polyval<3>(c, px, f_x, df);
+    double d2f = 2 * c[2] + 6 * c[3] * px;
+    double dpsi_des = d2f / (1 + df * df);
+    double g = YawGain(v, understeer, Lf);
+    double dg;
+    double d2g;
+    YawGainDerivatives(v, understeer, Lf, dg, d2g);
+
+    // x
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = v * sin_psi * dt;
+    *J++ = -cos_psi * dt;
+    // y
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = -v * cos_psi * dt;
+    *J++ = -sin_psi * dt;
+    // psi
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = -delta * dg * dt;
+    *J++ = -g * dt;
+    // v
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = -dt;
+    // cte
+    *J++ = 1;
+    *J++ = -df;
+    *J++ = 1;
+    *J++ = -sin_epsi * dt;
+    *J++ = -v * cos_epsi * dt;
+    // epsi
+    *J++ = 1;
+    *J++ = dpsi_des;
+    *J++ = -1;
+    *J++ = -delta * dg * dt;
+    *J++ = -g * dt;
+    dt *= dt_growth;
+  }
+  ObstacleJacobianValues<N>(x, this->params, LinearJacobianValues<N>(J));
+  return true;
+}
+
+template <size_t N>
+bool Kernel_NLP<N>::eval_h(Index n, const Number* x, bool new_x, Number obj_factor,
+                           Index m, const Number* lambda, bool new_lambda,
+                           Index nele_hess, Index* iRow, Index* jCol,
+                           Number* values) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_h");
+  if (values == NULL) {
+    for (Index k = 0; k < nele_hess; k++) {
+      iRow[k] = hes_row_[k];
+      jCol[k] = hes_col_[k];
+    }
+    return true;
+  }
+
+  for (Index k = 0; k < nele_hess; k++) {
+    values[k] = 0;
+  }
+
+  // The cost is a weighted sum of squares of affine residuals, so its
+  // Hessian is constant.
+  const Weights w = this->ParamWeights();
+  for (size_t i = 0; i < N; i++) {
+    values[h_cte_[i]] += obj_factor * 2 * w.cte;
+    values[h_epsi_[i]] += obj_factor * 2 * w.epsi;
+    values[h_v_[i]] += obj_factor * 2 * w.v;
+  }
+  for (size_t i = 0; i < N - 1; i++) {
+    // Each actuator enters one or two of the rate terms.
+    double rates = (i > 0 ? 1 : 0) + (i < N - 2 ? 1 : 0);
+    values[h_delta_[i]] += obj_factor * 2 * (w.delta + rates * w.ddelta);
+    values[h_a_[i]] += obj_factor * 2 * (w.a + rates * w.da);
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    values[h_ddelta_[i]] -= obj_factor * 2 * w.ddelta;
+    values[h_da_[i]] -= obj_factor * 2 * w.da;
+  }
+  for (size_t k = 0; k < h_terminal_.size(); k++) {
+    values[h_terminal_[k]] += obj_factor * 2 * this->params[terminal_start + k];
+  }
+
+  // Without the curvature of the constraints that is all (see
+  // CostResiduals.h).
+  if (this->gauss_newton) {
+    return true;
+  }
+
+  // Second derivatives of the kinematic constraints.
+  const double* c = &this->params[coeffs_start];
+  const double dt_growth = this->params[dt_growth_idx];
+  const double understeer = this->params[understeer_idx];
+  double dt = this->params[dt_idx];
+  for (size_t i = 0; i < N - 1; i++) {
+    double l_x = lambda[L::x_row(i + 1)];
+    double l_y = lambda[L::y_row(i + 1)];
+    double l_psi = lambda[L::psi_row(i + 1)];
+    double l_cte = lambda[L::cte_row(i + 1)];
+    double l_epsi = lambda[L::epsi_row(i + 1)];
+
+    double px = x[L::x(i)];
+    double psi = x[L::psi(i)];
+    double v = x[L::v(i)];
+    double epsi = x[L::epsi(i)];
+    double delta = x[L::delta(i)];
+
+    double cos_psi = cos(psi);
+    double sin_psi = sin(psi);
+    double dg;
+    double d2g;
+    YawGainDerivatives(v, understeer, Lf, dg, d2g);
+    double f_x;
+    double df;
+    Polyval<3>(c, px, f_x, df);
+    double d2f = 2 * c[2] + 6 * c[3] * px;
+    double d3f = 6 * c[3];
+    double q = 1 + df * df;
+    double d2psi_des = d3f / q - 2 * df * d2f * d2f / (q * q);
+
+    values[h_psi_psi_[i]] += (l_x * v * cos_psi + l_y * v * sin_psi) * dt;
+    values[h_v_psi_[i]] += (l_x * sin_psi - l_y * cos_psi) * dt;
+    values[h_delta_v_[i]] += -(l_psi + l_epsi) * dg * dt;
+    values[h_v_v_[i]] += -(l_psi + l_epsi) * delta * d2g * dt;
+    values[h_x_x_[i]] += -l_cte * d2f + l_epsi * d2psi_des;
+    values[h_epsi_v_[i]] += -l_cte * cos(epsi) * dt;
+    values[h_epsi_epsi_[i]] += l_cte * v * sin(epsi) * dt;
+    dt *= dt_growth;
+  }
+  ObstacleHessianValues<N>(lambda, h_obstacle_, values);
+  return true;
+}
+
+#define INSTANTIATE(N) template class Kernel_NLP<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -0,0 +1,70 @@
+#ifndef KERNEL_NLP_H
+#define KERNEL_NLP_H
+
+#include <array>
+#include <vector>
+#include "MPC_Problem.h"
+#include "TerminalCost.h"
+#include "Tuning.h"
+
+// Ipopt problem for FG_eval with the cost gradient, constraint Jacobian
+// and Lagrangian Hessian written out as straight-line kernels per stage.
+//
+// This is the same problem MPC_NLP records on a CppAD tape, but no tape is
+// interpreted at run time: each derivative entry is a closed-form
+// expression of the stage variables, and the Jacobian and Hessian
+// structures are fixed at construction. The constraints are those of
+// BicycleModel (Kinematics.h); the derivatives are written out for its
+// Euler step. The linear constraints (LinearConstraints.h) add only
+// constant Jacobian entries, the obstacle rows (ObstacleConstraints.h)
+// two entries of the Jacobian and of the Hessian per row.
+template <size_t N>
+class Kernel_NLP : public MPC_Problem<N> {
+ public:
+  typedef Layout<N> L;
+
+  Kernel_NLP();
+
+  virtual ~Kernel_NLP();
+
+  void AddFootprint(Footprint& footprint) const;
+
+  bool get_nlp_info(Ipopt::Index& n, Ipopt::Index& m, Ipopt::Index& nnz_jac_g,
+                    Ipopt::Index& nnz_h_lag, Ipopt::TNLP::IndexStyleEnum& index_style);
+
+  bool eval_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Number& obj_value);
+
+  bool eval_grad_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                   Ipopt::Number* grad_f);
+
+  bool eval_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Index m, Ipopt::Number* g);
+
+  bool eval_jac_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                  Ipopt::Index m, Ipopt::Index nele_jac, Ipopt::Index* iRow,
+                  Ipopt::Index* jCol, Ipopt::Number* values);
+
+  bool eval_h(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Number obj_factor, Ipopt::Index m, const Ipopt::Number* lambda,
+              bool new_lambda, Ipopt::Index nele_hess, Ipopt::Index* iRow,
+              Ipopt::Index* jCol, Ipopt::Number* values);
+
+ private:
+  // Jacobian structure, in the order eval_jac_g writes the values.
+  std::vector<Ipopt::Index> jac_row_, jac_col_;
+
+  // Hessian structure (lower triangle) and the position of each term.
+  std::vector<Ipopt::Index> hes_row_, hes_col_;
+  std::array<size_t, N> h_cte_, h_epsi_, h_v_;
+  std::array<size_t, N - 1> h_delta_, h_a_;
+  std::array<size_t, N - 2> h_ddelta_, h_da_;
+  std::array<size_t, n_terminal * (n_terminal + 1) / 2> h_terminal_;
+  std::array<size_t, N - 1> h_psi_psi_, h_v_psi_, h_delta_v_;
+  std::array<size_t, N - 1> h_x_x_, h_epsi_v_, h_epsi_epsi_, h_v_v_;
+  std::array<size_t, 2 * (N - 1)> h_obstacle_;
+
+  void AddJac(size_t row, size_t col);
+};
+
+#endif /* KERNEL_NLP_H */
@@ -0,0 +1,311 @@
+#ifndef KINEMATIC_MODEL_H
+#define KINEMATIC_MODEL_H
+
+#include <math.h>
+#include "Eigen-3.3/Eigen/Core"
+#ifdef MPC_EXACT_DISCRETIZATION
+#include "Eigen-3.3/unsupported/Eigen/MatrixFunctions"
+#endif
+#include "Horner.h"
+#include "Kinematics.h"
+#include "Layout.h"
+#include "SimdKernels.h"
+
+// The state [x, y, psi, v, cte, epsi] of the model, its pose [x, y, psi,
+// v] and its actuators [delta, a], in fixed-size storage.
+typedef Eigen::Matrix<double, 6, 1> StateVector;
+typedef Eigen::Matrix<double, 4, 1> PoseVector;
+typedef Eigen::Matrix<double, 2, 1> ActuatorVector;
+
+// With MPC_EXACT_DISCRETIZATION, the exponential of the last augmented
+// matrix M of a stage (see BasicKinematicModel::Linearize), which the
+// solvers keep for each of their stages so that a linearization point
+// that barely moved, each entry of M within discretization_tolerance,
+// reuses it instead of taking another.
+template <class Scalar>
+struct BasicDiscretization {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  Eigen::Matrix<Scalar, 6, 6> m;
+  Eigen::Matrix<Scalar, 6, 6> exp;
+  bool valid;
+
+  BasicDiscretization() : valid(false) {}
+};
+
+const double discretization_tolerance = 1e-6;
+
+// Discrete model of FG_eval (BicycleModel, Kinematics.h) over the time
+// grid of a horizon, with its Jacobians, for the hand-written solvers.
+//
+// The state is [x, y, psi, v, cte, epsi], the actuators [delta, a] and c
+// the coefficients of the reference polynomial. Stage k of a horizon
+// lasts dt growth^k; Step and Linearize take dt, Stage(k) the model of
+// one stage. Every solver takes it in double but the embedded build (see
+// Embedded.h), which takes it in float.
+//
+// With MPC_EXACT_DISCRETIZATION the Jacobians of the pose [x, y, psi, v]
+// are those of the exact flow over dt of the continuous model linearized
+// at (x, u), instead of those of its Euler or RK4 step: with Ac and Bc the
+// Jacobians of the pose derivative, exp([Ac Bc; 0 0] dt) holds them in
+// its top rows. They stay close to the step's at any dt in which the
+// linearization holds, so that long steps over few stages linearize as
+// well as short ones. The step itself, the constraint every backend
+// solves, is unchanged.
+template <class Scalar>
+struct BasicKinematicModel {
+  typedef Eigen::Matrix<Scalar, 6, 6> StateJacobian;
+  typedef Eigen::Matrix<Scalar, 6, 2> InputJacobian;
+  typedef Eigen::Matrix<Scalar, 6, 4> CoeffJacobian;
+  typedef Eigen::Matrix<Scalar, 4, 1> CoeffVector;
+  typedef BasicDiscretization<Scalar> Discretization;
+
+  Scalar dt;
+  Scalar Lf;
+  Scalar growth;
+  // Understeer of the yaw rate, see YawGain (Kinematics.h).
+  Scalar understeer;
+
+  BasicKinematicModel(Scalar dt, Scalar Lf, Scalar growth = 1, Scalar understeer = 0)
+      : dt(dt), Lf(Lf), growth(growth), understeer(understeer) {}
+
+  // Length of stage k, multiplied up as FG_eval does.
+  Scalar Dt(size_t k) const {
+    Scalar h = dt;
+    for (size_t i = 0; i < k; i++) {
+      h *= growth;
+    }
+    return h;
+  }
+
+  BasicKinematicModel Stage(size_t k) const { return BasicKinematicModel(Dt(k), Lf, 1, understeer); }
+
+  // The model of a single step, see Kinematics.h.
+  BicycleModel<Scalar> Bicycle() const { return BicycleModel<Scalar>(Lf, understeer); }
+
+  // x1 = f(x, u, c).
+  void Step(const Scalar* x, const Scalar* u, const CoeffVector& c, Scalar* x1) const {
+    Bicycle().Step(x, u, c, dt, x1);
+  }
+
+  // The same step in the coordinates of the reference path, c the
+  // curvature cubic of FrenetModel.
+  void FrenetStep(const Scalar* x, const Scalar* u, const CoeffVector& c, Scalar* x1) const {
+    FrenetModel<Scalar>(Lf, understeer).Step(x, u, c, dt, x1);
+  }
+
+  // Jacobians of f with respect to x, u and c. cache, which may be NULL,
+  // keeps the exponential of the stage with MPC_EXACT_DISCRETIZATION and is
+  // unused otherwise.
+  void Linearize(const Scalar* x, const Scalar* u, const CoeffVector& c, StateJacobian& A, InputJacobian& B,
+                 CoeffJacobian& E, Discretization* cache = NULL) const {
+    Scalar px = x[0];
+    Scalar psi = x[2];
+    Scalar v = x[3];
+    Scalar epsi = x[5];
+    Scalar delta = u[0];
+
+    Scalar f_x;
+    Scalar df;
+    Polyval<3>(c, px, f_x, df);
+    Scalar d2f = 2 * c[2] + 6 * c[3] * px;
+    Scalar datan = Scalar(1) / (1 + df * df);
+    Scalar d2g;
+
+    A.setZero();
+    B.setZero();
+    A(0, 0) = 1;
+    A(1, 1) = 1;
+#ifdef MPC_RK4
+    // The stages of KinematicIncrement: speed_i, linear in v and a, moves
+    // along heading_i = psi + arm_i delta YawGain(gain_speed_i), and the
+    // turn is the weighted sum of delta YawGain(speed_i).
+    Scalar a = u[1];
+    Scalar v_mid = v + Scalar(0.5) * a * dt;
+    const Scalar weight[4] = { 1, 2, 2, 1 };
+    const Scalar speed[4] = { v, v_mid, v_mid, v + a * dt };
+    const Scalar speed_a[4] = { 0, Scalar(0.5) * dt, Scalar(0.5) * dt, dt };
+    const Scalar arm[4] = { 0, Scalar(0.5) * dt, Scalar(0.5) * dt, dt };
+    const Scalar gain_speed[4] = { v, v, v_mid, v_mid };
+    const Scalar gain_speed_a[4] = { 0, 0, Scalar(0.5) * dt, Scalar(0.5) * dt };
+    Scalar turn_delta = 0;
+    Scalar turn_v = 0;
+    Scalar turn_a = 0;
+    for (int i = 0; i < 4; i++) {
+      Scalar w = weight[i] * dt / 6;
+      Scalar g = YawGain(gain_speed[i], understeer, Lf);
+      Scalar dg;
+      YawGainDerivatives(gain_speed[i], understeer, Lf, dg, d2g);
+      Scalar heading_v = arm[i] * delta * dg;
+      Scalar heading_a = heading_v * gain_speed_a[i];
+      Scalar heading_delta = arm[i] * g;
+      Scalar cos_i = cos(psi + arm[i] * delta * g);
+      Scalar sin_i = sin(psi + arm[i] * delta * g);
+      A(0, 2) -= w * speed[i] * sin_i;
+      A(0, 3) += w * (cos_i - speed[i] * sin_i * heading_v);
+      A(1, 2) += w * speed[i] * cos_i;
+      A(1, 3) += w * (sin_i + speed[i] * cos_i * heading_v);
+      B(0, 0) -= w * speed[i] * sin_i * heading_delta;
+      B(0, 1) += w * (speed_a[i] * cos_i - speed[i] * sin_i * heading_a);
+      B(1, 0) += w * speed[i] * cos_i * heading_delta;
+      B(1, 1) += w * (speed_a[i] * sin_i + speed[i] * cos_i * heading_a);
+
+      YawGainDerivatives(speed[i], understeer, Lf, dg, d2g);
+      turn_delta += w * YawGain(speed[i], understeer, Lf);
+      turn_v += w * delta * dg;
+      turn_a += w * delta * dg * speed_a[i];
+    }
+    // The distance travelled, and its derivative in a.
+    Scalar ds = v_mid * dt;
+    Scalar ds_a = Scalar(0.5) * dt * dt;
+#else
+    A(0, 2) = -v * sin(psi) * dt;
+    A(0, 3) = cos(psi) * dt;
+    A(1, 2) = v * cos(psi) * dt;
+    A(1, 3) = sin(psi) * dt;
+    Scalar ds = v * dt;
+    Scalar ds_a = 0;
+    Scalar dg;
+    YawGainDerivatives(v, understeer, Lf, dg, d2g);
+    Scalar turn_delta = YawGain(v, understeer, Lf) * dt;
+    Scalar turn_v = delta * dg * dt;
+    Scalar turn_a = 0;
+#endif
+    A(2, 2) = 1;
+    A(2, 3) = turn_v;
+    A(3, 3) = 1;
+    A(4, 0) = df;
+    A(4, 1) = -1;
+    A(4, 3) = sin(epsi) * dt;
+    A(4, 5) = ds * cos(epsi);
+    A(5, 0) = -d2f * datan;
+    A(5, 2) = 1;
+    A(5, 3) = turn_v;
+
+    B(2, 0) = turn_delta;
+    B(2, 1) = turn_a;
+    B(3, 1) = dt;
+    B(4, 1) = ds_a * sin(epsi);
+    B(5, 0) = turn_delta;
+    B(5, 1) = turn_a;
+#ifdef MPC_EXACT_DISCRETIZATION
+    Discretize(psi, v, delta, A, B, cache);
+#else
+    (void)cache;
+#endif
+
+    E.setZero();
+    E(4, 0) = 1;
+    E(4, 1) = px;
+    E(4, 2) = px * px;
+    E(4, 3) = px * px * px;
+    E(5, 1) = -datan;
+    E(5, 2) = -datan * 2 * px;
+    E(5, 3) = -datan * 3 * px * px;
+  }
+
+#ifdef MPC_EXACT_DISCRETIZATION
+  // The pose rows of A and B, and the turn in the rows of epsi, from the
+  // exponential of the augmented matrix at heading psi, speed v and
+  // steering delta.
+  void Discretize(Scalar psi, Scalar v, Scalar delta, StateJacobian& A, InputJacobian& B,
+                  Discretization* cache) const {
+    Scalar dg;
+    Scalar d2g;
+    YawGainDerivatives(v, understeer, Lf, dg, d2g);
+    Eigen::Matrix<Scalar, 6, 6> m;
+    m.setZero();
+    m(0, 2) = -v * sin(psi) * dt;
+    m(0, 3) = cos(psi) * dt;
+    m(1, 2) = v * cos(psi) * dt;
+    m(1, 3) = sin(psi) * dt;
+    m(2, 3) = delta * dg * dt;
+    m(2, 4) = YawGain(v, understeer, Lf) * dt;
+    m(3, 5) = dt;
+
+    Eigen::Matrix<Scalar, 6, 6> local;
+    Eigen::Matrix<Scalar, 6, 6>* flow = cache ? &cache->exp : &local;
+    if (!cache || !cache->valid || !((m - cache->m).cwiseAbs().maxCoeff() <= Scalar(discretization_tolerance))) {
+      *flow = m.exp();
+      if (cache) {
+        cache->m = m;
+        cache->valid = true;
+      }
+    }
+
+    A.template topLeftCorner<4, 4>() = flow->template topLeftCorner<4, 4>();
+    B.template topRows<4>() = flow->template topRightCorner<4, 2>();
+    // epsi turns as psi does.
+    A(5, 3) = A(2, 3);
+    B.row(5) = B.row(2);
+  }
+#endif
+};
+
+typedef BasicKinematicModel<double> KinematicModel;
+
+// The Jacobians of the first n stages of the horizon of model at the
+// states X, one per column, and the actuators U, [delta_0, a_0, ...], into
+// A[k], B[k] and E[k], as Stage(k).Linearize with caches[k] of each.
+template <class Scalar, class States>
+inline void LinearizeStages(const BasicKinematicModel<Scalar>& model, size_t n, const States& X, const Scalar* U,
+                            const typename BasicKinematicModel<Scalar>::CoeffVector& c,
+                            typename BasicKinematicModel<Scalar>::StateJacobian* A,
+                            typename BasicKinematicModel<Scalar>::InputJacobian* B,
+                            typename BasicKinematicModel<Scalar>::CoeffJacobian* E,
+                            typename BasicKinematicModel<Scalar>::Discretization* caches) {
+  for (size_t k = 0; k < n; k++) {
+    model.Stage(k).Linearize(X.col(k).data(), U + 2 * k, c, A[k], B[k], E[k], caches + k);
+  }
+}
+
+#if !defined(MPC_RK4) && !defined(MPC_EXACT_DISCRETIZATION) && !defined(MPC_EMBEDDED)
+// In double with the Euler step, every stage in one pass of the
+// linearize_stages kernel (SimdKernels.h) instead: the stages are lanes,
+// and the matrices are written in place.
+template <class States>
+inline void LinearizeStages(const KinematicModel& model, size_t n, const States& X, const double* U,
+                            const KinematicModel::CoeffVector& c, KinematicModel::StateJacobian* A,
+                            KinematicModel::InputJacobian* B, KinematicModel::CoeffJacobian* E,
+                            KinematicModel::Discretization*) {
+  static_assert(sizeof(KinematicModel::StateJacobian) == 36 * sizeof(double) &&
+                    sizeof(KinematicModel::InputJacobian) == 12 * sizeof(double) &&
+                    sizeof(KinematicModel::CoeffJacobian) == 24 * sizeof(double),
+                "The Jacobians must be packed for the kernel");
+  double dt[max_horizon];
+  double x[max_horizon];
+  double psi[max_horizon];
+  double v[max_horizon];
+  double epsi[max_horizon];
+  double delta[max_horizon];
+  double h = model.dt;
+  for (size_t k = 0; k < n; k++) {
+    dt[k] = h;
+    h *= model.growth;
+    x[k] = X(0, k);
+    psi[k] = X(2, k);
+    v[k] = X(3, k);
+    epsi[k] = X(5, k);
+    delta[k] = U[2 * k];
+  }
+  StageLinearization stages;
+  stages.n = n;
+  stages.Lf = model.Lf;
+  stages.understeer = model.understeer;
+  for (int i = 0; i < 4; i++) {
+    stages.c[i] = c[i];
+  }
+  stages.dt = dt;
+  stages.x = x;
+  stages.psi = psi;
+  stages.v = v;
+  stages.epsi = epsi;
+  stages.delta = delta;
+  stages.A = A[0].data();
+  stages.B = B[0].data();
+  stages.E = E[0].data();
+  CpuKernels().linearize_stages(stages);
+}
+#endif
+
+#endif /* KINEMATIC_MODEL_H */
@@ -0,0 +1,197 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <stddef.h>
+#include <cmath>
+#include "Horner.h"
+#include "Layout.h"
+
+// The step of the kinematic bicycle model, shared by FG_eval (on
+// CppAD::AD<double>), KinematicModel and MPC::Predict (on double).
+//
+// The actuators are held over the step. By default the step is explicit
+// Euler. With MPC_RK4 it is the classical Runge-Kutta method, four
+// headings per step for a local error of order dt^5 instead of dt^2, so
+// that longer steps and fewer stages predict as well; it is exact for the
+// speed, and for the heading of the kinematic model, a line and a
+// parabola in time.
+
+// Yaw rate per unit of steering at speed v. The kinematic model turns at
+// v delta / Lf; understeer > 0 (in s^2/m^2) is the steady state of the
+// dynamic bicycle model with linear tires, whose yaw rate
+// v delta / (L + K_us v^2) falls behind it as the tires slip more with
+// speed: understeer = K_us / Lf, with the understeer gradient
+// K_us = m (lr / Cf - lf / Cr) / L of the mass, the distances of the
+// axles from the centre of gravity and their cornering stiffnesses. The
+// gain halves at the characteristic speed 1 / sqrt(understeer).
+//
+// The constants are taken as T throughout, so that a float model (see
+// Embedded.h) computes in float alone.
+template <class T>
+inline T YawGain(const T& v, const T& understeer, double Lf) {
+  return v / (T(Lf) * (T(1) + understeer * v * v));
+}
+
+// First and second derivatives of YawGain in v.
+template <class T>
+inline void YawGainDerivatives(T v, T understeer, double Lf, T& d1, T& d2) {
+  T q = 1 + understeer * v * v;
+  d1 = (1 - understeer * v * v) / (T(Lf) * q * q);
+  d2 = -2 * understeer * v * (3 - understeer * v * v) / (T(Lf) * q * q * q);
+}
+
+// Increments of the pose (x, y, psi, v) over dt with steering delta and
+// acceleration a. ds is the distance travelled and turn the change of
+// heading.
+template <class T>
+inline void KinematicIncrement(const T& psi, const T& v, const T& delta, const T& a, const T& dt,
+                               double Lf, const T& understeer, T& dx, T& dy, T& ds, T& turn) {
+  using std::cos;
+  using std::sin;
+#ifdef MPC_RK4
+  // The speeds and headings of the four stages: at the start, twice at the
+  // midpoint and at the end.
+  T v_mid = v + T(0.5) * a * dt;
+  T v_end = v + a * dt;
+  T rate = delta * YawGain(v, understeer, Lf);
+  T rate_mid = delta * YawGain(v_mid, understeer, Lf);
+  T rate_end = delta * YawGain(v_end, understeer, Lf);
+  T psi_2 = psi + T(0.5) * dt * rate;
+  T psi_3 = psi + T(0.5) * dt * rate_mid;
+  T psi_4 = psi + dt * rate_mid;
+  T w = dt * T(1.0 / 6);
+  dx = w * (v * cos(psi) + T(2) * v_mid * (cos(psi_2) + cos(psi_3)) + v_end * cos(psi_4));
+  dy = w * (v * sin(psi) + T(2) * v_mid * (sin(psi_2) + sin(psi_3)) + v_end * sin(psi_4));
+  ds = v_mid * dt;
+  turn = w * (rate + T(4) * rate_mid + rate_end);
+#else
+  (void)a;
+  ds = v * dt;
+  turn = dt * delta * YawGain(v, understeer, Lf);
+  dx = ds * cos(psi);
+  dy = ds * sin(psi);
+#endif
+}
+
+// x1 = f(x, u) of the state [x, y, psi, v, cte, epsi] and the actuators
+// [delta, a], with f_x and df_x the reference polynomial and its slope at
+// x[0]. cte and epsi are taken from the old pose, as the errors the step
+// starts from plus what the step adds to them.
+template <class T>
+inline void KinematicStep(const T* x, const T* u, const T& f_x, const T& df_x, const T& dt, double Lf,
+                          const T& understeer, T* x1) {
+  using std::atan;
+  using std::sin;
+  T dx;
+  T dy;
+  T ds;
+  T turn;
+  KinematicIncrement(x[2], x[3], u[0], u[1], dt, Lf, understeer, dx, dy, ds, turn);
+  x1[0] = x[0] + dx;
+  x1[1] = x[1] + dy;
+  x1[2] = x[2] + turn;
+  x1[3] = x[3] + u[1] * dt;
+  x1[4] = (f_x - x[1]) + ds * sin(x[5]);
+  x1[5] = (x[2] - atan(df_x)) + turn;
+}
+
+// The model of the vehicle, as everything that predicts with it takes it:
+// a class with
+//
+//   n_states, n_inputs and n_pose, the sizes of the state, the actuators
+//   and the leading part of the state that evolves without a reference;
+//   Step(x, u, c, dt, x1), x1 = f(x, u) over dt for the reference
+//   polynomial c;
+//   Advance(pose, u, dt, pose1), the same for the pose alone;
+//   FromParams(params), the model of the dynamic parameters of a problem;
+//
+// with Step and Advance templates on the scalar type, which FG_eval
+// records on CppAD::AD<double>, and the parameters of the model of a type
+// P that converts to it. The consumers take the model as a template
+// parameter, so the step inlines into every one of them and nothing is
+// dispatched at run time.
+template <class P = double>
+struct BicycleModel {
+  enum : size_t { n_states = 6, n_inputs = 2, n_pose = 4 };
+
+  double Lf;
+  // See YawGain.
+  P understeer;
+
+  BicycleModel(double Lf, const P& understeer) : Lf(Lf), understeer(understeer) {}
+
+  // The model of the dynamic parameters of a problem (Layout.h).
+  template <class V>
+  static BicycleModel FromParams(const V& params) {
+    return BicycleModel(::Lf, params[understeer_idx]);
+  }
+
+  // State [x, y, psi, v, cte, epsi], actuators [delta, a].
+  template <class T, class C>
+  void Step(const T* x, const T* u, const C& c, const T& dt, T* x1) const {
+    T f_x;
+    T df_x;
+    Polyval<3>(c, x[0], f_x, df_x);
+    KinematicStep(x, u, f_x, df_x, dt, Lf, T(understeer), x1);
+  }
+
+  // Pose [x, y, psi, v].
+  template <class T>
+  void Advance(const T* pose, const T* u, const T& dt, T* pose1) const {
+    T dx;
+    T dy;
+    T ds;
+    T turn;
+    KinematicIncrement(pose[2], pose[3], u[0], u[1], dt, Lf, T(understeer), dx, dy, ds, turn);
+    pose1[0] = pose[0] + dx;
+    pose1[1] = pose[1] + dy;
+    pose1[2] = pose[2] + turn;
+    pose1[3] = pose[3] + u[1] * dt;
+  }
+};
+
+// The same bicycle in the coordinates of a reference path (see
+// MPC::SetFrenet): the state is [s, n, mu, v, cte, epsi], the arc length
+// along the path from where the vehicle is on it, the offset to the left
+// of the path, the heading relative to the path and the speed, and the
+// errors the cost takes, cte = -n and epsi = mu as BicycleModel has them.
+// c is the curvature of the path as a cubic in s. The step moves the pose
+// by the increments of KinematicIncrement along the tangent of the path
+// at s, and turns the heading back by the curvature over the arc length
+// it covers. Without a cubic of the reference or its atan, the model is
+// near linear over the whole horizon, wherever the path curves.
+//
+// There is no Advance: the pose does not evolve without the path.
+template <class P = double>
+struct FrenetModel {
+  enum : size_t { n_states = 6, n_inputs = 2, n_pose = 4 };
+
+  double Lf;
+  P understeer;
+
+  FrenetModel(double Lf, const P& understeer) : Lf(Lf), understeer(understeer) {}
+
+  template <class V>
+  static FrenetModel FromParams(const V& params) {
+    return FrenetModel(::Lf, params[understeer_idx]);
+  }
+
+  template <class T, class C>
+  void Step(const T* x, const T* u, const C& c, const T& dt, T* x1) const {
+    T dx;
+    T dy;
+    T ds;
+    T turn;
+    KinematicIncrement(x[2], x[3], u[0], u[1], dt, Lf, T(understeer), dx, dy, ds, turn);
+    T kappa = Polyval<3>(c, x[0]);
+    T along = dx / (T(1) - kappa * x[1]);
+    x1[0] = x[0] + along;
+    x1[1] = x[1] + dy;
+    x1[2] = x[2] + turn - kappa * along;
+    x1[3] = x[3] + u[1] * dt;
+    x1[4] = -x1[1];
+    x1[5] = x1[2];
+  }
+};
+
+#endif /* KINEMATICS_H */
@@ -0,0 +1,35 @@
+#ifndef LATENCY_ESTIMATE_H
+#define LATENCY_ESTIMATE_H
+
+#include <atomic>
+
+// Exponentially weighted moving average of the time from the arrival of
+// a telemetry frame to the actuation of its command.
+//
+// Samples are added on the event loop when a command is released and the
+// estimate is read on the solver thread, so it is kept in an atomic; a
+// reader sees either the previous or the new estimate.
+class LatencyEstimate {
+ public:
+  // initial is used until the first sample, alpha is the weight of a new
+  // sample.
+  LatencyEstimate(double initial, double alpha) : alpha_(alpha), estimate_(initial) {}
+
+  // Add a measured latency, in seconds.
+  void Add(double seconds) {
+    double old = estimate_.load(std::memory_order_relaxed);
+    estimate_.store(old + alpha_ * (seconds - old), std::memory_order_relaxed);
+  }
+
+  // Drop all samples and start over from initial.
+  void Reset(double initial) { estimate_.store(initial, std::memory_order_relaxed); }
+
+  // Current estimate, in seconds.
+  double Seconds() const { return estimate_.load(std::memory_order_relaxed); }
+
+ private:
+  double alpha_;
+  std::atomic<double> estimate_;
+};
+
+#endif /* LATENCY_ESTIMATE_H */
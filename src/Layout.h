@@ -0,0 +1,174 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stddef.h>
+
+// This is the length from front to CoG that has a similar radius.
+const double Lf = 2.67;
+// Default time step of the horizon; MPC::SetTimestep changes it.
+const double default_dt = 0.1;
+// Obstacle slots of the Ipopt problems (see ObstacleConstraints.h): the
+// most obstacles one solve keeps clear of, whatever the scene holds.
+const size_t max_obstacles = 4;
+// Longest horizon compiled (see MPC_FOR_EACH_HORIZON and
+// MPC_FOR_EACH_SCALING_HORIZON), the length of the per-stage parameters.
+#if defined(MPC_SCALING_HORIZONS) && !defined(MPC_EMBEDDED)
+const size_t max_horizon = 200;
+#else
+const size_t max_horizon = 16;
+#endif
+
+// With MPC_INTERLEAVED the model variables are laid out stage by stage,
+// [x, y, psi, v, cte, epsi, delta, a] for every stage and the six states
+// alone for the last, and the model constraints likewise, six rows per
+// stage. Each stage's variables then share cache lines, and the
+// constraint Jacobian and the Hessian of the Lagrangian are banded, of
+// bandwidth about two stages, for the linear solver. Without it they are
+// blocked by variable, every block N (or N - 1) long.
+#ifdef MPC_INTERLEAVED
+const bool interleaved_layout = true;
+#else
+const bool interleaved_layout = false;
+#endif
+
+// Variable layout of a horizon of N states. Every offset and size is a
+// compile-time constant, so the loops over the horizon can be unrolled
+// and the problem storage can be fixed-size. The model variables and
+// constraints are reached through State, Input and Row and their named
+// forms, which follow interleaved_layout; the slacks and the soft rows
+// come after them either way.
+template <size_t N_>
+struct Layout {
+  // The cost has rate terms between consecutive actuations.
+  static_assert(N_ >= 3, "the horizon needs at least two actuations");
+  static_assert(N_ <= max_horizon, "the per-stage parameters hold max_horizon stages");
+
+  enum : size_t {
+    N = N_,
+    n_states = 6,
+    n_actuators = 2,
+
+    // Variables of a stage but the last.
+    stage_vars = n_states + n_actuators,
+
+    // Number of model variables (includes both states and inputs)
+    // and number of constraints.
+    n_vars = N * n_states + (N - 1) * n_actuators,
+    n_constraints = N * n_states,
+    // Number of actuator variables.
+    n_inputs = (N - 1) * n_actuators,
+
+    // The Ipopt problems add the slacks of their soft constraints (see
+    // LinearConstraints.h) after the model variables, one for the track
+    // boundary at every state and one for the steering rate limit between
+    // every two actuations, and two rows for each after the model
+    // constraints, the upper and the lower side of the constraint. The
+    // rows of the hard rate limits of delta and a follow, one per rate.
+    // Last come the obstacle slots (ObstacleConstraints.h), a slack and a
+    // row at every state after the first, slot by slot.
+    n_obstacle_rows = max_obstacles * (N - 1),
+    cte_slack_start = n_vars,
+    ddelta_slack_start = cte_slack_start + N,
+    obstacle_slack_start = ddelta_slack_start + N - 2,
+    n_slacks = N + N - 2 + n_obstacle_rows,
+    nlp_vars = n_vars + n_slacks,
+    cte_soft_start = n_constraints,
+    ddelta_soft_start = cte_soft_start + 2 * N,
+    ddelta_rate_start = ddelta_soft_start + 2 * (N - 2),
+    da_rate_start = ddelta_rate_start + N - 2,
+    obstacle_start = da_rate_start + N - 2,
+    nlp_constraints = obstacle_start + n_obstacle_rows
+  };
+
+  // Index of state s of stage i < N, in the order x, y, psi, v, cte,
+  // epsi, and of actuator k of stage i < N - 1, delta then a.
+  static constexpr size_t State(size_t s, size_t i) { return interleaved_layout ? i * stage_vars + s : s * N + i; }
+  static constexpr size_t Input(size_t k, size_t i) {
+    return interleaved_layout ? i * stage_vars + n_states + k : N * n_states + k * (N - 1) + i;
+  }
+  // Row of the model constraint of state s of stage i: the initial state
+  // for i = 0, the step from stage i - 1 after.
+  static constexpr size_t Row(size_t s, size_t i) { return interleaved_layout ? i * n_states + s : s * N + i; }
+  // Whether row is one of the six initial state rows.
+  static constexpr bool InitialRow(size_t row) {
+    return row < n_constraints && (interleaved_layout ? row < n_states : row % N == 0);
+  }
+
+  static constexpr size_t x(size_t i) { return State(0, i); }
+  static constexpr size_t y(size_t i) { return State(1, i); }
+  static constexpr size_t psi(size_t i) { return State(2, i); }
+  static constexpr size_t v(size_t i) { return State(3, i); }
+  static constexpr size_t cte(size_t i) { return State(4, i); }
+  static constexpr size_t epsi(size_t i) { return State(5, i); }
+  static constexpr size_t delta(size_t i) { return Input(0, i); }
+  static constexpr size_t a(size_t i) { return Input(1, i); }
+
+  static constexpr size_t x_row(size_t i) { return Row(0, i); }
+  static constexpr size_t y_row(size_t i) { return Row(1, i); }
+  static constexpr size_t psi_row(size_t i) { return Row(2, i); }
+  static constexpr size_t v_row(size_t i) { return Row(3, i); }
+  static constexpr size_t cte_row(size_t i) { return Row(4, i); }
+  static constexpr size_t epsi_row(size_t i) { return Row(5, i); }
+};
+
+// Layout of the dynamic parameters of the problem.
+// These change every frame, or for the weights and the time step whenever
+// they are tuned, but never alter the problem structure.
+const size_t coeffs_start = 0;
+// The reference cte, epsi and speed of every stage, max_horizon of each;
+// stages past the horizon are unused.
+const size_t ref_cte_start = coeffs_start + 4;
+const size_t ref_epsi_start = ref_cte_start + max_horizon;
+const size_t ref_v_start = ref_epsi_start + max_horizon;
+// The cost weights, in the order of Weights (Tuning.h).
+const size_t w_cte_idx = ref_v_start + max_horizon;
+const size_t w_epsi_idx = w_cte_idx + 1;
+const size_t w_v_idx = w_epsi_idx + 1;
+const size_t w_delta_idx = w_v_idx + 1;
+const size_t w_a_idx = w_delta_idx + 1;
+const size_t w_ddelta_idx = w_a_idx + 1;
+const size_t w_da_idx = w_ddelta_idx + 1;
+// Time step of the first stage and the factor by which every later stage
+// is longer than the one before, 1 for a uniform grid.
+const size_t dt_idx = w_da_idx + 1;
+const size_t dt_growth_idx = dt_idx + 1;
+// Understeer of the model, 0 for the kinematic one (see YawGain,
+// Kinematics.h).
+const size_t understeer_idx = dt_growth_idx + 1;
+// Cost of a unit of slack of the soft constraints.
+const size_t w_slack_idx = understeer_idx + 1;
+// Centre of every obstacle slot in the vehicle frame, x then y.
+const size_t obstacles_start = w_slack_idx + 1;
+// Upper triangle of the terminal cost matrix, row by row (see
+// TerminalCost.h); all zero for none.
+const size_t terminal_start = obstacles_start + 2 * max_obstacles;
+const size_t n_params = terminal_start + 15;
+
+// Horizon lengths the controller is instantiated for. Using timeseries
+// rule of: 2N+1, subtracting the first state due to the initial forward
+// prediction, gives the default of 11. They are listed in increasing
+// order.
+#define MPC_FOR_EACH_HORIZON(X) X(7) X(11) X(16)
+
+// With MPC_SCALING_HORIZONS (cmake -DMPC_SCALING=ON) the MPC and its
+// backends are also instantiated for these, up to 200 stages, for
+// mpc_scaling to sweep; the controller still switches between the
+// horizons above alone, and the embedded core keeps to them.
+#if defined(MPC_SCALING_HORIZONS) && !defined(MPC_EMBEDDED)
+#define MPC_FOR_EACH_SCALING_HORIZON(X) X(5) X(25) X(50) X(100) X(200)
+#else
+#define MPC_FOR_EACH_SCALING_HORIZON(X)
+#endif
+
+// Stages of the coarse problem that starts the cold solves of the Ipopt
+// backends with MPC::SetCoarseStart, over the time of the whole horizon;
+// the Riccati backend is instantiated for it too.
+const size_t coarse_horizon = 4;
+
+// The same horizons as an array.
+#define MPC_HORIZON_VALUE(N) N,
+const size_t mpc_horizons[] = { MPC_FOR_EACH_HORIZON(MPC_HORIZON_VALUE) };
+#undef MPC_HORIZON_VALUE
+const size_t n_horizons = sizeof(mpc_horizons) / sizeof(mpc_horizons[0]);
+
+#endif /* LAYOUT_H */
@@ -0,0 +1,143 @@
+#ifndef LINEAR_CONSTRAINTS_H
+#define LINEAR_CONSTRAINTS_H
+
+#include <stddef.h>
+#include <vector>
+#include "Layout.h"
+
+// The linear constraints of the Ipopt problems, the rows after the model
+// constraints (see Layout for their place). Their Jacobian is constant and
+// their Hessian zero, so the problems write them out directly instead of
+// taking their derivatives, and declare them linear to Ipopt.
+//
+// Soft constraints: the track boundary |cte| <= boundary at every state
+// and the steering rate limit |delta_{i+1} - delta_i| <= max_ddelta
+// between consecutive actuations, each relaxed by a slack s >= 0 that the
+// cost penalizes by weight * s.
+//
+// A constraint c(x) <= b becomes the two linear rows c - s <= b and c + s
+// >= -b, so the problem stays feasible from any initial state and Ipopt
+// never spends its time looking for a feasible point. The penalty is
+// exact: with a weight larger than the multiplier of the hard constraint
+// the slack is zero whenever the hard problem is feasible, and the
+// solution the same.
+//
+// A bound of 0 leaves its constraint out: the rows are unbounded and the
+// slacks fixed at 0, which Ipopt takes out of the problem.
+struct SoftConstraints {
+  // Largest |cte| in metres and |delta_{i+1} - delta_i| in radians, 0 for
+  // none.
+  double boundary;
+  double max_ddelta;
+  // Cost of a unit of slack.
+  double weight;
+
+  SoftConstraints() : boundary(0), max_ddelta(0), weight(1000) {}
+};
+
+// Hard rate limits: the rows delta_{i+1} - delta_i and a_{i+1} - a_i,
+// bounded by -ddelta..ddelta and -da..da. Unlike the rate terms of the
+// cost they bound every change without stiffening the problem, and with
+// them the rate weights can be lowered. 0 leaves a limit out.
+struct RateLimits {
+  double ddelta;
+  double da;
+
+  RateLimits() : ddelta(0), da(0) {}
+};
+
+// Rows of the linear constraints, row r at g[offset + r - L::n_constraints].
+// V and G are anything indexable, on double or on CppAD::AD<double>.
+template <size_t N, class V, class G>
+inline void LinearRows(const V& vars, G& g, size_t offset) {
+  typedef Layout<N> L;
+  for (size_t i = 0; i < N; i++) {
+    size_t row = offset + L::cte_soft_start + 2 * i - L::n_constraints;
+    g[row] = vars[L::cte(i)] - vars[L::cte_slack_start + i];
+    g[row + 1] = vars[L::cte(i)] + vars[L::cte_slack_start + i];
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    size_t row = offset + L::ddelta_soft_start + 2 * i - L::n_constraints;
+    g[row] = (vars[L::delta(i + 1)] - vars[L::delta(i)]) - vars[L::ddelta_slack_start + i];
+    g[row + 1] = (vars[L::delta(i + 1)] - vars[L::delta(i)]) + vars[L::ddelta_slack_start + i];
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    g[offset + L::ddelta_rate_start + i - L::n_constraints] =
+        vars[L::delta(i + 1)] - vars[L::delta(i)];
+    g[offset + L::da_rate_start + i - L::n_constraints] = vars[L::a(i + 1)] - vars[L::a(i)];
+  }
+}
+
+// The penalty weight * sum of the slacks.
+template <size_t N, class V, class T>
+inline T SlackCost(const V& vars, const T& weight) {
+  typedef Layout<N> L;
+  T sum = vars[L::cte_slack_start];
+  for (size_t i = L::cte_slack_start + 1; i < L::nlp_vars; i++) {
+    sum += vars[i];
+  }
+  return weight * sum;
+}
+
+// Jacobian structure of the linear rows, appended in the order
+// LinearJacobianValues writes the values.
+template <size_t N, class Index>
+inline void LinearJacobianStructure(std::vector<Index>& rows, std::vector<Index>& cols) {
+  typedef Layout<N> L;
+  for (size_t i = 0; i < N; i++) {
+    for (size_t side = 0; side < 2; side++) {
+      rows.push_back(L::cte_soft_start + 2 * i + side);
+      cols.push_back(L::cte(i));
+      rows.push_back(L::cte_soft_start + 2 * i + side);
+      cols.push_back(L::cte_slack_start + i);
+    }
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    for (size_t side = 0; side < 2; side++) {
+      rows.push_back(L::ddelta_soft_start + 2 * i + side);
+      cols.push_back(L::delta(i + 1));
+      rows.push_back(L::ddelta_soft_start + 2 * i + side);
+      cols.push_back(L::delta(i));
+      rows.push_back(L::ddelta_soft_start + 2 * i + side);
+      cols.push_back(L::ddelta_slack_start + i);
+    }
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    rows.push_back(L::ddelta_rate_start + i);
+    cols.push_back(L::delta(i + 1));
+    rows.push_back(L::ddelta_rate_start + i);
+    cols.push_back(L::delta(i));
+    rows.push_back(L::da_rate_start + i);
+    cols.push_back(L::a(i + 1));
+    rows.push_back(L::da_rate_start + i);
+    cols.push_back(L::a(i));
+  }
+}
+
+// The constant values of that structure; returns the end of them.
+template <size_t N, class Number>
+inline Number* LinearJacobianValues(Number* J) {
+  for (size_t i = 0; i < N; i++) {
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = 1;
+    *J++ = 1;
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = -1;
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = 1;
+  }
+  for (size_t i = 0; i < N - 2; i++) {
+    *J++ = 1;
+    *J++ = -1;
+    *J++ = 1;
+    *J++ = -1;
+  }
+  return J;
+}
+
+#endif /* LINEAR_CONSTRAINTS_H */
@@ -0,0 +1,44 @@
+#include "LoadShedding.h"
+
+// Average slack, as a fraction of the budget, below which a level is shed
+// and above which one is restored.
+static const double shed_slack = 0.2;
+static const double restore_slack = 0.5;
+
+// Frames a level is held before the next is shed, unless a frame overruns,
+// and before one is restored.
+static const size_t shed_hold = 5;
+static const size_t restore_hold = 100;
+
+// Weight of a new frame's slack.
+static const double slack_alpha = 0.2;
+
+const char* ShedLevelName(ShedLevel level) {
+  static const char* names[n_shed_levels] = { "none", "viz", "logging", "multi-start", "iterations", "backend" };
+  return names[int(level)];
+}
+
+LoadGovernor::LoadGovernor(double budget) : budget_(budget) {
+  Reset();
+}
+
+void LoadGovernor::Reset() {
+  slack_ = 1;
+  level_ = ShedLevel::None;
+  held_ = 0;
+}
+
+ShedLevel LoadGovernor::Update(double elapsed) {
+  double slack = 1 - elapsed / budget_;
+  slack_ += slack_alpha * (slack - slack_);
+  held_++;
+  bool overrun = slack < 0;
+  if (level_ != ShedLevel::Backend && (overrun || (slack_ < shed_slack && held_ >= shed_hold))) {
+    level_ = ShedLevel(int(level_) + 1);
+    held_ = 0;
+  } else if (level_ != ShedLevel::None && slack_ > restore_slack && held_ >= restore_hold) {
+    level_ = ShedLevel(int(level_) - 1);
+    held_ = 0;
+  }
+  return level_;
+}
@@ -0,0 +1,67 @@
+#ifndef LOAD_SHEDDING_H
+#define LOAD_SHEDDING_H
+
+#include <stddef.h>
+
+// Optional work that a controller gives up, one step at a time and in
+// this order, as its frames run out of slack (see LoadGovernor), and that
+// it takes back in the reverse order as the slack returns. Every step
+// keeps those before it: a level sheds itself and all the ones below.
+enum class ShedLevel {
+  None,
+  // The predicted trajectory and the reference line of the replies, as
+  // between the frames of ControllerOptions::viz_interval_ms.
+  Viz,
+  // Debug and Info messages, process-wide while any controller sheds
+  // them (see ShedLogging, Logger.h).
+  Logging,
+  // The extra starts of the Ipopt backends (see MPC::SetSingleStart).
+  MultiStart,
+  // Iterations of the Ipopt backends beyond a lower cap (see
+  // MPC::SetIterationCap).
+  Iterations,
+  // The backend itself, for a cheaper one.
+  Backend
+};
+const int n_shed_levels = 6;
+
+// The label of a level in the log, e.g. "viz".
+const char* ShedLevelName(ShedLevel level);
+
+// Run-time choice of the load shedding of a controller from the slack of
+// its frames: the fraction of the budget left between the end of the
+// solve and the budget after the frame's arrival. Its moving average
+// drives the level, like the solve times the adaptive horizon (see
+// AdaptiveHorizon.h): below a fifth of the budget the level steps up, at
+// once and then every few frames while it stays below, so that each step
+// shows in the slack before the next. Above half of the budget, and only
+// after a level has been held for many frames, it steps back down, since
+// the steps at the top start solvers over and changing back and forth
+// would cost more than it saves. A frame over the budget steps up at
+// once.
+class LoadGovernor {
+ public:
+  // Keep frames within budget seconds of their arrival.
+  explicit LoadGovernor(double budget);
+
+  // Feed back the time from a frame's arrival to the end of its solve, in
+  // seconds, and return the level for the next frame.
+  ShedLevel Update(double elapsed);
+
+  ShedLevel Level() const { return level_; }
+
+  // Average slack of the frames, as a fraction of the budget.
+  double Slack() const { return slack_; }
+
+  // Shed nothing and forget the slack.
+  void Reset();
+
+ private:
+  double budget_;
+  double slack_;
+  ShedLevel level_;
+  // Frames since the last change of level.
+  size_t held_;
+};
+
+#endif /* LOAD_SHEDDING_H */
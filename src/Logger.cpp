@@ -0,0 +1,145 @@
+#include "Logger.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+const size_t ring_size = 1024;  // power of two
+const size_t message_size = 240;
+
+struct Slot {
+  // Sequence number of the bounded MPMC queue: equal to the position
+  // when the slot is free for that position, position + 1 once written.
+  atomic<size_t> seq;
+  LogLevel level;
+  char text[message_size];
+};
+
+class Logger {
+ public:
+  Logger()
+      : level_(int(LogLevel::Info)), shedding_(0), head_(0), tail_(0), written_(0), dropped_(0), stop_(false) {
+    for (size_t i = 0; i < ring_size; i++) {
+      ring_[i].seq.store(i, memory_order_relaxed);
+    }
+    thread_ = thread(&Logger::Run, this);
+  }
+
+  ~Logger() {
+    stop_ = true;
+    thread_.join();
+  }
+
+  void SetLevel(LogLevel level) { level_ = int(level); }
+
+  void Shed(bool shed) { shedding_.fetch_add(shed ? 1 : -1, memory_order_relaxed); }
+
+  bool Enabled(LogLevel level) const {
+    return int(level) >= level_.load(memory_order_relaxed) &&
+           (level >= LogLevel::Warning || shedding_.load(memory_order_relaxed) == 0);
+  }
+
+  void Write(LogLevel level, const char* format, va_list args) {
+    size_t pos = head_.load(memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &ring_[pos & (ring_size - 1)];
+      size_t seq = slot->seq.load(memory_order_acquire);
+      if (seq == pos) {
+        if (head_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+          break;
+        }
+      } else if (seq < pos) {
+        // Full: the writer is behind by a whole ring.
+        dropped_.fetch_add(1, memory_order_relaxed);
+        return;
+      } else {
+        pos = head_.load(memory_order_relaxed);
+      }
+    }
+    slot->level = level;
+    vsnprintf(slot->text, message_size, format, args);
+    slot->seq.store(pos + 1, memory_order_release);
+  }
+
+  void Flush() {
+    size_t target = head_.load(memory_order_acquire);
+    while (written_.load(memory_order_acquire) < target) {
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+  }
+
+ private:
+  atomic<int> level_;
+  // Callers shedding logging.
+  atomic<int> shedding_;
+  Slot ring_[ring_size];
+  atomic<size_t> head_;
+  // Only the writer thread touches tail_.
+  size_t tail_;
+  atomic<size_t> written_;
+  atomic<size_t> dropped_;
+  atomic<bool> stop_;
+  thread thread_;
+
+  void Run() {
+    static const char* names[] = { "D", "I", "W", "E" };
+    while (true) {
+      bool drained = true;
+      Slot& slot = ring_[tail_ & (ring_size - 1)];
+      if (slot.seq.load(memory_order_acquire) == tail_ + 1) {
+        size_t dropped = dropped_.exchange(0, memory_order_relaxed);
+        if (dropped > 0) {
+          fprintf(stdout, "W (%zu log messages dropped)\n", dropped);
+        }
+        FILE* out = slot.level >= LogLevel::Warning ? stderr : stdout;
+        fprintf(out, "%s %s\n", names[int(slot.level)], slot.text);
+        slot.seq.store(tail_ + ring_size, memory_order_release);
+        tail_++;
+        written_.store(tail_, memory_order_release);
+        drained = false;
+      }
+      if (drained) {
+        fflush(stdout);
+        if (stop_) {
+          return;
+        }
+        this_thread::sleep_for(chrono::milliseconds(2));
+      }
+    }
+  }
+};
+
+Logger& GetLogger() {
+  static Logger logger;
+  return logger;
+}
+
+}  // namespace
+
+void SetLogLevel(LogLevel level) {
+  GetLogger().SetLevel(level);
+}
+
+void ShedLogging(bool shed) {
+  GetLogger().Shed(shed);
+}
+
+bool LogEnabled(LogLevel level) {
+  return GetLogger().Enabled(level);
+}
+
+void Log(LogLevel level, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  GetLogger().Write(level, format, args);
+  va_end(args);
+}
+
+void FlushLog() {
+  GetLogger().Flush();
+}
@@ -0,0 +1,54 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <stddef.h>
+
+enum class LogLevel { Debug, Info, Warning, Error };
+
+// Asynchronous logging for the control path.
+//
+// Log formats the message into a slot of a fixed-size lock-free ring and
+// returns; a background thread writes the ring out and flushes once it has
+// drained it. Logging never blocks: when the ring is full the message is
+// dropped and counted, and the count is reported with the next message
+// written.
+
+// Messages below level are discarded. The default is LogLevel::Info.
+void SetLogLevel(LogLevel level);
+
+bool LogEnabled(LogLevel level);
+
+// While any caller sheds logging, Debug and Info messages are discarded
+// whatever the level, to save their formatting under load (see
+// LoadShedding.h). The calls are counted, so that every caller that sheds
+// has to restore before they are written again.
+void ShedLogging(bool shed);
+
+// printf-style. Messages longer than a ring slot are truncated.
+void Log(LogLevel level, const char* format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+// Write out everything logged so far and wait until it has been.
+void FlushLog();
+
+#define MPC_LOG(level, ...)         \
+  do {                              \
+    if (LogEnabled(level)) {        \
+      Log(level, __VA_ARGS__);      \
+    }                               \
+  } while (0)
+
+// Log only every n-th time this line is reached.
+#define MPC_LOG_EVERY_N(level, n, ...)                       \
+  do {                                                       \
+    static std::atomic<size_t> mpc_log_count_(0);            \
+    if (LogEnabled(level) && mpc_log_count_++ % (n) == 0) {  \
+      Log(level, __VA_ARGS__);                               \
+    }                                                        \
+  } while (0)
+
+#endif /* LOGGER_H */
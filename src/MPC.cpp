@@ -1,127 +1,1316 @@
 #include "MPC.h"
-#include <cppad/cppad.hpp>
-#include <cppad/ipopt/solve.hpp>
+#include "ADMM.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <istream>
+#include <ostream>
+#include <typeinfo>
+#include <coin/IpIpoptApplication.hpp>
+#include "AllocCount.h"
+#include "AutoDiff_NLP.h"
+#include "ControlTable.h"
 #include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+#include "KinematicModel.h"
+#include "Layout.h"
+#include "Logger.h"
+#include "Kernel_NLP.h"
+#include "MPC_NLP.h"
+#include "Metrics.h"
+#include "MPPI.h"
+#include "RTI.h"
+#include "Reduced_NLP.h"
+#include "RiccatiSQP.h"
+#include "TerminalCost.h"
+#include "Scheduler.h"
+#include "SolutionCache.h"
+#include "WarmStartNet.h"
+#include "Trace.h"
 
-using CppAD::AD;
 using namespace std;
 
-// This is the length from front to CoG that has a similar radius.
-const double Lf = 2.67;
-// Using timeseries rule of: 2N+1
-// subtracting the first state due to the initial forward prediction
-const size_t N = 11;
-const double dt = 0.1;
-
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
-
-class FG_eval {
- public:
-  // Fitted polynomial coefficients
-  Eigen::VectorXd coeffs;
-  double ref_cte;
-  double ref_epsi;
-  double ref_v;
-
-  FG_eval(Eigen::VectorXd coeffs, double cte_ref, double epsi_ref, double v_ref) { 
-    this->coeffs = coeffs;
-    this->ref_cte = cte_ref;
-    this->ref_epsi = epsi_ref;
-    this->ref_v = v_ref;
-  }
-
-  typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
-  void operator()(ADvector& fg, const ADvector& vars) {
-    // Implement MPC
-    
-    fg[0] = 0;
-
-    // The part of the cost based on the reference state.
-    for (int i = 0; i < N; i++) {
-      fg[0] += 16 * CppAD::pow(vars[cte_start + i] - ref_cte, 2);
-      fg[0] += 12 * CppAD::pow(vars[epsi_start + i] - ref_epsi, 2);
-      fg[0] += CppAD::pow(vars[v_start + i] - ref_v, 2);
-    }
-
-    // Minimize the use of actuators.
-    for (int i = 0; i < N - 1; i++) {
-      fg[0] += 8 * CppAD::pow(vars[delta_start + i], 2); // 4
-      fg[0] += 6 * CppAD::pow(vars[a_start + i], 2); // 3
-    }
-
-    // Minimize the value gap between sequential actuations.
-    for (int i = 0; i < N - 2; i++) {
-      fg[0] += 400 * CppAD::pow(vars[delta_start + i + 1] - vars[delta_start + i], 2);
-      fg[0] += 10 * CppAD::pow(vars[a_start + i + 1] - vars[a_start + i], 2);
-    }
-    
-    // Initial constraints
-    fg[1 + x_start] = vars[x_start];
-    fg[1 + y_start] = vars[y_start];
-    fg[1 + psi_start] = vars[psi_start];
-    fg[1 + v_start] = vars[v_start];
-    fg[1 + cte_start] = vars[cte_start];
-    fg[1 + epsi_start] = vars[epsi_start];
-
-    // The rest of the constraints
-    for (int i = 0; i < N - 1; i++) {
-      // The state at time t+1 .
-      AD<double> x1 = vars[x_start + i + 1];
-      AD<double> y1 = vars[y_start + i + 1];
-      AD<double> psi1 = vars[psi_start + i + 1];
-      AD<double> v1 = vars[v_start + i + 1];
-      AD<double> cte1 = vars[cte_start + i + 1];
-      AD<double> epsi1 = vars[epsi_start + i + 1];
-
-      // The state at time t.
-      AD<double> x = vars[x_start + i];
-      AD<double> y = vars[y_start + i];
-      AD<double> psi = vars[psi_start + i];
-      AD<double> v = vars[v_start + i];
-      AD<double> cte = vars[cte_start + i];
-      AD<double> epsi = vars[epsi_start + i];
-
-      // Only consider the actuation at time t.
-      AD<double> delta = vars[delta_start + i];
-      AD<double> alpha = vars[a_start + i];
-
-      AD<double> f_x = coeffs[0] + coeffs[1] * x + coeffs[2] * pow(x, 2) + coeffs[3] * pow(x, 3);
-      AD<double> psi_des = CppAD::atan(coeffs[1] + (2 * coeffs[3] * x) + (3 * coeffs[3] * pow(x, 2)));
-
-      // kinematic constraints
-      fg[2 + x_start + i] = x1 - (x + v * CppAD::cos(psi) * dt);
-      fg[2 + y_start + i] = y1 - (y + v * CppAD::sin(psi) * dt);
-      fg[2 + psi_start + i] = psi1 - (psi + v * delta / Lf * dt);
-      fg[2 + v_start + i] = v1 - (v + alpha * dt);
-      fg[2 + cte_start + i] = cte1 - ((f_x - y) + (v * CppAD::sin(epsi) * dt));
-      fg[2 + epsi_start + i] = epsi1 - ((psi - psi_des) + v * delta / Lf * dt);
+// Largest constraint violation of an iterate that is still used as a plan
+// when Ipopt did not converge, Ipopt's default constr_viol_tol.
+static const double feasible_tol = 1e-4;
+
+// Largest mismatch between cte, epsi and the coefficients they follow from,
+// and largest offset and heading of the pose from the origin of the frame,
+// for which the table is consulted.
+static const double table_cte_tol = 0.1;
+static const double table_epsi_tol = 0.01;
+
+// Multi-start: the warm started solve plus straight-line, full left and
+// full right steering guesses.
+static const int max_starts = 4;
+
+// Sensitivity updates of the Riccati backend in a row before a full
+// solve, which keeps the linearization from drifting.
+static const int max_predictions = 3;
+
+// Throttle per m/s of speed error of the cold start guess.
+static const double feedforward_speed_gain = 0.1;
+
+// Coarse starts (see SetCoarseStart): the Gauss-Newton steps of the coarse
+// problem, and the offset, heading and speed by which the state may miss
+// the second stage of the last plan before the frame is solved cold from
+// the coarse problem instead of from the shifted plan.
+static const int coarse_iterations = 3;
+static const double coarse_cte_jump = 0.5;
+static const double coarse_epsi_jump = 0.1;
+static const double coarse_v_jump = 2.0;
+
+// CppAD keeps its memory pools per thread, so the tapes of the extra starts
+// need it set up for parallel use. The calling thread is thread 0 and the
+// pool threads of a multi-start take the numbers from starts_thread on.
+// After MPCParallelSetup CppAD stays in parallel mode for good, and the
+// solver threads and the pools of the instances made from then on claim
+// their numbers from cppad_next, so that no two threads share a pool.
+static thread_local size_t cppad_thread = 0;
+static std::atomic<bool> cppad_parallel(false);
+static std::atomic<bool> cppad_shared(false);
+static std::atomic<size_t> cppad_next(1);
+static std::atomic<size_t> cppad_threads(0);
+static std::mutex cppad_mutex;
+
+static bool CppADInParallel() { return cppad_parallel.load() || cppad_shared.load(); }
+static size_t CppADThread() { return cppad_thread; }
+
+// Only the first call sets CppAD up; later ones must not need more threads.
+// CppAD is set up before any other thread uses it, so the lock only keeps
+// two first calls from racing.
+static void SetupCppAD(size_t threads) {
+  std::lock_guard<std::mutex> lock(cppad_mutex);
+  if (cppad_threads.load() == 0) {
+    CppAD::thread_alloc::parallel_setup(threads, CppADInParallel, CppADThread);
+    CppAD::parallel_ad<double>();
+#ifdef MPC_STAGE_CHECKPOINT
+    StageCheckpoint();
+#endif
+    cppad_threads = threads;
+  }
+}
+
+// The first of count thread numbers claimed from cppad_next, or 0 when
+// fewer are left.
+static size_t ClaimCppADThreads(size_t count) {
+  size_t first = cppad_next.load();
+  while (first + count <= cppad_threads.load()) {
+    if (cppad_next.compare_exchange_weak(first, first + count)) {
+      return first;
+    }
+  }
+  return 0;
+}
+
+size_t MPCParallelSetup(size_t threads) {
+  threads = std::min(threads, size_t(CPPAD_MAX_NUM_THREADS));
+  SetupCppAD(std::max(threads, size_t(max_starts)));
+  cppad_shared = true;
+  size_t next = cppad_next.load();
+  return next < cppad_threads.load() ? cppad_threads.load() - next : 0;
+}
+
+bool MPCParallel() {
+  return cppad_shared.load();
+}
+
+void MPCLinearSolverThreads(size_t threads) {
+  threads = std::max(threads, size_t(1));
+  const std::string value = std::to_string(threads);
+  size_t cores = threads;
+  for (const char* name : { "OMP_NUM_THREADS", "MKL_NUM_THREADS" }) {
+    const char* set = getenv(name);
+    if (set == nullptr) {
+      setenv(name, value.c_str(), 0);
+    } else if (strtoul(set, nullptr, 10) != threads) {
+      MPC_LOG(LogLevel::Warning, "%s=%s is set, keeping it instead of %zu", name, set, threads);
+      if (cores == threads) {
+        cores = std::max<size_t>(strtoul(set, nullptr, 10), 1);
+      }
     }
   }
+  SetControlSolveCores(cores);
+  MPC_LOG(LogLevel::Info, "Linear solver on %zu threads per solve", cores);
+}
+
+bool MPCSolverThread() {
+  size_t thread = ClaimCppADThreads(1);
+  if (thread == 0) {
+    MPC_LOG(LogLevel::Error, "No CppAD thread left for a solver thread, %zu set up", cppad_threads.load());
+    return false;
+  }
+  cppad_thread = thread;
+  return true;
+}
+
+template <size_t N>
+struct MPCSolver {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  MPCSolver()
+      : backend(MPC<N>::Backend::Ipopt),
+        weights(default_weights),
+        dt(default_dt),
+        dt_growth(1),
+        understeer(0),
+        terminal(false),
+        terminal_cost(TerminalMatrix::Zero()),
+        n_obstacles(0),
+        max_correction(0),
+        predictions(0),
+        rti(dt, Lf),
+        riccati(dt, Lf),
+        admm(dt, Lf),
+        mppi(dt, Lf),
+        coarse_start(false),
+        coarse(dt, Lf),
+        frenet(false),
+        ref_cte(),
+        ref_epsi(),
+        ref_v() {}
+
+  typename MPC<N>::Backend backend;
+  Weights weights;
+  double dt;
+  double dt_growth;
+  double understeer;
+  // Whether there is a terminal cost, and the one of every backend.
+  bool terminal;
+  TerminalMatrix terminal_cost;
+  SoftConstraints soft;
+  RateLimits rate_limits;
+  Obstacle obstacles[max_obstacles];
+  size_t n_obstacles;
+  // The largest correction of a sensitivity update, and the updates since
+  // the last full solve.
+  double max_correction;
+  int predictions;
+  RTI<N> rti;
+  RiccatiSQP<N> riccati;
+  ADMM<N> admm;
+  MPPI<N> mppi;
+  // Whether cold starts of the Ipopt backends take their guess from the
+  // coarse problem, solved by coarse.
+  bool coarse_start;
+  RiccatiSQP<coarse_horizon> coarse;
+  // Whether the problem of the ipopt backend is in the coordinates of the
+  // path (see SetFrenet).
+  bool frenet;
+  typename MPC<N>::Result result;
+  std::shared_ptr<const ControlTable> table;
+  // Reference of every stage, that of Init unless SetStageReferences.
+  double ref_cte[N];
+  double ref_epsi[N];
+  double ref_v[N];
+  // Solutions of the Ipopt backends by problem; cleared whenever the
+  // problem changes other than by its state and reference.
+  SolutionCache<N> cache;
+  std::shared_ptr<const WarmStartNet> net;
+  // The actuators of the guess of the next cold start, [delta..., a...]:
+  // those the net predicts, or those given with SetGuess when guessed.
+  Eigen::Matrix<double, 2 * (N - 1), 1> guess;
+  bool guessed;
+  // The first control of the next solve, when fixed.
+  bool fixed;
+  double fixed_delta;
+  double fixed_a;
+
+  // The model over the current time grid.
+  KinematicModel Model() const { return KinematicModel(dt, Lf, dt_growth, understeer); }
+
+  // Ipopt problem of the current backend, created once and reused by
+  // every call to Solve.
+  Ipopt::SmartPtr<MPC_Problem<N> > nlp;
+  // What Ipopt is handed of nlp, without the given initial state; made
+  // along with the first OptimizeTNLP of every problem.
+  Ipopt::SmartPtr<Reduced_NLP<N> > reduced;
+  // Long-lived application so Ipopt keeps its internal structures
+  // between frames (ReOptimizeTNLP after the first solve).
+  Ipopt::SmartPtr<Ipopt::IpoptApplication> app;
+  // Where KeepWarm evaluates nlp: the constraints, the gradient, the
+  // Jacobian and the Hessian one after the other.
+  std::vector<double> keep_warm;
+  // True once a solve has been made whose solution can seed the next one.
+  bool optimized;
+  bool warm;
+  // Whether the solution is that of a Presolve, already from the pose the
+  // next solve starts at, so that it is not shifted by a stage.
+  bool presolved;
+  // Whether the solve under way is a Presolve, which records no metrics.
+  bool presolving;
+  // Options of every application, and whether the warm start ones are
+  // currently set, so that they are only rewritten when switching
+  // between cold and warm starts.
+  IpoptOptions ipopt;
+  bool warm_options;
+  // Cap of SetIterationCap, 0 for none, and the iteration limit that the
+  // applications have, so that it too is only rewritten on a change; -1
+  // when they may differ.
+  int iteration_cap;
+  int applied_max_iter;
+
+  // Extra cold-started solves of the same problem, run on the pool while
+  // the main one runs on the calling thread.
+  struct Start {
+    Ipopt::SmartPtr<MPC_Problem<N> > nlp;
+    Ipopt::SmartPtr<Reduced_NLP<N> > reduced;
+    Ipopt::SmartPtr<Ipopt::IpoptApplication> app;
+    bool optimized;
+    Ipopt::ApplicationReturnStatus status;
+  };
+  std::vector<Start> starts;
+  // Whether the starts sit out the solves (see SetSingleStart).
+  bool single_start;
+  unique_ptr<Eigen::NonBlockingThreadPool> pool;
+  std::mutex starts_mutex;
+  std::condition_variable starts_done;
+  size_t starts_pending;
+  // The CppAD thread number of the pool's first thread.
+  size_t starts_thread;
 };
 
+// The terminal cost of the solver's weights, model and the time step and
+// reference speed of its last stage, zero while there is none, to every
+// backend that has not got it; the Ipopt ones take it with the other
+// parameters of every solve.
+template <size_t N>
+static void UpdateTerminalCost(MPCSolver<N>& s) {
+  TerminalMatrix cost = TerminalMatrix::Zero();
+  if (s.terminal) {
+    double dt = s.dt * pow(s.dt_growth, double(N - 2));
+    cost = LqrTerminalCost(s.weights, s.ref_v[N - 1], dt, s.understeer, Lf);
+  }
+  if (cost == s.terminal_cost) {
+    return;
+  }
+  s.terminal_cost = cost;
+  s.rti.SetTerminalCost(cost);
+  s.riccati.SetTerminalCost(cost);
+  s.admm.SetTerminalCost(cost);
+  s.mppi.SetTerminalCost(cost);
+}
+
+// Iteration limit of the applications of ipopt: Ipopt's own default
+// unless it sets one.
+static int MaxIter(const IpoptOptions& ipopt) {
+  return ipopt.max_iter > 0 ? ipopt.max_iter : 3000;
+}
+
+// Ipopt application with the options used by every solve. The warm start
+// options are set by Solve as it switches between cold and warm starts.
+static Ipopt::SmartPtr<Ipopt::IpoptApplication> NewApplication(const IpoptOptions& ipopt) {
+  Ipopt::SmartPtr<Ipopt::IpoptApplication> app = IpoptApplicationFactory();
+  Ipopt::SmartPtr<Ipopt::OptionsList> options = app->Options();
+  options->SetIntegerValue("print_level", ipopt.print_level);
+  options->SetStringValue("sb", "yes");
+  options->SetNumericValue("max_cpu_time", ipopt.max_cpu_time);
+  options->SetNumericValue("mu_init", ipopt.cold_mu_init);
+  if (!ipopt.linear_solver.empty()) {
+    options->SetStringValue("linear_solver", ipopt.linear_solver);
+  }
+  if (ipopt.tol > 0) {
+    options->SetNumericValue("tol", ipopt.tol);
+  }
+  if (ipopt.max_iter > 0) {
+    options->SetIntegerValue("max_iter", ipopt.max_iter);
+  }
+  if (!ipopt.mu_strategy.empty()) {
+    options->SetStringValue("mu_strategy", ipopt.mu_strategy);
+  }
+  if (!ipopt.hessian_approximation.empty()) {
+    options->SetStringValue("hessian_approximation", ipopt.hessian_approximation);
+  }
+  if (ipopt.user_scaling) {
+    options->SetStringValue("nlp_scaling_method", "user-scaling");
+  }
+  options->SetNumericValue("nlp_lower_bound_inf", -no_bound);
+  options->SetNumericValue("nlp_upper_bound_inf", no_bound);
+  // The initial state is fixed by its bounds and taken out of the problem.
+  options->SetStringValue("fixed_variable_treatment", "make_parameter");
+  if (app->Initialize() != Ipopt::Solve_Succeeded) {
+    MPC_LOG(LogLevel::Error, "Ipopt rejected its options");
+  }
+  return app;
+}
+
+template <size_t N>
+static MPC_Problem<N>* NewProblem(typename MPC<N>::Backend backend, bool frenet) {
+  if (backend == MPC<N>::Backend::IpoptKernels) {
+    return new Kernel_NLP<N>();
+  }
+  if (backend == MPC<N>::Backend::IpoptAutoDiff) {
+    return new AutoDiff_NLP<N>();
+  }
+  return new MPC_NLP<N>(frenet);
+}
+
+template <size_t N>
+static bool Feasible(const MPC_Problem<N>& nlp) {
+  return nlp.status == Ipopt::SUCCESS || nlp.violation <= feasible_tol;
+}
+
+// Stage k of model, in the coordinates of the path with frenet (see
+// MPC::SetFrenet), as the guesses simulate it.
+static void GuessStep(const KinematicModel& model, size_t k, bool frenet, const double* x, const double* u,
+                      const Eigen::Vector4d& coeffs, double* x1) {
+  if (frenet) {
+    model.Stage(k).FrenetStep(x, u, coeffs, x1);
+  } else {
+    model.Stage(k).Step(x, u, coeffs, x1);
+  }
+}
+
+// Initial guess holding the steering at delta and the throttle at zero,
+// simulated from the initial state.
+template <size_t N>
+static void ConstantGuess(MPC_Problem<N>& nlp, const StateVector& state, const Eigen::Vector4d& coeffs,
+                          const KinematicModel& model, bool frenet, double delta) {
+  typedef Layout<N> L;
+  const double u[2] = { delta, 0 };
+  double x[6];
+  double x1[6];
+  for (size_t s = 0; s < 6; s++) {
+    x[s] = state[s];
+  }
+  for (size_t k = 0; k < N; k++) {
+    for (size_t s = 0; s < 6; s++) {
+      nlp.vars[L::State(s, k)] = x[s];
+    }
+    if (k + 1 < N) {
+      GuessStep(model, k, frenet, x, u, coeffs, x1);
+      std::copy(x1, x1 + 6, x);
+      nlp.vars[L::delta(k)] = delta;
+      nlp.vars[L::a(k)] = 0;
+    }
+  }
+}
+
+// Initial guess of the actuators in actuators, [delta..., a...], within
+// their bounds, simulated from the initial state.
+template <size_t N>
+static void PlanGuess(MPC_Problem<N>& nlp, const StateVector& state, const Eigen::Vector4d& coeffs,
+                      const KinematicModel& model, bool frenet, const double* actuators) {
+  typedef Layout<N> L;
+  double x[6];
+  double x1[6];
+  for (size_t s = 0; s < 6; s++) {
+    x[s] = state[s];
+  }
+  for (size_t k = 0; k < N; k++) {
+    for (size_t s = 0; s < 6; s++) {
+      nlp.vars[L::State(s, k)] = x[s];
+    }
+    if (k + 1 < N) {
+      const double u[2] = { std::min(std::max(actuators[k], -max_delta), max_delta),
+                            std::min(std::max(actuators[N - 1 + k], -max_a), max_a) };
+      GuessStep(model, k, frenet, x, u, coeffs, x1);
+      std::copy(x1, x1 + 6, x);
+      nlp.vars[L::delta(k)] = u[0];
+      nlp.vars[L::a(k)] = u[1];
+    }
+  }
+}
+
+// Initial guess of a cold start without a better one: the steering that
+// turns the model along the curvature of the reference where it is, and
+// the throttle that closes the speed error, simulated from the initial
+// state. With frenet coeffs are the curvature itself.
+template <size_t N>
+static void FeedforwardGuess(MPC_Problem<N>& nlp, const StateVector& state, const Eigen::Vector4d& coeffs,
+                             const KinematicModel& model, bool frenet, double ref_v) {
+  typedef Layout<N> L;
+  double x[6];
+  double x1[6];
+  for (size_t s = 0; s < 6; s++) {
+    x[s] = state[s];
+  }
+  for (size_t k = 0; k < N; k++) {
+    for (size_t s = 0; s < 6; s++) {
+      nlp.vars[L::State(s, k)] = x[s];
+    }
+    if (k + 1 < N) {
+      double px = x[0];
+      double slope = coeffs[1] + (2 * coeffs[2] + 3 * coeffs[3] * px) * px;
+      double curvature = frenet ? Polyval<3>(coeffs, px)
+                                : (2 * coeffs[2] + 6 * coeffs[3] * px) / pow(1 + slope * slope, 1.5);
+      double delta = atan(Lf * curvature * (1 + model.understeer * x[3] * x[3]));
+      const double u[2] = { std::min(std::max(delta, -max_delta), max_delta),
+                            std::min(std::max(feedforward_speed_gain * (ref_v - x[3]), -max_a), max_a) };
+      GuessStep(model, k, frenet, x, u, coeffs, x1);
+      std::copy(x1, x1 + 6, x);
+      nlp.vars[L::delta(k)] = u[0];
+      nlp.vars[L::a(k)] = u[1];
+    }
+  }
+}
+
+// Look the controls up in the table when the state is one it covers, and
+// fill in the plan holding them.
+template <size_t N>
+static bool Tabulated(const ControlTable& table, const StateVector& state,
+                      const Eigen::Vector4d& coeffs, const KinematicModel& model,
+                      typename MPC<N>::Result& result) {
+  if (fabs(state[4] - coeffs[0]) > table_cte_tol || fabs(state[5] + atan(coeffs[1])) > table_epsi_tol ||
+      hypot(state[0], state[1]) > table_cte_tol || fabs(state[2]) > table_epsi_tol) {
+    return false;
+  }
+  const double p[ControlTable::n_dims] = { state[3], state[4], state[5], coeffs[2], coeffs[3] };
+  double u[2];
+  if (!table.Lookup(p, u[0], u[1])) {
+    return false;
+  }
+
+  double x[6];
+  double x1[6];
+  for (size_t s = 0; s < 6; s++) {
+    x[s] = state[s];
+  }
+  for (size_t k = 0; k < N; k++) {
+    result.x[k] = x[0];
+    result.y[k] = x[1];
+    result.psi[k] = x[2];
+    result.v[k] = x[3];
+    if (k + 1 < N) {
+      model.Stage(k).Step(x, u, coeffs, x1);
+      std::copy(x1, x1 + 6, x);
+    }
+  }
+  result.delta.setConstant(u[0]);
+  result.a.setConstant(u[1]);
+  result.ok = true;
+  result.status = Ipopt::Solve_Succeeded;
+  result.fallback = false;
+  result.usable = true;
+  result.tabulated = true;
+  result.cost = 0;
+  result.iterations = 0;
+  return true;
+}
+
+// Copy the plan of one of the hand-written solvers (RTI, RiccatiSQP, ADMM,
+// MPPI).
+template <size_t N, class Plan>
+static void CopyPlan(const Plan& plan, typename MPC<N>::Result& result) {
+  typedef Eigen::Matrix<double, N - 1, 1> InputSequence;
+  typedef Eigen::Map<const InputSequence, 0, Eigen::InnerStride<2> > InterleavedInputs;
+  result.x = plan.States().row(0).transpose();
+  result.y = plan.States().row(1).transpose();
+  result.psi = plan.States().row(2).transpose();
+  result.v = plan.States().row(3).transpose();
+  result.delta = InterleavedInputs(plan.Inputs().data());
+  result.a = InterleavedInputs(plan.Inputs().data() + 1);
+}
+
+// The trajectory and actuators of the solution of nlp.
+template <size_t N>
+static void CopySolution(const MPC_Problem<N>& nlp, typename MPC<N>::Result& result) {
+  typedef Layout<N> L;
+  for (size_t i = 0; i < N; i++) {
+    result.x[i] = nlp.x[L::x(i)];
+    result.y[i] = nlp.x[L::y(i)];
+    result.psi[i] = nlp.x[L::psi(i)];
+    result.v[i] = nlp.x[L::v(i)];
+  }
+  for (size_t i = 0; i < N - 1; i++) {
+    result.delta[i] = nlp.x[L::delta(i)];
+    result.a[i] = nlp.x[L::a(i)];
+  }
+}
+
+// Shift the entries first, first + stride, ... before end of v one step
+// towards the start, repeating the last.
+template <class Vector>
+static void ShiftRange(Vector& v, size_t first, size_t end, size_t stride) {
+  for (size_t i = first; i + stride < end; i += stride) {
+    v[i] = v[i + stride];
+  }
+}
+
+// Shift every state and actuator of the model variables v one stage
+// towards the start, repeating the last value.
+template <size_t N, class Vector>
+static void ShiftVariables(Vector& v) {
+  typedef Layout<N> L;
+  for (size_t i = 0; i + 1 < N; i++) {
+    for (size_t s = 0; s < L::n_states; s++) {
+      v[L::State(s, i)] = v[L::State(s, i + 1)];
+    }
+    for (size_t k = 0; k < L::n_actuators && i + 2 < N; k++) {
+      v[L::Input(k, i)] = v[L::Input(k, i + 1)];
+    }
+  }
+}
+
+// The same for the values of the model constraint rows r.
+template <size_t N, class Vector>
+static void ShiftRows(Vector& r) {
+  typedef Layout<N> L;
+  for (size_t i = 0; i + 1 < N; i++) {
+    for (size_t s = 0; s < L::n_states; s++) {
+      r[L::Row(s, i)] = r[L::Row(s, i + 1)];
+    }
+  }
+}
+
+// The previous solution in vars, its trajectory re-expressed relative to
+// its pose at stage. With frenet the offset and heading are relative to
+// the path already, and only the arc length starts at stage.
+template <size_t N>
+static void ReframeSolution(MPC_Problem<N>& nlp, size_t stage, bool frenet) {
+  typedef Layout<N> L;
+  double x0 = nlp.x[L::x(stage)];
+  double y0 = nlp.x[L::y(stage)];
+  double psi0 = nlp.x[L::psi(stage)];
+  double c = cos(psi0);
+  double s = sin(psi0);
+
+  nlp.vars = nlp.x;
+  if (frenet) {
+    for (size_t i = 0; i < N; i++) {
+      nlp.vars[L::x(i)] = nlp.x[L::x(i)] - x0;
+    }
+    return;
+  }
+  for (size_t i = 0; i < N; i++) {
+    double dx = nlp.x[L::x(i)] - x0;
+    double dy = nlp.x[L::y(i)] - y0;
+    nlp.vars[L::x(i)] = dx * c + dy * s;
+    nlp.vars[L::y(i)] = -dx * s + dy * c;
+    nlp.vars[L::psi(i)] = nlp.x[L::psi(i)] - psi0;
+  }
+}
+
+// Initial guess of the actuators in actuators, [delta..., a...], from the
+// coarse problem: coarse_horizon stages of equal length over the time the
+// horizon spans, solved cold by a few Gauss-Newton steps of the Riccati
+// backend. Each stage of the horizon takes the coarse actuators where it
+// starts, interpolated linearly between those of the coarse stages.
+template <size_t N>
+static void CoarseGuess(MPCSolver<N>& s, const StateVector& state, const Eigen::Vector4d& coeffs,
+                        double cte_ref, double epsi_ref, double v_ref, double* actuators) {
+  const size_t n = coarse_horizon - 1;
+  KinematicModel model = s.Model();
+  double span = 0;
+  for (size_t k = 0; k + 1 < N; k++) {
+    span += model.Dt(k);
+  }
+  double dt = span / n;
+  s.coarse.SetWeights(s.weights);
+  s.coarse.SetTimestep(dt);
+  s.coarse.SetUndersteer(s.understeer);
+  s.coarse.SetReference(cte_ref, epsi_ref, v_ref);
+  s.coarse.Reset();
+  s.coarse.Feedback(state, coeffs, coarse_iterations);
+  const typename RiccatiSQP<coarse_horizon>::InputVector& U = s.coarse.Inputs();
+  double t = 0;
+  for (size_t k = 0; k + 1 < N; k++) {
+    double j = std::min(t / dt, double(n - 1));
+    size_t j0 = std::min(size_t(j), n - 1);
+    size_t j1 = std::min(j0 + 1, n - 1);
+    double f = j - j0;
+    actuators[k] = (1 - f) * U[2 * j0] + f * U[2 * j1];
+    actuators[N - 1 + k] = (1 - f) * U[2 * j0 + 1] + f * U[2 * j1 + 1];
+    t += model.Dt(k);
+  }
+}
+
+// Whether the state has left the trajectory of the last solution x by
+// more than a coarse start allows.
+template <size_t N>
+static bool Departed(const typename MPC_Problem<N>::VarVector& x, const StateVector& state) {
+  typedef Layout<N> L;
+  return fabs(state[4] - x[L::cte(1)]) > coarse_cte_jump || fabs(state[5] - x[L::epsi(1)]) > coarse_epsi_jump ||
+         fabs(state[3] - x[L::v(1)]) > coarse_v_jump;
+}
+
+// Seed the next solve with the previous solution advanced by one step.
+// The new initial state lies close to the previous plan's second stage, so
+// the shifted trajectory is re-expressed relative to that stage.
+template <size_t N>
+static void ShiftSolution(MPC_Problem<N>& nlp, bool frenet) {
+  typedef Layout<N> L;
+  ReframeSolution(nlp, 1, frenet);
+  ShiftVariables<N>(nlp.vars);
+  ShiftVariables<N>(nlp.z_L);
+  ShiftVariables<N>(nlp.z_U);
+  // Constraint multipliers follow the state blocks only.
+  ShiftRows<N>(nlp.lambda);
+  // The same for the slacks and the multipliers of the soft rows, per
+  // constraint.
+  ShiftRange(nlp.vars, L::cte_slack_start, L::ddelta_slack_start, 1);
+  ShiftRange(nlp.vars, L::ddelta_slack_start, L::obstacle_slack_start, 1);
+  for (size_t side = 0; side < 2; side++) {
+    ShiftRange(nlp.lambda, L::cte_soft_start + side, L::ddelta_soft_start, 2);
+    ShiftRange(nlp.lambda, L::ddelta_soft_start + side, L::ddelta_rate_start, 2);
+  }
+  ShiftRange(nlp.lambda, L::ddelta_rate_start, L::da_rate_start, 1);
+  ShiftRange(nlp.lambda, L::da_rate_start, L::obstacle_start, 1);
+  for (size_t k = 0; k < max_obstacles; k++) {
+    ShiftRange(nlp.vars, ObstacleSlack<N>(k, 1), ObstacleSlack<N>(k, 1) + N - 1, 1);
+    ShiftRange(nlp.lambda, ObstacleRow<N>(k, 1), ObstacleRow<N>(k, 1) + N - 1, 1);
+  }
+}
+
+// Scale every variable and constraint by the reciprocal of its typical
+// magnitude over the coming solve, so that Ipopt sees them all of order
+// one: the positions by the distance covered over the horizon, the speed
+// by the larger of it and its reference, the actuators by their limits.
+// Each row of the model constraints is the defect of a state and takes
+// its scale, the soft and rate rows that of their variable.
+template <size_t N>
+static void ScaleProblem(MPC_Problem<N>& nlp, double v, double ref_v, double horizon_time) {
+  typedef Layout<N> L;
+  double speed = std::max(std::max(fabs(v), fabs(ref_v)), 1.0);
+  double reach = std::max(speed * horizon_time, 1.0);
+  // Typical cte and epsi: a lane and a fraction of a radian.
+  const double state_scale[L::n_states] = { 1 / reach, 1 / reach, 1, 1 / speed, 0.5, 2 };
+  for (size_t i = 0; i < N; i++) {
+    for (size_t s = 0; s < L::n_states; s++) {
+      nlp.x_scaling[L::State(s, i)] = state_scale[s];
+      nlp.g_scaling[L::Row(s, i)] = state_scale[s];
+    }
+    if (i + 1 < N) {
+      nlp.x_scaling[L::delta(i)] = 1 / max_delta;
+      nlp.x_scaling[L::a(i)] = 1 / max_a;
+    }
+  }
+  nlp.x_scaling.template segment<N>(L::cte_slack_start).setConstant(state_scale[4]);
+  nlp.x_scaling.template segment<N - 2>(L::ddelta_slack_start).setConstant(1 / max_delta);
+  nlp.g_scaling.template segment<2 * N>(L::cte_soft_start).setConstant(state_scale[4]);
+  nlp.g_scaling.template segment<2 * (N - 2)>(L::ddelta_soft_start).setConstant(1 / max_delta);
+  nlp.g_scaling.template segment<N - 2>(L::ddelta_rate_start).setConstant(1 / max_delta);
+  nlp.g_scaling.template segment<N - 2>(L::da_rate_start).setConstant(1 / max_a);
+  // The obstacle rows are squared distances.
+  nlp.x_scaling.template segment<L::n_obstacle_rows>(L::obstacle_slack_start).setConstant(1 / (reach * reach));
+  nlp.g_scaling.template segment<L::n_obstacle_rows>(L::obstacle_start).setConstant(1 / (reach * reach));
+}
+
 //
 // MPC class definition implementation.
 //
-MPC::MPC() {}
-MPC::~MPC() {}
+template <size_t N>
+MPC<N>::MPC() : solver_(new MPCSolver<N>) {
+  solver_->nlp = new MPC_NLP<N>();
+  solver_->optimized = false;
+  solver_->warm = false;
+  solver_->presolved = false;
+  solver_->guessed = false;
+  solver_->fixed = false;
+  solver_->presolving = false;
+  solver_->warm_options = false;
+  solver_->starts_pending = 0;
+  solver_->starts_thread = 1;
+  solver_->single_start = false;
+  solver_->iteration_cap = 0;
+  solver_->applied_max_iter = MaxIter(solver_->ipopt);
 
-void MPC::Init(double cte_ref, double epsi_ref, double v_ref) {
+  solver_->app = NewApplication(solver_->ipopt);
+}
+template <size_t N>
+MPC<N>::~MPC() {}
+
+template <size_t N>
+void MPC<N>::Init(double cte_ref, double epsi_ref, double v_ref) {
   this->ref_cte_ = cte_ref;
   this->ref_epsi_ = epsi_ref;
   this->ref_v_ = v_ref;
+  std::fill(solver_->ref_cte, solver_->ref_cte + N, cte_ref);
+  std::fill(solver_->ref_epsi, solver_->ref_epsi + N, epsi_ref);
+  std::fill(solver_->ref_v, solver_->ref_v + N, v_ref);
+  solver_->cache.Clear();
+  solver_->rti.SetReference(cte_ref, epsi_ref, v_ref);
+  solver_->riccati.SetReference(cte_ref, epsi_ref, v_ref);
+  solver_->admm.SetReference(cte_ref, epsi_ref, v_ref);
+  solver_->mppi.SetReference(cte_ref, epsi_ref, v_ref);
+  UpdateTerminalCost(*solver_);
+}
+
+template <size_t N>
+void MPC<N>::SetReferenceSpeed(double v_ref) {
+  if (v_ref != this->ref_v_) {
+    Init(this->ref_cte_, this->ref_epsi_, v_ref);
+  }
+}
+
+template <size_t N>
+void MPC<N>::SetStageReferences(const double* cte_ref, const double* epsi_ref, const double* v_ref) {
+  MPCSolver<N>& s = *solver_;
+  bool changed = false;
+  for (size_t k = 0; k < N; k++) {
+    double cte = cte_ref ? cte_ref[k] : this->ref_cte_;
+    double epsi = epsi_ref ? epsi_ref[k] : this->ref_epsi_;
+    double v = v_ref ? v_ref[k] : this->ref_v_;
+    changed = changed || cte != s.ref_cte[k] || epsi != s.ref_epsi[k] || v != s.ref_v[k];
+    s.ref_cte[k] = cte;
+    s.ref_epsi[k] = epsi;
+    s.ref_v[k] = v;
+  }
+  if (!changed) {
+    return;
+  }
+  s.cache.Clear();
+  s.rti.SetStageReference(s.ref_cte, s.ref_epsi, s.ref_v);
+  s.riccati.SetStageReference(s.ref_cte, s.ref_epsi, s.ref_v);
+  s.admm.SetStageReference(s.ref_cte, s.ref_epsi, s.ref_v);
+  s.mppi.SetStageReference(s.ref_cte, s.ref_epsi, s.ref_v);
+  UpdateTerminalCost(s);
+}
+
+template <size_t N>
+void MPC<N>::SetBackend(Backend backend) {
+#ifdef MPC_RK4
+  // The hand-written derivatives of Kernel_NLP are those of the Euler step.
+  if (backend == Backend::IpoptKernels) {
+    MPC_LOG(LogLevel::Warning, "The kernels backend has no RK4 model, using ipopt");
+    backend = Backend::Ipopt;
+  }
+#endif
+  // A different problem object needs a fresh OptimizeTNLP. AutoDiff_NLP
+  // derives from Kernel_NLP, so the types are compared exactly.
+  const std::type_info& current = typeid(*Ipopt::GetRawPtr(solver_->nlp));
+  if (backend == Backend::IpoptKernels && current != typeid(Kernel_NLP<N>)) {
+    solver_->nlp = new Kernel_NLP<N>();
+    solver_->optimized = false;
+  } else if (backend == Backend::IpoptAutoDiff && current != typeid(AutoDiff_NLP<N>)) {
+    solver_->nlp = new AutoDiff_NLP<N>();
+    solver_->optimized = false;
+  } else if (backend == Backend::Ipopt &&
+             (current != typeid(MPC_NLP<N>) ||
+              static_cast<MPC_NLP<N>&>(*Ipopt::GetRawPtr(solver_->nlp)).Frenet() != solver_->frenet)) {
+    solver_->nlp = new MPC_NLP<N>(solver_->frenet);
+    solver_->optimized = false;
+  }
+  for (size_t i = 0; i < solver_->starts.size(); i++) {
+    solver_->starts[i].nlp = NewProblem<N>(backend, solver_->frenet);
+    solver_->starts[i].optimized = false;
+  }
+  solver_->backend = backend;
+  Reset();
 }
 
-vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
+template <size_t N>
+bool MPC<N>::SetFrenet(bool frenet) {
+  if (frenet != solver_->frenet) {
+    solver_->frenet = frenet;
+    solver_->cache.Clear();
+    SetBackend(solver_->backend);
+  }
+  if (frenet && !Frenet()) {
+    MPC_LOG(LogLevel::Warning, "Only the ipopt backend solves in the coordinates of the path");
+    return false;
+  }
+  return true;
+}
+
+template <size_t N>
+bool MPC<N>::Frenet() const {
+  return solver_->frenet && solver_->backend == Backend::Ipopt;
+}
+
+template <size_t N>
+void MPC<N>::SetSoftConstraints(const SoftConstraints& soft) {
+  solver_->soft = soft;
+  solver_->cache.Clear();
+}
+
+template <size_t N>
+void MPC<N>::SetIpoptOptions(const IpoptOptions& options) {
+  // New applications, since Ipopt takes some of its options, the linear
+  // solver among them, only when it is initialized.
+  solver_->ipopt = options;
+  solver_->cache.Clear();
+  solver_->app = NewApplication(options);
+  solver_->optimized = false;
+  solver_->warm_options = false;
+  solver_->applied_max_iter = MaxIter(options);
+  for (size_t i = 0; i < solver_->starts.size(); i++) {
+    solver_->starts[i].app = NewApplication(options);
+    solver_->starts[i].optimized = false;
+  }
+}
+
+template <size_t N>
+void MPC<N>::SetRateLimits(const RateLimits& limits) {
+  solver_->rate_limits = limits;
+  solver_->cache.Clear();
+}
+
+template <size_t N>
+void MPC<N>::SetObstacles(const Obstacle* obstacles, size_t n) {
+  solver_->n_obstacles = std::min(n, max_obstacles);
+  std::copy(obstacles, obstacles + solver_->n_obstacles, solver_->obstacles);
+}
+
+template <size_t N>
+void MPC<N>::SetSensitivityUpdate(double max_correction) {
+  solver_->max_correction = std::max(max_correction, 0.0);
+  solver_->predictions = 0;
+}
+
+template <size_t N>
+void MPC<N>::SetMixedPrecision(int refinements) {
+  solver_->rti.SetMixedPrecision(refinements);
+  solver_->admm.SetMixedPrecision(refinements);
+}
+
+template <size_t N>
+void MPC<N>::SetWeights(const Weights& weights) {
+  solver_->weights = weights;
+  solver_->cache.Clear();
+  solver_->rti.SetWeights(weights);
+  solver_->riccati.SetWeights(weights);
+  solver_->admm.SetWeights(weights);
+  solver_->mppi.SetWeights(weights);
+  UpdateTerminalCost(*solver_);
+}
+
+template <size_t N>
+void MPC<N>::SetTimestep(double dt, double growth) {
+  solver_->dt = dt;
+  solver_->dt_growth = growth;
+  solver_->cache.Clear();
+  solver_->rti.SetTimestep(dt, growth);
+  solver_->riccati.SetTimestep(dt, growth);
+  solver_->admm.SetTimestep(dt, growth);
+  solver_->mppi.SetTimestep(dt, growth);
+  UpdateTerminalCost(*solver_);
+  Reset();
+}
+
+template <size_t N>
+void MPC<N>::SetUndersteer(double understeer) {
+  solver_->understeer = understeer;
+  solver_->cache.Clear();
+  solver_->rti.SetUndersteer(understeer);
+  solver_->riccati.SetUndersteer(understeer);
+  solver_->admm.SetUndersteer(understeer);
+  solver_->mppi.SetUndersteer(understeer);
+  UpdateTerminalCost(*solver_);
+  Reset();
+}
+
+template <size_t N>
+void MPC<N>::SetTerminalCost(bool enabled) {
+  solver_->terminal = enabled;
+  solver_->cache.Clear();
+  UpdateTerminalCost(*solver_);
+}
+
+template <size_t N>
+void MPC<N>::SetMoveBlocks(const std::vector<size_t>& lengths) {
+  solver_->rti.SetMoveBlocks(lengths);
+  solver_->mppi.SetMoveBlocks(lengths);
+}
+
+template <size_t N>
+void MPC<N>::SetSamplingThreads(int threads) {
+  solver_->mppi.SetThreads(size_t(std::max(threads, 1)));
+}
+
+template <size_t N>
+void MPC<N>::SetSamplingSeed(uint64_t seed) {
+  solver_->mppi.SetSeed(seed);
+}
+
+template <size_t N>
+bool MPC<N>::SetSamplingDevice(size_t samples) {
+  return solver_->mppi.SetDevice(samples);
+}
+
+template <size_t N>
+void MPC<N>::SetTable(std::shared_ptr<const ControlTable> table) {
+  if (table && table->Horizon() != N) {
+    MPC_LOG(LogLevel::Warning, "Ignoring a control table for N = %zu, not %zu", table->Horizon(), N);
+    table.reset();
+  }
+  solver_->table = table;
+}
+
+template <size_t N>
+void MPC<N>::SetWarmStartNet(std::shared_ptr<const WarmStartNet> net) {
+  if (net && net->Horizon() != N) {
+    MPC_LOG(LogLevel::Warning, "Ignoring a warm start net for N = %zu, not %zu", net->Horizon(), N);
+    net.reset();
+  }
+  solver_->net = net;
+}
+
+template <size_t N>
+void MPC<N>::Reset() {
+  solver_->rti.Reset();
+  solver_->riccati.Reset();
+  solver_->admm.Reset();
+  solver_->mppi.Reset();
+  solver_->warm = false;
+  solver_->presolved = false;
+  solver_->guessed = false;
+  solver_->fixed = false;
+}
+
+// Whether backend solves with Ipopt.
+static bool IpoptBackend(MPCBackend backend) {
+  return backend == MPCBackend::Ipopt || backend == MPCBackend::IpoptKernels ||
+         backend == MPCBackend::IpoptAutoDiff;
+}
+
+template <size_t N>
+void MPC<N>::SetGuess(const double* deltas, const double* accels) {
+  Reset();
+  std::copy(deltas, deltas + N - 1, solver_->guess.data());
+  std::copy(accels, accels + N - 1, solver_->guess.data() + N - 1);
+  solver_->guessed = true;
+}
+
+template <size_t N>
+bool MPC<N>::NeedsGuess(const StateVector& state) const {
+  const MPCSolver<N>& s = *solver_;
+  if (!IpoptBackend(s.backend) || !Ipopt::IsValid(s.nlp)) {
+    return false;
+  }
+  return !s.warm || (!s.presolved && Departed<N>(s.nlp->x, state));
+}
+
+template <size_t N>
+void MPC<N>::FixFirstControl(double delta, double a) {
+  solver_->fixed = true;
+  solver_->fixed_delta = std::max(-max_delta, std::min(delta, max_delta));
+  solver_->fixed_a = std::max(-max_a, std::min(a, max_a));
+}
+
+template <size_t N>
+void MPC<N>::SetSolutionCache(size_t capacity) {
+  solver_->cache.SetCapacity(capacity);
+}
+
+template <size_t N>
+void MPC<N>::SetCoarseStart(bool coarse) {
+  solver_->coarse_start = coarse;
+}
+
+template <size_t N>
+void MPC<N>::SetMultiStart(int starts) {
+  starts = std::min(std::max(starts, 1), max_starts);
+  if (starts > 1) {
+    SetupCppAD(max_starts);
+    // A pool next to other solver threads needs numbers of its own.
+    solver_->starts_thread = MPCParallel() ? ClaimCppADThreads(starts - 1) : 1;
+    if (solver_->starts_thread == 0) {
+      MPC_LOG(LogLevel::Warning, "No CppAD threads left for %d starts, solving one", starts);
+      starts = 1;
+    }
+  }
+  solver_->pool.reset(starts > 1 ? new Eigen::NonBlockingThreadPool(starts - 1) : NULL);
+  solver_->starts.resize(starts - 1);
+  // The new applications have the options' limit, the others perhaps a
+  // cap.
+  solver_->applied_max_iter = -1;
+  for (size_t i = 0; i < solver_->starts.size(); i++) {
+    typename MPCSolver<N>::Start& s = solver_->starts[i];
+    s.nlp = NewProblem<N>(solver_->backend, solver_->frenet);
+    s.app = NewApplication(solver_->ipopt);
+    s.optimized = false;
+    s.status = Ipopt::Solve_Succeeded;
+  }
+}
+
+template <size_t N>
+void MPC<N>::SetSingleStart(bool single) {
+  solver_->single_start = single;
+}
+
+template <size_t N>
+void MPC<N>::SetIterationCap(int max_iter) {
+  solver_->iteration_cap = std::max(max_iter, 0);
+}
+
+template <size_t N>
+void MPC<N>::Prepare() {
+  if (solver_->backend == Backend::RTI) {
+    solver_->rti.Prepare();
+  }
+}
+
+// Read a byte of every cache line of the n bytes at p.
+static void TouchBytes(const void* p, size_t n) {
+  const volatile unsigned char* bytes = static_cast<const volatile unsigned char*>(p);
+  unsigned char sum = 0;
+  for (size_t i = 0; i < n; i += 64) {
+    sum ^= bytes[i];
+  }
+  static volatile unsigned char sink;
+  sink = sum;
+}
+
+template <size_t N>
+void MPC<N>::KeepWarm() {
+  MPCSolver<N>& s = *solver_;
+  if (!IpoptBackend(s.backend)) {
+    switch (s.backend) {
+      case Backend::RTI:
+        TouchBytes(&s.rti, sizeof(s.rti));
+        break;
+      case Backend::Riccati:
+        TouchBytes(&s.riccati, sizeof(s.riccati));
+        break;
+      case Backend::ADMM:
+        TouchBytes(&s.admm, sizeof(s.admm));
+        break;
+      default:
+        TouchBytes(&s.mppi, sizeof(s.mppi));
+        break;
+    }
+    return;
+  }
+  if (!s.optimized || !Ipopt::IsValid(s.nlp)) {
+    return;
+  }
+  MPC_Problem<N>& nlp = *s.nlp;
+  Ipopt::Index n, m, nnz_jac, nnz_h;
+  Ipopt::TNLP::IndexStyleEnum style;
+  nlp.get_nlp_info(n, m, nnz_jac, nnz_h, style);
+  s.keep_warm.resize(size_t(m + n + nnz_jac + nnz_h));
+  double* g = s.keep_warm.data();
+  double* grad = g + m;
+  double* jac = grad + n;
+  double* hess = jac + nnz_jac;
+  const double* x = nlp.x.data();
+  double f;
+  // The evaluation time is that of the solves only.
+  chrono::steady_clock::duration eval_time = nlp.eval_time;
+  nlp.eval_f(n, x, true, f);
+  nlp.eval_g(n, x, false, m, g);
+  nlp.eval_grad_f(n, x, false, grad);
+  nlp.eval_jac_g(n, x, false, m, nnz_jac, NULL, NULL, jac);
+  nlp.eval_h(n, x, false, 1, m, nlp.lambda.data(), true, nnz_h, NULL, NULL, hess);
+  nlp.eval_time = eval_time;
+}
+
+template <class V>
+static void WriteVector(ostream& out, const V& v) {
+  out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(double));
+}
+
+template <size_t N>
+static void AddProblemFootprint(const Ipopt::SmartPtr<MPC_Problem<N> >& nlp,
+                                const Ipopt::SmartPtr<Reduced_NLP<N> >& reduced, Footprint& footprint) {
+  if (!Ipopt::IsValid(nlp)) {
+    return;
+  }
+  footprint.problems++;
+  footprint.solver_bytes += sizeof(MPC_Problem<N>);
+  nlp->AddFootprint(footprint);
+  // Sized as Ipopt sees the problem, without the initial state once it
+  // has been taken out.
+  Ipopt::Index n, m, nnz_jac, nnz_h;
+  Ipopt::TNLP::IndexStyleEnum style;
+  bool sized = Ipopt::IsValid(reduced) ? reduced->get_nlp_info(n, m, nnz_jac, nnz_h, style)
+                                       : nlp->get_nlp_info(n, m, nnz_jac, nnz_h, style);
+  if (sized) {
+    footprint.ipopt_bytes += IpoptEstimate(n, m, nnz_jac, nnz_h);
+  }
+  if (Ipopt::IsValid(reduced)) {
+    footprint.solver_bytes += sizeof(Reduced_NLP<N>);
+    reduced->AddFootprint(footprint);
+  }
+}
+
+template <size_t N>
+void MPC<N>::AddFootprint(Footprint& footprint) const {
+  const MPCSolver<N>& s = *solver_;
+  footprint.solvers++;
+  footprint.solver_bytes += sizeof(MPCSolver<N>) + s.mppi.HeapBytes() + VectorBytes(s.starts);
+  footprint.cache_bytes += s.cache.Bytes();
+  AddProblemFootprint<N>(s.nlp, s.reduced, footprint);
+  for (const auto& start : s.starts) {
+    AddProblemFootprint<N>(start.nlp, start.reduced, footprint);
+  }
+}
+
+template <class V>
+static void ReadVector(istream& in, V& v) {
+  in.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(double));
+}
+
+template <size_t N>
+bool MPC<N>::SaveState(ostream& out) const {
+  typedef Layout<N> L;
+  const MPC_Problem<N>& nlp = *solver_->nlp;
+  uint32_t sizes[2] = { uint32_t(L::nlp_vars), uint32_t(L::nlp_constraints) };
+  uint8_t warm = IpoptBackend(solver_->backend) && solver_->warm;
+  out.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+  out.write(reinterpret_cast<const char*>(&warm), sizeof(warm));
+  if (warm) {
+    WriteVector(out, nlp.x);
+    WriteVector(out, nlp.z_L);
+    WriteVector(out, nlp.z_U);
+    WriteVector(out, nlp.lambda);
+  }
+  return bool(out);
+}
+
+template <size_t N>
+bool MPC<N>::LoadState(istream& in) {
+  typedef Layout<N> L;
+  MPC_Problem<N>& nlp = *solver_->nlp;
+  uint32_t sizes[2];
+  uint8_t warm;
+  in.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+  in.read(reinterpret_cast<char*>(&warm), sizeof(warm));
+  if (!in || sizes[0] != L::nlp_vars || sizes[1] != L::nlp_constraints) {
+    return false;
+  }
+  if (!warm) {
+    return true;
+  }
+  typename MPC_Problem<N>::VarVector x;
+  typename MPC_Problem<N>::VarVector z_L;
+  typename MPC_Problem<N>::VarVector z_U;
+  typename MPC_Problem<N>::ConVector lambda;
+  ReadVector(in, x);
+  ReadVector(in, z_L);
+  ReadVector(in, z_U);
+  ReadVector(in, lambda);
+  if (!in) {
+    return false;
+  }
+  // Only the Ipopt backends take it; they shift it to the next frame as
+  // the solution of the frame before.
+  if (IpoptBackend(solver_->backend)) {
+    nlp.x = x;
+    nlp.z_L = z_L;
+    nlp.z_U = z_U;
+    nlp.lambda = lambda;
+    solver_->warm = true;
+    solver_->presolved = false;
+  }
+  return true;
+}
+
+template <size_t N>
+void MPC<N>::Presolve(const StateVector& state, const Eigen::Vector4d& coeffs,
+                      chrono::steady_clock::time_point deadline) {
+  if (!IpoptBackend(solver_->backend)) {
+    return;
+  }
+  MPC_TRACE("mpc_presolve");
+  solver_->presolving = true;
+  Solve(state, coeffs, deadline);
+  solver_->presolving = false;
+}
+
+template <size_t N>
+const typename MPC<N>::Result& MPC<N>::Solve(const StateVector& state, const Eigen::Vector4d& coeffs) {
+  return Solve(state, coeffs, chrono::steady_clock::time_point::max());
+}
+
+template <size_t N>
+const typename MPC<N>::Result& MPC<N>::Solve(const StateVector& state, const Eigen::Vector4d& coeffs,
+                                             chrono::steady_clock::time_point deadline) {
+  MPC_TRACE("mpc_solve");
+  typedef Layout<N> L;
+  auto start = chrono::steady_clock::now();
+  Result& result = solver_->result;
+  typedef typename MPC_Problem<N>::VarVector VarVector;
+  typedef typename MPC_Problem<N>::ConVector ConVector;
   bool ok = true;
-  
-  typedef CPPAD_TESTVECTOR(double) Dvector;
+  // Only for this solve.
+  const bool fixed = solver_->fixed;
+  solver_->fixed = false;
+
+  // The table, the net, the coarse problem and the obstacles are of the
+  // Cartesian problem.
+  const bool frenet = Frenet();
+  result.tabulated = false;
+  if (!frenet && solver_->table && Tabulated<N>(*solver_->table, state, coeffs, solver_->Model(), result)) {
+    // The solvers' own plans are not kept up to date meanwhile.
+    Reset();
+    result.solve_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+  }
+
+  if (solver_->backend == Backend::RTI) {
+    size_t allocs = ThreadAllocCount();
+    bool steady = solver_->warm;
+    auto cost = solver_->rti.Feedback(state, coeffs);
+    MPC_LOG(LogLevel::Debug, "Cost %g", cost);
+
+    result.ok = true;
+    result.status = Ipopt::Solve_Succeeded;
+    result.fallback = false;
+    result.usable = true;
+    result.cost = cost;
+    result.iterations = 1;
+    CopyPlan<N>(solver_->rti, result);
+    result.solve_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Everything the RTI step touches is fixed-size storage.
+    assert(!steady || ThreadAllocCount() == allocs);
+    (void)allocs;
+    (void)steady;
+    solver_->warm = true;
+    return result;
+  }
+
+  if (solver_->backend == Backend::Riccati) {
+    double cost;
+    if (solver_->max_correction > 0 && solver_->predictions < max_predictions &&
+        solver_->riccati.Predict(state, coeffs, solver_->max_correction)) {
+      cost = solver_->riccati.Cost();
+      solver_->predictions++;
+      CountEvent(Counter::SensitivityUpdates);
+    } else {
+      cost = solver_->riccati.Feedback(state, coeffs);
+      solver_->predictions = 0;
+    }
+    MPC_LOG(LogLevel::Debug, "Cost %g", cost);
+
+    result.ok = true;
+    result.status = Ipopt::Solve_Succeeded;
+    result.fallback = false;
+    result.usable = true;
+    result.cost = cost;
+    result.iterations = solver_->riccati.Iterations();
+    CopyPlan<N>(solver_->riccati, result);
+    result.solve_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+  }
+
+  if (solver_->backend == Backend::ADMM) {
+    auto cost = solver_->admm.Feedback(state, coeffs);
+    MPC_LOG(LogLevel::Debug, "Cost %g", cost);
+
+    bool converged = solver_->admm.Converged();
+    result.ok = converged;
+    result.status = converged ? Ipopt::Solve_Succeeded : Ipopt::Maximum_Iterations_Exceeded;
+    result.fallback = false;
+    result.usable = true;
+    result.cost = cost;
+    result.iterations = solver_->admm.Iterations();
+    CopyPlan<N>(solver_->admm, result);
+    result.solve_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+  }
+
+  if (solver_->backend == Backend::MPPI) {
+    auto cost = solver_->mppi.Feedback(state, coeffs);
+    MPC_LOG(LogLevel::Debug, "Cost %g, best sample weight %g", cost, solver_->mppi.WeightOfBest());
+
+    result.ok = true;
+    result.status = Ipopt::Solve_Succeeded;
+    result.fallback = false;
+    result.usable = true;
+    result.cost = cost;
+    result.iterations = 1;
+    CopyPlan<N>(solver_->mppi, result);
+    result.solve_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+  }
+
+  MPC_Problem<N>& nlp = *solver_->nlp;
 
   double x = state[0];
   double y = state[1];
@@ -130,131 +1319,404 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
   double cte = state[4];
   double epsi = state[5];
 
-  // Set the number of model variables (includes both states and inputs).
-  size_t n_vars = N * 6 + (N - 1) * 2;
-  // Set the number of constraints
-  size_t n_constraints = N * 6;
+  // The cache answers a problem whose solution it has kept, and seeds a
+  // cold solve of one in the same cell with the solution kept for it.
+  // A state far off the warm start, after a large disturbance, is solved
+  // as a cold start from the coarse problem.
+  if (solver_->coarse_start && solver_->warm && !solver_->presolved && Departed<N>(nlp.x, state)) {
+    MPC_LOG(LogLevel::Debug, "State off the warm start, starting cold from the coarse problem");
+    solver_->warm = false;
+  }
+  bool cold = !solver_->warm;
+  bool caching = solver_->cache.Capacity() > 0 && !solver_->presolving && solver_->n_obstacles == 0 && !fixed;
+  const typename SolutionCache<N>::Entry* seed = NULL;
+  if (caching) {
+    bool exact;
+    const typename SolutionCache<N>::Entry* entry = solver_->cache.Find(state, coeffs, exact);
+    if (entry && exact) {
+      nlp.x = entry->x;
+      nlp.x[L::x(0)] = x;
+      nlp.x[L::y(0)] = y;
+      nlp.x[L::psi(0)] = psi;
+      nlp.x[L::v(0)] = v;
+      nlp.x[L::cte(0)] = cte;
+      nlp.x[L::epsi(0)] = epsi;
+      nlp.z_L = entry->z_L;
+      nlp.z_U = entry->z_U;
+      nlp.lambda = entry->lambda;
+      nlp.obj_value = entry->cost;
+      nlp.status = Ipopt::SUCCESS;
+      solver_->warm = true;
+      solver_->presolved = false;
+      result.ok = true;
+      result.status = Ipopt::Solve_Succeeded;
+      result.fallback = false;
+      result.usable = true;
+      result.cost = entry->cost;
+      result.iterations = 0;
+      CopySolution(nlp, result);
+      auto elapsed = chrono::steady_clock::now() - start;
+      result.solve_time = chrono::duration<double>(elapsed).count();
+      CountEvent(Counter::CacheHits);
+      RecordStage(Stage::CacheHit, elapsed);
+      return result;
+    }
+    if (!entry) {
+      CountEvent(Counter::CacheMisses);
+    } else if (cold) {
+      seed = entry;
+      CountEvent(Counter::CacheSeeds);
+    }
+  }
 
   // Initial value of the independent variables.  
-  // Should be 0 except for the initial values.
-  Dvector vars(n_vars);
-  for (int i = 0; i < n_vars; i++) {
-    vars[i] = 0.0;
+  // Warm start from the shifted previous solution when there is one,
+  // or from the cached one, the given guess or the net's, otherwise from the
+  // coarse problem with SetCoarseStart or the curvature feedforward. A
+  // presolved solution already starts where this one does.
+  VarVector& vars = nlp.vars;
+  if (solver_->warm && solver_->presolved) {
+    ReframeSolution(nlp, 0, frenet);
+  } else if (solver_->warm) {
+    ShiftSolution(nlp, frenet);
+  } else if (seed) {
+    vars = seed->x;
+    nlp.z_L = seed->z_L;
+    nlp.z_U = seed->z_U;
+    nlp.lambda = seed->lambda;
+    solver_->guessed = false;
+  } else if (solver_->guessed || (solver_->net && !frenet)) {
+    vars.setZero();
+    if (!solver_->guessed) {
+      solver_->net->Predict(state, coeffs, solver_->guess.data());
+    }
+    solver_->guessed = false;
+    PlanGuess(nlp, state, coeffs, solver_->Model(), frenet, solver_->guess.data());
+  } else if (solver_->coarse_start && !frenet) {
+    vars.setZero();
+    CoarseGuess(*solver_, state, coeffs, this->ref_cte_, this->ref_epsi_, this->ref_v_, solver_->guess.data());
+    PlanGuess(nlp, state, coeffs, solver_->Model(), false, solver_->guess.data());
+    if (!solver_->presolving) {
+      CountEvent(Counter::CoarseStarts);
+    }
+  } else {
+    vars.setZero();
+    FeedforwardGuess(nlp, state, coeffs, solver_->Model(), frenet, this->ref_v_);
   }
   // Set the initial variable values
-  vars[x_start] = x;
-  vars[y_start] = y;
-  vars[psi_start] = psi;
-  vars[v_start] = v;
-  vars[cte_start] = cte;
-  vars[epsi_start] = epsi;
+  vars[L::x(0)] = x;
+  vars[L::y(0)] = y;
+  vars[L::psi(0)] = psi;
+  vars[L::v(0)] = v;
+  vars[L::cte(0)] = cte;
+  vars[L::epsi(0)] = epsi;
 
   // Lower and upper limits for x
-  Dvector vars_lowerbound(n_vars);
-  Dvector vars_upperbound(n_vars);
+  VarVector& vars_lowerbound = nlp.vars_lowerbound;
+  VarVector& vars_upperbound = nlp.vars_upperbound;
 
   // Set all non-actuators upper and lowerlimits
   // to the max negative and positive values.
-  for (int i = 0; i < delta_start; i++) {
-    vars_lowerbound[i] = -1.0e19;
-    vars_upperbound[i] = 1.0e19;
+  for (size_t i = 0; i < N; i++) {
+    for (size_t s = 0; s < L::n_states; s++) {
+      vars_lowerbound[L::State(s, i)] = -no_bound;
+      vars_upperbound[L::State(s, i)] = no_bound;
+    }
   }
 
   // The upper and lower limits of delta are set to -25 and 25
-  // degrees (values in radians).
+  // degrees (values in radians), and those of the
+  // acceleration/decceleration to max_a.
   // NOTE: Feel free to change this to something else.
-  for (int i = delta_start; i < a_start; i++) {
-    vars_lowerbound[i] = -0.436332;
-    vars_upperbound[i] = 0.436332;
+  for (size_t i = 0; i < N - 1; i++) {
+    vars_lowerbound[L::delta(i)] = -max_delta;
+    vars_upperbound[L::delta(i)] = max_delta;
+    vars_lowerbound[L::a(i)] = -max_a;
+    vars_upperbound[L::a(i)] = max_a;
+  }
+  if (fixed) {
+    vars[L::delta(0)] = vars_lowerbound[L::delta(0)] = vars_upperbound[L::delta(0)] = solver_->fixed_delta;
+    vars[L::a(0)] = vars_lowerbound[L::a(0)] = vars_upperbound[L::a(0)] = solver_->fixed_a;
   }
 
-  // Acceleration/decceleration upper and lower limits.
-  // NOTE: Feel free to change this to something else.
-  for (int i = a_start; i < n_vars; i++) {
-    vars_lowerbound[i] = -1.0;
-    vars_upperbound[i] = 1.0;
+  // The slacks of the soft constraints are nonnegative, and fixed at 0
+  // when their constraint is left out.
+  const SoftConstraints& soft = solver_->soft;
+  const size_t n_obstacles = frenet ? 0 : solver_->n_obstacles;
+  for (size_t i = L::cte_slack_start; i < L::nlp_vars; i++) {
+    bool used = i >= L::obstacle_slack_start ? i < ObstacleSlack<N>(n_obstacles, 1)
+                                             : (i < L::ddelta_slack_start ? soft.boundary : soft.max_ddelta) > 0;
+    vars_lowerbound[i] = 0;
+    vars_upperbound[i] = used ? no_bound : 0;
+  }
+
+  // The initial state is given: its variables are fixed, which leaves
+  // them out of what Ipopt solves for, and Reduced_NLP drops the rows
+  // below that would pin them.
+  for (size_t s = 0; s < L::n_states; s++) {
+    vars_lowerbound[L::State(s, 0)] = vars_upperbound[L::State(s, 0)] = vars[L::State(s, 0)];
   }
 
   // Lower and upper limits for the constraints
   // Should be 0 besides initial state.
-  Dvector constraints_lowerbound(n_constraints);
-  Dvector constraints_upperbound(n_constraints);
-  for (int i = 0; i < n_constraints; i++) {
-    constraints_lowerbound[i] = 0;
-    constraints_upperbound[i] = 0;
-  }
-
-  constraints_lowerbound[x_start] = x;
-  constraints_lowerbound[y_start] = y;
-  constraints_lowerbound[psi_start] = psi;
-  constraints_lowerbound[v_start] = v;
-  constraints_lowerbound[cte_start] = cte;
-  constraints_lowerbound[epsi_start] = epsi;
-
-  constraints_upperbound[x_start] = x;
-  constraints_upperbound[y_start] = y;
-  constraints_upperbound[psi_start] = psi;
-  constraints_upperbound[v_start] = v;
-  constraints_upperbound[cte_start] = cte;
-  constraints_upperbound[epsi_start] = epsi;
-
-
-  // object that computes objective and constraints
-  FG_eval fg_eval(coeffs, ref_cte_, ref_epsi_, ref_v_);
-  
-  //
-  // NOTE: You don't have to worry about these options
-  //
-  // options for IPOPT solver
-  std::string options;
-  // Uncomment this if you'd like more print information
-  options += "Integer print_level  0\n";
-  // NOTE: Setting sparse to true allows the solver to take advantage
-  // of sparse routines, this makes the computation MUCH FASTER. If you
-  // can uncomment 1 of these and see if it makes a difference or not but
-  // if you uncomment both the computation time should go up in orders of
-  // magnitude.
-  options += "Sparse  true        forward\n";
-  options += "Sparse  true        reverse\n";
-  // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
-  // Change this as you see fit.
-  options += "Numeric max_cpu_time          0.5\n";
-
-  // place to return solution
-  CppAD::ipopt::solve_result<Dvector> solution;
+  ConVector& constraints_lowerbound = nlp.constraints_lowerbound;
+  ConVector& constraints_upperbound = nlp.constraints_upperbound;
+  constraints_lowerbound.setZero();
+  constraints_upperbound.setZero();
+
+  constraints_lowerbound[L::x_row(0)] = x;
+  constraints_lowerbound[L::y_row(0)] = y;
+  constraints_lowerbound[L::psi_row(0)] = psi;
+  constraints_lowerbound[L::v_row(0)] = v;
+  constraints_lowerbound[L::cte_row(0)] = cte;
+  constraints_lowerbound[L::epsi_row(0)] = epsi;
+
+  constraints_upperbound[L::x_row(0)] = x;
+  constraints_upperbound[L::y_row(0)] = y;
+  constraints_upperbound[L::psi_row(0)] = psi;
+  constraints_upperbound[L::v_row(0)] = v;
+  constraints_upperbound[L::cte_row(0)] = cte;
+  constraints_upperbound[L::epsi_row(0)] = epsi;
+
+  // c - s <= bound and c + s >= -bound, unbounded when left out.
+  for (size_t r = L::cte_soft_start; r < L::ddelta_rate_start; r += 2) {
+    double bound = r < L::ddelta_soft_start ? soft.boundary : soft.max_ddelta;
+    if (bound <= 0) {
+      bound = no_bound;
+    }
+    constraints_lowerbound[r] = -no_bound;
+    constraints_upperbound[r] = bound;
+    constraints_lowerbound[r + 1] = -bound;
+    constraints_upperbound[r + 1] = no_bound;
+  }
+  // Hard rate limits.
+  const RateLimits& rates = solver_->rate_limits;
+  for (size_t r = L::ddelta_rate_start; r < L::obstacle_start; r++) {
+    double bound = r < L::da_rate_start ? rates.ddelta : rates.da;
+    if (bound <= 0) {
+      bound = no_bound;
+    }
+    constraints_lowerbound[r] = -bound;
+    constraints_upperbound[r] = bound;
+  }
+  // Squared distance from the obstacle of the slot at least its radius
+  // squared, unbounded for the slots left empty.
+  for (size_t k = 0; k < max_obstacles; k++) {
+    double clearance = k < n_obstacles ? pow(solver_->obstacles[k].radius, 2) : -no_bound;
+    for (size_t i = 1; i < N; i++) {
+      constraints_lowerbound[ObstacleRow<N>(k, i)] = clearance;
+      constraints_upperbound[ObstacleRow<N>(k, i)] = no_bound;
+    }
+    nlp.params[obstacles_start + 2 * k] = k < n_obstacles ? solver_->obstacles[k].x : 0;
+    nlp.params[obstacles_start + 2 * k + 1] = k < n_obstacles ? solver_->obstacles[k].y : 0;
+  }
+
+  // Bind this frame's coefficients, references and weights to the
+  // recorded tape.
+  for (size_t i = 0; i < 4; i++) {
+    nlp.params[coeffs_start + i] = coeffs[i];
+  }
+  for (size_t k = 0; k < N; k++) {
+    nlp.params[ref_cte_start + k] = solver_->ref_cte[k];
+    nlp.params[ref_epsi_start + k] = solver_->ref_epsi[k];
+    nlp.params[ref_v_start + k] = solver_->ref_v[k];
+  }
+  nlp.SetParamWeights(solver_->weights);
+  SetParamTerminalCost(nlp.params, solver_->terminal_cost);
+  nlp.params[dt_idx] = solver_->dt;
+  nlp.params[dt_growth_idx] = solver_->dt_growth;
+  nlp.params[understeer_idx] = solver_->understeer;
+  nlp.params[w_slack_idx] = soft.weight;
+  nlp.UpdateParams();
+  nlp.deadline = deadline;
+  nlp.gauss_newton = solver_->ipopt.gauss_newton;
+  if (solver_->ipopt.user_scaling) {
+    double horizon_time = 0;
+    double step = solver_->dt;
+    for (size_t k = 0; k + 1 < N; k++) {
+      horizon_time += step;
+      step *= solver_->dt_growth;
+    }
+    ScaleProblem(nlp, v, ref_v_, horizon_time);
+  }
+
+  // A warm start takes the multipliers from the previous solve too, and
+  // starts the barrier parameter small since the guess is near optimal.
+  const IpoptOptions& ipopt = solver_->ipopt;
+  bool warm = (solver_->warm || seed) && ipopt.warm_start;
+  if (warm != solver_->warm_options) {
+    Ipopt::SmartPtr<Ipopt::OptionsList> options = solver_->app->Options();
+    if (warm) {
+      options->SetStringValue("warm_start_init_point", "yes");
+      options->SetNumericValue("warm_start_bound_push", ipopt.warm_bound_push);
+      options->SetNumericValue("warm_start_mult_bound_push", ipopt.warm_bound_push);
+      options->SetNumericValue("mu_init", ipopt.warm_mu_init);
+    } else {
+      options->SetStringValue("warm_start_init_point", "no");
+      options->SetNumericValue("mu_init", ipopt.cold_mu_init);
+    }
+    solver_->warm_options = warm;
+  }
+  int max_iter = MaxIter(ipopt);
+  if (solver_->iteration_cap > 0) {
+    max_iter = std::min(max_iter, solver_->iteration_cap);
+  }
+  if (max_iter != solver_->applied_max_iter) {
+    solver_->app->Options()->SetIntegerValue("max_iter", max_iter);
+    for (size_t i = 0; i < solver_->starts.size(); i++) {
+      solver_->starts[i].app->Options()->SetIntegerValue("max_iter", max_iter);
+    }
+    solver_->applied_max_iter = max_iter;
+  }
+
+  // Hand the same problem to the extra starts, each from its own guess.
+  MPCSolver<N>* solver = solver_.get();
+  size_t n_extra = solver->single_start ? 0 : solver->starts.size();
+  if (n_extra > 0) {
+    const double deltas[] = { 0, max_delta, -max_delta };
+    for (size_t i = 0; i < n_extra; i++) {
+      MPC_Problem<N>& extra = *solver->starts[i].nlp;
+      extra.vars_lowerbound = vars_lowerbound;
+      extra.vars_upperbound = vars_upperbound;
+      extra.constraints_lowerbound = constraints_lowerbound;
+      extra.constraints_upperbound = constraints_upperbound;
+      extra.params = nlp.params;
+      extra.x_scaling = nlp.x_scaling;
+      extra.g_scaling = nlp.g_scaling;
+      extra.deadline = deadline;
+      extra.UpdateParams();
+      ConstantGuess(extra, state, coeffs, solver->Model(), frenet, deltas[i]);
+    }
+    solver->starts_pending = n_extra;
+    cppad_parallel = true;
+    for (size_t i = 0; i < n_extra; i++) {
+      solver->pool->Schedule([solver, i]() {
+        cppad_thread = solver->starts_thread + solver->pool->CurrentThreadId();
+        typename MPCSolver<N>::Start& s = solver->starts[i];
+        MPC_TRACE("ipopt_start");
+        if (s.optimized) {
+          s.status = s.app->ReOptimizeTNLP(s.reduced);
+        } else {
+          s.reduced = new Reduced_NLP<N>(s.nlp);
+          s.status = s.app->OptimizeTNLP(s.reduced);
+          s.optimized = true;
+        }
+        std::lock_guard<std::mutex> lock(solver->starts_mutex);
+        if (--solver->starts_pending == 0) {
+          solver->starts_done.notify_one();
+        }
+      });
+    }
+  }
 
   // solve the problem
-  CppAD::ipopt::solve<Dvector, FG_eval>(
-      options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-      constraints_upperbound, fg_eval, solution);
+  Ipopt::ApplicationReturnStatus status;
+  nlp.eval_time = chrono::steady_clock::duration::zero();
+  auto optimize_start = chrono::steady_clock::now();
+  {
+    MPC_TRACE("ipopt");
+    if (solver_->optimized) {
+      status = solver_->app->ReOptimizeTNLP(solver_->reduced);
+    } else {
+      solver_->reduced = new Reduced_NLP<N>(solver_->nlp);
+      status = solver_->app->OptimizeTNLP(solver_->reduced);
+      solver_->optimized = true;
+    }
+  }
+  auto optimize_time = chrono::steady_clock::now() - optimize_start;
+  if (!solver_->presolving) {
+    RecordStage(Stage::Evaluation, nlp.eval_time);
+    RecordStage(Stage::IpoptInternal, optimize_time - nlp.eval_time);
+  }
+
+  // Keep the lowest-cost feasible solution of all starts. The winner's
+  // solution and multipliers seed the next warm start. The starts are
+  // compared in order after all have finished and a tie keeps the earlier
+  // one, so the pick does not depend on which finished first.
+  if (n_extra > 0) {
+    MPC_TRACE("wait_starts");
+    std::unique_lock<std::mutex> lock(solver->starts_mutex);
+    solver->starts_done.wait(lock, [solver]() { return solver->starts_pending == 0; });
+    cppad_parallel = false;
+    for (size_t i = 0; i < n_extra; i++) {
+      const MPC_Problem<N>& extra = *solver->starts[i].nlp;
+      if (Feasible(extra) && (!Feasible(nlp) || extra.obj_value < nlp.obj_value)) {
+        MPC_LOG(LogLevel::Debug, "Start %zu: cost %g instead of %g", i + 1, extra.obj_value, nlp.obj_value);
+        nlp.status = extra.status;
+        nlp.x = extra.x;
+        nlp.z_L = extra.z_L;
+        nlp.z_U = extra.z_U;
+        nlp.lambda = extra.lambda;
+        nlp.obj_value = extra.obj_value;
+        nlp.violation = extra.violation;
+        status = solver->starts[i].status;
+      }
+    }
+  }
 
   // Check some of the solution values
-  ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
+  ok &= nlp.status == Ipopt::SUCCESS;
+  // A solve stopped by the deadline or the iteration limits still gives a
+  // usable plan if its iterate is feasible. Otherwise fall back to the
+  // shifted previous plan, which is still in vars when warm starting; its
+  // multipliers are unknown, so the next warm start begins from zero.
+  bool feasible = ok || nlp.violation <= feasible_tol;
+  bool fallback = !feasible && solver_->warm;
+  if (fallback) {
+    MPC_LOG(LogLevel::Warning, "Solve failed (status %d, violation %g), using the previous plan",
+            int(status), nlp.violation);
+    nlp.x = nlp.vars;
+    nlp.z_L.setZero();
+    nlp.z_U.setZero();
+    nlp.lambda.setZero();
+  }
+  if (!solver_->presolving) {
+    CountEvent(Counter::FallbackShifted, fallback ? 1 : 0);
+    CountEvent(Counter::DeadlineStops, status == Ipopt::User_Requested_Stop ? 1 : 0);
+  }
+  // Only a usable plan is a useful guess for the next frame.
+  solver_->warm = feasible || fallback;
+  solver_->presolved = solver_->presolving && solver_->warm;
 
   // Cost
-  auto cost = solution.obj_value;
-  std::cout << "Cost " << cost << std::endl;
+  auto cost = nlp.obj_value;
+  MPC_LOG(LogLevel::Debug, "Cost %g", cost);
 
-  // Return the actuator values.
-  return { solution.x[delta_start],   solution.x[a_start] };
+  result.ok = ok;
+  result.status = status;
+  result.fallback = fallback;
+  result.usable = feasible || fallback;
+  result.cost = cost;
+  // No statistics are kept if Ipopt stopped before iterating.
+  Ipopt::SmartPtr<Ipopt::SolveStatistics> stats = solver_->app->Statistics();
+  result.iterations = Ipopt::IsValid(stats) ? stats->IterationCount() : 0;
+  CopySolution(nlp, result);
+  if (caching && ok) {
+    solver_->cache.Insert(state, coeffs, nlp);
+  }
+  auto elapsed = chrono::steady_clock::now() - start;
+  result.solve_time = chrono::duration<double>(elapsed).count();
+  if (seed) {
+    RecordStage(Stage::CacheSeeded, elapsed);
+  } else if (cold && !solver_->presolving) {
+    RecordStage(Stage::ColdSolve, elapsed);
+  }
+  return result;
 }
 
-Eigen::VectorXd MPC::Predict(Eigen::VectorXd state, Eigen::VectorXd actuators, double dt) {
-  Eigen::VectorXd next_state(state.size());
-  
-  // extract state
-  auto x = state(0);
-  auto y = state(1);
-  auto psi = state(2);
-  auto v = state(3);
-
-  auto delta = actuators(0);
-  auto a = actuators(1);
-  // apply kinematics
-  next_state(0) = x + (v * cos(psi) * dt);
-  next_state(1) = y + (v * sin(psi) * dt);
-  next_state(2) = psi + (v / Lf * delta * dt);
-  next_state(3) = v + (a * dt);
+template <size_t N>
+PoseVector MPC<N>::Predict(const PoseVector& pose, const ActuatorVector& actuators, double dt,
+                           double understeer) {
+  PoseVector next;
+  BicycleModel<>(Lf, understeer).Advance(pose.data(), actuators.data(), dt, next.data());
+  return next;
+}
 
-  return next_state;
+template <size_t N>
+void MPC<N>::PredictBatch(PoseArrays& poses, double dt, double understeer) {
+  CpuKernels().advance_poses(poses, dt, Lf, understeer);
 }
+
+#define INSTANTIATE(N) template class MPC<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -2,17 +2,43 @@
 #define MPC_H
 
 #include <vector>
+#include <chrono>
+#include <memory>
 #include <iostream>
 #include <math.h>
 #include "Eigen-3.3/Eigen/Core"
+#include "KinematicModel.h"
+#include "SimdKernels.h"
+#include "Footprint.h"
+#include "IpoptOptions.h"
+#include "LinearConstraints.h"
+#include "ObstacleConstraints.h"
+#include "Tuning.h"
 
 using namespace std;
 
+class ControlTable;
+class WarmStartNet;
+
+// Persistent solver state (recorded tape, Ipopt problem), see MPC.cpp.
+template <size_t N>
+struct MPCSolver;
+
+// Full NLP solve with Ipopt on the recorded CppAD tape, on the
+// straight-line derivative kernels or on forward-mode AutoDiff of the
+// model step, one real-time SQP iteration per frame
+// on the condensed QP, or one SQP iteration per frame with the stage-
+// structured QP solved by Riccati recursions or by ADMM on its sparse
+// form, or path integral control over sampled rollouts. The same for
+// every horizon.
+enum class MPCBackend { Ipopt, IpoptKernels, IpoptAutoDiff, RTI, Riccati, ADMM, MPPI };
+
+// Controller over a horizon of N states. Only the horizons listed in
+// MPC_FOR_EACH_HORIZON (Layout.h) are instantiated.
+template <size_t N>
 class MPC {
  public:
-
-  size_t N_;
-  double dt_;
+  typedef MPCBackend Backend;
 
   double ref_cte_;
   double ref_epsi_;
@@ -24,11 +50,306 @@ class MPC {
 
   void Init(double cte_ref, double epsi_ref, double v_ref);
 
+  // Change the reference speed of Init alone, for the next solve; nothing
+  // happens when it is the same.
+  void SetReferenceSpeed(double v_ref);
+
+  // References of every stage, N values each of cte, epsi and speed, for
+  // one that varies along the horizon (a speed profile, the offsets of a
+  // planned path); NULL keeps the value of Init at every stage. They are
+  // parameters of the problem like the coefficients, so no tape is
+  // recorded again, and nothing happens when they are those already set.
+  // Init and SetReferenceSpeed set the same at every stage again.
+  void SetStageReferences(const double* cte_ref, const double* epsi_ref, const double* v_ref);
+
+  void SetBackend(Backend backend);
+
+  // Pose the problem of the ipopt backend in the coordinates of a
+  // reference path (see FrenetModel, Kinematics.h): the state is the arc
+  // length from where the vehicle is on the path, its offset, its heading
+  // relative to the path and its speed, with cte and epsi, and the
+  // coefficients of Solve are the curvature of the path as a cubic in
+  // the arc length instead of the reference polynomial. The plan is in
+  // the same coordinates. A new tape is recorded, and the table, the warm
+  // start net, the coarse start and the obstacles, of the Cartesian
+  // problem, sit out. False when the backend is another, which keeps its
+  // own model until it is ipopt again.
+  bool SetFrenet(bool frenet);
+
+  // Whether the solves are in the coordinates of the path.
+  bool Frenet() const;
+
+  // Cost weights of every backend, default_weights until set. They take
+  // effect from the next solve without recording the tape again. The
+  // control table is not rebuilt and keeps the weights it was built with.
+  void SetWeights(const Weights& weights);
+
+  // Time grid of the horizon: the first stage lasts dt and every later
+  // one growth times the one before, so that a grid finer near the start
+  // looks as far ahead with fewer stages. default_dt (Layout.h) and 1
+  // until set. Like the weights it needs no new tape; the next solve
+  // starts cold. The control table keeps the grid it was built with.
+  void SetTimestep(double dt, double growth = 1);
+
+  // Understeer of the model: the yaw rate of the dynamic bicycle model
+  // in the steady state of linear tires, which turns less than the
+  // kinematic one as the speed grows (see YawGain, Kinematics.h). 0, the
+  // default, is the kinematic model. A dynamic parameter of the tape, like
+  // the time grid; the control table keeps the model it was built with.
+  void SetUndersteer(double understeer);
+
+  // Add to the cost of every backend the terminal cost of the last stage
+  // (see TerminalCost.h): that of the LQR of the stage cost on the model
+  // at the last stage's reference speed and time step, recomputed when
+  // the weights, the time grid, the model or that speed change. It stands
+  // in for the stages past the horizon, so that a shorter one plans
+  // nearly what a longer one would. Off by default; the MPPI steps on a
+  // CUDA device leave it out.
+  void SetTerminalCost(bool enabled);
+
+  // Track boundary and steering rate limit of the Ipopt backends, as soft
+  // constraints with an L1 penalty on their slacks (LinearConstraints.h).
+  // None by default. They are bounds of the problem, so they take effect
+  // from the next solve with no new tape.
+  void SetSoftConstraints(const SoftConstraints& soft);
+
+  // Options of the Ipopt backends (see IpoptOptions.h), the defaults of
+  // IpoptOptions until set. They are applied once, to fresh applications,
+  // so the next solve starts Ipopt over.
+  void SetIpoptOptions(const IpoptOptions& options);
+
+  // Hard limits of the change of delta and a between stages, as linear
+  // constraints of the Ipopt backends (see RateLimits,
+  // LinearConstraints.h). None by default; like the soft constraints they
+  // take effect from the next solve.
+  void SetRateLimits(const RateLimits& limits);
+
+  // Obstacles for the next solves of the Ipopt backends to keep clear of,
+  // in the vehicle frame of the next state: the first max_obstacles
+  // (Layout.h) of obstacles fill the fixed slots of ObstacleConstraints.h,
+  // as soft constraints with the boundary's penalty. None by default; the
+  // solution cache is bypassed while there are some. The other backends
+  // ignore them.
+  void SetObstacles(const Obstacle* obstacles, size_t n);
+
+  // Hold the actuators constant over blocks of stages, e.g. 1, 1, 2, 3, 3
+  // for the ten stages of N = 11, which leaves five pairs of actuators
+  // free instead of ten (see MoveBlocks.h). Only the RTI and MPPI
+  // backends block; the others keep a pair per stage. None, the default,
+  // frees every stage.
+  void SetMoveBlocks(const std::vector<size_t>& lengths);
+
+  // Start the cold solves of the Ipopt backends that have neither a
+  // cached solution nor a guess from a coarse problem first: a few stages
+  // of large steps over the same time, solved by Gauss-Newton steps of the
+  // Riccati backend and interpolated onto the horizon. The frames whose
+  // state is far off the warm start, after a large disturbance, are solved
+  // as cold starts too. Off by default, for the curvature feedforward.
+  void SetCoarseStart(bool coarse);
+
+  // Run the Ipopt backends from up to 4 initial guesses in parallel: the
+  // warm start and, cold, the straight-line and full left and right
+  // steering plans. The lowest-cost feasible solution is kept. 1 (the
+  // default) runs the warm start only.
+  void SetMultiStart(int starts);
+
+  // Solve from the warm start alone while single, with the extra starts
+  // of SetMultiStart left idle rather than released, so that they join
+  // the next solve again at once.
+  void SetSingleStart(bool single);
+
+  // Stop the next solves of the Ipopt backends at max_iter iterations, or
+  // the limit of the options if it is lower; 0 lifts the cap. Unlike
+  // SetIpoptOptions this changes the option of the applications in
+  // place, so Ipopt carries on warm.
+  void SetIterationCap(int max_iter);
+
+  // Between full solves of the Riccati backend, update the last plan to
+  // first order for the new state and coefficients instead, with the
+  // recursion of the last solve (see RiccatiSQP::Predict), as long as no
+  // actuator changes by more than max_correction, for at most three
+  // solves in a row; a larger correction solves in full.
+  // 0, the default, always solves.
+  void SetSensitivityUpdate(double max_correction);
+
+  // Solve the QPs of the RTI and ADMM backends in single precision,
+  // refined with refinements double-precision residual corrections per
+  // solve (see RTI::SetMixedPrecision, ADMM::SetMixedPrecision). The
+  // actuators are bounded to small ranges, so float with one or two
+  // corrections is as good for them. 0, the default, solves in double.
+  void SetMixedPrecision(int refinements);
+
+  // Spread the rollouts of the MPPI backend over threads threads, the
+  // calling one included. The default is 1.
+  void SetSamplingThreads(int threads);
+
+  // Restart the random streams of the MPPI backend from seed, 0 until
+  // set (see MPPI::SetSeed).
+  void SetSamplingSeed(uint64_t seed);
+
+  // Run the rollouts of the MPPI backend on the CUDA device instead, with
+  // samples samples, or on the CPU again with 0 (see MppiDevice.h). False,
+  // staying on the CPU, in a build without MPC_CUDA or on a host without
+  // a device.
+  bool SetSamplingDevice(size_t samples);
+
+  // Answer solves inside the table's grid from it, with the first
+  // controls held over the horizon as the plan, and solve the rest. A
+  // table built for another horizon is ignored; NULL (the default)
+  // always solves.
+  void SetTable(std::shared_ptr<const ControlTable> table);
+
+  // Keep the solutions of the Ipopt backends' last capacity problems, by
+  // their state and reference quantized (see SolutionCache.h): a problem
+  // close enough to a kept one is answered with its solution, and a cold
+  // solve of one near it starts from it. The cache is cleared when the
+  // weights, time grid, model, references or constraints change, but not
+  // by Reset, so that it outlasts vehicles and laps. 0, the default,
+  // keeps none.
+  void SetSolutionCache(size_t capacity);
+
+  // Start the cold solves of the Ipopt backends from the actuators the
+  // net predicts, and the trajectory they drive the model along, instead
+  // of from the curvature feedforward. A net trained for another horizon
+  // is ignored; NULL (the default) starts from the feedforward.
+  void SetWarmStartNet(std::shared_ptr<const WarmStartNet> net);
+
+  // Forget the warm start and the previous plan, so the next solve starts
+  // cold.
+  void Reset();
+
+  // Reset, and start the next solve of the Ipopt backends from the N - 1
+  // steering and throttle values given, and the trajectory they drive the
+  // model along, unless the solution cache has one of its problem. The
+  // next Reset forgets them.
+  void SetGuess(const double* deltas, const double* accels);
+
+  // Whether the next solve of an Ipopt backend from state would start
+  // without a warm start, or from one the state has left by more than a
+  // coarse start allows (see SetCoarseStart): the solves a guess is for.
+  // False for the other backends, which take none.
+  bool NeedsGuess(const StateVector& state) const;
+
+  // Hold the first steering and throttle of the next solve of the Ipopt
+  // backends at delta and a, within their limits, as the scenarios of
+  // Controller agree on them; the later stages stay free. The solve after
+  // it, and Reset, free them again.
+  void FixFirstControl(double delta, double a);
+
+  // Write the warm start of the Ipopt backends, the last solution with its
+  // multipliers, to out, and read it back into an MPC of the same horizon
+  // and build, so that after a restart the next solve warm starts as if
+  // no time had passed. The other backends write only that they have none
+  // and start cold. Load returns false on a stream error or a state of
+  // another problem size.
+  bool SaveState(std::ostream& out) const;
+  bool LoadState(std::istream& in);
+
+  // Add the memory of this instance to footprint: its solver, the tapes
+  // and derivative structures of its Ipopt problems, the extra starts
+  // included, the estimated working set of Ipopt and the solution cache.
+  void AddFootprint(Footprint& footprint) const;
+
+  // Outcome of a solve, filled in place by every call to Solve.
+  struct Result {
+    // Whether the solve converged, and the solver status: the Ipopt
+    // ApplicationReturnStatus, or 0 (Solve_Succeeded) for the hand-written
+    // backends, or Maximum_Iterations_Exceeded when ADMM stops short of
+    // its tolerances.
+    bool ok;
+    int status;
+    // Whether the solve failed without a feasible iterate and the plan
+    // below is the previous one shifted by one step.
+    bool fallback;
+    // Whether the plan below can be applied: the solve converged, stopped
+    // short at a feasible iterate or fell back. Only a cold Ipopt solve
+    // that ends infeasible leaves a plan that cannot.
+    bool usable;
+    // Whether the controls came from the table instead of a solve; cost
+    // is then not evaluated and left at 0.
+    bool tabulated;
+    double cost;
+    int iterations;
+    // Wall time of the solve in seconds.
+    double solve_time;
+    // Predicted trajectory, in the frame of the initial state.
+    Eigen::Matrix<double, N, 1> x, y, psi, v;
+    // Actuator sequence; delta[0] and a[0] are the ones to apply.
+    Eigen::Matrix<double, N - 1, 1> delta, a;
+  };
+
   // Solve the model given an initial state and polynomial coefficients.
-  // Return the first actuations.
-  vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs);
+  // The result is valid until the next call.
+  //
+  // All buffers live in the solver and are only rewritten, so the RTI
+  // backend makes no heap allocation after its first frame (asserted when
+  // built with MPC_COUNT_ALLOCS). The Ipopt backends allocate only inside
+  // Ipopt itself.
+  const Result& Solve(const StateVector& state, const Eigen::Vector4d& coeffs);
+
+  // Solve with a hard wall-clock deadline. The Ipopt backends stop at the
+  // deadline and keep their current iterate if it is feasible; a solve
+  // that ends infeasible falls back to the shifted previous plan. The RTI
+  // Riccati, ADMM and MPPI backends run a bounded iteration and ignore the
+  // deadline.
+  const Result& Solve(const StateVector& state, const Eigen::Vector4d& coeffs,
+                      chrono::steady_clock::time_point deadline);
+
+  // Run the preparation phase of the next solve ahead of time.
+  // Only the RTI backend has one; call it between frames.
+  void Prepare();
+
+  // Bring the solver's workspace back into the caches of the calling
+  // core after an idle stretch, leaving the warm start as it is: the Ipopt
+  // backends evaluate their problem and its derivatives at the last
+  // solution, the others read their workspace. Nothing before the first
+  // solve.
+  void KeepWarm();
+
+  // Solve ahead of time from the predicted initial state of the next
+  // frame, in the frame of this one, as Solve does but in place of its
+  // result and recording no metrics. The next Solve warm starts from the
+  // solution as it is, re-expressed relative to its initial pose, instead
+  // of shifting it a stage, so that it only corrects for the difference
+  // from the state it is given. Only the Ipopt backends presolve; it is
+  // up to the deadline to end it before the frame arrives.
+  void Presolve(const StateVector& state, const Eigen::Vector4d& coeffs,
+                chrono::steady_clock::time_point deadline);
 
-  Eigen::VectorXd Predict(Eigen::VectorXd state, Eigen::VectorXd actuators, double dt);
+  // Advance [x, y, psi, v] by dt under the actuators with the kinematic
+  // model, with the given understeer; the same for every horizon.
+  static PoseVector Predict(const PoseVector& pose, const ActuatorVector& actuators, double dt,
+                            double understeer = 0);
+
+  // The same for the poses of a batch, in place and without allocating,
+  // in the vector kernel of the CPU (SimdKernels.h).
+  static void PredictBatch(PoseArrays& poses, double dt, double understeer = 0);
+
+ private:
+  unique_ptr<MPCSolver<N> > solver_;
 };
 
+// CppAD keeps its memory pools per thread. Callers that solve several MPC
+// instances at once call MPCParallelSetup before constructing them, with
+// the number of threads that will use them, the calling thread included.
+// Only the first call sizes CppAD; every call returns how many more
+// threads may still call MPCSolverThread. Each thread other than the
+// first calls MPCSolverThread once before it touches an MPC; it is false,
+// with a logged error, when no thread is left. Each instance is used by
+// one thread at a time. Multi-start pools made after the setup claim
+// threads of their own and fall back to one start when none are left.
+size_t MPCParallelSetup(size_t threads);
+bool MPCSolverThread();
+
+// Whether MPCParallelSetup has been called.
+bool MPCParallel();
+
+// Let the multithreaded linear solvers of Ipopt factor on threads threads
+// per solve: OMP_NUM_THREADS, which MA86, MA97 and Pardiso read, and
+// MKL_NUM_THREADS for the MKL Pardiso, and the cores the scheduler counts
+// per control solve (SetControlSolveCores). The solvers read the
+// environment once, so this is called at startup, before any thread
+// solves; a variable the user has set is left as it is.
+void MPCLinearSolverThreads(size_t threads);
+
 #endif /* MPC_H */
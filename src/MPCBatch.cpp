@@ -0,0 +1,897 @@
+#include "MPCBatch.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "Affinity.h"
+#include "Logger.h"
+#include "Mailbox.h"
+#include "Metrics.h"
+#include "MPC.h"
+#include "Scheduler.h"
+#include "Tenants.h"
+#include "Weights.h"
+
+using namespace std;
+
+static const char snapshot_magic[4] = { 'M', 'P', 'C', 'S' };
+static const uint32_t snapshot_version = 1;
+
+// Frames answered by the fallback in a row before one is solved anyway,
+// which also measures the solve time again.
+static const int max_downgrades = 4;
+
+// Weight of a new solve time in the estimate of the instance.
+static const double solve_alpha = 0.2;
+
+static bool LaterDeadline(const MPCBatch::Instance* a, const MPCBatch::Instance* b);
+
+static PipelineClock::duration Seconds(double seconds) {
+  return chrono::duration_cast<PipelineClock::duration>(chrono::duration<double>(seconds));
+}
+
+struct MPCBatch::Instance {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  Instance(const ControllerOptions& options, size_t index, size_t home)
+      : controller(options),
+        index(index),
+        home(home),
+        acquired(false),
+        restored(false),
+        generation(0),
+        scheduled(false),
+        period(controller.FrameInterval()),
+        solve_estimate(0),
+        downgrades(0),
+        counted_dropped(0),
+        ws(NULL),
+        framing(Framing::Text),
+        delivered(false),
+        tenant(0),
+        keep_warm(false),
+        idle_frame(false),
+        warmed(false) {}
+
+  Controller controller;
+  // Position in the batch, which tells observers the vehicles apart.
+  size_t index;
+  // The worker that solved it last, whose queue it goes to.
+  atomic<size_t> home;
+  Mailbox<Telemetry> in;
+  // Whether a vehicle holds the instance, and how many have held it. Only
+  // touched on the event loop; a worker reads generation while it has the
+  // instance scheduled, and Acquire claims it from the workers first.
+  bool acquired;
+  // Whether the controller holds the state of a snapshot, which the next
+  // Acquire keeps instead of resetting.
+  bool restored;
+  size_t generation;
+  // Set from the post that queues the instance until the worker that took
+  // it finds the mailbox empty.
+  atomic<bool> scheduled;
+  // The deadline of the frame it is queued for, set by the post that
+  // queues it, and the vehicle's frame interval in seconds, which the
+  // deadlines are taken over and its workers update.
+  PipelineClock::time_point deadline;
+  atomic<double> period;
+  // Recent solve time, in seconds, and frames answered by the fallback in
+  // a row; only touched by the worker that has the instance scheduled.
+  double solve_estimate;
+  int downgrades;
+  // Dropped frames of the mailbox already counted in the metrics; only
+  // touched by the worker that has the instance scheduled.
+  size_t counted_dropped;
+  // Arrival, socket and framing of the last frame posted other than a
+  // tick, which the ticks are sent as; only touched on the event loop.
+  PipelineClock::time_point last_post;
+  uWS::WebSocket<uWS::SERVER>* ws;
+  Framing framing;
+  // Whether the vehicle that holds it has had a command, whose plan the
+  // follow-ups take; only touched on the event loop.
+  bool delivered;
+  // The waypoints its vehicle's waypoints frames build on; only touched on
+  // the event loop.
+  WaypointWindow waypoints;
+  // The session of the vehicle that holds or last held it, empty for
+  // none, and when it was released; only touched on the event loop.
+  string session;
+  PipelineClock::time_point released;
+  // The tenant of the vehicle that holds it (see Tenants.h); set by
+  // Acquire, read by the worker that has the instance scheduled.
+  size_t tenant;
+  // Set by KeepWarm to have the worker that takes the instance without a
+  // frame keep its controller warm, and by the post of the first frame
+  // after an idle gap, for its worker to record the solve as such.
+  atomic<bool> keep_warm;
+  atomic<bool> idle_frame;
+  // Whether the controller was kept warm since its last solve; only
+  // touched by the worker that has the instance scheduled.
+  bool warmed;
+  // When KeepWarm last scheduled it; only touched on the event loop.
+  PipelineClock::time_point last_warm;
+};
+
+struct MPCBatch::Query {
+  uWS::WebSocket<uWS::SERVER>* client;
+  uint64_t id;
+  size_t horizon;
+  Framing framing;
+  vector<OfflineProblem> problems;
+  // Written by the worker that solves each problem.
+  vector<OfflineSolution> solutions;
+  // Under query_mutex_: the next problem to take, those solved and not
+  // yet sent, the number sent, and whether the client went away.
+  size_t next;
+  vector<uint32_t> solved;
+  size_t sent;
+  bool cancelled;
+};
+
+MPCBatch::MPCBatch(uS::Loop* loop, size_t capacity, size_t workers, const ControllerOptions& options,
+                   Sink deliver, int first_cpu)
+    : deliver_(deliver),
+      shadow_(NULL),
+      session_grace_(std::chrono::seconds(5)),
+      idle_gap_(std::chrono::seconds(1)),
+      stop_(false),
+      first_cpu_(first_cpu),
+      job_generation_(0),
+      job_pending_(0),
+      parallel_(false),
+      out_size_(0),
+      async_(new uS::Async(loop)),
+      query_problems_(0) {
+  // A single worker runs CppAD as thread 0, like the event loop thread
+  // that records the tapes before it starts, and may run multi-start.
+  // Several workers, or several batches, need CppAD in parallel mode, and
+  // so do the planners of the two-rate mode and the candidate references,
+  // threads of their own in every controller.
+  workers = max<size_t>(workers, 1);
+  ControllerOptions batch_options = options;
+  parallel_ = workers > 1 || MPCParallel() || ControllerThreads(options) > 0;
+  if (parallel_) {
+    size_t planners = ControllerThreads(options) * capacity;
+    size_t free = MPCParallelSetup(workers + 1 + planners);
+    if (free < workers + planners) {
+      size_t left = free - min(free, planners);
+      MPC_LOG(LogLevel::Warning, "CppAD supports %zu more threads, using %zu workers", free,
+              max<size_t>(left, 1));
+      workers = max<size_t>(left, 1);
+    }
+    batch_options.multi_start = 1;
+  }
+  // Every queued instance has a slot, if need be on another worker's queue.
+  if (capacity > workers * 1024) {
+    MPC_LOG(LogLevel::Warning, "The queues of %zu workers hold %zu instances, not %zu", workers, workers * 1024,
+            capacity);
+    capacity = workers * 1024;
+  }
+
+  instances_.resize(capacity);
+  // The controllers of the queries solve nothing but cold problems, on
+  // their worker's thread alone.
+  query_options_ = batch_options;
+  query_options_.candidate_offsets.clear();
+  query_options_.scenarios.clear();
+  query_options_.two_rate = false;
+  query_options_.adaptive_horizon = false;
+  query_options_.load_shedding = false;
+  query_options_.speculate = false;
+  // Their problems are in the vehicle frame, with no path to solve along.
+  query_options_.frenet = false;
+  query_options_.memory_budget = 0;
+  query_controllers_.resize(workers);
+  nodes_.assign(workers, -1);
+  busy_.reset(new atomic<bool>[workers]);
+  waiters_.reset(new Eigen::MaxSizeVector<Eigen::EventCount::Waiter>(workers));
+  waiters_->resize(workers);
+  ready_.reset(new Eigen::EventCount(*waiters_));
+  for (size_t i = 0; i < workers; i++) {
+    queues_.emplace_back(new Queue());
+    deadlines_.emplace_back(new Deadlines());
+    busy_[i] = false;
+  }
+
+  async_->setData(this);
+  async_->start(OnAsync);
+  for (size_t i = 0; i < workers; i++) {
+    threads_.emplace_back(&MPCBatch::Run, this, i);
+  }
+  // Every worker constructs the instances it starts with.
+  OnWorkers([this, &batch_options, workers](size_t worker) {
+    for (size_t i = worker; i < instances_.size(); i += workers) {
+      instances_[i].reset(new Instance(batch_options, i, worker));
+    }
+  });
+  size_t nodes = 0;
+  for (size_t i = 0; i < workers; i++) {
+    nodes += find(nodes_.begin(), nodes_.begin() + i, nodes_[i]) == nodes_.begin() + i;
+  }
+  if (nodes > 1) {
+    MPC_LOG(LogLevel::Info, "The batch workers span %zu NUMA nodes", nodes);
+  }
+}
+
+void MPCBatch::OnWorkers(const function<void(size_t)>& job) {
+  unique_lock<mutex> lock(job_mutex_);
+  job_ = job;
+  job_pending_ = threads_.size();
+  job_generation_++;
+  ready_->Notify(true);
+  job_done_.wait(lock, [this]() { return job_pending_ == 0; });
+  job_ = nullptr;
+}
+
+MPCBatch::~MPCBatch() {
+  stop_ = true;
+  ready_->Notify(true);
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  // The queues must be empty when they go.
+  for (auto& queue : queues_) {
+    while (queue->PopFront()) {
+    }
+  }
+  // The handle frees itself once the loop has closed it.
+  async_->close();
+}
+
+void MPCBatch::WarmUp(const Track& track, size_t solves) {
+  if (solves == 0) {
+    return;
+  }
+  // Each worker warms up the instances it has, whose workspaces the first
+  // solves allocate.
+  vector<vector<double> > times(instances_.size());
+  OnWorkers([this, &track, solves, &times](size_t worker) {
+    for (size_t i = 0; i < instances_.size(); i++) {
+      if (instances_[i]->home.load() == worker) {
+        instances_[i]->controller.WarmUp(track, solves, times[i]);
+      }
+    }
+  });
+  vector<double> first;
+  vector<double> rest;
+  for (const vector<double>& instance_times : times) {
+    first.push_back(instance_times[0]);
+    rest.insert(rest.end(), instance_times.begin() + 1, instance_times.end());
+  }
+  sort(first.begin(), first.end());
+  double median = 0;
+  if (!rest.empty()) {
+    nth_element(rest.begin(), rest.begin() + rest.size() / 2, rest.end());
+    median = rest[rest.size() / 2];
+  }
+  MPC_LOG(LogLevel::Info, "Warmed up %zu controllers with %zu solves: first solve %.2f ms (median), then %.2f ms (median)",
+          instances_.size(), solves, first[first.size() / 2] * 1000, median * 1000);
+}
+
+void MPCBatch::SetRealtime(int priority) {
+  for (size_t i = 0; i < threads_.size(); i++) {
+    if (!SetThreadRealtime(threads_[i].native_handle(), priority)) {
+      MPC_LOG(LogLevel::Warning, "Could not run worker %zu at real-time priority %d", i, priority);
+    }
+  }
+}
+
+MPCBatch::Instance* MPCBatch::Acquire(const VizEncoding& viz, const string& session, const string& tenant) {
+  // The free instances in the order they are taken: the session's own if
+  // it is still held for it, those held for no session, then the others
+  // by the time they were released.
+  PipelineClock::time_point now = PipelineClock::now();
+  Instance* resumed = NULL;
+  vector<Instance*> free;
+  vector<Instance*> held;
+  for (auto& instance : instances_) {
+    if (instance->acquired) {
+      continue;
+    }
+    if (instance->session.empty() || now - instance->released >= session_grace_) {
+      free.push_back(instance.get());
+    } else if (!session.empty() && instance->session == session) {
+      resumed = instance.get();
+    } else {
+      held.push_back(instance.get());
+    }
+  }
+  sort(held.begin(), held.end(), [](const Instance* a, const Instance* b) { return a->released < b->released; });
+  if (resumed) {
+    free.insert(free.begin(), resumed);
+  }
+  free.insert(free.end(), held.begin(), held.end());
+
+  for (Instance* instance : free) {
+    // Claim the instance from the workers: a released one may still be
+    // finishing its last frames.
+    if (instance->scheduled.exchange(true)) {
+      continue;
+    }
+    Telemetry stale;
+    instance->in.Take(stale);
+    if (instance == resumed) {
+      CountEvent(Counter::BatchResumes);
+      MPC_LOG(LogLevel::Info, "Session %s resumed on controller %zu", session.c_str(), instance->index);
+    } else if (!instance->restored) {
+      instance->controller.Reset();
+    }
+    instance->controller.SetVizEncoding(viz);
+    instance->session = session;
+    instance->tenant = TenantIndex(tenant);
+    instance->restored = false;
+    instance->last_post = PipelineClock::time_point();
+    instance->last_warm = PipelineClock::time_point();
+    instance->keep_warm = false;
+    instance->idle_frame = false;
+    instance->warmed = false;
+    instance->delivered = false;
+    instance->waypoints.n = 0;
+    instance->acquired = true;
+    instance->generation++;
+    instance->scheduled.store(false);
+    return instance;
+  }
+  return NULL;
+}
+
+bool MPCBatch::SaveSnapshot(const string& path) {
+  // Written aside and renamed over path, so that a crash midway leaves
+  // the last snapshot whole.
+  string temporary = path + ".tmp";
+  ofstream out(temporary.c_str(), ios::binary);
+  Weights weights;
+  CurrentWeights(weights);
+  string text = FormatWeights(weights);
+  uint32_t length = uint32_t(text.size());
+  uint32_t count = 0;
+  for (auto& instance : instances_) {
+    count += instance->acquired;
+  }
+  out.write(snapshot_magic, sizeof(snapshot_magic));
+  out.write(reinterpret_cast<const char*>(&snapshot_version), sizeof(snapshot_version));
+  out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+  out.write(text.data(), length);
+  out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  bool ok = bool(out);
+  for (auto& instance : instances_) {
+    if (!ok) {
+      break;
+    }
+    if (!instance->acquired) {
+      continue;
+    }
+    // Claim it like Acquire, waiting for the worker solving it to finish.
+    while (instance->scheduled.exchange(true)) {
+      this_thread::yield();
+    }
+    ok = instance->controller.SaveState(out);
+    // Queue it again if a frame came in meanwhile, as Post would have.
+    instance->scheduled.store(false);
+    if (instance->in.HasNew() && !instance->scheduled.exchange(true)) {
+      Schedule(instance.get());
+    }
+  }
+  out.close();
+  if (!ok || !out || rename(temporary.c_str(), path.c_str()) != 0) {
+    remove(temporary.c_str());
+    return false;
+  }
+  MPC_LOG(LogLevel::Info, "Saved a snapshot of %u controllers to %s", count, path.c_str());
+  return true;
+}
+
+void MPCBatch::AddFootprint(Footprint& footprint) {
+  footprint.connection_bytes += sizeof(MPCBatch) + VectorBytes(instances_) +
+                                queues_.size() * (sizeof(Queue) + sizeof(Deadlines)) +
+                                threads_.size() * sizeof(atomic<bool>);
+  for (auto& deadlines : deadlines_) {
+    lock_guard<mutex> lock(deadlines->mutex);
+    footprint.connection_bytes += VectorBytes(deadlines->heap);
+  }
+  {
+    lock_guard<mutex> lock(out_mutex_);
+    footprint.connection_bytes += VectorBytes(out_);
+    for (const auto& reply : out_) {
+      footprint.connection_bytes += reply.command.msg.capacity();
+    }
+  }
+  // delivering_ is only touched by Drain, on the event loop.
+  footprint.connection_bytes += VectorBytes(delivering_);
+  for (const auto& reply : delivering_) {
+    footprint.connection_bytes += reply.command.msg.capacity();
+  }
+  for (auto& instance : instances_) {
+    while (instance->scheduled.exchange(true)) {
+      this_thread::yield();
+    }
+    footprint.connection_bytes += sizeof(Instance) - sizeof(Controller);
+    instance->controller.AddFootprint(footprint);
+    instance->scheduled.store(false);
+    if (instance->in.HasNew() && !instance->scheduled.exchange(true)) {
+      Schedule(instance.get());
+    }
+  }
+}
+
+bool MPCBatch::LoadSnapshot(const string& path, bool weights) {
+  ifstream in(path.c_str(), ios::binary);
+  char magic[4];
+  uint32_t version;
+  uint32_t length;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  in.read(reinterpret_cast<char*>(&length), sizeof(length));
+  if (!in || memcmp(magic, snapshot_magic, sizeof(magic)) != 0 || version != snapshot_version ||
+      length > 65536) {
+    return false;
+  }
+  string text(length, '\0');
+  uint32_t count;
+  in.read(&text[0], length);
+  in.read(reinterpret_cast<char*>(&count), sizeof(count));
+  Weights snapshot_weights = default_weights;
+  string error;
+  if (!in || !ParseWeights(text, snapshot_weights, error)) {
+    return false;
+  }
+  size_t restored = 0;
+  for (size_t i = 0; i < count && i < instances_.size(); i++) {
+    if (!instances_[i]->controller.LoadState(in)) {
+      MPC_LOG(LogLevel::Warning, "Snapshot %s is cut short after %zu controllers", path.c_str(), i);
+      break;
+    }
+    instances_[i]->restored = true;
+    restored++;
+  }
+  if (weights) {
+    SetCurrentWeights(snapshot_weights);
+  }
+  MPC_LOG(LogLevel::Info, "Restored %zu of %u controllers from %s", restored, count, path.c_str());
+  return true;
+}
+
+void MPCBatch::Release(Instance* instance) {
+  instance->acquired = false;
+  instance->released = PipelineClock::now();
+}
+
+void MPCBatch::Post(Instance* instance, Telemetry& frame) {
+  if (!frame.tick) {
+    if (instance->last_post != PipelineClock::time_point() && frame.received - instance->last_post >= idle_gap_) {
+      instance->idle_frame = true;
+    }
+    instance->last_post = frame.received;
+    instance->ws = frame.ws;
+    instance->framing = frame.framing;
+  }
+  instance->in.Publish(frame);
+  if (!instance->scheduled.exchange(true)) {
+    if (TenantCount() > 1) {
+      WakeTenant(instance->tenant);
+    }
+    instance->deadline = frame.received + Seconds(instance->period.load());
+    Schedule(instance);
+  }
+}
+
+void MPCBatch::Schedule(Instance* instance) {
+  // Its home queue, or the next one with room.
+  const size_t n = queues_.size();
+  const size_t home = instance->home.load();
+  for (size_t i = 0; i < n; i++) {
+    if (queues_[(home + i) % n]->PushBack(instance) == NULL) {
+      break;
+    }
+  }
+  // Waking them all lets the home worker have it when idle; the others
+  // only steal from a busy one and go back to sleep.
+  ready_->Notify(true);
+}
+
+static bool LaterDeadline(const MPCBatch::Instance* a, const MPCBatch::Instance* b) {
+  return a->deadline > b->deadline;
+}
+
+// The instance of the earliest deadline of worker, after moving its queue
+// into the heap: from the front by the worker itself, from the back by a
+// thief; with several tenants, the earliest of the tenant of the least
+// virtual time. NULL when there is none.
+MPCBatch::Instance* MPCBatch::Earliest(size_t worker, bool owner) {
+  Queue& queue = *queues_[worker];
+  Deadlines& deadlines = *deadlines_[worker];
+  lock_guard<mutex> lock(deadlines.mutex);
+  while (Instance* instance = owner ? queue.PopFront() : queue.PopBack()) {
+    deadlines.heap.push_back(instance);
+    push_heap(deadlines.heap.begin(), deadlines.heap.end(), LaterDeadline);
+  }
+  if (deadlines.heap.empty()) {
+    return NULL;
+  }
+  Instance* instance;
+  if (TenantCount() > 1) {
+    // The virtual times change as the solves are charged, so they are
+    // compared afresh; the heaps hold a few instances.
+    vector<Instance*>& heap = deadlines.heap;
+    size_t best = 0;
+    double best_time = TenantVirtualTime(heap[0]->tenant);
+    for (size_t i = 1; i < heap.size(); i++) {
+      double time = TenantVirtualTime(heap[i]->tenant);
+      if (time < best_time || (time == best_time && heap[i]->deadline < heap[best]->deadline)) {
+        best = i;
+        best_time = time;
+      }
+    }
+    instance = heap[best];
+    heap[best] = heap.back();
+    heap.pop_back();
+    make_heap(heap.begin(), heap.end(), LaterDeadline);
+    PickTenant(instance->tenant);
+  } else {
+    pop_heap(deadlines.heap.begin(), deadlines.heap.end(), LaterDeadline);
+    instance = deadlines.heap.back();
+    deadlines.heap.pop_back();
+  }
+  deadlines.size = deadlines.heap.size();
+  return instance;
+}
+
+// Whether worker has instances waiting, in its queue or its heap.
+bool MPCBatch::Waiting(size_t worker) const {
+  return !queues_[worker]->Empty() || deadlines_[worker]->size.load() > 0;
+}
+
+// Whether worker may steal from victim: a busy worker of its own node,
+// whose instances' memory is local to both.
+bool MPCBatch::Stealable(size_t worker, size_t victim) const {
+  // busy_ is read first: a worker is busy only once it has set its node.
+  return victim != worker && busy_[victim].load() && nodes_[victim] == nodes_[worker];
+}
+
+MPCBatch::Instance* MPCBatch::Steal(size_t worker) {
+  const size_t n = queues_.size();
+  for (size_t i = 1; i < n; i++) {
+    size_t victim = (worker + i) % n;
+    if (!Stealable(worker, victim)) {
+      continue;
+    }
+    Instance* instance = Earliest(victim, false);
+    if (instance) {
+      CountEvent(Counter::BatchSteals);
+      return instance;
+    }
+  }
+  return NULL;
+}
+
+void MPCBatch::Submit(uWS::WebSocket<uWS::SERVER>* client, uint64_t id, size_t horizon, Framing framing,
+                      vector<OfflineProblem>& problems) {
+  shared_ptr<Query> query(new Query);
+  query->client = client;
+  query->id = id;
+  query->horizon = horizon;
+  query->framing = framing;
+  query->problems.swap(problems);
+  query->solutions.resize(query->problems.size());
+  query->next = 0;
+  query->sent = 0;
+  query->cancelled = false;
+  {
+    lock_guard<mutex> lock(query_mutex_);
+    queries_.push_back(query);
+    query_problems_ += query->problems.size();
+  }
+  ready_->Notify(true);
+}
+
+void MPCBatch::CancelQueries(uWS::WebSocket<uWS::SERVER>* client) {
+  lock_guard<mutex> lock(query_mutex_);
+  for (size_t i = 0; i < queries_.size();) {
+    Query& query = *queries_[i];
+    if (query.client != client) {
+      i++;
+      continue;
+    }
+    query_problems_ -= query.problems.size() - query.next;
+    query.next = query.problems.size();
+    query.cancelled = true;
+    queries_.erase(queries_.begin() + i);
+  }
+}
+
+// Solve the next problem of the oldest query that has one left on the
+// controller of worker; false when there is none.
+bool MPCBatch::SolveQuery(size_t worker) {
+  if (query_problems_.load() == 0) {
+    return false;
+  }
+  shared_ptr<Query> query;
+  size_t i = 0;
+  {
+    lock_guard<mutex> lock(query_mutex_);
+    for (const shared_ptr<Query>& queued : queries_) {
+      if (queued->next < queued->problems.size()) {
+        query = queued;
+        i = query->next++;
+        query_problems_--;
+        break;
+      }
+    }
+  }
+  if (!query) {
+    return false;
+  }
+  unique_ptr<Controller>& controller = query_controllers_[worker];
+  if (!controller) {
+    controller.reset(new Controller(query_options_));
+  }
+  // Others may take the vehicles queued to a worker busy with a query.
+  busy_[worker] = true;
+  controller->SolveOffline(query->problems[i], query->horizon, query->solutions[i]);
+  busy_[worker] = false;
+  CountEvent(Counter::OfflineSolves);
+  {
+    lock_guard<mutex> lock(query_mutex_);
+    if (!query->cancelled) {
+      query->solved.push_back(uint32_t(i));
+    }
+  }
+  async_->send();
+  return true;
+}
+
+void MPCBatch::Tick(PipelineClock::time_point now, PipelineClock::duration max_age) {
+  Telemetry tick;
+  for (auto& instance : instances_) {
+    if (!instance->acquired || instance->last_post == PipelineClock::time_point() ||
+        now - instance->last_post > max_age) {
+      continue;
+    }
+    if (instance->scheduled.load() || instance->in.HasNew()) {
+      CountEvent(Counter::MissedTicks);
+      continue;
+    }
+    tick.tick = true;
+    tick.ws = instance->ws;
+    tick.framing = instance->framing;
+    tick.received = now;
+    tick.arrived = now;
+    Post(instance.get(), tick);
+  }
+}
+
+void MPCBatch::KeepWarm(PipelineClock::time_point now) {
+  for (auto& instance : instances_) {
+    if (!instance->acquired || instance->last_post == PipelineClock::time_point() ||
+        now - instance->last_post < idle_gap_ || now - instance->last_warm < idle_gap_) {
+      continue;
+    }
+    // Only the home worker's caches are worth warming, and only when it
+    // has nothing else to do.
+    if (instance->scheduled.load() || busy_[instance->home.load()].load()) {
+      continue;
+    }
+    instance->last_warm = now;
+    instance->keep_warm = true;
+    if (!instance->scheduled.exchange(true)) {
+      // Behind every frame due before the next gap.
+      instance->deadline = now + idle_gap_;
+      Schedule(instance.get());
+    }
+  }
+}
+
+void MPCBatch::FollowUp(PipelineClock::time_point now, PipelineClock::duration min_gap,
+                        PipelineClock::duration max_age, const FollowUpSink& send) {
+  for (auto& instance : instances_) {
+    if (!instance->acquired || !instance->delivered || now - instance->last_post > max_age) {
+      continue;
+    }
+    if (instance->controller.FollowUp(now, min_gap, instance->framing, follow_msg_)) {
+      CountEvent(Counter::FollowUps);
+      send(instance->ws, follow_msg_, instance->framing);
+    }
+  }
+}
+
+WaypointWindow& MPCBatch::Waypoints(Instance* instance) {
+  return instance->waypoints;
+}
+
+bool MPCBatch::LatestPlan(size_t vehicle, PublishedPlan& plan) const {
+  return vehicle < instances_.size() && instances_[vehicle]->acquired &&
+         instances_[vehicle]->controller.LatestPlan(plan);
+}
+
+void MPCBatch::Run(size_t worker) {
+  if (first_cpu_ >= 0 && !PinCurrentThread(first_cpu_ + int(worker))) {
+    MPC_LOG(LogLevel::Warning, "Could not pin worker %zu to CPU %d", worker, first_cpu_ + int(worker));
+  }
+  nodes_[worker] = CurrentNode();
+  if (parallel_) {
+    MPCSolverThread();
+  }
+  Eigen::EventCount::Waiter* waiter = &(*waiters_)[worker];
+  Telemetry frame;
+  Reply reply;
+  size_t job_generation = 0;
+  for (;;) {
+    if (stop_.load()) {
+      return;
+    }
+    if (job_generation_.load() != job_generation) {
+      job_generation = job_generation_.load();
+      job_(worker);
+      lock_guard<mutex> lock(job_mutex_);
+      if (--job_pending_ == 0) {
+        job_done_.notify_one();
+      }
+      continue;
+    }
+    Instance* instance = Earliest(worker, true);
+    if (!instance) {
+      instance = Steal(worker);
+    }
+    if (!instance && SolveQuery(worker)) {
+      continue;
+    }
+    if (!instance) {
+      // Look again once registered as a waiter, so that no post between
+      // the look and the wait goes unseen; a steal can fail spuriously.
+      ready_->Prewait(waiter);
+      bool found = stop_.load() || job_generation_.load() != job_generation || Waiting(worker) ||
+                   query_problems_.load() > 0;
+      for (size_t i = 0; i < queues_.size() && !found; i++) {
+        found = Stealable(worker, i) && Waiting(i);
+      }
+      if (found) {
+        ready_->CancelWait(waiter);
+      } else {
+        ready_->CommitWait(waiter);
+      }
+      continue;
+    }
+    instance->home.store(worker);
+    busy_[worker] = true;
+    // Let the idle workers take what is left behind it.
+    if (Waiting(worker)) {
+      ready_->Notify(true);
+    }
+
+    if (instance->in.Take(frame)) {
+      instance->keep_warm = false;
+      Command& command = reply.command;
+      command.ws = frame.ws;
+      command.framing = frame.framing;
+      command.received = frame.received;
+      command.arrived = frame.arrived;
+      command.posted = instance->in.Published();
+      command.dropped = instance->in.Dropped();
+      command.observation.vehicle = instance->index;
+      CountEvent(Counter::DroppedFrames, command.dropped - instance->counted_dropped);
+      instance->counted_dropped = command.dropped;
+      // Admission against the deadline of the frame taken, which may be
+      // newer than the one the instance was queued for.
+      const PipelineClock::time_point start = PipelineClock::now();
+      if (!frame.tick) {
+        RecordStage(Stage::Queue, start - frame.received);
+      }
+      const PipelineClock::time_point deadline = frame.received + Seconds(instance->period.load());
+      bool admitted =
+          instance->downgrades >= max_downgrades || start + Seconds(instance->solve_estimate) <= deadline;
+      double cpu = ThreadCpuSeconds();
+      {
+        ControlScope control;
+        instance->controller.Solve(frame, command, admitted);
+      }
+      command.solved = PipelineClock::now();
+      if (instance->idle_frame.exchange(false)) {
+        RecordStage(instance->warmed ? Stage::IdleWarm : Stage::IdleCold, command.solved - start);
+      }
+      instance->warmed = false;
+      ChargeTenant(instance->tenant, ThreadCpuSeconds() - cpu,
+                   chrono::duration<double>(command.solved - start).count());
+      if (admitted) {
+        instance->solve_estimate += solve_alpha * (chrono::duration<double>(command.solved - start).count() -
+                                                   instance->solve_estimate);
+        instance->downgrades = 0;
+        CountEvent(Counter::BatchDeadlineMisses, command.solved > deadline ? 1 : 0);
+      } else {
+        instance->downgrades++;
+        CountEvent(Counter::BatchDowngrades);
+      }
+      instance->period = instance->controller.FrameInterval();
+      reply.instance = instance;
+      reply.generation = instance->generation;
+      if (shadow_ && !frame.tick) {
+        shadow_->Submit(instance->index, instance->generation, frame, command);
+      }
+      {
+        lock_guard<mutex> lock(out_mutex_);
+        if (out_size_ == out_.size()) {
+          out_.emplace_back();
+        }
+        swap(out_[out_size_++], reply);
+      }
+      async_->send();
+
+      // The speculative work of the next frame gives way to the solves of
+      // the instances waiting.
+      if (!Waiting(worker)) {
+        instance->controller.Prepare();
+      }
+    } else if (instance->keep_warm.exchange(false)) {
+      instance->controller.KeepWarm();
+      instance->warmed = true;
+      CountEvent(Counter::KeepWarms);
+    }
+    // A frame posted since the take found the instance still scheduled
+    // and did not queue it, so queue it here, behind any earlier deadline
+    // of the heap; the frame came in by now.
+    instance->scheduled.store(false);
+    if (instance->in.HasNew() && !instance->scheduled.exchange(true)) {
+      instance->deadline = PipelineClock::now() + Seconds(instance->period.load());
+      Deadlines& deadlines = *deadlines_[worker];
+      lock_guard<mutex> lock(deadlines.mutex);
+      deadlines.heap.push_back(instance);
+      push_heap(deadlines.heap.begin(), deadlines.heap.end(), LaterDeadline);
+      deadlines.size = deadlines.heap.size();
+    }
+    busy_[worker] = false;
+  }
+}
+
+void MPCBatch::Drain() {
+  size_t n;
+  {
+    lock_guard<mutex> lock(out_mutex_);
+    swap(out_, delivering_);
+    n = out_size_;
+    out_size_ = 0;
+  }
+  for (size_t i = 0; i < n; i++) {
+    Reply& reply = delivering_[i];
+    if (reply.instance->acquired && reply.instance->generation == reply.generation) {
+      deliver_(reply.instance->controller, reply.command);
+      reply.instance->delivered = true;
+    }
+  }
+  DrainQueries();
+  if (!observe_) {
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    Reply& reply = delivering_[i];
+    if (reply.instance->acquired && reply.instance->generation == reply.generation) {
+      observe_(reply.instance->controller, reply.command);
+    }
+  }
+}
+
+// Send the solutions of every query solved since the last drain, and let
+// go of the queries answered in full.
+void MPCBatch::DrainQueries() {
+  lock_guard<mutex> lock(query_mutex_);
+  for (size_t i = 0; i < queries_.size();) {
+    Query& query = *queries_[i];
+    if (!query.solved.empty()) {
+      swap(query.solved, query_indices_);
+      query.solved.clear();
+      query.sent += query_indices_.size();
+      WriteBinarySolutions(query_msg_, query.framing, query.id, query.horizon, query.solutions.data(),
+                           query_indices_.data(), query_indices_.size());
+      query_sink_(query.client, query_msg_);
+    }
+    if (query.sent == query.problems.size()) {
+      queries_.erase(queries_.begin() + i);
+    } else {
+      i++;
+    }
+  }
+}
+
+void MPCBatch::OnAsync(uS::Async* async) {
+  static_cast<MPCBatch*>(async->getData())->Drain();
+}
@@ -0,0 +1,313 @@
+#ifndef MPC_BATCH_H
+#define MPC_BATCH_H
+
+#include <uWS/uWS.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Controller.h"
+#include "BinaryProtocol.h"
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+#include "Pipeline.h"
+#include "Shadow.h"
+#include "Telemetry.h"
+
+// Many independent controllers solved in parallel on a pool of worker
+// threads, one per simulated vehicle.
+//
+// Each instance owns a Controller (its MPC with its coefficients,
+// references and warm start, and all solver workspaces) and a lock-free
+// latest-value mailbox: a frame posted while another is waiting replaces
+// it, so the controller always works on the freshest state and bursts
+// never build a backlog. Posting a frame queues the instance
+// for the workers unless it is queued or being solved already; the worker
+// that takes it solves its freshest frame, so an instance is never solved
+// by two workers at once, while different instances are solved
+// concurrently. The event loop only parses and posts frames; commands go
+// back to it through one async handle, so network I/O overlaps with the
+// solves.
+//
+// Every worker has a work-stealing queue of its own (Eigen's RunQueue,
+// as in its NonBlockingThreadPool), and an instance is queued to the
+// worker that solved it last, so that its tapes and warm start stay in
+// that core's caches. Solves are scheduled earliest deadline first: a
+// worker moves its queue into a heap ordered by deadline, the arrival of
+// the frame plus the vehicle's frame interval, and solves the earliest.
+// With none left it takes the earliest of a worker that is busy solving,
+// and the instance stays with it from then on. Idle workers sleep on an
+// EventCount, which a post wakes.
+//
+// Every vehicle belongs to a tenant (see Tenants.h), charged with the
+// time of its solves. With more than one tenant a worker takes the
+// earliest deadline of the tenant of the least virtual time among those
+// it has waiting, rather than the earliest of all, so that the tenants
+// share the workers by their weights however costly their solves are.
+//
+// Admission control keeps the latency of each vehicle bounded under
+// load: a frame whose solve, at the instance's recent solve times, would
+// end after its deadline is answered by the pure pursuit instead (see
+// Controller::Solve), at most a few frames in a row, so that a slow
+// stretch of solves cannot lock a vehicle out of the MPC.
+//
+// Instances are constructed up front (recording their tapes) and handed
+// out by Acquire and Release, so connecting a vehicle costs no more than
+// a reset. Each is constructed, and warmed up, by its first worker, so
+// that on a host of several NUMA nodes the pages of its tapes, solver
+// workspaces and warm start are first touched, and so placed, on that
+// worker's node; the workers only steal from workers of their own node. The hand-written backends share no state between instances;
+// the Ipopt backends additionally need a thread-safe linear solver.
+//
+// The workers also solve offline queries, batches of problems that tools
+// submit to be solved cold (see Submit), when they find no vehicle to
+// solve: one problem at a time, on a controller of every worker's own
+// that no vehicle holds, so that a query delays a vehicle by one solve at
+// most.
+class MPCBatch {
+ public:
+  struct Instance;
+
+  // Delivers a command of an instance. Runs on the event loop, and only
+  // while the instance is still acquired by the vehicle that posted the
+  // frame.
+  typedef std::function<void(Controller&, Command&)> Sink;
+
+  // capacity instances solved by up to workers threads at once. With more
+  // than one worker it must be created before any other MPC of the
+  // process, and multi-start is turned off. With first_cpu >= 0 the
+  // workers are pinned to consecutive CPUs from first_cpu before they
+  // construct their instances.
+  MPCBatch(uS::Loop* loop, size_t capacity, size_t workers, const ControllerOptions& options,
+           Sink deliver, int first_cpu = -1);
+
+  virtual ~MPCBatch();
+
+  // Also pass every delivered command to observe, on the event loop: after
+  // all the commands of the same drain have been delivered, as the
+  // visualization work of Scheduler.h that is never to delay a command.
+  void SetObserver(Sink observe) { observe_ = observe; }
+
+  // Hand every frame solved but the ticks, with its command, to the
+  // shadow of its instance's vehicle (see ShadowRunner::Submit) on the
+  // worker, a copy before the command is handed over; NULL, the default,
+  // for none. Set before the first frame.
+  void SetShadow(ShadowRunner* shadow) { shadow_ = shadow; }
+
+  // Take a free instance, reset for a new vehicle, or NULL when all are in
+  // use; its replies are encoded as viz says (see VizEncoding). Called on
+  // the event loop.
+  //
+  // A vehicle that names a session gets back, warm, the instance its
+  // session released within the grace period (see SetSessionGrace), so a
+  // reconnection after a network blip solves on from its warm start,
+  // fitted reference and latency estimate instead of cold. Otherwise
+  // instances held for the session of another are taken last, the one
+  // released longest ago first, and only when no other is free.
+  //
+  // The vehicle's solves are charged to tenant (see TenantIndex), the
+  // default tenant when empty.
+  Instance* Acquire(const VizEncoding& viz, const std::string& session = std::string(),
+                    const std::string& tenant = std::string());
+
+  // Give an instance back. Commands of frames it still has in flight are
+  // discarded. One of a session is held for it for the grace period.
+  // Called on the event loop.
+  void Release(Instance* instance);
+
+  // How long a released instance is held for its session; 5 s until set,
+  // 0 for never.
+  void SetSessionGrace(PipelineClock::duration grace) { session_grace_ = grace; }
+
+  // The waypoints the vehicle holding instance sent last in waypoints
+  // frames, to decode its next one against (see DecodeBinary); empty from
+  // Acquire on. Called on the event loop.
+  WaypointWindow& Waypoints(Instance* instance);
+
+  // Post a frame for an acquired instance. Called on the event loop; the
+  // contents of frame are swapped out to keep its buffers allocated.
+  void Post(Instance* instance, Telemetry& frame);
+
+  // Post a tick frame (see Telemetry::tick) stamped now for every acquired
+  // instance whose last frame arrived within max_age, so that its
+  // controller solves again from the state predicted to now, as the
+  // control loop of a rate above the telemetry's. An instance with a frame
+  // waiting or being solved is skipped: the tick would be stale by the
+  // time its solve started. Called on the event loop.
+  void Tick(PipelineClock::time_point now, PipelineClock::duration max_age);
+
+  // The gap between two frames of a vehicle after which its controller is
+  // idle: KeepWarm keeps it warm from then on, and the solve of the frame
+  // that ends the gap goes to the idle_warm or idle_cold histogram of
+  // /metrics by whether it was. 1 s until set.
+  void SetIdleGap(PipelineClock::duration gap) { idle_gap_ = gap; }
+
+  // Have the home worker of every acquired instance idle for the idle gap
+  // keep its controller warm (see Controller::KeepWarm), at most once a
+  // gap, so that the solve of the vehicle's next frame does not start
+  // from caches other processes took over meanwhile; skipped while that
+  // worker is busy. Called on the event loop, from a timer.
+  void KeepWarm(PipelineClock::time_point now);
+
+  // Sends a command written by FollowUp to a vehicle's socket, in its
+  // framing.
+  typedef std::function<void(uWS::WebSocket<uWS::SERVER>*, const std::string&, Framing)> FollowUpSink;
+
+  // Hand send a command from the plan last delivered to every acquired
+  // instance whose last frame arrived within max_age, at the actuators the
+  // plan has for now (see Controller::FollowUp), so that the vehicle's
+  // commands keep up with the plan while its next solve runs; none within
+  // min_gap of a delivery. Called on the event loop.
+  void FollowUp(PipelineClock::time_point now, PipelineClock::duration min_gap, PipelineClock::duration max_age,
+                const FollowUpSink& send);
+
+  // Copy the latest plan of the controller of vehicle (see
+  // Controller::LatestPlan), which its worker may be solving meanwhile;
+  // false when the vehicle is not acquired or has no plan yet. Called on
+  // the event loop.
+  bool LatestPlan(size_t vehicle, PublishedPlan& plan) const;
+
+  // Warm up every instance with solves frames along track (see
+  // Controller::WarmUp) on its worker, before any is acquired, and log
+  // the first solve against the steady state.
+  void WarmUp(const Track& track, size_t solves);
+
+  // Write the state of every acquired instance to the file at path (see
+  // Controller::SaveState), with the process-wide weights, for a process
+  // restarted after an upgrade or a crash to carry on from. Each instance
+  // is claimed from the workers while it is written, which may wait out
+  // a solve. Called on the event loop.
+  bool SaveSnapshot(const std::string& path);
+
+  // Read a snapshot into the first instances, before any is acquired, so
+  // that the vehicles that connect first take them over warm instead of
+  // starting from a reset; with weights, the snapshot's weights become
+  // the process-wide ones. False when the file is missing or not a
+  // snapshot of this build, leaving the instances as they were.
+  bool LoadSnapshot(const std::string& path, bool weights);
+
+  // Add the memory of every instance to footprint (see
+  // Controller::AddFootprint), with the reply buffers and queues of the
+  // batch. Each instance is claimed from the workers while it is counted,
+  // as for SaveSnapshot. Called on the event loop.
+  void AddFootprint(Footprint& footprint);
+
+  // Sends a solutions frame of a query to the socket of its client.
+  typedef std::function<void(uWS::WebSocket<uWS::SERVER>*, const std::string&)> QuerySink;
+
+  // Where the solutions of the queries go, on the event loop; set before
+  // the first Submit.
+  void SetQuerySink(QuerySink sink) { query_sink_ = sink; }
+
+  // Queue the problems of the query id of client, over horizon states,
+  // one of MPC_FOR_EACH_HORIZON, for the workers, swapping them out of
+  // problems. Their solutions go to the query sink as solutions frames in
+  // framing (see WriteBinarySolutions), those the workers solved
+  // between two drains of the loop together. Queries are taken in the
+  // order they come. Called on the event loop.
+  void Submit(uWS::WebSocket<uWS::SERVER>* client, uint64_t id, size_t horizon, Framing framing,
+              std::vector<OfflineProblem>& problems);
+
+  // Drop the queries of client, whose connection closed; the problems
+  // being solved are finished but not sent. Called on the event loop.
+  void CancelQueries(uWS::WebSocket<uWS::SERVER>* client);
+
+  // Run the workers under SCHED_FIFO at priority (see SetThreadRealtime).
+  void SetRealtime(int priority);
+
+  size_t Capacity() const { return instances_.size(); }
+  size_t Workers() const { return threads_.size(); }
+
+ private:
+  struct Query;
+
+  Sink deliver_;
+  Sink observe_;
+  ShadowRunner* shadow_;
+
+  std::vector<std::unique_ptr<Instance> > instances_;
+  PipelineClock::duration session_grace_;
+  PipelineClock::duration idle_gap_;
+
+  // Instances with a frame waiting for a worker, queued to the worker
+  // that solved them last, and whether each worker is solving.
+  typedef Eigen::RunQueue<Instance*, 1024> Queue;
+  std::vector<std::unique_ptr<Queue> > queues_;
+  // The instances moved out of the queue of every worker, a heap with the
+  // earliest deadline first, under its mutex.
+  struct Deadlines {
+    Deadlines() : size(0) {}
+    std::mutex mutex;
+    std::vector<Instance*> heap;
+    std::atomic<size_t> size;
+  };
+  std::vector<std::unique_ptr<Deadlines> > deadlines_;
+  std::unique_ptr<std::atomic<bool>[]> busy_;
+  std::unique_ptr<Eigen::MaxSizeVector<Eigen::EventCount::Waiter> > waiters_;
+  std::unique_ptr<Eigen::EventCount> ready_;
+  std::atomic<bool> stop_;
+  // The NUMA node of every worker, -1 when unknown.
+  std::vector<int> nodes_;
+  int first_cpu_;
+
+  // A job every worker runs once on its own thread, posted by OnWorkers.
+  std::mutex job_mutex_;
+  std::condition_variable job_done_;
+  std::function<void(size_t)> job_;
+  std::atomic<size_t> job_generation_;
+  size_t job_pending_;
+  // Whether the workers run CppAD in parallel mode.
+  bool parallel_;
+
+  // Commands waiting to be delivered on the loop, with the instance and
+  // the generation of its vehicle: the first out_size_ of out_, which
+  // Drain swaps with delivering_. A worker swaps its reply into a slot and
+  // gets the buffers of an earlier one back, so the slots keep their
+  // message buffers and handing over a command allocates nothing.
+  struct Reply {
+    Instance* instance;
+    size_t generation;
+    Command command;
+  };
+  std::mutex out_mutex_;
+  std::vector<Reply> out_;
+  size_t out_size_;
+  std::vector<Reply> delivering_;
+  uS::Async* async_;
+  // The message of the follow-ups, written on the event loop.
+  std::string follow_msg_;
+
+  // The queries not yet answered in full, oldest first, and the problems
+  // of them not yet taken by a worker, under query_mutex_; the
+  // controller every worker solves them on, made with its first problem;
+  // and the message of the solutions, written on the event loop.
+  QuerySink query_sink_;
+  std::mutex query_mutex_;
+  std::deque<std::shared_ptr<Query> > queries_;
+  std::atomic<size_t> query_problems_;
+  ControllerOptions query_options_;
+  std::vector<std::unique_ptr<Controller> > query_controllers_;
+  std::vector<uint32_t> query_indices_;
+  std::string query_msg_;
+
+  std::vector<std::thread> threads_;
+
+  void Run(size_t worker);
+  void OnWorkers(const std::function<void(size_t)>& job);
+  void Schedule(Instance* instance);
+  Instance* Earliest(size_t worker, bool owner);
+  Instance* Steal(size_t worker);
+  bool Stealable(size_t worker, size_t victim) const;
+  bool Waiting(size_t worker) const;
+  bool SolveQuery(size_t worker);
+  void Drain();
+  void DrainQueries();
+
+  static void OnAsync(uS::Async* async);
+};
+
+#endif /* MPC_BATCH_H */
@@ -0,0 +1,307 @@
+#include "MPC_NLP.h"
+#include <map>
+#include <utility>
+#include "LinearConstraints.h"
+#include "Logger.h"
+#include "ObstacleConstraints.h"
+#include "Trace.h"
+
+using namespace Ipopt;
+
+template <size_t N>
+MPC_NLP<N>::MPC_NLP(bool frenet)
+    : frenet_(frenet),
+      cost_hes_valid_(false),
+      params_(n_params),
+      x_eval_(L::nlp_vars),
+      fg_(1 + L::n_constraints),
+      w_(1 + L::n_constraints),
+      lambda_(L::n_constraints),
+      fg_valid_(false) {
+  MPC_TRACE("tape");
+  // Keep the memory of CppAD's temporary vectors in its pool so the sweeps
+  // of later solves reuse it instead of going back to the heap.
+  CppAD::thread_alloc::hold_memory(true);
+
+  // Record the tapes once with the parameters as dynamic parameters.
+  RecordTapes<N>(fg_fun_, g_fun_, frenet_);
+  MPC_LOG(LogLevel::Debug, "Tapes of N = %zu: %zu and %zu operations", N, size_t(fg_fun_.size_op()),
+          size_t(g_fun_.size_op()));
+
+  // The structure of the problem never changes, so compute the
+  // sparsity patterns here instead of on every solve.
+  Pattern r(L::nlp_vars);
+  for (size_t j = 0; j < L::nlp_vars; j++) {
+    r[j].insert(j);
+  }
+  jac_pattern_ = fg_fun_.ForSparseJac(L::nlp_vars, r);
+  // RevSparseHes needs the forward sparsity of its own tape.
+  g_fun_.ForSparseJac(L::nlp_vars, r);
+
+  Pattern s_cost(1);
+  s_cost[0].insert(0);
+  cost_pattern_ = fg_fun_.RevSparseHes(L::nlp_vars, s_cost);
+  Pattern s_g(1);
+  for (size_t i = 0; i < L::n_constraints; i++) {
+    s_g[0].insert(i);
+  }
+  g_hes_pattern_ = g_fun_.RevSparseHes(L::nlp_vars, s_g);
+
+  for (size_t i = 1; i < 1 + L::n_constraints; i++) {
+    for (std::set<size_t>::const_iterator j = jac_pattern_[i].begin();
+         j != jac_pattern_[i].end(); j++) {
+      jac_row_.push_back(i);
+      jac_col_.push_back(*j);
+    }
+  }
+  LinearJacobianStructure<N>(linear_row_, linear_col_);
+  ObstacleJacobianStructure<N>(linear_row_, linear_col_);
+
+  // Lower triangle of the union of both Hessian patterns.
+  std::map<std::pair<size_t, size_t>, size_t> position;
+  for (size_t i = 0; i < L::nlp_vars; i++) {
+    std::set<size_t> cols = cost_pattern_[i];
+    cols.insert(g_hes_pattern_[i].begin(), g_hes_pattern_[i].end());
+    for (std::set<size_t>::const_iterator j = cols.begin(); j != cols.end(); j++) {
+      if (*j <= i) {
+        position[std::make_pair(i, *j)] = hes_row_.size();
+        hes_row_.push_back(i);
+        hes_col_.push_back(*j);
+      }
+    }
+  }
+  // The obstacle rows add to the diagonal of the positions, which the
+  // tapes leave out.
+  std::vector<size_t> obstacle_row, obstacle_col;
+  ObstacleHessianStructure<N>(obstacle_row, obstacle_col);
+  for (size_t k = 0; k < obstacle_row.size(); k++) {
+    std::pair<size_t, size_t> key(obstacle_row[k], obstacle_col[k]);
+    if (position.find(key) == position.end()) {
+      position[key] = hes_row_.size();
+      hes_row_.push_back(key.first);
+      hes_col_.push_back(key.second);
+    }
+    obstacle_hes_index_.push_back(position[key]);
+  }
+  for (size_t i = 0; i < L::nlp_vars; i++) {
+    for (std::set<size_t>::const_iterator j = g_hes_pattern_[i].begin();
+         j != g_hes_pattern_[i].end(); j++) {
+      if (*j <= i) {
+        g_hes_index_.push_back(position[std::make_pair(i, *j)]);
+        g_hes_row_.push_back(i);
+        g_hes_col_.push_back(*j);
+      }
+    }
+  }
+
+  // Entries of the cost Hessian in the lower triangle, and their position
+  // in hes_row_, hes_col_.
+  for (size_t i = 0; i < L::nlp_vars; i++) {
+    for (std::set<size_t>::const_iterator j = cost_pattern_[i].begin();
+         j != cost_pattern_[i].end(); j++) {
+      if (*j <= i) {
+        cost_row_.push_back(i);
+        cost_col_.push_back(*j);
+        cost_index_.push_back(position[std::make_pair(i, *j)]);
+      }
+    }
+  }
+  cost_values_.resize(cost_row_.size());
+  cost_hes_.assign(hes_row_.size(), 0.0);
+
+  jac_.resize(jac_row_.size());
+  g_hes_.resize(g_hes_row_.size());
+}
+
+template <size_t N>
+MPC_NLP<N>::~MPC_NLP() {}
+
+template <size_t N>
+void MPC_NLP<N>::AddFootprint(Footprint& footprint) const {
+  for (const CppAD::ADFun<double>* fun : { &fg_fun_, &g_fun_ }) {
+    footprint.tape_ops += fun->size_op();
+    footprint.tape_vars += fun->size_var();
+    footprint.tape_params += fun->size_par();
+    footprint.tape_bytes += fun->size_op_seq() + fun->size_var() * fun->size_order() * sizeof(double);
+  }
+  footprint.sparsity_bytes += PatternBytes(jac_pattern_) + PatternBytes(cost_pattern_) +
+                              PatternBytes(g_hes_pattern_) + VectorBytes(jac_row_) + VectorBytes(jac_col_) +
+                              VectorBytes(linear_row_) + VectorBytes(linear_col_) + VectorBytes(hes_row_) +
+                              VectorBytes(hes_col_) + VectorBytes(obstacle_hes_index_) +
+                              VectorBytes(cost_row_) + VectorBytes(cost_col_) + VectorBytes(cost_index_) +
+                              VectorBytes(g_hes_row_) + VectorBytes(g_hes_col_) + VectorBytes(g_hes_index_);
+  footprint.solver_bytes += VectorBytes(cost_hes_) +
+                            (cost_values_.size() + params_.size() + x_eval_.size() + fg_.size() + w_.size() +
+                             lambda_.size() + jac_.size() + g_hes_.size()) * sizeof(double);
+}
+
+template <size_t N>
+void MPC_NLP<N>::UpdateParams() {
+  MPC_TRACE("bind_params");
+  bool weights_changed = !cost_hes_valid_;
+  for (size_t i = w_cte_idx; i <= w_da_idx; i++) {
+    weights_changed = weights_changed || params_[i] != this->params[i];
+  }
+  for (size_t i = terminal_start; i < n_params; i++) {
+    weights_changed = weights_changed || params_[i] != this->params[i];
+  }
+  for (size_t i = 0; i < n_params; i++) {
+    params_[i] = this->params[i];
+  }
+  fg_fun_.new_dynamic(params_);
+  g_fun_.new_dynamic(params_);
+  fg_valid_ = false;
+  if (weights_changed) {
+    EvalCostHessian();
+  }
+}
+
+template <size_t N>
+void MPC_NLP<N>::EvalCostHessian() {
+  // The cost Hessian does not depend on x, only on the weights, so any
+  // point will do.
+  w_[0] = 1.0;
+  for (size_t i = 1; i < 1 + L::n_constraints; i++) {
+    w_[i] = 0.0;
+  }
+  for (size_t i = 0; i < L::nlp_vars; i++) {
+    x_eval_[i] = 0.0;
+  }
+  fg_fun_.SparseHessian(x_eval_, w_, cost_pattern_, cost_row_, cost_col_, cost_values_, cost_work_);
+  for (size_t k = 0; k < cost_row_.size(); k++) {
+    cost_hes_[cost_index_[k]] = cost_values_[k];
+  }
+  // x_eval_ no longer holds the point of fg_.
+  fg_valid_ = false;
+  cost_hes_valid_ = true;
+}
+
+template <size_t N>
+void MPC_NLP<N>::EvalFG(const Number* x, bool new_x) {
+  if (new_x || !fg_valid_) {
+    for (size_t i = 0; i < L::nlp_vars; i++) {
+      x_eval_[i] = x[i];
+    }
+    fg_ = fg_fun_.Forward(0, x_eval_);
+    fg_valid_ = true;
+  }
+}
+
+template <size_t N>
+bool MPC_NLP<N>::get_nlp_info(Index& n, Index& m, Index& nnz_jac_g,
+                              Index& nnz_h_lag, TNLP::IndexStyleEnum& index_style) {
+  n = L::nlp_vars;
+  m = L::nlp_constraints;
+  nnz_jac_g = jac_row_.size() + linear_row_.size();
+  nnz_h_lag = hes_row_.size();
+  index_style = TNLP::C_STYLE;
+  return true;
+}
+
+template <size_t N>
+bool MPC_NLP<N>::eval_f(Index n, const Number* x, bool new_x, Number& obj_value) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_f");
+  EvalFG(x, new_x);
+  obj_value = fg_[0];
+  return true;
+}
+
+template <size_t N>
+bool MPC_NLP<N>::eval_grad_f(Index n, const Number* x, bool new_x, Number* grad_f) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_grad_f");
+  // The sparse drivers leave other Taylor coefficients on the tape,
+  // so always sweep forward at x before the reverse sweep.
+  fg_valid_ = false;
+  EvalFG(x, true);
+  w_[0] = 1.0;
+  for (size_t i = 1; i < 1 + L::n_constraints; i++) {
+    w_[i] = 0.0;
+  }
+  Dvector dw = fg_fun_.Reverse(1, w_);
+  for (Index j = 0; j < n; j++) {
+    grad_f[j] = dw[j];
+  }
+  return true;
+}
+
+template <size_t N>
+bool MPC_NLP<N>::eval_g(Index n, const Number* x, bool new_x, Index m, Number* g) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_g");
+  EvalFG(x, new_x);
+  for (size_t i = 0; i < L::n_constraints; i++) {
+    g[i] = fg_[1 + i];
+  }
+  LinearRows<N>(x, g, L::n_constraints);
+  ObstacleRows<N>(x, this->params, g);
+  return true;
+}
+
+template <size_t N>
+bool MPC_NLP<N>::eval_jac_g(Index n, const Number* x, bool new_x, Index m,
+                            Index nele_jac, Index* iRow, Index* jCol,
+                            Number* values) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_jac_g");
+  const size_t nnz_tape = jac_row_.size();
+  if (values == NULL) {
+    for (size_t k = 0; k < nnz_tape; k++) {
+      iRow[k] = jac_row_[k] - 1;
+      jCol[k] = jac_col_[k];
+    }
+    for (size_t k = 0; k < linear_row_.size(); k++) {
+      iRow[nnz_tape + k] = linear_row_[k];
+      jCol[nnz_tape + k] = linear_col_[k];
+    }
+    return true;
+  }
+  for (Index i = 0; i < n; i++) {
+    x_eval_[i] = x[i];
+  }
+  fg_valid_ = false;
+  fg_fun_.SparseJacobianForward(x_eval_, jac_pattern_, jac_row_, jac_col_,
+                                jac_, jac_work_);
+  for (size_t k = 0; k < nnz_tape; k++) {
+    values[k] = jac_[k];
+  }
+  ObstacleJacobianValues<N>(x, this->params, LinearJacobianValues<N>(values + nnz_tape));
+  return true;
+}
+
+template <size_t N>
+bool MPC_NLP<N>::eval_h(Index n, const Number* x, bool new_x, Number obj_factor,
+                        Index m, const Number* lambda, bool new_lambda,
+                        Index nele_hess, Index* iRow, Index* jCol,
+                        Number* values) {
+  typename MPC_Problem<N>::Evaluation evaluation(*this, "eval_h");
+  if (values == NULL) {
+    for (Index k = 0; k < nele_hess; k++) {
+      iRow[k] = hes_row_[k];
+      jCol[k] = hes_col_[k];
+    }
+    return true;
+  }
+  for (Index k = 0; k < nele_hess; k++) {
+    values[k] = obj_factor * cost_hes_[k];
+  }
+  // Without the curvature of the constraints the cost Hessian is all, and
+  // no second-order sweep is made (see CostResiduals.h).
+  if (this->gauss_newton) {
+    return true;
+  }
+  for (Index i = 0; i < n; i++) {
+    x_eval_[i] = x[i];
+  }
+  for (size_t i = 0; i < L::n_constraints; i++) {
+    lambda_[i] = lambda[i];
+  }
+  g_fun_.SparseHessian(x_eval_, lambda_, g_hes_pattern_, g_hes_row_, g_hes_col_,
+                       g_hes_, g_hes_work_);
+  for (size_t k = 0; k < g_hes_row_.size(); k++) {
+    values[g_hes_index_[k]] += g_hes_[k];
+  }
+  ObstacleHessianValues<N>(lambda, obstacle_hes_index_, values);
+  return true;
+}
+
+#define INSTANTIATE(N) template class MPC_NLP<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
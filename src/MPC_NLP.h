@@ -0,0 +1,123 @@
+#ifndef MPC_NLP_H
+#define MPC_NLP_H
+
+#include <set>
+#include <vector>
+#include <cppad/cppad.hpp>
+#include "FG_Tape.h"
+#include "MPC_Problem.h"
+
+// Ipopt problem backed by a CppAD tape of FG_eval that is recorded once,
+// by RecordTapes (FG_Tape.h).
+//
+// The polynomial coefficients and reference values are dynamic parameters
+// of the tape, so a new frame only rebinds them with new_dynamic. The
+// Jacobian and Hessian sparsity patterns are computed once at construction
+// (their colorings, held in the work objects, on the first solve).
+//
+// The cost is a weighted sum of squares of linear terms, so its Hessian is
+// constant in the variables. The weights are dynamic parameters as well,
+// so it is evaluated again only when they change. eval_h only
+// differentiates a second, optimized tape of the constraints alone and
+// adds the scaled cost Hessian. The linear rows (LinearConstraints.h) and
+// the obstacle rows (ObstacleConstraints.h) are not on the tapes; their
+// values and derivatives are written out.
+template <size_t N>
+class MPC_NLP : public MPC_Problem<N> {
+ public:
+  typedef std::vector<std::set<size_t> > Pattern;
+  typedef typename MPC_Problem<N>::Dvector Dvector;
+  typedef Layout<N> L;
+
+  // The tapes of FrenetModel with frenet, of BicycleModel otherwise.
+  explicit MPC_NLP(bool frenet = false);
+
+  virtual ~MPC_NLP();
+
+  // Bind the current contents of params to the tape.
+  void UpdateParams();
+
+  void AddFootprint(Footprint& footprint) const;
+
+  bool Frenet() const { return frenet_; }
+
+  bool get_nlp_info(Ipopt::Index& n, Ipopt::Index& m, Ipopt::Index& nnz_jac_g,
+                    Ipopt::Index& nnz_h_lag, Ipopt::TNLP::IndexStyleEnum& index_style);
+
+  bool eval_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Number& obj_value);
+
+  bool eval_grad_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                   Ipopt::Number* grad_f);
+
+  bool eval_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Index m, Ipopt::Number* g);
+
+  bool eval_jac_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                  Ipopt::Index m, Ipopt::Index nele_jac, Ipopt::Index* iRow,
+                  Ipopt::Index* jCol, Ipopt::Number* values);
+
+  bool eval_h(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Number obj_factor, Ipopt::Index m, const Ipopt::Number* lambda,
+              bool new_lambda, Ipopt::Index nele_hess, Ipopt::Index* iRow,
+              Ipopt::Index* jCol, Ipopt::Number* values);
+
+ private:
+  // Recorded tape of fg = FG_eval<N>(vars; params), and of its
+  // constraints alone with the cost operations optimized out.
+  CppAD::ADFun<double> fg_fun_;
+  CppAD::ADFun<double> g_fun_;
+  bool frenet_;
+
+  // Sparsity of the constraint Jacobian (rows offset by one for the cost)
+  // and of the lower triangle of the Lagrangian Hessian, the union of the
+  // cost and constraint Hessians.
+  Pattern jac_pattern_;
+  std::vector<size_t> jac_row_, jac_col_;
+  // Jacobian structure of the linear rows, then of the obstacle rows,
+  // after that of the tape.
+  std::vector<Ipopt::Index> linear_row_, linear_col_;
+  std::vector<size_t> hes_row_, hes_col_;
+  // Position of each Hessian entry of the obstacle rows in hes_row_,
+  // hes_col_.
+  std::vector<size_t> obstacle_hes_index_;
+  CppAD::sparse_jacobian_work jac_work_;
+
+  // Sparsity of the cost Hessian, its lower triangle and the position of
+  // each of its entries in hes_row_, hes_col_.
+  Pattern cost_pattern_;
+  std::vector<size_t> cost_row_, cost_col_;
+  std::vector<size_t> cost_index_;
+  Dvector cost_values_;
+  CppAD::sparse_hessian_work cost_work_;
+
+  // Cost Hessian for the bound weights at each entry of hes_row_,
+  // hes_col_.
+  std::vector<double> cost_hes_;
+  bool cost_hes_valid_;
+
+  // Lower triangle of the constraint Hessian and the position of each of
+  // its entries in hes_row_, hes_col_.
+  Pattern g_hes_pattern_;
+  std::vector<size_t> g_hes_row_, g_hes_col_;
+  std::vector<size_t> g_hes_index_;
+  CppAD::sparse_hessian_work g_hes_work_;
+
+  // Evaluation buffers reused across calls.
+  Dvector params_;
+  Dvector x_eval_;
+  Dvector fg_;
+  Dvector w_;
+  Dvector lambda_;
+  Dvector jac_;
+  Dvector g_hes_;
+  bool fg_valid_;
+
+  // Zero order forward sweep at x, skipped if x is unchanged.
+  void EvalFG(const Ipopt::Number* x, bool new_x);
+
+  // Evaluate cost_hes_ for the weights bound to the tape.
+  void EvalCostHessian();
+};
+
+#endif /* MPC_NLP_H */
@@ -0,0 +1,136 @@
+#include "MPC_Problem.h"
+#include <algorithm>
+#include "Metrics.h"
+#include "Trace.h"
+
+using namespace Ipopt;
+
+template <size_t N>
+MPC_Problem<N>::MPC_Problem()
+    : vars(VarVector::Zero()),
+      vars_lowerbound(VarVector::Zero()),
+      vars_upperbound(VarVector::Zero()),
+      constraints_lowerbound(ConVector::Zero()),
+      constraints_upperbound(ConVector::Zero()),
+      params(ParamVector::Zero()),
+      x_scaling(VarVector::Ones()),
+      g_scaling(ConVector::Ones()),
+      deadline(std::chrono::steady_clock::time_point::max()),
+      gauss_newton(false),
+      status(UNASSIGNED),
+      x(VarVector::Zero()),
+      z_L(VarVector::Zero()),
+      z_U(VarVector::Zero()),
+      lambda(ConVector::Zero()),
+      obj_value(0),
+      violation(0),
+      eval_time(std::chrono::steady_clock::duration::zero()) {
+  SetParamWeights(default_weights);
+  params[dt_idx] = default_dt;
+  params[dt_growth_idx] = 1;
+}
+
+template <size_t N>
+MPC_Problem<N>::~MPC_Problem() {}
+
+template <size_t N>
+bool MPC_Problem<N>::get_bounds_info(Index n, Number* x_l, Number* x_u, Index m,
+                                     Number* g_l, Number* g_u) {
+  for (Index i = 0; i < n; i++) {
+    x_l[i] = vars_lowerbound[i];
+    x_u[i] = vars_upperbound[i];
+  }
+  for (Index i = 0; i < m; i++) {
+    g_l[i] = constraints_lowerbound[i];
+    g_u[i] = constraints_upperbound[i];
+  }
+  return true;
+}
+
+template <size_t N>
+bool MPC_Problem<N>::get_scaling_parameters(Number& obj_scaling, bool& use_x_scaling, Index n,
+                                            Number* x_scaling_out, bool& use_g_scaling, Index m,
+                                            Number* g_scaling_out) {
+  obj_scaling = 1;
+  use_x_scaling = true;
+  use_g_scaling = true;
+  std::copy(x_scaling.data(), x_scaling.data() + n, x_scaling_out);
+  std::copy(g_scaling.data(), g_scaling.data() + m, g_scaling_out);
+  return true;
+}
+
+template <size_t N>
+bool MPC_Problem<N>::get_constraints_linearity(Index m, TNLP::LinearityType* const_types) {
+  for (Index i = 0; i < m; i++) {
+    bool initial = L::InitialRow(i);
+    bool linear = size_t(i) >= L::n_constraints && size_t(i) < L::obstacle_start;
+    const_types[i] = initial || linear ? TNLP::LINEAR : TNLP::NON_LINEAR;
+  }
+  return true;
+}
+
+template <size_t N>
+bool MPC_Problem<N>::get_starting_point(Index n, bool init_x, Number* x,
+                                        bool init_z, Number* z_L, Number* z_U,
+                                        Index m, bool init_lambda,
+                                        Number* lambda) {
+  for (Index i = 0; i < n; i++) {
+    x[i] = vars[i];
+  }
+  if (init_z) {
+    for (Index i = 0; i < n; i++) {
+      z_L[i] = this->z_L[i];
+      z_U[i] = this->z_U[i];
+    }
+  }
+  if (init_lambda) {
+    for (Index i = 0; i < m; i++) {
+      lambda[i] = this->lambda[i];
+    }
+  }
+  return true;
+}
+
+template <size_t N>
+void MPC_Problem<N>::finalize_solution(SolverReturn status, Index n,
+                                       const Number* x, const Number* z_L,
+                                       const Number* z_U, Index m,
+                                       const Number* g, const Number* lambda,
+                                       Number obj_value, const IpoptData* ip_data,
+                                       IpoptCalculatedQuantities* ip_cq) {
+  this->status = status;
+  this->obj_value = obj_value;
+  violation = 0;
+  for (Index i = 0; i < n; i++) {
+    this->x[i] = x[i];
+    this->z_L[i] = z_L[i];
+    this->z_U[i] = z_U[i];
+    violation = std::max(violation, std::max(vars_lowerbound[i] - x[i], x[i] - vars_upperbound[i]));
+  }
+  for (Index i = 0; i < m; i++) {
+    this->lambda[i] = lambda[i];
+    violation = std::max(violation, std::max(constraints_lowerbound[i] - g[i], g[i] - constraints_upperbound[i]));
+  }
+}
+
+template <size_t N>
+bool MPC_Problem<N>::intermediate_callback(AlgorithmMode mode, Index iter,
+                                           Number obj_value, Number inf_pr,
+                                           Number inf_du, Number mu,
+                                           Number d_norm, Number regularization_size,
+                                           Number alpha_du, Number alpha_pr,
+                                           Index ls_trials, const IpoptData* ip_data,
+                                           IpoptCalculatedQuantities* ip_cq) {
+  TraceInstant("ipopt_iteration");
+  RecordIterate(Iterate::PrimalInfeasibility, inf_pr);
+  RecordIterate(Iterate::DualInfeasibility, inf_du);
+  RecordIterate(Iterate::Barrier, mu);
+  RecordIterate(Iterate::PrimalStep, alpha_pr);
+  RecordIterate(Iterate::DualStep, alpha_du);
+  CountEvent(Counter::LineSearchTrials, ls_trials > 0 ? ls_trials : 0);
+  return std::chrono::steady_clock::now() < deadline;
+}
+
+#define INSTANTIATE(N) template class MPC_Problem<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
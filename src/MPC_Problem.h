@@ -0,0 +1,138 @@
+#ifndef MPC_PROBLEM_H
+#define MPC_PROBLEM_H
+
+#include <chrono>
+#include <cppad/cppad.hpp>
+#include <coin/IpTNLP.hpp>
+#include "Eigen-3.3/Eigen/Core"
+#include "Footprint.h"
+#include "Layout.h"
+#include "Trace.h"
+#include "Tuning.h"
+
+// State shared by the Ipopt problem formulations of the MPC: the initial
+// guess, bounds and parameters of the next solve and the last solution.
+// Derived classes only provide the function and derivative evaluations.
+//
+// The storage is fixed-size for the horizon N of the problem.
+template <size_t N>
+class MPC_Problem : public Ipopt::TNLP {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef CPPAD_TESTVECTOR(double) Dvector;
+  typedef Layout<N> L;
+  // With the slacks and the rows of the soft constraints.
+  typedef Eigen::Matrix<double, L::nlp_vars, 1> VarVector;
+  typedef Eigen::Matrix<double, L::nlp_constraints, 1> ConVector;
+  typedef Eigen::Matrix<double, n_params, 1> ParamVector;
+
+  // Initial guess, variable and constraint bounds and dynamic parameters
+  // of the next solve.
+  VarVector vars;
+  VarVector vars_lowerbound;
+  VarVector vars_upperbound;
+  ConVector constraints_lowerbound;
+  ConVector constraints_upperbound;
+  ParamVector params;
+  // Scaling of every variable and constraint, which Ipopt applies with
+  // its nlp_scaling_method user-scaling; 1 until set.
+  VarVector x_scaling;
+  ConVector g_scaling;
+  // Wall-clock time at which the solve is cut short, returning the
+  // current iterate (status USER_REQUESTED_STOP).
+  std::chrono::steady_clock::time_point deadline;
+  // Whether eval_h leaves out the curvature of the constraints (see
+  // IpoptOptions::gauss_newton).
+  bool gauss_newton;
+
+  // Result of the last solve. The bound and constraint multipliers
+  // are also handed back to Ipopt as the starting point of a warm start.
+  Ipopt::SolverReturn status;
+  VarVector x;
+  VarVector z_L;
+  VarVector z_U;
+  ConVector lambda;
+  double obj_value;
+  // Largest constraint or bound violation of x.
+  double violation;
+  // Time spent in the function and derivative evaluations, summed until
+  // the caller zeroes it.
+  std::chrono::steady_clock::duration eval_time;
+
+  // Adds the time of an evaluation to eval_time and traces it as a span.
+  class Evaluation {
+   public:
+    Evaluation(MPC_Problem& problem, const char* name)
+        : problem_(problem), span_(name), start_(std::chrono::steady_clock::now()) {}
+
+    ~Evaluation() { problem_.eval_time += std::chrono::steady_clock::now() - start_; }
+
+   private:
+    MPC_Problem& problem_;
+    TraceSpan span_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  MPC_Problem();
+
+  virtual ~MPC_Problem();
+
+  // Bind the current contents of params for the next solve.
+  virtual void UpdateParams() {}
+
+  // Add the memory the formulation holds beyond this object: its tapes
+  // and derivative structures.
+  virtual void AddFootprint(Footprint& footprint) const { (void)footprint; }
+
+  // The cost weights in params.
+  Weights ParamWeights() const {
+    Weights w = { params[w_cte_idx], params[w_epsi_idx], params[w_v_idx], params[w_delta_idx],
+                  params[w_a_idx], params[w_ddelta_idx], params[w_da_idx] };
+    return w;
+  }
+
+  void SetParamWeights(const Weights& w) {
+    params[w_cte_idx] = w.cte;
+    params[w_epsi_idx] = w.epsi;
+    params[w_v_idx] = w.v;
+    params[w_delta_idx] = w.delta;
+    params[w_a_idx] = w.a;
+    params[w_ddelta_idx] = w.ddelta;
+    params[w_da_idx] = w.da;
+  }
+
+  bool get_bounds_info(Ipopt::Index n, Ipopt::Number* x_l, Ipopt::Number* x_u,
+                       Ipopt::Index m, Ipopt::Number* g_l, Ipopt::Number* g_u);
+
+  // The initial constraints and the rows of LinearConstraints.h are
+  // linear, the kinematic constraints and the obstacle rows not.
+  bool get_constraints_linearity(Ipopt::Index m, Ipopt::TNLP::LinearityType* const_types);
+
+  bool get_scaling_parameters(Ipopt::Number& obj_scaling, bool& use_x_scaling, Ipopt::Index n,
+                              Ipopt::Number* x_scaling, bool& use_g_scaling, Ipopt::Index m,
+                              Ipopt::Number* g_scaling);
+
+  bool get_starting_point(Ipopt::Index n, bool init_x, Ipopt::Number* x,
+                          bool init_z, Ipopt::Number* z_L, Ipopt::Number* z_U,
+                          Ipopt::Index m, bool init_lambda, Ipopt::Number* lambda);
+
+  void finalize_solution(Ipopt::SolverReturn status, Ipopt::Index n,
+                         const Ipopt::Number* x, const Ipopt::Number* z_L,
+                         const Ipopt::Number* z_U, Ipopt::Index m,
+                         const Ipopt::Number* g, const Ipopt::Number* lambda,
+                         Ipopt::Number obj_value, const Ipopt::IpoptData* ip_data,
+                         Ipopt::IpoptCalculatedQuantities* ip_cq);
+
+  // Stops the iterations once the deadline has passed. Every iteration's
+  // infeasibilities, barrier parameter and step sizes go to the metrics.
+  bool intermediate_callback(Ipopt::AlgorithmMode mode, Ipopt::Index iter,
+                             Ipopt::Number obj_value, Ipopt::Number inf_pr,
+                             Ipopt::Number inf_du, Ipopt::Number mu,
+                             Ipopt::Number d_norm, Ipopt::Number regularization_size,
+                             Ipopt::Number alpha_du, Ipopt::Number alpha_pr,
+                             Ipopt::Index ls_trials, const Ipopt::IpoptData* ip_data,
+                             Ipopt::IpoptCalculatedQuantities* ip_cq);
+};
+
+#endif /* MPC_PROBLEM_H */
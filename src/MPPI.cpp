@@ -0,0 +1,357 @@
+#include "MPPI.h"
+#include "Logger.h"
+#include "SimdKernels.h"
+#include "Tuning.h"
+#include <math.h>
+#include <algorithm>
+
+// Standard deviation of the steering and throttle perturbations.
+static const double sigma_delta = 0.05;
+static const double sigma_a = 0.2;
+
+// Cost scale of the sample weights: lower follows the best samples more
+// closely, higher averages more of them.
+static const double temperature = 10;
+
+// Samples of one random stream, and the fewest worth handing to a thread
+// of their own.
+static const size_t stream_samples = 64;
+
+template <size_t N>
+MPPI<N>::MPPI(double dt, double Lf, size_t samples)
+    : model_(dt, Lf),
+      samples_(std::max<size_t>(samples, 1)),
+      xref_(StateMatrix::Zero()),
+      weights_(default_weights),
+      terminal_(TerminalMatrix::Zero()),
+      initialized_(false),
+      weight_of_best_(1),
+      X_(StateMatrix::Zero()),
+      U_(InputVector::Zero()),
+      coeffs_(Eigen::Vector4d::Zero()),
+      x0_(Eigen::Matrix<double, 6, 1>::Zero()),
+      noise_(Eigen::Index(samples_), Eigen::Index(n_u)),
+      cost_(samples_),
+      weight_(samples_),
+      steps_(0),
+      seed_(0),
+      chunks_pending_(0) {
+  for (size_t k = 0; k < N - 1; k++) {
+    u_lb_(2 * k) = -max_delta;
+    u_ub_(2 * k) = max_delta;
+    u_lb_(2 * k + 1) = -max_a;
+    u_ub_(2 * k + 1) = max_a;
+  }
+  SetMoveBlocks(std::vector<size_t>());
+  SetSeed(0);
+  Split(1);
+}
+
+template <size_t N>
+MPPI<N>::~MPPI() {}
+
+template <size_t N>
+void MPPI<N>::SetReference(double cte_ref, double epsi_ref, double v_ref) {
+  xref_.row(3).setConstant(v_ref);
+  xref_.row(4).setConstant(cte_ref);
+  xref_.row(5).setConstant(epsi_ref);
+}
+
+template <size_t N>
+void MPPI<N>::SetStageReference(const double* cte_ref, const double* epsi_ref, const double* v_ref) {
+  for (size_t k = 0; k < N; k++) {
+    xref_(3, k) = v_ref[k];
+    xref_(4, k) = cte_ref[k];
+    xref_(5, k) = epsi_ref[k];
+  }
+}
+
+template <size_t N>
+void MPPI<N>::SetWeights(const Weights& weights) {
+  weights_ = weights;
+}
+
+template <size_t N>
+void MPPI<N>::SetMoveBlocks(const std::vector<size_t>& lengths) {
+  n_blocks_ = MoveBlockIndex(lengths, N - 1, block_of_, block_start_);
+}
+
+template <size_t N>
+void MPPI<N>::SetThreads(size_t threads) {
+  threads = std::min(std::max<size_t>(threads, 1), std::max<size_t>(samples_ / stream_samples, 1));
+  pool_.reset(threads > 1 ? new Eigen::NonBlockingThreadPool(int(threads - 1)) : NULL);
+  Split(threads);
+}
+
+template <size_t N>
+void MPPI<N>::SetSeed(uint64_t seed) {
+  seed_ = seed;
+  steps_ = 0;
+  streams_.resize((samples_ + stream_samples - 1) / stream_samples);
+  for (size_t i = 0; i < streams_.size(); i++) {
+    std::seed_seq seq = { uint32_t(seed), uint32_t(seed >> 32), uint32_t(i) };
+    streams_[i].seed(seq);
+  }
+}
+
+template <size_t N>
+bool MPPI<N>::SetDevice(size_t samples) {
+  device_.reset();
+  if (samples == 0) {
+    return true;
+  }
+  // Only the long horizons of MPC_FOR_EACH_SCALING_HORIZON have more.
+  if (N - 1 > mppi_device_max_stages) {
+    MPC_LOG(LogLevel::Warning, "The device problem holds %zu stages, not %zu, staying on the CPU",
+            mppi_device_max_stages, N - 1);
+    return false;
+  }
+  if (!MppiDevice::Available()) {
+    MPC_LOG(LogLevel::Warning, "No CUDA device for the MPPI rollouts, staying on the CPU");
+    return false;
+  }
+  device_.reset(new MppiDevice(1, samples));
+  if (!device_->Ready()) {
+    device_.reset();
+    return false;
+  }
+  device_problem_.samples = samples;
+  return true;
+}
+
+template <size_t N>
+void MPPI<N>::DeviceStep() {
+  MppiDeviceProblem& p = device_problem_;
+  p.stages = N - 1;
+  p.blocks = n_blocks_;
+  std::copy(block_of_, block_of_ + N - 1, p.block_of);
+  std::copy(block_start_, block_start_ + N - 1, p.block_start);
+  p.seed = (seed_ << 32) ^ steps_++;
+  std::copy(x0_.data(), x0_.data() + 6, p.x0);
+  std::copy(coeffs_.data(), coeffs_.data() + 4, p.c);
+  p.Lf = model_.Lf;
+  p.understeer = model_.understeer;
+  for (size_t k = 0; k < N; k++) {
+    p.ref_cte[k] = xref_(4, k);
+    p.ref_epsi[k] = xref_(5, k);
+    p.ref_v[k] = xref_(3, k);
+  }
+  p.weights = weights_;
+  p.temperature = temperature;
+  p.sigma_delta = sigma_delta;
+  p.sigma_a = sigma_a;
+  for (size_t k = 0; k < N - 1; k++) {
+    p.dt[k] = model_.Dt(k);
+  }
+  std::copy(U_.data(), U_.data() + n_u, p.u);
+  std::copy(u_lb_.data(), u_lb_.data() + n_u, p.u_lb);
+  std::copy(u_ub_.data(), u_ub_.data() + n_u, p.u_ub);
+
+  MppiDeviceResult result;
+  if (!device_->Run(&p, 1, &result)) {
+    // Keep the shifted plan for this frame.
+    return;
+  }
+  weight_of_best_ = 1 / result.total_weight;
+  for (size_t k = 0; k < N - 1; k++) {
+    for (size_t j = 0; j < 2; j++) {
+      U_(2 * k + j) += result.weighted_noise[2 * block_of_[k] + j] / result.total_weight;
+    }
+  }
+}
+
+template <size_t N>
+void MPPI<N>::Reset() {
+  initialized_ = false;
+}
+
+template <size_t N>
+void MPPI<N>::Split(size_t threads) {
+  chunks_.resize(threads);
+  const size_t n_streams = streams_.size();
+  size_t first = 0;
+  for (size_t i = 0; i < threads; i++) {
+    Chunk& chunk = chunks_[i];
+    chunk.first_stream = first;
+    chunk.streams = n_streams / threads + (i < n_streams % threads ? 1 : 0);
+    first += chunk.streams;
+    chunk.begin = chunk.first_stream * stream_samples;
+    chunk.size = std::min(first * stream_samples, samples_) - chunk.begin;
+    Eigen::ArrayXd* arrays[] = { &chunk.x, &chunk.y, &chunk.psi, &chunk.v, &chunk.cte, &chunk.epsi,
+                                 &chunk.delta_prev, &chunk.a_prev };
+    for (Eigen::ArrayXd* array : arrays) {
+      array->resize(chunk.size);
+    }
+    chunk.delta_prev.setZero();
+    chunk.a_prev.setZero();
+    chunk.scratch.resize(4 * chunk.size);
+  }
+}
+
+template <size_t N>
+void MPPI<N>::Rollout(Chunk& chunk) {
+  const size_t begin = chunk.begin;
+  const size_t n = chunk.size;
+
+  // Perturb the plan, keeping every sample within the actuator bounds. Each
+  // stream draws for its own samples alone, with a distribution of its own
+  // that carries no value over to the next.
+  for (size_t r = chunk.first_stream; r < chunk.first_stream + chunk.streams; r++) {
+    std::normal_distribution<double> normal;
+    const size_t first = r * stream_samples;
+    const size_t last = std::min(first + stream_samples, samples_);
+    for (size_t j = 0; j < 2 * n_blocks_; j++) {
+      double sigma = j % 2 == 0 ? sigma_delta : sigma_a;
+      size_t s = 2 * block_start_[j / 2] + j % 2;
+      for (size_t i = first; i < last; i++) {
+        double u = std::min(std::max(U_(s) + sigma * normal(streams_[r]), u_lb_(s)), u_ub_(s));
+        noise_(i, j) = u - U_(s);
+      }
+    }
+  }
+  // The first sample is the unperturbed plan, so the step never loses it.
+  if (begin == 0) {
+    noise_.row(0).setZero();
+  }
+
+  chunk.x.setConstant(x0_(0));
+  chunk.y.setConstant(x0_(1));
+  chunk.psi.setConstant(x0_(2));
+  chunk.v.setConstant(x0_(3));
+  chunk.cte.setConstant(x0_(4));
+  chunk.epsi.setConstant(x0_(5));
+
+  auto cost = cost_.segment(begin, n);
+  cost = weights_.cte * (chunk.cte - xref_(4, 0)).square() +
+         weights_.epsi * (chunk.epsi - xref_(5, 0)).square() + weights_.v * (chunk.v - xref_(3, 0)).square();
+
+  // The stages run in the vector kernel of the CPU, see SimdKernels.h.
+  const SimdKernels& kernels = CpuKernels();
+  RolloutArrays arrays = { n, chunk.x.data(), chunk.y.data(), chunk.psi.data(), chunk.v.data(),
+                           chunk.cte.data(), chunk.epsi.data(), chunk.delta_prev.data(),
+                           chunk.a_prev.data(), cost.data(), chunk.scratch.data() };
+  RolloutStage stage;
+  stage.Lf = model_.Lf;
+  stage.understeer = model_.understeer;
+  for (int i = 0; i < 4; i++) {
+    stage.c[i] = coeffs_[i];
+  }
+  stage.weights = weights_;
+  for (size_t k = 0; k < N - 1; k++) {
+    // The cost of the state the stage reaches.
+    stage.ref_cte = xref_(4, k + 1);
+    stage.ref_epsi = xref_(5, k + 1);
+    stage.ref_v = xref_(3, k + 1);
+    stage.dt = model_.Dt(k);
+    stage.u_delta = U_(2 * k);
+    stage.u_a = U_(2 * k + 1);
+    stage.noise_delta = noise_.col(2 * block_of_[k]).data() + begin;
+    stage.noise_a = noise_.col(2 * block_of_[k] + 1).data() + begin;
+    stage.first = k == 0;
+    kernels.rollout_stage(stage, arrays);
+  }
+
+  // The terminal cost of the last stage and the actuators that reached it.
+  if (!terminal_.isZero(0)) {
+    for (size_t i = 0; i < n; i++) {
+      Eigen::Matrix<double, n_terminal, 1> e;
+      e << chunk.cte(i) - xref_(4, N - 1), chunk.epsi(i) - xref_(5, N - 1), chunk.v(i) - xref_(3, N - 1),
+          chunk.delta_prev(i), chunk.a_prev(i);
+      cost(i) += e.dot(terminal_ * e);
+    }
+  }
+}
+
+template <size_t N>
+void MPPI<N>::RolloutPlan() {
+  X_.col(0) = x0_;
+  for (size_t k = 0; k < N - 1; k++) {
+    model_.Stage(k).Step(X_.col(k).data(), U_.data() + 2 * k, coeffs_, X_.col(k + 1).data());
+  }
+}
+
+template <size_t N>
+double MPPI<N>::Feedback(const StateVector& state, const Eigen::Vector4d& coeffs) {
+  if (!initialized_) {
+    U_.setZero();
+    initialized_ = true;
+  } else {
+    // The previous plan, one stage later.
+    for (size_t i = 0; i + 2 < n_u; i++) {
+      U_(i) = U_(i + 2);
+    }
+    // Blocks take the shifted actuators of their first stage.
+    for (size_t k = 0; k < N - 1; k++) {
+      size_t first = block_start_[block_of_[k]];
+      U_.template segment<2>(2 * k) = U_.template segment<2>(2 * first);
+    }
+  }
+  coeffs_ = coeffs;
+  x0_ = state;
+
+  if (device_) {
+    DeviceStep();
+    U_ = U_.cwiseMax(u_lb_).cwiseMin(u_ub_);
+    RolloutPlan();
+    return Cost();
+  }
+
+  // Chunk 0 runs on the calling thread.
+  chunks_pending_ = chunks_.size() - 1;
+  for (size_t i = 1; i < chunks_.size(); i++) {
+    pool_->Schedule([this, i]() {
+      Rollout(chunks_[i]);
+      std::lock_guard<std::mutex> lock(chunks_mutex_);
+      if (--chunks_pending_ == 0) {
+        chunks_done_.notify_one();
+      }
+    });
+  }
+  Rollout(chunks_[0]);
+  if (chunks_.size() > 1) {
+    std::unique_lock<std::mutex> lock(chunks_mutex_);
+    chunks_done_.wait(lock, [this]() { return chunks_pending_ == 0; });
+  }
+
+  // Importance weights, relative to the best sample to keep exp in range.
+  double best = cost_.minCoeff();
+  weight_ = (-(cost_ - best) / temperature).exp();
+  double total = weight_.sum();
+  weight_of_best_ = 1 / total;
+  const Eigen::Index m = Eigen::Index(2 * n_blocks_);
+  du_.head(m).noalias() = noise_.leftCols(m).matrix().transpose() * weight_.matrix();
+  for (size_t k = 0; k < N - 1; k++) {
+    U_.template segment<2>(2 * k) += du_.template segment<2>(2 * block_of_[k]) / total;
+  }
+  U_ = U_.cwiseMax(u_lb_).cwiseMin(u_ub_);
+
+  RolloutPlan();
+  return Cost();
+}
+
+template <size_t N>
+double MPPI<N>::Cost() const {
+  double cost = 0;
+  for (size_t k = 0; k < N; k++) {
+    cost += weights_.cte * pow(X_(4, k) - xref_(4, k), 2);
+    cost += weights_.epsi * pow(X_(5, k) - xref_(5, k), 2);
+    cost += weights_.v * pow(X_(3, k) - xref_(3, k), 2);
+  }
+  for (size_t k = 0; k < N - 1; k++) {
+    cost += weights_.delta * pow(U_(2 * k), 2);
+    cost += weights_.a * pow(U_(2 * k + 1), 2);
+  }
+  for (size_t k = 0; k < N - 2; k++) {
+    cost += weights_.ddelta * pow(U_(2 * k + 2) - U_(2 * k), 2);
+    cost += weights_.da * pow(U_(2 * k + 3) - U_(2 * k + 1), 2);
+  }
+  Eigen::Matrix<double, n_terminal, 1> e;
+  e << X_(4, N - 1) - xref_(4, N - 1), X_(5, N - 1) - xref_(5, N - 1), X_(3, N - 1) - xref_(3, N - 1),
+      U_(2 * (N - 2)), U_(2 * (N - 2) + 1);
+  cost += e.dot(terminal_ * e);
+  return cost;
+}
+
+#define INSTANTIATE(N) template class MPPI<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -0,0 +1,186 @@
+#ifndef MPPI_H
+#define MPPI_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+#include "KinematicModel.h"
+#include "Layout.h"
+#include "TerminalCost.h"
+#include "MoveBlocks.h"
+#include "MppiDevice.h"
+#include "Tuning.h"
+
+// Model predictive path integral control for the kinematic model of
+// FG_eval.
+//
+// Each feedback step perturbs the shifted actuator plan with Gaussian
+// noise, simulates every perturbed plan from the measured state, scores it
+// with the cost terms of FG_eval and moves the plan to the average of the
+// samples weighted by exp(-cost / temperature). The work per frame is fixed
+// and there is nothing to converge.
+//
+// The samples are laid out structure-of-arrays: every state and actuator
+// of a stage is one array over the samples, and each stage is one call of
+// the rollout kernel of SimdKernels.h, vectorized for the CPU. The samples
+// draw their perturbations from random streams of a fixed number of
+// samples each, seeded from the instance's seed, and the chunk of every
+// thread is made of whole streams with rollout arrays of its own. The
+// weights are reduced on the calling thread in sample order, so a step
+// does not depend on scheduling or on the thread count. On a CUDA device (see
+// MppiDevice.h) the samples, as many as asked for, run in one block of
+// the device instead, and only the weighted sums come back.
+template <size_t N>
+class MPPI {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef Layout<N> L;
+  enum : int { n_u = L::n_inputs };
+
+  typedef Eigen::Matrix<double, 6, N> StateMatrix;
+  typedef Eigen::Matrix<double, n_u, 1> InputVector;
+
+  MPPI(double dt, double Lf, size_t samples = 1024);
+
+  virtual ~MPPI();
+
+  void SetReference(double cte_ref, double epsi_ref, double v_ref);
+
+  // References of every stage, N values each (see RTI::SetStageReference).
+  void SetStageReference(const double* cte_ref, const double* epsi_ref, const double* v_ref);
+
+  // Cost weights; default_weights until set.
+  void SetWeights(const Weights& weights);
+
+  // Terminal cost of the last stage (see TerminalCost.h), none (zero)
+  // until set. The samples on the CUDA device are costed without it.
+  void SetTerminalCost(const TerminalMatrix& cost) { terminal_ = cost; }
+
+  // Time step of the first stage and growth of the later ones (see
+  // KinematicModel), the step of the constructor and 1 until set. Takes
+  // effect from the next feedback step; Reset first to drop the plan.
+  void SetTimestep(double dt, double growth = 1) {
+    model_.dt = dt;
+    model_.growth = growth;
+  }
+
+  // Understeer of the model (see YawGain, Kinematics.h), 0 until set.
+  void SetUndersteer(double understeer) { model_.understeer = understeer; }
+
+  // Hold the actuators constant over blocks of stages of the given
+  // lengths (see MoveBlocks.h), so that the samples perturb one pair of
+  // actuators per block; none, the default, frees every stage. Takes
+  // effect from the next feedback step.
+  void SetMoveBlocks(const std::vector<size_t>& lengths);
+
+  // Spread the rollouts over threads threads, the calling one included.
+  void SetThreads(size_t threads);
+
+  // Restart the random streams from seed, 0 until set. Instances with the
+  // same seed and the same frames take the same steps.
+  void SetSeed(uint64_t seed);
+
+  // Run the sampling steps on the CUDA device with samples samples
+  // instead, or on the CPU again with 0. False, staying on the CPU, when
+  // the build or the host has no device.
+  bool SetDevice(size_t samples);
+
+  // Perform one sampling step from initial state [x, y, psi, v, cte, epsi]
+  // and polynomial coefficients. Returns the cost of the new plan.
+  double Feedback(const StateVector& state, const Eigen::Vector4d& coeffs);
+
+  // Actuator plan, [delta_0, a_0, delta_1, a_1, ...].
+  const InputVector& Inputs() const { return U_; }
+
+  // State plan, one stage of [x, y, psi, v, cte, epsi] per column.
+  const StateMatrix& States() const { return X_; }
+
+  // Share of the total weight carried by the best sample of the last step.
+  double WeightOfBest() const { return weight_of_best_; }
+
+  // Bytes of the random streams and of the rollout state of the chunks.
+  size_t HeapBytes() const {
+    size_t bytes = streams_.capacity() * sizeof(std::mt19937) + chunks_.capacity() * sizeof(Chunk);
+    for (const Chunk& chunk : chunks_) {
+      bytes += (chunk.x.size() + chunk.y.size() + chunk.psi.size() + chunk.v.size() + chunk.cte.size() +
+                chunk.epsi.size() + chunk.delta_prev.size() + chunk.a_prev.size() + chunk.scratch.size()) *
+               sizeof(double);
+    }
+    return bytes;
+  }
+
+  void Reset();
+
+ private:
+  // Rollout state of one chunk of samples.
+  struct Chunk {
+    size_t begin;
+    size_t size;
+    // The random streams of its samples.
+    size_t first_stream;
+    size_t streams;
+    Eigen::ArrayXd x, y, psi, v, cte, epsi;
+    Eigen::ArrayXd delta_prev, a_prev;
+    // Scratch of the rollout kernel, 4 * size.
+    Eigen::ArrayXd scratch;
+  };
+
+  KinematicModel model_;
+  size_t samples_;
+
+  // Reference state of every stage; only v, cte and epsi are set.
+  StateMatrix xref_;
+  Weights weights_;
+  TerminalMatrix terminal_;
+
+  bool initialized_;
+  double weight_of_best_;
+
+  // Move blocks: block of every stage and first stage of every block.
+  size_t block_of_[N - 1];
+  size_t block_start_[N - 1];
+  size_t n_blocks_;
+
+  StateMatrix X_;
+  InputVector U_;
+  Eigen::Vector4d coeffs_;
+  Eigen::Matrix<double, 6, 1> x0_;
+  InputVector u_lb_;
+  InputVector u_ub_;
+  InputVector du_;
+
+  // Clipped perturbations, one column per actuator of a block, and the
+  // cost and weight of every sample.
+  Eigen::ArrayXXd noise_;
+  Eigen::ArrayXd cost_;
+  Eigen::ArrayXd weight_;
+
+  // The device and its problem, when the steps run there, and the steps
+  // so far, which seed its generator.
+  std::unique_ptr<MppiDevice> device_;
+  MppiDeviceProblem device_problem_;
+  uint64_t steps_;
+
+  // The seed, and the random streams of the CPU samples in order.
+  uint64_t seed_;
+  std::vector<std::mt19937> streams_;
+
+  std::vector<Chunk> chunks_;
+  std::unique_ptr<Eigen::NonBlockingThreadPool> pool_;
+  std::mutex chunks_mutex_;
+  std::condition_variable chunks_done_;
+  size_t chunks_pending_;
+
+  void Split(size_t threads);
+  void Rollout(Chunk& chunk);
+  void RolloutPlan();
+  void DeviceStep();
+  double Cost() const;
+};
+
+#endif /* MPPI_H */
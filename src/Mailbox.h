@@ -0,0 +1,69 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+#include <stddef.h>
+#include <utility>
+
+// Lock-free single-producer single-consumer "latest value" slot.
+//
+// A triple buffer: the producer and the consumer each own one of three
+// slots and the third is shared through an atomic index. Publishing a
+// value while the previous one has not been taken overwrites it, which is
+// counted as a dropped value, so the consumer always sees the freshest
+// value and never a backlog.
+template <class T>
+class Mailbox {
+ public:
+  Mailbox() : back_(0), shared_(1), front_(2), published_(0), dropped_(0) {}
+
+  // Producer: publish value. Its contents are swapped with a free slot,
+  // so buffers move between the slots instead of being reallocated.
+  void Publish(T& value) {
+    using std::swap;
+    swap(slots_[back_], value);
+    unsigned old = shared_.exchange(back_ | fresh, std::memory_order_acq_rel);
+    if (old & fresh) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    back_ = old & ~fresh;
+    published_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Consumer: whether a value was published since the last Take.
+  bool HasNew() const {
+    return shared_.load(std::memory_order_acquire) & fresh;
+  }
+
+  // Consumer: swap the latest value into value. Returns false, leaving
+  // value untouched, if nothing new was published.
+  bool Take(T& value) {
+    if (!HasNew()) {
+      return false;
+    }
+    unsigned old = shared_.exchange(front_, std::memory_order_acq_rel);
+    front_ = old & ~fresh;
+    using std::swap;
+    swap(slots_[front_], value);
+    return true;
+  }
+
+  // Number of values published, and of those overwritten before the
+  // consumer took them.
+  size_t Published() const { return published_.load(std::memory_order_relaxed); }
+  size_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  static const unsigned fresh = 4;
+
+  T slots_[3];
+  // Slot indices; shared_ also carries the fresh flag.
+  unsigned back_;
+  std::atomic<unsigned> shared_;
+  unsigned front_;
+
+  std::atomic<size_t> published_;
+  std::atomic<size_t> dropped_;
+};
+
+#endif /* MAILBOX_H */
@@ -0,0 +1,61 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+using namespace std;
+
+MappedFile::MappedFile() : data_(NULL), size_(0) {}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+void MappedFile::Close() {
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+}
+
+bool MappedFile::Open(const string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  // The mapping keeps the file open.
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  size_ = size_t(st.st_size);
+  return true;
+}
+
+void MappedFile::Advise(size_t offset, size_t length, int advice) const {
+  if (!data_ || offset >= size_) {
+    return;
+  }
+  static const size_t page = size_t(sysconf(_SC_PAGESIZE));
+  size_t begin = offset / page * page;
+  size_t end = min(offset + length, size_);
+  madvise(const_cast<char*>(data_) + begin, end - begin, advice);
+}
+
+void MappedFile::WillNeed(size_t offset, size_t length) const {
+  Advise(offset, length, MADV_WILLNEED);
+}
+
+void MappedFile::DontNeed(size_t offset, size_t length) const {
+  Advise(offset, length, MADV_DONTNEED);
+}
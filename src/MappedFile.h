@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <string>
+
+// A whole file mapped read-only into memory. Its pages are read in when
+// first touched and, being backed by the file, can be dropped again at any
+// time, so a mapped file costs only the memory of the parts in use.
+class MappedFile {
+ public:
+  MappedFile();
+
+  virtual ~MappedFile();
+
+  // Map the file at path, unmapping any other. False when it cannot be
+  // opened or mapped, or is empty.
+  bool Open(const std::string& path);
+
+  const char* Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+  // Advise that the bytes from offset on will be read soon, so they are
+  // read ahead, or not for a while, so their memory may be reclaimed. The
+  // range is widened to whole pages, and the data stays readable either
+  // way.
+  void WillNeed(size_t offset, size_t length) const;
+  void DontNeed(size_t offset, size_t length) const;
+
+ private:
+  const char* data_;
+  size_t size_;
+
+  void Close();
+  void Advise(size_t offset, size_t length, int advice) const;
+};
+
+#endif /* MAPPED_FILE_H */
@@ -0,0 +1,447 @@
+#include "Metrics.h"
+#include <stdarg.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "AllocCount.h"
+#include "Tenants.h"
+
+using namespace std;
+
+// Log-linear buckets over nanoseconds, as in HDR histograms: every power
+// of two is split into 1 << sub_bits buckets, so a bucket is within 12.5%
+// of its values. Values of 2^max_bits ns (about 18 minutes) and more are
+// counted in the last bucket.
+static const int sub_bits = 3;
+static const int sub_buckets = 1 << sub_bits;
+static const int max_bits = 40;
+static const int n_buckets = (max_bits - sub_bits + 1) * sub_buckets;
+
+// Exported histogram bounds: powers of two from about 1 us to 2 s, which
+// fall on bucket bounds.
+static const int first_export_bits = 10;
+static const int last_export_bits = 31;
+
+// Iterate quantities in logarithmic buckets, iterate_steps per decade from
+// 10^min_decade to 10^max_decade, with a bucket below for zero and smaller
+// values and one above.
+static const int min_decade = -12;
+static const int max_decade = 4;
+static const int iterate_steps = 4;
+static const int n_iterate_buckets = (max_decade - min_decade) * iterate_steps + 2;
+
+static const char* const stage_names[n_stages] = {
+  "parse", "transform", "polyfit", "solve", "format", "send", "end_to_end",
+  "evaluation", "ipopt_internal", "cache_hit", "cache_seeded", "cold_solve", "arrival", "queue",
+  "idle_warm", "idle_cold"
+};
+
+static const char* const perf_names[n_perf_events] = {
+  "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+static const char* const perf_helps[n_perf_events] = {
+  "CPU cycles", "Instructions retired", "Last-level cache misses", "Mispredicted branches"
+};
+
+static const char* const iterate_names[n_iterates] = {
+  "inf_pr", "inf_du", "mu", "alpha_pr", "alpha_du"
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static int Bucket(uint64_t ns) {
+  if (ns < uint64_t(sub_buckets)) {
+    return int(ns);
+  }
+  if (ns >= (uint64_t(1) << max_bits)) {
+    return n_buckets - 1;
+  }
+  int magnitude = 63 - __builtin_clzll(ns);
+  return (magnitude - sub_bits + 1) * sub_buckets + int((ns >> (magnitude - sub_bits)) & (sub_buckets - 1));
+}
+
+// Smallest value of bucket i.
+static uint64_t BucketLow(int i) {
+  if (i < sub_buckets) {
+    return uint64_t(i);
+  }
+  int magnitude = i / sub_buckets + sub_bits - 1;
+  return uint64_t(sub_buckets + i % sub_buckets) << (magnitude - sub_bits);
+}
+
+// The histograms and counters of one thread. Only that thread writes
+// them, so a load and a store make an increment.
+struct Shard {
+  atomic<uint64_t> buckets[n_stages][n_buckets];
+  atomic<uint64_t> sum_ns[n_stages];
+  // Hardware counts of the stages, and the number of stages counted.
+  atomic<uint64_t> perf[n_stages][n_perf_events];
+  atomic<uint64_t> perf_samples[n_stages];
+  atomic<uint64_t> counters[n_counters];
+  atomic<uint64_t> iterates[n_iterates][n_iterate_buckets];
+
+  Shard() {
+    for (int s = 0; s < n_stages; s++) {
+      for (int i = 0; i < n_buckets; i++) {
+        buckets[s][i].store(0, memory_order_relaxed);
+      }
+      sum_ns[s].store(0, memory_order_relaxed);
+      for (int e = 0; e < n_perf_events; e++) {
+        perf[s][e].store(0, memory_order_relaxed);
+      }
+      perf_samples[s].store(0, memory_order_relaxed);
+    }
+    for (int c = 0; c < n_counters; c++) {
+      counters[c].store(0, memory_order_relaxed);
+    }
+    for (int q = 0; q < n_iterates; q++) {
+      for (int i = 0; i < n_iterate_buckets; i++) {
+        iterates[q][i].store(0, memory_order_relaxed);
+      }
+    }
+  }
+};
+
+static void Add(atomic<uint64_t>& value, uint64_t n) {
+  value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Shards live as long as the process, so that the counts of threads that
+// exited stay in the totals.
+static mutex shards_mutex;
+static vector<Shard*> shards;
+
+static thread_local Shard* thread_shard = NULL;
+
+static Shard& ThreadShard() {
+  if (!thread_shard) {
+    thread_shard = new Shard;
+    lock_guard<mutex> lock(shards_mutex);
+    shards.push_back(thread_shard);
+  }
+  return *thread_shard;
+}
+
+void DetachThreadMetrics() {
+  // A shard of its own that no scrape reads.
+  thread_shard = new Shard;
+}
+
+const char* StageName(Stage stage) {
+  return stage_names[int(stage)];
+}
+
+void RecordStage(Stage stage, chrono::steady_clock::duration elapsed) {
+  int64_t ns = chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+  uint64_t value = ns > 0 ? uint64_t(ns) : 0;
+  Shard& shard = ThreadShard();
+  Add(shard.buckets[int(stage)][Bucket(value)], 1);
+  Add(shard.sum_ns[int(stage)], value);
+}
+
+void RecordStageCounters(Stage stage, const PerfReading& begin, const PerfReading& end) {
+  if (!begin.ok || !end.ok) {
+    return;
+  }
+  Shard& shard = ThreadShard();
+  for (int e = 0; e < n_perf_events; e++) {
+    Add(shard.perf[int(stage)][e], end.counts[e] - begin.counts[e]);
+  }
+  Add(shard.perf_samples[int(stage)], 1);
+}
+
+void CountEvent(Counter counter, uint64_t n) {
+  Add(ThreadShard().counters[int(counter)], n);
+}
+
+void RecordIterate(Iterate iterate, double value) {
+  int i = 0;
+  if (value > 0) {
+    double step = floor((log10(value) - min_decade) * iterate_steps);
+    i = step < 0 ? 0 : int(min(step, double(n_iterate_buckets - 2))) + 1;
+  }
+  Add(ThreadShard().iterates[int(iterate)][i], 1);
+}
+
+static void Append(string& out, const char* format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+static void Append(string& out, const char* format, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (n > 0) {
+    out.append(line, min(size_t(n), sizeof(line) - 1));
+  }
+}
+
+static void AppendCounter(string& out, const char* name, const char* help, uint64_t value) {
+  Append(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+         (unsigned long long)value);
+}
+
+void WriteMetrics(string& out) {
+  // Merge the shards.
+  vector<uint64_t> buckets(n_stages * n_buckets, 0);
+  uint64_t sum_ns[n_stages] = { 0 };
+  uint64_t perf[n_stages][n_perf_events] = { { 0 } };
+  uint64_t perf_samples[n_stages] = { 0 };
+  uint64_t counters[n_counters] = { 0 };
+  vector<uint64_t> iterates(n_iterates * n_iterate_buckets, 0);
+  {
+    lock_guard<mutex> lock(shards_mutex);
+    for (const Shard* shard : shards) {
+      for (int s = 0; s < n_stages; s++) {
+        for (int i = 0; i < n_buckets; i++) {
+          buckets[s * n_buckets + i] += shard->buckets[s][i].load(memory_order_relaxed);
+        }
+        sum_ns[s] += shard->sum_ns[s].load(memory_order_relaxed);
+        for (int e = 0; e < n_perf_events; e++) {
+          perf[s][e] += shard->perf[s][e].load(memory_order_relaxed);
+        }
+        perf_samples[s] += shard->perf_samples[s].load(memory_order_relaxed);
+      }
+      for (int c = 0; c < n_counters; c++) {
+        counters[c] += shard->counters[c].load(memory_order_relaxed);
+      }
+      for (int q = 0; q < n_iterates; q++) {
+        for (int i = 0; i < n_iterate_buckets; i++) {
+          iterates[q * n_iterate_buckets + i] += shard->iterates[q][i].load(memory_order_relaxed);
+        }
+      }
+    }
+  }
+
+  out.clear();
+  Append(out, "# HELP mpc_stage_seconds Time spent in each stage of the pipeline.\n");
+  Append(out, "# TYPE mpc_stage_seconds histogram\n");
+  for (int s = 0; s < n_stages; s++) {
+    const uint64_t* counts = &buckets[s * n_buckets];
+    uint64_t cumulative = 0;
+    int i = 0;
+    for (int bits = first_export_bits; bits <= last_export_bits; bits++) {
+      for (; i < n_buckets && BucketLow(i) < (uint64_t(1) << bits); i++) {
+        cumulative += counts[i];
+      }
+      Append(out, "mpc_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n", stage_names[s],
+             double(uint64_t(1) << bits) * 1e-9, (unsigned long long)cumulative);
+    }
+    for (; i < n_buckets; i++) {
+      cumulative += counts[i];
+    }
+    Append(out, "mpc_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", stage_names[s],
+           (unsigned long long)cumulative);
+    Append(out, "mpc_stage_seconds_sum{stage=\"%s\"} %.9g\n", stage_names[s], sum_ns[s] * 1e-9);
+    Append(out, "mpc_stage_seconds_count{stage=\"%s\"} %llu\n", stage_names[s],
+           (unsigned long long)cumulative);
+  }
+
+  // Quantiles at the resolution of the fine buckets, which the exported
+  // bounds are too coarse for.
+  Append(out, "# HELP mpc_stage_quantile_seconds Quantiles of the time spent in each stage.\n");
+  Append(out, "# TYPE mpc_stage_quantile_seconds gauge\n");
+  for (int s = 0; s < n_stages; s++) {
+    const uint64_t* counts = &buckets[s * n_buckets];
+    uint64_t total = 0;
+    for (int i = 0; i < n_buckets; i++) {
+      total += counts[i];
+    }
+    if (total == 0) {
+      continue;
+    }
+    for (double q : quantiles) {
+      uint64_t rank = uint64_t(q * (total - 1)) + 1;
+      uint64_t seen = 0;
+      int i = 0;
+      for (; i < n_buckets - 1; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+          break;
+        }
+      }
+      // Midpoint of the bucket.
+      double value = 0.5 * (BucketLow(i) + BucketLow(i + 1 < n_buckets ? i + 1 : i));
+      Append(out, "mpc_stage_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9g\n",
+             stage_names[s], q, value * 1e-9);
+    }
+  }
+
+  // Only the stages counted while the hardware counters were on.
+  bool counted = false;
+  for (int s = 0; s < n_stages; s++) {
+    counted = counted || perf_samples[s] > 0;
+  }
+  if (counted) {
+    for (int e = 0; e < n_perf_events; e++) {
+      Append(out, "# HELP mpc_stage_%s_total %s in each stage, in user space.\n", perf_names[e], perf_helps[e]);
+      Append(out, "# TYPE mpc_stage_%s_total counter\n", perf_names[e]);
+      for (int s = 0; s < n_stages; s++) {
+        if (perf_samples[s] > 0) {
+          Append(out, "mpc_stage_%s_total{stage=\"%s\"} %llu\n", perf_names[e], stage_names[s],
+                 (unsigned long long)perf[s][e]);
+        }
+      }
+    }
+    Append(out, "# HELP mpc_stage_counted_total Stages with hardware counts.\n");
+    Append(out, "# TYPE mpc_stage_counted_total counter\n");
+    for (int s = 0; s < n_stages; s++) {
+      if (perf_samples[s] > 0) {
+        Append(out, "mpc_stage_counted_total{stage=\"%s\"} %llu\n", stage_names[s],
+               (unsigned long long)perf_samples[s]);
+      }
+    }
+  }
+
+  // Bucket i > 0 holds values below 10^(min_decade + i / iterate_steps),
+  // so the decades are bounds of whole buckets.
+  Append(out, "# HELP mpc_ipopt_iterate Infeasibilities, barrier parameter and step sizes of every Ipopt iteration.\n");
+  Append(out, "# TYPE mpc_ipopt_iterate histogram\n");
+  for (int q = 0; q < n_iterates; q++) {
+    const uint64_t* counts = &iterates[q * n_iterate_buckets];
+    uint64_t cumulative = counts[0];
+    for (int decade = min_decade; decade <= max_decade; decade++) {
+      if (decade > min_decade) {
+        for (int k = 1; k <= iterate_steps; k++) {
+          cumulative += counts[(decade - 1 - min_decade) * iterate_steps + k];
+        }
+      }
+      Append(out, "mpc_ipopt_iterate_bucket{quantity=\"%s\",le=\"1e%d\"} %llu\n", iterate_names[q],
+             decade, (unsigned long long)cumulative);
+    }
+    cumulative += counts[n_iterate_buckets - 1];
+    Append(out, "mpc_ipopt_iterate_bucket{quantity=\"%s\",le=\"+Inf\"} %llu\n", iterate_names[q],
+           (unsigned long long)cumulative);
+    Append(out, "mpc_ipopt_iterate_count{quantity=\"%s\"} %llu\n", iterate_names[q],
+           (unsigned long long)cumulative);
+  }
+
+  AppendCounter(out, "mpc_frames_total", "Telemetry frames solved.", counters[int(Counter::Frames)]);
+  AppendCounter(out, "mpc_solver_iterations_total", "Solver iterations over all frames.",
+                counters[int(Counter::SolverIterations)]);
+  AppendCounter(out, "mpc_solver_failures_total", "Solves that did not converge.",
+                counters[int(Counter::SolverFailures)]);
+  AppendCounter(out, "mpc_dropped_frames_total", "Frames replaced by a newer one before being solved.",
+                counters[int(Counter::DroppedFrames)]);
+  AppendCounter(out, "mpc_line_search_trials_total", "Line search trials of the Ipopt iterations.",
+                counters[int(Counter::LineSearchTrials)]);
+  AppendCounter(out, "mpc_received_bytes_total", "Payload bytes of the websocket messages received.",
+                counters[int(Counter::BytesReceived)]);
+  AppendCounter(out, "mpc_sent_bytes_total", "Payload bytes of the messages sent.",
+                counters[int(Counter::BytesSent)]);
+  AppendCounter(out, "mpc_reused_waypoints_total", "Waypoints of waypoints frames not sent again.",
+                counters[int(Counter::WaypointsReused)]);
+  AppendCounter(out, "mpc_waypoint_resends_total", "Waypoints frames answered with a request to resend the window.",
+                counters[int(Counter::WaypointResends)]);
+  AppendCounter(out, "mpc_congested_sends_total", "Messages sent to a socket with a queue.",
+                counters[int(Counter::CongestedSends)]);
+  AppendCounter(out, "mpc_observer_drops_total", "Observations skipped for observers that were behind.",
+                counters[int(Counter::ObserverDrops)]);
+  AppendCounter(out, "mpc_missed_ticks_total", "Control ticks skipped while the controller was busy.",
+                counters[int(Counter::MissedTicks)]);
+  AppendCounter(out, "mpc_follow_ups_total", "Commands sent from the delivered plan between solves.",
+                counters[int(Counter::FollowUps)]);
+  AppendCounter(out, "mpc_replayed_frames_total", "Frames answered from the last plan without a solve.",
+                counters[int(Counter::ReplayedFrames)]);
+  AppendCounter(out, "mpc_pursuit_frames_total", "Frames answered by pure pursuit in the hybrid mode.",
+                counters[int(Counter::PursuitFrames)]);
+  AppendCounter(out, "mpc_mode_switches_total", "Switches between pure pursuit and the MPC.",
+                counters[int(Counter::ModeSwitches)]);
+  AppendCounter(out, "mpc_fallback_shifted_total", "Solves that fell back to the shifted previous plan.",
+                counters[int(Counter::FallbackShifted)]);
+  AppendCounter(out, "mpc_fallback_pursuit_total", "Solves without a plan, answered by pure pursuit.",
+                counters[int(Counter::FallbackPursuit)]);
+  AppendCounter(out, "mpc_deadline_stops_total", "Ipopt solves stopped by their deadline.",
+                counters[int(Counter::DeadlineStops)]);
+  AppendCounter(out, "mpc_plans_total", "Solves of the planners of the two-rate mode.",
+                counters[int(Counter::Plans)]);
+  AppendCounter(out, "mpc_obstacle_constraints_total", "Obstacles the solves kept clear of, summed over the frames.",
+                counters[int(Counter::ObstacleConstraints)]);
+  AppendCounter(out, "mpc_scenario_consensus_total", "Scenario solves that agreed on their first control.",
+                counters[int(Counter::ScenarioConsensus)]);
+  AppendCounter(out, "mpc_sensitivity_updates_total", "Riccati solves answered by a first-order sensitivity update.",
+                counters[int(Counter::SensitivityUpdates)]);
+  AppendCounter(out, "mpc_batch_steals_total", "Instances a batch worker took from the queue of another.",
+                counters[int(Counter::BatchSteals)]);
+  AppendCounter(out, "mpc_batch_downgrades_total", "Batch frames answered by the fallback to meet their deadline.",
+                counters[int(Counter::BatchDowngrades)]);
+  AppendCounter(out, "mpc_batch_deadline_misses_total", "Batch solves that finished after their deadline.",
+                counters[int(Counter::BatchDeadlineMisses)]);
+  AppendCounter(out, "mpc_batch_resumes_total", "Reconnections that resumed their session's controller.",
+                counters[int(Counter::BatchResumes)]);
+  AppendCounter(out, "mpc_flight_dumps_total", "Spikes the flight recorder wrote out.",
+                counters[int(Counter::FlightDumps)]);
+  AppendCounter(out, "mpc_shed_steps_total", "Steps of the load shedding that gave up more optional work.",
+                counters[int(Counter::ShedSteps)]);
+  AppendCounter(out, "mpc_shed_restores_total", "Steps of the load shedding that took optional work back.",
+                counters[int(Counter::ShedRestores)]);
+  AppendCounter(out, "mpc_shed_frames_total", "Frames solved with some of their optional work shed.",
+                counters[int(Counter::ShedFrames)]);
+  AppendCounter(out, "mpc_shadow_frames_total", "Frames handed to the shadow controllers.",
+                counters[int(Counter::ShadowFrames)]);
+  AppendCounter(out, "mpc_shadow_drops_total", "Frames replaced before the shadow solved them.",
+                counters[int(Counter::ShadowDrops)]);
+  AppendCounter(out, "mpc_rejected_waypoints_total", "Waypoints dropped beyond the capacity of a frame.",
+                counters[int(Counter::RejectedWaypoints)]);
+  AppendCounter(out, "mpc_budget_rejections_total", "Solvers not made or released to keep within a memory budget.",
+                counters[int(Counter::BudgetRejections)]);
+  AppendCounter(out, "mpc_coarse_starts_total", "Cold solves started from the coarse problem.",
+                counters[int(Counter::CoarseStarts)]);
+  AppendCounter(out, "mpc_offline_solves_total", "Problems of offline queries solved.",
+                counters[int(Counter::OfflineSolves)]);
+  AppendCounter(out, "mpc_offline_rejections_total", "Offline query frames refused.",
+                counters[int(Counter::OfflineRejections)]);
+  AppendCounter(out, "mpc_keep_warm_total", "Keep-warm passes over the controllers of idle vehicles.",
+                counters[int(Counter::KeepWarms)]);
+  AppendCounter(out, "mpc_plan_library_starts_total", "Cold solves started from a plan of the plan library.",
+                counters[int(Counter::LibraryStarts)]);
+  AppendCounter(out, "mpc_plan_library_misses_total", "Cold solves that found no plan in the plan library.",
+                counters[int(Counter::LibraryMisses)]);
+  AppendCounter(out, "mpc_solution_cache_hits_total", "Solves answered from the solution cache.",
+                counters[int(Counter::CacheHits)]);
+  AppendCounter(out, "mpc_solution_cache_seeds_total", "Cold solves started from a cached solution.",
+                counters[int(Counter::CacheSeeds)]);
+  AppendCounter(out, "mpc_solution_cache_misses_total", "Lookups of the solution cache that found nothing.",
+                counters[int(Counter::CacheMisses)]);
+  Append(out, "# HELP mpc_solution_cache_bytes Bytes of the entries of the solution caches.\n");
+  Append(out, "# TYPE mpc_solution_cache_bytes gauge\n");
+  Append(out, "mpc_solution_cache_bytes %llu\n", (unsigned long long)counters[int(Counter::CacheBytes)]);
+  Append(out, "# HELP mpc_send_buffered_bytes Payload bytes sent but not yet written by the sockets.\n");
+  Append(out, "# TYPE mpc_send_buffered_bytes gauge\n");
+  Append(out, "mpc_send_buffered_bytes %llu\n",
+         (unsigned long long)(counters[int(Counter::BytesSent)] - counters[int(Counter::BytesWritten)]));
+  AppendCounter(out, "mpc_allocations_total", "Heap allocations, counted with MPC_COUNT_ALLOCS only.",
+                AllocCount());
+  // By stage, where any were counted; "other" is outside the stages.
+  StageAllocs allocs = AllocsByStage();
+  const char* alloc_names[] = { "allocations", "allocated_bytes" };
+  const char* alloc_helps[] = { "Heap allocations", "Bytes of the heap allocations" };
+  for (int k = 0; k < 2; k++) {
+    const uint64_t* values = k == 0 ? allocs.count : allocs.bytes;
+    bool any = false;
+    for (int s = 0; s <= n_stages; s++) {
+      any = any || values[s] > 0;
+    }
+    if (!any) {
+      continue;
+    }
+    Append(out, "# HELP mpc_stage_%s_total %s in each stage, counted with MPC_COUNT_ALLOCS only.\n",
+           alloc_names[k], alloc_helps[k]);
+    Append(out, "# TYPE mpc_stage_%s_total counter\n", alloc_names[k]);
+    for (int s = 0; s <= n_stages; s++) {
+      if (values[s] > 0) {
+        Append(out, "mpc_stage_%s_total{stage=\"%s\"} %llu\n", alloc_names[k],
+               s < n_stages ? stage_names[s] : "other", (unsigned long long)values[s]);
+      }
+    }
+  }
+  WriteTenantMetrics(out);
+}
@@ -0,0 +1,188 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include "PerfCounters.h"
+
+// Latency histograms and counters of the pipeline, served in the
+// Prometheus text format.
+//
+// Every thread records into histograms of its own, created on its first
+// record, so recording is a couple of relaxed loads and stores with no
+// lock and no shared cache line. A scrape merges the threads' histograms.
+
+// Stages of a frame with a latency histogram each.
+enum class Stage {
+  // Decoding of the websocket message.
+  Parse,
+  // Map to vehicle frame and latency prediction.
+  Transform,
+  Polyfit,
+  Solve,
+  // Writing the reply.
+  Format,
+  // The websocket send of a released reply.
+  Send,
+  // Arrival of the frame to the handover of its reply to the sender; the
+  // emulated actuator latency comes on top.
+  EndToEnd,
+  // Function and derivative evaluations of an Ipopt solve.
+  Evaluation,
+  // The rest of an Ipopt solve: mostly the linear algebra of the steps.
+  IpoptInternal,
+  // Solves answered by the solution cache, Ipopt solves it seeded, and
+  // those started from neither it nor a previous solution (see
+  // SolutionCache.h); the speedup of a hit is that over a cold solve.
+  CacheHit,
+  CacheSeeded,
+  ColdSolve,
+  // Age of a frame when the event loop reads it: from the stamp the
+  // gateway puts on its shared ring slot (SharedRing::Push), so the time
+  // it waited in the ring. Other transports are stamped on reading; see
+  // Telemetry::arrived.
+  Arrival,
+  // From the read of a frame to the start of its solve on a worker: the
+  // wait in the controller's mailbox behind the solves before it.
+  Queue,
+  // Solves of the first frame of a vehicle after a gap of the batch's
+  // idle gap, that of a controller kept warm over the gap and that of one
+  // left to go cold (see MPCBatch::KeepWarm).
+  IdleWarm,
+  IdleCold
+};
+const int n_stages = 16;
+
+enum class Counter {
+  Frames,
+  SolverIterations,
+  SolverFailures,
+  // Frames replaced by a newer one before their solve started.
+  DroppedFrames,
+  LineSearchTrials,
+  // Payload bytes of the websocket messages received, after any
+  // decompression, of the messages sent, and of those sent that the
+  // sockets have written out or dropped (see SendCounted).
+  BytesReceived,
+  BytesSent,
+  BytesWritten,
+  // Waypoints of binary waypoints frames taken from their connection's
+  // window instead of sent, and frames answered with a request to resend
+  // the window whole (see BinaryProtocol.h).
+  WaypointsReused,
+  WaypointResends,
+  // Messages sent to a socket that still had a queue.
+  CongestedSends,
+  // Observations not sent to an observer that was behind.
+  ObserverDrops,
+  // Control ticks skipped because the controller was still busy with a
+  // frame (see MPCBatch::Tick).
+  MissedTicks,
+  // Commands sent from the delivered plan between solves (see
+  // MPCBatch::FollowUp).
+  FollowUps,
+  // Frames answered from the last plan instead of a solve (see
+  // ControllerOptions::replay_frames).
+  ReplayedFrames,
+  // Frames answered by the pure pursuit of the hybrid mode, and switches
+  // between it and the MPC (see ControllerOptions::hybrid).
+  PursuitFrames,
+  ModeSwitches,
+  // Solves that fell back to the shifted previous plan, that had no plan
+  // to apply and were answered by pure pursuit instead, and Ipopt solves
+  // stopped by their deadline.
+  FallbackShifted,
+  FallbackPursuit,
+  DeadlineStops,
+  // Solves of the planners of the two-rate mode (see Planner.h).
+  Plans,
+  // Obstacles the solves kept clear of, summed over the frames (see
+  // ControllerOptions::obstacles).
+  ObstacleConstraints,
+  // Solves of the scenarios that agreed on their first control (see
+  // ControllerOptions::scenarios).
+  ScenarioConsensus,
+  // Solves of the Riccati backend answered by a sensitivity update (see
+  // MPC::SetSensitivityUpdate).
+  SensitivityUpdates,
+  // Instances a batch worker took from the queue of another, frames it
+  // answered by the fallback because their solve would have missed the
+  // deadline, and solves that finished after it anyway (see MPCBatch).
+  BatchSteals,
+  BatchDowngrades,
+  BatchDeadlineMisses,
+  // Reconnections that took their controller back warm (see
+  // MPCBatch::Acquire).
+  BatchResumes,
+  // Spikes the flight recorder wrote out (see FlightRecorder.h).
+  FlightDumps,
+  // Steps of the load shedding up and back down, and the frames solved
+  // with some of their optional work shed (see LoadShedding.h).
+  ShedSteps,
+  ShedRestores,
+  ShedFrames,
+  // Frames handed to the shadow controllers, and those replaced before
+  // the shadow started on them (see Shadow.h).
+  ShadowFrames,
+  ShadowDrops,
+  // Waypoints of frames beyond the capacity of the decoders or of the
+  // controller, dropped, and MPCs that a controller did not make, or let
+  // go, to stay within its memory budget (see
+  // ControllerOptions::memory_budget).
+  RejectedWaypoints,
+  BudgetRejections,
+  // Cold solves of the Ipopt backends started from the coarse problem
+  // (see MPC::SetCoarseStart).
+  CoarseStarts,
+  // Problems of offline queries solved by the batch workers (see
+  // MPCBatch::Submit), and the query frames refused.
+  OfflineSolves,
+  OfflineRejections,
+  // Passes of the keep-warm over the controllers of idle vehicles (see
+  // MPCBatch::KeepWarm).
+  KeepWarms,
+  // Solves that needed a guess and took it from the plan library, and
+  // those that found none there (see PlanLibrary.h).
+  LibraryStarts,
+  LibraryMisses,
+  // Lookups of the solution caches that answered the solve, that seeded
+  // it and that found nothing, and the bytes the caches hold.
+  CacheHits,
+  CacheSeeds,
+  CacheMisses,
+  CacheBytes
+};
+const int n_counters = 46;
+
+// Quantities of every Ipopt iterate, over many orders of magnitude.
+enum class Iterate {
+  PrimalInfeasibility,
+  DualInfeasibility,
+  Barrier,
+  PrimalStep,
+  DualStep
+};
+const int n_iterates = 5;
+
+// The label of a stage in the metrics, e.g. "solve".
+const char* StageName(Stage stage);
+
+void RecordStage(Stage stage, std::chrono::steady_clock::duration elapsed);
+
+// Add the hardware counts of a stage, from the reading at its start to
+// that at its end; nothing unless both are ok.
+void RecordStageCounters(Stage stage, const PerfReading& begin, const PerfReading& end);
+
+void CountEvent(Counter counter, uint64_t n = 1);
+
+void RecordIterate(Iterate iterate, double value);
+
+// Keep what the calling thread records from now on out of the metrics,
+// for work that is not the server's own (see Shadow.h).
+void DetachThreadMetrics();
+
+// Write all metrics of all threads to out, in the Prometheus text format.
+void WriteMetrics(std::string& out);
+
+#endif /* METRICS_H */
@@ -0,0 +1,84 @@
+#include "ModelCalibration.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include "Weights.h"
+
+using namespace std;
+
+struct NamedParameter {
+  const char* name;
+  double ModelCalibration::*field;
+  // Least value, and whether it may be reached.
+  double least;
+  bool inclusive;
+};
+
+static const NamedParameter named_parameters[] = {
+  { "lag_ms", &ModelCalibration::lag_ms, 0, true },
+  { "understeer", &ModelCalibration::understeer, 0, true },
+  { "steer_gain", &ModelCalibration::steer_gain, 0, false },
+  { "throttle_gain", &ModelCalibration::throttle_gain, 0, false },
+};
+
+bool ParseModelCalibration(const string& text, ModelCalibration& model, string& error) {
+  ModelCalibration parsed = model;
+  size_t i = 0;
+  string name;
+  string value;
+  while (NextSettingToken(text, i, name)) {
+    const NamedParameter* named = NULL;
+    for (const NamedParameter& p : named_parameters) {
+      if (name == p.name) {
+        named = &p;
+      }
+    }
+    if (!named) {
+      error = "unknown parameter " + name;
+      return false;
+    }
+    if (!NextSettingToken(text, i, value)) {
+      error = "no value for " + name;
+      return false;
+    }
+    char* end;
+    double x = strtod(value.c_str(), &end);
+    if (*end != '\0' || !isfinite(x) || x < named->least || (!named->inclusive && x == named->least)) {
+      error = "bad value " + value + " for " + name;
+      return false;
+    }
+    parsed.*named->field = x;
+  }
+  model = parsed;
+  return true;
+}
+
+bool LoadModelCalibration(const string& path, ModelCalibration& model, string& error) {
+  ifstream in(path.c_str());
+  if (!in) {
+    error = "cannot read " + path;
+    return false;
+  }
+  stringstream text;
+  text << in.rdbuf();
+  return ParseModelCalibration(text.str(), model, error);
+}
+
+string FormatModelCalibration(const ModelCalibration& model) {
+  string out;
+  char line[64];
+  for (const NamedParameter& p : named_parameters) {
+    snprintf(line, sizeof(line), "%s %.17g\n", p.name, model.*p.field);
+    out += line;
+  }
+  return out;
+}
+
+void ApplyModelCalibration(const ModelCalibration& model, ControllerOptions& options) {
+  options.actuator_lag_ms = model.lag_ms;
+  options.understeer = model.understeer;
+  options.steer_gain = model.steer_gain;
+  options.throttle_gain = model.throttle_gain;
+}
@@ -0,0 +1,48 @@
+#ifndef MODEL_CALIBRATION_H
+#define MODEL_CALIBRATION_H
+
+#include <string>
+#include "Controller.h"
+
+// The vehicle as the controllers model it, fitted to recorded telemetry by
+// tools/mpc_calibrate.cpp, as text in the format of the weights (see
+// Weights.h), e.g.
+//
+//   lag_ms 42.5
+//   understeer 0.00031
+//   steer_gain 0.94
+//   throttle_gain 1.12
+//
+// The wheelbase Lf is compiled in; a vehicle that turns as one of
+// wheelbase L would is modelled with steer_gain Lf / L, which is the same
+// yaw rate.
+struct ModelCalibration {
+  // Time from the actuators a frame reports to their effect on the pose,
+  // in milliseconds, over the latency of the commands.
+  double lag_ms;
+  // Understeer of the model, see YawGain (Kinematics.h).
+  double understeer;
+  // Model steering and acceleration per unit of the steering and throttle
+  // reported and commanded.
+  double steer_gain;
+  double throttle_gain;
+
+  ModelCalibration() : lag_ms(0), understeer(0), steer_gain(1), throttle_gain(1) {}
+};
+
+// Parse text into model. A bad name or value, or a negative lag or
+// understeer or a gain that is not positive, leaves model unchanged and
+// returns false with the reason in error.
+bool ParseModelCalibration(const std::string& text, ModelCalibration& model, std::string& error);
+
+// Parse the file at path.
+bool LoadModelCalibration(const std::string& path, ModelCalibration& model, std::string& error);
+
+// One "name value" line per parameter, as ParseModelCalibration reads it
+// back.
+std::string FormatModelCalibration(const ModelCalibration& model);
+
+// Model the vehicle of options as model does.
+void ApplyModelCalibration(const ModelCalibration& model, ControllerOptions& options);
+
+#endif /* MODEL_CALIBRATION_H */
@@ -0,0 +1,57 @@
+#ifndef MOVE_BLOCKS_H
+#define MOVE_BLOCKS_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+// Move blocking: the actuators are held constant over blocks of
+// consecutive stages, so a plan has one free pair of actuators per block
+// instead of one per stage.
+//
+// lengths are the numbers of stages of the blocks from the first stage on,
+// a length of 0 counting as 1. The last block extends to the end of the
+// horizon and lengths past it are ignored; no lengths leave every stage a
+// block of its own. Fills block_of with the block of each of the stages
+// and block_start with the first stage of each block, and returns the
+// number of blocks.
+inline size_t MoveBlockIndex(const std::vector<size_t>& lengths, size_t stages, size_t* block_of,
+                             size_t* block_start) {
+  size_t block = 0;
+  size_t end = lengths.empty() ? 1 : std::max<size_t>(lengths[0], 1);
+  for (size_t k = 0; k < stages; k++) {
+    if (k >= end && (lengths.empty() || block + 1 < lengths.size())) {
+      block++;
+      end += lengths.empty() ? 1 : std::max<size_t>(lengths[block], 1);
+    }
+    if (k == 0 || block_of[k - 1] != block) {
+      block_start[block] = k;
+    }
+    block_of[k] = block;
+  }
+  return stages > 0 ? block + 1 : 0;
+}
+
+// Parse comma-separated block lengths, e.g. "1,1,2,3,4". Returns false if
+// text is not a list of positive integers.
+inline bool ParseMoveBlocks(const char* text, std::vector<size_t>& lengths) {
+  lengths.clear();
+  for (const char* p = text;;) {
+    char* end;
+    long n = strtol(p, &end, 10);
+    if (end == p || n <= 0) {
+      return false;
+    }
+    lengths.push_back(size_t(n));
+    if (*end == 0) {
+      return true;
+    }
+    if (*end != ',') {
+      return false;
+    }
+    p = end + 1;
+  }
+}
+
+#endif /* MOVE_BLOCKS_H */
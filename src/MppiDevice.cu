@@ -0,0 +1,186 @@
+// The device path of MPPI (MppiDevice.h), built with MPC_CUDA.
+#include "MppiDevice.h"
+#include <cuda_runtime.h>
+#include <curand_kernel.h>
+#include <math.h>
+#include "Logger.h"
+
+// Threads of a block, a power of two for the reductions.
+static const int block_threads = 256;
+
+// The clipped perturbations of sample i, one per actuator of every block;
+// sample 0 is the unperturbed plan, so the step never loses it.
+__device__ static void Perturb(const MppiDeviceProblem& p, size_t i, double* noise) {
+  if (i == 0) {
+    for (size_t j = 0; j < 2 * p.blocks; j++) {
+      noise[j] = 0;
+    }
+    return;
+  }
+  curandStatePhilox4_32_10_t rng;
+  curand_init(p.seed, i, 0, &rng);
+  for (size_t j = 0; j < 2 * p.blocks; j++) {
+    double sigma = j % 2 == 0 ? p.sigma_delta : p.sigma_a;
+    size_t s = 2 * p.block_start[j / 2] + j % 2;
+    double u = fmin(fmax(p.u[s] + sigma * curand_normal_double(&rng), p.u_lb[s]), p.u_ub[s]);
+    noise[j] = u - p.u[s];
+  }
+}
+
+// Cost of the rollout of one perturbed plan, the terms of StepSamples
+// (SimdKernelsImpl.cpp) over every stage.
+__device__ static double Rollout(const MppiDeviceProblem& p, const double* noise) {
+  double x = p.x0[0];
+  double y = p.x0[1];
+  double psi = p.x0[2];
+  double v = p.x0[3];
+  double cte = p.x0[4];
+  double epsi = p.x0[5];
+  const Weights& w = p.weights;
+  double cost = w.cte * (cte - p.ref_cte[0]) * (cte - p.ref_cte[0]) +
+                w.epsi * (epsi - p.ref_epsi[0]) * (epsi - p.ref_epsi[0]) + w.v * (v - p.ref_v[0]) * (v - p.ref_v[0]);
+  double delta_prev = 0;
+  double a_prev = 0;
+  for (size_t k = 0; k < p.stages; k++) {
+    double delta = p.u[2 * k] + noise[2 * p.block_of[k]];
+    double a = p.u[2 * k + 1] + noise[2 * p.block_of[k] + 1];
+    cost += w.delta * delta * delta + w.a * a * a;
+    if (k > 0) {
+      cost += w.ddelta * (delta - delta_prev) * (delta - delta_prev) + w.da * (a - a_prev) * (a - a_prev);
+    }
+
+    const double dt = p.dt[k];
+    double f = ((p.c[3] * x + p.c[2]) * x + p.c[1]) * x + p.c[0];
+    double df = (3 * p.c[3] * x + 2 * p.c[2]) * x + p.c[1];
+    double turn = v * delta * dt / (p.Lf * (1 + p.understeer * v * v));
+    double cte1 = (f - y) + v * sin(epsi) * dt;
+    double epsi1 = (psi - atan(df)) + turn;
+    x += v * cos(psi) * dt;
+    y += v * sin(psi) * dt;
+    psi += turn;
+    v += a * dt;
+    cte = cte1;
+    epsi = epsi1;
+
+    const double ref_cte = p.ref_cte[k + 1];
+    const double ref_epsi = p.ref_epsi[k + 1];
+    const double ref_v = p.ref_v[k + 1];
+    cost += w.cte * (cte - ref_cte) * (cte - ref_cte) + w.epsi * (epsi - ref_epsi) * (epsi - ref_epsi) +
+            w.v * (v - ref_v) * (v - ref_v);
+    delta_prev = delta;
+    a_prev = a;
+  }
+  return cost;
+}
+
+// value reduced over the block with op, returned to every thread.
+template <class Op>
+__device__ static double BlockReduce(double value, double* shared, Op op) {
+  shared[threadIdx.x] = value;
+  __syncthreads();
+  for (int half = block_threads / 2; half > 0; half /= 2) {
+    if (int(threadIdx.x) < half) {
+      shared[threadIdx.x] = op(shared[threadIdx.x], shared[threadIdx.x + half]);
+    }
+    __syncthreads();
+  }
+  double result = shared[0];
+  __syncthreads();
+  return result;
+}
+
+struct Min {
+  __device__ double operator()(double a, double b) const { return fmin(a, b); }
+};
+
+struct Sum {
+  __device__ double operator()(double a, double b) const { return a + b; }
+};
+
+__global__ static void SampleKernel(const MppiDeviceProblem* problems, double* costs, size_t cost_stride,
+                                    MppiDeviceResult* results) {
+  __shared__ double shared[block_threads];
+  const MppiDeviceProblem& p = problems[blockIdx.x];
+  double* cost = costs + blockIdx.x * cost_stride;
+  double noise[2 * mppi_device_max_stages];
+
+  double best = INFINITY;
+  for (size_t i = threadIdx.x; i < p.samples; i += block_threads) {
+    Perturb(p, i, noise);
+    cost[i] = Rollout(p, noise);
+    best = fmin(best, cost[i]);
+  }
+  best = BlockReduce(best, shared, Min());
+
+  // Importance weights, relative to the best sample to keep exp in range.
+  double sums[2 * mppi_device_max_stages];
+  for (size_t j = 0; j < 2 * p.blocks; j++) {
+    sums[j] = 0;
+  }
+  double total = 0;
+  for (size_t i = threadIdx.x; i < p.samples; i += block_threads) {
+    double weight = exp(-(cost[i] - best) / p.temperature);
+    total += weight;
+    Perturb(p, i, noise);
+    for (size_t j = 0; j < 2 * p.blocks; j++) {
+      sums[j] += weight * noise[j];
+    }
+  }
+  MppiDeviceResult& result = results[blockIdx.x];
+  total = BlockReduce(total, shared, Sum());
+  for (size_t j = 0; j < 2 * p.blocks; j++) {
+    double sum = BlockReduce(sums[j], shared, Sum());
+    if (threadIdx.x == 0) {
+      result.weighted_noise[j] = sum;
+    }
+  }
+  if (threadIdx.x == 0) {
+    result.total_weight = total;
+  }
+}
+
+bool MppiDevice::Available() {
+  int devices = 0;
+  return cudaGetDeviceCount(&devices) == cudaSuccess && devices > 0;
+}
+
+MppiDevice::MppiDevice(size_t max_problems, size_t max_samples)
+    : max_problems_(max_problems), max_samples_(max_samples), problems_(NULL), results_(NULL), costs_(NULL) {
+  if (cudaMalloc(&problems_, max_problems * sizeof(MppiDeviceProblem)) != cudaSuccess ||
+      cudaMalloc(&results_, max_problems * sizeof(MppiDeviceResult)) != cudaSuccess ||
+      cudaMalloc(&costs_, max_problems * max_samples * sizeof(double)) != cudaSuccess) {
+    MPC_LOG(LogLevel::Error, "Failed to allocate the MPPI device buffers: %s",
+            cudaGetErrorString(cudaGetLastError()));
+    cudaFree(problems_);
+    cudaFree(results_);
+    cudaFree(costs_);
+    problems_ = NULL;
+    results_ = NULL;
+    costs_ = NULL;
+  }
+}
+
+MppiDevice::~MppiDevice() {
+  cudaFree(problems_);
+  cudaFree(results_);
+  cudaFree(costs_);
+}
+
+bool MppiDevice::Run(const MppiDeviceProblem* problems, size_t n, MppiDeviceResult* results) {
+  if (!Ready() || n > max_problems_) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (problems[i].samples > max_samples_ || problems[i].stages > mppi_device_max_stages) {
+      return false;
+    }
+  }
+  cudaMemcpy(problems_, problems, n * sizeof(MppiDeviceProblem), cudaMemcpyHostToDevice);
+  SampleKernel<<<unsigned(n), block_threads>>>(problems_, costs_, max_samples_, results_);
+  cudaError_t error = cudaMemcpy(results, results_, n * sizeof(MppiDeviceResult), cudaMemcpyDeviceToHost);
+  if (error != cudaSuccess) {
+    MPC_LOG(LogLevel::Error, "MPPI device step failed: %s", cudaGetErrorString(error));
+    return false;
+  }
+  return true;
+}
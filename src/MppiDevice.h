@@ -0,0 +1,105 @@
+#ifndef MPPI_DEVICE_H
+#define MPPI_DEVICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Tuning.h"
+
+// The rollouts of MPPI on a CUDA device, for hosts with one, in builds
+// with MPC_CUDA (MppiDevice.cu); other builds have only the stubs below,
+// which find no device.
+//
+// Each problem, the sampling step of one vehicle, runs in one block of
+// the grid: its threads stride over the samples, simulate each with the
+// step of SimdKernels.h and keep the costs in device memory, then weigh
+// the samples against the best of the block and reduce the weighted
+// perturbations in shared memory. Only those sums come back, two numbers
+// per block of stages, so the sample count costs device time alone.
+//
+// The perturbations are drawn from a counter-based generator (Philox) at
+// the sample's own subsequence of the problem's seed, and drawn again
+// for the weighting instead of being stored, so a step is deterministic
+// for its seed however the samples are scheduled. The header sees no
+// Eigen and no CUDA, so that host code includes it freely.
+
+// Stages of the longest compiled horizon.
+const size_t mppi_device_max_stages = 15;
+
+struct MppiDeviceProblem {
+  size_t samples;
+  size_t stages;
+  // Move blocks (see MoveBlocks.h): the block of every stage, and the
+  // stage whose actuators every block perturbs.
+  size_t blocks;
+  size_t block_of[mppi_device_max_stages];
+  size_t block_start[mppi_device_max_stages];
+  // The generator's seed of this step; sample i draws from subsequence i.
+  uint64_t seed;
+
+  double x0[6];
+  double c[4];
+  double Lf;
+  double understeer;
+  // References of the initial state and of every stage's.
+  double ref_cte[mppi_device_max_stages + 1];
+  double ref_epsi[mppi_device_max_stages + 1];
+  double ref_v[mppi_device_max_stages + 1];
+  Weights weights;
+  double temperature;
+  double sigma_delta;
+  double sigma_a;
+  // Stage lengths, and the plan [delta_0, a_0, ...] with its bounds.
+  double dt[mppi_device_max_stages];
+  double u[2 * mppi_device_max_stages];
+  double u_lb[2 * mppi_device_max_stages];
+  double u_ub[2 * mppi_device_max_stages];
+};
+
+struct MppiDeviceResult {
+  // Sum over the samples of weight * perturbation, per actuator of every
+  // block, and of the weights, with the best sample's weight 1.
+  double weighted_noise[2 * mppi_device_max_stages];
+  double total_weight;
+};
+
+class MppiDevice {
+ public:
+  // Whether the build has the device path and a device is there.
+  static bool Available();
+
+  // Device buffers for up to max_problems problems of up to max_samples
+  // samples each.
+  MppiDevice(size_t max_problems, size_t max_samples);
+
+  ~MppiDevice();
+
+  // Whether the buffers were allocated.
+  bool Ready() const { return problems_ != NULL; }
+
+  // Run n problems, one block each, and wait for their results. False,
+  // with a logged error, when the device fails or they do not fit.
+  bool Run(const MppiDeviceProblem* problems, size_t n, MppiDeviceResult* results);
+
+ private:
+  size_t max_problems_;
+  size_t max_samples_;
+  // Device memory: the problems, the results and the costs of the
+  // samples, max_samples per problem.
+  MppiDeviceProblem* problems_;
+  MppiDeviceResult* results_;
+  double* costs_;
+};
+
+#ifndef MPC_CUDA
+// Without MPC_CUDA there is no device, and MPPI stays on the CPU.
+inline bool MppiDevice::Available() { return false; }
+
+inline MppiDevice::MppiDevice(size_t max_problems, size_t max_samples)
+    : max_problems_(max_problems), max_samples_(max_samples), problems_(NULL), results_(NULL), costs_(NULL) {}
+
+inline MppiDevice::~MppiDevice() {}
+
+inline bool MppiDevice::Run(const MppiDeviceProblem*, size_t, MppiDeviceResult*) { return false; }
+#endif /* MPC_CUDA */
+
+#endif /* MPPI_DEVICE_H */
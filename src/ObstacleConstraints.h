@@ -0,0 +1,119 @@
+#ifndef OBSTACLE_CONSTRAINTS_H
+#define OBSTACLE_CONSTRAINTS_H
+
+#include <stddef.h>
+#include <vector>
+#include "Layout.h"
+
+// An obstacle to keep clear of: a circle, in the vehicle frame when handed
+// to the MPC and in map coordinates in an ObstacleMap.
+struct Obstacle {
+  double x;
+  double y;
+  double radius;
+};
+
+// The obstacle rows of the Ipopt problems, the last rows of Layout. There
+// are max_obstacles slots, each with a row at every state after the
+// first:
+//
+//   (x_i - ox)^2 + (y_i - oy)^2 + s_i >= radius^2
+//
+// with the centre (ox, oy) of the slot's obstacle a dynamic parameter and
+// the radius in the bound, so the problem structure is the same however
+// many obstacles a frame has. The slack s_i >= 0 is penalized with those
+// of LinearConstraints.h, which keeps the problem feasible when the
+// vehicle starts inside a circle. A slot left empty has its rows
+// unbounded and its slacks fixed at 0, so Ipopt takes them out.
+//
+// The rows depend on x_i and y_i alone and their Hessian is diagonal, so
+// the problems write the derivatives out, as for the linear rows, rather
+// than record them on a tape.
+template <size_t N>
+inline size_t ObstacleRow(size_t slot, size_t i) {
+  return Layout<N>::obstacle_start + slot * (N - 1) + i - 1;
+}
+
+template <size_t N>
+inline size_t ObstacleSlack(size_t slot, size_t i) {
+  return Layout<N>::obstacle_slack_start + slot * (N - 1) + i - 1;
+}
+
+// Write the obstacle rows of vars into g, at their rows of the problem.
+// V, P and G are anything indexable on double.
+template <size_t N, class V, class P, class G>
+inline void ObstacleRows(const V& vars, const P& params, G& g) {
+  typedef Layout<N> L;
+  for (size_t k = 0; k < max_obstacles; k++) {
+    const double ox = params[obstacles_start + 2 * k];
+    const double oy = params[obstacles_start + 2 * k + 1];
+    for (size_t i = 1; i < N; i++) {
+      g[ObstacleRow<N>(k, i)] = (vars[L::x(i)] - ox) * (vars[L::x(i)] - ox) +
+                                (vars[L::y(i)] - oy) * (vars[L::y(i)] - oy) +
+                                vars[ObstacleSlack<N>(k, i)];
+    }
+  }
+}
+
+// Jacobian structure of the obstacle rows, appended in the order
+// ObstacleJacobianValues writes the values.
+template <size_t N, class Index>
+inline void ObstacleJacobianStructure(std::vector<Index>& rows, std::vector<Index>& cols) {
+  typedef Layout<N> L;
+  for (size_t k = 0; k < max_obstacles; k++) {
+    for (size_t i = 1; i < N; i++) {
+      rows.push_back(ObstacleRow<N>(k, i));
+      cols.push_back(L::x(i));
+      rows.push_back(ObstacleRow<N>(k, i));
+      cols.push_back(L::y(i));
+      rows.push_back(ObstacleRow<N>(k, i));
+      cols.push_back(ObstacleSlack<N>(k, i));
+    }
+  }
+}
+
+// The values of that structure at vars; returns the end of them.
+template <size_t N, class Number, class P>
+inline Number* ObstacleJacobianValues(const Number* vars, const P& params, Number* J) {
+  typedef Layout<N> L;
+  for (size_t k = 0; k < max_obstacles; k++) {
+    const double ox = params[obstacles_start + 2 * k];
+    const double oy = params[obstacles_start + 2 * k + 1];
+    for (size_t i = 1; i < N; i++) {
+      *J++ = 2 * (vars[L::x(i)] - ox);
+      *J++ = 2 * (vars[L::y(i)] - oy);
+      *J++ = 1;
+    }
+  }
+  return J;
+}
+
+// Hessian entries of the obstacle rows, (x_i, x_i) and (y_i, y_i) for
+// every state after the first, in the order ObstacleHessianValues adds
+// to them.
+template <size_t N, class Index>
+inline void ObstacleHessianStructure(std::vector<Index>& rows, std::vector<Index>& cols) {
+  typedef Layout<N> L;
+  for (size_t i = 1; i < N; i++) {
+    rows.push_back(L::x(i));
+    cols.push_back(L::x(i));
+    rows.push_back(L::y(i));
+    cols.push_back(L::y(i));
+  }
+}
+
+// Add the Hessian of sum lambda * row of the obstacle rows to values, the
+// k-th entry of that structure at values[index[k]].
+template <size_t N, class Number, class I>
+inline void ObstacleHessianValues(const Number* lambda, const I& index, Number* values) {
+  for (size_t i = 1; i < N; i++) {
+    Number sum = 0;
+    for (size_t k = 0; k < max_obstacles; k++) {
+      sum += lambda[ObstacleRow<N>(k, i)];
+    }
+    values[index[2 * (i - 1)]] += 2 * sum;
+    values[index[2 * (i - 1) + 1]] += 2 * sum;
+  }
+}
+
+#endif /* OBSTACLE_CONSTRAINTS_H */
@@ -0,0 +1,112 @@
+#include "ObstacleMap.h"
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+
+using namespace std;
+
+ObstacleMap::ObstacleMap() : path_(NULL) {}
+
+bool ObstacleMap::Load(const string& path) {
+  obstacles_.clear();
+  entries_.clear();
+  path_ = NULL;
+  ifstream in(path.c_str());
+  string line;
+  if (!getline(in, line)) {
+    return false;
+  }
+  while (getline(in, line)) {
+    Obstacle obstacle;
+    if (sscanf(line.c_str(), "%lf,%lf,%lf", &obstacle.x, &obstacle.y, &obstacle.radius) == 3 &&
+        obstacle.radius > 0) {
+      obstacles_.push_back(obstacle);
+    }
+  }
+  return !obstacles_.empty();
+}
+
+void ObstacleMap::Add(const Obstacle& obstacle) {
+  obstacles_.push_back(obstacle);
+  // The index no longer holds them all.
+  entries_.clear();
+  path_ = NULL;
+}
+
+void ObstacleMap::Index(const ReferencePath& path) {
+  entries_.clear();
+  path_ = NULL;
+  if (path.Size() == 0) {
+    return;
+  }
+  for (size_t i = 0; i < obstacles_.size(); i++) {
+    Entry entry;
+    entry.obstacle = obstacles_[i];
+    size_t hint = ReferencePath::no_hint;
+    entry.s = path.Progress(entry.obstacle.x, entry.obstacle.y, hint);
+    PathSample sample = path.Sample(hint);
+    entry.d = -(entry.obstacle.x - sample.x) * sin(sample.heading) +
+              (entry.obstacle.y - sample.y) * cos(sample.heading);
+    entries_.push_back(entry);
+  }
+  sort(entries_.begin(), entries_.end());
+  path_ = &path;
+}
+
+// The obstacle in the vehicle frame of the pose (px, py, psi).
+static Obstacle InFrame(const Obstacle& obstacle, double px, double py, double psi) {
+  double c = cos(psi);
+  double s = sin(psi);
+  double dx = obstacle.x - px;
+  double dy = obstacle.y - py;
+  Obstacle local = { dx * c + dy * s, -dx * s + dy * c, obstacle.radius };
+  return local;
+}
+
+size_t ObstacleMap::Query(double px, double py, double psi, size_t hint, double reach, double corridor,
+                          Obstacle* out) const {
+  size_t n = 0;
+  if (path_ && hint != ReferencePath::no_hint && !entries_.empty()) {
+    // From corridor behind the vehicle, for a circle it is still passing,
+    // to reach ahead, wrapping around the end of the loop.
+    const double length = path_->Length();
+    const double first = fmod(path_->Sample(hint).s - corridor + length, length);
+    const double span = corridor + reach;
+    Entry key;
+    key.s = first;
+    size_t start = size_t(lower_bound(entries_.begin(), entries_.end(), key) - entries_.begin());
+    for (size_t k = 0; k < entries_.size() && n < max_obstacles; k++) {
+      const Entry& entry = entries_[(start + k) % entries_.size()];
+      double along = fmod(entry.s - first + length, length);
+      if (along > span + entry.obstacle.radius) {
+        break;
+      }
+      if (fabs(entry.d) <= corridor + entry.obstacle.radius) {
+        out[n++] = InFrame(entry.obstacle, px, py, psi);
+      }
+    }
+    return n;
+  }
+
+  // Every obstacle by its distance, keeping the nearest.
+  Obstacle nearest[max_obstacles + 1];
+  double distance[max_obstacles + 1];
+  for (size_t i = 0; i < obstacles_.size(); i++) {
+    Obstacle local = InFrame(obstacles_[i], px, py, psi);
+    double d = hypot(local.x, local.y) - local.radius;
+    if (d > reach || local.x < -(corridor + local.radius)) {
+      continue;
+    }
+    size_t j = n;
+    for (; j > 0 && distance[j - 1] > d; j--) {
+      nearest[j] = nearest[j - 1];
+      distance[j] = distance[j - 1];
+    }
+    nearest[j] = local;
+    distance[j] = d;
+    n = min(n + 1, max_obstacles);
+  }
+  copy(nearest, nearest + n, out);
+  return n;
+}
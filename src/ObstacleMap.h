@@ -0,0 +1,64 @@
+#ifndef OBSTACLE_MAP_H
+#define OBSTACLE_MAP_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "ObstacleConstraints.h"
+#include "ReferencePath.h"
+
+// The static obstacles of a scene, circles in map coordinates, and the
+// query that picks the few of them a solve has to keep clear of.
+//
+// A scene may hold any number of obstacles, but the MPC has only
+// max_obstacles slots (Layout.h), so every frame keeps only those within
+// the corridor the horizon can reach. Indexed along a reference path, the
+// obstacles are sorted by the arc length of their nearest point of the
+// path, found with the path's own grid (ReferencePath::Progress); a query
+// then binary searches the stretch from the vehicle to the end of its
+// reach and keeps those near enough to the centre line, the nearest
+// along the path first. Without a path every obstacle is tested by its
+// distance from the vehicle, and the nearest kept.
+class ObstacleMap {
+ public:
+  ObstacleMap();
+
+  // Read an "x,y,radius" CSV with a header line, in map coordinates.
+  // False when the file cannot be read or holds no obstacle.
+  bool Load(const std::string& path);
+
+  void Add(const Obstacle& obstacle);
+
+  size_t Size() const { return obstacles_.size(); }
+
+  // Sort the obstacles along path, for the queries with it. path must
+  // outlive the map, or the next Index.
+  void Index(const ReferencePath& path);
+
+  // Write to out, at most max_obstacles of them, the obstacles whose
+  // circle comes within corridor metres of the centre line up to reach
+  // metres ahead of the vehicle pose (px, py, psi), in its vehicle frame,
+  // and return how many. hint is the path sample nearest to the vehicle,
+  // as ReferencePath::Local leaves it; with no_hint, or without an
+  // index, every obstacle is tested by its distance.
+  size_t Query(double px, double py, double psi, size_t hint, double reach, double corridor,
+               Obstacle* out) const;
+
+ private:
+  struct Entry {
+    // Arc length of the nearest point of the path and signed offset from
+    // the path, positive to the left.
+    double s;
+    double d;
+    Obstacle obstacle;
+
+    bool operator<(const Entry& other) const { return s < other.s; }
+  };
+
+  std::vector<Obstacle> obstacles_;
+  // The obstacles by increasing arc length, along path_.
+  std::vector<Entry> entries_;
+  const ReferencePath* path_;
+};
+
+#endif /* OBSTACLE_MAP_H */
@@ -0,0 +1,107 @@
+#include "PerfCounters.h"
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "Logger.h"
+
+using namespace std;
+
+atomic<bool> perf_enabled(false);
+
+#ifdef __linux__
+static const uint64_t perf_configs[n_perf_events] = {
+  PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// The group of a thread, the cycles its leader. Closed with the thread.
+struct PerfGroup {
+  int fds[n_perf_events];
+  bool opened;
+  bool failed;
+
+  PerfGroup() : opened(false), failed(false) {
+    for (int i = 0; i < n_perf_events; i++) {
+      fds[i] = -1;
+    }
+  }
+
+  ~PerfGroup() { Close(); }
+
+  bool Open() {
+    for (int i = 0; i < n_perf_events; i++) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = perf_configs[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0));
+      if (fds[i] < 0) {
+        Close();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Close() {
+    for (int i = n_perf_events - 1; i >= 0; i--) {
+      if (fds[i] >= 0) {
+        close(fds[i]);
+        fds[i] = -1;
+      }
+    }
+  }
+};
+
+static PerfGroup& ThreadGroup() {
+  static thread_local PerfGroup group;
+  if (!group.opened && !group.failed) {
+    group.opened = group.Open();
+    group.failed = !group.opened;
+  }
+  return group;
+}
+#endif
+
+bool SetPerfCounters(bool enabled) {
+#ifdef __linux__
+  if (enabled && !ThreadGroup().opened) {
+    MPC_LOG(LogLevel::Warning, "Hardware counters unavailable, perf_event_open failed");
+    return false;
+  }
+  perf_enabled.store(enabled);
+  return true;
+#else
+  if (enabled) {
+    MPC_LOG(LogLevel::Warning, "Hardware counters are only counted on Linux");
+  }
+  return !enabled;
+#endif
+}
+
+PerfReading ReadPerfCounters() {
+  PerfReading reading;
+  reading.ok = false;
+  if (!PerfCountersEnabled()) {
+    return reading;
+  }
+#ifdef __linux__
+  PerfGroup& group = ThreadGroup();
+  // With PERF_FORMAT_GROUP: the number of counters, then their values.
+  uint64_t values[1 + n_perf_events];
+  if (group.opened && read(group.fds[0], values, sizeof(values)) == ssize_t(sizeof(values)) &&
+      values[0] == uint64_t(n_perf_events)) {
+    memcpy(reading.counts, values + 1, sizeof(reading.counts));
+    reading.ok = true;
+  }
+#endif
+  return reading;
+}
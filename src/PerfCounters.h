@@ -0,0 +1,38 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Hardware performance counters of the calling thread, for telling the
+// stages that are bound by compute from those bound by memory: cycles and
+// instructions (their ratio is the IPC), last-level cache misses and
+// mispredicted branches, in user space only.
+//
+// Every thread opens its own perf_event_open group on its first reading
+// and keeps it for its lifetime; a reading is one read(2) of the group.
+// Counting is off until SetPerfCounters(true), and only on Linux; while
+// off, a reading costs one relaxed load. Metrics.h sums them per stage
+// and Trace.h attaches them to the spans.
+enum class PerfEvent { Cycles, Instructions, CacheMisses, BranchMisses };
+const int n_perf_events = 4;
+
+// The counts of the calling thread, or ok false while counting is off or
+// the thread could not open its group.
+struct PerfReading {
+  uint64_t counts[n_perf_events];
+  bool ok;
+};
+
+extern std::atomic<bool> perf_enabled;
+
+// Turn counting on or off. Turning it on opens the group of the calling
+// thread as a check, and fails, leaving it off, where the kernel refuses
+// (see /proc/sys/kernel/perf_event_paranoid).
+bool SetPerfCounters(bool enabled);
+
+inline bool PerfCountersEnabled() { return perf_enabled.load(std::memory_order_relaxed); }
+
+PerfReading ReadPerfCounters();
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,135 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <uWS/uWS.h>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "Telemetry.h"
+
+// Types of the telemetry -> solve -> send pipeline. The event loop parses
+// frames and posts them to MPCBatch, whose workers solve them and hand the
+// commands back to the loop for sending.
+
+typedef std::chrono::steady_clock PipelineClock;
+
+// What observers are sent of a solved frame: the state it was solved from,
+// the actuators and the plan, and how the solve went. Fixed-size, so that
+// filling it costs a copy and no allocation.
+struct Observation {
+  // Index of the controller in its batch.
+  size_t vehicle;
+  // Pose and speed of the telemetry, in map coordinates.
+  double px;
+  double py;
+  double psi;
+  double v;
+  // Cross-track and heading errors of the state solved from, the pose
+  // predicted over the latency, against the fitted reference.
+  double cte;
+  double epsi;
+  // The actuators sent, in the simulator's convention.
+  double steering_angle;
+  double throttle;
+  bool ok;
+  double cost;
+  int iterations;
+  double solve_time;
+  // Wall time of the stages of the frame, in seconds: the transform with
+  // the latency prediction, the fit, the solve stage (the solve and the
+  // cache, pursuit or replay around it) and the reply.
+  double transform_time;
+  double polyfit_time;
+  double solve_stage_time;
+  double format_time;
+  double latency;
+  size_t horizon;
+  // Predicted trajectory in the vehicle frame.
+  double mpc_x[Telemetry::max_points];
+  double mpc_y[Telemetry::max_points];
+  size_t n_mpc;
+};
+
+// The actuators of a plan over the stages of its horizon, in the
+// simulator's convention, for the commands between solves (see
+// Controller::FollowUp): stage k lasts dt growth^k, and the first is the
+// reply's. n is 0 for a reply not to follow, e.g. a replayed one.
+struct ActuationPlan {
+  size_t n;
+  double dt;
+  double growth;
+  double steering[Telemetry::max_points];
+  double throttle[Telemetry::max_points];
+};
+
+// The latest plan of a controller, as its solver thread publishes it for
+// the others (see Controller::LatestPlan): the actuators over the horizon
+// and the predicted trajectory in the vehicle frame of its frame.
+struct PublishedPlan {
+  // False after a Reset, until the next solve.
+  bool valid;
+  // Solves of the controller, this one included.
+  uint64_t solves;
+  // When its frame was read, and when it was solved.
+  PipelineClock::time_point received;
+  PipelineClock::time_point solved;
+  // The actuators of its reply, in the simulator's convention.
+  double steering_angle;
+  double throttle;
+  bool ok;
+  double cost;
+  int iterations;
+  double solve_time;
+  // Cross-track and heading errors of the state solved from.
+  double cte;
+  double epsi;
+  ActuationPlan actuation;
+  double x[Telemetry::max_points];
+  double y[Telemetry::max_points];
+  size_t n;
+};
+
+// A problem of an offline query (see MPCBatch::Submit): the initial state
+// [x, y, psi, v, cte, epsi] in the vehicle frame, the coefficients of the
+// reference polynomial and the references, solved cold.
+struct OfflineProblem {
+  double state[6];
+  double coeffs[4];
+  double cte_ref;
+  double epsi_ref;
+  double v_ref;
+};
+
+// The solution of an offline problem: the outcome of its solve (see
+// MPC::Result) and the n actuators of its plan.
+struct OfflineSolution {
+  bool ok;
+  bool usable;
+  double cost;
+  int iterations;
+  double solve_time;
+  size_t n;
+  double delta[Telemetry::max_points];
+  double a[Telemetry::max_points];
+};
+
+// The reply to a frame, built on a solver thread.
+struct Command {
+  uWS::WebSocket<uWS::SERVER>* ws;
+  // msg is binary unless framing is Framing::Text.
+  Framing framing;
+  std::string msg;
+  // When the frame was read and when it arrived (see Telemetry::arrived),
+  // and its reply was solved.
+  PipelineClock::time_point received;
+  PipelineClock::time_point arrived;
+  PipelineClock::time_point solved;
+  // Frame counters of the controller's mailbox when the frame was taken.
+  size_t posted;
+  size_t dropped;
+  Observation observation;
+  ActuationPlan actuation;
+};
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,66 @@
+#include "PlanLibrary.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+// How far the cte and epsi a plan started from may be off those of the
+// solve it is to start, which the rollout of its actuators then carries.
+static const double reach_cte = 0.5;
+static const double reach_epsi = 0.1;
+
+PlanLibrary::PlanLibrary(double length, double spacing, double band, size_t n_bands)
+    : length_(max(length, spacing)),
+      spacing_(spacing),
+      band_(band),
+      n_cells_(size_t(ceil(length_ / spacing))),
+      n_bands_(max<size_t>(n_bands, 1)),
+      cells_(new Cell[n_cells_ * n_bands_]) {}
+
+size_t PlanLibrary::Index(double s, double v) const {
+  double wrapped = fmod(s, length_);
+  if (wrapped < 0) {
+    wrapped += length_;
+  }
+  size_t cell = min(size_t(wrapped / spacing_), n_cells_ - 1);
+  size_t speed = min(size_t(max(v, 0.0) / band_), n_bands_ - 1);
+  return cell * n_bands_ + speed;
+}
+
+void PlanLibrary::Insert(double s, const Plan& plan) {
+  Cell& cell = cells_[Index(s, plan.v)];
+  if (cell.writing.exchange(true, memory_order_acquire)) {
+    return;
+  }
+  cell.plan.Write(plan);
+  cell.writing.store(false, memory_order_release);
+}
+
+bool PlanLibrary::Find(double s, double v, double cte, double epsi, Plan& plan) const {
+  return cells_[Index(s, v)].plan.Read(plan) && plan.n > 0 && fabs(plan.cte - cte) <= reach_cte &&
+         fabs(plan.epsi - epsi) <= reach_epsi;
+}
+
+void PlanLibrary::Resample(const Plan& plan, size_t n, double dt, double growth, double* deltas,
+                           double* accels) {
+  // The start of stage k of the plan, and of the one resampled.
+  size_t k = 0;
+  double plan_t = 0;
+  double plan_dt = plan.dt;
+  double t = 0;
+  for (size_t i = 0; i < n; i++) {
+    while (k + 1 < plan.n && plan_t + plan_dt <= t + 1e-9) {
+      plan_t += plan_dt;
+      plan_dt *= plan.growth;
+      k++;
+    }
+    deltas[i] = plan.steering[k];
+    accels[i] = plan.throttle[k];
+    t += dt;
+    dt *= growth;
+  }
+}
+
+size_t PlanLibrary::Bytes() const {
+  return sizeof(*this) + n_cells_ * n_bands_ * sizeof(Cell);
+}
@@ -0,0 +1,81 @@
+#ifndef PLAN_LIBRARY_H
+#define PLAN_LIBRARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include "SeqLock.h"
+
+// Plans of past solves along a reference path, shared by every controller
+// of a process, for the cold starts of the others: vehicles on the same
+// track take the same corners at the same speeds, lap after lap.
+//
+// The library is indexed by the arc length of the path, in cells of
+// spacing metres, and by speed, in bands of band m/s. Every solve that
+// converges keeps its actuators, by time along its stages, as the plan of
+// its cell, in place of the one before; they do not depend on where the
+// path lies in the map, so that with the cte and epsi it started from
+// the plan is relative to the track. A solve that would start cold, or
+// from a warm start its state has left, takes the plan of its cell as the
+// guess when the plan started from about the same cte and epsi (see
+// Controller::SolveWith), so that a vehicle starts from the last solve of
+// any vehicle there instead of from the feedforward.
+//
+// Every cell is a sequence lock; a write that finds another under way
+// is skipped, so neither the writers nor the readers ever wait.
+class PlanLibrary {
+ public:
+  // Stages of a plan kept; a plan of a longer horizon keeps the first,
+  // and a guess over a longer time than a plan holds its last actuators.
+  enum : size_t { max_stages = 16 };
+
+  struct Plan {
+    // The cte, epsi and speed it was solved from.
+    double cte;
+    double epsi;
+    double v;
+    // Its time grid: the time step of its first stage and their growth.
+    double dt;
+    double growth;
+    double cost;
+    size_t n;
+    double steering[max_stages];
+    double throttle[max_stages];
+  };
+
+  // A library along a path of length metres, which wraps around; the
+  // speeds past n_bands bands share the last.
+  explicit PlanLibrary(double length, double spacing = 2, double band = 1, size_t n_bands = 32);
+
+  // Keep plan as the one of the cell of arc length s and its speed.
+  void Insert(double s, const Plan& plan);
+
+  // The plan of the cell of arc length s and speed v, if it started from
+  // within reach of cte and epsi.
+  bool Find(double s, double v, double cte, double epsi, Plan& plan) const;
+
+  // The n actuators of each of plan over stages of dt growing by growth,
+  // each that of the plan at the start of the stage.
+  static void Resample(const Plan& plan, size_t n, double dt, double growth, double* deltas, double* accels);
+
+  size_t Bytes() const;
+
+ private:
+  struct Cell {
+    Cell() : writing(false) {}
+    std::atomic<bool> writing;
+    SeqLock<Plan> plan;
+  };
+
+  double length_;
+  double spacing_;
+  double band_;
+  size_t n_cells_;
+  size_t n_bands_;
+  std::unique_ptr<Cell[]> cells_;
+
+  size_t Index(double s, double v) const;
+};
+
+#endif /* PLAN_LIBRARY_H */
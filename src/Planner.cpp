@@ -0,0 +1,130 @@
+#include "Planner.h"
+#include <math.h>
+#include "Logger.h"
+#include "Metrics.h"
+
+using namespace std;
+using namespace std::chrono;
+
+Planner::Planner(double dt, double interval, double understeer, double ref_v, const Weights& weights)
+    : dt_(dt),
+      interval_(duration_cast<PipelineClock::duration>(duration<double>(interval))),
+      understeer_(understeer),
+      ref_v_(ref_v),
+      started_(false),
+      pending_(false),
+      stop_(false),
+      reset_(false),
+      new_weights_(true),
+      weights_(weights) {
+  if (MPCParallelSetup(2) == 0) {
+    MPC_LOG(LogLevel::Warning, "CppAD has no thread left for the planner, which will not plan");
+    return;
+  }
+  thread_ = thread(&Planner::Run, this);
+  // The next MPCParallelSetup counts this planner's thread.
+  unique_lock<mutex> lock(mutex_);
+  wake_.wait(lock, [this]() { return started_; });
+}
+
+Planner::~Planner() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void Planner::Submit(PipelineClock::time_point received, double frame_x, double frame_y, double frame_psi,
+                     const StateVector& state, const Eigen::Vector4d& coeffs) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    problem_.received = received;
+    problem_.frame_x = frame_x;
+    problem_.frame_y = frame_y;
+    problem_.frame_psi = frame_psi;
+    problem_.state = state;
+    problem_.coeffs = coeffs;
+    pending_ = true;
+  }
+  wake_.notify_one();
+}
+
+bool Planner::Latest(Path& path) const {
+  lock_guard<mutex> lock(mutex_);
+  path = path_;
+  return path.valid;
+}
+
+void Planner::SetWeights(const Weights& weights) {
+  lock_guard<mutex> lock(mutex_);
+  weights_ = weights;
+  new_weights_ = true;
+}
+
+void Planner::Reset() {
+  lock_guard<mutex> lock(mutex_);
+  pending_ = false;
+  reset_ = true;
+  path_.valid = false;
+}
+
+void Planner::Run() {
+  MPCSolverThread();
+  unique_lock<mutex> lock(mutex_);
+  started_ = true;
+  wake_.notify_all();
+  lock.unlock();
+  mpc_.reset(new MPC<N>());
+  mpc_->Init(0, 0, ref_v_);
+  mpc_->SetTimestep(dt_);
+  mpc_->SetUndersteer(understeer_);
+  PipelineClock::time_point next = PipelineClock::time_point();
+  lock.lock();
+  for (;;) {
+    wake_.wait(lock, [this]() { return stop_ || pending_; });
+    if (stop_) {
+      return;
+    }
+    // At most one plan every interval; a problem submitted meanwhile
+    // replaces the pending one.
+    if (PipelineClock::now() < next) {
+      wake_.wait_until(lock, next, [this]() { return stop_; });
+      continue;
+    }
+    Problem problem = problem_;
+    pending_ = false;
+    if (reset_) {
+      mpc_->Reset();
+      reset_ = false;
+    }
+    if (new_weights_) {
+      mpc_->SetWeights(weights_);
+      new_weights_ = false;
+    }
+    next = PipelineClock::now() + interval_;
+    lock.unlock();
+
+    const MPC<N>::Result& result = mpc_->Solve(problem.state, problem.coeffs);
+    Path path;
+    path.valid = result.ok;
+    path.received = problem.received;
+    double c = cos(problem.frame_psi);
+    double s = sin(problem.frame_psi);
+    for (size_t k = 0; k < N; k++) {
+      path.x[k] = problem.frame_x + c * result.x[k] - s * result.y[k];
+      path.y[k] = problem.frame_y + s * result.x[k] + c * result.y[k];
+    }
+    path.v = result.v;
+    CountEvent(Counter::Plans);
+
+    lock.lock();
+    // A Reset while solving drops the plan of the vehicle before it.
+    if (path.valid && !reset_) {
+      path_ = path;
+    }
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "Eigen-3.3/Eigen/Core"
+#include "KinematicModel.h"
+#include "MPC.h"
+#include "Pipeline.h"
+#include "Weights.h"
+
+// The slow layer of the two-rate mode of Controller: a long, coarse MPC
+// solved on a thread of its own at a low rate, whose trajectory the
+// controller's MPC then tracks every frame.
+//
+// Submit hands it the latest problem of a frame, in the vehicle frame of
+// the frame's pose in the world, replacing any not yet taken. The thread
+// solves the latest one at most once every interval and keeps the plan in
+// world coordinates, so that the frames after it can take it into their
+// own vehicle frames. The planner runs the Ipopt backend over the longest
+// compiled horizon, and its solves are recorded in the metrics like the
+// controller's.
+//
+// The thread runs CppAD in parallel mode (see MPCParallelSetup), as one
+// of the threads it was set up for; with none left the planner never
+// plans. Multi-start pools of the other MPCs of the process then need
+// threads of their own beyond it (see MPCParallelSetup).
+class Planner {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  enum : size_t { N = 16 };
+
+  // A plan: the poses of its stages in the world, and when the frame it
+  // was solved for arrived.
+  struct Path {
+    bool valid;
+    PipelineClock::time_point received;
+    Eigen::Matrix<double, N, 1> x;
+    Eigen::Matrix<double, N, 1> y;
+    Eigen::Matrix<double, N, 1> v;
+
+    Path() : valid(false) {}
+  };
+
+  // Plan over N stages of dt seconds, at most once every interval, with
+  // the model's understeer and the reference speed ref_v.
+  Planner(double dt, double interval, double understeer, double ref_v, const Weights& weights);
+
+  ~Planner();
+
+  // Plan for the state and reference of a frame that arrived at received,
+  // in its vehicle frame at (frame_x, frame_y, frame_psi).
+  void Submit(PipelineClock::time_point received, double frame_x, double frame_y, double frame_psi,
+              const StateVector& state, const Eigen::Vector4d& coeffs);
+
+  // Copy the latest plan to path; false when there is none.
+  bool Latest(Path& path) const;
+
+  // Take the weights for the next plans.
+  void SetWeights(const Weights& weights);
+
+  // Forget the plans and the pending problem, and start the next plan cold.
+  void Reset();
+
+ private:
+  struct Problem {
+    PipelineClock::time_point received;
+    double frame_x;
+    double frame_y;
+    double frame_psi;
+    StateVector state;
+    Eigen::Vector4d coeffs;
+  };
+
+  double dt_;
+  PipelineClock::duration interval_;
+  double understeer_;
+  double ref_v_;
+  // Made on the thread, which CppAD knows by then.
+  std::unique_ptr<MPC<N> > mpc_;
+  // Guards everything below.
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  // Whether the thread has claimed its CppAD thread.
+  bool started_;
+  bool pending_;
+  bool stop_;
+  bool reset_;
+  bool new_weights_;
+  Weights weights_;
+  Problem problem_;
+  Path path_;
+  std::thread thread_;
+
+  void Run();
+};
+
+#endif /* PLANNER_H */
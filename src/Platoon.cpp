@@ -0,0 +1,137 @@
+#include "Platoon.h"
+#include <math.h>
+#include <algorithm>
+#include "Eigen-3.3/Eigen/Cholesky"
+
+using namespace std;
+
+PlatoonConsensus::PlatoonConsensus(size_t vehicles, size_t stages, double dt, const PlatoonOptions& options)
+    : vehicles_(vehicles),
+      stages_(stages),
+      dt_(dt),
+      options_(options),
+      exchanged_(false),
+      s_(vehicles * stages),
+      z_ahead_(vehicles > 1 ? (vehicles - 1) * stages : 0),
+      z_behind_(z_ahead_.size()),
+      u_ahead_(z_ahead_.size()),
+      u_behind_(z_ahead_.size()) {}
+
+void PlatoonConsensus::Begin(const double* progress) {
+  for (size_t i = 0; i < vehicles_; i++) {
+    fill(S(i), S(i) + stages_, progress[i]);
+  }
+  // The copies and the duals carry over to the next frame a stage on, as
+  // the ADMM backend's warm start does, the copies extrapolated at the
+  // end.
+  for (vector<double>* v : { &z_ahead_, &z_behind_, &u_ahead_, &u_behind_ }) {
+    for (size_t j = 0; j + 1 < vehicles_; j++) {
+      double* x = &(*v)[j * stages_];
+      copy(x + 1, x + stages_, x);
+      if (stages_ > 2 && (v == &z_ahead_ || v == &z_behind_)) {
+        x[stages_ - 1] = 2 * x[stages_ - 2] - x[stages_ - 3];
+      }
+    }
+  }
+}
+
+void PlatoonConsensus::References(size_t i, double v_free, double* v_ref) const {
+  fill(v_ref, v_ref + stages_, v_free);
+  if (!exchanged_ || vehicles_ < 2 || stages_ < 2) {
+    return;
+  }
+  // The mean t of the copies of vehicle i less their duals: as the one
+  // behind in pair i - 1 and the one ahead in pair i.
+  const size_t n = stages_ - 1;
+  const double copies = (i > 0) + (i + 1 < vehicles_);
+  Vector t(n);
+  for (size_t k = 1; k < stages_; k++) {
+    double sum = 0;
+    if (i > 0) {
+      size_t at = (i - 1) * stages_ + k;
+      sum += z_behind_[at] - u_behind_[at];
+    }
+    if (i + 1 < vehicles_) {
+      size_t at = i * stages_ + k;
+      sum += z_ahead_[at] - u_ahead_[at];
+    }
+    t[k - 1] = sum / copies - S(i)[0];
+  }
+  // The speeds v nearest the vehicle's own reference in the proximal
+  // term of ADMM on the progress dt (v_0 + ... + v_k - 1), with the
+  // progress taken as straight along the path:
+  //
+  //   min |v - v_free|^2 + rho copies |dt L v - t|^2,
+  //
+  // L lower triangular of ones. Its normal equations are symmetric
+  // positive definite.
+  const double weight = options_.rho * copies;
+  Matrix H(n, n);
+  for (size_t r = 0; r < n; r++) {
+    for (size_t c = 0; c < n; c++) {
+      // Rows of L below both r and c.
+      H(r, c) = weight * dt_ * dt_ * double(n - max(r, c)) + (r == c ? 1 : 0);
+    }
+  }
+  Vector g(n);
+  double tail = 0;
+  for (size_t k = n; k-- > 0;) {
+    tail += t[k];
+    g[k] = v_free + weight * dt_ * tail;
+  }
+  Vector v = H.llt().solve(g);
+  for (size_t k = 0; k < n; k++) {
+    v_ref[k] = max(v[k], 0.0);
+  }
+  v_ref[n] = v_ref[n - 1];
+}
+
+void PlatoonConsensus::Report(size_t i, const double* v) {
+  double* s = S(i);
+  for (size_t k = 1; k < stages_; k++) {
+    s[k] = s[k - 1] + v[k - 1] * dt_;
+  }
+}
+
+double PlatoonConsensus::Exchange() {
+  double residual = 0;
+  for (size_t j = 0; j + 1 < vehicles_; j++) {
+    const double* ahead = S(j);
+    const double* behind = S(j + 1);
+    double* za = &z_ahead_[j * stages_];
+    double* zb = &z_behind_[j * stages_];
+    double* ua = &u_ahead_[j * stages_];
+    double* ub = &u_behind_[j * stages_];
+    // The first stage is the vehicles now, which no plan moves.
+    za[0] = ahead[0];
+    zb[0] = behind[0];
+    for (size_t k = 1; k < stages_; k++) {
+      // Project the pair onto the gap, each of them moving half of what
+      // it is short of.
+      double a = ahead[k] + ua[k];
+      double b = behind[k] + ub[k];
+      double shortfall = options_.gap - (a - b);
+      if (shortfall > 0) {
+        a += shortfall / 2;
+        b -= shortfall / 2;
+      }
+      za[k] = a;
+      zb[k] = b;
+      ua[k] += ahead[k] - a;
+      ub[k] += behind[k] - b;
+      residual = max(residual, max(fabs(ahead[k] - a), fabs(behind[k] - b)));
+    }
+  }
+  exchanged_ = true;
+  return residual;
+}
+
+double PlatoonConsensus::Violation() const {
+  double worst = 0;
+  for (size_t j = 0; j + 1 < vehicles_; j++) {
+    for (size_t k = 1; k < stages_; k++) {
+      worst = max(worst, options_.gap - (S(j)[k] - S(j + 1)[k]));
+    }
+  }
+  return worst;
+}
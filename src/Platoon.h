@@ -0,0 +1,97 @@
+#ifndef PLATOON_H
+#define PLATOON_H
+
+#include <stddef.h>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Layout.h"
+
+// Coupling of the vehicles of a platoon, each keeping at least gap metres
+// along the path behind the one ahead.
+struct PlatoonOptions {
+  double gap;
+  // Weight of the consensus on the progress, in 1 / s^2, relative to
+  // that of each vehicle's own reference speed; 0 leaves the vehicles
+  // uncoupled.
+  double rho;
+
+  PlatoonOptions() : gap(10), rho(1) {}
+};
+
+// Consensus ADMM between the MPCs of a platoon, which stay separate
+// problems: each vehicle solves its own, in parallel with the others,
+// and only their predicted progress along the path is exchanged, a few
+// rounds per frame. The spacing constraint between two neighbours,
+//
+//   s_ahead(k) - s_behind(k) >= gap   at every stage k after the first,
+//
+// has a copy of both trajectories of its own (z); every round the
+// vehicles plan towards their copies, the copies are projected onto the
+// constraint from the plans, and the scaled duals (u) add up what the
+// plans still miss of them. The proximal term of ADMM, rho / 2 times the
+// squared distance of a plan's progress from its copies less their
+// duals, is not one the MPC's cost has; a vehicle takes it in through
+// the stage speed references of MPC::SetStageReferences instead, as the
+// speeds that minimize it with the distance from its own reference speed
+// for progress straight along the path. A round's work for a vehicle is
+// one solve and the stages of at most two neighbours, however long the
+// platoon is.
+//
+// A frame starts with Begin, the progress of the vehicles now, and every
+// round ends with Report for each vehicle and Exchange. The copies and
+// duals carry over to the next frame, which is to come dt later; the
+// first frame's first round is solved at the vehicles' own reference
+// speeds. Everything exchanged is the stage arrays, so the vehicles can
+// as well solve in other processes. Vehicle 0 leads; the stages are dt
+// apart.
+class PlatoonConsensus {
+ public:
+  PlatoonConsensus(size_t vehicles, size_t stages, double dt, const PlatoonOptions& options);
+
+  // Start a frame with progress[i], the distance of vehicle i along the
+  // path, shifting the copies and duals of the last a stage on.
+  void Begin(const double* progress);
+
+  // The stage speed references of vehicle i for its next solve, given
+  // its own reference speed v_free.
+  void References(size_t i, double v_free, double* v_ref) const;
+
+  // The speeds of every stage that vehicle i planned.
+  void Report(size_t i, const double* v);
+
+  // Update the copies and the duals from the plans reported; returns the
+  // largest distance between a plan and a copy of it, the residual of
+  // the consensus.
+  double Exchange();
+
+  // Largest shortfall of the gap in the plans reported, in metres.
+  double Violation() const;
+
+  size_t Vehicles() const { return vehicles_; }
+
+ private:
+  size_t vehicles_;
+  size_t stages_;
+  double dt_;
+  PlatoonOptions options_;
+  // Whether there are copies yet.
+  bool exchanged_;
+  // Planned progress of every vehicle, stages_ per vehicle, and the
+  // copies and duals of every pair, vehicle j ahead of j + 1, stages_
+  // per pair.
+  std::vector<double> s_;
+  std::vector<double> z_ahead_;
+  std::vector<double> z_behind_;
+  std::vector<double> u_ahead_;
+  std::vector<double> u_behind_;
+
+  // The proximal problem of References, of at most max_horizon - 1
+  // speeds, in fixed storage.
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, max_horizon, 1> Vector;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_horizon, max_horizon> Matrix;
+
+  double* S(size_t i) { return &s_[i * stages_]; }
+  const double* S(size_t i) const { return &s_[i * stages_]; }
+};
+
+#endif /* PLATOON_H */
@@ -0,0 +1,112 @@
+#ifndef POLYFIT_H
+#define POLYFIT_H
+
+#include <math.h>
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Eigen-3.3/Eigen/LU"
+
+// Least-squares fit of a polynomial of order K, c[0] + c[1] x + ... +
+// c[K] x^K, through the n points (xs[i], ys[i]).
+//
+// Solves the (K + 1) x (K + 1) normal equations in fixed-size storage, so
+// no allocation is made. The abscissae are scaled to [-1, 1] first to keep
+// the normal equations well conditioned for waypoints tens of meters away.
+// Scalar is double but in the embedded build (see Embedded.h).
+template <int K, class Scalar>
+Eigen::Matrix<Scalar, K + 1, 1> Polyfit(const Scalar* xs, const Scalar* ys, size_t n) {
+  typedef Eigen::Matrix<Scalar, K + 1, 1> Vector;
+  typedef Eigen::Matrix<Scalar, K + 1, K + 1> Matrix;
+
+  Scalar scale = 0;
+  for (size_t i = 0; i < n; i++) {
+    scale = std::max(scale, std::abs(xs[i]));
+  }
+  scale = scale > 0 ? scale : 1;
+
+  Matrix AtA = Matrix::Zero();
+  Vector Atb = Vector::Zero();
+  for (size_t i = 0; i < n; i++) {
+    Vector phi;
+    phi[0] = 1;
+    Scalar t = xs[i] / scale;
+    for (int k = 1; k <= K; k++) {
+      phi[k] = phi[k - 1] * t;
+    }
+    AtA.template selfadjointView<Eigen::Lower>().rankUpdate(phi);
+    Atb += phi * ys[i];
+  }
+  // LDLT copes with fewer than K + 1 points, where A'A is singular.
+  Vector c = AtA.template selfadjointView<Eigen::Lower>().ldlt().solve(Atb);
+
+  // Undo the scaling: c_k t^k = (c_k / scale^k) x^k.
+  Scalar s = 1;
+  for (int k = 1; k <= K; k++) {
+    s *= scale;
+    c[k] /= s;
+  }
+  return c;
+}
+
+// Polyfit with a weight ws[i] >= 0 on the square error of every point,
+// and with anchor also through (x0, y0) exactly: the minimum of the
+// weighted error subject to p(x0) = y0, from the (K + 2) x (K + 2) KKT
+// system of the normal equations and the constraint, again in fixed-size
+// storage.
+template <int K>
+Eigen::Matrix<double, K + 1, 1> WeightedPolyfit(const double* xs, const double* ys, const double* ws,
+                                                 size_t n, bool anchor, double x0, double y0) {
+  typedef Eigen::Matrix<double, K + 1, 1> Vector;
+  typedef Eigen::Matrix<double, K + 2, 1> KKTVector;
+  typedef Eigen::Matrix<double, K + 2, K + 2> KKTMatrix;
+
+  double scale = anchor ? fabs(x0) : 0;
+  for (size_t i = 0; i < n; i++) {
+    scale = fmax(scale, fabs(xs[i]));
+  }
+  scale = scale > 0 ? scale : 1;
+
+  KKTMatrix kkt = KKTMatrix::Zero();
+  KKTVector rhs = KKTVector::Zero();
+  for (size_t i = 0; i < n; i++) {
+    Vector phi;
+    phi[0] = 1;
+    double t = xs[i] / scale;
+    for (int k = 1; k <= K; k++) {
+      phi[k] = phi[k - 1] * t;
+    }
+    kkt.template topLeftCorner<K + 1, K + 1>().noalias() += ws[i] * phi * phi.transpose();
+    rhs.template head<K + 1>() += ws[i] * ys[i] * phi;
+  }
+  // A little regularization keeps the system solvable with fewer points
+  // than coefficients, where A'WA is singular.
+  double ridge = 1e-12 * (kkt.trace() + 1);
+  kkt.template topLeftCorner<K + 1, K + 1>().diagonal().array() += ridge;
+  if (anchor) {
+    Vector phi;
+    phi[0] = 1;
+    double t = x0 / scale;
+    for (int k = 1; k <= K; k++) {
+      phi[k] = phi[k - 1] * t;
+    }
+    kkt.template block<K + 1, 1>(0, K + 1) = phi;
+    kkt.template block<1, K + 1>(K + 1, 0) = phi.transpose();
+    rhs[K + 1] = y0;
+  } else {
+    // Leaves the multiplier at 0 and the fit unconstrained.
+    kkt(K + 1, K + 1) = 1;
+  }
+  Vector c = kkt.partialPivLu().solve(rhs).template head<K + 1>();
+
+  double s = 1;
+  for (int k = 1; k <= K; k++) {
+    s *= scale;
+    c[k] /= s;
+  }
+  return c;
+}
+
+#endif /* POLYFIT_H */
@@ -0,0 +1,28 @@
+#ifndef PRECOMPILED_H
+#define PRECOMPILED_H
+
+// The heavy headers of libmpc, precompiled once per build (MPC_PCH) so an
+// edit to the controller does not reparse CppAD, Ipopt and Eigen in every
+// unit it touches. Nothing here may depend on the unit that includes it.
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cppad/cppad.hpp>
+#include <coin/IpIpoptApplication.hpp>
+#include <coin/IpTNLP.hpp>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Eigen-3.3/Eigen/QR"
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+
+#endif /* PRECOMPILED_H */
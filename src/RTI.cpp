@@ -0,0 +1,424 @@
+#include "RTI.h"
+#include "Horner.h"
+#include "Tuning.h"
+#include <math.h>
+#include <algorithm>
+
+// Number of samples used to re-express the reference polynomial in the
+// predicted vehicle frame of the next frame.
+static const int n_samples = 8;
+
+template <size_t N, class Scalar>
+RTI<N, Scalar>::RTI(Scalar dt, Scalar Lf)
+    : model_(dt, Lf),
+      weights_(default_weights),
+      terminal_(Eigen::Matrix<Scalar, n_terminal, n_terminal>::Zero()),
+      has_terminal_(false),
+      initialized_(false),
+      prepared_(false),
+      X_(StateMatrix::Zero()),
+      U_(InputVector::Zero()),
+      coeffs_(CoeffVector::Zero()),
+      Mx_(Eigen::Matrix<Scalar, n_x, 6>::Zero()),
+      Mu_(Eigen::Matrix<Scalar, n_x, n_u>::Zero()),
+      Mc_(Eigen::Matrix<Scalar, n_x, 4>::Zero()),
+      m_(StackedVector::Zero()),
+      q_(StackedVector::Zero()),
+      xref_(StackedVector::Zero()),
+      R_(InputMatrix::Zero()) {
+#ifndef MPC_EMBEDDED
+  refinements_ = 0;
+#endif
+  SetMoveBlocks(std::vector<size_t>());
+  for (size_t k = 0; k < N - 1; k++) {
+    u_lb_(2 * k) = Scalar(-max_delta);
+    u_ub_(2 * k) = Scalar(max_delta);
+    u_lb_(2 * k + 1) = Scalar(-max_a);
+    u_ub_(2 * k + 1) = Scalar(max_a);
+  }
+  SetWeights(default_weights);
+}
+
+template <size_t N, class Scalar>
+RTI<N, Scalar>::~RTI() {}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SetWeights(const Weights& weights) {
+  weights_ = weights;
+  for (size_t k = 0; k < N; k++) {
+    q_(6 * k + 4) = Scalar(weights_.cte);
+    q_(6 * k + 5) = Scalar(weights_.epsi);
+    q_(6 * k + 3) = Scalar(weights_.v);
+  }
+  R_.setZero();
+  for (size_t k = 0; k < N - 1; k++) {
+    R_(2 * k, 2 * k) += Scalar(weights_.delta);
+    R_(2 * k + 1, 2 * k + 1) += Scalar(weights_.a);
+  }
+  // Rate penalties: w * (u_{k+1} - u_k)^2 for each actuator.
+  for (size_t k = 0; k + 2 < N; k++) {
+    for (size_t j = 0; j < 2; j++) {
+      Scalar w = Scalar(j == 0 ? weights_.ddelta : weights_.da);
+      size_t i0 = 2 * k + j;
+      size_t i1 = 2 * (k + 1) + j;
+      R_(i0, i0) += w;
+      R_(i1, i1) += w;
+      R_(i0, i1) -= w;
+      R_(i1, i0) -= w;
+    }
+  }
+  BlockWeights();
+  prepared_ = false;
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SetTerminalCost(const TerminalMatrix& cost) {
+  terminal_ = cost.cast<Scalar>();
+  has_terminal_ = !cost.isZero(0);
+  prepared_ = false;
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SetMoveBlocks(const std::vector<size_t>& lengths) {
+  n_blocks_ = MoveBlockIndex(lengths, N - 1, block_of_, block_start_);
+  T_.setZero();
+  for (size_t k = 0; k < N - 1; k++) {
+    T_(2 * k, 2 * block_of_[k]) = 1;
+    T_(2 * k + 1, 2 * block_of_[k] + 1) = 1;
+  }
+  BlockWeights();
+  prepared_ = false;
+}
+
+#ifndef MPC_EMBEDDED
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SetMixedPrecision(int refinements) {
+  refinements_ = std::max(refinements, 0);
+  prepared_ = false;
+}
+#endif
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::BlockWeights() {
+  Rb_.noalias() = T_.transpose() * R_ * T_;
+  for (size_t i = 2 * n_blocks_; i < n_u; i++) {
+    Rb_(i, i) = 1;
+  }
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SetReference(Scalar cte_ref, Scalar epsi_ref, Scalar v_ref) {
+  Scalar cte[N];
+  Scalar epsi[N];
+  Scalar v[N];
+  std::fill(cte, cte + N, cte_ref);
+  std::fill(epsi, epsi + N, epsi_ref);
+  std::fill(v, v + N, v_ref);
+  SetStageReference(cte, epsi, v);
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SetStageReference(const Scalar* cte_ref, const Scalar* epsi_ref, const Scalar* v_ref) {
+  for (size_t k = 0; k < N; k++) {
+    xref_(6 * k + 3) = v_ref[k];
+    xref_(6 * k + 4) = cte_ref[k];
+    xref_(6 * k + 5) = epsi_ref[k];
+  }
+  prepared_ = false;
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::Reset() {
+  initialized_ = false;
+  prepared_ = false;
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::Rollout(const Vector6& x0) {
+  X_.col(0) = x0;
+  for (size_t k = 0; k < N - 1; k++) {
+    model_.Stage(k).Step(X_.col(k).data(), U_.data() + 2 * k, coeffs_, X_.col(k + 1).data());
+  }
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::Prepare() {
+  if (!initialized_ || prepared_) {
+    return;
+  }
+
+  // The next initial state will be close to the plan's second stage, so
+  // express the plan and the reference polynomial relative to that pose.
+  Scalar x0 = X_(0, 1);
+  Scalar y0 = X_(1, 1);
+  Scalar psi0 = X_(2, 1);
+  Scalar c = cos(psi0);
+  Scalar s = sin(psi0);
+
+  Scalar span = std::max(X_(0, N - 1) - X_(0, 0), Scalar(10));
+  Eigen::Matrix<Scalar, 4, 4> AtA = Eigen::Matrix<Scalar, 4, 4>::Zero();
+  CoeffVector Atb = CoeffVector::Zero();
+  Scalar xs[n_samples];
+  Scalar ys[n_samples];
+  for (int j = 0; j < n_samples; j++) {
+    xs[j] = X_(0, 0) + span * j / (n_samples - 1);
+  }
+  PolyvalBatch<3>(coeffs_, xs, n_samples, ys);
+  for (int j = 0; j < n_samples; j++) {
+    Scalar dx = xs[j] - x0;
+    Scalar dy = ys[j] - y0;
+    Scalar xn = dx * c + dy * s;
+    Scalar yn = -dx * s + dy * c;
+    CoeffVector phi(1, xn, xn * xn, xn * xn * xn);
+    AtA += phi * phi.transpose();
+    Atb += phi * yn;
+  }
+  coeffs_ = AtA.ldlt().solve(Atb);
+
+  for (size_t k = 0; k < N - 1; k++) {
+    Scalar dx = X_(0, k + 1) - x0;
+    Scalar dy = X_(1, k + 1) - y0;
+    X_(0, k) = dx * c + dy * s;
+    X_(1, k) = -dx * s + dy * c;
+    X_(2, k) = X_(2, k + 1) - psi0;
+    X_.template block<3, 1>(3, k) = X_.template block<3, 1>(3, k + 1);
+  }
+  for (size_t i = 0; i + 2 < n_u; i++) {
+    U_(i) = U_(i + 2);
+  }
+  // Blocks take the shifted actuators of their first stage.
+  for (size_t k = 0; k < N - 1; k++) {
+    size_t first = block_start_[block_of_[k]];
+    U_.template segment<2>(2 * k) = U_.template segment<2>(2 * first);
+  }
+  model_.Stage(N - 2).Step(X_.col(N - 2).data(), U_.data() + n_u - 2, coeffs_, X_.col(N - 1).data());
+
+  Linearize();
+  prepared_ = true;
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::Linearize() {
+  Mx_.setZero();
+  Mu_.setZero();
+  Mc_.setZero();
+  m_.setZero();
+  Mx_.template topRows<6>().setIdentity();
+
+  typename Model::StateJacobian As[N - 1];
+  typename Model::InputJacobian Bs[N - 1];
+  typename Model::CoeffJacobian Es[N - 1];
+  LinearizeStages(model_, N - 1, X_, U_.data(), coeffs_, As, Bs, Es, discretization_);
+  for (size_t k = 0; k < N - 1; k++) {
+    const typename Model::StateJacobian& A = As[k];
+    const typename Model::InputJacobian& B = Bs[k];
+    const typename Model::CoeffJacobian& E = Es[k];
+
+    Vector6 gap;
+    model_.Stage(k).Step(X_.col(k).data(), U_.data() + 2 * k, coeffs_, gap.data());
+    gap -= X_.col(k + 1);
+
+    size_t r0 = 6 * k;
+    size_t r1 = 6 * (k + 1);
+    Mx_.template block<6, 6>(r1, 0).noalias() = A * Mx_.template block<6, 6>(r0, 0);
+    Mu_.template block<6, n_u>(r1, 0).noalias() = A * Mu_.template block<6, n_u>(r0, 0);
+    Mu_.template block<6, 2>(r1, 2 * block_of_[k]) += B;
+    Mc_.template block<6, 4>(r1, 0).noalias() = A * Mc_.template block<6, 4>(r0, 0);
+    Mc_.template block<6, 4>(r1, 0) += E;
+    m_.template segment<6>(r1).noalias() = A * m_.template segment<6>(r0);
+    m_.template segment<6>(r1) += gap;
+  }
+
+  // Condensed Gauss-Newton QP. The cost is a sum of weighted squares of
+  // terms that are linear in the states and actuators, so this is exact.
+  Eigen::Map<const StackedVector> Xs(X_.data());
+  QMu_.noalias() = q_.asDiagonal() * Mu_;
+  e_ = Xs + m_ - xref_;
+  // The terminal cost is a quadratic form of errors linear in them too:
+  // those of the last stage's state rows and of the last actuators, the
+  // rows of T.
+  const size_t last = 6 * (N - 1);
+  const size_t last_input = 2 * (N - 2);
+  if (has_terminal_) {
+    terminal_error_ << e_(last + 4), e_(last + 5), e_(last + 3), U_(last_input), U_(last_input + 1);
+    terminal_jacobian_.row(0) = Mu_.row(last + 4);
+    terminal_jacobian_.row(1) = Mu_.row(last + 5);
+    terminal_jacobian_.row(2) = Mu_.row(last + 3);
+    terminal_jacobian_.row(3) = T_.row(last_input);
+    terminal_jacobian_.row(4) = T_.row(last_input + 1);
+  }
+  bool mixed = false;
+#ifndef MPC_EMBEDDED
+  // The Hessian, the one product cubic in the horizon, and its factor in
+  // float.
+  mixed = refinements_ > 0;
+  if (mixed) {
+    Mu_f_ = Mu_.template cast<float>();
+    QMu_f_ = QMu_.template cast<float>();
+    H_f_.noalias() = 2 * Mu_f_.transpose() * QMu_f_;
+    H_f_ += 2 * Rb_.template cast<float>();
+    if (has_terminal_) {
+      Eigen::Matrix<float, n_terminal, n_u> jacobian_f = terminal_jacobian_.template cast<float>();
+      Eigen::Matrix<float, n_terminal, n_u> weighted_f = terminal_.template cast<float>() * jacobian_f;
+      H_f_.noalias() += 2 * jacobian_f.transpose() * weighted_f;
+    }
+    llt_f_.compute(H_f_);
+  }
+#endif
+  if (!mixed) {
+    H_.noalias() = 2 * Mu_.transpose() * QMu_;
+    H_ += 2 * Rb_;
+    if (has_terminal_) {
+      H_.noalias() += 2 * terminal_jacobian_.transpose() * terminal_ * terminal_jacobian_;
+    }
+    llt_.compute(H_);
+  }
+  g0_.noalias() = 2 * QMu_.transpose() * e_;
+  du_.noalias() = R_ * U_;
+  g0_.noalias() += 2 * T_.transpose() * du_;
+  Gx_.noalias() = 2 * QMu_.transpose() * Mx_;
+  Gc_.noalias() = 2 * QMu_.transpose() * Mc_;
+  if (has_terminal_) {
+    // The initial state and the coefficients move the state errors alone.
+    Eigen::Matrix<Scalar, n_u, n_terminal> JP = 2 * terminal_jacobian_.transpose() * terminal_;
+    g0_.noalias() += JP * terminal_error_;
+    const int rows[3] = { int(last) + 4, int(last) + 5, int(last) + 3 };
+    for (int i = 0; i < 3; i++) {
+      Gx_.noalias() += JP.col(i) * Mx_.row(rows[i]);
+      Gc_.noalias() += JP.col(i) * Mc_.row(rows[i]);
+    }
+  }
+}
+
+// Whether x is inside the box [lb, ub].
+template <class Vector, class Bound>
+static bool InBox(const Vector& x, const Bound& lb, const Bound& ub) {
+  for (int i = 0; i < x.size(); i++) {
+    if (x(i) < lb(i) || x(i) > ub(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SolveQP() {
+  for (size_t b = 0; b < n_blocks_; b++) {
+    size_t i = 2 * b;
+    size_t j = 2 * block_start_[b];
+    du_lb_.template segment<2>(i) = u_lb_.template segment<2>(j) - U_.template segment<2>(j);
+    du_ub_.template segment<2>(i) = u_ub_.template segment<2>(j) - U_.template segment<2>(j);
+  }
+  for (size_t i = 2 * n_blocks_; i < n_u; i++) {
+    du_lb_(i) = -1;
+    du_ub_(i) = 1;
+  }
+#ifndef MPC_EMBEDDED
+  if (refinements_ > 0) {
+    SolveMixed();
+    return;
+  }
+#endif
+
+  // Unconstrained minimizer from the factorization made during
+  // preparation. Usually no bound is active and this is the solution.
+  du_ = llt_.solve(-g0_);
+  if (InBox(du_, du_lb_, du_ub_)) {
+    return;
+  }
+
+  // Otherwise solve the box-constrained QP from the clipped step.
+  qp_.Solve(H_, g0_, du_lb_, du_ub_, du_);
+}
+
+#ifndef MPC_EMBEDDED
+template <size_t N, class Scalar>
+void RTI<N, Scalar>::SolveMixed() {
+  // The first pass solves for the step from zero, and every later one for
+  // a correction d of it, in the box left around the step; the gradient
+  // g0 + H du at the step is taken in Scalar, so the step converges to
+  // the solution of the exact QP while H only enters in float.
+  du_.setZero();
+  grad_ = g0_;
+  for (int r = 0; r <= refinements_; r++) {
+    if (r > 0) {
+      QMd_.noalias() = QMu_ * du_;
+      grad_.noalias() = 2 * Mu_.transpose() * QMd_;
+      grad_.noalias() += 2 * Rb_ * du_;
+      if (has_terminal_) {
+        grad_.noalias() += 2 * terminal_jacobian_.transpose() * (terminal_ * (terminal_jacobian_ * du_));
+      }
+      grad_ += g0_;
+    }
+    g_f_ = grad_.template cast<float>();
+    lb_f_ = (du_lb_ - du_).template cast<float>();
+    ub_f_ = (du_ub_ - du_).template cast<float>();
+    d_f_ = llt_f_.solve(-g_f_);
+    if (!InBox(d_f_, lb_f_, ub_f_)) {
+      qp_f_.Solve(H_f_, g_f_, lb_f_, ub_f_, d_f_);
+    }
+    du_ += d_f_.template cast<Scalar>();
+  }
+}
+#endif
+
+template <size_t N, class Scalar>
+Scalar RTI<N, Scalar>::Feedback(const Vector6& state, const CoeffVector& coeffs) {
+  const CoeffVector& cf = coeffs;
+  if (!initialized_) {
+    U_.setZero();
+    coeffs_ = cf;
+    Rollout(state);
+    Linearize();
+    initialized_ = true;
+    prepared_ = true;
+  } else if (!prepared_) {
+    Prepare();
+  }
+
+  // Correct the prepared gradient for the deviation of the measured
+  // state and polynomial from those predicted during preparation.
+  Vector6 dx0 = state - X_.col(0);
+  CoeffVector dc = cf - coeffs_;
+  g0_.noalias() += Gx_ * dx0;
+  g0_.noalias() += Gc_ * dc;
+  SolveQP();
+
+  // Apply the step and re-simulate the nonlinear model from the measured
+  // state for the next preparation phase.
+  U_.noalias() += T_ * du_;
+  U_ = U_.cwiseMax(u_lb_).cwiseMin(u_ub_);
+  coeffs_ = cf;
+  Rollout(state);
+  prepared_ = false;
+  return Cost();
+}
+
+template <size_t N, class Scalar>
+Scalar RTI<N, Scalar>::Cost() const {
+  Scalar cost = 0;
+  for (size_t k = 0; k < N; k++) {
+    Scalar e_cte = X_(4, k) - xref_(6 * k + 4);
+    Scalar e_epsi = X_(5, k) - xref_(6 * k + 5);
+    Scalar e_v = X_(3, k) - xref_(6 * k + 3);
+    cost += Scalar(weights_.cte) * e_cte * e_cte + Scalar(weights_.epsi) * e_epsi * e_epsi +
+            Scalar(weights_.v) * e_v * e_v;
+  }
+  cost += U_.dot(R_ * U_);
+  if (has_terminal_) {
+    Eigen::Matrix<Scalar, n_terminal, 1> e;
+    e << X_(4, N - 1) - xref_(6 * (N - 1) + 4), X_(5, N - 1) - xref_(6 * (N - 1) + 5),
+        X_(3, N - 1) - xref_(6 * (N - 1) + 3), U_(2 * (N - 2)), U_(2 * (N - 2) + 1);
+    cost += e.dot(terminal_ * e);
+  }
+  return cost;
+}
+
+// The embedded build compiles this file for its float solvers alone.
+#ifdef MPC_EMBEDDED
+#define INSTANTIATE(N) template class RTI<N, float>;
+#else
+#define INSTANTIATE(N) template class RTI<N>;
+#endif
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -0,0 +1,194 @@
+#ifndef RTI_H
+#define RTI_H
+
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "BoxQP.h"
+#include "KinematicModel.h"
+#include "Layout.h"
+#include "MoveBlocks.h"
+#include "TerminalCost.h"
+#include "Tuning.h"
+
+// Real-time iteration (RTI) scheme for the kinematic model of FG_eval.
+//
+// Each frame performs a single Gauss-Newton SQP step, split in two phases:
+//  - Prepare: shift the last plan one stage, linearize the model along it
+//    and condense the states out of the QP. This only needs the previous
+//    frame, so it can run while waiting for the next telemetry message.
+//  - Feedback: on arrival of a new frame, correct the prepared QP gradient
+//    for the measured initial state and the new polynomial, then solve the
+//    small box-constrained QP in the actuators exactly (BoxQP).
+//
+// With move blocking the actuators are condensed per block instead of per
+// stage; the QP keeps its size and the variables past the blocks are
+// padding with an identity Hessian that stays at zero.
+//
+// With mixed precision the condensed Hessian is formed and factored in
+// single precision, and the step is refined with corrections against
+// the double-precision gradient (see SetMixedPrecision).
+//
+// All matrices are fixed-size for the horizon N. Scalar is double for
+// the MPC and float for the embedded build (see Embedded.h), which is
+// instantiated there alone, without mixed precision.
+template <size_t N, class Scalar = double>
+class RTI {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef Layout<N> L;
+  enum : int { n_x = L::n_constraints, n_u = L::n_inputs };
+
+  typedef BasicKinematicModel<Scalar> Model;
+  typedef Eigen::Matrix<Scalar, 6, 1> Vector6;
+  typedef typename Model::CoeffVector CoeffVector;
+  typedef Eigen::Matrix<Scalar, 6, N> StateMatrix;
+  typedef Eigen::Matrix<Scalar, n_u, 1> InputVector;
+  typedef Eigen::Matrix<Scalar, n_u, n_u> InputMatrix;
+  typedef Eigen::Matrix<Scalar, n_x, 1> StackedVector;
+
+  RTI(Scalar dt, Scalar Lf);
+
+  virtual ~RTI();
+
+  void SetReference(Scalar cte_ref, Scalar epsi_ref, Scalar v_ref);
+
+  // References of every stage, N values each, for a reference that varies
+  // along the horizon; SetReference sets the same at every stage.
+  void SetStageReference(const Scalar* cte_ref, const Scalar* epsi_ref, const Scalar* v_ref);
+
+  // Cost weights; default_weights until set.
+  void SetWeights(const Weights& weights);
+
+  // Terminal cost of the last stage (see TerminalCost.h), none (zero)
+  // until set. Takes effect from the next preparation.
+  void SetTerminalCost(const TerminalMatrix& cost);
+
+  // Time step of the first stage and growth of the later ones (see
+  // KinematicModel), the step of the constructor and 1 until set. Takes
+  // effect from the next feedback step; Reset first to drop the plan.
+  void SetTimestep(Scalar dt, Scalar growth = 1) {
+    model_.dt = dt;
+    model_.growth = growth;
+  }
+
+  // Understeer of the model (see YawGain, Kinematics.h), 0 until set.
+  void SetUndersteer(Scalar understeer) { model_.understeer = understeer; }
+
+  // Hold the actuators constant over blocks of stages of the given
+  // lengths (see MoveBlocks.h); none, the default, frees every stage.
+  // Takes effect from the next feedback step.
+  void SetMoveBlocks(const std::vector<size_t>& lengths);
+
+#ifndef MPC_EMBEDDED
+  // Form, factor and solve the condensed QP in float, then correct the
+  // step refinements times: each correction solves the float QP again
+  // for the exact gradient at the step, with the Hessian applied in
+  // Scalar as Mu' Q Mu + R without forming it. 0, the default, solves in
+  // Scalar. Takes effect from the next preparation.
+  void SetMixedPrecision(int refinements);
+#endif
+
+  // Linearize and condense around the shifted plan. Does nothing before
+  // the first feedback step.
+  void Prepare();
+
+  // Perform the feedback step for initial state [x, y, psi, v, cte, epsi]
+  // and polynomial coefficients. Preparation is run inline if it has not
+  // been run since the last feedback step. Returns the new plan cost.
+  Scalar Feedback(const Vector6& state, const CoeffVector& coeffs);
+
+  // Actuator plan, [delta_0, a_0, delta_1, a_1, ...].
+  const InputVector& Inputs() const { return U_; }
+
+  // State plan, one stage of [x, y, psi, v, cte, epsi] per column.
+  const StateMatrix& States() const { return X_; }
+
+  void Reset();
+
+ private:
+  Model model_;
+
+  Weights weights_;
+  Eigen::Matrix<Scalar, n_terminal, n_terminal> terminal_;
+  bool has_terminal_;
+
+  bool initialized_;
+  bool prepared_;
+
+  // Move blocks: block of every stage, first stage of every block, and
+  // the stage actuators as a function of the block actuators.
+  size_t block_of_[N - 1];
+  size_t block_start_[N - 1];
+  size_t n_blocks_;
+  InputMatrix T_;
+
+  // Linearization trajectory and the coefficients it was prepared for.
+  StateMatrix X_;
+  InputVector U_;
+  CoeffVector coeffs_;
+  // Exponentials of the stages (see BasicDiscretization).
+  typename Model::Discretization discretization_[N - 1];
+
+  // Condensed state sensitivities: stacked states as an affine function of
+  // the initial state, the block actuators and the polynomial coefficients.
+  Eigen::Matrix<Scalar, n_x, 6> Mx_;
+  Eigen::Matrix<Scalar, n_x, n_u> Mu_;
+  Eigen::Matrix<Scalar, n_x, 4> Mc_;
+  StackedVector m_;
+
+  // Condensed QP: 0.5 dU' H dU + (g0 + Gx dx0 + Gc dc)' dU.
+  InputMatrix H_;
+  InputVector g0_;
+  Eigen::Matrix<Scalar, n_u, 6> Gx_;
+  Eigen::Matrix<Scalar, n_u, 4> Gc_;
+  StackedVector q_;
+  StackedVector xref_;
+  InputMatrix R_;
+  // T' R T, padded with the identity past the blocks.
+  InputMatrix Rb_;
+  Eigen::Matrix<Scalar, n_x, n_u> QMu_;
+  StackedVector e_;
+  // The errors of the terminal cost at the plan and their Jacobian in
+  // the block actuators.
+  Eigen::Matrix<Scalar, n_terminal, 1> terminal_error_;
+  Eigen::Matrix<Scalar, n_terminal, n_u> terminal_jacobian_;
+  Eigen::LLT<InputMatrix> llt_;
+
+  // Input bounds, step bounds and QP solver.
+  InputVector u_lb_;
+  InputVector u_ub_;
+  InputVector du_lb_;
+  InputVector du_ub_;
+  InputVector du_;
+  BoxQP<n_u, Scalar> qp_;
+
+#ifndef MPC_EMBEDDED
+  // Mixed precision: the condensed QP in float, and the exact gradient at
+  // the step of the refinements.
+  typedef Eigen::Matrix<float, n_u, n_u> InnerMatrix;
+  typedef Eigen::Matrix<float, n_u, 1> InnerVector;
+  int refinements_;
+  Eigen::Matrix<float, n_x, n_u> Mu_f_;
+  Eigen::Matrix<float, n_x, n_u> QMu_f_;
+  InnerMatrix H_f_;
+  Eigen::LLT<InnerMatrix> llt_f_;
+  BoxQP<n_u, float> qp_f_;
+  InnerVector g_f_;
+  InnerVector lb_f_;
+  InnerVector ub_f_;
+  InnerVector d_f_;
+  InputVector grad_;
+  StackedVector QMd_;
+
+  void SolveMixed();
+#endif
+
+  void BlockWeights();
+  void Rollout(const Vector6& x0);
+  void Linearize();
+  void SolveQP();
+  Scalar Cost() const;
+};
+
+#endif /* RTI_H */
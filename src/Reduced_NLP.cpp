@@ -0,0 +1,205 @@
+#include "Reduced_NLP.h"
+#include <algorithm>
+
+using namespace Ipopt;
+
+// Whether row of the full problem is the initial constraint of a state.
+template <size_t N>
+static bool Dropped(Index row) {
+  return Layout<N>::InitialRow(row);
+}
+
+template <size_t N>
+Reduced_NLP<N>::Reduced_NLP(const SmartPtr<MPC_Problem<N> >& full) : full_(full), nnz_full_(0) {
+  for (Index i = 0; i < Index(L::nlp_constraints); i++) {
+    if (!Dropped<N>(i)) {
+      rows_.push_back(i);
+    }
+  }
+  lower_.resize(L::nlp_constraints);
+  upper_.resize(L::nlp_constraints);
+  g_.resize(L::nlp_constraints);
+  lambda_.resize(L::nlp_constraints);
+  types_.resize(L::nlp_constraints);
+}
+
+template <size_t N>
+Reduced_NLP<N>::~Reduced_NLP() {}
+
+template <size_t N>
+void Reduced_NLP<N>::AddFootprint(Footprint& footprint) const {
+  footprint.sparsity_bytes += VectorBytes(rows_) + VectorBytes(entries_) + VectorBytes(jac_row_) +
+                              VectorBytes(jac_col_) + VectorBytes(types_);
+  footprint.solver_bytes += VectorBytes(lower_) + VectorBytes(upper_) + VectorBytes(g_) + VectorBytes(lambda_) +
+                            VectorBytes(jac_);
+}
+
+template <size_t N>
+template <class T>
+void Reduced_NLP<N>::Keep(const T* full, T* reduced) const {
+  for (size_t k = 0; k < rows_.size(); k++) {
+    reduced[k] = full[rows_[k]];
+  }
+}
+
+template <size_t N>
+void Reduced_NLP<N>::Spread(const Number* reduced) {
+  std::fill(lambda_.begin(), lambda_.end(), 0.0);
+  for (size_t k = 0; k < rows_.size(); k++) {
+    lambda_[rows_[k]] = reduced[k];
+  }
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::get_nlp_info(Index& n, Index& m, Index& nnz_jac_g, Index& nnz_h_lag,
+                                  TNLP::IndexStyleEnum& index_style) {
+  Index m_full;
+  if (!full_->get_nlp_info(n, m_full, nnz_full_, nnz_h_lag, index_style)) {
+    return false;
+  }
+  // The structure, once: the full problem's never changes.
+  if (jac_row_.empty()) {
+    jac_row_.resize(nnz_full_);
+    jac_col_.resize(nnz_full_);
+    jac_.resize(nnz_full_);
+    full_->eval_jac_g(n, NULL, false, m_full, nnz_full_, &jac_row_[0], &jac_col_[0], NULL);
+    for (Index k = 0; k < nnz_full_; k++) {
+      if (!Dropped<N>(jac_row_[k])) {
+        entries_.push_back(k);
+      }
+    }
+  }
+  m = Index(rows_.size());
+  nnz_jac_g = Index(entries_.size());
+  return true;
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::get_bounds_info(Index n, Number* x_l, Number* x_u, Index m, Number* g_l,
+                                     Number* g_u) {
+  if (!full_->get_bounds_info(n, x_l, x_u, Index(L::nlp_constraints), &lower_[0], &upper_[0])) {
+    return false;
+  }
+  Keep(&lower_[0], g_l);
+  Keep(&upper_[0], g_u);
+  return true;
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::get_scaling_parameters(Number& obj_scaling, bool& use_x_scaling, Index n,
+                                            Number* x_scaling, bool& use_g_scaling, Index m,
+                                            Number* g_scaling) {
+  if (!full_->get_scaling_parameters(obj_scaling, use_x_scaling, n, x_scaling, use_g_scaling,
+                                     Index(L::nlp_constraints), &g_[0])) {
+    return false;
+  }
+  Keep(&g_[0], g_scaling);
+  return true;
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::get_constraints_linearity(Index m, TNLP::LinearityType* const_types) {
+  if (!full_->get_constraints_linearity(Index(L::nlp_constraints), &types_[0])) {
+    return false;
+  }
+  Keep(&types_[0], const_types);
+  return true;
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::get_starting_point(Index n, bool init_x, Number* x, bool init_z, Number* z_L,
+                                        Number* z_U, Index m, bool init_lambda, Number* lambda) {
+  if (!full_->get_starting_point(n, init_x, x, init_z, z_L, z_U, Index(L::nlp_constraints),
+                                 init_lambda, &lambda_[0])) {
+    return false;
+  }
+  if (init_lambda) {
+    Keep(&lambda_[0], lambda);
+  }
+  return true;
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::eval_f(Index n, const Number* x, bool new_x, Number& obj_value) {
+  return full_->eval_f(n, x, new_x, obj_value);
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::eval_grad_f(Index n, const Number* x, bool new_x, Number* grad_f) {
+  return full_->eval_grad_f(n, x, new_x, grad_f);
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::eval_g(Index n, const Number* x, bool new_x, Index m, Number* g) {
+  if (!full_->eval_g(n, x, new_x, Index(L::nlp_constraints), &g_[0])) {
+    return false;
+  }
+  Keep(&g_[0], g);
+  return true;
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::eval_jac_g(Index n, const Number* x, bool new_x, Index m, Index nele_jac,
+                                Index* iRow, Index* jCol, Number* values) {
+  if (values == NULL) {
+    // Row numbers of the full problem, less the dropped rows before.
+    for (size_t e = 0; e < entries_.size(); e++) {
+      Index row = jac_row_[entries_[e]];
+      iRow[e] = Index(std::lower_bound(rows_.begin(), rows_.end(), row) - rows_.begin());
+      jCol[e] = jac_col_[entries_[e]];
+    }
+    return true;
+  }
+  if (!full_->eval_jac_g(n, x, new_x, Index(L::nlp_constraints), nnz_full_, NULL, NULL, &jac_[0])) {
+    return false;
+  }
+  for (size_t e = 0; e < entries_.size(); e++) {
+    values[e] = jac_[entries_[e]];
+  }
+  return true;
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::eval_h(Index n, const Number* x, bool new_x, Number obj_factor, Index m,
+                            const Number* lambda, bool new_lambda, Index nele_hess, Index* iRow,
+                            Index* jCol, Number* values) {
+  // The dropped rows are linear and add nothing to the Hessian.
+  if (lambda) {
+    Spread(lambda);
+  }
+  return full_->eval_h(n, x, new_x, obj_factor, Index(L::nlp_constraints), lambda ? &lambda_[0] : NULL,
+                       new_lambda, nele_hess, iRow, jCol, values);
+}
+
+template <size_t N>
+void Reduced_NLP<N>::finalize_solution(SolverReturn status, Index n, const Number* x,
+                                       const Number* z_L, const Number* z_U, Index m,
+                                       const Number* g, const Number* lambda, Number obj_value,
+                                       const IpoptData* ip_data, IpoptCalculatedQuantities* ip_cq) {
+  // A dropped row is the value of its fixed variable.
+  for (Index i = 0; i < Index(L::nlp_constraints); i++) {
+    g_[i] = Dropped<N>(i) ? x[i] : 0;
+  }
+  for (size_t k = 0; k < rows_.size(); k++) {
+    g_[rows_[k]] = g[k];
+  }
+  Spread(lambda);
+  full_->finalize_solution(status, n, x, z_L, z_U, Index(L::nlp_constraints), &g_[0], &lambda_[0],
+                           obj_value, ip_data, ip_cq);
+}
+
+template <size_t N>
+bool Reduced_NLP<N>::intermediate_callback(AlgorithmMode mode, Index iter, Number obj_value,
+                                           Number inf_pr, Number inf_du, Number mu, Number d_norm,
+                                           Number regularization_size, Number alpha_du,
+                                           Number alpha_pr, Index ls_trials,
+                                           const IpoptData* ip_data,
+                                           IpoptCalculatedQuantities* ip_cq) {
+  return full_->intermediate_callback(mode, iter, obj_value, inf_pr, inf_du, mu, d_norm,
+                                      regularization_size, alpha_du, alpha_pr, ls_trials, ip_data,
+                                      ip_cq);
+}
+
+#define INSTANTIATE(N) template class Reduced_NLP<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
@@ -0,0 +1,107 @@
+#ifndef REDUCED_NLP_H
+#define REDUCED_NLP_H
+
+#include <vector>
+#include <coin/IpTNLP.hpp>
+#include "MPC_Problem.h"
+
+// The Ipopt problem of an MPC_Problem without its initial state: what
+// Ipopt is handed for every solve.
+//
+// The initial state is given, not decided. MPC::Solve fixes its six
+// variables by equal bounds, which Ipopt takes out of the problem as
+// parameters (fixed_variable_treatment make_parameter), and this drops
+// the six equality rows that pinned them, which would be left with no
+// free variable. The full problem keeps its layout: its evaluations run
+// on the full rows, and this copies out the kept ones and hands back the
+// multipliers of the dropped ones as 0, so the warm start and the
+// formulations are unchanged.
+template <size_t N>
+class Reduced_NLP : public Ipopt::TNLP {
+ public:
+  typedef Layout<N> L;
+
+  explicit Reduced_NLP(const Ipopt::SmartPtr<MPC_Problem<N> >& full);
+
+  virtual ~Reduced_NLP();
+
+  // Add its buffers and structures, not those of the full problem.
+  void AddFootprint(Footprint& footprint) const;
+
+  // Number of rows dropped: the initial constraint of every state.
+  enum : size_t { n_dropped = L::n_states };
+
+  bool get_nlp_info(Ipopt::Index& n, Ipopt::Index& m, Ipopt::Index& nnz_jac_g,
+                    Ipopt::Index& nnz_h_lag, Ipopt::TNLP::IndexStyleEnum& index_style);
+
+  bool get_bounds_info(Ipopt::Index n, Ipopt::Number* x_l, Ipopt::Number* x_u,
+                       Ipopt::Index m, Ipopt::Number* g_l, Ipopt::Number* g_u);
+
+  bool get_scaling_parameters(Ipopt::Number& obj_scaling, bool& use_x_scaling, Ipopt::Index n,
+                              Ipopt::Number* x_scaling, bool& use_g_scaling, Ipopt::Index m,
+                              Ipopt::Number* g_scaling);
+
+  bool get_constraints_linearity(Ipopt::Index m, Ipopt::TNLP::LinearityType* const_types);
+
+  bool get_starting_point(Ipopt::Index n, bool init_x, Ipopt::Number* x,
+                          bool init_z, Ipopt::Number* z_L, Ipopt::Number* z_U,
+                          Ipopt::Index m, bool init_lambda, Ipopt::Number* lambda);
+
+  bool eval_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Number& obj_value);
+
+  bool eval_grad_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                   Ipopt::Number* grad_f);
+
+  bool eval_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Index m, Ipopt::Number* g);
+
+  bool eval_jac_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                  Ipopt::Index m, Ipopt::Index nele_jac, Ipopt::Index* iRow,
+                  Ipopt::Index* jCol, Ipopt::Number* values);
+
+  bool eval_h(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+              Ipopt::Number obj_factor, Ipopt::Index m, const Ipopt::Number* lambda,
+              bool new_lambda, Ipopt::Index nele_hess, Ipopt::Index* iRow,
+              Ipopt::Index* jCol, Ipopt::Number* values);
+
+  void finalize_solution(Ipopt::SolverReturn status, Ipopt::Index n,
+                         const Ipopt::Number* x, const Ipopt::Number* z_L,
+                         const Ipopt::Number* z_U, Ipopt::Index m,
+                         const Ipopt::Number* g, const Ipopt::Number* lambda,
+                         Ipopt::Number obj_value, const Ipopt::IpoptData* ip_data,
+                         Ipopt::IpoptCalculatedQuantities* ip_cq);
+
+  bool intermediate_callback(Ipopt::AlgorithmMode mode, Ipopt::Index iter,
+                             Ipopt::Number obj_value, Ipopt::Number inf_pr,
+                             Ipopt::Number inf_du, Ipopt::Number mu,
+                             Ipopt::Number d_norm, Ipopt::Number regularization_size,
+                             Ipopt::Number alpha_du, Ipopt::Number alpha_pr,
+                             Ipopt::Index ls_trials, const Ipopt::IpoptData* ip_data,
+                             Ipopt::IpoptCalculatedQuantities* ip_cq);
+
+ private:
+  Ipopt::SmartPtr<MPC_Problem<N> > full_;
+  // Row of the full problem of every kept row, and the entries of the
+  // full Jacobian in kept rows.
+  std::vector<Ipopt::Index> rows_;
+  std::vector<Ipopt::Index> entries_;
+  Ipopt::Index nnz_full_;
+  // Buffers of the full rows and Jacobian, reused across calls.
+  std::vector<Ipopt::Number> lower_;
+  std::vector<Ipopt::Number> upper_;
+  std::vector<Ipopt::Number> g_;
+  std::vector<Ipopt::Number> lambda_;
+  std::vector<Ipopt::Index> jac_row_;
+  std::vector<Ipopt::Index> jac_col_;
+  std::vector<Ipopt::Number> jac_;
+  std::vector<Ipopt::TNLP::LinearityType> types_;
+
+  // Copy the kept rows of full into reduced.
+  template <class T>
+  void Keep(const T* full, T* reduced) const;
+  // Spread reduced over the kept rows of lambda_, 0 in the others.
+  void Spread(const Ipopt::Number* reduced);
+};
+
+#endif /* REDUCED_NLP_H */
@@ -0,0 +1,588 @@
+#include "ReferencePath.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include "Eigen-3.3/unsupported/Eigen/Splines"
+#include "Polyfit.h"
+#include "Transform.h"
+
+using namespace std;
+
+// Binary map, in the byte order of the host that wrote it:
+//   MapHeader               see below
+// then, each array starting on a map_alignment boundary:
+//   float  s[count], x[count], y[count], heading[count], curvature[count],
+//          speed[count]
+//   int64  cell_keys[cells]
+//   uint32 cell_begin[cells + 1]
+//   uint32 cell_samples[count]
+// Positions are relative to the origin of the header, so floats keep
+// millimetres over routes of any extent.
+static const char map_magic[4] = { 'M', 'P', 'C', 'M' };
+static const uint32_t map_version = 2;
+static const size_t map_alignment = 4096;
+
+struct MapHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+  uint64_t cells;
+  uint32_t tile_samples;
+  uint32_t reserved;
+  double length;
+  double origin[2];
+  double cell_size;
+  int64_t cell_min[2];
+  int64_t cell_max[2];
+};
+static_assert(sizeof(MapHeader) == 96, "MapHeader is packed");
+
+// Samples of a tile of a map, about 2 km at the default spacing.
+static const size_t tile_samples = 4096;
+
+// Offsets of the nine arrays of a map and its size.
+enum { n_arrays = 9 };
+static size_t MapLayout(size_t count, size_t cells, size_t* offsets) {
+  const size_t bytes[n_arrays] = {
+    count * sizeof(float), count * sizeof(float), count * sizeof(float), count * sizeof(float),
+    count * sizeof(float), count * sizeof(float), cells * sizeof(int64_t), (cells + 1) * sizeof(uint32_t),
+    count * sizeof(uint32_t)
+  };
+  size_t end = sizeof(MapHeader);
+  for (int i = 0; i < n_arrays; i++) {
+    offsets[i] = (end + map_alignment - 1) / map_alignment * map_alignment;
+    end = offsets[i] + bytes[i];
+  }
+  return end;
+}
+
+typedef Eigen::Spline<double, 2, 3> Spline2d;
+
+// Waypoints repeated from the other end of the loop on each side, so the
+// free ends of the interpolation fall outside the loop.
+static const size_t closure = 3;
+
+// Integration steps of the arc length per waypoint interval.
+static const int length_steps = 16;
+
+// Grid cells are this many sample spacings wide.
+static const double cell_samples = 8;
+
+// Longest walk from a hint, in samples, before searching the grid.
+static const size_t max_walk = 64;
+
+static int64_t CellKey(int64_t cx, int64_t cy) {
+  return int64_t((uint64_t(cx) << 32) | uint64_t(uint32_t(cy)));
+}
+
+// Window of the reference polynomial, in metres behind and ahead of the
+// nearest sample, and the number of samples fitted over it.
+static const double fit_behind = 5;
+static const double fit_ahead = 30;
+static const size_t fit_points = 16;
+
+// Limits of the speed profile: lateral acceleration in the turns,
+// acceleration out of them and braking into them, in m/s^2, and the
+// speed of the straights, m/s.
+static const double profile_lateral = 4;
+static const double profile_accel = 2;
+static const double profile_brake = 4;
+static const double profile_top = 100;
+
+// |dP/du| of the spline at u.
+static double Speed(const Spline2d& spline, double u) {
+  return spline.derivatives<1>(u).col(1).matrix().norm();
+}
+
+ReferencePath::ReferencePath() : tile_samples_(tile_samples), tile_(no_hint) {
+  Clear();
+}
+
+void ReferencePath::Clear() {
+  count_ = 0;
+  length_ = 0;
+  origin_[0] = origin_[1] = 0;
+  cell_size_ = 1;
+  n_cells_ = 0;
+  cell_min_[0] = cell_min_[1] = cell_max_[0] = cell_max_[1] = 0;
+  s_ = x_ = y_ = heading_ = curvature_ = speed_ = NULL;
+  cell_keys_ = NULL;
+  cell_begin_ = cell_samples_ = NULL;
+  samples_store_.clear();
+  cell_keys_store_.clear();
+  cell_index_store_.clear();
+  map_.reset();
+  tile_samples_ = tile_samples;
+  tile_ = no_hint;
+}
+
+bool ReferencePath::Build(const Track& track, double spacing) {
+  Clear();
+  const size_t m = track.Size();
+  if (m < 4 || !(spacing > 0)) {
+    return false;
+  }
+
+  // The loop of waypoints, closed by its first one, and padded on both
+  // sides.
+  const size_t n = m + 1 + 2 * closure;
+  Eigen::Matrix<double, 2, Eigen::Dynamic> points(2, n);
+  for (size_t i = 0; i < n; i++) {
+    size_t j = (i + m - closure % m) % m;
+    points(0, i) = track.x[j];
+    points(1, i) = track.y[j];
+  }
+  Spline2d::KnotVectorType u;
+  Eigen::ChordLengths(points, u);
+  Spline2d spline = Eigen::SplineFitting<Spline2d>::Interpolate(points, 3, u);
+  const double u_begin = u(closure);
+  const double u_end = u(closure + m);
+
+  // Arc length by Simpson's rule over the loop, tabulated against u.
+  const size_t steps = m * length_steps;
+  vector<double> us(steps + 1);
+  vector<double> ss(steps + 1);
+  us[0] = u_begin;
+  ss[0] = 0;
+  for (size_t k = 1; k <= steps; k++) {
+    double a = us[k - 1];
+    double b = u_begin + (u_end - u_begin) * k / steps;
+    double fa = Speed(spline, a);
+    double fm = Speed(spline, (a + b) / 2);
+    double fb = Speed(spline, b);
+    us[k] = b;
+    ss[k] = ss[k - 1] + (b - a) / 6 * (fa + 4 * fm + fb);
+  }
+  length_ = ss[steps];
+
+  // Equal arc-length samples, with u interpolated from the table.
+  count_ = max<size_t>(size_t(ceil(length_ / spacing)), 4);
+  origin_[0] = track.x[0];
+  origin_[1] = track.y[0];
+  samples_store_.resize(6 * count_);
+  float* store = samples_store_.data();
+  s_ = store;
+  x_ = store + count_;
+  y_ = store + 2 * count_;
+  heading_ = store + 3 * count_;
+  curvature_ = store + 4 * count_;
+  speed_ = store + 5 * count_;
+  size_t k = 0;
+  for (size_t i = 0; i < count_; i++) {
+    double s = length_ * i / count_;
+    while (k + 1 < steps && ss[k + 1] < s) {
+      k++;
+    }
+    double t = (s - ss[k]) / (ss[k + 1] - ss[k]);
+    Eigen::Matrix<double, 2, 3> d = spline.derivatives<2>(us[k] + t * (us[k + 1] - us[k])).matrix();
+    store[i] = float(s);
+    store[count_ + i] = float(d(0, 0) - origin_[0]);
+    store[2 * count_ + i] = float(d(1, 0) - origin_[1]);
+    store[3 * count_ + i] = float(atan2(d(1, 1), d(0, 1)));
+    store[4 * count_ + i] = float((d(0, 1) * d(1, 2) - d(1, 1) * d(0, 2)) / pow(d.col(1).norm(), 3));
+  }
+  BuildProfile(store + 5 * count_);
+  BuildGrid();
+  return true;
+}
+
+void ReferencePath::BuildProfile(float* speed) const {
+  // The speed of each sample's curvature at the lateral limit, then the
+  // acceleration and braking limits between neighbours, v^2 changing by
+  // at most 2 a ds: forwards for the one and backwards for the other,
+  // twice around the loop so that its closure is covered too.
+  const double ds = length_ / count_;
+  vector<double> v2(count_);
+  for (size_t i = 0; i < count_; i++) {
+    double k = fabs(curvature_[i]);
+    v2[i] = min(profile_top * profile_top, k > 0 ? profile_lateral / k : profile_top * profile_top);
+  }
+  for (size_t pass = 0; pass < 2 * count_; pass++) {
+    size_t i = pass % count_;
+    size_t next = (i + 1) % count_;
+    v2[next] = min(v2[next], v2[i] + 2 * profile_accel * ds);
+  }
+  for (size_t pass = 0; pass < 2 * count_; pass++) {
+    size_t i = count_ - 1 - pass % count_;
+    size_t prev = (i + count_ - 1) % count_;
+    v2[prev] = min(v2[prev], v2[i] + 2 * profile_brake * ds);
+  }
+  for (size_t i = 0; i < count_; i++) {
+    speed[i] = float(sqrt(v2[i]));
+  }
+}
+
+int64_t ReferencePath::Cell(double v) const {
+  return int64_t(floor(v / cell_size_));
+}
+
+void ReferencePath::BuildGrid() {
+  cell_size_ = cell_samples * length_ / count_;
+  vector<pair<int64_t, uint32_t> > keyed(count_);
+  for (size_t i = 0; i < count_; i++) {
+    int64_t cx = Cell(x_[i]);
+    int64_t cy = Cell(y_[i]);
+    keyed[i] = make_pair(CellKey(cx, cy), uint32_t(i));
+    cell_min_[0] = i == 0 ? cx : min(cell_min_[0], cx);
+    cell_min_[1] = i == 0 ? cy : min(cell_min_[1], cy);
+    cell_max_[0] = i == 0 ? cx : max(cell_max_[0], cx);
+    cell_max_[1] = i == 0 ? cy : max(cell_max_[1], cy);
+  }
+  sort(keyed.begin(), keyed.end());
+  cell_keys_store_.clear();
+  vector<uint32_t> begin;
+  for (size_t i = 0; i < count_; i++) {
+    if (i == 0 || keyed[i].first != keyed[i - 1].first) {
+      cell_keys_store_.push_back(keyed[i].first);
+      begin.push_back(uint32_t(i));
+    }
+  }
+  n_cells_ = cell_keys_store_.size();
+  begin.push_back(uint32_t(count_));
+  cell_index_store_ = begin;
+  for (size_t i = 0; i < count_; i++) {
+    cell_index_store_.push_back(keyed[i].second);
+  }
+  cell_keys_ = cell_keys_store_.data();
+  cell_begin_ = cell_index_store_.data();
+  cell_samples_ = cell_index_store_.data() + n_cells_ + 1;
+}
+
+bool ReferencePath::Save(const string& path) const {
+  MapHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, map_magic, sizeof(map_magic));
+  header.version = map_version;
+  header.count = count_;
+  header.cells = n_cells_;
+  header.tile_samples = uint32_t(tile_samples_);
+  header.length = length_;
+  header.origin[0] = origin_[0];
+  header.origin[1] = origin_[1];
+  header.cell_size = cell_size_;
+  for (int d = 0; d < 2; d++) {
+    header.cell_min[d] = cell_min_[d];
+    header.cell_max[d] = cell_max_[d];
+  }
+  size_t offsets[n_arrays];
+  size_t size = MapLayout(count_, n_cells_, offsets);
+  const void* arrays[n_arrays] = { s_, x_, y_, heading_, curvature_, speed_, cell_keys_, cell_begin_,
+                                    cell_samples_ };
+  const size_t bytes[n_arrays] = {
+    count_ * sizeof(float), count_ * sizeof(float), count_ * sizeof(float), count_ * sizeof(float),
+    count_ * sizeof(float), count_ * sizeof(float), n_cells_ * sizeof(int64_t),
+    (n_cells_ + 1) * sizeof(uint32_t), count_ * sizeof(uint32_t)
+  };
+
+  ofstream out(path.c_str(), ios::binary);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  size_t at = sizeof(header);
+  static const char zeros[map_alignment] = {};
+  for (int i = 0; i < n_arrays; i++) {
+    out.write(zeros, offsets[i] - at);
+    out.write(static_cast<const char*>(arrays[i]), bytes[i]);
+    at = offsets[i] + bytes[i];
+  }
+  return bool(out) && at == size;
+}
+
+bool ReferencePath::Open(const string& path) {
+  Clear();
+  unique_ptr<MappedFile> map(new MappedFile);
+  if (!map->Open(path) || map->Size() < sizeof(MapHeader)) {
+    return false;
+  }
+  MapHeader header;
+  memcpy(&header, map->Data(), sizeof(header));
+  if (memcmp(header.magic, map_magic, sizeof(map_magic)) != 0 || header.version != map_version ||
+      header.count < 4 || header.count > UINT32_MAX || header.cells < 1 ||
+      header.cells > header.count || header.tile_samples < 1 || !(header.cell_size > 0)) {
+    return false;
+  }
+  size_t offsets[n_arrays];
+  if (MapLayout(header.count, header.cells, offsets) > map->Size()) {
+    return false;
+  }
+  const char* data = map->Data();
+  const uint32_t* cell_begin = reinterpret_cast<const uint32_t*>(data + offsets[7]);
+  if (cell_begin[0] != 0 || cell_begin[header.cells] != header.count) {
+    return false;
+  }
+
+  count_ = header.count;
+  length_ = header.length;
+  origin_[0] = header.origin[0];
+  origin_[1] = header.origin[1];
+  cell_size_ = header.cell_size;
+  n_cells_ = header.cells;
+  for (int d = 0; d < 2; d++) {
+    cell_min_[d] = header.cell_min[d];
+    cell_max_[d] = header.cell_max[d];
+  }
+  s_ = reinterpret_cast<const float*>(data + offsets[0]);
+  x_ = reinterpret_cast<const float*>(data + offsets[1]);
+  y_ = reinterpret_cast<const float*>(data + offsets[2]);
+  heading_ = reinterpret_cast<const float*>(data + offsets[3]);
+  curvature_ = reinterpret_cast<const float*>(data + offsets[4]);
+  speed_ = reinterpret_cast<const float*>(data + offsets[5]);
+  cell_keys_ = reinterpret_cast<const int64_t*>(data + offsets[6]);
+  cell_begin_ = cell_begin;
+  cell_samples_ = reinterpret_cast<const uint32_t*>(data + offsets[8]);
+  tile_samples_ = header.tile_samples;
+  map_ = move(map);
+  return true;
+}
+
+bool ReferencePath::Load(const string& path) {
+  if (Open(path)) {
+    return true;
+  }
+  Track track;
+  return track.Load(path) && Build(track);
+}
+
+PathSample ReferencePath::Sample(size_t i) const {
+  PathSample sample;
+  sample.s = s_[i];
+  sample.x = origin_[0] + x_[i];
+  sample.y = origin_[1] + y_[i];
+  sample.heading = heading_[i];
+  sample.curvature = curvature_[i];
+  sample.speed = speed_[i];
+  return sample;
+}
+
+double ReferencePath::SpeedAt(double s) const {
+  double at = fmod(s, length_) / length_ * count_;
+  if (at < 0) {
+    at += count_;
+  }
+  size_t i = min(size_t(at), count_ - 1);
+  size_t next = (i + 1) % count_;
+  double t = at - double(i);
+  return (1 - t) * speed_[i] + t * speed_[next];
+}
+
+// Position, relative to the origin, and heading of the path at arc
+// length s, interpolated between the samples as SpeedAt.
+void ReferencePath::Interpolate(double s, double& x, double& y, double& heading) const {
+  double at = fmod(s, length_) / length_ * count_;
+  if (at < 0) {
+    at += count_;
+  }
+  size_t i = min(size_t(at), count_ - 1);
+  size_t next = (i + 1) % count_;
+  double t = at - double(i);
+  x = (1 - t) * x_[i] + t * x_[next];
+  y = (1 - t) * y_[i] + t * y_[next];
+  heading = heading_[i] + t * remainder(double(heading_[next]) - heading_[i], 2 * M_PI);
+}
+
+void ReferencePath::PointAt(double s, double n, double& px, double& py, double& heading) const {
+  double x;
+  double y;
+  Interpolate(s, x, y, heading);
+  px = origin_[0] + x - n * sin(heading);
+  py = origin_[1] + y + n * cos(heading);
+}
+
+void ReferencePath::Touch(size_t i) const {
+  if (!map_) {
+    return;
+  }
+  size_t tile = i / tile_samples_;
+  if (tile_.exchange(tile) == tile) {
+    return;
+  }
+  // The tile and the next are read ahead, the one two behind given back.
+  // Other vehicles on the same path may still use it, which costs them a
+  // page fault, not a wrong answer.
+  const size_t n_tiles = (count_ + tile_samples_ - 1) / tile_samples_;
+  const float* arrays[] = { s_, x_, y_, heading_, curvature_, speed_ };
+  for (const float* array : arrays) {
+    size_t offset = size_t(reinterpret_cast<const char*>(array) - map_->Data());
+    size_t tile_bytes = tile_samples_ * sizeof(float);
+    map_->WillNeed(offset + tile * tile_bytes, tile_bytes);
+    map_->WillNeed(offset + (tile + 1) % n_tiles * tile_bytes, tile_bytes);
+    if (n_tiles > 3) {
+      map_->DontNeed(offset + (tile + n_tiles - 2) % n_tiles * tile_bytes, tile_bytes);
+    }
+  }
+}
+
+double ReferencePath::Distance2(size_t i, double px, double py) const {
+  double dx = x_[i] - px;
+  double dy = y_[i] - py;
+  return dx * dx + dy * dy;
+}
+
+size_t ReferencePath::GridNearest(double px, double py) const {
+  const int64_t cx = Cell(px);
+  const int64_t cy = Cell(py);
+  // Rings of cells around the vehicle's until every cell left is farther
+  // than the best sample found.
+  int64_t rings = max(max(cx - cell_min_[0], cell_max_[0] - cx), max(cy - cell_min_[1], cell_max_[1] - cy));
+  size_t best = 0;
+  double best_d2 = -1;
+  for (int64_t r = 0; r <= rings; r++) {
+    for (int64_t x = cx - r; x <= cx + r; x++) {
+      // The whole column at either side, the ends of the others.
+      int64_t step = x == cx - r || x == cx + r ? 1 : max<int64_t>(2 * r, 1);
+      for (int64_t y = cy - r; y <= cy + r; y += step) {
+        int64_t key = CellKey(x, y);
+        const int64_t* it = lower_bound(cell_keys_, cell_keys_ + n_cells_, key);
+        if (it == cell_keys_ + n_cells_ || *it != key) {
+          continue;
+        }
+        size_t cell = size_t(it - cell_keys_);
+        for (size_t k = cell_begin_[cell]; k < cell_begin_[cell + 1]; k++) {
+          double d2 = Distance2(cell_samples_[k], px, py);
+          if (best_d2 < 0 || d2 < best_d2) {
+            best = cell_samples_[k];
+            best_d2 = d2;
+          }
+        }
+      }
+    }
+    if (best_d2 >= 0 && best_d2 <= pow(r * cell_size_, 2)) {
+      break;
+    }
+  }
+  return best;
+}
+
+size_t ReferencePath::Nearest(double px, double py, size_t hint) const {
+  const size_t count = count_;
+  if (count == 0) {
+    return 0;
+  }
+  px -= origin_[0];
+  py -= origin_[1];
+  if (hint >= count) {
+    return GridNearest(px, py);
+  }
+  // Walk from the hint, forward first, while the distance falls.
+  size_t i = hint;
+  double d = Distance2(i, px, py);
+  size_t walked = 0;
+  for (size_t next = (i + 1) % count; walked < max_walk && Distance2(next, px, py) < d;
+       next = (i + 1) % count, walked++) {
+    i = next;
+    d = Distance2(i, px, py);
+  }
+  for (size_t prev = (i + count - 1) % count; walked < max_walk && Distance2(prev, px, py) < d;
+       prev = (i + count - 1) % count, walked++) {
+    i = prev;
+    d = Distance2(i, px, py);
+  }
+  if (walked == max_walk || d > cell_size_ * cell_size_) {
+    return GridNearest(px, py);
+  }
+  return i;
+}
+
+double ReferencePath::Progress(double px, double py, size_t& hint) const {
+  const size_t count = count_;
+  if (count == 0) {
+    return 0;
+  }
+  hint = Nearest(px, py, hint);
+  Touch(hint);
+  // Project onto the segments to either neighbour of the nearest sample
+  // and keep the nearer foot.
+  px -= origin_[0];
+  py -= origin_[1];
+  double spacing = length_ / count;
+  double best_s = s_[hint];
+  double best_d2 = Distance2(hint, px, py);
+  for (int side = -1; side <= 1; side += 2) {
+    size_t j = (hint + count + side) % count;
+    double dx = x_[j] - x_[hint];
+    double dy = y_[j] - y_[hint];
+    double t = ((px - x_[hint]) * dx + (py - y_[hint]) * dy) / (dx * dx + dy * dy);
+    if (t <= 0) {
+      continue;
+    }
+    t = min(t, 1.0);
+    double ex = x_[hint] + t * dx - px;
+    double ey = y_[hint] + t * dy - py;
+    if (ex * ex + ey * ey < best_d2) {
+      best_d2 = ex * ex + ey * ey;
+      best_s = s_[hint] + side * t * spacing;
+    }
+  }
+  return fmod(best_s + length_, length_);
+}
+
+bool ReferencePath::Local(double px, double py, double psi, size_t& hint,
+                          Eigen::Vector4d& coeffs) const {
+  const size_t count = count_;
+  if (count == 0) {
+    return false;
+  }
+  hint = Nearest(px, py, hint);
+  Touch(hint);
+
+  // Samples of the window, spread evenly over it.
+  double spacing = length_ / count;
+  long first = -long(fit_behind / spacing);
+  long last = long(fit_ahead / spacing);
+  long stride = max(1L, (last - first) / long(fit_points - 1));
+  double xs[fit_points];
+  double ys[fit_points];
+  size_t n = 0;
+  for (long j = first; j <= last && n < fit_points; j += stride) {
+    size_t i = size_t((long(hint) + j % long(count) + long(count)) % long(count));
+    xs[n] = x_[i];
+    ys[n] = y_[i];
+    n++;
+  }
+  double vx[fit_points];
+  double vy[fit_points];
+  ToVehicleFrame(xs, ys, n, px - origin_[0], py - origin_[1], psi, vx, vy);
+  // The window must run ahead of the vehicle for y(x) to describe it.
+  for (size_t i = 1; i < n; i++) {
+    if (vx[i] <= vx[i - 1]) {
+      return false;
+    }
+  }
+  coeffs = Polyfit<3>(vx, vy, n);
+  return true;
+}
+
+bool ReferencePath::Frenet(double px, double py, double psi, double ahead, size_t& hint, double& s, double& n,
+                           double& mu, Eigen::Vector4d& curvature) const {
+  const size_t count = count_;
+  if (count == 0) {
+    return false;
+  }
+  s = Progress(px, py, hint);
+  double x;
+  double y;
+  double heading;
+  Interpolate(s, x, y, heading);
+  double dx = px - origin_[0] - x;
+  double dy = py - origin_[1] - y;
+  n = -dx * sin(heading) + dy * cos(heading);
+  mu = remainder(psi - heading, 2 * M_PI);
+
+  // The curvature of the samples over the window, by their arc length from
+  // s, spread evenly over it as in Local.
+  double spacing = length_ / count;
+  double from = remainder(s - s_[hint], length_);
+  long first = -long(fit_behind / spacing);
+  long last = long(max(ahead, fit_ahead) / spacing);
+  long stride = max(1L, (last - first) / long(fit_points - 1));
+  double ds[fit_points];
+  double kappa[fit_points];
+  size_t k = 0;
+  for (long j = first; j <= last && k < fit_points; j += stride) {
+    size_t i = size_t((long(hint) + j % long(count) + long(count)) % long(count));
+    ds[k] = j * spacing - from;
+    kappa[k] = curvature_[i];
+    k++;
+  }
+  curvature = Polyfit<3>(ds, kappa, k);
+  return true;
+}
@@ -0,0 +1,164 @@
+#ifndef REFERENCE_PATH_H
+#define REFERENCE_PATH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "MappedFile.h"
+#include "Track.h"
+
+// Global reference path: a closed cubic spline through the waypoints of a
+// Track (unsupported/Eigen/Splines), fitted once and sampled at a fixed
+// arc-length spacing.
+//
+// Every sample carries its arc length, heading and curvature, and the
+// speed of a profile limited by the curvature: the speed of a lateral
+// acceleration limit in every turn, lowered ahead of it to brake into it
+// and after it to accelerate out of it. A query
+// finds the sample nearest to the vehicle and fits the reference cubic to
+// a fixed number of samples of the window ahead of it, dense and evenly
+// spread along the path, where the polyfit of the telemetry has six
+// waypoints tens of metres apart. The spline is fitted once, so nothing
+// done per frame depends on the waypoints the simulator sends.
+//
+// Nearest-sample queries walk from the previous answer, which is O(1)
+// from frame to frame, and fall back to a uniform grid over the samples
+// when there is none or the walk ends far from the vehicle. The grid
+// keeps only its occupied cells, sorted by key, so its memory is linear in
+// the samples however far apart they lie; long routes of tens of
+// thousands of samples cost a binary search per cell visited.
+//
+// Save writes a path with its grid as a binary map that Open maps into
+// memory as it is, with nothing to parse or build (see ReferencePath.cpp
+// for the layout). The samples of a mapped path are split into tiles of
+// consecutive samples, stretches of the route: a query reads ahead the
+// tile it lands in and the next, and gives back the memory of the tile
+// two behind, so however long the route only a few tiles stay resident.
+
+struct PathSample {
+  // Arc length from the first waypoint, position and heading in map
+  // coordinates, signed curvature (positive turning left) and the speed
+  // of the profile, m/s.
+  double s;
+  double x;
+  double y;
+  double heading;
+  double curvature;
+  double speed;
+};
+
+class ReferencePath {
+ public:
+  // No hint for Nearest and Local: search all samples.
+  static const size_t no_hint = size_t(-1);
+
+  ReferencePath();
+
+  // Fit the loop of track and sample it about every spacing metres. False
+  // if the track has fewer than four waypoints or the spacing is not
+  // positive.
+  bool Build(const Track& track, double spacing = 0.5);
+
+  // Write the path as a binary map. False when the file cannot be written.
+  bool Save(const std::string& path) const;
+
+  // Map a binary map written by Save. False, leaving the path empty, when
+  // the file is not one.
+  bool Open(const std::string& path);
+
+  // Open path as a binary map, or else build the path of the track CSV
+  // there with the default spacing.
+  bool Load(const std::string& path);
+
+  size_t Size() const { return count_; }
+  double Length() const { return length_; }
+  PathSample Sample(size_t i) const;
+
+  // Whether the samples are read from a mapped file.
+  bool Mapped() const { return bool(map_); }
+
+  // Index of the sample nearest to (px, py). From a hint, usually the
+  // result of the previous query, the search walks along the path while
+  // the distance falls; without one, or when the walk ends farther than a
+  // grid cell from the vehicle, it searches the grid.
+  size_t Nearest(double px, double py, size_t hint = no_hint) const;
+
+  // Speed of the profile at arc length s, interpolated between the
+  // samples; s wraps around the loop.
+  double SpeedAt(double s) const;
+
+  // Arc length of the point of the path nearest to (px, py), in [0,
+  // Length()), updating hint as Nearest.
+  double Progress(double px, double py, size_t& hint) const;
+
+  // Reference polynomial y(x) in the frame of the vehicle pose (px, py,
+  // psi), as Polyfit<3> of the waypoints in that frame would give it.
+  // hint is updated to the nearest sample. False, with coeffs untouched,
+  // when the window turns back on itself in that frame, so that it is no
+  // function y(x).
+  bool Local(double px, double py, double psi, size_t& hint, Eigen::Vector4d& coeffs) const;
+
+  // The pose (px, py, psi) in the coordinates of the path (see
+  // FrenetModel, Kinematics.h): the arc length s of its nearest point, in
+  // [0, Length()), its offset n to the left of the path, and its heading
+  // mu relative to the path's there, with the curvature of the path as a
+  // cubic in the arc length from s, fitted over ahead metres ahead of it.
+  // hint is updated as by Progress. False, with nothing set, for an empty
+  // path.
+  bool Frenet(double px, double py, double psi, double ahead, size_t& hint, double& s, double& n, double& mu,
+              Eigen::Vector4d& curvature) const;
+
+  // The point of offset n to the left of the path at arc length s, which
+  // wraps around the loop, in map coordinates, and the heading of the
+  // path there.
+  void PointAt(double s, double n, double& px, double& py, double& heading) const;
+
+ private:
+  // The samples, relative to origin_, and the grid: occupied cells by
+  // increasing key, the samples of cell i at cell_samples_[cell_begin_[i]]
+  // to cell_samples_[cell_begin_[i + 1]], and the range of cell
+  // coordinates. They point into the storage below for a built path, or
+  // into the map of an opened one.
+  size_t count_;
+  double length_;
+  double origin_[2];
+  double cell_size_;
+  size_t n_cells_;
+  int64_t cell_min_[2];
+  int64_t cell_max_[2];
+  const float* s_;
+  const float* x_;
+  const float* y_;
+  const float* heading_;
+  const float* curvature_;
+  const float* speed_;
+  const int64_t* cell_keys_;
+  const uint32_t* cell_begin_;
+  const uint32_t* cell_samples_;
+
+  // Storage of a built path, one array after the other.
+  std::vector<float> samples_store_;
+  std::vector<int64_t> cell_keys_store_;
+  std::vector<uint32_t> cell_index_store_;
+
+  // The map of an opened path, its samples per tile and the tile of the
+  // last query.
+  std::unique_ptr<MappedFile> map_;
+  size_t tile_samples_;
+  mutable std::atomic<size_t> tile_;
+
+  void Clear();
+  void BuildProfile(float* speed) const;
+  void BuildGrid();
+  void Interpolate(double s, double& x, double& y, double& heading) const;
+  int64_t Cell(double v) const;
+  size_t GridNearest(double px, double py) const;
+  double Distance2(size_t i, double px, double py) const;
+  void Touch(size_t i) const;
+};
+
+#endif /* REFERENCE_PATH_H */
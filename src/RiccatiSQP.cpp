@@ -0,0 +1,355 @@
+#include "RiccatiSQP.h"
+#include "Tuning.h"
+#include <math.h>
+#include <algorithm>
+
+// Interior-point iteration limit and stopping duality gap.
+static const int max_ip_iterations = 30;
+static const double ip_tol = 1e-9;
+
+// Fraction of the distance to the bounds a step may cover.
+static const double to_boundary = 0.995;
+
+template <size_t N>
+RiccatiSQP<N>::RiccatiSQP(double dt, double Lf)
+    : model_(dt, Lf),
+      xref_(StateMatrix::Zero()),
+      weights_(default_weights),
+      terminal_(TerminalMatrix::Zero()),
+      initialized_(false),
+      factorized_(false),
+      iterations_(0),
+      X_(StateMatrix::Zero()),
+      U_(InputVector::Zero()),
+      coeffs_(Eigen::Vector4d::Zero()) {
+  for (size_t k = 0; k < N - 1; k++) {
+    u_lb_(2 * k) = -max_delta;
+    u_ub_(2 * k) = max_delta;
+    u_lb_(2 * k + 1) = -max_a;
+    u_ub_(2 * k + 1) = max_a;
+  }
+}
+
+template <size_t N>
+RiccatiSQP<N>::~RiccatiSQP() {}
+
+template <size_t N>
+void RiccatiSQP<N>::SetReference(double cte_ref, double epsi_ref, double v_ref) {
+  xref_.row(3).setConstant(v_ref);
+  xref_.row(4).setConstant(cte_ref);
+  xref_.row(5).setConstant(epsi_ref);
+  factorized_ = false;
+}
+
+template <size_t N>
+void RiccatiSQP<N>::SetStageReference(const double* cte_ref, const double* epsi_ref, const double* v_ref) {
+  for (size_t k = 0; k < N; k++) {
+    xref_(3, k) = v_ref[k];
+    xref_(4, k) = cte_ref[k];
+    xref_(5, k) = epsi_ref[k];
+  }
+  factorized_ = false;
+}
+
+template <size_t N>
+void RiccatiSQP<N>::SetWeights(const Weights& weights) {
+  weights_ = weights;
+  factorized_ = false;
+}
+
+template <size_t N>
+void RiccatiSQP<N>::SetTerminalCost(const TerminalMatrix& cost) {
+  terminal_ = cost;
+  factorized_ = false;
+}
+
+template <size_t N>
+typename RiccatiSQP<N>::TerminalVector RiccatiSQP<N>::TerminalError() const {
+  TerminalVector e;
+  e << X_(4, N - 1) - xref_(4, N - 1), X_(5, N - 1) - xref_(5, N - 1), X_(3, N - 1) - xref_(3, N - 1),
+      U_(2 * (N - 2)), U_(2 * (N - 2) + 1);
+  return e;
+}
+
+template <size_t N>
+void RiccatiSQP<N>::Reset() {
+  initialized_ = false;
+  factorized_ = false;
+}
+
+template <size_t N>
+void RiccatiSQP<N>::Rollout(const StateVector& x0) {
+  X_.col(0) = x0;
+  for (size_t k = 0; k < N - 1; k++) {
+    model_.Stage(k).Step(X_.col(k).data(), U_.data() + 2 * k, coeffs_, X_.col(k + 1).data());
+  }
+}
+
+template <size_t N>
+void RiccatiSQP<N>::Linearize() {
+  LinearizeStages(model_, N - 1, X_, U_.data(), coeffs_, A_.data(), B_.data(), E_.data(), discretization_.data());
+}
+
+template <size_t N>
+void RiccatiSQP<N>::SolveLQ() {
+  // Stage weights: 0.5 z' Q z + q' z + 0.5 u' R u + r' u + u' S z for
+  // the augmented state z = [dx; du_prev] and the correction u, with the
+  // trajectory deviations and the barrier terms of the bounds folded in.
+  const double q_diag[6] = { 0, 0, 0, 2 * weights_.v, 2 * weights_.cte, 2 * weights_.epsi };
+  const double w_rate[2] = { 2 * weights_.ddelta, 2 * weights_.da };
+  const double w_input[2] = { 2 * weights_.delta, 2 * weights_.a };
+
+  // Terminal cost-to-go: the state cost of the last stage and the
+  // terminal cost, whose errors are those of z at terminal_index.
+  P_.setZero();
+  p_.setZero();
+  for (int i = 3; i < 6; i++) {
+    P_(i, i) = q_diag[i];
+    p_(i) = q_diag[i] * (X_(i, N - 1) - xref_(i, N - 1));
+  }
+  const int terminal_index[n_terminal] = { 4, 5, 3, 6, 7 };
+  TerminalVector terminal_gradient = 2 * terminal_ * TerminalError();
+  for (size_t i = 0; i < n_terminal; i++) {
+    for (size_t j = 0; j < n_terminal; j++) {
+      P_(terminal_index[i], terminal_index[j]) += 2 * terminal_(i, j);
+    }
+    p_(terminal_index[i]) += terminal_gradient(i);
+  }
+
+  Matrix8d A = Matrix8d::Zero();
+  Matrix82d B = Matrix82d::Zero();
+  B.template bottomRows<2>().setIdentity();
+  for (size_t s = N - 1; s-- > 0;) {
+    A.template topLeftCorner<6, 6>() = A_[s];
+    B.template topRows<6>() = B_[s];
+
+    Matrix8d Q = Matrix8d::Zero();
+    Vector8d q = Vector8d::Zero();
+    Eigen::Matrix2d R = Eigen::Matrix2d::Zero();
+    Eigen::Vector2d r;
+    Matrix28d S = Matrix28d::Zero();
+    for (int i = 3; i < 6; i++) {
+      Q(i, i) = q_diag[i];
+      q(i) = q_diag[i] * (X_(i, s) - xref_(i, s));
+    }
+    for (int j = 0; j < 2; j++) {
+      size_t i = 2 * s + j;
+      R(j, j) = w_input[j] + sigma_(i);
+      r(j) = w_input[j] * U_(i) + barrier_(i) - sigma_(i) * du_(i);
+      // Rate penalty against the previous stage's actuation.
+      if (s > 0) {
+        double e = U_(i) - U_(i - 2);
+        R(j, j) += w_rate[j];
+        r(j) += w_rate[j] * e;
+        Q(6 + j, 6 + j) = w_rate[j];
+        q(6 + j) = -w_rate[j] * e;
+        S(j, 6 + j) = -w_rate[j];
+      }
+    }
+
+    Eigen::Matrix2d Ruu = R;
+    Ruu.noalias() += B.transpose() * P_ * B;
+    Matrix28d Ruz = S;
+    Ruz.noalias() += B.transpose() * P_ * A;
+    Eigen::Vector2d ru = r;
+    ru.noalias() += B.transpose() * p_;
+
+    Eigen::LLT<Eigen::Matrix2d>& llt = llt_[s];
+    llt.compute(Ruu);
+    K_[s] = -llt.solve(Ruz);
+    k_[s] = -llt.solve(ru);
+    P_next_[s] = P_;
+    Ruz_[s] = Ruz;
+
+    Matrix8d P = Q;
+    P.noalias() += A.transpose() * P_ * A;
+    P.noalias() += Ruz.transpose() * K_[s];
+    Vector8d p = q;
+    p.noalias() += A.transpose() * p_;
+    p.noalias() += Ruz.transpose() * k_[s];
+    P_ = 0.5 * (P + P.transpose());
+    p_ = p;
+  }
+
+  // Forward pass from the measured initial state, z_0 = 0.
+  Vector8d z = Vector8d::Zero();
+  for (size_t s = 0; s < N - 1; s++) {
+    Eigen::Vector2d u = K_[s] * z + k_[s];
+    du_new_.template segment<2>(2 * s) = u;
+    z.template head<6>() = A_[s] * z.template head<6>() + B_[s] * u;
+    z.template tail<2>() = u;
+  }
+}
+
+template <size_t N>
+void RiccatiSQP<N>::SolveQP() {
+  du_lb_ = u_lb_ - U_;
+  du_ub_ = u_ub_ - U_;
+
+  // Start strictly inside the bounds, with multipliers on the central
+  // path of a moderate barrier.
+  const double mu0 = 1e-2;
+  for (size_t i = 0; i < n_u; i++) {
+    double margin = 1e-3 * (du_ub_(i) - du_lb_(i));
+    du_(i) = std::min(std::max(0.0, du_lb_(i) + margin), du_ub_(i) - margin);
+    lam_lb_(i) = mu0 / (du_(i) - du_lb_(i));
+    lam_ub_(i) = mu0 / (du_ub_(i) - du_(i));
+  }
+
+  InputVector s_lb;
+  InputVector s_ub;
+  InputVector step;
+  InputVector dlam_lb;
+  InputVector dlam_ub;
+  for (int it = 0; it < max_ip_iterations; it++) {
+    s_lb = du_ - du_lb_;
+    s_ub = du_ub_ - du_;
+    double gap = (s_lb.dot(lam_lb_) + s_ub.dot(lam_ub_)) / (2 * n_u);
+    if (gap < ip_tol) {
+      break;
+    }
+    double mu = 0.1 * gap;
+
+    // Newton step of the barrier problem: the bounds add sigma to the
+    // input weights, and the optimum of that LQ problem is the new point.
+    sigma_ = (lam_lb_.array() / s_lb.array() + lam_ub_.array() / s_ub.array()).matrix();
+    barrier_ = (mu / s_ub.array() - mu / s_lb.array()).matrix();
+    SolveLQ();
+    step = du_new_ - du_;
+    dlam_lb = ((mu - s_lb.array() * lam_lb_.array() - lam_lb_.array() * step.array()) / s_lb.array()).matrix();
+    dlam_ub = ((mu - s_ub.array() * lam_ub_.array() + lam_ub_.array() * step.array()) / s_ub.array()).matrix();
+
+    double alpha_p = 1;
+    double alpha_d = 1;
+    for (size_t i = 0; i < n_u; i++) {
+      if (step(i) < 0) {
+        alpha_p = std::min(alpha_p, -to_boundary * s_lb(i) / step(i));
+      } else if (step(i) > 0) {
+        alpha_p = std::min(alpha_p, to_boundary * s_ub(i) / step(i));
+      }
+      if (dlam_lb(i) < 0) {
+        alpha_d = std::min(alpha_d, -to_boundary * lam_lb_(i) / dlam_lb(i));
+      }
+      if (dlam_ub(i) < 0) {
+        alpha_d = std::min(alpha_d, -to_boundary * lam_ub_(i) / dlam_ub(i));
+      }
+    }
+    du_ += alpha_p * step;
+    lam_lb_ += alpha_d * dlam_lb;
+    lam_ub_ += alpha_d * dlam_ub;
+    iterations_++;
+  }
+}
+
+template <size_t N>
+double RiccatiSQP<N>::Feedback(const StateVector& state, const Eigen::Vector4d& coeffs,
+                               int sqp_iterations) {
+  if (!initialized_) {
+    U_.setZero();
+    initialized_ = true;
+  } else {
+    // The previous plan, one stage later.
+    for (size_t i = 0; i + 2 < n_u; i++) {
+      U_(i) = U_(i + 2);
+    }
+  }
+  coeffs_ = coeffs;
+  Rollout(state);
+
+  iterations_ = 0;
+  for (int it = 0; it < sqp_iterations; it++) {
+    Linearize();
+    SolveQP();
+    U_ += du_;
+    U_ = U_.cwiseMax(u_lb_).cwiseMin(u_ub_);
+    Rollout(state);
+  }
+  factorized_ = sqp_iterations > 0;
+  return Cost();
+}
+
+template <size_t N>
+bool RiccatiSQP<N>::Predict(const StateVector& state, const Eigen::Vector4d& coeffs, double max_correction) {
+  if (!initialized_ || !factorized_) {
+    return false;
+  }
+  // The problem one stage on: stage s of it is stage s + 1 of the last
+  // one, and the last stage repeats.
+  const Eigen::Vector4d dc = coeffs - coeffs_;
+
+  // Backward: the change of the affine terms that the coefficients make,
+  // through the disturbance E dc of every stage.
+  std::array<Eigen::Vector2d, N - 1> dk;
+  Vector8d dp = Vector8d::Zero();
+  for (size_t s = N - 1; s-- > 0;) {
+    size_t o = std::min(s + 1, N - 2);
+    Vector8d g = dp;
+    g.noalias() += P_next_[o].template leftCols<6>() * (E_[o] * dc);
+    Eigen::Vector2d ru = B_[o].transpose() * g.template head<6>() + g.template tail<2>();
+    dk[s] = -llt_[o].solve(ru);
+    dp.template head<6>() = A_[o].transpose() * g.template head<6>();
+    dp.template tail<2>().setZero();
+    dp.noalias() += Ruz_[o].transpose() * dk[s];
+  }
+
+  // Forward from the difference of the initial state.
+  InputVector dU;
+  Vector8d z = Vector8d::Zero();
+  z.template head<6>() = state - X_.col(1);
+  for (size_t s = 0; s < N - 1; s++) {
+    size_t o = std::min(s + 1, N - 2);
+    Eigen::Vector2d u = K_[o] * z + dk[s];
+    dU.template segment<2>(2 * s) = u;
+    z.template head<6>() = A_[o] * z.template head<6>() + B_[o] * u + E_[o] * dc;
+    z.template tail<2>() = u;
+  }
+  if (dU.template lpNorm<Eigen::Infinity>() > max_correction) {
+    return false;
+  }
+
+  // Shift the plan and the recursion along with it, for the next one.
+  for (size_t i = 0; i + 2 < n_u; i++) {
+    U_(i) = U_(i + 2);
+  }
+  for (size_t s = 0; s + 1 < N - 1; s++) {
+    A_[s] = A_[s + 1];
+    B_[s] = B_[s + 1];
+    E_[s] = E_[s + 1];
+    K_[s] = K_[s + 1];
+    P_next_[s] = P_next_[s + 1];
+    Ruz_[s] = Ruz_[s + 1];
+    llt_[s] = llt_[s + 1];
+  }
+  U_ += dU;
+  U_ = U_.cwiseMax(u_lb_).cwiseMin(u_ub_);
+  coeffs_ = coeffs;
+  Rollout(state);
+  iterations_ = 0;
+  return true;
+}
+
+template <size_t N>
+double RiccatiSQP<N>::Cost() const {
+  double cost = 0;
+  for (size_t k = 0; k < N; k++) {
+    cost += weights_.cte * pow(X_(4, k) - xref_(4, k), 2);
+    cost += weights_.epsi * pow(X_(5, k) - xref_(5, k), 2);
+    cost += weights_.v * pow(X_(3, k) - xref_(3, k), 2);
+  }
+  for (size_t k = 0; k < N - 1; k++) {
+    cost += weights_.delta * pow(U_(2 * k), 2);
+    cost += weights_.a * pow(U_(2 * k + 1), 2);
+  }
+  for (size_t k = 0; k < N - 2; k++) {
+    cost += weights_.ddelta * pow(U_(2 * k + 2) - U_(2 * k), 2);
+    cost += weights_.da * pow(U_(2 * k + 3) - U_(2 * k + 1), 2);
+  }
+  TerminalVector e = TerminalError();
+  cost += e.dot(terminal_ * e);
+  return cost;
+}
+
+#define INSTANTIATE(N) template class RiccatiSQP<N>;
+MPC_FOR_EACH_HORIZON(INSTANTIATE)
+MPC_FOR_EACH_SCALING_HORIZON(INSTANTIATE)
+template class RiccatiSQP<coarse_horizon>;
@@ -0,0 +1,178 @@
+#ifndef RICCATI_SQP_H
+#define RICCATI_SQP_H
+
+#include <array>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "KinematicModel.h"
+#include "Layout.h"
+#include "TerminalCost.h"
+#include "Tuning.h"
+
+// Gauss-Newton SQP for the kinematic model of FG_eval that keeps the
+// stage structure of the horizon instead of condensing it.
+//
+// Each feedback step shifts the last actuator plan, simulates it from the
+// measured state and linearizes the model along that trajectory, so the
+// QP in the plan corrections has no dynamics gaps. The QP is solved with
+// a primal-dual interior-point method on the actuator bounds: the barrier
+// only adds diagonal terms to the input weights, so every Newton step is
+// an LQ problem solved by a backward Riccati recursion. The actuation
+// rate penalties couple consecutive stages; they are kept stage-wise by
+// carrying the previous correction in an augmented state.
+//
+// The cost of a Newton step is linear in N (the condensed RTI QP is cubic
+// in N), and all storage is fixed-size for the horizon N.
+//
+// The last Newton step's recursion is kept for Predict, the tangential
+// predictor: to first order, the solution of a problem whose initial
+// state and coefficients differ a little from the last one changes by
+// the LQ solution of that difference, which needs only a backward and a
+// forward substitution with the kept factors, no new linearization.
+template <size_t N>
+class RiccatiSQP {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef Layout<N> L;
+  enum : int { n_u = L::n_inputs };
+
+  typedef Eigen::Matrix<double, 6, N> StateMatrix;
+  typedef Eigen::Matrix<double, n_u, 1> InputVector;
+
+  RiccatiSQP(double dt, double Lf);
+
+  virtual ~RiccatiSQP();
+
+  void SetReference(double cte_ref, double epsi_ref, double v_ref);
+
+  // References of every stage, N values each (see RTI::SetStageReference).
+  void SetStageReference(const double* cte_ref, const double* epsi_ref, const double* v_ref);
+
+  // Cost weights; default_weights until set.
+  void SetWeights(const Weights& weights);
+
+  // Terminal cost of the last stage (see TerminalCost.h), none (zero)
+  // until set.
+  void SetTerminalCost(const TerminalMatrix& cost);
+
+  // Time step of the first stage and growth of the later ones (see
+  // KinematicModel), the step of the constructor and 1 until set. Takes
+  // effect from the next feedback step; Reset first to drop the plan.
+  void SetTimestep(double dt, double growth = 1) {
+    model_.dt = dt;
+    model_.growth = growth;
+  }
+
+  // Understeer of the model (see YawGain, Kinematics.h), 0 until set.
+  void SetUndersteer(double understeer) { model_.understeer = understeer; }
+
+  // Run sqp_iterations Gauss-Newton steps from initial state
+  // [x, y, psi, v, cte, epsi] and polynomial coefficients. Returns the
+  // cost of the new plan.
+  double Feedback(const StateVector& state, const Eigen::Vector4d& coeffs,
+                  int sqp_iterations = 1);
+
+  // Update the plan to first order for the next problem, from initial
+  // state and coefficients close to the last ones, shifting it a stage as
+  // Feedback does: the difference from the state the plan predicted one
+  // stage on, and from the last coefficients, is propagated through the
+  // kept recursion, shifted along with the plan. False, leaving the plan
+  // as it was, before any Feedback or when the correction of some
+  // actuator would exceed max_correction; then run Feedback instead.
+  bool Predict(const StateVector& state, const Eigen::Vector4d& coeffs, double max_correction);
+
+  // Cost of the current plan.
+  double Cost() const;
+
+  // Actuator plan, [delta_0, a_0, delta_1, a_1, ...].
+  const InputVector& Inputs() const { return U_; }
+
+  // State plan, one stage of [x, y, psi, v, cte, epsi] per column.
+  const StateMatrix& States() const { return X_; }
+
+  // Interior-point iterations of the last feedback step.
+  int Iterations() const { return iterations_; }
+
+  // Take plan, [delta_0, a_0, ...] as Inputs, as the plan of the last
+  // feedback step, so that the next Feedback shifts it and starts from it;
+  // NULL drops the plan as Reset does. Predict waits for that Feedback.
+  // A batch keeps its plans apart (BatchRiccati.h) and solves them all on
+  // one solver this way.
+  void Resume(const double* plan) {
+    if (plan) {
+      U_ = Eigen::Map<const InputVector>(plan);
+    }
+    initialized_ = plan != NULL;
+    factorized_ = false;
+  }
+
+  void Reset();
+
+ private:
+  // Augmented stage state [dx; du_prev] and its matrices.
+  typedef Eigen::Matrix<double, 8, 1> Vector8d;
+  typedef Eigen::Matrix<double, 8, 8> Matrix8d;
+  typedef Eigen::Matrix<double, 8, 2> Matrix82d;
+  typedef Eigen::Matrix<double, 2, 8> Matrix28d;
+  typedef Eigen::Matrix<double, n_terminal, 1> TerminalVector;
+
+  KinematicModel model_;
+
+  // Reference state of every stage; only v, cte and epsi are set.
+  StateMatrix xref_;
+  Weights weights_;
+  TerminalMatrix terminal_;
+
+  bool initialized_;
+  // Whether the recursion below is that of a plan, for Predict.
+  bool factorized_;
+  int iterations_;
+
+  StateMatrix X_;
+  InputVector U_;
+  Eigen::Vector4d coeffs_;
+
+  // Input bounds and the bounds of the corrections.
+  InputVector u_lb_;
+  InputVector u_ub_;
+  InputVector du_lb_;
+  InputVector du_ub_;
+
+  // Linearized stage dynamics.
+  std::array<KinematicModel::StateJacobian, N - 1> A_;
+  std::array<KinematicModel::InputJacobian, N - 1> B_;
+  std::array<KinematicModel::CoeffJacobian, N - 1> E_;
+  std::array<KinematicModel::Discretization, N - 1> discretization_;
+
+  // Interior-point iterate: corrections, bound multipliers and the
+  // diagonal barrier terms of the current Newton step.
+  InputVector du_;
+  InputVector du_new_;
+  InputVector lam_lb_;
+  InputVector lam_ub_;
+  InputVector sigma_;
+  InputVector barrier_;
+
+  // Riccati recursion: feedback gains and the cost-to-go.
+  std::array<Matrix28d, N - 1> K_;
+  std::array<Eigen::Vector2d, N - 1> k_;
+  Matrix8d P_;
+  Vector8d p_;
+  // What Predict substitutes into: for every stage the cost-to-go of the
+  // next one, the input-state coupling and the factor of the input
+  // Hessian.
+  std::array<Matrix8d, N - 1> P_next_;
+  std::array<Matrix28d, N - 1> Ruz_;
+  std::array<Eigen::LLT<Eigen::Matrix2d>, N - 1> llt_;
+
+  // Errors of the terminal cost at the plan.
+  TerminalVector TerminalError() const;
+
+  void Rollout(const StateVector& x0);
+  void Linearize();
+  void SolveQP();
+  void SolveLQ();
+};
+
+#endif /* RICCATI_SQP_H */
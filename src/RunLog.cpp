@@ -0,0 +1,365 @@
+#include "RunLog.h"
+#include <string.h>
+#include <algorithm>
+#include "Scheduler.h"
+
+using namespace std;
+
+static const char run_log_magic[4] = { 'M', 'P', 'C', 'L' };
+static const uint32_t run_log_version = 1;
+
+// A chunk is written out at least this often.
+static const chrono::seconds chunk_interval(1);
+
+// A chunk claiming more rows is taken for a corrupt log.
+static const uint32_t max_chunk_rows = 1 << 20;
+
+// Bound on the columns of a row, for the row built on the stack.
+static const size_t max_columns = 64;
+
+static void PutU32(char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = char(v >> (8 * i));
+  }
+}
+
+static void PutF64(char* p, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  for (int i = 0; i < 8; i++) {
+    p[i] = char(v >> (8 * i));
+  }
+}
+
+static uint32_t GetU32(const char* p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= uint32_t(uint8_t(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+static double GetF64(const char* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= uint64_t(uint8_t(p[i])) << (8 * i);
+  }
+  double d;
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+
+size_t RunLogWidth(RunLogType type) {
+  switch (type) {
+    case RunLogType::Float64:
+      return 8;
+    case RunLogType::Int32:
+      return 4;
+    case RunLogType::UInt8:
+      return 1;
+  }
+  return 0;
+}
+
+const vector<RunLogColumn>& RunLogColumns() {
+  static const vector<RunLogColumn> columns = []() {
+    const RunLogType f = RunLogType::Float64;
+    const RunLogType i = RunLogType::Int32;
+    vector<RunLogColumn> c = {
+      { "time", f },         { "vehicle", i },      { "x", f },
+      { "y", f },            { "psi", f },          { "v", f },
+      { "cte", f },          { "epsi", f },
+      { "steering_angle", f }, { "throttle", f },   { "ok", RunLogType::UInt8 },
+      { "cost", f },         { "iterations", i },   { "solve_time", f },
+      { "transform_time", f }, { "polyfit_time", f }, { "solve_stage_time", f },
+      { "format_time", f },  { "latency", f },      { "horizon", i },
+      { "n_plan", i },
+    };
+    for (const char* axis : { "plan_x", "plan_y" }) {
+      for (size_t k = 0; k < run_log_plan_points; k++) {
+        c.push_back({ axis + to_string(k), f });
+      }
+    }
+    return c;
+  }();
+  return columns;
+}
+
+// The values of a row, in the order of RunLogColumns.
+static void RowValues(const Observation& o, double time, double* row) {
+  size_t n_plan = min(o.n_mpc, run_log_plan_points);
+  double values[] = { time,    double(o.vehicle), o.px,
+                      o.py,    o.psi,             o.v,
+                      o.cte,   o.epsi,
+                      o.steering_angle, o.throttle, double(o.ok),
+                      o.cost,  double(o.iterations), o.solve_time,
+                      o.transform_time, o.polyfit_time, o.solve_stage_time,
+                      o.format_time, o.latency,   double(o.horizon),
+                      double(n_plan) };
+  const size_t n = sizeof(values) / sizeof(values[0]);
+  copy(values, values + n, row);
+  fill(row + n, row + n + 2 * run_log_plan_points, 0.0);
+  copy(o.mpc_x, o.mpc_x + n_plan, row + n);
+  copy(o.mpc_y, o.mpc_y + n_plan, row + n + run_log_plan_points);
+}
+
+// The file header: magic, version and schema.
+static string Header() {
+  const vector<RunLogColumn>& columns = RunLogColumns();
+  string header(12, '\0');
+  memcpy(&header[0], run_log_magic, 4);
+  PutU32(&header[4], run_log_version);
+  PutU32(&header[8], uint32_t(columns.size()));
+  for (const auto& column : columns) {
+    header += char(column.type);
+    header += char(column.name.length());
+    header += column.name;
+  }
+  return header;
+}
+
+// A chunk of the first rows of values, by column, as written.
+static void EncodeChunk(const vector<vector<double> >& values, size_t rows, string& bytes) {
+  const vector<RunLogColumn>& columns = RunLogColumns();
+  bytes.assign(4 + 16 * columns.size(), '\0');
+  PutU32(&bytes[0], uint32_t(rows));
+  for (size_t c = 0; c < columns.size(); c++) {
+    const vector<double>& column = values[c];
+    auto range = minmax_element(column.begin(), column.begin() + rows);
+    PutF64(&bytes[4 + 16 * c], *range.first);
+    PutF64(&bytes[12 + 16 * c], *range.second);
+  }
+  for (size_t c = 0; c < columns.size(); c++) {
+    const vector<double>& column = values[c];
+    size_t at = bytes.size();
+    bytes.resize(at + rows * RunLogWidth(columns[c].type));
+    char* p = &bytes[at];
+    for (size_t r = 0; r < rows; r++) {
+      switch (columns[c].type) {
+        case RunLogType::Float64:
+          PutF64(p + 8 * r, column[r]);
+          break;
+        case RunLogType::Int32:
+          PutU32(p + 4 * r, uint32_t(int32_t(column[r])));
+          break;
+        case RunLogType::UInt8:
+          p[r] = char(uint8_t(column[r]));
+          break;
+      }
+    }
+  }
+}
+
+// The rows gathered, by column.
+struct RunLogWriter::Chunk {
+  size_t rows;
+  vector<vector<double> > values;
+
+  Chunk() : rows(0), values(RunLogColumns().size()) {
+    for (auto& column : values) {
+      column.resize(run_log_chunk_rows);
+    }
+  }
+};
+
+RunLogWriter::RunLogWriter() {}
+
+RunLogWriter::~RunLogWriter() {
+  Flush();
+  file_.Close();
+}
+
+bool RunLogWriter::Open(const string& path, PipelineClock::time_point origin) {
+  Flush();
+  lock_guard<mutex> lock(mutex_);
+  if (!file_.Open(path)) {
+    return false;
+  }
+  string header = Header();
+  file_.Write(header.data(), header.length());
+  opened_ = PipelineClock::now();
+  start_ = origin == PipelineClock::time_point() ? opened_ : origin;
+  if (!chunk_) {
+    chunk_.reset(new Chunk);
+  }
+  return true;
+}
+
+void RunLogWriter::Append(const Observation& observation, PipelineClock::time_point received) {
+  double row[max_columns];
+  const size_t n_columns = RunLogColumns().size();
+  lock_guard<mutex> lock(mutex_);
+  if (!file_.IsOpen()) {
+    return;
+  }
+  RowValues(observation, chrono::duration<double>(received - start_).count(), row);
+  Chunk& chunk = *chunk_;
+  for (size_t c = 0; c < n_columns; c++) {
+    chunk.values[c][chunk.rows] = row[c];
+  }
+  chunk.rows++;
+  PipelineClock::time_point now = PipelineClock::now();
+  if (chunk.rows == run_log_chunk_rows || now - opened_ >= chunk_interval) {
+    Post();
+    opened_ = now;
+  }
+}
+
+void RunLogWriter::Flush() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (file_.IsOpen() && chunk_->rows > 0) {
+      Post();
+    }
+  }
+  TaskScheduler::Background().Flush();
+  file_.Flush();
+}
+
+void RunLogWriter::Post() {
+  // The chunk is encoded and written by the background scheduler, in the
+  // order posted, and comes back as a spare; a spare, or a fresh one while
+  // all are in flight, gathers the next rows.
+  shared_ptr<Chunk> chunk = chunk_;
+  if (spare_.empty()) {
+    chunk_.reset(new Chunk);
+  } else {
+    chunk_ = spare_.back();
+    spare_.pop_back();
+  }
+  TaskScheduler::Background().Post(TaskClass::Logging, [this, chunk]() {
+    string bytes;
+    EncodeChunk(chunk->values, chunk->rows, bytes);
+    file_.Write(bytes.data(), bytes.size());
+    chunk->rows = 0;
+    lock_guard<mutex> lock(mutex_);
+    spare_.push_back(chunk);
+  });
+}
+
+bool WriteRunLog(const string& path, const Observation* observations, const PipelineClock::time_point* received,
+                 size_t n) {
+  AsyncFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+  string bytes = Header();
+  file.Write(bytes.data(), bytes.length());
+  const size_t n_columns = RunLogColumns().size();
+  vector<vector<double> > values(n_columns, vector<double>(min(n, run_log_chunk_rows)));
+  double row[max_columns];
+  for (size_t begin = 0; begin < n; begin += run_log_chunk_rows) {
+    size_t rows = min(n - begin, run_log_chunk_rows);
+    for (size_t r = 0; r < rows; r++) {
+      RowValues(observations[begin + r], chrono::duration<double>(received[begin + r] - received[0]).count(), row);
+      for (size_t c = 0; c < n_columns; c++) {
+        values[c][r] = row[c];
+      }
+    }
+    EncodeChunk(values, rows, bytes);
+    file.Write(bytes.data(), bytes.size());
+  }
+  return file.Close();
+}
+
+RunLogReader::RunLogReader() {}
+
+RunLogReader::~RunLogReader() {}
+
+bool RunLogReader::Open(const string& path) {
+  columns_.clear();
+  chunks_.clear();
+  if (!file_.Open(path)) {
+    return false;
+  }
+  const char* data = file_.Data();
+  const size_t size = file_.Size();
+  if (size < 12 || memcmp(data, run_log_magic, 4) != 0 || GetU32(data + 4) != run_log_version) {
+    return false;
+  }
+  uint32_t n_columns = GetU32(data + 8);
+  size_t at = 12;
+  size_t row_bytes = 0;
+  for (uint32_t c = 0; c < n_columns; c++) {
+    if (at + 2 > size || uint8_t(data[at]) > uint8_t(RunLogType::UInt8) || at + 2 + uint8_t(data[at + 1]) > size) {
+      return false;
+    }
+    RunLogColumn column;
+    column.type = RunLogType(data[at]);
+    column.name.assign(data + at + 2, uint8_t(data[at + 1]));
+    at += 2 + column.name.length();
+    row_bytes += RunLogWidth(column.type);
+    columns_.push_back(column);
+  }
+  // Index the chunks; one cut short at the end of the file is left out.
+  const size_t ranges_bytes = 16 * n_columns;
+  while (at + 4 + ranges_bytes <= size) {
+    uint32_t rows = GetU32(data + at);
+    if (rows > max_chunk_rows || at + 4 + ranges_bytes + rows * row_bytes > size) {
+      break;
+    }
+    ChunkIndex chunk;
+    chunk.rows = rows;
+    chunk.ranges = at + 4;
+    chunk.data = chunk.ranges + ranges_bytes;
+    chunks_.push_back(chunk);
+    at = chunk.data + rows * row_bytes;
+  }
+  return true;
+}
+
+size_t RunLogReader::Find(const string& name) const {
+  for (size_t c = 0; c < columns_.size(); c++) {
+    if (columns_[c].name == name) {
+      return c;
+    }
+  }
+  return columns_.size();
+}
+
+double RunLogReader::Min(size_t chunk, size_t column) const {
+  return GetF64(file_.Data() + chunks_[chunk].ranges + 16 * column);
+}
+
+double RunLogReader::Max(size_t chunk, size_t column) const {
+  return GetF64(file_.Data() + chunks_[chunk].ranges + 16 * column + 8);
+}
+
+// Offset in the file of the values of column in chunk; that of the
+// column past the last is the end of the chunk.
+size_t RunLogReader::ColumnOffset(size_t chunk, size_t column) const {
+  const ChunkIndex& index = chunks_[chunk];
+  size_t offset = index.data;
+  for (size_t c = 0; c < column; c++) {
+    offset += index.rows * RunLogWidth(columns_[c].type);
+  }
+  return offset;
+}
+
+void RunLogReader::ReadColumn(size_t chunk, size_t column, vector<double>& values) const {
+  const size_t rows = chunks_[chunk].rows;
+  const char* p = file_.Data() + ColumnOffset(chunk, column);
+  values.resize(rows);
+  switch (columns_[column].type) {
+    case RunLogType::Float64:
+      for (size_t r = 0; r < rows; r++) {
+        values[r] = GetF64(p + 8 * r);
+      }
+      break;
+    case RunLogType::Int32:
+      for (size_t r = 0; r < rows; r++) {
+        values[r] = double(int32_t(GetU32(p + 4 * r)));
+      }
+      break;
+    case RunLogType::UInt8:
+      for (size_t r = 0; r < rows; r++) {
+        values[r] = double(uint8_t(p[r]));
+      }
+      break;
+  }
+}
+
+void RunLogReader::Release(size_t chunk) const {
+  const ChunkIndex& index = chunks_[chunk];
+  file_.DontNeed(index.data, ColumnOffset(chunk, columns_.size()) - index.data);
+}
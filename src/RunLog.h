@@ -0,0 +1,146 @@
+#ifndef RUN_LOG_H
+#define RUN_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "AsyncFile.h"
+#include "MappedFile.h"
+#include "Pipeline.h"
+
+// Columnar log of what the controllers made of every frame they solved:
+// the state, the command, the solve statistics, the stage timings and the
+// plan, for analysis of long recorded runs. mpc --record keeps the raw
+// telemetry for replay; this keeps one fixed-width row per frame, stored
+// by column so that a reader takes only the columns it needs and skips
+// the chunks whose ranges rule them out. All fields are little-endian.
+//
+// The file starts with the magic "MPCL", a uint32 version and the schema:
+//   uint32 columns, then per column
+//     uint8  type         see RunLogType
+//     uint8  length       then length bytes of the name
+// followed by the chunks, each of up to run_log_chunk_rows rows:
+//   uint32 rows
+//   per column a float64 min and max over the chunk
+//   per column its rows values, column after column
+enum class RunLogType : uint8_t { Float64 = 0, Int32 = 1, UInt8 = 2 };
+
+struct RunLogColumn {
+  std::string name;
+  RunLogType type;
+};
+
+// Bytes of a value of type.
+size_t RunLogWidth(RunLogType type);
+
+// The columns of every run log: time (seconds since the origin of the log),
+// vehicle, x, y, psi, v, cte, epsi, steering_angle, throttle, ok, cost, iterations,
+// solve_time, transform_time, polyfit_time, solve_stage_time,
+// format_time, latency, horizon, n_plan and the plan, plan_x0 to
+// plan_y{run_log_plan_points - 1} in the vehicle frame, 0 past n_plan.
+const std::vector<RunLogColumn>& RunLogColumns();
+
+// Points of the plan kept, enough for the longest compiled horizon.
+const size_t run_log_plan_points = 16;
+
+// Rows of a full chunk.
+const size_t run_log_chunk_rows = 4096;
+
+// Appends the observations of any number of controllers, from any thread.
+// Rows are gathered into a chunk in memory; a chunk that is full, or that
+// has been open for a second, is encoded and written on the background
+// scheduler (see Scheduler.h) as logging work, through the io_uring of the
+// file where there is one (see AsyncFile.h), so a server that is killed
+// loses at most the last second.
+class RunLogWriter {
+ public:
+  RunLogWriter();
+
+  virtual ~RunLogWriter();
+
+  // Start a new log at path, its times measured from origin, by default
+  // the time it is opened; the rows of logs of one origin line up in time.
+  // False when it cannot be created.
+  bool Open(const std::string& path, PipelineClock::time_point origin = PipelineClock::time_point());
+
+  // A row for the observation of the frame received at received.
+  void Append(const Observation& observation, PipelineClock::time_point received);
+
+  // Write the rows gathered so far as a chunk, and wait until every chunk
+  // is on disk.
+  void Flush();
+
+ private:
+  struct Chunk;
+
+  std::mutex mutex_;
+  AsyncFile file_;
+  PipelineClock::time_point start_;
+  PipelineClock::time_point opened_;
+  std::shared_ptr<Chunk> chunk_;
+  // Chunks written out, which gather rows again.
+  std::vector<std::shared_ptr<Chunk> > spare_;
+
+  // Hand the chunk to the background scheduler; mutex_ is held.
+  void Post();
+};
+
+// Write the n observations, of the frames received at received, to a new
+// log at path at once, on the calling thread, with the times from the
+// first frame. False when it cannot be written.
+bool WriteRunLog(const std::string& path, const Observation* observations, const PipelineClock::time_point* received,
+                 size_t n);
+
+// Reads a log written by RunLogWriter or WriteRunLog, mapped into memory
+// (MappedFile.h). Open indexes the chunks, touching only their headers;
+// ReadColumn then decodes one column of one chunk, and only its pages are
+// read in. The reads are const and may run on any number of threads at
+// once.
+class RunLogReader {
+ public:
+  RunLogReader();
+
+  virtual ~RunLogReader();
+
+  // False when path cannot be read or is not a run log.
+  bool Open(const std::string& path);
+
+  const std::vector<RunLogColumn>& Columns() const { return columns_; }
+
+  // Index of the column called name, or Columns().size().
+  size_t Find(const std::string& name) const;
+
+  size_t Chunks() const { return chunks_.size(); }
+  size_t Rows(size_t chunk) const { return chunks_[chunk].rows; }
+
+  // The range of column over chunk.
+  double Min(size_t chunk, size_t column) const;
+  double Max(size_t chunk, size_t column) const;
+
+  // The values of column in chunk, as doubles.
+  void ReadColumn(size_t chunk, size_t column, std::vector<double>& values) const;
+
+  // Let the memory of the pages of chunk go, once it has been read.
+  void Release(size_t chunk) const;
+
+ private:
+  // Offsets in the file of the ranges and of the first column's values.
+  struct ChunkIndex {
+    size_t rows;
+    size_t ranges;
+    size_t data;
+  };
+
+  MappedFile file_;
+  std::vector<RunLogColumn> columns_;
+  std::vector<ChunkIndex> chunks_;
+
+  size_t ColumnOffset(size_t chunk, size_t column) const;
+};
+
+#endif /* RUN_LOG_H */
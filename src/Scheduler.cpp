@@ -0,0 +1,113 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <chrono>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+static atomic<size_t> control_solves(0);
+static atomic<size_t> solve_cores(1);
+
+// How long a background task waits at a time for the cores to free up.
+static const chrono::microseconds control_wait(200);
+
+ControlScope::ControlScope() {
+  control_solves++;
+}
+
+ControlScope::~ControlScope() {
+  control_solves--;
+}
+
+size_t ControlSolves() {
+  return control_solves.load();
+}
+
+void WaitForSpareCore() {
+  static const size_t cores = max<size_t>(thread::hardware_concurrency(), 1);
+  while (control_solves.load() * solve_cores.load() >= cores) {
+    this_thread::sleep_for(control_wait);
+  }
+}
+
+void SetControlSolveCores(size_t cores) {
+  solve_cores = max<size_t>(cores, 1);
+}
+
+size_t ControlSolveCores() {
+  return solve_cores.load();
+}
+
+size_t ControlCoreBudget(size_t concurrent_solves, size_t reserved) {
+  const size_t cores = max<size_t>(thread::hardware_concurrency(), 1);
+  return cores > reserved ? max<size_t>((cores - reserved) / max<size_t>(concurrent_solves, 1), 1) : 1;
+}
+
+TaskScheduler& TaskScheduler::Background() {
+  static TaskScheduler scheduler;
+  return scheduler;
+}
+
+TaskScheduler::TaskScheduler() : pending_(0), stop_(false) {
+  thread_ = thread(&TaskScheduler::Run, this);
+#ifdef __linux__
+  sched_param param;
+  param.sched_priority = 0;
+  pthread_setschedparam(thread_.native_handle(), SCHED_IDLE, &param);
+#endif
+}
+
+TaskScheduler::~TaskScheduler() {
+  Flush();
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void TaskScheduler::Post(TaskClass task_class, function<void()> task) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    queues_[int(task_class)].push_back(move(task));
+    pending_++;
+  }
+  wake_.notify_one();
+}
+
+void TaskScheduler::Flush() {
+  unique_lock<mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+void TaskScheduler::Run() {
+  function<void()> task;
+  for (;;) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return pending_ > 0 || stop_; });
+      if (pending_ == 0) {
+        return;
+      }
+      for (auto& queue : queues_) {
+        if (!queue.empty()) {
+          task = move(queue.front());
+          queue.pop_front();
+          break;
+        }
+      }
+    }
+    // A task boundary: give the cores to the control solves first.
+    WaitForSpareCore();
+    task();
+    task = nullptr;
+    lock_guard<mutex> lock(mutex_);
+    if (--pending_ == 0) {
+      idle_.notify_all();
+    }
+  }
+}
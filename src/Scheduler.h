@@ -0,0 +1,86 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// The classes of work that share the cores of a server, most urgent first.
+// Control solves run on the solver threads and are never queued behind
+// anything; the others give way to them at their task boundaries:
+//
+//   Control        the solve of a frame and its reply
+//   Speculative    presolves of the next frame and the extra starts
+//   Visualization  the observations sent to /observe
+//   Logging        the telemetry recording
+//
+// The solver threads yield the speculative work of an instance when
+// another one is waiting (see MPCBatch), and the event loop sends every
+// command of a drain before it serializes any observation. The rest runs
+// here, on one background thread at the lowest scheduling class of the
+// OS (SCHED_IDLE on Linux), which takes the queued tasks by class and in
+// order within one, and before each task waits while control solves are
+// in flight on every core.
+enum class TaskClass { Control, Speculative, Visualization, Logging };
+const int n_task_classes = 4;
+
+class TaskScheduler {
+ public:
+  // The process-wide scheduler, started with its first use.
+  static TaskScheduler& Background();
+
+  TaskScheduler();
+
+  virtual ~TaskScheduler();
+
+  // Run task on the background thread, after the tasks queued before it
+  // of its own class and of every more urgent one.
+  void Post(TaskClass task_class, std::function<void()> task);
+
+  // Wait until every task posted so far has run.
+  void Flush();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::deque<std::function<void()> > queues_[n_task_classes];
+  // Tasks posted and not yet run, the one running included.
+  size_t pending_;
+  bool stop_;
+  std::thread thread_;
+
+  void Run();
+};
+
+// Marks a control solve in flight on the calling thread for its lifetime.
+class ControlScope {
+ public:
+  ControlScope();
+  ~ControlScope();
+};
+
+// Control solves now in flight.
+size_t ControlSolves();
+
+// Wait while the control solves in flight hold every core, as the
+// background thread does before each task; for other work that only runs
+// on the cores they leave.
+void WaitForSpareCore();
+
+// The cores every control solve holds while in flight: more than one
+// when Ipopt factors with a multithreaded linear solver (see
+// MPCLinearSolverThreads), so that the background thread waits for the
+// cores the solves leave rather than for their count. 1 by default; set
+// once at startup.
+void SetControlSolveCores(size_t cores);
+size_t ControlSolveCores();
+
+// The cores that each of concurrent control solves may hold, out of those
+// of the server less reserved ones (the event loops'); at least one.
+size_t ControlCoreBudget(size_t concurrent_solves, size_t reserved);
+
+#endif /* SCHEDULER_H */
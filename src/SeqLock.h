@@ -0,0 +1,83 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+// Lock-free single-writer many-reader "latest value" slot: a sequence
+// lock.
+//
+// The writer never waits: Write bumps the sequence to odd, stores the
+// value and bumps it to even. A reader copies the value out and keeps the
+// copy only if the sequence was the same even number before and after,
+// and otherwise copies again, so it never sees a torn value and never
+// holds the writer up; it only retries while a write overlaps its copy.
+// Unlike Mailbox, reading takes nothing: every reader sees the latest
+// value, as many times as it likes.
+//
+// The value is kept as words of relaxed atomics, which the fences order,
+// so that the copies that race with a write are well defined. T must be
+// trivially copyable.
+template <class T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable value");
+
+ public:
+  SeqLock() : sequence_(0) {
+    for (size_t i = 0; i < n_words; i++) {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Writer: publish value. Writes must not overlap.
+  void Write(const T& value) {
+    uint64_t words[n_words] = { 0 };
+    memcpy(words, &value, sizeof(T));
+    const uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < n_words; i++) {
+      words_[i].store(words[i], std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  // Reader: copy the latest value into value; false, leaving it
+  // untouched, when nothing was written yet.
+  bool Read(T& value) const {
+    uint64_t words[n_words];
+    for (;;) {
+      const uint64_t before = sequence_.load(std::memory_order_acquire);
+      if (before == 0) {
+        return false;
+      }
+      if (before & 1) {
+        continue;
+      }
+      for (size_t i = 0; i < n_words; i++) {
+        words[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+    memcpy(&value, words, sizeof(T));
+    return true;
+  }
+
+  // Values written so far.
+  uint64_t Writes() const { return sequence_.load(std::memory_order_acquire) / 2; }
+
+ private:
+  enum : size_t { n_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+
+  // Odd while a write is under way.
+  std::atomic<uint64_t> sequence_;
+  std::atomic<uint64_t> words_[n_words];
+};
+
+#endif /* SEQ_LOCK_H */
@@ -0,0 +1,153 @@
+#include "Shadow.h"
+#include <math.h>
+#include "Logger.h"
+#include "Metrics.h"
+#include "Scheduler.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+// Frames of every summary of the comparison.
+static const size_t summary_frames = 100;
+
+ShadowRunner::ShadowRunner(const ControllerOptions& options, size_t vehicles, const string& name,
+                           shared_ptr<RunLogWriter> log)
+    : options_(options), name_(name), log_(log), pending_(false), started_(false), stop_(false) {
+  options_.candidate_offsets.clear();
+  options_.scenarios.clear();
+  options_.two_rate = false;
+  options_.multi_start = 1;
+  options_.speculate = false;
+  options_.load_shedding = false;
+  comparison_ = Comparison();
+  for (size_t i = 0; i < vehicles; i++) {
+    vehicles_.emplace_back(new Vehicle);
+  }
+  if (MPCParallelSetup(2) == 0) {
+    MPC_LOG(LogLevel::Warning, "CppAD has no thread left for the shadow, which will not solve");
+    return;
+  }
+  thread_ = thread(&ShadowRunner::Run, this);
+  unique_lock<mutex> lock(mutex_);
+  wake_.wait(lock, [this]() { return started_; });
+}
+
+ShadowRunner::~ShadowRunner() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void ShadowRunner::Submit(size_t vehicle, size_t generation, const Telemetry& frame, const Command& command) {
+  if (vehicle >= vehicles_.size() || !thread_.joinable()) {
+    return;
+  }
+  Vehicle& v = *vehicles_[vehicle];
+  Frame& next = v.next;
+  next.telemetry = frame;
+  next.generation = generation;
+  next.received = command.received;
+  next.arrived = command.arrived;
+  next.solved = command.solved;
+  next.primary = command.observation;
+  v.in.Publish(next);
+  size_t dropped = v.in.Dropped();
+  CountEvent(Counter::ShadowFrames);
+  CountEvent(Counter::ShadowDrops, dropped - v.dropped);
+  v.dropped = dropped;
+  {
+    lock_guard<mutex> lock(mutex_);
+    pending_ = true;
+  }
+  wake_.notify_one();
+}
+
+void ShadowRunner::Run() {
+#ifdef __linux__
+  sched_param param;
+  param.sched_priority = 0;
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+  DetachThreadMetrics();
+  MPCSolverThread();
+  {
+    lock_guard<mutex> lock(mutex_);
+    started_ = true;
+  }
+  wake_.notify_all();
+  Frame frame;
+  Command command;
+  for (;;) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return pending_ || stop_; });
+      if (stop_) {
+        return;
+      }
+      pending_ = false;
+    }
+    for (auto& vehicle : vehicles_) {
+      if (vehicle->in.Take(frame)) {
+        WaitForSpareCore();
+        Shadow(*vehicle, frame, command);
+      }
+    }
+  }
+}
+
+void ShadowRunner::Shadow(Vehicle& vehicle, Frame& frame, Command& command) {
+  if (!vehicle.controller) {
+    vehicle.controller.reset(new Controller(options_));
+  } else if (frame.generation != vehicle.generation) {
+    vehicle.controller->Reset();
+  }
+  vehicle.generation = frame.generation;
+
+  // The frame as just arrived, as it would be at a solver of its own.
+  PipelineClock::time_point now = PipelineClock::now();
+  Telemetry& telemetry = frame.telemetry;
+  telemetry.received = now;
+  telemetry.arrived = now;
+  command.ws = NULL;
+  command.framing = telemetry.framing;
+  command.received = now;
+  command.arrived = now;
+  command.observation.vehicle = frame.primary.vehicle;
+  vehicle.controller->Solve(telemetry, command);
+  command.solved = PipelineClock::now();
+  vehicle.controller->Delivered(command, command.solved);
+  if (log_) {
+    log_->Append(command.observation, frame.received);
+  }
+
+  const Observation& primary = frame.primary;
+  const Observation& shadow = command.observation;
+  Comparison& c = comparison_;
+  c.frames++;
+  c.steering_squares += pow(shadow.steering_angle - primary.steering_angle, 2);
+  c.throttle_squares += pow(shadow.throttle - primary.throttle, 2);
+  c.primary_cost += primary.cost;
+  c.shadow_cost += shadow.cost;
+  c.primary_solve += primary.solve_time;
+  c.shadow_solve += shadow.solve_time;
+  c.primary_failures += primary.ok ? 0 : 1;
+  c.shadow_failures += shadow.ok ? 0 : 1;
+  if (c.frames == summary_frames) {
+    MPC_LOG(LogLevel::Info,
+            "Shadow %s over %zu frames: RMS difference steering %.4f, throttle %.4f; cost %g vs %g, "
+            "solve %.2f vs %.2f ms, %zu vs %zu failed",
+            name_.c_str(), c.frames, sqrt(c.steering_squares / c.frames), sqrt(c.throttle_squares / c.frames),
+            c.shadow_cost / c.frames, c.primary_cost / c.frames, c.shadow_solve / c.frames * 1000,
+            c.primary_solve / c.frames * 1000, c.shadow_failures, c.primary_failures);
+    c = Comparison();
+  }
+}
@@ -0,0 +1,113 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stddef.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Controller.h"
+#include "Mailbox.h"
+#include "Pipeline.h"
+#include "RunLog.h"
+
+// Shadow evaluation of another configuration of the controllers on the
+// live telemetry: another backend or other weights, tried under the real
+// load before the server switches to it.
+//
+// Every frame a controller of the server solves is handed on, with what
+// its controller replied, to a shadow controller of the same vehicle,
+// which solves it again on a thread of its own at the lowest scheduling
+// class of the OS and only on the cores the control solves leave (see
+// WaitForSpareCore). Its replies go nowhere. A frame the shadow has not
+// started on is replaced by the next one of its vehicle, as in the
+// server's own mailboxes, and a new vehicle on a controller gets a reset
+// shadow. The shadow takes the frame as just arrived, so that its deadline
+// and latency compensation are those it would have had in the server's
+// place; its latency estimate is its own solve time on top of the
+// configured latency.
+//
+// The shadow's observations go to a run log of their own, if any, with
+// the time and vehicle of the primary's rows in the server's run log when
+// both share the origin (see RunLogWriter::Open). Every 100 frames the log
+// gets the RMS difference of the shadow's actuators from the primary's,
+// and the mean costs, solve times and failures of both. The shadow's own
+// solves stay out of the server's metrics (see DetachThreadMetrics); the
+// frames handed to it and those it dropped are counted.
+class ShadowRunner {
+ public:
+  // A shadow for each of vehicles controllers of the server, with the
+  // options of the shadow configuration less the candidates, scenarios,
+  // planner, extra starts, speculation and load shedding, which are not
+  // for a thread that only gets the cores left idle. name labels the
+  // configuration in the log; log may be NULL.
+  ShadowRunner(const ControllerOptions& options, size_t vehicles, const std::string& name,
+               std::shared_ptr<RunLogWriter> log);
+
+  virtual ~ShadowRunner();
+
+  // Hand the frame to the shadow of vehicle, with the command its
+  // controller replied; generation tells a new vehicle on the controller
+  // apart. Called on the thread that solved the frame; each vehicle by
+  // one thread at a time.
+  void Submit(size_t vehicle, size_t generation, const Telemetry& frame, const Command& command);
+
+ private:
+  // A frame with the primary's answer.
+  struct Frame {
+    Telemetry telemetry;
+    size_t generation;
+    PipelineClock::time_point received;
+    PipelineClock::time_point arrived;
+    PipelineClock::time_point solved;
+    Observation primary;
+  };
+
+  struct Vehicle {
+    Mailbox<Frame> in;
+    // The frame Submit fills in and publishes.
+    Frame next;
+    // Dropped frames of in counted so far.
+    size_t dropped;
+    // The shadow controller, created on the shadow's thread with the
+    // first frame, and the generation it solves for.
+    std::unique_ptr<Controller> controller;
+    size_t generation;
+
+    Vehicle() : dropped(0), generation(0) {}
+  };
+
+  // Sums over the frames since the last summary.
+  struct Comparison {
+    size_t frames;
+    double steering_squares;
+    double throttle_squares;
+    double primary_cost;
+    double shadow_cost;
+    double primary_solve;
+    double shadow_solve;
+    size_t primary_failures;
+    size_t shadow_failures;
+  };
+
+  ControllerOptions options_;
+  std::string name_;
+  std::shared_ptr<RunLogWriter> log_;
+  std::vector<std::unique_ptr<Vehicle> > vehicles_;
+  Comparison comparison_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool pending_;
+  bool started_;
+  bool stop_;
+  std::thread thread_;
+
+  void Run();
+  // Solve the frame of a vehicle again and compare it with the primary's.
+  void Shadow(Vehicle& vehicle, Frame& frame, Command& command);
+};
+
+#endif /* SHADOW_H */
@@ -0,0 +1,90 @@
+#include "SharedChannel.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <new>
+
+using namespace std;
+
+SharedChannel::SharedChannel() : segment_(NULL) {}
+
+SharedChannel::~SharedChannel() {
+  Close();
+}
+
+void SharedChannel::Close() {
+  if (segment_) {
+    munmap(segment_, sizeof(SharedSegment));
+  }
+  if (!created_.empty()) {
+    shm_unlink(created_.c_str());
+  }
+  segment_ = NULL;
+  created_.clear();
+}
+
+// Map the object of fd, which the mapping keeps open.
+static SharedSegment* Map(int fd) {
+  void* data = mmap(NULL, sizeof(SharedSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return data == MAP_FAILED ? NULL : static_cast<SharedSegment*>(data);
+}
+
+bool SharedChannel::Create(const string& name) {
+  Close();
+  // A gateway still holding a stale object keeps its own mapping of it.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  if (ftruncate(fd, sizeof(SharedSegment)) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  segment_ = Map(fd);
+  if (!segment_) {
+    shm_unlink(name.c_str());
+    return false;
+  }
+  created_ = name;
+  // The pages come zeroed; the magic goes last, once the rings are set.
+  new (&segment_->session) atomic<uint64_t>(0);
+  new (&segment_->telemetry.head) atomic<uint64_t>(0);
+  new (&segment_->telemetry.tail) atomic<uint64_t>(0);
+  new (&segment_->commands.head) atomic<uint64_t>(0);
+  new (&segment_->commands.tail) atomic<uint64_t>(0);
+  segment_->version = shared_version;
+  atomic_thread_fence(memory_order_release);
+  segment_->magic = shared_magic;
+  return true;
+}
+
+bool SharedChannel::Open(const string& name) {
+  Close();
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SharedSegment)) {
+    close(fd);
+    return false;
+  }
+  segment_ = Map(fd);
+  if (!segment_) {
+    return false;
+  }
+  if (segment_->magic != shared_magic || segment_->version != shared_version) {
+    Close();
+    return false;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  // Commands of an earlier session are not for this one.
+  SharedRing& commands = segment_->commands;
+  commands.tail.store(commands.head.load(memory_order_acquire), memory_order_release);
+  segment_->session.fetch_add(1, memory_order_acq_rel);
+  return true;
+}
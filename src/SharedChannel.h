@@ -0,0 +1,57 @@
+#ifndef SHARED_CHANNEL_H
+#define SHARED_CHANNEL_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include "SharedRing.h"
+
+// The link between a gateway and the controller on the same host, in a
+// POSIX shared memory object: a ring of telemetry from the gateway and a
+// ring of commands back, each message a frame of the binary framing
+// (BinaryProtocol.h). Nothing goes through the kernel once both sides
+// have mapped it, so a frame costs two copies into and out of the slots
+// instead of the TCP, websocket and JSON stacks.
+//
+// The controller creates the object under its name ("/mpc" for
+// /dev/shm/mpc) and removes it when done; a gateway opens it and starts a
+// session, which makes the controller start over for a new vehicle.
+const uint32_t shared_magic = 0x3153504d;  // "MPS1"
+const uint32_t shared_version = 2;
+
+struct SharedSegment {
+  uint32_t magic;
+  uint32_t version;
+  // Bumped by every gateway that opens the channel.
+  std::atomic<uint64_t> session;
+  SharedRing telemetry;
+  SharedRing commands;
+};
+
+class SharedChannel {
+ public:
+  SharedChannel();
+
+  virtual ~SharedChannel();
+
+  // Create the object called name, replacing any stale one, and map it.
+  // False when it cannot be created or mapped.
+  bool Create(const std::string& name);
+
+  // Map the object created under name and start a new session. False
+  // when there is none or it is of another version.
+  bool Open(const std::string& name);
+
+  SharedRing& Telemetry() { return segment_->telemetry; }
+  SharedRing& Commands() { return segment_->commands; }
+  uint64_t Session() const { return segment_->session.load(std::memory_order_acquire); }
+
+ private:
+  SharedSegment* segment_;
+  // Name of the object if this side created it, to remove.
+  std::string created_;
+
+  void Close();
+};
+
+#endif /* SHARED_CHANNEL_H */
@@ -0,0 +1,76 @@
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Lock-free single-producer single-consumer queue of messages in fixed
+// slots, laid out to live in memory shared between two processes (see
+// SharedChannel.h).
+//
+// head counts the messages pushed and tail those popped; each is written
+// by one side only and on a cache line of its own, so the two sides only
+// share the lines of the slots they hand over. A full ring refuses the
+// push instead of overwriting, since the consumer may be reading the
+// oldest slot in place. Everything is plain data: the ring is valid in
+// zeroed memory and holds no pointers.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring needs address-free 64-bit atomics");
+
+const size_t shared_ring_slots = 16;
+// Payload capacity of a slot: a binary command of the longest horizon
+// with all its waypoints takes 1312 bytes (BinaryProtocol.h).
+const size_t shared_slot_bytes = 2032;
+
+struct SharedSlot {
+  uint64_t length;
+  // When the message was pushed, in nanoseconds of the steady clock,
+  // which is CLOCK_MONOTONIC and so shared by the processes of a host.
+  uint64_t stamp;
+  char data[shared_slot_bytes];
+};
+
+struct SharedRing {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) SharedSlot slots[shared_ring_slots];
+
+  // Producer: copy a message into the next slot. False when the ring is
+  // full or the message does not fit a slot.
+  bool Push(const char* data, size_t length) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (length > shared_slot_bytes || h - tail.load(std::memory_order_acquire) >= shared_ring_slots) {
+      return false;
+    }
+    SharedSlot& slot = slots[h % shared_ring_slots];
+    memcpy(slot.data, data, length);
+    slot.length = length;
+    slot.stamp = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now().time_since_epoch())
+                              .count());
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer: the oldest message, read in place until Pop, or NULL when
+  // the ring is empty.
+  const SharedSlot* Front() const {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t) {
+      return NULL;
+    }
+    return &slots[t % shared_ring_slots];
+  }
+
+  // Consumer: release the slot of Front.
+  void Pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Consumer: the number of messages waiting.
+  size_t Size() const {
+    return size_t(head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed));
+  }
+};
+
+#endif /* SHARED_RING_H */
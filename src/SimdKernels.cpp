@@ -0,0 +1,71 @@
+#include "SimdKernels.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The levels the build compiled SimdKernelsImpl.cpp for. The wider ones
+// exist only in builds with MPC_SIMD_DISPATCH, on x86.
+extern const SimdKernels kernels_Generic;
+#ifdef MPC_SIMD_DISPATCH
+extern const SimdKernels kernels_SSE42;
+extern const SimdKernels kernels_AVX2;
+extern const SimdKernels kernels_AVX512;
+#endif
+
+static const char* const level_names[] = { "generic", "sse42", "avx2", "avx512" };
+
+const char* CpuLevelName(CpuLevel level) {
+  return level_names[int(level)];
+}
+
+CpuLevel DetectCpuLevel() {
+#if defined(MPC_SIMD_DISPATCH) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return CpuLevel::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return CpuLevel::AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return CpuLevel::SSE42;
+  }
+#endif
+  return CpuLevel::Generic;
+}
+
+const SimdKernels* KernelsFor(CpuLevel level) {
+  switch (level) {
+    case CpuLevel::Generic:
+      return &kernels_Generic;
+#ifdef MPC_SIMD_DISPATCH
+    case CpuLevel::SSE42:
+      return &kernels_SSE42;
+    case CpuLevel::AVX2:
+      return &kernels_AVX2;
+    case CpuLevel::AVX512:
+      return &kernels_AVX512;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+static const SimdKernels& Select() {
+  CpuLevel level = DetectCpuLevel();
+  const char* cap = getenv("MPC_CPU_LEVEL");
+  if (cap) {
+    for (int i = 0; i < int(level); i++) {
+      if (strcmp(cap, level_names[i]) == 0) {
+        level = CpuLevel(i);
+      }
+    }
+  }
+  const SimdKernels* kernels = KernelsFor(level);
+  return kernels ? *kernels : kernels_Generic;
+}
+
+const SimdKernels& CpuKernels() {
+  // Chosen once, thread-safely, by the static initialization.
+  static const SimdKernels& kernels = Select();
+  return kernels;
+}
@@ -0,0 +1,128 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <stddef.h>
+#include "Tuning.h"
+
+// Numeric kernels built once per x86 instruction set level and chosen at
+// run time for the CPU they run on, so a single binary uses the vector
+// width of every host.
+//
+// The kernels are plain loops over separate arrays that the compiler
+// vectorizes for each level (SimdKernelsImpl.cpp, compiled with the flags
+// of its level). They include no other header-defined code, so no inline
+// function built for a wider level can be picked by the linker for all of
+// them. Elsewhere than on x86 only the generic build is compiled.
+
+enum class CpuLevel { Generic, SSE42, AVX2, AVX512 };
+
+const char* CpuLevelName(CpuLevel level);
+
+// Highest level the CPU and the build support.
+CpuLevel DetectCpuLevel();
+
+// One stage of the rollouts of a chunk of MPPI samples, structure-of-
+// arrays with n entries each. The actuators are u_delta + noise_delta[i]
+// and u_a + noise_a[i]; the step adds their cost terms, those of the rate
+// of change from delta_prev and a_prev unless first, and the cost of the
+// new state, to cost. See MPPI::Rollout. delta_prev and a_prev are read
+// even when first, so they must hold finite values.
+struct RolloutStage {
+  double dt;
+  double Lf;
+  // Understeer of the yaw rate, as YawGain (Kinematics.h).
+  double understeer;
+  double c[4];
+  // References of the new state.
+  double ref_cte;
+  double ref_epsi;
+  double ref_v;
+  Weights weights;
+  double u_delta;
+  double u_a;
+  const double* noise_delta;
+  const double* noise_a;
+  bool first;
+};
+
+struct RolloutArrays {
+  size_t n;
+  double* x;
+  double* y;
+  double* psi;
+  double* v;
+  double* cte;
+  double* epsi;
+  double* delta_prev;
+  double* a_prev;
+  double* cost;
+  // Scratch space of 4 * n.
+  double* scratch;
+};
+
+// n poses advanced in place by dt under their actuators, structure-of-
+// arrays: the step of BicycleModel::Advance (Kinematics.h), as
+// MPC::PredictBatch.
+struct PoseArrays {
+  size_t n;
+  double* x;
+  double* y;
+  double* psi;
+  double* v;
+  const double* delta;
+  const double* a;
+};
+
+// The Jacobians of n stages of the Euler step of the model, as
+// KinematicModel::Linearize, structure-of-arrays in and one column-major
+// matrix per stage out: A (6 x 6) at 36 k, B (6 x 2) at 12 k and E
+// (6 x 4) at 24 k.
+struct StageLinearization {
+  size_t n;
+  double Lf;
+  double understeer;
+  double c[4];
+  // Length, state and steering of every stage.
+  const double* dt;
+  const double* x;
+  const double* psi;
+  const double* v;
+  const double* epsi;
+  const double* delta;
+  double* A;
+  double* B;
+  double* E;
+};
+
+struct SimdKernels {
+  CpuLevel level;
+
+  void (*rollout_stage)(const RolloutStage& stage, RolloutArrays& arrays);
+
+  // Advance poses by dt with the wheelbase Lf and understeer of the model.
+  void (*advance_poses)(PoseArrays& poses, double dt, double Lf, double understeer);
+
+  // All the stage Jacobians of a horizon in one pass.
+  void (*linearize_stages)(StageLinearization& stages);
+
+  // Rotate and offset n points: x_out = c x + s y + ox, y_out = c y - s x + oy.
+  void (*vehicle_frame)(const double* xs, const double* ys, size_t n, double c, double s,
+                        double ox, double oy, double* x_out, double* y_out);
+
+  // sin and cos, and atan, of n values, by the polynomials the rollouts and
+  // the batch prediction use in place of libm: within 2 ulp of sin and cos
+  // for |x| < 1e6 and 2e-16 relative of atan. mpc_mathbench measures both
+  // against libm.
+  void (*sin_cos)(const double* x, size_t n, double* s, double* c);
+  void (*arc_tangent)(const double* x, size_t n, double* out);
+};
+
+// Kernels of the highest level the CPU supports, chosen on the first call.
+// The environment variable MPC_CPU_LEVEL (generic, sse42, avx2, avx512)
+// caps the level, e.g. to compare them.
+const SimdKernels& CpuKernels();
+
+// Kernels of a given level, or NULL if the build does not have it.
+const SimdKernels* KernelsFor(CpuLevel level);
+
+#endif /* SIMD_KERNELS_H */
@@ -0,0 +1,324 @@
+// The kernels of SimdKernels.h for one level, selected by
+// MPC_KERNEL_LEVEL (Generic, SSE42, AVX2 or AVX512). The build compiles
+// this file once per level with that level's instruction set flags.
+#include "SimdKernels.h"
+
+#ifndef MPC_KERNEL_LEVEL
+#define MPC_KERNEL_LEVEL Generic
+#endif
+
+#define MPC_KERNEL_CAT2(a, b) a##b
+#define MPC_KERNEL_CAT(a, b) MPC_KERNEL_CAT2(a, b)
+#define MPC_KERNEL_NAMESPACE MPC_KERNEL_CAT(simd_, MPC_KERNEL_LEVEL)
+
+namespace MPC_KERNEL_NAMESPACE {
+
+// sin and cos of x, reduced to r in [-pi/4, pi/4] by the nearest multiple
+// k of pi/2 and taken from the polynomials of fdlibm's kernels, within
+// an ulp or two of libm for |x| < 1e6. The code is straight-line, so the
+// loops that call it vectorize where calls to libm stay scalar.
+static inline void SinCos(double x, double& s, double& c) {
+  // Rounding to the nearest integer by adding and subtracting 1.5 2^52.
+  const double round = 6755399441055744.0;
+  double k = (x * 0.636619772367581343076 + round) - round;
+  int q = int(k);
+  double r = ((x - k * 1.57079632673412561417e+00) - k * 6.07710050630396597660e-11) -
+             k * 2.02226624871116645580e-21;
+  double z = r * r;
+  double sr = r + r * z * (-1.66666666666666324348e-01 +
+                           z * (8.33333333332248946124e-03 +
+                                z * (-1.98412698298579493134e-04 +
+                                     z * (2.75573137070700676789e-06 +
+                                          z * (-2.50507602534068634195e-08 +
+                                               z * 1.58969099521155010221e-10)))));
+  double cr = 1 - 0.5 * z + z * z * (4.16666666666666019037e-02 +
+                                     z * (-1.38888888888741095749e-03 +
+                                          z * (2.48015872894767294178e-05 +
+                                               z * (-2.75573143513906633035e-07 +
+                                                    z * (2.08757232129817482790e-09 +
+                                                         z * -1.13596475577881948265e-11)))));
+  // Quadrant k mod 4: odd ones swap sin and cos, and the signs follow.
+  // Selected by multiplying with 0 and 1, which is exact and keeps the
+  // loops free of branches.
+  double odd = double(q & 1);
+  double sign_s = double(1 - (q & 2));
+  double sign_c = double(1 - ((q + 1) & 2));
+  s = sign_s * (odd * cr + (1 - odd) * sr);
+  c = sign_c * (odd * sr + (1 - odd) * cr);
+}
+
+// atan of x, from Cephes: reduced to |r| <= tan(pi/8) by
+// atan x = pi/2 + atan(-1/x) above tan(3pi/8) and pi/4 + atan((x-1)/(x+1))
+// above 0.66, then a rational function of r^2, within 2e-16 of atan(x)
+// relative for every x. Every branch is computed and the right one
+// selected, which compilers turn into blends, so it vectorizes as SinCos.
+static inline double Atan(double x) {
+  double ax = x < 0 ? -x : x;
+  bool big = ax > 2.41421356237309504880;
+  bool mid = ax > 0.66;
+  double num = big ? -1.0 : (mid ? ax - 1 : ax);
+  double den = big ? ax : (mid ? ax + 1 : 1.0);
+  // The constant and the low bits of pi/2 or pi/4 added after the sum.
+  double base = big ? 1.57079632679489661923 : (mid ? 0.78539816339744830962 : 0.0);
+  double low = big ? 6.123233995736765886130e-17 : (mid ? 3.061616997868382943065e-17 : 0.0);
+  double r = num / den;
+  double z = r * r;
+  double p = (((-8.750608600031904122785e-01 * z - 1.615753718733365076637e+01) * z -
+               7.500855792314704667340e+01) * z - 1.228866684490136173410e+02) * z -
+             6.485021904942025371773e+01;
+  double q = ((((z + 2.485846490142306297962e+01) * z + 1.650270098316988542046e+02) * z +
+               4.328810604912902668951e+02) * z + 4.853903996359136964868e+02) * z +
+             1.945506571482613964425e+02;
+  double y = base + (r + r * z * p / q + low);
+  return x < 0 ? -y : y;
+}
+
+// The transcendental functions of a stage, in a loop of their own so that
+// the arithmetic of StepSamples vectorizes even where they would not. The
+// arrays are restrict parameters, which compilers honour where they do
+// not for restrict locals.
+static void Transcendentals(size_t n, const double c[4], const double* __restrict x,
+                            const double* __restrict psi, const double* __restrict epsi,
+                            double* __restrict sin_epsi, double* __restrict sin_psi,
+                            double* __restrict cos_psi, double* __restrict psi_des) {
+  const double c1 = c[1];
+  const double c2 = c[2];
+  const double c3 = c[3];
+  for (size_t i = 0; i < n; i++) {
+    double df = (3 * c3 * x[i] + 2 * c2) * x[i] + c1;
+    double cos_epsi;
+    SinCos(epsi[i], sin_epsi[i], cos_epsi);
+    SinCos(psi[i], sin_psi[i], cos_psi[i]);
+    psi_des[i] = Atan(df);
+  }
+}
+
+static void StepSamples(size_t n, const RolloutStage& stage, const double* __restrict noise_delta,
+                        const double* __restrict noise_a, const double* __restrict sin_epsi,
+                        const double* __restrict sin_psi, const double* __restrict cos_psi,
+                        const double* __restrict psi_des, double* __restrict x,
+                        double* __restrict y, double* __restrict psi, double* __restrict v,
+                        double* __restrict cte, double* __restrict epsi,
+                        double* __restrict delta_prev, double* __restrict a_prev,
+                        double* __restrict cost) {
+  const double c0 = stage.c[0];
+  const double c1 = stage.c[1];
+  const double c2 = stage.c[2];
+  const double c3 = stage.c[3];
+  const double dt = stage.dt;
+  const double dt_Lf = dt / stage.Lf;
+  const double understeer = stage.understeer;
+  const double u_delta = stage.u_delta;
+  const double u_a = stage.u_a;
+  const double ref_cte = stage.ref_cte;
+  const double ref_epsi = stage.ref_epsi;
+  const double ref_v = stage.ref_v;
+  const double w_cte = stage.weights.cte;
+  const double w_epsi = stage.weights.epsi;
+  const double w_v = stage.weights.v;
+  const double w_delta = stage.weights.delta;
+  const double w_a = stage.weights.a;
+  // The rate of change terms are weighed in rather than branched on, so the
+  // loop has a single body.
+  const double w_rate_delta = stage.first ? 0 : stage.weights.ddelta;
+  const double w_rate_a = stage.first ? 0 : stage.weights.da;
+
+  for (size_t i = 0; i < n; i++) {
+    double delta = u_delta + noise_delta[i];
+    double a = u_a + noise_a[i];
+    double ddelta = delta - delta_prev[i];
+    double da = a - a_prev[i];
+    double c = w_delta * delta * delta + w_a * a * a + w_rate_delta * ddelta * ddelta + w_rate_a * da * da;
+
+    // One step of KinematicModel::Step. cte and epsi go first, as they
+    // read the old pose.
+    double px = x[i];
+    double f = ((c3 * px + c2) * px + c1) * px + c0;
+    double vi = v[i];
+    double turn = vi * delta * dt_Lf / (1 + understeer * vi * vi);
+    double cte1 = (f - y[i]) + vi * sin_epsi[i] * dt;
+    double epsi1 = (psi[i] - psi_des[i]) + turn;
+    x[i] = px + vi * cos_psi[i] * dt;
+    y[i] += vi * sin_psi[i] * dt;
+    psi[i] += turn;
+    double v1 = vi + a * dt;
+    v[i] = v1;
+    cte[i] = cte1;
+    epsi[i] = epsi1;
+
+    double e_cte = cte1 - ref_cte;
+    double e_epsi = epsi1 - ref_epsi;
+    double e_v = v1 - ref_v;
+    cost[i] += c + w_cte * e_cte * e_cte + w_epsi * e_epsi * e_epsi + w_v * e_v * e_v;
+    delta_prev[i] = delta;
+    a_prev[i] = a;
+  }
+}
+
+static void RolloutStageKernel(const RolloutStage& stage, RolloutArrays& arrays) {
+  const size_t n = arrays.n;
+  double* sin_epsi = arrays.scratch;
+  double* sin_psi = arrays.scratch + n;
+  double* cos_psi = arrays.scratch + 2 * n;
+  double* psi_des = arrays.scratch + 3 * n;
+  Transcendentals(n, stage.c, arrays.x, arrays.psi, arrays.epsi, sin_epsi, sin_psi, cos_psi, psi_des);
+  StepSamples(n, stage, stage.noise_delta, stage.noise_a, sin_epsi, sin_psi, cos_psi, psi_des,
+              arrays.x, arrays.y, arrays.psi, arrays.v, arrays.cte, arrays.epsi,
+              arrays.delta_prev, arrays.a_prev, arrays.cost);
+}
+
+// The yaw rate per unit of steering of YawGain (Kinematics.h).
+static inline double Gain(double v, double Lf, double understeer) {
+  return v / (Lf * (1 + understeer * v * v));
+}
+
+static void AdvancePoses(size_t n, double dt, double Lf, double understeer, double* __restrict x,
+                         double* __restrict y, double* __restrict psi, double* __restrict v,
+                         const double* __restrict delta, const double* __restrict a) {
+  for (size_t i = 0; i < n; i++) {
+    double vi = v[i];
+#ifdef MPC_RK4
+    // The four stages of KinematicIncrement.
+    double v_mid = vi + 0.5 * a[i] * dt;
+    double v_end = vi + a[i] * dt;
+    double rate = delta[i] * Gain(vi, Lf, understeer);
+    double rate_mid = delta[i] * Gain(v_mid, Lf, understeer);
+    double rate_end = delta[i] * Gain(v_end, Lf, understeer);
+    double psi_2 = psi[i] + 0.5 * dt * rate;
+    double psi_3 = psi[i] + 0.5 * dt * rate_mid;
+    double psi_4 = psi[i] + dt * rate_mid;
+    double s_1, c_1, s_2, c_2, s_3, c_3, s_4, c_4;
+    SinCos(psi[i], s_1, c_1);
+    SinCos(psi_2, s_2, c_2);
+    SinCos(psi_3, s_3, c_3);
+    SinCos(psi_4, s_4, c_4);
+    double w = dt * (1.0 / 6);
+    x[i] += w * (vi * c_1 + 2.0 * v_mid * (c_2 + c_3) + v_end * c_4);
+    y[i] += w * (vi * s_1 + 2.0 * v_mid * (s_2 + s_3) + v_end * s_4);
+    psi[i] += w * (rate + 4.0 * rate_mid + rate_end);
+#else
+    double ds = vi * dt;
+    double s;
+    double c;
+    SinCos(psi[i], s, c);
+    x[i] += ds * c;
+    y[i] += ds * s;
+    psi[i] += dt * delta[i] * Gain(vi, Lf, understeer);
+#endif
+    v[i] = vi + a[i] * dt;
+  }
+}
+
+static void AdvancePosesKernel(PoseArrays& poses, double dt, double Lf, double understeer) {
+  AdvancePoses(poses.n, dt, Lf, understeer, poses.x, poses.y, poses.psi, poses.v, poses.delta, poses.a);
+}
+
+static void SinCosKernel(const double* __restrict x, size_t n, double* __restrict s, double* __restrict c) {
+  for (size_t i = 0; i < n; i++) {
+    SinCos(x[i], s[i], c[i]);
+  }
+}
+
+static void AtanKernel(const double* __restrict x, size_t n, double* __restrict out) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = Atan(x[i]);
+  }
+}
+
+static void LinearizeStages(size_t n, double Lf, double understeer, const double* c,
+                            const double* __restrict dt, const double* __restrict x,
+                            const double* __restrict psi, const double* __restrict v,
+                            const double* __restrict epsi, const double* __restrict delta,
+                            double* __restrict A, double* __restrict B, double* __restrict E) {
+  const double c1 = c[1];
+  const double c2 = c[2];
+  const double c3 = c[3];
+  // The zeros in one contiguous pass over each, then the rest by stage.
+  for (size_t i = 0; i < 36 * n; i++) {
+    A[i] = 0;
+  }
+  for (size_t i = 0; i < 12 * n; i++) {
+    B[i] = 0;
+  }
+  for (size_t i = 0; i < 24 * n; i++) {
+    E[i] = 0;
+  }
+  for (size_t k = 0; k < n; k++) {
+    double* a = A + 36 * k;
+    double* b = B + 12 * k;
+    double* e = E + 24 * k;
+    double h = dt[k];
+    double px = x[k];
+    double vk = v[k];
+    double df = (3 * c3 * px + 2 * c2) * px + c1;
+    double d2f = 2 * c2 + 6 * c3 * px;
+    double datan = 1 / (1 + df * df);
+    double q = 1 + understeer * vk * vk;
+    double dg = (1 - understeer * vk * vk) / (Lf * q * q);
+    double turn_delta = Gain(vk, Lf, understeer) * h;
+    double turn_v = delta[k] * dg * h;
+    double s_psi, c_psi, s_epsi, c_epsi;
+    SinCos(psi[k], s_psi, c_psi);
+    SinCos(epsi[k], s_epsi, c_epsi);
+
+    // Column-major: entry (r, j) at r + 6 j.
+    a[0] = 1;
+    a[7] = 1;
+    a[12] = -vk * s_psi * h;
+    a[13] = vk * c_psi * h;
+    a[14] = 1;
+    a[18] = c_psi * h;
+    a[19] = s_psi * h;
+    a[20] = turn_v;
+    a[21] = 1;
+    a[4] = df;
+    a[10] = -1;
+    a[22] = s_epsi * h;
+    a[34] = vk * h * c_epsi;
+    a[5] = -d2f * datan;
+    a[17] = 1;
+    a[23] = turn_v;
+
+    b[2] = turn_delta;
+    b[9] = h;
+    b[5] = turn_delta;
+
+    e[4] = 1;
+    e[10] = px;
+    e[16] = px * px;
+    e[22] = px * px * px;
+    e[11] = -datan;
+    e[17] = -datan * 2 * px;
+    e[23] = -datan * 3 * px * px;
+  }
+}
+
+static void LinearizeStagesKernel(StageLinearization& stages) {
+  LinearizeStages(stages.n, stages.Lf, stages.understeer, stages.c, stages.dt, stages.x, stages.psi, stages.v,
+                  stages.epsi, stages.delta, stages.A, stages.B, stages.E);
+}
+
+static void VehicleFrameKernel(const double* __restrict xs, const double* __restrict ys, size_t n,
+                               double c, double s, double ox, double oy,
+                               double* __restrict x_out, double* __restrict y_out) {
+  for (size_t i = 0; i < n; i++) {
+    double x = xs[i];
+    double y = ys[i];
+    x_out[i] = c * x + s * y + ox;
+    y_out[i] = c * y - s * x + oy;
+  }
+}
+
+}  // namespace MPC_KERNEL_NAMESPACE
+
+extern const SimdKernels MPC_KERNEL_CAT(kernels_, MPC_KERNEL_LEVEL);
+
+const SimdKernels MPC_KERNEL_CAT(kernels_, MPC_KERNEL_LEVEL) = {
+  CpuLevel::MPC_KERNEL_LEVEL,
+  MPC_KERNEL_NAMESPACE::RolloutStageKernel,
+  MPC_KERNEL_NAMESPACE::AdvancePosesKernel,
+  MPC_KERNEL_NAMESPACE::LinearizeStagesKernel,
+  MPC_KERNEL_NAMESPACE::VehicleFrameKernel,
+  MPC_KERNEL_NAMESPACE::SinCosKernel,
+  MPC_KERNEL_NAMESPACE::AtanKernel,
+};
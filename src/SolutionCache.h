@@ -0,0 +1,214 @@
+#ifndef SOLUTION_CACHE_H
+#define SOLUTION_CACHE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "KinematicModel.h"
+#include "MPC_Problem.h"
+#include "Metrics.h"
+
+// Solutions of the Ipopt problem over N states by the problems they
+// solve, least recently used first out.
+//
+// A problem is its initial state and reference coefficients, given the
+// weights, time grid and constraints, which the owner clears the cache
+// on changing. The ten numbers are quantized to a cell of key_quantum
+// each; a lookup finds the solution kept for the cell, if any, and tells
+// whether its problem is within a tenth of the cell of the one looked up,
+// close enough for its solution to stand as this one's. Laps of the same
+// track put the vehicle in the same cells again and again.
+//
+// The entries are reserved up front and reused once the cache is full,
+// which then only copies; their bytes are counted in Counter::CacheBytes.
+template <size_t N>
+class SolutionCache {
+ public:
+  typedef typename MPC_Problem<N>::VarVector VarVector;
+  typedef typename MPC_Problem<N>::ConVector ConVector;
+
+  // x, y, psi, v, cte, epsi and the four coefficients.
+  enum : size_t { n_key = 10 };
+
+  struct Entry {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    int64_t cell[n_key];
+    double key[n_key];
+    // The solution and its multipliers, as MPC_Problem keeps them.
+    VarVector x;
+    VarVector z_L;
+    VarVector z_U;
+    ConVector lambda;
+    double cost;
+    // Neighbours in the order of use, most recent first.
+    size_t newer;
+    size_t older;
+  };
+
+  SolutionCache() : capacity_(0), used_(0), newest_(none), oldest_(none) {}
+
+  // Keep up to capacity solutions, forgetting those kept; 0 keeps none.
+  void SetCapacity(size_t capacity) {
+    capacity_ = capacity;
+    Clear();
+    if (entries_.capacity() < capacity) {
+      CountEvent(Counter::CacheBytes, (capacity - entries_.capacity()) * sizeof(Entry));
+      entries_.reserve(capacity);
+    }
+    index_.reserve(capacity);
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+  // Bytes of the entries and of the index: its buckets and, for every
+  // entry, a node of the key, the position and a link.
+  size_t Bytes() const {
+    return entries_.capacity() * sizeof(Entry) + index_.bucket_count() * sizeof(void*) +
+           index_.size() * (sizeof(uint64_t) + sizeof(size_t) + sizeof(void*));
+  }
+
+  // Forget every solution, keeping the memory.
+  void Clear() {
+    index_.clear();
+    newest_ = none;
+    oldest_ = none;
+    used_ = 0;
+  }
+
+  // The solution kept for the cell of (state, coeffs), now the most
+  // recently used, or NULL; exact is set when its problem is within the
+  // tolerance of this one.
+  const Entry* Find(const StateVector& state, const Eigen::Vector4d& coeffs, bool& exact) {
+    exact = false;
+    if (capacity_ == 0) {
+      return NULL;
+    }
+    double key[n_key];
+    int64_t cell[n_key];
+    Key(state, coeffs, key, cell);
+    typename std::unordered_map<uint64_t, size_t>::const_iterator it = index_.find(Hash(cell));
+    if (it == index_.end() || memcmp(entries_[it->second].cell, cell, sizeof(cell)) != 0) {
+      return NULL;
+    }
+    Entry& entry = entries_[it->second];
+    exact = true;
+    for (size_t i = 0; i < n_key; i++) {
+      exact = exact && fabs(entry.key[i] - key[i]) <= 0.1 * key_quantum[i];
+    }
+    Touch(it->second);
+    return &entry;
+  }
+
+  // Keep the solution of nlp as that of (state, coeffs), in place of the
+  // one kept for its cell or else of the least recently used.
+  void Insert(const StateVector& state, const Eigen::Vector4d& coeffs, const MPC_Problem<N>& nlp) {
+    if (capacity_ == 0) {
+      return;
+    }
+    double key[n_key];
+    int64_t cell[n_key];
+    Key(state, coeffs, key, cell);
+    uint64_t hash = Hash(cell);
+    size_t i;
+    typename std::unordered_map<uint64_t, size_t>::iterator it = index_.find(hash);
+    if (it != index_.end()) {
+      // The cell's entry, or one of another cell of the same hash.
+      i = it->second;
+    } else if (used_ < capacity_) {
+      i = used_++;
+      if (i == entries_.size()) {
+        entries_.push_back(Entry());
+      }
+      Link(i);
+      index_[hash] = i;
+    } else {
+      i = oldest_;
+      index_.erase(Hash(entries_[i].cell));
+      index_[hash] = i;
+    }
+    Entry& entry = entries_[i];
+    memcpy(entry.cell, cell, sizeof(cell));
+    memcpy(entry.key, key, sizeof(key));
+    entry.x = nlp.x;
+    entry.z_L = nlp.z_L;
+    entry.z_U = nlp.z_U;
+    entry.lambda = nlp.lambda;
+    entry.cost = nlp.obj_value;
+    Touch(i);
+  }
+
+ private:
+  static const size_t none = size_t(-1);
+
+  // Cell sizes of x, y, psi, v, cte, epsi and the coefficients of x^0 to
+  // x^3: about what moves the first actuators by a fraction of a percent.
+  static constexpr double key_quantum[n_key] = { 0.1, 0.05, 0.01, 0.1, 0.05, 0.01,
+                                                 0.05, 0.01, 1e-3, 1e-5 };
+
+  size_t capacity_;
+  // Entries in use, the first of entries_.
+  size_t used_;
+  std::vector<Entry, Eigen::aligned_allocator<Entry> > entries_;
+  std::unordered_map<uint64_t, size_t> index_;
+  size_t newest_;
+  size_t oldest_;
+
+  static void Key(const StateVector& state, const Eigen::Vector4d& coeffs, double* key, int64_t* cell) {
+    for (size_t i = 0; i < 6; i++) {
+      key[i] = state[i];
+    }
+    for (size_t i = 0; i < 4; i++) {
+      key[6 + i] = coeffs[i];
+    }
+    for (size_t i = 0; i < n_key; i++) {
+      cell[i] = int64_t(floor(key[i] / key_quantum[i]));
+    }
+  }
+
+  // FNV-1a over the cell indices.
+  static uint64_t Hash(const int64_t* cell) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(cell);
+    for (size_t i = 0; i < n_key * sizeof(int64_t); i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+  }
+
+  // Put entry i, not in the order of use, first in it.
+  void Link(size_t i) {
+    entries_[i].newer = none;
+    entries_[i].older = newest_;
+    if (newest_ != none) {
+      entries_[newest_].newer = i;
+    }
+    newest_ = i;
+    if (oldest_ == none) {
+      oldest_ = i;
+    }
+  }
+
+  // Move entry i to the front of the order of use.
+  void Touch(size_t i) {
+    if (i == newest_) {
+      return;
+    }
+    Entry& entry = entries_[i];
+    entries_[entry.newer].older = entry.older;
+    if (entry.older != none) {
+      entries_[entry.older].newer = entry.newer;
+    } else {
+      oldest_ = entry.newer;
+    }
+    Link(i);
+  }
+};
+
+template <size_t N>
+constexpr double SolutionCache<N>::key_quantum[SolutionCache<N>::n_key];
+
+#endif /* SOLUTION_CACHE_H */
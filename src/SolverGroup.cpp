@@ -0,0 +1,78 @@
+#include "SolverGroup.h"
+#include <algorithm>
+#include "Logger.h"
+#include "MPC.h"
+
+using namespace std;
+
+SolverGroup::SolverGroup(size_t threads) : job_(NULL), n_(0), run_(0), running_(0), stop_(false) {
+  size_t free = MPCParallelSetup(threads + 1);
+  if (free < threads) {
+    MPC_LOG(LogLevel::Warning, "CppAD supports %zu more threads, using %zu of %zu", free, free, threads);
+    threads = free;
+  }
+  // Each thread claims its CppAD thread before the next starts, so that
+  // the next MPCParallelSetup counts them all.
+  unique_lock<mutex> lock(mutex_);
+  for (size_t i = 0; i < threads; i++) {
+    running_ = 1;
+    threads_.emplace_back(&SolverGroup::Work, this, i + 1);
+    done_.wait(lock, [this]() { return running_ == 0; });
+  }
+}
+
+SolverGroup::~SolverGroup() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+}
+
+void SolverGroup::Run(size_t n, const function<void(size_t)>& job) {
+  n = min(n, threads_.size() + 1);
+  if (n > 1) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      job_ = &job;
+      n_ = n;
+      running_ = n - 1;
+      run_++;
+    }
+    start_.notify_all();
+  }
+  job(0);
+  if (n > 1) {
+    unique_lock<mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return running_ == 0; });
+    job_ = NULL;
+  }
+}
+
+void SolverGroup::Work(size_t i) {
+  MPCSolverThread();
+  unique_lock<mutex> lock(mutex_);
+  running_ = 0;
+  done_.notify_all();
+  size_t run = run_;
+  for (;;) {
+    start_.wait(lock, [this, run]() { return stop_ || run_ != run; });
+    if (stop_) {
+      return;
+    }
+    run = run_;
+    if (i >= n_) {
+      continue;
+    }
+    const function<void(size_t)>* job = job_;
+    lock.unlock();
+    (*job)(i);
+    lock.lock();
+    if (--running_ == 0) {
+      done_.notify_all();
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef SOLVER_GROUP_H
+#define SOLVER_GROUP_H
+
+#include <stddef.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads that run the jobs of one solve in parallel with the calling
+// thread, for the candidate references and scenarios
+// of Controller.
+//
+// Every thread claims a CppAD thread of its own (MPCSolverThread) when it
+// starts, so the MPCs it solves must be made and used on it alone; the
+// group puts CppAD in parallel mode (see MPCParallelSetup) and starts as
+// many of the threads asked for as CppAD has left.
+class SolverGroup {
+ public:
+  explicit SolverGroup(size_t threads);
+
+  ~SolverGroup();
+
+  // Threads started, not counting the caller's.
+  size_t Threads() const { return threads_.size(); }
+
+  // Run job(i) for every i below n, at most Threads() + 1: job(0) on the
+  // calling thread and job(i) on thread i of the group, always the same
+  // one. Returns once all are done.
+  void Run(size_t n, const std::function<void(size_t)>& job);
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  // The jobs of the current run, the run number and the threads of it
+  // still running.
+  const std::function<void(size_t)>* job_;
+  size_t n_;
+  size_t run_;
+  size_t running_;
+  bool stop_;
+  std::vector<std::thread> threads_;
+
+  void Work(size_t i);
+};
+
+#endif /* SOLVER_GROUP_H */
@@ -0,0 +1,94 @@
+#ifndef STATE_FILTER_H
+#define STATE_FILTER_H
+
+#include <math.h>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/LU"
+#include "Kinematics.h"
+
+// Extended Kalman filter of the pose [x, y, psi, v] in map coordinates,
+// from the pose every frame reports.
+//
+// Between frames the estimate follows the kinematic bicycle model
+// (BicycleModel::Advance) with the actuators the previous frame reported,
+// which are the ones the vehicle held meanwhile, and its covariance grows
+// by the process noise, given per second. Each frame then corrects it by
+// the measured pose. Everything is in 4 x 4 fixed-size matrices, so an
+// update allocates nothing.
+class StateFilter {
+ public:
+  typedef Eigen::Matrix<double, 4, 1> Vector;
+  typedef Eigen::Matrix<double, 4, 4> Matrix;
+
+  // Standard deviations of the measurement of each component, and of the
+  // process noise over one second.
+  StateFilter(double understeer, const Vector& measurement_sd, const Vector& process_sd)
+      : model_(Lf, understeer), initialized_(false) {
+    R_ = measurement_sd.cwiseAbs2().asDiagonal();
+    Q_ = process_sd.cwiseAbs2().asDiagonal();
+  }
+
+  // Forget the estimate; the next measurement is taken as it is.
+  void Reset() { initialized_ = false; }
+
+  // Correct the estimate by the pose z measured dt seconds after the last
+  // one, with the actuators delta and a reported along with it, and
+  // return the new estimate. A dt of 0 or less starts over from z.
+  const Vector& Update(const Vector& z, double dt, double delta, double a) {
+    if (!initialized_ || dt <= 0) {
+      x_ = z;
+      P_ = R_;
+      initialized_ = true;
+    } else {
+      Predict(dt, x_, P_);
+      // Innovation, with the heading difference wrapped to (-pi, pi].
+      Vector y = z - x_;
+      y[2] = atan2(sin(y[2]), cos(y[2]));
+      Matrix K = P_ * (P_ + R_).inverse();
+      x_ += K * y;
+      P_ = (Matrix::Identity() - K) * P_;
+    }
+    u_[0] = delta;
+    u_[1] = a;
+    return x_;
+  }
+
+  // The estimate dt seconds after the last measurement.
+  Vector Predicted(double dt) const {
+    Vector x = x_;
+    Matrix P = P_;
+    Predict(dt, x, P);
+    return x;
+  }
+
+ private:
+  BicycleModel<> model_;
+  bool initialized_;
+  Vector x_;
+  Matrix P_;
+  Matrix R_;
+  Matrix Q_;
+  double u_[2];
+
+  // Advance x and P by dt with the held actuators, linearized at x like
+  // the explicit Euler step of the model.
+  void Predict(double dt, Vector& x, Matrix& P) const {
+    double c = cos(x[2]);
+    double s = sin(x[2]);
+    double gain_dv;
+    double unused;
+    YawGainDerivatives(x[3], model_.understeer, Lf, gain_dv, unused);
+    Matrix F = Matrix::Identity();
+    F(0, 2) = -x[3] * s * dt;
+    F(0, 3) = c * dt;
+    F(1, 2) = x[3] * c * dt;
+    F(1, 3) = s * dt;
+    F(2, 3) = u_[0] * gain_dv * dt;
+    Vector next;
+    model_.Advance(x.data(), u_, dt, next.data());
+    x = next;
+    P = F * P * F.transpose() + Q_ * dt;
+  }
+};
+
+#endif /* STATE_FILTER_H */
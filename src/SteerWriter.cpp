@@ -0,0 +1,227 @@
+#include "SteerWriter.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+using namespace std;
+
+// Coordinates beyond this are written exactly whatever the resolution,
+// which would take more digits than the buffer holds.
+static const double max_rounded = 1e9;
+
+// Format value into buf, returning the length.
+static int FormatNumber(double value, char* buf, size_t size) {
+  if (!isfinite(value)) {
+    // JSON has no representation for these.
+    buf[0] = '0';
+    return 1;
+  }
+  int n = snprintf(buf, size, "%.15g", value);
+  if (strtod(buf, NULL) != value) {
+    n = snprintf(buf, size, "%.17g", value);
+  }
+  return n;
+}
+
+static void AppendNumber(string& out, double value) {
+  char buf[32];
+  out.append(buf, FormatNumber(value, buf, sizeof(buf)));
+}
+
+// value rounded to a multiple of resolution, with the decimals it needs
+// and no trailing zeros.
+static void AppendRounded(string& out, double value, double resolution, int decimals) {
+  if (resolution <= 0 || !(fabs(value) < max_rounded)) {
+    AppendNumber(out, value);
+    return;
+  }
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "%.*f", decimals, round(value / resolution) * resolution);
+  if (decimals > 0) {
+    while (buf[n - 1] == '0') {
+      n--;
+    }
+    if (buf[n - 1] == '.') {
+      n--;
+    }
+  }
+  if (n == 2 && buf[0] == '-' && buf[1] == '0') {
+    buf[0] = '0';
+    n = 1;
+  }
+  out.append(buf, n);
+}
+
+static void AppendArray(string& out, const char* key, const double* values, size_t n, double resolution = 0) {
+  int decimals = resolution > 0 ? max(0, min(9, int(ceil(-log10(resolution) - 1e-9)))) : 0;
+  out += ",\"";
+  out += key;
+  out += "\":[";
+  for (size_t i = 0; i < n; i++) {
+    if (i > 0) {
+      out += ',';
+    }
+    AppendRounded(out, values[i], resolution, decimals);
+  }
+  out += ']';
+}
+
+// The line (x, y) decimated and rounded as viz says.
+static void AppendLine(string& out, const char* key_x, const char* key_y, const double* x, const double* y,
+                       size_t n, const VizEncoding& viz) {
+  double kept_x[Telemetry::max_points];
+  double kept_y[Telemetry::max_points];
+  if (viz.tolerance > 0) {
+    n = Decimate(x, y, n, viz.tolerance, kept_x, kept_y);
+    x = kept_x;
+    y = kept_y;
+  }
+  AppendArray(out, key_x, x, n, viz.resolution);
+  AppendArray(out, key_y, y, n, viz.resolution);
+}
+
+void ParseVizQuery(const string& query, VizEncoding& encoding) {
+  size_t begin = 0;
+  while (begin < query.size()) {
+    size_t end = min(query.find('&', begin), query.size());
+    size_t eq = query.find('=', begin);
+    if (eq < end) {
+      string name = query.substr(begin, eq - begin);
+      double value = max(atof(query.substr(eq + 1, end - eq - 1).c_str()), 0.0);
+      if (name == "viz_tolerance") {
+        encoding.tolerance = value;
+      } else if (name == "viz_resolution") {
+        encoding.resolution = value;
+      }
+    }
+    begin = end + 1;
+  }
+}
+
+// Squared distance of (px, py) from the segment from a to b.
+static double SegmentDistance2(double px, double py, double ax, double ay, double bx, double by) {
+  double dx = bx - ax;
+  double dy = by - ay;
+  double length2 = dx * dx + dy * dy;
+  double t = length2 > 0 ? ((px - ax) * dx + (py - ay) * dy) / length2 : 0;
+  t = min(max(t, 0.0), 1.0);
+  double ex = ax + t * dx - px;
+  double ey = ay + t * dy - py;
+  return ex * ex + ey * ey;
+}
+
+size_t Decimate(const double* x, const double* y, size_t n, double tolerance, double* out_x, double* out_y) {
+  n = min(n, size_t(Telemetry::max_points));
+  bool keep[Telemetry::max_points];
+  fill(keep, keep + n, tolerance <= 0);
+  if (n > 0) {
+    keep[0] = keep[n - 1] = true;
+  }
+  // The spans still to split, first and last point; they are disjoint,
+  // so there are fewer than n at a time.
+  size_t spans[2 * Telemetry::max_points];
+  size_t top = 0;
+  if (n > 2 && tolerance > 0) {
+    spans[top++] = 0;
+    spans[top++] = n - 1;
+  }
+  const double tolerance2 = tolerance * tolerance;
+  while (top > 0) {
+    size_t last = spans[--top];
+    size_t first = spans[--top];
+    size_t farthest = first;
+    double distance2 = tolerance2;
+    for (size_t i = first + 1; i < last; i++) {
+      double d2 = SegmentDistance2(x[i], y[i], x[first], y[first], x[last], y[last]);
+      if (d2 > distance2) {
+        farthest = i;
+        distance2 = d2;
+      }
+    }
+    if (farthest == first) {
+      continue;
+    }
+    keep[farthest] = true;
+    if (farthest - first > 1) {
+      spans[top++] = first;
+      spans[top++] = farthest;
+    }
+    if (last - farthest > 1) {
+      spans[top++] = farthest;
+      spans[top++] = last;
+    }
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (keep[i]) {
+      out_x[kept] = x[i];
+      out_y[kept] = y[i];
+      kept++;
+    }
+  }
+  return kept;
+}
+
+void WriteSteer(string& out, double steering_angle, double throttle,
+                const double* mpc_x, const double* mpc_y, size_t n_mpc,
+                const double* next_x, const double* next_y, size_t n_next,
+                const VizEncoding& viz) {
+  out.clear();
+  out += "42[\"steer\",{\"steering_angle\":";
+  AppendNumber(out, steering_angle);
+  out += ",\"throttle\":";
+  AppendNumber(out, throttle);
+  AppendLine(out, "mpc_x", "mpc_y", mpc_x, mpc_y, n_mpc, viz);
+  AppendLine(out, "next_x", "next_y", next_x, next_y, n_next, viz);
+  out += "}]";
+}
+
+static void AppendField(string& out, const char* key, double value) {
+  out += ",\"";
+  out += key;
+  out += "\":";
+  AppendNumber(out, value);
+}
+
+void WriteObservation(string& out, const Observation& o, const VizEncoding& viz) {
+  out.clear();
+  out += "{\"vehicle\":";
+  AppendNumber(out, double(o.vehicle));
+  AppendField(out, "x", o.px);
+  AppendField(out, "y", o.py);
+  AppendField(out, "psi", o.psi);
+  AppendField(out, "v", o.v);
+  AppendField(out, "steering_angle", o.steering_angle);
+  AppendField(out, "throttle", o.throttle);
+  out += o.ok ? ",\"ok\":true" : ",\"ok\":false";
+  AppendField(out, "cost", o.cost);
+  AppendField(out, "iterations", o.iterations);
+  AppendField(out, "solve_ms", o.solve_time * 1000);
+  AppendField(out, "latency_ms", o.latency * 1000);
+  AppendField(out, "horizon", double(o.horizon));
+  AppendLine(out, "mpc_x", "mpc_y", o.mpc_x, o.mpc_y, o.n_mpc, viz);
+  out += '}';
+}
+
+void WritePlan(string& out, size_t vehicle, const PublishedPlan& plan, double age) {
+  out.clear();
+  out += "{\"vehicle\":";
+  AppendNumber(out, double(vehicle));
+  AppendField(out, "solves", double(plan.solves));
+  AppendField(out, "age_ms", age * 1000);
+  out += plan.ok ? ",\"ok\":true" : ",\"ok\":false";
+  AppendField(out, "cost", plan.cost);
+  AppendField(out, "iterations", plan.iterations);
+  AppendField(out, "solve_ms", plan.solve_time * 1000);
+  AppendField(out, "cte", plan.cte);
+  AppendField(out, "epsi", plan.epsi);
+  const ActuationPlan& actuation = plan.actuation;
+  AppendField(out, "dt", actuation.n > 0 ? actuation.dt : 0);
+  AppendField(out, "dt_growth", actuation.n > 0 ? actuation.growth : 1);
+  AppendArray(out, "steering_angle", actuation.steering, actuation.n);
+  AppendArray(out, "throttle", actuation.throttle, actuation.n);
+  AppendArray(out, "mpc_x", plan.x, plan.n);
+  AppendArray(out, "mpc_y", plan.y, plan.n);
+  out += '}';
+}
@@ -0,0 +1,59 @@
+#ifndef STEER_WRITER_H
+#define STEER_WRITER_H
+
+#include <stddef.h>
+#include <string>
+#include "Pipeline.h"
+
+// How the lines of a reply, the plan and the reference, are encoded for
+// display. Each subscriber, a simulator or an observer, may have its own.
+struct VizEncoding {
+  // Largest distance in metres of a point left out from the line through
+  // those kept (Douglas-Peucker, see Decimate); 0 keeps every point.
+  double tolerance;
+  // Grid in metres the coordinates are rounded to and written at, as
+  // 0.01 for centimetres; 0 writes them exactly.
+  double resolution;
+
+  VizEncoding() : tolerance(0), resolution(0) {}
+};
+
+// Read viz_tolerance=M and viz_resolution=M of the query string of a URL,
+// "name=value&...", into encoding, keeping what the query leaves out.
+void ParseVizQuery(const std::string& query, VizEncoding& encoding);
+
+// The points of the polyline (x, y) that Douglas-Peucker keeps within
+// tolerance, the first and the last always among them, written in order
+// to out_x and out_y, which may be x and y. Returns how many; n is capped
+// at Telemetry::max_points. Allocates nothing.
+size_t Decimate(const double* x, const double* y, size_t n, double tolerance, double* out_x, double* out_y);
+
+// Write the Socket.IO steer event for the simulator,
+//   42["steer",{"steering_angle":..,"throttle":..,"mpc_x":[..],...}]
+// directly into out. out is cleared but keeps its capacity, so once it has
+// grown to the frame size no further allocation is made.
+//
+// Numbers are written with the fewest digits (15 or 17) that read back
+// to the same double. The lines are decimated and rounded as viz says;
+// the actuators are always exact.
+void WriteSteer(std::string& out, double steering_angle, double throttle,
+                const double* mpc_x, const double* mpc_y, size_t n_mpc,
+                const double* next_x, const double* next_y, size_t n_next,
+                const VizEncoding& viz = VizEncoding());
+
+// Write the JSON of an observation for the observers of the server,
+//   {"vehicle":..,"x":..,"y":..,"psi":..,"v":..,"steering_angle":..,
+//    "throttle":..,"ok":..,"cost":..,"iterations":..,"solve_ms":..,
+//    "latency_ms":..,"horizon":..,"mpc_x":[..],"mpc_y":[..]}
+// into out, in the same way, with the plan encoded as viz says.
+void WriteObservation(std::string& out, const Observation& o, const VizEncoding& viz = VizEncoding());
+
+// Write the JSON of the latest plan of a vehicle's controller, solved age
+// seconds ago, for /plan:
+//   {"vehicle":..,"solves":..,"age_ms":..,"ok":..,"cost":..,"iterations":..,
+//    "solve_ms":..,"cte":..,"epsi":..,"dt":..,"dt_growth":..,
+//    "steering_angle":[..],"throttle":[..],"mpc_x":[..],"mpc_y":[..]}
+// with the actuators of every stage in the simulator's convention.
+void WritePlan(std::string& out, size_t vehicle, const PublishedPlan& plan, double age);
+
+#endif /* STEER_WRITER_H */
@@ -0,0 +1,242 @@
+#include "Telemetry.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Metrics.h"
+
+namespace {
+
+// Minimal JSON scanner over [p, end). Every method returns false on
+// malformed or truncated input instead of reading past end.
+struct Scanner {
+  const char* p;
+  const char* end;
+
+  void SkipSpace() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+      p++;
+    }
+  }
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (p < end && *p == c) {
+      p++;
+      return true;
+    }
+    return false;
+  }
+
+  bool Peek(char c) {
+    SkipSpace();
+    return p < end && *p == c;
+  }
+
+  bool ConsumeLiteral(const char* s) {
+    SkipSpace();
+    size_t n = strlen(s);
+    if (size_t(end - p) >= n && memcmp(p, s, n) == 0) {
+      p += n;
+      return true;
+    }
+    return false;
+  }
+
+  // String without unescaping; [*s, *s + *n) is its raw contents.
+  bool String(const char** s, size_t* n) {
+    if (!Consume('"')) {
+      return false;
+    }
+    const char* start = p;
+    while (p < end && *p != '"') {
+      p += *p == '\\' ? 2 : 1;
+    }
+    if (p >= end) {
+      return false;
+    }
+    *s = start;
+    *n = p - start;
+    p++;
+    return true;
+  }
+
+  bool Number(double* value) {
+    SkipSpace();
+    // Copy the token so that strtod stops within the buffer.
+    char token[64];
+    size_t n = 0;
+    while (p + n < end && n < sizeof(token) - 1 && p[n] != '\0' &&
+           strchr("+-.0123456789eE", p[n])) {
+      token[n] = p[n];
+      n++;
+    }
+    if (n == 0) {
+      return false;
+    }
+    token[n] = '\0';
+    char* stop;
+    *value = strtod(token, &stop);
+    if (stop != token + n) {
+      return false;
+    }
+    p += n;
+    return true;
+  }
+
+  // Array of numbers, keeping at most capacity of them, count, of the
+  // total in it.
+  bool Numbers(double* values, size_t capacity, size_t* count, size_t* total) {
+    if (!Consume('[')) {
+      return false;
+    }
+    *count = 0;
+    *total = 0;
+    if (Consume(']')) {
+      return true;
+    }
+    do {
+      double value;
+      if (!Number(&value)) {
+        return false;
+      }
+      if (*count < capacity) {
+        values[(*count)++] = value;
+      }
+      (*total)++;
+    } while (Consume(','));
+    return Consume(']');
+  }
+
+  // Skip any value.
+  bool Skip() {
+    SkipSpace();
+    if (p >= end) {
+      return false;
+    }
+    const char* s;
+    size_t n;
+    double value;
+    switch (*p) {
+      case '"':
+        return String(&s, &n);
+      case '[':
+      case '{': {
+        char close = *p == '[' ? ']' : '}';
+        p++;
+        if (Consume(close)) {
+          return true;
+        }
+        do {
+          if (close == '}' && !(String(&s, &n) && Consume(':'))) {
+            return false;
+          }
+          if (!Skip()) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume(close);
+      }
+      case 't':
+        return ConsumeLiteral("true");
+      case 'f':
+        return ConsumeLiteral("false");
+      case 'n':
+        return ConsumeLiteral("null");
+      default:
+        return Number(&value);
+    }
+  }
+};
+
+bool Equals(const char* s, size_t n, const char* key) {
+  return strlen(key) == n && memcmp(s, key, n) == 0;
+}
+
+}  // namespace
+
+TelemetryMessage DecodeTelemetry(const char* data, size_t length, Telemetry& frame) {
+  // "42" at the start of the message means there's a websocket message event.
+  // The 4 signifies a websocket message
+  // The 2 signifies a websocket event
+  if (length < 2 || data[0] != '4' || data[1] != '2') {
+    return TelemetryMessage::Other;
+  }
+  Scanner in = { data + 2, data + length };
+  const char* s;
+  size_t n;
+  if (!in.Consume('[') || !in.String(&s, &n)) {
+    return TelemetryMessage::Other;
+  }
+  // Only the event name decides, never a scan of the payload: other
+  // events are not descended into, and a telemetry event without a data
+  // object, 42["telemetry"] or 42["telemetry",null], means manual driving.
+  if (!Equals(s, n, "telemetry")) {
+    return TelemetryMessage::Other;
+  }
+  if (!in.Consume(',')) {
+    return in.Consume(']') ? TelemetryMessage::Manual : TelemetryMessage::Other;
+  }
+  if (in.ConsumeLiteral("null")) {
+    return in.Consume(']') ? TelemetryMessage::Manual : TelemetryMessage::Other;
+  }
+  if (!in.Consume('{')) {
+    return TelemetryMessage::Other;
+  }
+
+  size_t n_x = 0;
+  size_t n_y = 0;
+  size_t sent_x = 0;
+  size_t sent_y = 0;
+  if (!in.Peek('}')) {
+    do {
+      const char* key;
+      size_t key_n;
+      if (!in.String(&key, &key_n) || !in.Consume(':')) {
+        return TelemetryMessage::Other;
+      }
+      bool ok;
+      if (Equals(key, key_n, "ptsx")) {
+        ok = in.Numbers(frame.ptsx, Telemetry::max_points, &n_x, &sent_x);
+      } else if (Equals(key, key_n, "ptsy")) {
+        ok = in.Numbers(frame.ptsy, Telemetry::max_points, &n_y, &sent_y);
+      } else if (Equals(key, key_n, "x")) {
+        ok = in.Number(&frame.px);
+      } else if (Equals(key, key_n, "y")) {
+        ok = in.Number(&frame.py);
+      } else if (Equals(key, key_n, "psi")) {
+        ok = in.Number(&frame.psi);
+      } else if (Equals(key, key_n, "speed")) {
+        ok = in.Number(&frame.v);
+      } else if (Equals(key, key_n, "steering_angle")) {
+        ok = in.Number(&frame.delta);
+      } else if (Equals(key, key_n, "throttle")) {
+        ok = in.Number(&frame.a);
+      } else {
+        ok = in.Skip();
+      }
+      if (!ok) {
+        return TelemetryMessage::Other;
+      }
+    } while (in.Consume(','));
+  }
+  if (!in.Consume('}')) {
+    return TelemetryMessage::Other;
+  }
+  frame.n_points = n_x < n_y ? n_x : n_y;
+  // The waypoints past the capacity of the frame are dropped, and counted.
+  size_t sent = sent_x < sent_y ? sent_x : sent_y;
+  if (sent > frame.n_points) {
+    CountEvent(Counter::RejectedWaypoints, sent - frame.n_points);
+  }
+  frame.first_waypoint = no_waypoint_id;
+  frame.framing = Framing::Text;
+  frame.tick = false;
+  NormalizeTelemetry(frame);
+  return TelemetryMessage::Telemetry;
+}
+
+void NormalizeTelemetry(Telemetry& frame) {
+  frame.v *= mph_to_mps;
+  frame.delta = -frame.delta;
+  frame.psi = atan2(sin(frame.psi), cos(frame.psi));
+}
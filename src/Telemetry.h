@@ -0,0 +1,87 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <uWS/uWS.h>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+// Framing of a connection: the simulator's Socket.IO text, or the binary
+// framing of BinaryProtocol.h with float64 or float32 arrays.
+enum class Framing { Text, Binary64, Binary32 };
+
+// Telemetry::first_waypoint of a frame whose waypoints carry no numbers.
+const uint64_t no_waypoint_id = ~uint64_t(0);
+
+// Speed of the simulator's mph in the m/s of the model.
+const double mph_to_mps = 0.44704;
+
+// One telemetry frame from the simulator, in fixed-capacity storage so
+// that decoding a frame never allocates.
+//
+// The decoders hand it over in the units and conventions of the model
+// (see NormalizeTelemetry), which the simulator's differ from.
+struct Telemetry {
+  // Waypoints beyond this many are ignored; they come nearest first.
+  static const size_t max_points = 64;
+
+  uWS::WebSocket<uWS::SERVER>* ws;
+  // Framing the frame arrived in, and its reply is to be sent in.
+  Framing framing;
+  // Waypoints in map coordinates.
+  double ptsx[max_points];
+  double ptsy[max_points];
+  size_t n_points;
+  // The number the gateway gave ptsx[0], one more for each waypoint after
+  // it, on frames of the binary waypoints framing; no_waypoint_id on the
+  // others. It tells the sliding-window fit which waypoints it already
+  // holds (see WindowPolyfit::Update).
+  uint64_t first_waypoint;
+  double px;
+  double py;
+  // Heading in (-pi, pi], counterclockwise from the x axis.
+  double psi;
+  // Speed in m/s.
+  double v;
+  // Steering in radians, positive to the left like the model's delta,
+  // and throttle in [-1, 1].
+  double delta;
+  double a;
+  // When the event loop read the frame, and when it reached the process:
+  // the gateway's stamp on the shared ring, or received on transports
+  // that carry none. TCP gives no kernel receive timestamp to a plain
+  // recv, and uWS does its own reads, so a websocket frame is stamped at
+  // the top of its message handler.
+  std::chrono::steady_clock::time_point received;
+  std::chrono::steady_clock::time_point arrived;
+  // Set on the frames of a control tick (see MPCBatch::Tick), which carry
+  // nothing but ws, framing and received: the controller solves its last
+  // frame again, predicted to the tick. The decoders clear it.
+  bool tick;
+
+  Telemetry() : first_waypoint(no_waypoint_id), tick(false) {}
+};
+
+// Kind of a Socket.IO message, see DecodeTelemetry.
+enum class TelemetryMessage {
+  // A telemetry event with its data.
+  Telemetry,
+  // A telemetry event without data: the simulator is in manual mode.
+  Manual,
+  // Not an event ("42" prefix), another event, or a malformed frame.
+  Other
+};
+
+// Decode a Socket.IO message of the form 42["telemetry",{...}] in place
+// from the websocket buffer. Only the waypoints, pose, speed and
+// actuator fields of the data object are read, into frame; other fields
+// are skipped without being copied.
+TelemetryMessage DecodeTelemetry(const char* data, size_t length, Telemetry& frame);
+
+// Bring the fields of a frame as the simulator reports them to those of
+// Telemetry, once, in the decoder: the speed from mph to m/s, the
+// steering from the simulator's positive-right to the model's
+// positive-left, and the heading wrapped to (-pi, pi].
+void NormalizeTelemetry(Telemetry& frame);
+
+#endif /* TELEMETRY_H */
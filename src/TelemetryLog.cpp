@@ -0,0 +1,193 @@
+#include "TelemetryLog.h"
+#include <string.h>
+#include "Scheduler.h"
+
+using namespace std;
+
+static const char log_magic[4] = { 'M', 'P', 'C', 'R' };
+static const uint32_t log_version = 1;
+
+// Messages longer than this are not telemetry; a record claiming one is
+// taken for a corrupt log.
+static const uint32_t max_message = 1 << 24;
+
+static void PutU32(char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = char(v >> (8 * i));
+  }
+}
+
+static void PutU64(char* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = char(v >> (8 * i));
+  }
+}
+
+static uint32_t GetU32(const char* p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= uint32_t(uint8_t(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+static uint64_t GetU64(const char* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= uint64_t(uint8_t(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+// Buffered records are written out at least this often, and once they
+// fill a block of this many bytes.
+static const chrono::seconds flush_interval(1);
+static const size_t block_size = 64 << 10;
+
+// time, connection, kind and length.
+static const size_t record_header_size = 17;
+
+TelemetryRecorder::TelemetryRecorder() : next_connection_(0), block_(new string) {}
+
+TelemetryRecorder::~TelemetryRecorder() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    Post();
+  }
+  TaskScheduler::Background().Flush();
+  file_.Close();
+}
+
+bool TelemetryRecorder::Open(const string& path) {
+  lock_guard<mutex> lock(mutex_);
+  Post();
+  TaskScheduler::Background().Flush();
+  if (!file_.Open(path)) {
+    return false;
+  }
+  char header[8];
+  memcpy(header, log_magic, 4);
+  PutU32(header + 4, log_version);
+  file_.Write(header, sizeof(header));
+  start_ = Clock::now();
+  flushed_ = start_;
+  next_connection_ = 0;
+  connections_.clear();
+  return true;
+}
+
+void TelemetryRecorder::Connect(const void* connection) {
+  lock_guard<mutex> lock(mutex_);
+  uint32_t id = next_connection_++;
+  connections_[connection] = id;
+  Write(id, LoggedKind::Connect, NULL, 0);
+}
+
+void TelemetryRecorder::Disconnect(const void* connection) {
+  lock_guard<mutex> lock(mutex_);
+  auto it = connections_.find(connection);
+  if (it == connections_.end()) {
+    return;
+  }
+  Write(it->second, LoggedKind::Disconnect, NULL, 0);
+  connections_.erase(it);
+}
+
+void TelemetryRecorder::Message(const void* connection, bool binary, const char* data, size_t length) {
+  lock_guard<mutex> lock(mutex_);
+  auto it = connections_.find(connection);
+  if (it == connections_.end()) {
+    return;
+  }
+  Write(it->second, binary ? LoggedKind::Binary : LoggedKind::Text, data, length);
+}
+
+void TelemetryRecorder::Write(uint32_t connection, LoggedKind kind, const char* data, size_t length) {
+  if (!file_.IsOpen() || length > max_message) {
+    return;
+  }
+  // The record is stamped and copied here, in the order of the events,
+  // and written out by the background scheduler as logging work, so that
+  // the disk never holds up the thread that received it.
+  string& block = *block_;
+  size_t at = block.size();
+  block.resize(at + record_header_size + length);
+  Clock::time_point now = Clock::now();
+  uint64_t time = chrono::duration_cast<chrono::nanoseconds>(now - start_).count();
+  PutU64(&block[at], time);
+  PutU32(&block[at + 8], connection);
+  block[at + 12] = char(kind);
+  PutU32(&block[at + 13], uint32_t(length));
+  if (length > 0) {
+    memcpy(&block[at + record_header_size], data, length);
+  }
+  if (block.size() >= block_size || now - flushed_ >= flush_interval) {
+    flushed_ = now;
+    Post();
+  }
+}
+
+void TelemetryRecorder::Post() {
+  if (!file_.IsOpen() || block_->empty()) {
+    return;
+  }
+  shared_ptr<string> block = block_;
+  {
+    lock_guard<mutex> lock(spare_mutex_);
+    if (spare_.empty()) {
+      block_.reset(new string);
+    } else {
+      block_ = spare_.back();
+      spare_.pop_back();
+    }
+  }
+  block_->reserve(block_size);
+  TaskScheduler::Background().Post(TaskClass::Logging, [this, block]() {
+    file_.Write(block->data(), block->size());
+    block->clear();
+    lock_guard<mutex> lock(spare_mutex_);
+    spare_.push_back(block);
+  });
+}
+
+TelemetryReader::TelemetryReader() : file_(NULL) {}
+
+TelemetryReader::~TelemetryReader() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool TelemetryReader::Open(const string& path) {
+  if (file_) {
+    fclose(file_);
+  }
+  file_ = fopen(path.c_str(), "rb");
+  if (!file_) {
+    return false;
+  }
+  char header[8];
+  if (fread(header, 1, sizeof(header), file_) != sizeof(header) ||
+      memcmp(header, log_magic, 4) != 0 || GetU32(header + 4) != log_version) {
+    fclose(file_);
+    file_ = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool TelemetryReader::Next(LoggedEvent& event) {
+  char header[record_header_size];
+  if (!file_ || fread(header, 1, sizeof(header), file_) != sizeof(header)) {
+    return false;
+  }
+  event.time_ns = GetU64(header);
+  event.connection = GetU32(header + 8);
+  event.kind = LoggedKind(uint8_t(header[12]));
+  uint32_t length = GetU32(header + 13);
+  if (event.kind > LoggedKind::Binary || length > max_message) {
+    return false;
+  }
+  event.data.resize(length);
+  return length == 0 || fread(&event.data[0], 1, length, file_) == length;
+}
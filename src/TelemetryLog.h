@@ -0,0 +1,97 @@
+#ifndef TELEMETRY_LOG_H
+#define TELEMETRY_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AsyncFile.h"
+
+// Binary log of the telemetry a server received, for replaying it offline
+// with mpc_replay. All fields are little-endian.
+//
+// The file starts with the magic "MPCR" and a uint32 version, followed by
+// one record per event:
+//   uint64 time        nanoseconds since recording started
+//   uint32 connection  numbered from 0 in order of connection
+//   uint8  kind        see LoggedKind
+//   uint32 length      then length bytes of the raw websocket message
+
+enum class LoggedKind : uint8_t { Connect = 0, Disconnect = 1, Text = 2, Binary = 3 };
+
+struct LoggedEvent {
+  uint64_t time_ns;
+  uint32_t connection;
+  LoggedKind kind;
+  // The message as received, for Text and Binary.
+  std::string data;
+};
+
+// Appends the events of any number of connections, from any thread, to a
+// log file. The records are gathered into blocks, which go to the
+// background scheduler (see Scheduler.h) to be written once full or about
+// a second old, through the io_uring of the file where there is one (see
+// AsyncFile.h), so a server that is killed loses at most the last
+// second. The blocks come back as spares, so once there are enough of
+// them for the blocks in flight, recording a message copies it
+// without allocating.
+class TelemetryRecorder {
+ public:
+  TelemetryRecorder();
+
+  virtual ~TelemetryRecorder();
+
+  // Start a new log at path. False when it cannot be created.
+  bool Open(const std::string& path);
+
+  void Connect(const void* connection);
+  void Disconnect(const void* connection);
+
+  // A websocket message of connection, binary or text, as received.
+  void Message(const void* connection, bool binary, const char* data, size_t length);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  std::mutex mutex_;
+  AsyncFile file_;
+  Clock::time_point start_;
+  Clock::time_point flushed_;
+  uint32_t next_connection_;
+  std::unordered_map<const void*, uint32_t> connections_;
+  // The records not yet posted, and blocks written out, which gather
+  // records again, under spare_mutex_: the scheduler gives them back
+  // while Open holds mutex_ and waits for it.
+  std::shared_ptr<std::string> block_;
+  std::mutex spare_mutex_;
+  std::vector<std::shared_ptr<std::string> > spare_;
+
+  // Write one record; mutex_ is held.
+  void Write(uint32_t connection, LoggedKind kind, const char* data, size_t length);
+  // Hand block_ to the scheduler and take a spare; mutex_ is held.
+  void Post();
+};
+
+// Reads a log written by TelemetryRecorder.
+class TelemetryReader {
+ public:
+  TelemetryReader();
+
+  virtual ~TelemetryReader();
+
+  // False when path cannot be read or is not a telemetry log.
+  bool Open(const std::string& path);
+
+  // The next event; false at the end of the log or at a truncated record.
+  bool Next(LoggedEvent& event);
+
+ private:
+  FILE* file_;
+};
+
+#endif /* TELEMETRY_LOG_H */
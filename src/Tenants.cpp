@@ -0,0 +1,202 @@
+#include "Tenants.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "Logger.h"
+
+using namespace std;
+
+// Virtual seconds a tenant coming back to the workers may be behind the
+// one last given a worker, so that a few frames of a tenant whose
+// vehicles come and go are not held up behind a busy one.
+static const double wake_credit = 0.05;
+
+// Longest tenant name.
+static const size_t max_tenant_name = 32;
+
+namespace {
+
+// The charges of a tenant, in nanoseconds, written by the workers, and its
+// virtual time, in nanoseconds of worker time over its weight. The
+// default tenant has no name, and weight 1 until set.
+struct Tenant {
+  char name[max_tenant_name + 1];
+  atomic<double> weight;
+  atomic<uint64_t> solves;
+  atomic<uint64_t> cpu_ns;
+  atomic<uint64_t> worker_ns;
+  atomic<uint64_t> virtual_ns;
+};
+
+}  // namespace
+
+static Tenant tenants[max_tenants];
+// Registered under the mutex, read without it; a tenant is complete
+// before the count includes it. The default tenant is always there.
+static mutex tenants_mutex;
+static atomic<size_t> n_tenants(1);
+// The virtual time of the tenant last given a worker.
+static atomic<uint64_t> virtual_clock(0);
+
+static bool ValidName(const string& name) {
+  if (name.empty() || name.size() > max_tenant_name) {
+    return false;
+  }
+  for (char c : name) {
+    if (!(isalnum((unsigned char)c) || c == '_' || c == '-')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static const char* Name(size_t tenant) {
+  return tenant == 0 ? "default" : tenants[tenant].name;
+}
+
+static double Weight(size_t tenant) {
+  double weight = tenants[tenant].weight.load();
+  return weight > 0 ? weight : 1;
+}
+
+// The tenant of name under the mutex, registered with weight when it is
+// new; max_tenants when there is no room.
+static size_t FindTenant(const string& name, double weight) {
+  size_t n = n_tenants.load();
+  for (size_t i = 0; i < n; i++) {
+    if (name == Name(i)) {
+      return i;
+    }
+  }
+  if (n == max_tenants) {
+    return max_tenants;
+  }
+  Tenant& tenant = tenants[n];
+  snprintf(tenant.name, sizeof(tenant.name), "%s", name.c_str());
+  tenant.weight = weight;
+  tenant.solves = 0;
+  tenant.cpu_ns = 0;
+  tenant.worker_ns = 0;
+  tenant.virtual_ns = virtual_clock.load();
+  n_tenants = n + 1;
+  MPC_LOG(LogLevel::Info, "Tenant %s, weight %g", tenant.name, weight);
+  return n;
+}
+
+size_t TenantIndex(const string& name) {
+  if (name.empty()) {
+    return 0;
+  }
+  if (!ValidName(name)) {
+    MPC_LOG(LogLevel::Warning, "Bad tenant name, solving for the default tenant");
+    return 0;
+  }
+  lock_guard<mutex> lock(tenants_mutex);
+  size_t tenant = FindTenant(name, 1);
+  if (tenant == max_tenants) {
+    MPC_LOG(LogLevel::Warning, "No room for tenant %s, solving for the default tenant", name.c_str());
+    return 0;
+  }
+  return tenant;
+}
+
+bool SetTenantWeight(const string& name, double weight) {
+  if (!ValidName(name) || !(weight > 0)) {
+    return false;
+  }
+  lock_guard<mutex> lock(tenants_mutex);
+  size_t tenant = FindTenant(name, weight);
+  if (tenant == max_tenants) {
+    return false;
+  }
+  tenants[tenant].weight = weight;
+  return true;
+}
+
+bool ParseTenantWeight(const char* text) {
+  const char* colon = strchr(text, ':');
+  if (!colon) {
+    return false;
+  }
+  char* end;
+  double weight = strtod(colon + 1, &end);
+  return end != colon + 1 && *end == 0 && SetTenantWeight(string(text, colon), weight);
+}
+
+size_t TenantCount() {
+  return n_tenants.load();
+}
+
+double TenantVirtualTime(size_t tenant) {
+  return tenants[tenant].virtual_ns.load() * 1e-9;
+}
+
+void ChargeTenant(size_t tenant, double cpu, double worker) {
+  Tenant& t = tenants[tenant];
+  t.solves++;
+  t.cpu_ns += uint64_t(max(cpu, 0.0) * 1e9);
+  t.worker_ns += uint64_t(max(worker, 0.0) * 1e9);
+  t.virtual_ns += uint64_t(max(worker, 0.0) * 1e9 / Weight(tenant));
+}
+
+void WakeTenant(size_t tenant) {
+  uint64_t credit = uint64_t(wake_credit * 1e9);
+  uint64_t clock = virtual_clock.load();
+  uint64_t floor = clock > credit ? clock - credit : 0;
+  atomic<uint64_t>& virtual_ns = tenants[tenant].virtual_ns;
+  uint64_t current = virtual_ns.load();
+  while (current < floor && !virtual_ns.compare_exchange_weak(current, floor)) {
+  }
+}
+
+void PickTenant(size_t tenant) {
+  uint64_t time = tenants[tenant].virtual_ns.load();
+  uint64_t clock = virtual_clock.load();
+  while (clock < time && !virtual_clock.compare_exchange_weak(clock, time)) {
+  }
+}
+
+double ThreadCpuSeconds() {
+  timespec now;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) {
+    return 0;
+  }
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void WriteTenantMetrics(string& out) {
+  size_t n = n_tenants.load();
+  char line[256];
+  const char* const names[3] = { "mpc_tenant_solves_total", "mpc_tenant_cpu_seconds_total",
+                                 "mpc_tenant_worker_seconds_total" };
+  const char* const helps[3] = { "Solves of the vehicles of each tenant.",
+                                 "CPU time of the worker threads solving for each tenant.",
+                                 "Time the workers were held by solves of each tenant." };
+  for (size_t k = 0; k < 3; k++) {
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n", names[k], helps[k], names[k]);
+    out += line;
+    for (size_t i = 0; i < n; i++) {
+      const Tenant& tenant = tenants[i];
+      if (k == 0) {
+        snprintf(line, sizeof(line), "%s{tenant=\"%s\"} %llu\n", names[k], Name(i),
+                 (unsigned long long)tenant.solves.load());
+      } else {
+        uint64_t ns = k == 1 ? tenant.cpu_ns.load() : tenant.worker_ns.load();
+        snprintf(line, sizeof(line), "%s{tenant=\"%s\"} %.9g\n", names[k], Name(i), ns * 1e-9);
+      }
+      out += line;
+    }
+  }
+  out += "# HELP mpc_tenant_weight Share of the workers of each tenant under contention.\n";
+  out += "# TYPE mpc_tenant_weight gauge\n";
+  for (size_t i = 0; i < n; i++) {
+    snprintf(line, sizeof(line), "mpc_tenant_weight{tenant=\"%s\"} %g\n", Name(i), Weight(i));
+    out += line;
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef TENANTS_H
+#define TENANTS_H
+
+#include <stddef.h>
+#include <string>
+
+// The tenants of a shared host: the teams whose vehicles its controllers
+// solve, each named by its vehicles with ?tenant=NAME on their URL, with
+// a weight, its share of the batch workers under contention.
+//
+// Every solve is charged to the tenant of its vehicle: the CPU time of
+// the worker's thread, and the time it held the worker, which also
+// covers the threads of the candidates and scenarios it waits for. The
+// scheduler of MPCBatch gives the workers to the tenant of the least
+// virtual time first, its worker time over its weight, and solves its
+// vehicles earliest deadline first, so that under load every tenant gets
+// workers in proportion to its weight, whatever one configuration costs
+// per solve, and a tenant alone gets them all. A tenant coming back to
+// the workers after an idle stretch starts from the least virtual time
+// of the others less a short credit, rather than with all the time it
+// did not use. /metrics reports the charges of every tenant.
+//
+// The tenants are process-wide, over every hub. Vehicles that name none
+// belong to the default tenant, number 0; names are letters, digits, '_'
+// and '-', and those past max_tenants, or malformed, are the default
+// tenant too.
+enum : size_t { max_tenants = 16 };
+
+// The tenant of name, registered with weight 1 unless SetTenantWeight
+// gave it another; 0 for the default tenant. Called on the event loops.
+size_t TenantIndex(const std::string& name);
+
+// Set the weight of tenant name, registering it; false for a malformed
+// name, a weight that is not positive or no room for another tenant.
+bool SetTenantWeight(const std::string& name, double weight);
+
+// Parse the NAME:WEIGHT of --tenant and set it.
+bool ParseTenantWeight(const char* text);
+
+// The tenants registered, the default one included.
+size_t TenantCount();
+
+// The virtual time of tenant, in seconds of worker time over its weight.
+double TenantVirtualTime(size_t tenant);
+
+// Charge a solve of tenant that took cpu seconds of the worker's thread
+// and held the worker for worker seconds.
+void ChargeTenant(size_t tenant, double cpu, double worker);
+
+// A vehicle of tenant has a frame for the workers: bring its virtual time
+// up to within the credit of that of the tenant last given a worker.
+void WakeTenant(size_t tenant);
+
+// The tenant given a worker, whose virtual time the others catch up to.
+void PickTenant(size_t tenant);
+
+// CPU time of the calling thread, in seconds.
+double ThreadCpuSeconds();
+
+// Append the charges and weights of every tenant to out, in the
+// Prometheus text format (see WriteMetrics).
+void WriteTenantMetrics(std::string& out);
+
+#endif /* TENANTS_H */
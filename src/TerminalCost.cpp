@@ -0,0 +1,58 @@
+#include "TerminalCost.h"
+#include <math.h>
+#include <algorithm>
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Kinematics.h"
+
+// Iterations of the recursion, and the change of P, relative to its
+// size, at which it has converged.
+static const int max_iterations = 2000;
+static const double tolerance = 1e-10;
+
+TerminalMatrix LqrTerminalCost(const Weights& weights, double v, double dt, double understeer, double Lf) {
+  typedef Eigen::Matrix<double, n_terminal, 2> InputMatrix;
+  typedef Eigen::Matrix2d InputCost;
+
+  // z = [cte, epsi, v, delta, a] with the actuators of the stage before,
+  // u = [delta, a] of this one.
+  TerminalMatrix A = TerminalMatrix::Identity();
+  A(0, 1) = v * dt;
+  A(3, 3) = 0;
+  A(4, 4) = 0;
+  InputMatrix B = InputMatrix::Zero();
+  B(1, 0) = YawGain(v, understeer, Lf) * dt;
+  B(2, 1) = dt;
+  B(3, 0) = 1;
+  B(4, 1) = 1;
+
+  // The stage cost z'Qz + u'Ru + 2 z'Su, the changes of the actuators
+  // (u - z[3..4])^2 spread over the three.
+  TerminalMatrix Q = TerminalMatrix::Zero();
+  Q.diagonal() << weights.cte, weights.epsi, weights.v, weights.ddelta, weights.da;
+  InputCost R = InputCost::Zero();
+  R.diagonal() << weights.delta + weights.ddelta, weights.a + weights.da;
+  InputMatrix S = InputMatrix::Zero();
+  S(3, 0) = -weights.ddelta;
+  S(4, 1) = -weights.da;
+
+  // Standing still leaves cte where it is, at a cost that grows without
+  // bound; there is no terminal cost then.
+  TerminalMatrix P = Q;
+  bool converged = false;
+  for (int k = 0; k < max_iterations && !converged; k++) {
+    InputMatrix M = A.transpose() * P * B + S;
+    InputCost H = R + B.transpose() * P * B;
+    TerminalMatrix next = Q + A.transpose() * P * A - M * H.ldlt().solve(M.transpose());
+    next = (next + next.transpose()) / 2;
+    double change = (next - P).cwiseAbs().maxCoeff();
+    P = next;
+    converged = change <= tolerance * std::max(P.cwiseAbs().maxCoeff(), 1.0);
+  }
+  if (!converged || !P.allFinite()) {
+    return TerminalMatrix::Zero();
+  }
+  P(0, 0) -= weights.cte;
+  P(1, 1) -= weights.epsi;
+  P(2, 2) -= weights.v;
+  return P;
+}
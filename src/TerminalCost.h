@@ -0,0 +1,71 @@
+#ifndef TERMINAL_COST_H
+#define TERMINAL_COST_H
+
+#include <stddef.h>
+#include <utility>
+#include "Eigen-3.3/Eigen/Core"
+#include "Layout.h"
+#include "Tuning.h"
+
+// Terminal cost of the horizon: what the stages past its end would cost
+// the vehicle driving on under the LQR of the stage cost, as the quadratic
+// form e' P e of the errors of the last stage
+//
+//   e = [cte - ref_cte, epsi - ref_epsi, v - ref_v, delta, a]
+//
+// with delta and a the last actuators, those the last stage was reached
+// with, which the next change of them is charged from. It stands in for
+// the stages a shorter horizon leaves out, so that its plan ends heading
+// where a longer one would rather than wherever the last stage is
+// cheapest.
+enum : size_t { n_terminal = 5 };
+
+typedef Eigen::Matrix<double, n_terminal, n_terminal> TerminalMatrix;
+
+// Index of P(i, j) in the upper triangle at terminal_start (Layout.h).
+inline size_t TerminalEntry(size_t i, size_t j) {
+  if (i > j) {
+    std::swap(i, j);
+  }
+  return i * n_terminal - i * (i - 1) / 2 + (j - i);
+}
+
+static_assert(n_params - terminal_start == n_terminal * (n_terminal + 1) / 2,
+              "The terminal cost takes the upper triangle of P");
+
+// P of the LQR of the model linearized on a straight reference at speed
+// v, over steps of dt, with the stage cost of weights, by the Riccati
+// recursion to its fixed point. The part of the stage cost that the last
+// stage of the horizon already has, that of its cte, epsi and v, is left
+// out. The model of the errors and the last actuators is
+//
+//   cte' = cte + v dt epsi
+//   epsi' = epsi + YawGain(v, understeer, Lf) dt delta
+//   v' = v + a dt
+//   delta' = delta, a' = a of the next stage
+//
+// which the horizon's own stages follow near the reference.
+TerminalMatrix LqrTerminalCost(const Weights& weights, double v, double dt, double understeer, double Lf);
+
+// P of params, zero when there is none.
+template <class P>
+inline TerminalMatrix ParamTerminalCost(const P& params) {
+  TerminalMatrix cost;
+  for (size_t i = 0; i < n_terminal; i++) {
+    for (size_t j = 0; j < n_terminal; j++) {
+      cost(i, j) = params[terminal_start + TerminalEntry(i, j)];
+    }
+  }
+  return cost;
+}
+
+template <class P>
+inline void SetParamTerminalCost(P& params, const TerminalMatrix& cost) {
+  for (size_t i = 0; i < n_terminal; i++) {
+    for (size_t j = i; j < n_terminal; j++) {
+      params[terminal_start + TerminalEntry(i, j)] = cost(i, j);
+    }
+  }
+}
+
+#endif /* TERMINAL_COST_H */
@@ -0,0 +1,208 @@
+#include "Trace.h"
+#include <stdio.h>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+atomic<bool> trace_enabled(false);
+
+// A span, or an instantaneous event when end is 0, with its hardware
+// counts when counted is set. The fields are atomic
+// so that a scrape may read a slot while its thread overwrites it; the
+// scrape then discards it, see WriteTrace.
+struct TraceEvent {
+  atomic<const char*> name;
+  atomic<uint64_t> begin;
+  atomic<uint64_t> end;
+  atomic<bool> counted;
+  atomic<uint64_t> counts[n_perf_events];
+};
+
+// The spans of one thread. Only that thread writes them.
+struct TraceRing {
+  TraceEvent events[trace_capacity];
+  // Number of events ever recorded; the latest is at (head - 1) % capacity.
+  atomic<uint64_t> head;
+  int thread;
+
+  explicit TraceRing(int thread) : head(0), thread(thread) {}
+};
+
+// Rings live as long as the process, like the threads that record.
+static mutex rings_mutex;
+static vector<TraceRing*> rings;
+
+// Ticks and clock when tracing was first enabled, to convert ticks to
+// time at export.
+static mutex calibration_mutex;
+static bool calibrated = false;
+static uint64_t ticks_origin;
+static chrono::steady_clock::time_point clock_origin;
+
+uint64_t TraceTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return uint64_t(chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+void SetTracing(bool enabled) {
+  if (enabled) {
+    lock_guard<mutex> lock(calibration_mutex);
+    if (!calibrated) {
+      ticks_origin = TraceTicks();
+      clock_origin = chrono::steady_clock::now();
+      calibrated = true;
+    }
+  }
+  trace_enabled.store(enabled);
+}
+
+static TraceRing& ThreadRing() {
+  static thread_local TraceRing* ring = NULL;
+  if (!ring) {
+    lock_guard<mutex> lock(rings_mutex);
+    ring = new TraceRing(int(rings.size()) + 1);
+    rings.push_back(ring);
+  }
+  return *ring;
+}
+
+static void Record(const char* name, uint64_t begin, uint64_t end, const uint64_t* counts = NULL) {
+  TraceRing& ring = ThreadRing();
+  uint64_t head = ring.head.load(memory_order_relaxed);
+  TraceEvent& event = ring.events[head % trace_capacity];
+  event.name.store(name, memory_order_relaxed);
+  event.begin.store(begin, memory_order_relaxed);
+  event.end.store(end, memory_order_relaxed);
+  event.counted.store(counts != NULL, memory_order_relaxed);
+  if (counts) {
+    for (int e = 0; e < n_perf_events; e++) {
+      event.counts[e].store(counts[e], memory_order_relaxed);
+    }
+  }
+  ring.head.store(head + 1, memory_order_release);
+}
+
+void TraceComplete(const char* name, uint64_t begin, uint64_t end) {
+  if (TracingEnabled()) {
+    Record(name, begin, end > begin ? end : begin + 1);
+  }
+}
+
+void TraceComplete(const char* name, uint64_t begin, uint64_t end, const PerfReading& first,
+                   const PerfReading& last) {
+  if (!TracingEnabled()) {
+    return;
+  }
+  if (!first.ok || !last.ok) {
+    Record(name, begin, end > begin ? end : begin + 1);
+    return;
+  }
+  uint64_t counts[n_perf_events];
+  for (int e = 0; e < n_perf_events; e++) {
+    counts[e] = last.counts[e] - first.counts[e];
+  }
+  Record(name, begin, end > begin ? end : begin + 1, counts);
+}
+
+void TraceInstant(const char* name) {
+  if (TracingEnabled()) {
+    Record(name, TraceTicks(), 0);
+  }
+}
+
+void WriteTrace(string& out) {
+  out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  {
+    lock_guard<mutex> lock(calibration_mutex);
+    if (!calibrated) {
+      out += "]}\n";
+      return;
+    }
+  }
+  // Ticks per microsecond since calibration.
+  double elapsed_us = chrono::duration<double, micro>(chrono::steady_clock::now() - clock_origin).count();
+  double ticks = double(TraceTicks() - ticks_origin);
+  double per_us = elapsed_us > 0 && ticks > 0 ? ticks / elapsed_us : 1;
+
+  vector<TraceRing*> snapshot;
+  {
+    lock_guard<mutex> lock(rings_mutex);
+    snapshot = rings;
+  }
+  struct Copy {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+    bool counted;
+    uint64_t counts[n_perf_events];
+  };
+  vector<Copy> copies;
+  char line[384];
+  for (TraceRing* ring : snapshot) {
+    uint64_t head = ring->head.load(memory_order_acquire);
+    uint64_t from = head > trace_capacity ? head - trace_capacity : 0;
+    copies.clear();
+    for (uint64_t k = from; k < head; k++) {
+      const TraceEvent& event = ring->events[k % trace_capacity];
+      Copy copy = { event.name.load(memory_order_relaxed), event.begin.load(memory_order_relaxed),
+                    event.end.load(memory_order_relaxed), event.counted.load(memory_order_relaxed), { 0 } };
+      if (copy.counted) {
+        for (int e = 0; e < n_perf_events; e++) {
+          copy.counts[e] = event.counts[e].load(memory_order_relaxed);
+        }
+      }
+      copies.push_back(copy);
+    }
+    // Slots the thread reused while they were copied are torn.
+    uint64_t now = ring->head.load(memory_order_acquire);
+    uint64_t valid = now > trace_capacity ? now - trace_capacity : 0;
+    for (uint64_t k = max(from, valid); k < head; k++) {
+      const Copy& copy = copies[k - from];
+      double ts = (double(copy.begin) - double(ticks_origin)) / per_us;
+      int n;
+      if (copy.end == 0) {
+        n = snprintf(line, sizeof(line),
+                     "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                     first ? "" : ",", copy.name, ts, ring->thread);
+      } else if (copy.counted) {
+        double dur = double(copy.end - copy.begin) / per_us;
+        n = snprintf(line, sizeof(line),
+                     "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+                     "\"args\":{\"cycles\":%llu,\"instructions\":%llu,\"cache_misses\":%llu,"
+                     "\"branch_misses\":%llu}}",
+                     first ? "" : ",", copy.name, ts, dur, ring->thread, (unsigned long long)copy.counts[0],
+                     (unsigned long long)copy.counts[1], (unsigned long long)copy.counts[2],
+                     (unsigned long long)copy.counts[3]);
+      } else {
+        double dur = double(copy.end - copy.begin) / per_us;
+        n = snprintf(line, sizeof(line),
+                     "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                     first ? "" : ",", copy.name, ts, dur, ring->thread);
+      }
+      if (n > 0 && size_t(n) < sizeof(line)) {
+        out.append(line, n);
+        first = false;
+      }
+    }
+  }
+  out += "]}\n";
+}
+
+bool WriteTraceFile(const string& path) {
+  string trace;
+  WriteTrace(trace);
+  ofstream file(path.c_str(), ios::binary);
+  file.write(trace.data(), trace.size());
+  return bool(file);
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "PerfCounters.h"
+
+// Scoped trace spans of the hot path, exported in the Chrome trace event
+// format (chrome://tracing, https://ui.perfetto.dev).
+//
+// Spans are timestamped with the time-stamp counter where there is one
+// and written to a fixed-size ring of the recording thread, which keeps
+// the latest trace_capacity spans. Recording is off until SetTracing(true);
+// while off, a span costs one relaxed load.
+//
+// Span names must be string literals, or otherwise outlive the trace.
+
+// Spans kept per thread.
+const size_t trace_capacity = 8192;
+
+extern std::atomic<bool> trace_enabled;
+
+void SetTracing(bool enabled);
+
+inline bool TracingEnabled() { return trace_enabled.load(std::memory_order_relaxed); }
+
+// Raw timestamp: time-stamp counter ticks, or steady clock nanoseconds
+// where there is no counter.
+uint64_t TraceTicks();
+
+// Record a span from begin to end, as given by TraceTicks.
+void TraceComplete(const char* name, uint64_t begin, uint64_t end);
+
+// The same, with the hardware counts from first to last (PerfCounters.h)
+// as the arguments of the span when both readings are ok.
+void TraceComplete(const char* name, uint64_t begin, uint64_t end, const PerfReading& first,
+                   const PerfReading& last);
+
+// Record an instantaneous event.
+void TraceInstant(const char* name);
+
+// Write the spans of all threads to out as Chrome trace JSON.
+void WriteTrace(std::string& out);
+
+// Write the trace to path; false when it cannot be written.
+bool WriteTraceFile(const std::string& path);
+
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name) : name_(name), begin_(TracingEnabled() ? TraceTicks() : 0) {}
+
+  ~TraceSpan() {
+    if (begin_ != 0) {
+      TraceComplete(name_, begin_, TraceTicks());
+    }
+  }
+
+ private:
+  const char* name_;
+  uint64_t begin_;
+};
+
+#define MPC_TRACE_NAME2(a, b) a##b
+#define MPC_TRACE_NAME(a, b) MPC_TRACE_NAME2(a, b)
+
+// Trace the rest of the enclosing scope as a span called name.
+#define MPC_TRACE(name) TraceSpan MPC_TRACE_NAME(mpc_trace_span_, __LINE__)(name)
+
+#endif /* TRACE_H */
@@ -0,0 +1,37 @@
+#include "Track.h"
+#include <math.h>
+#include <stdio.h>
+#include <fstream>
+
+using namespace std;
+
+bool Track::Load(const string& path) {
+  x.clear();
+  y.clear();
+  ifstream in(path.c_str());
+  string line;
+  if (!getline(in, line)) {
+    return false;
+  }
+  while (getline(in, line)) {
+    double wx;
+    double wy;
+    if (sscanf(line.c_str(), "%lf,%lf", &wx, &wy) == 2) {
+      x.push_back(wx);
+      y.push_back(wy);
+    }
+  }
+  return x.size() >= 2;
+}
+
+void Track::Window(size_t i, size_t n, double* xs, double* ys) const {
+  for (size_t k = 0; k < n; k++) {
+    xs[k] = x[(i + k) % x.size()];
+    ys[k] = y[(i + k) % y.size()];
+  }
+}
+
+double Track::Heading(size_t i) const {
+  size_t j = (i + 1) % x.size();
+  return atan2(y[j] - y[i % y.size()], x[j] - x[i % x.size()]);
+}
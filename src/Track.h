@@ -0,0 +1,27 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// A closed track as a loop of waypoints in map coordinates, as in
+// lake_track_waypoints.csv.
+struct Track {
+  std::vector<double> x;
+  std::vector<double> y;
+
+  // Read an "x,y" CSV with a header line. False when the file cannot be
+  // read or has fewer than two waypoints.
+  bool Load(const std::string& path);
+
+  size_t Size() const { return x.size(); }
+
+  // The n waypoints from i on, wrapping around the end of the loop.
+  void Window(size_t i, size_t n, double* xs, double* ys) const;
+
+  // Heading of the segment from waypoint i to the next.
+  double Heading(size_t i) const;
+};
+
+#endif /* TRACK_H */
@@ -0,0 +1,85 @@
+#include "TrackCache.h"
+#include <limits.h>
+#include <stdlib.h>
+#include "Logger.h"
+
+using namespace std;
+
+TrackCache::TrackCache(size_t capacity) : capacity_(max<size_t>(capacity, 1)), loads_(0) {}
+
+TrackCache& TrackCache::Shared() {
+  static TrackCache cache;
+  return cache;
+}
+
+shared_ptr<const ReferencePath> TrackCache::Get(const string& file) {
+  char resolved[PATH_MAX];
+  string key = realpath(file.c_str(), resolved) ? string(resolved) : file;
+  return GetOrLoad("file:" + key, file, NULL);
+}
+
+shared_ptr<const ReferencePath> TrackCache::Get(const string& key, const Track& track) {
+  return GetOrLoad("track:" + key, string(), &track);
+}
+
+size_t TrackCache::Size() const {
+  lock_guard<mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t TrackCache::Loads() const {
+  lock_guard<mutex> lock(mutex_);
+  return loads_;
+}
+
+TrackCache::Entry* TrackCache::Find(const string& key) {
+  for (list<Entry>::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+    if (i->key == key) {
+      entries_.splice(entries_.begin(), entries_, i);
+      return &entries_.front();
+    }
+  }
+  return NULL;
+}
+
+shared_ptr<const ReferencePath> TrackCache::GetOrLoad(const string& key, const string& file, const Track* track) {
+  promise<shared_ptr<const ReferencePath> > loaded;
+  Future cached;
+  {
+    lock_guard<mutex> lock(mutex_);
+    Entry* entry = Find(key);
+    if (entry) {
+      cached = entry->path;
+    } else {
+      Entry added = { key, loaded.get_future().share() };
+      entries_.push_front(added);
+      if (entries_.size() > capacity_) {
+        entries_.pop_back();
+      }
+      loads_++;
+    }
+  }
+  if (cached.valid()) {
+    // Waits for the caller that loads it, if it is still loading.
+    return cached.get();
+  }
+
+  shared_ptr<ReferencePath> path = make_shared<ReferencePath>();
+  bool ok = track ? path->Build(*track) : path->Load(file);
+  if (ok) {
+    MPC_LOG(LogLevel::Info, "Track cache: loaded %s, %.0f m in %zu samples%s", key.c_str(), path->Length(),
+            path->Size(), path->Mapped() ? ", mapped" : "");
+  } else {
+    path.reset();
+    // Not kept, so that a later Get tries again.
+    lock_guard<mutex> lock(mutex_);
+    for (list<Entry>::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+      if (i->key == key) {
+        entries_.erase(i);
+        break;
+      }
+    }
+  }
+  loaded.set_value(path);
+  return path;
+}
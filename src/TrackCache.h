@@ -0,0 +1,63 @@
+#ifndef TRACK_CACHE_H
+#define TRACK_CACHE_H
+
+#include <stddef.h>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "ReferencePath.h"
+#include "Track.h"
+
+// Reference paths shared by every controller of a process: the spline,
+// arc-length samples, grid and speed profile of a track are built, or its
+// binary map mapped, once, and every vehicle on it reads the same
+// ReferencePath, which is read-only once made. A sweep or batch of many
+// vehicles on a handful of tracks so pays for each track once instead of
+// once per instance.
+//
+// The cache holds the capacity paths used last; a path evicted stays
+// alive for as long as a controller holds it, and the next Get of it
+// loads it again. Loading happens outside the lock, so a slow track holds
+// up only the callers that wait for that same track.
+class TrackCache {
+ public:
+  explicit TrackCache(size_t capacity = 8);
+
+  // The cache of the process.
+  static TrackCache& Shared();
+
+  // The path of the binary map or track CSV at file (see
+  // ReferencePath::Load), or NULL when it cannot be loaded. Files are
+  // told apart by their canonical path.
+  std::shared_ptr<const ReferencePath> Get(const std::string& file);
+
+  // The path of track, built on the first Get under key; later ones
+  // return it whatever track they pass. NULL when it cannot be built.
+  std::shared_ptr<const ReferencePath> Get(const std::string& key, const Track& track);
+
+  // Paths held and loads made, hits excluded.
+  size_t Size() const;
+  size_t Loads() const;
+
+ private:
+  typedef std::shared_future<std::shared_ptr<const ReferencePath> > Future;
+  struct Entry {
+    std::string key;
+    Future path;
+  };
+
+  size_t capacity_;
+  mutable std::mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+  size_t loads_;
+
+  // The entry of key, moved to the front, or NULL; with the lock held.
+  Entry* Find(const std::string& key);
+  std::shared_ptr<const ReferencePath> GetOrLoad(const std::string& key, const std::string& file,
+                                                 const Track* track);
+};
+
+#endif /* TRACK_CACHE_H */
@@ -0,0 +1,65 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <math.h>
+#include <stddef.h>
+#include "SimdKernels.h"
+
+// Transform the n points (xs[i], ys[i]) from map coordinates into the
+// frame of the vehicle pose (px, py, psi), writing them to (x_out, y_out).
+//
+// The rotation is computed once and applied to the whole x and y arrays by
+// the vehicle frame kernel of SimdKernels.h, vectorized for the CPU. The
+// points stay in separate x and y arrays, as they arrive in the telemetry,
+// so no 2xN interleaved copy is needed.
+inline void ToVehicleFrame(const double* xs, const double* ys, size_t n,
+                           double px, double py, double psi,
+                           double* x_out, double* y_out) {
+  double c = cos(psi);
+  double s = sin(psi);
+  // Fold the translation into an offset so each output is two multiplies
+  // and two adds per point.
+  double ox = -(px * c + py * s);
+  double oy = px * s - py * c;
+  CpuKernels().vehicle_frame(xs, ys, n, c, s, ox, oy, x_out, y_out);
+}
+
+// Resample the polyline through the n points (xs[i], ys[i]) to count
+// points spaced spacing apart along it from the first, writing them to
+// (x_out, y_out), which must not overlap the input. A polyline shorter
+// than (count - 1) * spacing is spread over its whole length instead, so
+// no point is extrapolated. Fewer than two points are copied as they are;
+// returns the number of points written.
+inline size_t ResampleWaypoints(const double* xs, const double* ys, size_t n, size_t count,
+                                double spacing, double* x_out, double* y_out) {
+  if (n < 2 || count < 2) {
+    for (size_t i = 0; i < n; i++) {
+      x_out[i] = xs[i];
+      y_out[i] = ys[i];
+    }
+    return n;
+  }
+  double length = 0;
+  for (size_t i = 0; i + 1 < n; i++) {
+    length += hypot(xs[i + 1] - xs[i], ys[i + 1] - ys[i]);
+  }
+  double step = fmin(spacing, length / double(count - 1));
+  // Walk the segments once: s is the arc length at the start of segment i.
+  size_t i = 0;
+  double s = 0;
+  double segment = hypot(xs[1] - xs[0], ys[1] - ys[0]);
+  for (size_t k = 0; k < count; k++) {
+    double target = step * double(k);
+    while (i + 2 < n && s + segment < target) {
+      s += segment;
+      i++;
+      segment = hypot(xs[i + 1] - xs[i], ys[i + 1] - ys[i]);
+    }
+    double t = segment > 0 ? fmin(fmax((target - s) / segment, 0.0), 1.0) : 0;
+    x_out[k] = xs[i] + t * (xs[i + 1] - xs[i]);
+    y_out[k] = ys[i] + t * (ys[i + 1] - ys[i]);
+  }
+  return count;
+}
+
+#endif /* TRANSFORM_H */
@@ -0,0 +1,37 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+// Cost weights shared by every formulation of the problem. The solvers
+// take them as parameters, so they can change between frames without a
+// rebuild or a new tape; see Weights.h for the process-wide set.
+struct Weights {
+  double cte;
+  double epsi;
+  double v;
+  double delta;
+  double a;
+  double ddelta;
+  double da;
+};
+
+const Weights default_weights = {
+  16,   // cte
+  12,   // epsi
+  1,    // v
+  8,    // delta, was 4
+  6,    // a, was 3
+  400,  // ddelta
+  10    // da
+};
+
+// The upper and lower limits of delta are set to -25 and 25
+// degrees (values in radians), acceleration to [-1, 1].
+const double max_delta = 0.436332;
+const double max_a = 1.0;
+
+// Bound of a variable or constraint that has none: Ipopt takes bounds at
+// or beyond its nlp_upper_bound_inf (and -nlp_lower_bound_inf), 1e19 by
+// default, as absent and keeps no barrier term for them.
+const double no_bound = 1.0e19;
+
+#endif /* TUNING_H */
@@ -0,0 +1,93 @@
+#include "WarmStartNet.h"
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+
+using namespace std;
+
+static const char net_magic[4] = { 'M', 'P', 'C', 'W' };
+static const uint32_t net_version = 1;
+
+template <class M>
+static void Write(ofstream& out, const M& m) {
+  out.write(reinterpret_cast<const char*>(m.data()), m.size() * sizeof(double));
+}
+
+template <class M>
+static void Read(ifstream& in, M& m) {
+  in.read(reinterpret_cast<char*>(m.data()), m.size() * sizeof(double));
+}
+
+WarmStartNet::WarmStartNet() : horizon_(0) {}
+
+WarmStartNet::WarmStartNet(const Layers& layers, size_t horizon) : layers_(layers), horizon_(horizon) {}
+
+WarmStartNet::Input WarmStartNet::Standardize(const StateVector& state, const Eigen::Vector4d& coeffs) const {
+  Input in;
+  in.head<6>() = state;
+  in.tail<4>() = coeffs;
+  return (in - layers_.in_mean).cwiseQuotient(layers_.in_scale);
+}
+
+void WarmStartNet::Predict(const StateVector& state, const Eigen::Vector4d& coeffs, double* actuators) const {
+  Hidden h1 = (layers_.w1 * Standardize(state, coeffs) + layers_.b1).array().tanh();
+  Hidden h2 = (layers_.w2 * h1 + layers_.b2).array().tanh();
+  Eigen::Map<Eigen::VectorXd> out(actuators, Outputs());
+  out.noalias() = layers_.w3 * h2;
+  out = (out + layers_.b3).cwiseProduct(layers_.out_scale) + layers_.out_mean;
+}
+
+bool WarmStartNet::Save(const string& path) const {
+  ofstream out(path.c_str(), ios::binary);
+  uint32_t horizon = uint32_t(horizon_);
+  out.write(net_magic, sizeof(net_magic));
+  out.write(reinterpret_cast<const char*>(&net_version), sizeof(net_version));
+  out.write(reinterpret_cast<const char*>(&horizon), sizeof(horizon));
+  Write(out, layers_.in_mean);
+  Write(out, layers_.in_scale);
+  Write(out, layers_.w1);
+  Write(out, layers_.b1);
+  Write(out, layers_.w2);
+  Write(out, layers_.b2);
+  Write(out, layers_.w3);
+  Write(out, layers_.b3);
+  Write(out, layers_.out_mean);
+  Write(out, layers_.out_scale);
+  return bool(out);
+}
+
+bool WarmStartNet::Load(const string& path) {
+  *this = WarmStartNet();
+  ifstream in(path.c_str(), ios::binary);
+  char magic[4];
+  uint32_t version;
+  uint32_t horizon;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  in.read(reinterpret_cast<char*>(&horizon), sizeof(horizon));
+  if (!in || memcmp(magic, net_magic, sizeof(magic)) != 0 || version != net_version || horizon < 2 ||
+      horizon > 1024) {
+    return false;
+  }
+  Layers layers;
+  size_t outputs = 2 * (horizon - 1);
+  layers.w3.resize(outputs, n_hidden);
+  layers.b3.resize(outputs);
+  layers.out_mean.resize(outputs);
+  layers.out_scale.resize(outputs);
+  Read(in, layers.in_mean);
+  Read(in, layers.in_scale);
+  Read(in, layers.w1);
+  Read(in, layers.b1);
+  Read(in, layers.w2);
+  Read(in, layers.b2);
+  Read(in, layers.w3);
+  Read(in, layers.b3);
+  Read(in, layers.out_mean);
+  Read(in, layers.out_scale);
+  if (!in) {
+    return false;
+  }
+  *this = WarmStartNet(layers, horizon);
+  return true;
+}
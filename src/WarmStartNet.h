@@ -0,0 +1,71 @@
+#ifndef WARM_START_NET_H
+#define WARM_START_NET_H
+
+#include <stddef.h>
+#include <string>
+#include "Eigen-3.3/Eigen/Core"
+#include "KinematicModel.h"
+
+// Initial guess of the actuators of a cold solve, from a small multilayer
+// perceptron trained offline by tools/mpc_net.cpp on cold solves.
+//
+// The input is the state [x, y, psi, v, cte, epsi] and the coefficients of
+// the reference, standardized; two hidden layers of n_hidden tanh units
+// follow, and the output is the steering and throttle of every stage,
+// [delta_0 .. delta_N-2, a_0 .. a_N-2], standardized as well. The hidden
+// layers are fixed-size, so that Predict takes a few microseconds and
+// makes no allocation. A net is built for one horizon, like the control
+// table.
+class WarmStartNet {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  enum { n_inputs = 10, n_hidden = 32 };
+
+  typedef Eigen::Matrix<double, n_inputs, 1> Input;
+  typedef Eigen::Matrix<double, n_hidden, 1> Hidden;
+
+  // The weights, biases and standardization of the net; output ones are
+  // sized 2 (N - 1) for the horizon N.
+  struct Layers {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Input in_mean;
+    Input in_scale;
+    Eigen::Matrix<double, n_hidden, n_inputs> w1;
+    Hidden b1;
+    Eigen::Matrix<double, n_hidden, n_hidden> w2;
+    Hidden b2;
+    Eigen::Matrix<double, Eigen::Dynamic, n_hidden> w3;
+    Eigen::VectorXd b3;
+    Eigen::VectorXd out_mean;
+    Eigen::VectorXd out_scale;
+  };
+
+  WarmStartNet();
+
+  // A net over the layers, for the horizon N it is trained for.
+  WarmStartNet(const Layers& layers, size_t horizon);
+
+  size_t Horizon() const { return horizon_; }
+  size_t Outputs() const { return horizon_ > 0 ? 2 * (horizon_ - 1) : 0; }
+  const Layers& GetLayers() const { return layers_; }
+
+  // The standardized input of a problem.
+  Input Standardize(const StateVector& state, const Eigen::Vector4d& coeffs) const;
+
+  // Write the Outputs() actuators predicted for the problem to actuators.
+  void Predict(const StateVector& state, const Eigen::Vector4d& coeffs, double* actuators) const;
+
+  bool Save(const std::string& path) const;
+
+  // Replace the net with the one in path. False, leaving the net empty,
+  // when the file is not a net.
+  bool Load(const std::string& path);
+
+ private:
+  Layers layers_;
+  size_t horizon_;
+};
+
+#endif /* WARM_START_NET_H */
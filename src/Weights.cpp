@@ -0,0 +1,122 @@
+#include "Weights.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+struct NamedWeight {
+  const char* name;
+  double Weights::*field;
+};
+
+static const NamedWeight named_weights[] = {
+  { "cte", &Weights::cte },
+  { "epsi", &Weights::epsi },
+  { "v", &Weights::v },
+  { "delta", &Weights::delta },
+  { "a", &Weights::a },
+  { "ddelta", &Weights::ddelta },
+  { "da", &Weights::da },
+};
+
+static mutex current_mutex;
+static Weights current = default_weights;
+static atomic<uint64_t> current_version(0);
+
+static bool Separator(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '=' || c == '&' || c == ',' || c == ';';
+}
+
+bool NextSettingToken(const string& text, size_t& i, string& token) {
+  while (i < text.size()) {
+    if (text[i] == '#') {
+      while (i < text.size() && text[i] != '\n') {
+        i++;
+      }
+    } else if (Separator(text[i])) {
+      i++;
+    } else {
+      break;
+    }
+  }
+  size_t begin = i;
+  while (i < text.size() && !Separator(text[i]) && text[i] != '#') {
+    i++;
+  }
+  token = text.substr(begin, i - begin);
+  return !token.empty();
+}
+
+bool ParseWeights(const string& text, Weights& weights, string& error) {
+  Weights parsed = weights;
+  size_t i = 0;
+  string name;
+  string value;
+  while (NextSettingToken(text, i, name)) {
+    const NamedWeight* named = NULL;
+    for (const NamedWeight& w : named_weights) {
+      if (name == w.name) {
+        named = &w;
+      }
+    }
+    if (!named) {
+      error = "unknown weight " + name;
+      return false;
+    }
+    if (!NextSettingToken(text, i, value)) {
+      error = "no value for " + name;
+      return false;
+    }
+    char* end;
+    double w = strtod(value.c_str(), &end);
+    if (*end != '\0' || !isfinite(w) || w < 0) {
+      error = "bad value " + value + " for " + name;
+      return false;
+    }
+    parsed.*named->field = w;
+  }
+  weights = parsed;
+  return true;
+}
+
+bool LoadWeights(const string& path, Weights& weights, string& error) {
+  ifstream in(path.c_str());
+  if (!in) {
+    error = "cannot read " + path;
+    return false;
+  }
+  stringstream text;
+  text << in.rdbuf();
+  return ParseWeights(text.str(), weights, error);
+}
+
+string FormatWeights(const Weights& weights) {
+  string out;
+  char line[64];
+  for (const NamedWeight& w : named_weights) {
+    snprintf(line, sizeof(line), "%s %.17g\n", w.name, weights.*w.field);
+    out += line;
+  }
+  return out;
+}
+
+void SetCurrentWeights(const Weights& weights) {
+  lock_guard<mutex> lock(current_mutex);
+  current = weights;
+  current_version.fetch_add(1, memory_order_release);
+}
+
+uint64_t CurrentWeights(Weights& weights) {
+  lock_guard<mutex> lock(current_mutex);
+  weights = current;
+  return current_version.load(memory_order_relaxed);
+}
+
+uint64_t WeightsVersion() {
+  return current_version.load(memory_order_acquire);
+}
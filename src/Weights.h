@@ -0,0 +1,41 @@
+#ifndef WEIGHTS_H
+#define WEIGHTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "Tuning.h"
+
+// Cost weights as text, and the set the Controllers of a process follow.
+//
+// The text lists name and value pairs, with the names of the Weights
+// fields: "cte 20 ddelta 300", "cte=20&ddelta=300" or one pair per line.
+// Whitespace, '=', '&', ',' and ';' separate; '#' comments out the rest
+// of a line. Weights the text does not name keep their value.
+
+// Parse text into weights. A bad name or value, or a negative or
+// infinite weight, leaves weights unchanged and returns false with the
+// reason in error.
+bool ParseWeights(const std::string& text, Weights& weights, std::string& error);
+
+// The next name or value of such text from i on, skipping separators
+// and comments; false at its end. For other settings in the same format.
+bool NextSettingToken(const std::string& text, size_t& i, std::string& token);
+
+// Parse the file at path.
+bool LoadWeights(const std::string& path, Weights& weights, std::string& error);
+
+// One "name value" line per weight, as ParseWeights reads it back.
+std::string FormatWeights(const Weights& weights);
+
+// Replace the process-wide weights, default_weights until set.
+void SetCurrentWeights(const Weights& weights);
+
+// Copy the process-wide weights to weights; returns their version, which
+// every SetCurrentWeights increments from 0.
+uint64_t CurrentWeights(Weights& weights);
+
+// Version of the process-wide weights, for a cheap check on every frame.
+uint64_t WeightsVersion();
+
+#endif /* WEIGHTS_H */
@@ -0,0 +1,220 @@
+#ifndef WINDOW_POLYFIT_H
+#define WINDOW_POLYFIT_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Horner.h"
+#include "Polyfit.h"
+
+// Sliding-window least-squares fit of the reference polynomial.
+//
+// Consecutive frames share most of their waypoints, so the fit is kept as
+// normal equations in a fixed anchor frame: waypoints that enter the
+// window are added as rank-1 updates, those that leave it are removed as
+// rank-1 downdates, and the shared ones cost nothing. The result is then
+// re-expressed in the vehicle frame by refitting a fixed number of samples
+// of the anchor-frame polynomial, so the cost of a frame depends on the
+// number of changed waypoints, not on the window size.
+//
+// A polynomial y(x) does not stay one under rotation, so the anchor is
+// moved to the current pose (and the window refitted from scratch) once
+// the heading has turned too far from it, when a waypoint falls outside
+// the scaled range, when the window does not overlap the previous one,
+// or periodically to shed the round-off of the downdates.
+//
+// Waypoints that come numbered (see Telemetry::first_waypoint) are matched
+// to the window by their numbers: only the ends of the part the windows
+// share are compared, in case the numbers restarted.
+template <int K, size_t Capacity>
+class WindowPolyfit {
+ public:
+  typedef Eigen::Matrix<double, K + 1, 1> Vector;
+  typedef Eigen::Matrix<double, K + 1, K + 1> Matrix;
+
+  // first of waypoints that carry no numbers.
+  static const uint64_t unnumbered = ~uint64_t(0);
+
+  WindowPolyfit() : first_(unnumbered), n_(0), updates_(0), refits_(0), changed_(0) {}
+
+  // Update the window with this frame's waypoints in map coordinates
+  // (nearest first), the first of them numbered first if they are
+  // numbered, and return the fit in the frame of the vehicle pose
+  // (px, py, psi).
+  Vector Update(const double* ptsx, const double* ptsy, size_t n,
+                double px, double py, double psi, uint64_t first = unnumbered) {
+    n = n < Capacity ? n : Capacity;
+    if (!Slide(ptsx, ptsy, n, psi, first)) {
+      Anchor(ptsx, ptsy, n, px, py, psi);
+    }
+    first_ = first;
+    return ToVehicle(px, py, psi);
+  }
+
+  // Number of full refits, and of waypoints added or removed
+  // incrementally, since construction.
+  size_t Refits() const { return refits_; }
+  size_t Changed() const { return changed_; }
+
+ private:
+  // Refit from scratch after this many incremental updates.
+  static const size_t max_updates = 200;
+  // Heading change from the anchor after which to re-anchor.
+  static constexpr double max_turn = 0.5;
+  // Samples of the anchor-frame fit refitted in the vehicle frame.
+  static const int n_samples = 2 * (K + 1);
+
+  double ax_, ay_, acos_, asin_, apsi_;
+  double scale_;
+  Matrix AtA_;
+  Vector Atb_;
+  // Current window in map coordinates, and the number of its first
+  // waypoint.
+  double wx_[Capacity];
+  double wy_[Capacity];
+  uint64_t first_;
+  size_t n_;
+  size_t updates_;
+  size_t refits_;
+  size_t changed_;
+
+  Vector Basis(double x, double y, double* t) const {
+    double xa = (x - ax_) * acos_ + (y - ay_) * asin_;
+    Vector phi;
+    phi[0] = 1;
+    *t = xa / scale_;
+    for (int k = 1; k <= K; k++) {
+      phi[k] = phi[k - 1] * *t;
+    }
+    return phi;
+  }
+
+  // Add (sign 1) or remove (sign -1) a waypoint. Returns false if it is
+  // outside the scaled range of the anchor frame.
+  bool Accumulate(double x, double y, double sign) {
+    double t;
+    Vector phi = Basis(x, y, &t);
+    if (fabs(t) > 1) {
+      return false;
+    }
+    double ya = -(x - ax_) * asin_ + (y - ay_) * acos_;
+    AtA_.template selfadjointView<Eigen::Lower>().rankUpdate(phi, sign);
+    Atb_ += sign * ya * phi;
+    return true;
+  }
+
+  // Incremental update. The new window is expected to be the old one with
+  // some waypoints dropped from the front and new ones appended.
+  bool Slide(const double* ptsx, const double* ptsy, size_t n, double psi, uint64_t first) {
+    if (n_ == 0 || n == 0 || updates_ >= max_updates ||
+        fabs(remainder(psi - apsi_, 2 * M_PI)) > max_turn) {
+      return false;
+    }
+    size_t dropped = 0;
+    size_t kept = 0;
+    if (first != unnumbered && first_ != unnumbered) {
+      if (first < first_ || first - first_ >= n_) {
+        return false;
+      }
+      dropped = size_t(first - first_);
+      kept = n_ - dropped;
+      if (kept > n || wx_[dropped] != ptsx[0] || wy_[dropped] != ptsy[0] ||
+          wx_[n_ - 1] != ptsx[kept - 1] || wy_[n_ - 1] != ptsy[kept - 1]) {
+        return false;
+      }
+    } else {
+      while (dropped < n_ && !(wx_[dropped] == ptsx[0] && wy_[dropped] == ptsy[0])) {
+        dropped++;
+      }
+      kept = n_ - dropped;
+      if (kept == 0 || kept > n) {
+        return false;
+      }
+      for (size_t i = 1; i < kept; i++) {
+        if (wx_[dropped + i] != ptsx[i] || wy_[dropped + i] != ptsy[i]) {
+          return false;
+        }
+      }
+    }
+    // Check the range before touching the normal equations.
+    for (size_t i = kept; i < n; i++) {
+      double t;
+      Basis(ptsx[i], ptsy[i], &t);
+      if (fabs(t) > 1) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < dropped; i++) {
+      Accumulate(wx_[i], wy_[i], -1);
+    }
+    for (size_t i = kept; i < n; i++) {
+      Accumulate(ptsx[i], ptsy[i], 1);
+    }
+    for (size_t i = 0; i < n; i++) {
+      wx_[i] = ptsx[i];
+      wy_[i] = ptsy[i];
+    }
+    changed_ += dropped + n - kept;
+    n_ = n;
+    updates_++;
+    return true;
+  }
+
+  void Anchor(const double* ptsx, const double* ptsy, size_t n,
+              double px, double py, double psi) {
+    ax_ = px;
+    ay_ = py;
+    apsi_ = psi;
+    acos_ = cos(psi);
+    asin_ = sin(psi);
+    // Leave room for the window to slide ahead of the anchor.
+    double reach = 0;
+    for (size_t i = 0; i < n; i++) {
+      double xa = (ptsx[i] - ax_) * acos_ + (ptsy[i] - ay_) * asin_;
+      reach = fmax(reach, fabs(xa));
+    }
+    scale_ = reach > 0 ? 2 * reach : 1;
+
+    AtA_.setZero();
+    Atb_.setZero();
+    for (size_t i = 0; i < n; i++) {
+      Accumulate(ptsx[i], ptsy[i], 1);
+      wx_[i] = ptsx[i];
+      wy_[i] = ptsy[i];
+    }
+    n_ = n;
+    updates_ = 0;
+    refits_++;
+  }
+
+  Vector ToVehicle(double px, double py, double psi) const {
+    // Anchor-frame fit in the scaled abscissa.
+    Vector c = AtA_.template selfadjointView<Eigen::Lower>().ldlt().solve(Atb_);
+
+    // Sample it over the window and express the samples in the vehicle
+    // frame, relative to the anchor.
+    double lo = 1, hi = -1;
+    for (size_t i = 0; i < n_; i++) {
+      double t;
+      Basis(wx_[i], wy_[i], &t);
+      lo = fmin(lo, t);
+      hi = fmax(hi, t);
+    }
+    double dpsi = psi - apsi_;
+    double c_d = cos(dpsi);
+    double s_d = sin(dpsi);
+    double dx = (px - ax_) * acos_ + (py - ay_) * asin_;
+    double dy = -(px - ax_) * asin_ + (py - ay_) * acos_;
+    typedef Eigen::Array<double, n_samples, 1> Samples;
+    Samples t = Samples::LinSpaced(n_samples, lo, hi);
+    Samples ya = Polyval<K>(c, t) - dy;
+    Samples xa = t * scale_ - dx;
+    Samples xs = xa * c_d + ya * s_d;
+    Samples ys = -xa * s_d + ya * c_d;
+    return Polyfit<K>(xs.data(), ys.data(), n_samples);
+  }
+};
+
+#endif /* WINDOW_POLYFIT_H */
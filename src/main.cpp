@@ -1,17 +1,40 @@
 #include <math.h>
 #include <uWS/uWS.h>
 #include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <iostream>
+#include <memory>
 #include <thread>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
-#include "Eigen-3.3/Eigen/QR"
-#include "MPC.h"
-#include "json.hpp"
-
-// for convenience
-using json = nlohmann::json;
+#include "Affinity.h"
+#include "BinaryProtocol.h"
+#include "Calibration.h"
+#include "ControlTable.h"
+#include "Controller.h"
+#include "DelayedSender.h"
+#include "FG_Tape.h"
+#include "FlightRecorder.h"
+#include "Footprint.h"
+#include "Logger.h"
+#include "MPCBatch.h"
+#include "Metrics.h"
+#include "ModelCalibration.h"
+#include "MoveBlocks.h"
+#include "ObstacleMap.h"
+#include "PlanLibrary.h"
+#include "RunLog.h"
+#include "Scheduler.h"
+#include "Shadow.h"
+#include "SharedChannel.h"
+#include "SteerWriter.h"
+#include "TelemetryLog.h"
+#include "Tenants.h"
+#include "Trace.h"
+#include "TrackCache.h"
+#include "Weights.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -20,190 +43,465 @@ using namespace std::chrono;
 constexpr double pi() { return M_PI; }
 double deg2rad(double x) { return x * pi() / 180; }
 double rad2deg(double x) { return x * 180 / pi(); }
-double clip(double v, double low, double high) { return max(low, min(v, high)); }
-
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.rfind("}]");
-  if (found_null != string::npos) {
-    return "";
-  } else if (b1 != string::npos && b2 != string::npos) {
-    return s.substr(b1, b2 - b1 + 2);
-  }
-  return "";
-}
 
-// Evaluate a polynomial.
-double polyeval(Eigen::VectorXd coeffs, double x) {
-  double result = 0.0;
-  for (int i = 0; i < coeffs.size(); i++) {
-    result += coeffs[i] * pow(x, i);
+// File of the cost weights given with --weights, reread on /weights/reload.
+static string weights_path;
+
+// The /weights endpoints: GET /weights lists the current weights,
+// /weights?cte=20&ddelta=300 changes those named and /weights/reload
+// rereads the --weights file over the defaults. Every controller picks a
+// change up with its next frame. Answers with the weights now in effect,
+// or the reason they were not changed.
+static string WeightsRequest(const string& path) {
+  Weights weights;
+  CurrentWeights(weights);
+  string error;
+  bool ok = true;
+  if (path == "/weights/reload") {
+    if (weights_path.empty()) {
+      return "error: no --weights file\n";
+    }
+    weights = default_weights;
+    ok = LoadWeights(weights_path, weights, error);
+  } else if (path.size() > 9 && path[8] == '?') {
+    ok = ParseWeights(path.substr(9), weights, error);
+  }
+  if (!ok) {
+    return "error: " + error + "\n";
   }
-  return result;
+  if (path != "/weights") {
+    SetCurrentWeights(weights);
+    MPC_LOG(LogLevel::Info, "Cost weights changed by %s", path.c_str());
+  }
+  return FormatWeights(weights);
 }
 
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
-                        int order) {
-  assert(xvals.size() == yvals.size());
-  assert(order >= 1 && order <= xvals.size() - 1);
-  Eigen::MatrixXd A(xvals.size(), order + 1);
+// What the websocket link costs besides the frames themselves. The
+// simulator talks over loopback, where permessage-deflate and TLS only
+// spend the event loop's time on frames of a few hundred bytes, so the
+// local profile, the default, offers neither. The remote profile, for a
+// gateway across a real network, offers compression and serves TLS when
+// given a certificate and key.
+struct TransportProfile {
+  bool compression;
+  std::string tls_cert;
+  std::string tls_key;
 
-  for (int i = 0; i < xvals.size(); i++) {
-    A(i, 0) = 1.0;
-  }
+  TransportProfile() : compression(false) {}
+
+  bool Tls() const { return !tls_cert.empty() && !tls_key.empty(); }
+};
+
+// How the threads of a server run, for dedicated control boxes. With
+// busy_poll the event loop polls its sockets, or the shared memory server
+// its ring, without ever sleeping in the kernel, which takes a whole core
+// and is meant for one isolated from the scheduler (isolcpus) with --pin.
+// A realtime priority above 0 runs the solver threads under SCHED_FIFO at
+// it and locks the process in memory (see Affinity.h).
+//
+// With a warm-up track, every controller solves warmup_solves frames along
+// it before the server listens (see Controller::WarmUp).
+//
+// With a snapshot path, a server restores the controllers of the snapshot
+// there, if any, after the warm-up, and /snapshot writes a new one (see
+// MPCBatch::SaveSnapshot); with snapshot_weights the snapshot's cost
+// weights are restored too.
+//
+// A released controller is held for session_grace_ms for the session its
+// vehicle named, if any, so that a reconnection naming the same one takes
+// it back warm (see MPCBatch::Acquire).
+//
+// With a control rate, a timer on the event loop has every controller
+// solve again at that rate between frames, from its last frame predicted
+// to the tick (see MPCBatch::Tick), so that the commands come faster than
+// the telemetry. Every solve then has to fit in one period.
+//
+// With a follow rate, a timer on the event loop sends every vehicle the
+// actuators its last delivered plan has for the time, at that rate
+// between the solves' commands (see MPCBatch::FollowUp), so that the
+// commands stay current however long a solve takes.
+//
+// With a keep-warm gap, a timer on the event loop has the worker of every
+// vehicle whose telemetry paused for that long keep its controller warm,
+// once a gap, while the worker is idle (see MPCBatch::KeepWarm). The
+// first solve after such a pause, by default of a second, is measured
+// either way.
+struct RuntimeProfile {
+  bool busy_poll;
+  int realtime_priority;
+  std::shared_ptr<const Track> warmup_track;
+  size_t warmup_solves;
+  std::string snapshot_path;
+  bool snapshot_weights;
+  int control_rate_hz;
+  int follow_rate_hz;
+  int keep_warm_ms;
+  int session_grace_ms;
+  // The columnar log of the solved frames, shared by the hubs.
+  std::shared_ptr<RunLogWriter> run_log;
+  // The flight recorder of the solved frames, also shared.
+  std::shared_ptr<FlightRecorder> flight_recorder;
+  // Options of the shadow controllers of every hub, if any, the name of
+  // their configuration and the run log of their observations, shared
+  // (see Shadow.h).
+  std::shared_ptr<const ControllerOptions> shadow;
+  std::string shadow_name;
+  std::shared_ptr<RunLogWriter> shadow_log;
+
+  RuntimeProfile()
+      : busy_poll(false),
+        realtime_priority(0),
+        warmup_solves(0),
+        snapshot_weights(false),
+        control_rate_hz(0),
+        follow_rate_hz(0),
+        keep_warm_ms(0),
+        session_grace_ms(5000) {}
+};
 
-  for (int j = 0; j < xvals.size(); j++) {
-    for (int i = 0; i < order; i++) {
-      A(j, i + 1) = A(j, i) * xvals(j);
+// The value of name in the query string of a URL, "name=value&...", or
+// empty.
+static string QueryValue(const string& query, const string& name) {
+  size_t begin = 0;
+  while (begin < query.size()) {
+    size_t end = min(query.find('&', begin), query.size());
+    if (query.compare(begin, name.size() + 1, name + "=") == 0) {
+      return query.substr(begin + name.size() + 1, end - begin - name.size() - 1);
     }
+    begin = end + 1;
   }
+  return string();
+}
+
+// Frames an observer may stay behind for before it is disconnected.
+const size_t max_observer_skips = 100;
+
+// Most problems of an offline query frame (see MPCBatch::Submit).
+const size_t max_query_problems = 1 << 16;
+
+// How long after its last frame a vehicle is still ticked; a longer gap
+// is a paused simulator, whose pose the prediction would run away from.
+const auto max_tick_age = seconds(1);
+
+static void OnControlTick(uS::Timer* timer) {
+  static_cast<MPCBatch*>(timer->getData())->Tick(PipelineClock::now(), max_tick_age);
+}
 
-  auto Q = A.householderQr();
-  auto result = Q.solve(yvals);
-  return result;
+static void OnKeepWarmTick(uS::Timer* timer) {
+  static_cast<MPCBatch*>(timer->getData())->KeepWarm(PipelineClock::now());
 }
 
-int main() {
-  uWS::Hub h;
-
-  // MPC is initialized here!
-  MPC mpc;
-  // Initialise with zero for cross-track error and psi error
-  // and target acceleration of 40
-  mpc.Init(0, 0, 40);
-
-  auto timestamp = system_clock::now();
-
-  h.onMessage([&mpc, &timestamp](uWS::WebSocket<uWS::SERVER> *ws, char *data, size_t length,
-                     uWS::OpCode opCode) {
-    // "42" at the start of the message means there's a websocket message event.
-    // The 4 signifies a websocket message
-    // The 2 signifies a websocket event
-    string sdata = string(data).substr(0, length);
-    cout << sdata << endl;
-    if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
-      string s = hasData(sdata);
-      if (s != "") {
-        auto j = json::parse(s);
-        string event = j[0].get<string>();
-        if (event == "telemetry") {
-          // j[1] is the data JSON object
-          vector<double> ptsx = j[1]["ptsx"];
-          vector<double> ptsy = j[1]["ptsy"];
-          double px = j[1]["x"];
-          double py = j[1]["y"];
-          double psi = j[1]["psi"];
-          double v = j[1]["speed"];
-
-          double delta = j[1]["steering_angle"];
-          double alpha = j[1]["throttle"];
-          
-          //Display the waypoints/reference line
-          vector<double> next_x_vals;
-          vector<double> next_y_vals;
-
-          //Display the MPC predicted trajectory 
-          vector<double> mpc_x_vals;
-          vector<double> mpc_y_vals;
-
-          Eigen::VectorXd xvals(ptsx.size());
-          Eigen::VectorXd yvals(ptsy.size());
-          // coordinate translation
-          for (int i = 0; i < ptsx.size(); i++) {
-            double x_offset = (ptsx[i] - px);
-            double y_offset = (ptsy[i] - py);
-            double x_v = x_offset * cos(psi) + y_offset * sin(psi);
-            double y_v = -x_offset * sin(psi) + y_offset * cos(psi);
-            
-            xvals(i) = x_v;
-            yvals(i) = y_v;
-            next_x_vals.push_back(x_v);
-            next_y_vals.push_back(y_v);
+// The follow-ups of a hub: its batch, the sender of its commands and the
+// period of the timer.
+struct FollowUps {
+  MPCBatch* batch;
+  DelayedSender* sender;
+  PipelineClock::duration period;
+};
+
+static void OnFollowTick(uS::Timer* timer) {
+  FollowUps* follow = static_cast<FollowUps*>(timer->getData());
+  DelayedSender* sender = follow->sender;
+  // A command delivered within the period is still fresh.
+  follow->batch->FollowUp(PipelineClock::now(), follow->period, max_tick_age,
+                          [sender](uWS::WebSocket<uWS::SERVER>* ws, const string& msg, Framing framing) {
+                            sender->Send(ws, msg, framing == Framing::Text ? uWS::OpCode::TEXT
+                                                                           : uWS::OpCode::BINARY);
+                          });
+}
+
+// One server: a hub and its event loop on the calling thread, with capacity
+// controllers solved by workers threads, listening to port with the uS
+// listen_options over the transport profile. With first_cpu >= 0 the calling thread is pinned to
+// first_cpu and the workers to the CPUs after it. A recorder, when given,
+// logs every connection and message. Returns false when the port cannot
+// be listened to.
+static bool Serve(const ControllerOptions& options, const TransportProfile& transport,
+                  const RuntimeProfile& runtime, size_t capacity, size_t workers, int port,
+                  int listen_options, int first_cpu, TelemetryRecorder* recorder) {
+  uWS::Hub h(transport.compression ? uWS::PERMESSAGE_DEFLATE : 0);
+  if (first_cpu >= 0 && !PinCurrentThread(first_cpu)) {
+    MPC_LOG(LogLevel::Warning, "Could not pin the event loop to CPU %d", first_cpu);
+  }
+  DelayedSender sender(h.getLoop(), options.latency_ms);
+
+  // Connections to /observe: dashboards and loggers, which get no
+  // controller and send nothing, but receive the observation of every
+  // frame solved by this hub (WriteObservation). It is written once and
+  // sent to all of them as one prepared message, whose frame uWS builds
+  // once and shares between the sockets.
+  //
+  // Observations are worth nothing once a newer one exists, so an
+  // observer whose socket still has a queue is skipped: it holds at most
+  // the message it is behind on, and catches up with the newest frame.
+  // One that stays behind for max_observer_skips frames in a row is
+  // disconnected. The commands are always sent.
+  //
+  // An observer may ask for an encoding of the plan of its own, as a
+  // simulator may for its replies (see ParseVizQuery); the observation is
+  // then written again for every run of observers of another encoding.
+  struct Observer {
+    uWS::WebSocket<uWS::SERVER>* ws;
+    size_t skipped;
+    VizEncoding viz;
+  };
+  vector<Observer> observers;
+  string observed;
+
+  // Connections to /solve: tools that send problems frames of offline
+  // queries and get their solutions back as the batch workers solve them
+  // (see BinaryProtocol.h), and have no controller either.
+  vector<uWS::WebSocket<uWS::SERVER>*> query_clients;
+
+  // Event loop: release the command after the latency. The loop keeps
+  // reading telemetry in the meantime. The batch only hands over commands
+  // of connections that are still open.
+  auto deliver = [&sender](Controller& controller, Command& command) {
+    auto now = PipelineClock::now();
+    controller.Delivered(command, now);
+    RecordStage(Stage::EndToEnd, now - command.received);
+    MPC_LOG_EVERY_N(LogLevel::Info, 10, "Latency: solve %.2f ms, handover %.2f ms, estimate %.2f ms, dropped %zu/%zu frames",
+                    duration<double, milli>(command.solved - command.received).count(),
+                    duration<double, milli>(now - command.solved).count(),
+                    controller.Latency() * 1000, command.dropped, command.posted);
+    uWS::OpCode opcode = command.framing == Framing::Text ? uWS::OpCode::TEXT : uWS::OpCode::BINARY;
+    sender.Send(command.ws, command.msg, opcode);
+  };
+
+  // The observations go out after every command of the same drain (see
+  // Scheduler.h).
+  auto observe = [&observers, &observed, &runtime](Controller&, Command& command) {
+    if (runtime.run_log) {
+      runtime.run_log->Append(command.observation, command.received);
+    }
+    if (runtime.flight_recorder) {
+      runtime.flight_recorder->Record(command.observation, command.arrived, command.solved);
+    }
+    if (!observers.empty()) {
+      MPC_TRACE("observe");
+      PreparedMessage* prepared = NULL;
+      VizEncoding written;
+      uWS::WebSocket<uWS::SERVER>* stalled = NULL;
+      for (auto& observer : observers) {
+        if (!observer.ws->hasEmptyQueue()) {
+          CountEvent(Counter::ObserverDrops);
+          if (++observer.skipped >= max_observer_skips) {
+            stalled = observer.ws;
+          }
+          continue;
+        }
+        observer.skipped = 0;
+        if (!prepared || observer.viz.tolerance != written.tolerance ||
+            observer.viz.resolution != written.resolution) {
+          if (prepared) {
+            uWS::WebSocket<uWS::SERVER>::finalizeMessage(prepared);
           }
+          written = observer.viz;
+          WriteObservation(observed, command.observation, written);
+          prepared = PrepareCounted(&observed[0], observed.length(), uWS::OpCode::TEXT);
+        }
+        SendPreparedCounted(observer.ws, prepared, observed.length());
+      }
+      if (prepared) {
+        uWS::WebSocket<uWS::SERVER>::finalizeMessage(prepared);
+      }
+      // Closing may remove the observer, so it comes after the loop; any
+      // other stalled one goes with a later frame.
+      if (stalled) {
+        MPC_LOG(LogLevel::Warning, "Observer %zu frames behind, disconnecting", max_observer_skips);
+        stalled->close();
+      }
+    }
+  };
+
+  // Every connection gets a controller from the batch, set as the
+  // socket's user data. The shadow's thread needs CppAD in parallel mode
+  // too, sized here for it along with the batch's.
+  if (runtime.shadow) {
+    MPCParallelSetup(workers + 2 + ControllerThreads(options) * capacity);
+  }
+  MPCBatch batch(h.getLoop(), capacity, workers, options, deliver, first_cpu >= 0 ? first_cpu + 1 : -1);
+  batch.SetObserver(observe);
+  batch.SetQuerySink([](uWS::WebSocket<uWS::SERVER>* ws, const string& msg) {
+    SendCounted(ws, msg.data(), msg.length(), uWS::OpCode::BINARY);
+  });
+  unique_ptr<ShadowRunner> shadow;
+  if (runtime.shadow) {
+    shadow.reset(new ShadowRunner(*runtime.shadow, batch.Capacity(), runtime.shadow_name, runtime.shadow_log));
+    batch.SetShadow(shadow.get());
+  }
+  MPC_LOG(LogLevel::Info, "Serving up to %zu simulators on %zu workers", batch.Capacity(), batch.Workers());
+  if (runtime.realtime_priority > 0) {
+    batch.SetRealtime(runtime.realtime_priority);
+  }
+  batch.SetSessionGrace(milliseconds(runtime.session_grace_ms));
+  if (runtime.warmup_track) {
+    batch.WarmUp(*runtime.warmup_track, runtime.warmup_solves);
+  }
+  if (!runtime.snapshot_path.empty() && !batch.LoadSnapshot(runtime.snapshot_path, runtime.snapshot_weights)) {
+    MPC_LOG(LogLevel::Info, "No snapshot to restore at %s", runtime.snapshot_path.c_str());
+  }
+  uS::Timer* control_timer = NULL;
+  if (runtime.control_rate_hz > 0) {
+    int period_ms = max(1000 / runtime.control_rate_hz, 1);
+    control_timer = new uS::Timer(h.getLoop());
+    control_timer->setData(&batch);
+    control_timer->start(OnControlTick, period_ms, period_ms);
+    MPC_LOG(LogLevel::Info, "Controlling at %d Hz, every %d ms", runtime.control_rate_hz, period_ms);
+  }
+  uS::Timer* keep_warm_timer = NULL;
+  if (runtime.keep_warm_ms > 0) {
+    // Twice a gap, so that an idle controller is kept warm within a gap of
+    // the last time.
+    int period_ms = max(runtime.keep_warm_ms / 2, 1);
+    batch.SetIdleGap(milliseconds(runtime.keep_warm_ms));
+    keep_warm_timer = new uS::Timer(h.getLoop());
+    keep_warm_timer->setData(&batch);
+    keep_warm_timer->start(OnKeepWarmTick, period_ms, period_ms);
+    MPC_LOG(LogLevel::Info, "Keeping idle controllers warm after %d ms", runtime.keep_warm_ms);
+  }
+  uS::Timer* follow_timer = NULL;
+  FollowUps follow_ups;
+  if (runtime.follow_rate_hz > 0) {
+    int period_ms = max(1000 / runtime.follow_rate_hz, 1);
+    follow_ups.batch = &batch;
+    follow_ups.sender = &sender;
+    follow_ups.period = milliseconds(period_ms);
+    follow_timer = new uS::Timer(h.getLoop());
+    follow_timer->setData(&follow_ups);
+    follow_timer->start(OnFollowTick, period_ms, period_ms);
+    MPC_LOG(LogLevel::Info, "Following the plans at %d Hz, every %d ms", runtime.follow_rate_hz, period_ms);
+  }
 
-          Eigen::VectorXd state(4);
-          state << px, py, psi, v;
-
-          Eigen::VectorXd actuators(2);
-          actuators << delta, alpha;
-
-          const double deltat = 0.05;
-          
-          std::cout << "Predicting state... [dt = " << deltat << "]" << std::endl;
-          // offset state with process time
-          state = mpc.Predict(state, actuators, deltat);
-          // DEBUG
-          std::cout << "State: { x = " << px << ", y = " << py << ", psi = " << psi << ", v = " << v << " }" << std::endl;
-          px = state(0); py = state(1); psi = state(2); v = state(3);
-          // DEBUG
-          std::cout << "State*: { x = " << px << ", y = " << py << ", psi = " << psi << ", v = " << v << " }" << std::endl;
-          
-          auto coeffs = polyfit(xvals, yvals, 3);
-
-          // compute cross-track error (difference in y from center).
-          double cte = polyeval(coeffs, 0) - py;
-          // compute orientation error
-          double epsi = -atan(coeffs[1]);
-
-          Eigen::VectorXd state_p(6);
-          state_p << 0, 0, 0, v, cte, epsi;
-          std::cout << "Solving..." << std::endl;
-          vector<double> controls = mpc.Solve(state_p, coeffs);
-          // tractability gaurantee
-          double steer_value = clip(controls[0], -1, 1);
-          double throttle_value = clip(controls[1], -1, 1);
-
-          json msgJson;
-          msgJson["steering_angle"] = -steer_value;
-          msgJson["throttle"] = throttle_value;
-
-          std::cout << "[ steering = " << -steer_value << ", throttle = " << throttle_value << " ]" << std::endl;
-
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Green line
-
-          msgJson["mpc_x"] = mpc_x_vals;
-          msgJson["mpc_y"] = mpc_y_vals;
-
-          msgJson["next_x"] = next_x_vals;
-          msgJson["next_y"] = next_y_vals;
-          
-          auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-          //std::cout << msg << std::endl;
-          // Latency
-          // The purpose is to mimic real driving conditions where
-          // the car does actuate the commands instantly.
-          //
-          // Feel free to play around with this value but should be to drive
-          // around the track with 100ms latency.
-          //
-          // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-          // SUBMITTING.
-          this_thread::sleep_for(chrono::milliseconds(100));
-          (*ws).send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+  Telemetry frame;
+  vector<OfflineProblem> problems;
+
+  h.onMessage([&batch, &frame, &problems, &query_clients, &options, recorder](uWS::WebSocket<uWS::SERVER> *ws,
+                                                                            char *data, size_t length,
+                                                                            uWS::OpCode opCode) {
+    // The earliest this process sees of the frame (see Telemetry::arrived).
+    PipelineClock::time_point received = PipelineClock::now();
+    MPC_TRACE("telemetry");
+    MPCBatch::Instance* instance = static_cast<MPCBatch::Instance*>((*ws).getUserData());
+    if (!instance) {
+      bool client = find(query_clients.begin(), query_clients.end(), ws) != query_clients.end();
+      if (client && opCode == uWS::OpCode::BINARY) {
+        CountEvent(Counter::BytesReceived, length);
+        Framing framing = Framing::Binary64;
+        uint64_t id = 0;
+        size_t horizon = 0;
+        bool taken = DecodeBinaryProblems(data, length, framing, id, horizon, problems, max_query_problems);
+        horizon = horizon == 0 ? options.horizon : horizon;
+        if (taken && !problems.empty() && HorizonIndex(horizon) != n_horizons) {
+          batch.Submit(ws, id, horizon, framing, problems);
+        } else {
+          MPC_LOG(LogLevel::Warning, "Refusing a query frame of %zu bytes", length);
+          CountEvent(Counter::OfflineRejections);
+          string msg;
+          WriteBinarySolutions(msg, framing, id, 0, NULL, NULL, 0);
+          SendCounted(ws, msg.data(), msg.length(), uWS::OpCode::BINARY);
         }
-      } else {
+      }
+      return;
+    }
+    if (recorder) {
+      recorder->Message(ws, opCode == uWS::OpCode::BINARY, data, length);
+    }
+    CountEvent(Counter::BytesReceived, length);
+    if (opCode == uWS::OpCode::BINARY) {
+      Framing framing;
+      BinaryMessage kind = DecodeBinary(data, length, framing, frame, &batch.Waypoints(instance));
+      switch (kind) {
+        case BinaryMessage::Hello:
+        case BinaryMessage::Resend: {
+          string msg;
+          WriteBinaryHello(msg, framing, kind == BinaryMessage::Resend);
+          SendCounted(ws, msg.data(), msg.length(), uWS::OpCode::BINARY);
+          break;
+        }
+        case BinaryMessage::Telemetry:
+          RecordStage(Stage::Parse, PipelineClock::now() - received);
+          frame.ws = ws;
+          frame.received = received;
+          frame.arrived = received;
+          batch.Post(instance, frame);
+          break;
+        case BinaryMessage::Invalid:
+          MPC_LOG(LogLevel::Warning, "Invalid binary frame of %zu bytes", length);
+          break;
+      }
+      return;
+    }
+
+    MPC_LOG(LogLevel::Debug, "%.*s", int(length), data);
+    switch (DecodeTelemetry(data, length, frame)) {
+      case TelemetryMessage::Telemetry:
+        RecordStage(Stage::Parse, PipelineClock::now() - received);
+        frame.ws = ws;
+        frame.received = received;
+        frame.arrived = received;
+        // Handed to the connection's controller, replacing any frame it
+        // has not started on yet.
+        batch.Post(instance, frame);
+        break;
+      case TelemetryMessage::Manual: {
         // Manual driving
         std::string msg = "42[\"manual\",{}]";
-        (*ws).send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+        SendCounted(ws, msg.data(), msg.length(), uWS::OpCode::TEXT);
+        break;
       }
+      case TelemetryMessage::Other:
+        break;
     }
   });
 
-  // We don't need this since we're not using HTTP but if it's removed the
-  // program
-  // doesn't compile :-(
-  h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
-                     size_t, size_t) {
+  // GET /metrics serves the latency histograms and counters of Metrics.h
+  // in the Prometheus text format, GET /trace the latest spans of Trace.h
+  // as Chrome trace JSON, /weights the cost weights (WeightsRequest) and
+  // /snapshot saves the controllers to the --snapshot file, /memory
+  // reports their memory as JSON (Footprint.h) and /plan?vehicle=I the
+  // latest plan of the controller of vehicle I (WritePlan), read without
+  // waiting for its solve.
+  string metrics;
+  h.onHttpRequest([&metrics, &batch, &runtime](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
+                             size_t, size_t) {
     const std::string s = "<h1>Hello world!</h1>";
-    if (req.getUrl().valueLength == 1) {
+    uWS::Header url = req.getUrl();
+    string path(url.value, url.valueLength);
+    if (path == "/metrics") {
+      WriteMetrics(metrics);
+      res->end(metrics.data(), metrics.length());
+    } else if (path == "/trace") {
+      WriteTrace(metrics);
+      res->end(metrics.data(), metrics.length());
+    } else if (path.compare(0, 8, "/weights") == 0) {
+      metrics = WeightsRequest(path);
+      res->end(metrics.data(), metrics.length());
+    } else if (path == "/snapshot") {
+      if (runtime.snapshot_path.empty()) {
+        metrics = "error: no --snapshot file\n";
+      } else if (batch.SaveSnapshot(runtime.snapshot_path)) {
+        metrics = "saved " + runtime.snapshot_path + "\n";
+      } else {
+        metrics = "error: could not write " + runtime.snapshot_path + "\n";
+      }
+      res->end(metrics.data(), metrics.length());
+    } else if (path == "/memory") {
+      Footprint footprint;
+      batch.AddFootprint(footprint);
+      WriteFootprint(metrics, footprint);
+      res->end(metrics.data(), metrics.length());
+    } else if (path.compare(0, 5, "/plan") == 0) {
+      size_t query = min(path.find('?'), path.size());
+      size_t vehicle = size_t(atoi(QueryValue(path.substr(min(query + 1, path.size())), "vehicle").c_str()));
+      PublishedPlan plan;
+      if (batch.LatestPlan(vehicle, plan)) {
+        WritePlan(metrics, vehicle, plan, duration<double>(PipelineClock::now() - plan.solved).count());
+      } else {
+        metrics = "error: no plan for vehicle " + to_string(vehicle) + "\n";
+      }
+      res->end(metrics.data(), metrics.length());
+    } else if (url.valueLength == 1) {
       res->end(s.data(), s.length());
     } else {
       // i guess this should be done more gracefully?
@@ -211,22 +509,963 @@ int main() {
     }
   });
 
-  h.onConnection([&h](uWS::WebSocket<uWS::SERVER> *ws, uWS::HttpRequest req) {
-    std::cout << "Connected!!!" << std::endl;
+  h.onConnection([&h, &batch, &observers, &query_clients, &options, recorder](uWS::WebSocket<uWS::SERVER> *ws,
+                                                                              uWS::HttpRequest req) {
+    uWS::Header url = req.getUrl();
+    string target = url ? string(url.value, url.valueLength) : string();
+    size_t query = min(target.find('?'), target.size());
+    // The server's encoding of the lines, or that the URL asks for.
+    string parameters = target.substr(min(query + 1, target.size()));
+    VizEncoding viz = options.viz;
+    ParseVizQuery(parameters, viz);
+    if (target.compare(0, query, "/observe") == 0) {
+      Observer observer = { ws, 0, viz };
+      observers.push_back(observer);
+      MPC_LOG(LogLevel::Info, "Observer connected, %zu in all", observers.size());
+      return;
+    }
+    if (target.compare(0, query, "/solve") == 0) {
+      query_clients.push_back(ws);
+      MPC_LOG(LogLevel::Info, "Query client connected, %zu in all", query_clients.size());
+      return;
+    }
+    // A vehicle reconnecting with ?session=ID resumes its controller, and
+    // one of ?tenant=NAME is solved for that tenant.
+    MPCBatch::Instance* instance =
+        batch.Acquire(viz, QueryValue(parameters, "session"), QueryValue(parameters, "tenant"));
+    if (!instance) {
+      MPC_LOG(LogLevel::Warning, "All %zu controllers in use, refusing connection", batch.Capacity());
+      (*ws).close();
+      return;
+    }
+    (*ws).setUserData(instance);
+    if (recorder) {
+      recorder->Connect(ws);
+    }
+    MPC_LOG(LogLevel::Info, "Connected!!!");
   });
 
-  h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> *ws, int code,
-                         char *message, size_t length) {
+  h.onDisconnection([&h, &sender, &batch, &observers, &query_clients, recorder](uWS::WebSocket<uWS::SERVER> *ws,
+                                                                                int code, char *message,
+                                                                                size_t length) {
+    auto observer = find_if(observers.begin(), observers.end(),
+                            [ws](const Observer& o) { return o.ws == ws; });
+    if (observer != observers.end()) {
+      observers.erase(observer);
+      MPC_LOG(LogLevel::Info, "Observer disconnected");
+      return;
+    }
+    auto client = find(query_clients.begin(), query_clients.end(), ws);
+    if (client != query_clients.end()) {
+      query_clients.erase(client);
+      batch.CancelQueries(ws);
+      MPC_LOG(LogLevel::Info, "Query client disconnected");
+      return;
+    }
+    if ((*ws).getUserData()) {
+      if (recorder) {
+        recorder->Disconnect(ws);
+      }
+      batch.Release(static_cast<MPCBatch::Instance*>((*ws).getUserData()));
+      (*ws).setUserData(NULL);
+    }
+    sender.Cancel(ws);
     (*ws).close();
-    std::cout << "Disconnected" << std::endl;
+    MPC_LOG(LogLevel::Info, "Disconnected");
   });
 
-  int port = 4567;
-  if (h.listen(port)) {
-    std::cout << "Listening to port " << port << std::endl;
+  uS::TLS::Context tls = nullptr;
+  if (transport.Tls()) {
+    tls = uS::TLS::createContext(transport.tls_cert, transport.tls_key);
+    if (!tls) {
+      MPC_LOG(LogLevel::Error, "Failed to load the TLS certificate %s and key %s", transport.tls_cert.c_str(),
+              transport.tls_key.c_str());
+      return false;
+    }
+  }
+  if (h.listen(port, tls, listen_options)) {
+    MPC_LOG(LogLevel::Info, "Listening to port %d%s%s", port, transport.Tls() ? " over TLS" : "",
+            transport.compression ? " with compression" : "");
+  } else {
+    MPC_LOG(LogLevel::Error, "Failed to listen to port");
+    return false;
+  }
+  if (runtime.busy_poll) {
+    // Run the loop without blocking in epoll_wait, for as long as it has
+    // handles, as run does.
+    while (uv_run(h.getLoop(), UV_RUN_NOWAIT)) {
+    }
   } else {
-    std::cerr << "Failed to listen to port" << std::endl;
+    h.run();
+  }
+  // The timers free themselves once the loop has closed their handles.
+  if (control_timer) {
+    control_timer->stop();
+    control_timer->close();
+  }
+  if (keep_warm_timer) {
+    keep_warm_timer->stop();
+    keep_warm_timer->close();
+  }
+  if (follow_timer) {
+    follow_timer->stop();
+    follow_timer->close();
+  }
+  return true;
+}
+
+// Polls of an empty ring before the server starts yielding the CPU, and
+// how long it sleeps between polls once the gateway has been quiet for
+// idle_polls more.
+const size_t spin_polls = 1000;
+const size_t idle_polls = 100000;
+const auto idle_sleep = microseconds(50);
+
+// The server of a gateway on the same host, over the SharedChannel called
+// name, on the calling thread and pinned to first_cpu if not negative:
+// the controller one connection gets, with no event loop. Of the frames
+// waiting when it looks, only the newest is solved, as the batch's
+// mailboxes do, and its reply is pushed as soon as it is written; the
+// gateway is the vehicle, so there is no emulated actuator latency.
+// The thread is the solver as well, so the real-time priority applies to
+// it; with busy_poll it never yields an empty ring.
+// Returns false when the channel cannot be created.
+static bool ServeShared(const ControllerOptions& options, const RuntimeProfile& runtime, const string& name,
+                        int first_cpu) {
+  SharedChannel channel;
+  if (!channel.Create(name)) {
+    MPC_LOG(LogLevel::Error, "Failed to create the shared memory channel %s", name.c_str());
+    return false;
+  }
+  if (first_cpu >= 0 && !PinCurrentThread(first_cpu)) {
+    MPC_LOG(LogLevel::Warning, "Could not pin the shared memory server to CPU %d", first_cpu);
+  }
+  if (runtime.realtime_priority > 0 && !SetCurrentRealtime(runtime.realtime_priority)) {
+    MPC_LOG(LogLevel::Warning, "Could not run the shared memory server at real-time priority %d",
+            runtime.realtime_priority);
+  }
+  MPC_LOG(LogLevel::Info, "Serving a gateway on shared memory %s", name.c_str());
+  SharedRing& in = channel.Telemetry();
+  SharedRing& out = channel.Commands();
+  // Before the controller, whose thread then takes the first CppAD thread.
+  unique_ptr<ShadowRunner> shadow;
+  if (runtime.shadow) {
+    shadow.reset(new ShadowRunner(*runtime.shadow, 1, runtime.shadow_name, runtime.shadow_log));
+  }
+  Controller controller(options);
+  if (runtime.warmup_track) {
+    vector<double> times;
+    controller.WarmUp(*runtime.warmup_track, runtime.warmup_solves, times);
+    MPC_LOG(LogLevel::Info, "Warmed up with %zu solves: first %.2f ms, last %.2f ms", times.size(),
+            times.front() * 1000, times.back() * 1000);
+  }
+  Telemetry frame;
+  Command command;
+  command.ws = NULL;
+  command.posted = 0;
+  command.dropped = 0;
+  command.observation.vehicle = 0;
+  string hello;
+  WaypointWindow waypoints;
+  uint64_t session = channel.Session();
+  size_t idle = 0;
+  for (;;) {
+    if (channel.Session() != session) {
+      session = channel.Session();
+      while (in.Front()) {
+        in.Pop();
+      }
+      controller.Reset();
+      waypoints.n = 0;
+      MPC_LOG(LogLevel::Info, "Gateway session %llu", (unsigned long long)session);
+    }
+    const SharedSlot* slot = in.Front();
+    if (!slot) {
+      idle++;
+      if (runtime.busy_poll) {
+        continue;
+      }
+      if (idle > spin_polls + idle_polls) {
+        this_thread::sleep_for(idle_sleep);
+      } else if (idle > spin_polls) {
+        this_thread::yield();
+      }
+      continue;
+    }
+    idle = 0;
+    // The frames skipped are still decoded, for the waypoints the next
+    // ones take from them.
+    Framing framing;
+    size_t skipped = in.Size() - 1;
+    for (size_t i = 0; i < skipped; i++) {
+      if (DecodeBinary(slot->data, size_t(slot->length), framing, frame, &waypoints) == BinaryMessage::Resend) {
+        WriteBinaryHello(hello, framing, true);
+        out.Push(hello.data(), hello.length());
+      }
+      in.Pop();
+      slot = in.Front();
+    }
+    command.posted += skipped + 1;
+    command.dropped += skipped;
+    CountEvent(Counter::DroppedFrames, skipped);
+
+    PipelineClock::time_point received = PipelineClock::now();
+    // Pushed by the gateway on the same steady clock; a stamp from later
+    // than the read is of a gateway with another clock.
+    PipelineClock::time_point arrived(duration_cast<PipelineClock::duration>(nanoseconds(slot->stamp)));
+    if (arrived > received || slot->stamp == 0) {
+      arrived = received;
+    }
+    RecordStage(Stage::Arrival, received - arrived);
+    CountEvent(Counter::BytesReceived, slot->length);
+    BinaryMessage kind = DecodeBinary(slot->data, size_t(slot->length), framing, frame, &waypoints);
+    size_t length = size_t(slot->length);
+    in.Pop();
+    if (kind == BinaryMessage::Hello || kind == BinaryMessage::Resend) {
+      WriteBinaryHello(hello, framing, kind == BinaryMessage::Resend);
+      out.Push(hello.data(), hello.length());
+      continue;
+    }
+    if (kind == BinaryMessage::Invalid) {
+      MPC_LOG(LogLevel::Warning, "Invalid binary frame of %zu bytes", length);
+      continue;
+    }
+    RecordStage(Stage::Parse, PipelineClock::now() - received);
+    frame.ws = NULL;
+    frame.received = received;
+    frame.arrived = arrived;
+    command.framing = frame.framing;
+    command.received = received;
+    command.arrived = arrived;
+    {
+      ControlScope control;
+      controller.Solve(frame, command);
+    }
+    command.solved = PipelineClock::now();
+    if (!out.Push(command.msg.data(), command.msg.length())) {
+      MPC_LOG_EVERY_N(LogLevel::Warning, 100, "Command ring full, gateway not reading");
+      continue;
+    }
+    auto now = PipelineClock::now();
+    RecordStage(Stage::Send, now - command.solved);
+    RecordStage(Stage::EndToEnd, now - received);
+    CountEvent(Counter::BytesSent, command.msg.length());
+    CountEvent(Counter::BytesWritten, command.msg.length());
+    controller.Delivered(command, now);
+    if (runtime.run_log) {
+      runtime.run_log->Append(command.observation, received);
+    }
+    if (runtime.flight_recorder) {
+      runtime.flight_recorder->Record(command.observation, arrived, command.solved);
+    }
+    if (shadow) {
+      shadow->Submit(0, size_t(session), frame, command);
+    }
+    controller.Prepare();
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  // Pass --rti to run one real-time SQP iteration per frame
+  // instead of a full Ipopt solve, or --kernels to solve with the
+  // straight-line derivative kernels instead of the CppAD tape, or
+  // --autodiff to take the derivatives in forward mode per stage, or
+  // --riccati to run one SQP iteration per frame whose QP is solved
+  // stage-wise with Riccati recursions, or --admm to solve that QP in
+  // its sparse form with ADMM, or --mppi to average sampled rollouts
+  // (spread over --mppi-threads T threads, from the random streams of
+  // --mppi-seed S, or run on the CUDA device with --mppi-device S
+  // samples in builds with MPC_CUDA).
+  // --sensitivity-update U answers up to three frames in a row of the
+  // Riccati backend with a first-order update of its last plan, while no
+  // actuator changes by more than U (see MPC::SetSensitivityUpdate).
+  // --mixed-precision R solves the QPs of the RTI and ADMM backends in
+  // float with R double-precision refinements (see
+  // MPC::SetMixedPrecision).
+  // --window-fit fits the reference polynomial incrementally over the
+  // waypoint window instead of refitting it every frame.
+  // --filter-state runs the reported pose of every frame through an
+  // extended Kalman filter before using it (see StateFilter.h).
+  // --fit-near-field M weighs the waypoints of the fit by 1 / (1 +
+  // (d / M)^2) at a distance d from the vehicle, and --fit-anchor passes
+  // the fit through the path at the vehicle (see WeightedPolyfit).
+  // --fit-points K resamples the waypoints to K points --fit-spacing M
+  // metres apart along them (5 by default) before the fit, so that every
+  // frame fits the same number (see ResampleWaypoints).
+  // --max-waypoints K takes at most the K nearest waypoints of a frame and
+  // counts the rest as rejected, as the decoders count those past the 64
+  // a frame holds.
+  // --memory-budget KB caps the memory of every controller: past it, it
+  // makes no more MPCs for other horizons, candidates or scenarios and
+  // lets go of those it has (see ControllerOptions::memory_budget).
+  // --exact-cte takes the cross-track and heading errors from the point of
+  // the fit nearest the vehicle instead of the vertical offset at it (see
+  // CubicClosestPoint).
+  // --event-trigger K answers a frame from the last plan instead of
+  // solving while the vehicle and its reference follow what that plan
+  // predicted, solving at least every K-th frame (see
+  // ControllerOptions::replay_frames).
+  // --two-rate tracks the plan of a long, coarse MPC solved on a thread
+  // of every controller at most every --plan-interval MS (200 by default)
+  // over steps of --plan-dt S (0.25), instead of the waypoints (see
+  // ControllerOptions::two_rate); --horizon 7 suits the tracker.
+  // --candidates O,O,... also solves the reference shifted sideways by
+  // each offset in metres, on threads of every controller, and follows the
+  // cheapest plan (see ControllerOptions::candidate_offsets).
+  // --scenarios MS:K,... also solves for each extra latency in
+  // milliseconds and understeer, and commands the first control they
+  // agree on (see ControllerOptions::scenarios).
+  // --hybrid steers by pure pursuit of the reference on straights and
+  // solves only on curves or off the line (see ControllerOptions::hybrid).
+  // --solution-cache K keeps the Ipopt solutions of the last K problems
+  // of every MPC, answering those met again (see MPC::SetSolutionCache).
+  // --multi-start K runs the Ipopt solve from K initial guesses in
+  // parallel and keeps the best.
+  // --coarse-start starts the cold Ipopt solves, and those after a large
+  // disturbance, from a coarse problem solved first (see
+  // MPC::SetCoarseStart).
+  // --table FILE answers states inside the grid of a table built by
+  // mpc_table from it, solving only the others.
+  // --warm-start-net FILE starts the cold solves from the guess of a net
+  // trained by mpc_net (see WarmStartNet.h).
+  // --deadline MS bounds every solve to MS milliseconds after the arrival
+  // of its frame, falling back to the previous plan when it runs out.
+  // Each connection gets its own controller; up to 4 are solved in turn on
+  // one solver thread. --batch K serves up to K simulators at once, solved
+  // on --workers W threads (default: the cores left after the event
+  // loop). --hubs H runs H event loops on their own threads, sharing the
+  // port, each with its own controllers and workers. --pin pins every
+  // event loop and worker to a core of its own.
+  // --record FILE logs every telemetry message with its arrival time to
+  // FILE, for mpc_replay.
+  // --run-log FILE writes the state, command, solve statistics, stage
+  // timings and plan of every solved frame to FILE, by column (see
+  // RunLog.h), for mpc_columns.
+  // --flight-recorder DIR keeps the last --flight-frames K solved frames
+  // (default 512) in memory and writes them to a run log in DIR whenever
+  // a frame takes over --flight-budget MS from its arrival to its reply
+  // (default the --deadline, else 50) or its solve fails (see
+  // FlightRecorder.h).
+  // --shadow NAME solves every frame again with another backend, one of
+  // the names of --auto-backend (ipopt, ipopt-lbfgs, ipopt-gn, kernels,
+  // kernels-gn, autodiff, rti, riccati, admm, mppi), and --shadow-weights
+  // FILE with other cost weights, or both, on a thread that only takes
+  // the cores the control solves leave, without ever sending its command
+  // (see Shadow.h). Its commands, costs and solve times are compared with
+  // the served ones in the log every 100 frames, and --shadow-log FILE
+  // writes its observations to a run log whose rows line up with those of
+  // --run-log.
+  // --trace records trace spans of every frame, served on /trace.
+  // --weights FILE reads the cost weights from FILE (see Weights.h);
+  // /weights/reload rereads it while serving.
+  // --model FILE models the vehicle as mpc_calibrate fitted it to a
+  // recorded log: the lag of its actuators, its understeer and the gains
+  // of its steering and throttle (see ModelCalibration.h).
+  // --adaptive-horizon switches every controller between the compiled
+  // horizons by speed, curvature and solve time (see AdaptiveHorizon.h).
+  // --load-shedding has every controller give up optional work, step by
+  // step, as its frames near the --deadline, or 25 ms without one: the
+  // lines of the replies, Info logging, the extra starts, Ipopt iterations
+  // past 10 and at last the backend, for RTI (see LoadShedding.h).
+  // --reference FILE takes the reference polynomial from a spline through
+  // the track waypoints of FILE, e.g. lake_track_waypoints.csv, fitted
+  // once at startup (see ReferencePath.h), instead of fitting the
+  // waypoints of every frame. FILE may also be a binary map written by
+  // mpc_map, which is mapped into memory instead. --speed-profile takes
+  // the reference speed of every stage from the path's speed profile,
+  // capped at the reference speed (see Controller::ProfileSpeed).
+  // --plan-library keeps the plan of every solve by its station along the
+  // --reference path and speed, shared by all the controllers, for the
+  // cold starts of the Ipopt backends and those far off their warm start
+  // to start from that of the last vehicle there (see PlanLibrary.h);
+  // /metrics counts the starts it gave and those it had none for.
+  // --frenet solves along the --reference path, in its arc length, offset
+  // and relative heading with its curvature, instead of on the reference
+  // polynomial in the vehicle frame (see MPC::SetFrenet); it needs the
+  // ipopt backend, and solves once per frame, without the candidates,
+  // scenarios or speculation.
+  // --obstacles FILE keeps the Ipopt backends --obstacle-margin M (1.5)
+  // clear of the circles of FILE, "x,y,radius" in map coordinates; each
+  // frame constrains the few the horizon can reach, found along the
+  // --reference path if there is one (see ObstacleMap.h).
+  // --move-blocks L,L,... holds the actuators constant over blocks of
+  // stages of those lengths (see MPC::SetMoveBlocks).
+  // --understeer K models the yaw rate of the tires slipping with speed,
+  // K in s^2/m^2 (see MPC::SetUndersteer); 0, the default, is the
+  // kinematic model.
+  // --terminal-cost charges the last stage the LQR cost of the stages
+  // past the horizon (see MPC::SetTerminalCost), for a shorter --horizon.
+  // --soft-boundary M and --soft-steer-rate R bound |cte| to M metres
+  // and the steering change between stages to R radians as soft
+  // constraints, whose slacks cost --slack-weight W each (see
+  // LinearConstraints.h); both are off by default.
+  // --max-steer-rate R and --max-accel-rate R bound the change of the
+  // steering and the throttle between stages as hard linear constraints
+  // (see RateLimits, LinearConstraints.h).
+  // --linear-solver NAME, --tol T, --mu-strategy S and --max-iter I set
+  // those options of Ipopt, --limited-memory approximates its Hessian by
+  // L-BFGS, --gauss-newton by the Gauss-Newton Hessian of the cost alone,
+  // without the second derivatives of the constraints, --cold-start
+  // starts every solve without the multipliers of the last and
+  // --user-scaling scales the problem by the typical magnitudes of its
+  // variables instead of its gradients (see IpoptOptions.h).
+  // --solver-threads T factors on T threads per solve with a
+  // multithreaded linear solver (ma86, ma97, pardiso or pardisomkl);
+  // without it such a solver gets the cores left to each solver thread
+  // after the event loops, and the background work waits for the cores
+  // the solves hold (see MPCLinearSolverThreads).
+  // --speculate presolves the next frame while waiting for it, from the
+  // state the new actuators are predicted to reach (see MPC::Presolve).
+  // --transport remote offers permessage-deflate for a gateway across a
+  // network, and with --tls-cert FILE and --tls-key FILE serves TLS;
+  // --transport local, the default, offers neither (see
+  // TransportProfile). /metrics counts the bytes of the frames either way.
+  // --viz-interval MS sends the predicted trajectory and the reference
+  // line at most every MS milliseconds per connection; the replies in
+  // between carry the actuators alone. --viz-tolerance M drops the points
+  // of those lines within M metres of the line through the rest
+  // (Douglas-Peucker), and --viz-resolution M writes their coordinates
+  // rounded to M metres, as 0.01 for centimetres; both are off by
+  // default. A simulator or an /observe connection may ask for its own
+  // with ?viz_tolerance=M&viz_resolution=M on its URL (see VizEncoding).
+  // --warmup K solves K frames along the track of --warmup-track FILE
+  // (lake_track_waypoints.csv by default) on every controller before
+  // listening, and logs the first solve against the steady state.
+  // --auto-backend solves the frames of the warm-up track (--warmup K of
+  // them, 60 without) with every backend at startup and keeps the fastest
+  // whose actuators agree with the exact-Hessian Ipopt's within
+  // --auto-tolerance X (0.05), logging every trial (see Calibration.h). A
+  // backend given on the command line, --limited-memory or --gauss-newton
+  // overrides it.
+  // --verify-tapes checks every optimized CppAD tape against its
+  // recording and logs an error on a difference (see FG_Tape.h).
+  // --busy-poll never lets the event loop (or the shared memory server)
+  // sleep in the kernel between frames, and --realtime P runs the solver
+  // threads under SCHED_FIFO at priority P with the process locked in
+  // memory; both are for cores isolated for the controller (see
+  // RuntimeProfile).
+  // --snapshot FILE restores the controllers saved to FILE by an earlier
+  // process on /snapshot, so that the vehicles reconnecting after a
+  // restart resume with their warm starts and estimates; with --hubs,
+  // hub i uses FILE.i. The cost weights of the snapshot are restored
+  // unless --weights is given (see RuntimeProfile).
+  // --session-grace MS holds the controller of a disconnected vehicle for
+  // MS milliseconds (5000; 0 for none) for the session it named with
+  // ?session=ID on its URL: a reconnection naming the same session takes
+  // it back with its warm start, reference fit and latency estimate
+  // instead of solving cold. /metrics counts the resumes.
+  // --tenant NAME:WEIGHT gives the tenant NAME, that its vehicles name
+  // with ?tenant=NAME on their URL, WEIGHT shares of the workers under
+  // contention, 1 for those not given; may be repeated (see Tenants.h).
+  // /metrics reports the solves, CPU and worker time of every tenant.
+  // --control-rate HZ solves every controller HZ times a second between
+  // frames, from its last frame predicted to the time, instead of only on
+  // the arrival of telemetry (see RuntimeProfile); /metrics counts the
+  // ticks missed by controllers still busy. It does not apply to --shared.
+  // --follow-plan HZ sends every vehicle, HZ times a second between the
+  // commands of its solves, the actuators its last plan has for the time,
+  // interpolated between the plan's stages, so that the commands follow
+  // the plan while a solve runs long (see RuntimeProfile); /metrics counts
+  // them. It does not apply to --shared.
+  // --keep-warm MS has the worker of every vehicle whose telemetry paused
+  // for MS, at low rates or in manual mode, keep its controller in the
+  // caches while idle, evaluating the problem at its last solution once
+  // every MS (see RuntimeProfile). /metrics counts the passes and has the
+  // first solve after the pause (idle_warm) against those of controllers
+  // left to go cold (idle_cold, after a second without it). It does not
+  // apply to --shared.
+  // --shared NAME serves a gateway on the same host over the shared
+  // memory channel NAME, e.g. /mpc, instead of websockets (see
+  // SharedChannel.h). The frames are those of BinaryProtocol.h; there is
+  // no /metrics endpoint, and --batch and --hubs do not apply.
+  // --verbose also logs every message and the intermediate states.
+  ControllerOptions options;
+  TransportProfile transport;
+  bool remote = false;
+  string shared_name;
+  RuntimeProfile runtime;
+  string warmup_path = "lake_track_waypoints.csv";
+  bool auto_backend = false;
+  double auto_tolerance = 0.05;
+  string obstacles_path;
+  bool plan_library = false;
+  size_t capacity = 4;
+  size_t workers = 1;
+  size_t hubs = 1;
+  bool pin = false;
+  bool server = false;
+  bool workers_set = false;
+  unique_ptr<TelemetryRecorder> recorder;
+  string flight_directory;
+  size_t flight_frames = 512;
+  double flight_budget_ms = 0;
+  string shadow_backend;
+  string shadow_weights_path;
+  string shadow_log_path;
+  // The origin of the times of the run logs.
+  PipelineClock::time_point started = PipelineClock::now();
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--rti") {
+      options.backend = MPC<11>::Backend::RTI;
+    } else if (arg == "--riccati") {
+      options.backend = MPC<11>::Backend::Riccati;
+    } else if (arg == "--sensitivity-update" && i + 1 < argc) {
+      options.sensitivity_update = stod(argv[++i]);
+    } else if (arg == "--mixed-precision" && i + 1 < argc) {
+      options.mixed_precision = max(atoi(argv[++i]), 0);
+    } else if (arg == "--admm") {
+      options.backend = MPC<11>::Backend::ADMM;
+    } else if (arg == "--mppi") {
+      options.backend = MPC<11>::Backend::MPPI;
+    } else if (arg == "--mppi-threads" && i + 1 < argc) {
+      options.sampling_threads = stoi(argv[++i]);
+    } else if (arg == "--mppi-seed" && i + 1 < argc) {
+      options.sampling_seed = stoull(argv[++i]);
+    } else if (arg == "--mppi-device" && i + 1 < argc) {
+      options.sampling_device_samples = stoul(argv[++i]);
+    } else if (arg == "--kernels") {
+      options.backend = MPC<11>::Backend::IpoptKernels;
+    } else if (arg == "--autodiff") {
+      options.backend = MPC<11>::Backend::IpoptAutoDiff;
+    } else if (arg == "--soft-boundary" && i + 1 < argc) {
+      options.soft.boundary = stod(argv[++i]);
+    } else if (arg == "--soft-steer-rate" && i + 1 < argc) {
+      options.soft.max_ddelta = stod(argv[++i]);
+    } else if (arg == "--slack-weight" && i + 1 < argc) {
+      options.soft.weight = stod(argv[++i]);
+    } else if (arg == "--max-steer-rate" && i + 1 < argc) {
+      options.rate_limits.ddelta = stod(argv[++i]);
+    } else if (arg == "--max-accel-rate" && i + 1 < argc) {
+      options.rate_limits.da = stod(argv[++i]);
+    } else if (arg == "--linear-solver" && i + 1 < argc) {
+      options.ipopt.linear_solver = argv[++i];
+    } else if (arg == "--solver-threads" && i + 1 < argc) {
+      options.ipopt.linear_solver_threads = stoul(argv[++i]);
+    } else if (arg == "--tol" && i + 1 < argc) {
+      options.ipopt.tol = stod(argv[++i]);
+    } else if (arg == "--mu-strategy" && i + 1 < argc) {
+      options.ipopt.mu_strategy = argv[++i];
+    } else if (arg == "--max-iter" && i + 1 < argc) {
+      options.ipopt.max_iter = max(atoi(argv[++i]), 0);
+    } else if (arg == "--limited-memory") {
+      options.ipopt.hessian_approximation = "limited-memory";
+    } else if (arg == "--gauss-newton") {
+      options.ipopt.gauss_newton = true;
+    } else if (arg == "--user-scaling") {
+      options.ipopt.user_scaling = true;
+    } else if (arg == "--cold-start") {
+      options.ipopt.warm_start = false;
+    } else if (arg == "--speculate") {
+      options.speculate = true;
+    } else if (arg == "--window-fit") {
+      options.window_fit = true;
+    } else if (arg == "--filter-state") {
+      options.filter_state = true;
+    } else if (arg == "--fit-near-field" && i + 1 < argc) {
+      options.fit_near_field = max(stod(argv[++i]), 0.0);
+    } else if (arg == "--fit-anchor") {
+      options.fit_anchor = true;
+    } else if (arg == "--fit-points" && i + 1 < argc) {
+      options.fit_points = stoul(argv[++i]);
+    } else if (arg == "--fit-spacing" && i + 1 < argc) {
+      options.fit_spacing = max(stod(argv[++i]), 0.1);
+    } else if (arg == "--max-waypoints" && i + 1 < argc) {
+      options.max_waypoints = stoul(argv[++i]);
+    } else if (arg == "--memory-budget" && i + 1 < argc) {
+      options.memory_budget = stoul(argv[++i]) * 1024;
+    } else if (arg == "--exact-cte") {
+      options.exact_cte = true;
+    } else if (arg == "--event-trigger" && i + 1 < argc) {
+      options.replay_frames = max(stoi(argv[++i]), 0);
+    } else if (arg == "--solution-cache" && i + 1 < argc) {
+      options.solution_cache = stoul(argv[++i]);
+    } else if (arg == "--hybrid") {
+      options.hybrid = true;
+    } else if (arg == "--two-rate") {
+      options.two_rate = true;
+    } else if (arg == "--plan-dt" && i + 1 < argc) {
+      options.plan_dt = max(stod(argv[++i]), 0.01);
+    } else if (arg == "--plan-interval" && i + 1 < argc) {
+      options.plan_interval_ms = max(stoi(argv[++i]), 0);
+    } else if (arg == "--candidates" && i + 1 < argc) {
+      if (!ParseOffsets(argv[++i], options.candidate_offsets)) {
+        MPC_LOG(LogLevel::Error, "Bad candidate offsets %s, at most %d allowed", argv[i],
+                int(max_candidates) - 1);
+        FlushLog();
+        return 1;
+      }
+    } else if (arg == "--scenarios" && i + 1 < argc) {
+      if (!ParseScenarios(argv[++i], options.scenarios)) {
+        MPC_LOG(LogLevel::Error, "Bad scenarios %s, at most %d allowed", argv[i], int(max_candidates) - 1);
+        FlushLog();
+        return 1;
+      }
+    } else if (arg == "--multi-start" && i + 1 < argc) {
+      options.multi_start = stoi(argv[++i]);
+    } else if (arg == "--coarse-start") {
+      options.coarse_start = true;
+    } else if (arg == "--table" && i + 1 < argc) {
+      shared_ptr<ControlTable> table(new ControlTable);
+      if (!table->Load(argv[++i])) {
+        MPC_LOG(LogLevel::Error, "Failed to load the control table %s", argv[i]);
+        FlushLog();
+        return -1;
+      }
+      options.table = table;
+    } else if (arg == "--warm-start-net" && i + 1 < argc) {
+      shared_ptr<WarmStartNet> net(new WarmStartNet);
+      if (!net->Load(argv[++i])) {
+        MPC_LOG(LogLevel::Error, "Failed to load the warm start net %s", argv[i]);
+        FlushLog();
+        return -1;
+      }
+      options.warm_start_net = net;
+    } else if (arg == "--deadline" && i + 1 < argc) {
+      options.deadline_ms = stoi(argv[++i]);
+    } else if (arg == "--batch" && i + 1 < argc) {
+      capacity = stoul(argv[++i]);
+      server = true;
+    } else if (arg == "--workers" && i + 1 < argc) {
+      workers = stoul(argv[++i]);
+      workers_set = true;
+    } else if (arg == "--hubs" && i + 1 < argc) {
+      hubs = stoul(argv[++i]);
+      server = true;
+    } else if (arg == "--pin") {
+      pin = true;
+    } else if (arg == "--record" && i + 1 < argc) {
+      recorder.reset(new TelemetryRecorder);
+      if (!recorder->Open(argv[++i])) {
+        MPC_LOG(LogLevel::Error, "Failed to create the telemetry log %s", argv[i]);
+        FlushLog();
+        return -1;
+      }
+    } else if (arg == "--run-log" && i + 1 < argc) {
+      runtime.run_log.reset(new RunLogWriter);
+      if (!runtime.run_log->Open(argv[++i], started)) {
+        MPC_LOG(LogLevel::Error, "Failed to create the run log %s", argv[i]);
+        FlushLog();
+        return -1;
+      }
+    } else if (arg == "--shadow" && i + 1 < argc) {
+      shadow_backend = argv[++i];
+    } else if (arg == "--shadow-weights" && i + 1 < argc) {
+      shadow_weights_path = argv[++i];
+    } else if (arg == "--shadow-log" && i + 1 < argc) {
+      shadow_log_path = argv[++i];
+    } else if (arg == "--flight-recorder" && i + 1 < argc) {
+      flight_directory = argv[++i];
+    } else if (arg == "--flight-frames" && i + 1 < argc) {
+      flight_frames = size_t(max(stoi(argv[++i]), 1));
+    } else if (arg == "--flight-budget" && i + 1 < argc) {
+      flight_budget_ms = max(stod(argv[++i]), 0.0);
+    } else if (arg == "--trace") {
+      SetTracing(true);
+    } else if (arg == "--perf-counters") {
+      SetPerfCounters(true);
+    } else if (arg == "--weights" && i + 1 < argc) {
+      weights_path = argv[++i];
+      Weights weights = default_weights;
+      string error;
+      if (!LoadWeights(weights_path, weights, error)) {
+        MPC_LOG(LogLevel::Error, "Failed to load the cost weights: %s", error.c_str());
+        FlushLog();
+        return -1;
+      }
+      SetCurrentWeights(weights);
+    } else if (arg == "--model" && i + 1 < argc) {
+      ModelCalibration model;
+      string error;
+      if (!LoadModelCalibration(argv[++i], model, error)) {
+        MPC_LOG(LogLevel::Error, "Failed to load the model: %s", error.c_str());
+        FlushLog();
+        return -1;
+      }
+      ApplyModelCalibration(model, options);
+    } else if (arg == "--adaptive-horizon") {
+      options.adaptive_horizon = true;
+    } else if (arg == "--load-shedding") {
+      options.load_shedding = true;
+    } else if (arg == "--reference" && i + 1 < argc) {
+      options.reference = TrackCache::Shared().Get(argv[++i]);
+      if (!options.reference) {
+        MPC_LOG(LogLevel::Error, "Failed to load the reference path from %s", argv[i]);
+        FlushLog();
+        return -1;
+      }
+    } else if (arg == "--speed-profile") {
+      options.speed_profile = true;
+    } else if (arg == "--plan-library") {
+      plan_library = true;
+    } else if (arg == "--frenet") {
+      options.frenet = true;
+    } else if (arg == "--obstacles" && i + 1 < argc) {
+      obstacles_path = argv[++i];
+    } else if (arg == "--obstacle-margin" && i + 1 < argc) {
+      options.obstacle_margin = max(stod(argv[++i]), 0.0);
+    } else if (arg == "--move-blocks" && i + 1 < argc) {
+      if (!ParseMoveBlocks(argv[++i], options.move_blocks)) {
+        MPC_LOG(LogLevel::Error, "Bad move blocks %s", argv[i]);
+        FlushLog();
+        return -1;
+      }
+    } else if (arg == "--understeer" && i + 1 < argc) {
+      options.understeer = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--terminal-cost") {
+      options.terminal_cost = true;
+    } else if (arg == "--transport" && i + 1 < argc) {
+      string profile = argv[++i];
+      if (profile != "local" && profile != "remote") {
+        MPC_LOG(LogLevel::Error, "Unknown transport %s, expected local or remote", profile.c_str());
+        FlushLog();
+        return -1;
+      }
+      remote = profile == "remote";
+    } else if (arg == "--viz-interval" && i + 1 < argc) {
+      options.viz_interval_ms = stoi(argv[++i]);
+    } else if (arg == "--viz-tolerance" && i + 1 < argc) {
+      options.viz.tolerance = max(stod(argv[++i]), 0.0);
+    } else if (arg == "--viz-resolution" && i + 1 < argc) {
+      options.viz.resolution = max(stod(argv[++i]), 0.0);
+    } else if (arg == "--warmup" && i + 1 < argc) {
+      runtime.warmup_solves = stoul(argv[++i]);
+    } else if (arg == "--warmup-track" && i + 1 < argc) {
+      warmup_path = argv[++i];
+    } else if (arg == "--verify-tapes") {
+      SetTapeVerification(true);
+    } else if (arg == "--auto-backend") {
+      auto_backend = true;
+    } else if (arg == "--auto-tolerance" && i + 1 < argc) {
+      auto_tolerance = stod(argv[++i]);
+    } else if (arg == "--snapshot" && i + 1 < argc) {
+      runtime.snapshot_path = argv[++i];
+    } else if (arg == "--session-grace" && i + 1 < argc) {
+      runtime.session_grace_ms = max(stoi(argv[++i]), 0);
+    } else if (arg == "--tenant" && i + 1 < argc) {
+      if (!ParseTenantWeight(argv[++i])) {
+        MPC_LOG(LogLevel::Error, "Bad tenant %s, expected NAME:WEIGHT", argv[i]);
+        FlushLog();
+        return 1;
+      }
+    } else if (arg == "--control-rate" && i + 1 < argc) {
+      runtime.control_rate_hz = max(stoi(argv[++i]), 0);
+    } else if (arg == "--follow-plan" && i + 1 < argc) {
+      runtime.follow_rate_hz = max(stoi(argv[++i]), 0);
+    } else if (arg == "--keep-warm" && i + 1 < argc) {
+      runtime.keep_warm_ms = max(stoi(argv[++i]), 0);
+    } else if (arg == "--busy-poll") {
+      runtime.busy_poll = true;
+    } else if (arg == "--realtime" && i + 1 < argc) {
+      runtime.realtime_priority = min(max(stoi(argv[++i]), 1), 99);
+    } else if (arg == "--shared" && i + 1 < argc) {
+      shared_name = argv[++i];
+    } else if (arg == "--tls-cert" && i + 1 < argc) {
+      transport.tls_cert = argv[++i];
+    } else if (arg == "--tls-key" && i + 1 < argc) {
+      transport.tls_key = argv[++i];
+    } else if (arg == "--verbose") {
+      SetLogLevel(LogLevel::Debug);
+    }
+  }
+  transport.compression = remote;
+  if (!remote && (!transport.tls_cert.empty() || !transport.tls_key.empty())) {
+    MPC_LOG(LogLevel::Warning, "TLS is only served with --transport remote");
+    transport.tls_cert.clear();
+    transport.tls_key.clear();
+  } else if (remote && !transport.Tls()) {
+    MPC_LOG(LogLevel::Warning, "Remote transport without --tls-cert and --tls-key, serving plain websockets");
+  }
+  if (server && !workers_set) {
+    // The cores left to each hub after its event loop thread.
+    size_t cores = max(thread::hardware_concurrency(), 1u);
+    workers = max<size_t>(cores / max<size_t>(hubs, 1), 2) - 1;
+  }
+  if (MultithreadedLinearSolver(options.ipopt.linear_solver)) {
+    size_t threads = options.ipopt.linear_solver_threads;
+    MPCLinearSolverThreads(threads > 0 ? threads : ControlCoreBudget(hubs * workers, hubs));
+  } else if (options.ipopt.linear_solver_threads > 0) {
+    MPC_LOG(LogLevel::Warning, "--solver-threads needs a multithreaded --linear-solver");
+  }
+  if (!flight_directory.empty()) {
+    if (access(flight_directory.c_str(), W_OK) != 0) {
+      MPC_LOG(LogLevel::Error, "Cannot write flight recorder dumps to %s", flight_directory.c_str());
+      FlushLog();
+      return -1;
+    }
+    if (flight_budget_ms <= 0) {
+      flight_budget_ms = options.deadline_ms > 0 ? options.deadline_ms : 50;
+    }
+    runtime.flight_recorder.reset(new FlightRecorder(flight_directory, flight_frames, flight_budget_ms / 1000));
+  }
+
+  // Latency
+  // The purpose is to mimic real driving conditions where
+  // the car does actuate the commands instantly.
+  //
+  // Feel free to play around with this value but should be to drive
+  // around the track with 100ms latency.
+  //
+  // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+  // SUBMITTING.
+  const int latency_ms = 100;
+  options.latency_ms = latency_ms;
+
+  if (!obstacles_path.empty()) {
+    // Indexed once all the options are read, along the reference path.
+    shared_ptr<ObstacleMap> obstacles(new ObstacleMap);
+    if (!obstacles->Load(obstacles_path)) {
+      MPC_LOG(LogLevel::Error, "Failed to read the obstacles %s", obstacles_path.c_str());
+      FlushLog();
+      return -1;
+    }
+    if (options.reference) {
+      obstacles->Index(*options.reference);
+    }
+    MPC_LOG(LogLevel::Info, "%zu obstacles", obstacles->Size());
+    options.obstacles = obstacles;
+  }
+  if (plan_library) {
+    if (options.reference) {
+      options.plan_library.reset(new PlanLibrary(options.reference->Length()));
+      MPC_LOG(LogLevel::Info, "Plan library of %zu KiB along the reference path",
+              options.plan_library->Bytes() >> 10);
+    } else {
+      MPC_LOG(LogLevel::Warning, "--plan-library needs a --reference path");
+    }
+  }
+  if (options.frenet && (!options.reference || options.backend != MPCBackend::Ipopt)) {
+    MPC_LOG(LogLevel::Warning, "--frenet needs a --reference path and the ipopt backend");
+    options.frenet = false;
+  } else if (options.frenet && auto_backend) {
+    MPC_LOG(LogLevel::Info, "--frenet keeps the ipopt backend, so --auto-backend does not apply");
+    auto_backend = false;
+  }
+  if (auto_backend && (options.backend != MPCBackend::Ipopt || !options.ipopt.hessian_approximation.empty() ||
+                       options.ipopt.gauss_newton)) {
+    MPC_LOG(LogLevel::Info, "The backend is given, so --auto-backend does not apply");
+    auto_backend = false;
+  }
+  if (runtime.warmup_solves > 0 || auto_backend) {
+    shared_ptr<Track> track(new Track);
+    if (!track->Load(warmup_path)) {
+      MPC_LOG(LogLevel::Error, "Failed to read the warm-up track %s", warmup_path.c_str());
+      FlushLog();
+      return -1;
+    }
+    if (runtime.warmup_solves > 0) {
+      runtime.warmup_track = track;
+    }
+    if (auto_backend) {
+      vector<BackendTrial> trials;
+      size_t solves = runtime.warmup_solves > 0 ? runtime.warmup_solves : 60;
+      size_t chosen = CalibrateBackend(options, *track, solves, auto_tolerance, BackendCandidates(), trials);
+      ApplyBackend(trials[chosen].candidate, options);
+    }
+  }
+  runtime.snapshot_weights = weights_path.empty();
+  if (!shadow_backend.empty() || !shadow_weights_path.empty()) {
+    shared_ptr<ControllerOptions> shadow(new ControllerOptions(options));
+    // The shadow's plans are not the ones driven.
+    shadow->plan_library.reset();
+    if (!shadow_backend.empty()) {
+      const vector<BackendCandidate>& candidates = BackendCandidates();
+      auto named = find_if(candidates.begin(), candidates.end(),
+                           [&shadow_backend](const BackendCandidate& c) { return shadow_backend == c.name; });
+      if (named == candidates.end()) {
+        MPC_LOG(LogLevel::Error, "Unknown shadow backend %s", shadow_backend.c_str());
+        FlushLog();
+        return -1;
+      }
+      ApplyBackend(*named, *shadow);
+    }
+    if (!shadow_weights_path.empty()) {
+      shared_ptr<Weights> weights(new Weights(default_weights));
+      string error;
+      if (!LoadWeights(shadow_weights_path, *weights, error)) {
+        MPC_LOG(LogLevel::Error, "Failed to load the shadow's cost weights: %s", error.c_str());
+        FlushLog();
+        return -1;
+      }
+      shadow->weights = weights;
+    }
+    if (!shadow_log_path.empty()) {
+      runtime.shadow_log.reset(new RunLogWriter);
+      if (!runtime.shadow_log->Open(shadow_log_path, started)) {
+        MPC_LOG(LogLevel::Error, "Failed to create the shadow's run log %s", shadow_log_path.c_str());
+        FlushLog();
+        return -1;
+      }
+    }
+    runtime.shadow = shadow;
+    runtime.shadow_name = shadow_backend.empty() ? shadow_weights_path : shadow_backend;
+    MPC_LOG(LogLevel::Info, "Shadowing the controllers with %s", runtime.shadow_name.c_str());
+  }
+  if (!runtime.snapshot_path.empty() && !shared_name.empty()) {
+    MPC_LOG(LogLevel::Warning, "--snapshot does not apply to --shared");
+  }
+  if (runtime.control_rate_hz > 0 && !shared_name.empty()) {
+    MPC_LOG(LogLevel::Warning, "--control-rate does not apply to --shared");
+  }
+  if (runtime.follow_rate_hz > 0 && !shared_name.empty()) {
+    MPC_LOG(LogLevel::Warning, "--follow-plan does not apply to --shared");
+  }
+  if (runtime.keep_warm_ms > 0 && !shared_name.empty()) {
+    MPC_LOG(LogLevel::Warning, "--keep-warm does not apply to --shared");
+  }
+  if (runtime.realtime_priority > 0 && !LockMemory()) {
+    MPC_LOG(LogLevel::Warning, "Could not lock the process in memory");
+  }
+  if (runtime.busy_poll && !pin) {
+    MPC_LOG(LogLevel::Warning, "--busy-poll without --pin spins on whatever core the scheduler picks");
+  }
+
+  if (!shared_name.empty()) {
+    if (!ServeShared(options, runtime, shared_name, pin ? 0 : -1)) {
+      FlushLog();
+      return -1;
+    }
+    return 0;
+  }
+
+  int port = 4567;
+  if (hubs <= 1) {
+    if (!Serve(options, transport, runtime, capacity, workers, port, 0, pin ? 0 : -1, recorder.get())) {
+      FlushLog();
+      return -1;
+    }
+    return 0;
+  }
+
+  // One hub per thread, all listening to the same port: the kernel spreads
+  // the connections across them. Every hub thread records the tapes of its
+  // own controllers, so CppAD is set up for the hubs and all the workers.
+  MPCParallelSetup(hubs * (workers + 1 + ControllerThreads(options) * capacity + (runtime.shadow ? 1 : 0)) + 1);
+  vector<thread> threads;
+  atomic<size_t> failed(0);
+  for (size_t i = 0; i < hubs; i++) {
+    int first_cpu = pin ? int(i * (workers + 1)) : -1;
+    TelemetryRecorder* shared_recorder = recorder.get();
+    RuntimeProfile hub_runtime = runtime;
+    if (!hub_runtime.snapshot_path.empty()) {
+      hub_runtime.snapshot_path += "." + to_string(i);
+    }
+    threads.emplace_back([&options, &transport, hub_runtime, &failed, capacity, workers, port, first_cpu,
+                          shared_recorder]() {
+      MPCSolverThread();
+      if (!Serve(options, transport, hub_runtime, capacity, workers, port, uS::REUSE_PORT, first_cpu,
+                 shared_recorder)) {
+        failed++;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (failed > 0) {
+    FlushLog();
     return -1;
   }
-  h.run();
+  return 0;
 }
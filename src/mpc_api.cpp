@@ -0,0 +1,184 @@
+#include "mpc_api.h"
+#include <math.h>
+#include <algorithm>
+#include <new>
+#include "AdaptiveHorizon.h"
+#include "BinaryProtocol.h"
+#include "Controller.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Track.h"
+
+using namespace std;
+
+// The frame, the reply and the controller of a handle, all made up front.
+struct mpc_controller {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  Controller controller;
+  Telemetry frame;
+  Command command;
+
+  explicit mpc_controller(const ControllerOptions& options) : controller(options) {
+    frame.ws = NULL;
+    frame.framing = Framing::Binary64;
+    command.ws = NULL;
+    command.framing = Framing::Binary64;
+    // The largest reply a frame gets, so that no solve grows it.
+    command.msg.reserve(binary_header_size + (2 + 4 * Telemetry::max_points) * sizeof(double));
+  }
+};
+
+// Whether the calling thread may use a controller of a parallel setup.
+static thread_local bool solver_thread = false;
+
+static bool ClaimSolverThread() {
+  if (!MPCParallel() || solver_thread) {
+    return true;
+  }
+  solver_thread = MPCSolverThread();
+  return solver_thread;
+}
+
+// A loop of waypoints for the warm-up, a circle of the radius of a gentle
+// turn.
+static Track WarmUpTrack() {
+  const size_t n = 64;
+  const double radius = 60;
+  Track track;
+  for (size_t i = 0; i < n; i++) {
+    double angle = 2 * M_PI * double(i) / double(n);
+    track.x.push_back(radius * cos(angle));
+    track.y.push_back(radius * sin(angle));
+  }
+  return track;
+}
+
+int mpc_api_version(void) {
+  return MPC_API_VERSION;
+}
+
+void mpc_config_init(mpc_config* config) {
+  ControllerOptions options;
+  config->size = sizeof(mpc_config);
+  config->backend = mpc_backend(options.backend);
+  config->horizon = options.horizon;
+  config->dt = options.dt;
+  config->dt_growth = options.dt_growth;
+  config->ref_v = options.ref_v;
+  config->latency_ms = options.latency_ms;
+  config->understeer = options.understeer;
+  const Weights& w = default_weights;
+  const double weights[7] = { w.cte, w.epsi, w.v, w.delta, w.a, w.ddelta, w.da };
+  copy(weights, weights + 7, config->weights);
+  config->warmup_solves = 8;
+}
+
+size_t mpc_parallel(size_t threads) {
+  size_t left = MPCParallelSetup(max<size_t>(threads, 1));
+  solver_thread = true;
+  return left;
+}
+
+mpc_controller* mpc_create(const mpc_config* config) {
+  if (!config || config->size != sizeof(mpc_config) || config->backend < MPC_BACKEND_IPOPT ||
+      config->backend > MPC_BACKEND_MPPI || HorizonIndex(config->horizon) == n_horizons) {
+    MPC_LOG(LogLevel::Error, "mpc_create: invalid config");
+    return NULL;
+  }
+  if (!ClaimSolverThread()) {
+    return NULL;
+  }
+  ControllerOptions options;
+  options.backend = MPCBackend(config->backend);
+  options.horizon = config->horizon;
+  options.dt = config->dt;
+  options.dt_growth = config->dt_growth;
+  options.ref_v = config->ref_v;
+  options.latency_ms = config->latency_ms;
+  options.understeer = config->understeer;
+  const double* w = config->weights;
+  Weights weights = { w[0], w[1], w[2], w[3], w[4], w[5], w[6] };
+  options.weights = make_shared<const Weights>(weights);
+  mpc_controller* mpc = new (nothrow) mpc_controller(options);
+  if (mpc && config->warmup_solves > 0) {
+    vector<double> times;
+    mpc->controller.WarmUp(WarmUpTrack(), config->warmup_solves, times);
+  }
+  return mpc;
+}
+
+int mpc_solve(mpc_controller* mpc, const mpc_frame* frame, mpc_result* result) {
+  if (!frame || !result || frame->size != sizeof(mpc_frame) || result->size != sizeof(mpc_result) ||
+      frame->n_points < 4 || !ClaimSolverThread()) {
+    return -1;
+  }
+  Telemetry& t = mpc->frame;
+  t.n_points = min(frame->n_points, Telemetry::max_points);
+  if (frame->n_points > t.n_points) {
+    CountEvent(Counter::RejectedWaypoints, frame->n_points - t.n_points);
+  }
+  copy(frame->ptsx, frame->ptsx + t.n_points, t.ptsx);
+  copy(frame->ptsy, frame->ptsy + t.n_points, t.ptsy);
+  t.px = frame->px;
+  t.py = frame->py;
+  t.psi = frame->psi;
+  t.v = frame->v;
+  t.delta = frame->delta;
+  t.a = frame->a;
+  t.received = PipelineClock::now();
+  t.arrived = t.received;
+  Command& command = mpc->command;
+  command.received = t.received;
+  command.arrived = command.received;
+  mpc->controller.Solve(t, command);
+  // The reply is out as the call returns, and acts latency_ms later.
+  mpc->controller.Delivered(command, PipelineClock::now());
+
+  const Observation& o = command.observation;
+  result->n_plan = result->plan_x && result->plan_y ? min(o.n_mpc, result->plan_capacity) : 0;
+  copy(o.mpc_x, o.mpc_x + result->n_plan, result->plan_x);
+  copy(o.mpc_y, o.mpc_y + result->n_plan, result->plan_y);
+  // The reply's steering is in the simulator's sense, opposite to the
+  // model's.
+  result->delta = -o.steering_angle;
+  result->a = o.throttle;
+  result->ok = o.ok;
+  result->cost = o.cost;
+  result->iterations = o.iterations;
+  result->solve_time = o.solve_time;
+  result->cte = o.cte;
+  result->epsi = o.epsi;
+  return 0;
+}
+
+int mpc_latest_plan(const mpc_controller* mpc, mpc_result* result) {
+  PublishedPlan plan;
+  if (!result || result->size != sizeof(mpc_result) || !mpc->controller.LatestPlan(plan)) {
+    return -1;
+  }
+  result->n_plan = result->plan_x && result->plan_y ? min(plan.n, result->plan_capacity) : 0;
+  copy(plan.x, plan.x + result->n_plan, result->plan_x);
+  copy(plan.y, plan.y + result->n_plan, result->plan_y);
+  result->delta = -plan.steering_angle;
+  result->a = plan.throttle;
+  result->ok = plan.ok;
+  result->cost = plan.cost;
+  result->iterations = plan.iterations;
+  result->solve_time = plan.solve_time;
+  result->cte = plan.cte;
+  result->epsi = plan.epsi;
+  return 0;
+}
+
+void mpc_prepare(mpc_controller* mpc) {
+  mpc->controller.Prepare();
+}
+
+void mpc_reset(mpc_controller* mpc) {
+  mpc->controller.Reset();
+}
+
+void mpc_destroy(mpc_controller* mpc) {
+  delete mpc;
+}
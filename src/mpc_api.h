@@ -0,0 +1,152 @@
+#ifndef MPC_API_H
+#define MPC_API_H
+
+#include <stddef.h>
+
+/* C interface of the controller, for callers in the same process that
+ * have no use for the websocket server or its JSON: a gateway hands over
+ * the telemetry of a frame as plain values and arrays and receives the
+ * actuators and the plan in buffers of its own.
+ *
+ *   mpc_config config;
+ *   mpc_config_init(&config);
+ *   config.backend = MPC_BACKEND_RTI;
+ *   mpc_controller* mpc = mpc_create(&config);
+ *   ...
+ *   if (mpc_solve(mpc, &frame, &result) == 0) apply(result.delta, result.a);
+ *   ...
+ *   mpc_destroy(mpc);
+ *
+ * mpc_create makes every buffer and solver of the controller and warms
+ * it up (see Controller::WarmUp), so mpc_solve allocates no more than the
+ * steady-state solve of the backend, which for most is nothing. A
+ * controller is used by one thread at a time; controllers on several
+ * threads need mpc_parallel first.
+ *
+ * The ABI is stable within MPC_API_VERSION: every struct starts with its
+ * size, as the caller was compiled, and the library refuses one of
+ * another layout instead of misreading it. Units and signs are those of
+ * the model: metres, radians, seconds and m/s, angles counterclockwise,
+ * positive steering to the left. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MPC_API_VERSION 1
+
+typedef struct mpc_controller mpc_controller;
+
+typedef enum {
+  MPC_BACKEND_IPOPT = 0,
+  MPC_BACKEND_IPOPT_KERNELS = 1,
+  MPC_BACKEND_IPOPT_AUTODIFF = 2,
+  MPC_BACKEND_RTI = 3,
+  MPC_BACKEND_RICCATI = 4,
+  MPC_BACKEND_ADMM = 5,
+  MPC_BACKEND_MPPI = 6
+} mpc_backend;
+
+typedef struct {
+  /* sizeof(mpc_config), set by mpc_config_init. */
+  size_t size;
+  mpc_backend backend;
+  /* States of the horizon, one of those compiled (7, 11, 16), and its
+   * time grid (see MPC::SetTimestep). */
+  size_t horizon;
+  double dt;
+  double dt_growth;
+  /* Reference speed, m/s. */
+  double ref_v;
+  /* Delay from the frame to the actuators taking effect, ms. */
+  int latency_ms;
+  /* Understeer of the model, 0 for the kinematic one. */
+  double understeer;
+  /* Cost weights: cte, epsi, v, delta, a, ddelta, da. */
+  double weights[7];
+  /* Solves of the warm-up in mpc_create, 0 for none. */
+  size_t warmup_solves;
+} mpc_config;
+
+typedef struct {
+  /* sizeof(mpc_frame). */
+  size_t size;
+  /* Waypoints in map coordinates, nearest first; beyond 64 are ignored. */
+  const double* ptsx;
+  const double* ptsy;
+  size_t n_points;
+  /* Pose and speed in map coordinates, and the actuators last applied. */
+  double px;
+  double py;
+  double psi;
+  double v;
+  double delta;
+  double a;
+} mpc_frame;
+
+typedef struct {
+  /* sizeof(mpc_result). */
+  size_t size;
+  /* Planned trajectory in the vehicle frame, written to plan_capacity
+   * points of the caller's plan_x and plan_y, which may be NULL with a
+   * capacity of 0; n_plan is the number written. */
+  double* plan_x;
+  double* plan_y;
+  size_t plan_capacity;
+  size_t n_plan;
+  /* The actuators to apply. */
+  double delta;
+  double a;
+  /* Whether the solver converged, and its cost, iterations and time in
+   * seconds. */
+  int ok;
+  double cost;
+  int iterations;
+  double solve_time;
+  /* Cross-track and heading errors of the state solved from. */
+  double cte;
+  double epsi;
+} mpc_result;
+
+/* MPC_API_VERSION of the library. */
+int mpc_api_version(void);
+
+/* The defaults of the controller, and config->size. */
+void mpc_config_init(mpc_config* config);
+
+/* Set up the solvers for controllers on threads threads, the calling one
+ * included, before any is created (see MPCParallelSetup); every other
+ * thread claims one on its first mpc_solve. Returns how many are left. */
+size_t mpc_parallel(size_t threads);
+
+/* A controller, or NULL when the config is invalid: an unknown backend
+ * or horizon, or a size that is not that of an mpc_config. */
+mpc_controller* mpc_create(const mpc_config* config);
+
+/* Solve a frame into result. 0 on success; -1 when the frame or the
+ * result is invalid (a size of neither, fewer than four waypoints), or
+ * the thread cannot claim a solver, leaving result as it was. A failed
+ * solve is not an error: result holds the fallback with ok = 0. */
+int mpc_solve(mpc_controller* mpc, const mpc_frame* frame, mpc_result* result);
+
+/* Copy the result of the latest mpc_solve since the create or reset into
+ * result, from any thread and while another solves: a gateway's actuation
+ * or monitoring threads read it without holding up the solver, and never
+ * see half of one solve and half of the next (see SeqLock.h). 0 on
+ * success; -1 when there is none yet or result is invalid, leaving it as
+ * it was. */
+int mpc_latest_plan(const mpc_controller* mpc, mpc_result* result);
+
+/* Get the next mpc_solve ready, between frames (see Controller::Prepare). */
+void mpc_prepare(mpc_controller* mpc);
+
+/* Start over for a new vehicle: cold solve, initial latency. */
+void mpc_reset(mpc_controller* mpc);
+
+void mpc_destroy(mpc_controller* mpc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MPC_API_H */
@@ -0,0 +1,530 @@
+// Python bindings of libmpc: batches of MPC solves, batch pose prediction
+// and the closed-loop simulator of mpc_sim, without the server.
+//
+//   import numpy as np, pympc
+//   solver = pympc.Solver(n=11, count=64, backend="rti")
+//   states = np.zeros((64, 6)); coeffs = np.zeros((64, 4))
+//   plan = np.empty((64, 6, 11)); info = np.empty((64, 4))
+//   solver.solve(states, coeffs, plan, info)
+//
+// The arrays are taken through the buffer protocol and must be C
+// contiguous float64 of the sizes given below. They are read and written
+// in place, through Eigen maps of their memory, so batches of any size
+// pass without a copy, NumPy or otherwise. The GIL is released while the
+// solvers and the simulator run, so Python threads with solvers of their
+// own solve in parallel, after pympc.parallel(threads) as with
+// MPCParallelSetup.
+#include <Python.h>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "AdaptiveHorizon.h"
+#include "BatchRiccati.h"
+#include "Controller.h"
+#include "MPC.h"
+#include "SimdKernels.h"
+#include "Track.h"
+#include "Tuning.h"
+#include "tools/Backends.h"
+#include "tools/ClosedLoop.h"
+
+using namespace std;
+
+// Whether the calling thread may use an MPC of a parallel setup: the one
+// that made the setup, or one that has called MPCSolverThread.
+static thread_local bool solver_thread = false;
+
+static bool ClaimSolverThread() {
+  if (!MPCParallel() || solver_thread) {
+    return true;
+  }
+  solver_thread = MPCSolverThread();
+  return solver_thread;
+}
+
+// A C-contiguous float64 buffer of obj holding count items, with count
+// rows when it has dimensions; false with a Python error set otherwise.
+static bool GetArray(PyObject* obj, Py_buffer& view, bool writable, size_t rows, size_t count, const char* name) {
+  int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+  if (PyObject_GetBuffer(obj, &view, flags) != 0) {
+    return false;
+  }
+  bool dtype = view.itemsize == sizeof(double) && view.format && string(view.format).find('d') != string::npos;
+  bool shape = size_t(view.len) == count * sizeof(double) && (view.ndim == 0 || size_t(view.shape[0]) == rows);
+  if (!dtype || !shape) {
+    PyErr_Format(PyExc_ValueError, "%s must be float64 with %zu rows of %zu values", name, rows, count / rows);
+    PyBuffer_Release(&view);
+    return false;
+  }
+  return true;
+}
+
+// Releases the buffers taken for a call.
+struct Buffers {
+  vector<Py_buffer> views;
+
+  ~Buffers() {
+    for (Py_buffer& view : views) {
+      PyBuffer_Release(&view);
+    }
+  }
+
+  double* Take(PyObject* obj, bool writable, size_t rows, size_t count, const char* name) {
+    Py_buffer view;
+    if (!GetArray(obj, view, writable, rows, count, name)) {
+      return NULL;
+    }
+    views.push_back(view);
+    return static_cast<double*>(view.buf);
+  }
+};
+
+// The solvers of one horizon, for the rows of a batch.
+class Horizon {
+ public:
+  virtual ~Horizon() {}
+  virtual size_t Steps() const = 0;
+  // Solve every row from its state[6] and coeffs[4]; its plan holds the
+  // six rows of N of x, y, psi, v, delta and a, and its info ok, cost,
+  // iterations and the solve time.
+  virtual void Solve(const double* states, const double* coeffs, double* plans, double* infos) = 0;
+  virtual void Reset() = 0;
+};
+
+// Write the plan of a solver of the fixed-size backends, States and
+// Inputs, in the rows of a batch.
+template <size_t N, class Plan>
+static void WritePlan(const Plan& solver, double* plan) {
+  typedef Eigen::Map<Eigen::Matrix<double, N, 1> > Row;
+  typedef Eigen::Map<Eigen::Matrix<double, N - 1, 1> > ActuatorRow;
+  typedef Eigen::Map<const Eigen::Matrix<double, N - 1, 1>, 0, Eigen::InnerStride<2> > InterleavedInputs;
+  for (int k = 0; k < 4; k++) {
+    Row(plan + k * N, N) = solver.States().row(k).transpose();
+  }
+  ActuatorRow(plan + 4 * N, N - 1) = InterleavedInputs(solver.Inputs().data());
+  ActuatorRow(plan + 5 * N, N - 1) = InterleavedInputs(solver.Inputs().data() + 1);
+  plan[5 * N - 1] = NAN;
+  plan[6 * N - 1] = NAN;
+}
+
+template <size_t N>
+class HorizonMPCs : public Horizon {
+ public:
+  HorizonMPCs(size_t count, const ControllerOptions& options, const Weights& weights) {
+    for (size_t i = 0; i < count; i++) {
+      mpcs_.emplace_back(new MPC<N>());
+      MPC<N>& mpc = *mpcs_.back();
+      mpc.Init(0, 0, options.ref_v);
+      mpc.SetBackend(options.backend);
+      mpc.SetTimestep(options.dt, options.dt_growth);
+      mpc.SetUndersteer(options.understeer);
+      mpc.SetWeights(weights);
+    }
+  }
+
+  size_t Steps() const { return N; }
+
+  void Solve(const double* states, const double* coeffs, double* plans, double* infos) {
+    typedef Eigen::Map<Eigen::Matrix<double, N, 1> > Row;
+    typedef Eigen::Map<Eigen::Matrix<double, N - 1, 1> > ActuatorRow;
+    for (size_t i = 0; i < mpcs_.size(); i++) {
+      double* plan = plans + 6 * N * i;
+      double* info = infos + 4 * i;
+      const typename MPC<N>::Result& r = mpcs_[i]->Solve(Eigen::Map<const StateVector>(states + 6 * i),
+                                                         Eigen::Map<const Eigen::Vector4d>(coeffs + 4 * i));
+      Row(plan, N) = r.x;
+      Row(plan + N, N) = r.y;
+      Row(plan + 2 * N, N) = r.psi;
+      Row(plan + 3 * N, N) = r.v;
+      ActuatorRow(plan + 4 * N, N - 1) = r.delta;
+      ActuatorRow(plan + 5 * N, N - 1) = r.a;
+      plan[5 * N - 1] = NAN;
+      plan[6 * N - 1] = NAN;
+      info[0] = r.ok;
+      info[1] = r.cost;
+      info[2] = r.iterations;
+      info[3] = r.solve_time;
+    }
+  }
+
+  void Reset() {
+    for (auto& mpc : mpcs_) {
+      mpc->Reset();
+    }
+  }
+
+ private:
+  vector<unique_ptr<MPC<N> > > mpcs_;
+};
+
+// The riccati backend: the rows are the instances of one BatchRiccati,
+// kept structure-of-arrays, instead of an MPC each.
+template <size_t N>
+class HorizonBatch : public Horizon {
+ public:
+  HorizonBatch(size_t count, size_t threads, const ControllerOptions& options, const Weights& weights)
+      : batch_(count, options.dt, Lf, options.ref_v) {
+    batch_.SetTimestep(options.dt, options.dt_growth);
+    batch_.SetUndersteer(options.understeer);
+    batch_.SetWeights(weights);
+    batch_.SetThreads(threads);
+  }
+
+  size_t Steps() const { return N; }
+
+  void Solve(const double* states, const double* coeffs, double* plans, double* infos) {
+    batch_.Solve(states, coeffs, [plans, infos](size_t i, const RiccatiSQP<N>& solver, double seconds) {
+      WritePlan<N>(solver, plans + 6 * N * i);
+      double* info = infos + 4 * i;
+      info[0] = 1;
+      info[1] = solver.Cost();
+      info[2] = solver.Iterations();
+      info[3] = seconds;
+    });
+  }
+
+  void Reset() { batch_.Reset(); }
+
+ private:
+  BatchRiccati<N> batch_;
+};
+
+static bool ParseBackend(const char* name, MPCBackend& backend) {
+  const NamedBackend* named = FindBackend(name);
+  if (!named) {
+    PyErr_Format(PyExc_ValueError, "unknown backend %s", name);
+    return false;
+  }
+  backend = named->backend;
+  return true;
+}
+
+// Weights from a sequence of the seven of Weights.h, or the defaults.
+static bool ParseWeights(PyObject* obj, Weights& weights) {
+  weights = default_weights;
+  if (!obj || obj == Py_None) {
+    return true;
+  }
+  Buffers buffers;
+  const double* w = buffers.Take(obj, false, 7, 7, "weights");
+  if (!w) {
+    return false;
+  }
+  Weights parsed = { w[0], w[1], w[2], w[3], w[4], w[5], w[6] };
+  weights = parsed;
+  return true;
+}
+
+struct SolverObject {
+  PyObject_HEAD
+  Horizon* horizon;
+  size_t count;
+  // One call at a time: every MPC is used by one thread at a time.
+  std::mutex* mutex;
+};
+
+static int SolverInit(PyObject* self, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = { "n", "count", "backend", "dt", "ref_v", "weights", "threads", NULL };
+  SolverObject* s = reinterpret_cast<SolverObject*>(self);
+  unsigned long n = 11;
+  unsigned long count = 1;
+  unsigned long threads = 1;
+  const char* backend_name = "ipopt";
+  ControllerOptions options;
+  PyObject* weights_obj = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|kksddOk", const_cast<char**>(keywords), &n, &count,
+                                   &backend_name, &options.dt, &options.ref_v, &weights_obj, &threads)) {
+    return -1;
+  }
+  Weights weights;
+  if (count == 0 || !ParseBackend(backend_name, options.backend) || !ParseWeights(weights_obj, weights)) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "count must be positive");
+    }
+    return -1;
+  }
+  if (!ClaimSolverThread()) {
+    PyErr_SetString(PyExc_RuntimeError, "no solver thread left, see pympc.parallel");
+    return -1;
+  }
+  delete s->horizon;
+  s->horizon = NULL;
+#define PYMPC_HORIZON(N)                                                   \
+  if (n == N && options.backend == MPCBackend::Riccati) {                  \
+    s->horizon = new HorizonBatch<N>(count, threads, options, weights);    \
+  } else if (n == N) {                                                     \
+    s->horizon = new HorizonMPCs<N>(count, options, weights);              \
+  }
+  MPC_FOR_EACH_HORIZON(PYMPC_HORIZON)
+#undef PYMPC_HORIZON
+  if (!s->horizon) {
+    PyErr_Format(PyExc_ValueError, "no MPC for n = %lu in this build", n);
+    return -1;
+  }
+  s->count = count;
+  if (!s->mutex) {
+    s->mutex = new std::mutex;
+  }
+  return 0;
+}
+
+static void SolverDealloc(PyObject* self) {
+  SolverObject* s = reinterpret_cast<SolverObject*>(self);
+  delete s->horizon;
+  delete s->mutex;
+  PyTypeObject* type = Py_TYPE(self);
+  type->tp_free(self);
+  Py_DECREF(type);
+}
+
+static PyObject* SolverSolve(PyObject* self, PyObject* args) {
+  SolverObject* s = reinterpret_cast<SolverObject*>(self);
+  PyObject* states_obj;
+  PyObject* coeffs_obj;
+  PyObject* plan_obj;
+  PyObject* info_obj;
+  if (!s->horizon || !PyArg_ParseTuple(args, "OOOO", &states_obj, &coeffs_obj, &plan_obj, &info_obj)) {
+    return NULL;
+  }
+  const size_t count = s->count;
+  const size_t n = s->horizon->Steps();
+  Buffers buffers;
+  const double* states = buffers.Take(states_obj, false, count, count * 6, "states");
+  const double* coeffs = states ? buffers.Take(coeffs_obj, false, count, count * 4, "coeffs") : NULL;
+  double* plan = coeffs ? buffers.Take(plan_obj, true, count, count * 6 * n, "plan") : NULL;
+  double* info = plan ? buffers.Take(info_obj, true, count, count * 4, "info") : NULL;
+  if (!info) {
+    return NULL;
+  }
+  bool claimed;
+  Py_BEGIN_ALLOW_THREADS
+  claimed = ClaimSolverThread();
+  if (claimed) {
+    lock_guard<std::mutex> lock(*s->mutex);
+    s->horizon->Solve(states, coeffs, plan, info);
+  }
+  Py_END_ALLOW_THREADS
+  if (!claimed) {
+    PyErr_SetString(PyExc_RuntimeError, "no solver thread left, see pympc.parallel");
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* SolverReset(PyObject* self, PyObject*) {
+  SolverObject* s = reinterpret_cast<SolverObject*>(self);
+  if (s->horizon) {
+    Py_BEGIN_ALLOW_THREADS
+    lock_guard<std::mutex> lock(*s->mutex);
+    s->horizon->Reset();
+    Py_END_ALLOW_THREADS
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* SolverHorizon(PyObject* self, void*) {
+  SolverObject* s = reinterpret_cast<SolverObject*>(self);
+  return PyLong_FromSize_t(s->horizon ? s->horizon->Steps() : 0);
+}
+
+static PyObject* SolverCount(PyObject* self, void*) {
+  return PyLong_FromSize_t(reinterpret_cast<SolverObject*>(self)->count);
+}
+
+static PyMethodDef solver_methods[] = {
+  { "solve", SolverSolve, METH_VARARGS,
+    "solve(states, coeffs, plan, info)\n\n"
+    "Solve every row: states (count, 6) of x, y, psi, v, cte, epsi and coeffs\n"
+    "(count, 4) of the cubic reference, in the vehicle frame. Writes plan\n"
+    "(count, 6, n), the rows x, y, psi, v, delta and a (delta and a end in\n"
+    "NaN), and info (count, 4) of ok, cost, iterations and solve seconds.\n"
+    "Each row warm starts from its last solve." },
+  { "reset", SolverReset, METH_NOARGS, "Forget the warm starts, so every row solves cold." },
+  { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef solver_getset[] = {
+  { const_cast<char*>("n"), SolverHorizon, NULL, const_cast<char*>("States of the horizon."), NULL },
+  { const_cast<char*>("count"), SolverCount, NULL, const_cast<char*>("Rows of a batch."), NULL },
+  { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyType_Slot solver_slots[] = {
+  { Py_tp_doc, const_cast<char*>("Solver(n=11, count=1, backend='ipopt', dt=0.1, ref_v=..., weights=None,\n"
+                                 "       threads=1)\n\n"
+                                 "count MPCs over n states, one per row of the batches solved. The\n"
+                                 "riccati backend keeps the rows in one batch instead, a few hundred\n"
+                                 "bytes each, and solves them on threads threads.") },
+  { Py_tp_init, reinterpret_cast<void*>(SolverInit) },
+  { Py_tp_dealloc, reinterpret_cast<void*>(SolverDealloc) },
+  { Py_tp_methods, solver_methods },
+  { Py_tp_getset, solver_getset },
+  { Py_tp_new, reinterpret_cast<void*>(PyType_GenericNew) },
+  { 0, NULL }
+};
+
+static PyType_Spec solver_spec = { "pympc.Solver", sizeof(SolverObject), 0, Py_TPFLAGS_DEFAULT, solver_slots };
+
+static PyObject* Predict(PyObject*, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = { "x", "y", "psi", "v", "delta", "a", "dt", "understeer", NULL };
+  PyObject* objs[6];
+  double dt;
+  double understeer = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOd|d", const_cast<char**>(keywords), &objs[0], &objs[1],
+                                   &objs[2], &objs[3], &objs[4], &objs[5], &dt, &understeer)) {
+    return NULL;
+  }
+  Py_buffer first;
+  if (PyObject_GetBuffer(objs[0], &first, PyBUF_C_CONTIGUOUS) != 0) {
+    return NULL;
+  }
+  const size_t n = size_t(first.len) / sizeof(double);
+  PyBuffer_Release(&first);
+  static const char* names[] = { "x", "y", "psi", "v", "delta", "a" };
+  Buffers buffers;
+  double* arrays[6];
+  for (int k = 0; k < 6; k++) {
+    arrays[k] = buffers.Take(objs[k], k < 4, n, n, names[k]);
+    if (!arrays[k]) {
+      return NULL;
+    }
+  }
+  PoseArrays poses = { n, arrays[0], arrays[1], arrays[2], arrays[3], arrays[4], arrays[5] };
+  Py_BEGIN_ALLOW_THREADS
+  MPC<11>::PredictBatch(poses, dt, understeer);
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+// A read-only float64 memoryview of a copy of values.
+static PyObject* DoubleView(const vector<double>& values) {
+  PyObject* bytes = PyBytes_FromStringAndSize(reinterpret_cast<const char*>(values.data()),
+                                              Py_ssize_t(values.size() * sizeof(double)));
+  if (!bytes) {
+    return NULL;
+  }
+  PyObject* view = PyMemoryView_FromObject(bytes);
+  Py_DECREF(bytes);
+  if (!view) {
+    return NULL;
+  }
+  PyObject* cast = PyObject_CallMethod(view, "cast", "s", "d");
+  Py_DECREF(view);
+  return cast;
+}
+
+static PyObject* Simulate(PyObject*, PyObject* args, PyObject* kwargs) {
+  static const char* keywords[] = { "track_x", "track_y", "n", "backend", "laps", "latency", "period",
+                                    "ref_v", "dt", "weights", NULL };
+  PyObject* x_obj;
+  PyObject* y_obj;
+  unsigned long n = 11;
+  const char* backend_name = "ipopt";
+  ClosedLoopSettings settings;
+  ControllerOptions options;
+  PyObject* weights_obj = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ksidddbO", const_cast<char**>(keywords), &x_obj, &y_obj,
+                                   &n, &backend_name, &settings.laps, &settings.latency, &settings.period,
+                                   &options.ref_v, &options.dt, &weights_obj)) {
+    return NULL;
+  }
+  Weights weights;
+  if (!ParseBackend(backend_name, options.backend) || !ParseWeights(weights_obj, weights)) {
+    return NULL;
+  }
+  if (HorizonIndex(n) == n_horizons) {
+    PyErr_Format(PyExc_ValueError, "no MPC for n = %lu in this build", n);
+    return NULL;
+  }
+  options.horizon = n;
+  options.weights = make_shared<const Weights>(weights);
+  Py_buffer x_view;
+  if (PyObject_GetBuffer(x_obj, &x_view, PyBUF_C_CONTIGUOUS) != 0) {
+    return NULL;
+  }
+  const size_t points = size_t(x_view.len) / sizeof(double);
+  PyBuffer_Release(&x_view);
+  Buffers buffers;
+  const double* xs = buffers.Take(x_obj, false, points, points, "track_x");
+  const double* ys = xs ? buffers.Take(y_obj, false, points, points, "track_y") : NULL;
+  if (!ys || points < 2) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "the track needs two waypoints or more");
+    }
+    return NULL;
+  }
+  Track track;
+  track.x.assign(xs, xs + points);
+  track.y.assign(ys, ys + points);
+  ClosedLoopResult result;
+  bool claimed;
+  Py_BEGIN_ALLOW_THREADS
+  claimed = ClaimSolverThread();
+  if (claimed) {
+    result = RunClosedLoop(track, settings, options);
+  }
+  Py_END_ALLOW_THREADS
+  if (!claimed) {
+    PyErr_SetString(PyExc_RuntimeError, "no solver thread left, see pympc.parallel");
+    return NULL;
+  }
+  PyObject* lap_times = DoubleView(result.lap_times);
+  PyObject* solve_times = lap_times ? DoubleView(result.solve_times) : NULL;
+  if (!solve_times) {
+    Py_XDECREF(lap_times);
+    return NULL;
+  }
+  return Py_BuildValue("{s:d,s:d,s:d,s:n,s:N,s:N,s:d,s:d,s:d,s:O}", "laps", result.laps, "time", result.time,
+                       "wall", result.wall, "solves", Py_ssize_t(result.solves), "lap_times", lap_times,
+                       "solve_times", solve_times, "offset_mean", result.offset_mean, "offset_max",
+                       result.offset_max, "speed_mean", result.speed_mean, "off_track",
+                       result.off_track ? Py_True : Py_False);
+}
+
+static PyObject* Parallel(PyObject*, PyObject* args) {
+  unsigned long threads;
+  if (!PyArg_ParseTuple(args, "k", &threads)) {
+    return NULL;
+  }
+  size_t left = MPCParallelSetup(max<size_t>(threads, 1));
+  solver_thread = true;
+  return PyLong_FromSize_t(left);
+}
+
+static PyMethodDef module_methods[] = {
+  { "predict", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)(void)>(Predict)), METH_VARARGS | METH_KEYWORDS,
+    "predict(x, y, psi, v, delta, a, dt, understeer=0)\n\n"
+    "Advance the poses of a batch by dt under the actuators with the\n"
+    "kinematic model, in place on x, y, psi and v (MPC::PredictBatch)." },
+  { "simulate", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)(void)>(Simulate)),
+    METH_VARARGS | METH_KEYWORDS,
+    "simulate(track_x, track_y, n=11, backend='ipopt', laps=1, latency=0.1, period=0.05,\n"
+    "         ref_v=..., dt=0.1, weights=None)\n\n"
+    "Drive the closed loop of mpc_sim around the track and return its\n"
+    "result as a dict; lap_times and solve_times are float64 memoryviews." },
+  { "parallel", Parallel, METH_VARARGS,
+    "parallel(threads)\n\n"
+    "Set up CppAD for solvers on threads threads, the calling one included,\n"
+    "before any solver is made (MPCParallelSetup). Every other thread claims\n"
+    "one on its first solve. Returns how many are left." },
+  { NULL, NULL, 0, NULL }
+};
+
+static PyModuleDef module = { PyModuleDef_HEAD_INIT, "pympc", "Bindings of libmpc.", -1, module_methods,
+                              NULL, NULL, NULL, NULL };
+
+PyMODINIT_FUNC PyInit_pympc() {
+  PyObject* m = PyModule_Create(&module);
+  if (!m) {
+    return NULL;
+  }
+  PyObject* solver = PyType_FromSpec(&solver_spec);
+  if (!solver || PyModule_AddObject(m, "Solver", solver) != 0) {
+    Py_XDECREF(solver);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
@@ -0,0 +1,35 @@
+#ifndef TOOLS_BACKENDS_H
+#define TOOLS_BACKENDS_H
+
+#include <string>
+#include "MPC.h"
+
+// Command-line names of the MPC backends, for the offline tools.
+struct NamedBackend {
+  const char* name;
+  MPC<11>::Backend backend;
+};
+
+static const NamedBackend named_backends[] = {
+  { "ipopt", MPC<11>::Backend::Ipopt },
+  { "kernels", MPC<11>::Backend::IpoptKernels },
+  { "autodiff", MPC<11>::Backend::IpoptAutoDiff },
+  { "rti", MPC<11>::Backend::RTI },
+  { "riccati", MPC<11>::Backend::Riccati },
+  { "admm", MPC<11>::Backend::ADMM },
+  { "mppi", MPC<11>::Backend::MPPI },
+};
+
+static const size_t n_named_backends = sizeof(named_backends) / sizeof(named_backends[0]);
+
+// The backend called name; NULL when there is none.
+inline const NamedBackend* FindBackend(const std::string& name) {
+  for (size_t i = 0; i < n_named_backends; i++) {
+    if (name == named_backends[i].name) {
+      return &named_backends[i];
+    }
+  }
+  return NULL;
+}
+
+#endif /* TOOLS_BACKENDS_H */
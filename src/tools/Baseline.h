@@ -0,0 +1,135 @@
+#ifndef TOOLS_BASELINE_H
+#define TOOLS_BASELINE_H
+
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ClosedLoop.h"
+
+// Performance gate of mpc_sim --baseline: limits a closed-loop run must
+// stay within, kept in a text file of "name value" lines (# starts a
+// comment), e.g.
+//
+//   p99_solve_ms 4.5
+//   allocs_per_frame 0
+//   lap_time_s 58.2
+//
+// mpc_sim --write-baseline writes one from a run, with margins over what
+// the run measured so that the noise of the machine does not fail it.
+// The allocations are those of the frames after the first, and only
+// counted in builds with MPC_COUNT_ALLOCS; otherwise they are 0 and pass
+// trivially.
+struct PerfBaseline {
+  double p99_solve_ms;
+  double allocs_per_frame;
+  // Of the slowest completed lap, in simulated time.
+  double lap_time_s;
+
+  PerfBaseline() : p99_solve_ms(0), allocs_per_frame(0), lap_time_s(0) {}
+};
+
+namespace baseline {
+
+// Margins of a written baseline over the measurements.
+static const double solve_margin = 1.25;
+static const double lap_margin = 1.02;
+
+inline double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t i = size_t(p * (values.size() - 1) + 0.5);
+  return values[std::min(i, values.size() - 1)];
+}
+
+}  // namespace baseline
+
+// What the gate looks at of a run. The first solve, which records the
+// tapes and initializes the solver, is left out of the solve times.
+inline PerfBaseline Measure(const ClosedLoopResult& result) {
+  PerfBaseline measured;
+  std::vector<double> times(result.solve_times.begin() + std::min<size_t>(result.solve_times.size(), 1),
+                            result.solve_times.end());
+  measured.p99_solve_ms = baseline::Percentile(times, 0.99) * 1e3;
+  measured.allocs_per_frame = double(result.steady_allocs) / (std::max<size_t>(result.solves, 2) - 1);
+  for (size_t i = 0; i < result.lap_times.size(); i++) {
+    measured.lap_time_s = std::max(measured.lap_time_s, result.lap_times[i]);
+  }
+  return measured;
+}
+
+// Read the limits at path. Names left out are not checked; an unknown
+// name or a bad value is an error.
+inline bool LoadBaseline(const std::string& path, PerfBaseline& limits, std::string& error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    error = "cannot read " + path;
+    return false;
+  }
+  limits = PerfBaseline();
+  std::string line;
+  for (int number = 1; std::getline(in, line); number++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string name;
+    double value;
+    if (!(fields >> name)) {
+      continue;
+    }
+    if (!(fields >> value) || value < 0) {
+      error = path + ":" + std::to_string(number) + ": bad value of " + name;
+      return false;
+    }
+    if (name == "p99_solve_ms") {
+      limits.p99_solve_ms = value;
+    } else if (name == "allocs_per_frame") {
+      limits.allocs_per_frame = value;
+    } else if (name == "lap_time_s") {
+      limits.lap_time_s = value;
+    } else {
+      error = path + ":" + std::to_string(number) + ": unknown limit " + name;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Write the limits for a run that measured measured.
+inline bool SaveBaseline(const std::string& path, const PerfBaseline& measured) {
+  std::ofstream out(path.c_str());
+  out << "# Limits of mpc_sim --baseline, written by --write-baseline\n";
+  out << "p99_solve_ms " << measured.p99_solve_ms * baseline::solve_margin << "\n";
+  out << "allocs_per_frame " << measured.allocs_per_frame << "\n";
+  out << "lap_time_s " << measured.lap_time_s * baseline::lap_margin << "\n";
+  return bool(out);
+}
+
+// Print every limit with its measurement, and return whether all hold. A
+// limit of 0 is not checked, except for the allocations, where it is the
+// goal; with no completed lap the lap time fails.
+inline bool CheckBaseline(const PerfBaseline& limits, const PerfBaseline& measured, size_t laps) {
+  bool ok = true;
+  if (limits.p99_solve_ms > 0) {
+    bool pass = measured.p99_solve_ms <= limits.p99_solve_ms;
+    printf("p99 solve time %.3f ms, limit %.3f ms: %s\n", measured.p99_solve_ms, limits.p99_solve_ms,
+           pass ? "ok" : "REGRESSED");
+    ok = ok && pass;
+  }
+  bool pass = measured.allocs_per_frame <= limits.allocs_per_frame;
+  printf("allocations per frame %.2f, limit %.2f: %s\n", measured.allocs_per_frame,
+         limits.allocs_per_frame, pass ? "ok" : "REGRESSED");
+  ok = ok && pass;
+  if (limits.lap_time_s > 0) {
+    pass = laps > 0 && measured.lap_time_s <= limits.lap_time_s;
+    printf("slowest lap %.2f s, limit %.2f s: %s\n", measured.lap_time_s, limits.lap_time_s,
+           pass ? "ok" : "REGRESSED");
+    ok = ok && pass;
+  }
+  return ok;
+}
+
+#endif /* TOOLS_BASELINE_H */
@@ -0,0 +1,243 @@
+#ifndef TOOLS_CLOSED_LOOP_H
+#define TOOLS_CLOSED_LOOP_H
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "AllocCount.h"
+#include "BinaryProtocol.h"
+#include "Controller.h"
+#include "Track.h"
+
+// The closed loop of mpc_sim, shared with mpc_sweep: the kinematic model of
+// MPC::PredictBatch driven around a Track by a Controller, with no websocket.
+//
+// Every period of simulated time the vehicle sends a frame with the six
+// waypoints nearest to it; its reply takes effect latency later, as the
+// simulator's actuators do. Simulated time does not wait for the solver,
+// so a run is deterministic for a given set of options.
+
+struct ClosedLoopSettings {
+  int laps;
+  // Actuator latency and frame period, in seconds.
+  double latency;
+  double period;
+  // Understeer of the vehicle (see YawGain, Kinematics.h), 0 for the
+  // kinematic model.
+  double understeer;
+
+  ClosedLoopSettings() : laps(1), latency(0.1), period(0.05), understeer(0) {}
+};
+
+struct ClosedLoopResult {
+  // Laps driven, possibly a fraction, and simulated and wall time.
+  double laps;
+  double time;
+  double wall;
+  size_t solves;
+  // Simulated time of each completed lap.
+  std::vector<double> lap_times;
+  // Wall time of every Controller::Solve, in seconds, and the heap
+  // allocations of them all (see AllocCount.h); then those of the solves
+  // after the first, which records the tapes and sizes the buffers, in all
+  // and by stage.
+  std::vector<double> solve_times;
+  size_t allocs;
+  size_t steady_allocs;
+  uint64_t stage_allocs[n_stages + 1];
+  // Distance from the line, in metres, after every frame.
+  double offset_mean;
+  double offset_max;
+  double speed_mean;
+  // Whether the vehicle left the track or stopped making progress, and
+  // where it ended.
+  bool off_track;
+  double px;
+  double py;
+};
+
+namespace closed_loop {
+
+// Waypoints in every frame, as the simulator sends.
+static const size_t window = 6;
+
+// Integration step of the vehicle.
+static const double sim_step = 0.01;
+
+// Farther than this from the line, in metres, is off the track.
+static const double max_offset = 5;
+
+// A vehicle that takes longer over a lap is stuck.
+static const double max_lap_time = 600;
+
+// A reply waiting for the actuator latency.
+struct Pending {
+  double at;
+  double delta;
+  double a;
+};
+
+// Distance from (px, py) to the segment from waypoint i to the next.
+inline double Offset(const Track& track, size_t i, double px, double py) {
+  size_t j = (i + 1) % track.Size();
+  double ax = track.x[i];
+  double ay = track.y[i];
+  double dx = track.x[j] - ax;
+  double dy = track.y[j] - ay;
+  double u = ((px - ax) * dx + (py - ay) * dy) / (dx * dx + dy * dy);
+  u = std::max(0.0, std::min(u, 1.0));
+  return hypot(px - ax - u * dx, py - ay - u * dy);
+}
+
+// Advance i to the waypoint nearest to (px, py), searching forward only,
+// and return how many waypoints it moved.
+inline size_t Advance(const Track& track, size_t& i, double px, double py) {
+  size_t moved = 0;
+  for (;;) {
+    size_t j = (i + 1) % track.Size();
+    if (hypot(track.x[j] - px, track.y[j] - py) >= hypot(track.x[i] - px, track.y[i] - py)) {
+      return moved;
+    }
+    i = j;
+    moved++;
+  }
+}
+
+}  // namespace closed_loop
+
+// Drive settings.laps laps of track from rest at the first waypoint, or
+// until the vehicle leaves the track. The controller compensates for the
+// emulated latency alone, since nothing else delays a reply here, so the
+// latency_ms of options is replaced.
+inline ClosedLoopResult RunClosedLoop(const Track& track, const ClosedLoopSettings& settings,
+                                      ControllerOptions options) {
+  using namespace closed_loop;
+  using namespace std::chrono;
+
+  options.latency_ms = int(settings.latency * 1000 + 0.5);
+  Controller controller(options);
+
+  PoseVector state;
+  state << track.x[0], track.y[0], track.Heading(0), 0;
+  ActuatorVector actuators;
+  actuators << 0, 0;
+  PoseArrays pose = { 1, &state(0), &state(1), &state(2), &state(3), &actuators(0), &actuators(1) };
+  std::deque<Pending> pending;
+
+  Telemetry frame;
+  frame.ws = NULL;
+  frame.framing = Framing::Binary64;
+  frame.n_points = window;
+  Command command;
+  command.ws = NULL;
+  command.framing = Framing::Binary64;
+
+  ClosedLoopResult result;
+  result.solves = 0;
+  result.allocs = 0;
+  result.steady_allocs = 0;
+  std::fill(result.stage_allocs, result.stage_allocs + n_stages + 1, 0);
+  result.off_track = false;
+  double offset_sum = 0;
+  double speed_sum = 0;
+  result.offset_max = 0;
+
+  // Frames are stamped in simulated time from an arbitrary epoch.
+  const PipelineClock::time_point epoch = PipelineClock::now();
+  size_t waypoint = 0;
+  size_t progress = 0;
+  double t = 0;
+  const size_t goal = size_t(settings.laps) * track.Size();
+
+  PipelineClock::time_point start = PipelineClock::now();
+  while (progress < goal) {
+    // Telemetry of the current state, nearest waypoints first.
+    track.Window(waypoint, window, frame.ptsx, frame.ptsy);
+    frame.px = state(0);
+    frame.py = state(1);
+    frame.psi = state(2);
+    frame.v = state(3);
+    frame.delta = actuators(0);
+    frame.a = actuators(1);
+    frame.received = epoch + duration_cast<PipelineClock::duration>(duration<double>(t));
+    frame.arrived = frame.received;
+
+    command.received = frame.received;
+    command.arrived = command.received;
+    size_t allocs_before = AllocCount();
+    StageAllocs stages_before = AllocsByStage();
+    PipelineClock::time_point solve_start = PipelineClock::now();
+    controller.Solve(frame, command);
+    PipelineClock::time_point solve_end = PipelineClock::now();
+    size_t allocs = AllocCount() - allocs_before;
+    result.allocs += allocs;
+    if (result.solves > 0) {
+      StageAllocs stages = AllocsByStage();
+      result.steady_allocs += allocs;
+      for (int s = 0; s <= n_stages; s++) {
+        result.stage_allocs[s] += stages.count[s] - stages_before.count[s];
+      }
+    }
+    result.solve_times.push_back(duration<double>(solve_end - solve_start).count());
+    controller.Delivered(command, command.received);
+    result.solves++;
+    // As MPCBatch does once the reply is out; not part of the solve time.
+    controller.Prepare();
+
+    // A command frame starts with the steering angle and the throttle.
+    double steering;
+    double throttle;
+    memcpy(&steering, command.msg.data() + binary_header_size, sizeof(double));
+    memcpy(&throttle, command.msg.data() + binary_header_size + sizeof(double), sizeof(double));
+    // The reply's steering is in the simulator's sense, opposite to the
+    // model's.
+    Pending reply = { t + settings.latency, -steering, throttle };
+    pending.push_back(reply);
+
+    // Drive until the next frame, applying replies as they come due.
+    for (double end = t + settings.period; t < end - 1e-9;) {
+      while (!pending.empty() && pending.front().at <= t + 1e-9) {
+        actuators << pending.front().delta, pending.front().a;
+        pending.pop_front();
+      }
+      double step = std::min(sim_step, end - t);
+      MPC<11>::PredictBatch(pose, step, settings.understeer);
+      t += step;
+    }
+
+    size_t laps_before = progress / track.Size();
+    progress += Advance(track, waypoint, state(0), state(1));
+    if (progress / track.Size() > laps_before) {
+      result.lap_times.push_back(t);
+    }
+    double offset = std::min(Offset(track, waypoint, state(0), state(1)),
+                             Offset(track, (waypoint + track.Size() - 1) % track.Size(), state(0), state(1)));
+    offset_sum += offset;
+    speed_sum += state(3);
+    result.offset_max = std::max(result.offset_max, offset);
+    if (offset > max_offset || t > settings.laps * max_lap_time) {
+      result.off_track = true;
+      break;
+    }
+  }
+  result.wall = duration<double>(PipelineClock::now() - start).count();
+
+  // The lap ends were recorded in simulated time since the start.
+  for (size_t i = result.lap_times.size(); i-- > 1;) {
+    result.lap_times[i] -= result.lap_times[i - 1];
+  }
+  result.laps = double(progress) / track.Size();
+  result.time = t;
+  size_t frames = std::max(result.solves, size_t(1));
+  result.offset_mean = offset_sum / frames;
+  result.speed_mean = speed_sum / frames;
+  result.px = state(0);
+  result.py = state(1);
+  return result;
+}
+
+#endif /* TOOLS_CLOSED_LOOP_H */
@@ -0,0 +1,140 @@
+#ifndef LINE_SOCKET_H
+#define LINE_SOCKET_H
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+
+// TCP connections that carry text lines, for the coordinator and workers
+// of mpc_sweep. POSIX sockets only.
+
+// A socket listening on port on every interface, or -1.
+inline int ListenTcp(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(uint16_t(port));
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 64) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Lines go out as soon as they are written, and a peer that vanishes
+// without closing is found by the keepalive probes within about a minute.
+inline void SetLineOptions(int fd) {
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+#ifdef TCP_KEEPIDLE
+  int idle = 30;
+  int interval = 10;
+  int count = 3;
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+}
+
+// A connection to HOST:PORT, or -1.
+inline int ConnectTcp(const std::string& host_port) {
+  size_t colon = host_port.rfind(':');
+  if (colon == std::string::npos) {
+    return -1;
+  }
+  std::string host = host_port.substr(0, colon);
+  std::string port = host_port.substr(colon + 1);
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* found = NULL;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(found);
+  if (fd >= 0) {
+    SetLineOptions(fd);
+  }
+  return fd;
+}
+
+// Write line and its newline whole. False when the peer is gone.
+inline bool SendLine(int fd, const std::string& line) {
+  std::string out = line + '\n';
+  size_t sent = 0;
+  while (sent < out.size()) {
+    ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += size_t(n);
+  }
+  return true;
+}
+
+// The lines read from a connection, split as they arrive.
+class LineReader {
+ public:
+  explicit LineReader(int fd) : fd_(fd) {}
+
+  // Read what has arrived, blocking until something has. False at the end
+  // of the stream or on an error.
+  bool Fill() {
+    char buffer[4096];
+    ssize_t n = recv(fd_, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      return false;
+    }
+    pending_.append(buffer, size_t(n));
+    return true;
+  }
+
+  // The next whole line without its newline, if one has arrived.
+  bool Next(std::string& line) {
+    size_t end = pending_.find('\n');
+    if (end == std::string::npos) {
+      return false;
+    }
+    line.assign(pending_, 0, end);
+    pending_.erase(0, end + 1);
+    return true;
+  }
+
+  // The next line, reading until it arrives. False when the stream ends
+  // first.
+  bool ReadLine(std::string& line) {
+    while (!Next(line)) {
+      if (!Fill()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  int fd_;
+  std::string pending_;
+};
+
+#endif /* LINE_SOCKET_H */
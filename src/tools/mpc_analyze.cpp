@@ -0,0 +1,315 @@
+// Summarizes run logs written by mpc --run-log (RunLog.h): the stage and
+// solve time percentiles, the distribution of solver iterations, the
+// cross-track and heading error statistics and the worst frames.
+//
+//   mpc_analyze LOG... [--threads T] [--worst K]
+//
+// Every log is mapped into memory and its chunks are summarized in
+// parallel on T threads (default: one per core), each chunk reading only
+// the columns summarized and letting its pages go after. The percentiles
+// come from histograms of logarithmic buckets 1% wide, so they are exact
+// to within 1%. Prints the K (default 10) frames of the longest solve
+// stage and of the largest |cte|, with their log, vehicle and time.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "RunLog.h"
+
+using namespace std;
+
+// The columns read, and the timings among them, in seconds: the stages
+// and the latency estimate.
+enum Column { Vehicle, Time, Ok, Iterations, Cte, Epsi, Transform, Polyfit, SolveStage, Solve, Format, Latency, n_columns };
+static const char* const column_names[n_columns] = { "vehicle", "time", "ok", "iterations", "cte", "epsi",
+                                                     "transform_time", "polyfit_time", "solve_stage_time",
+                                                     "solve_time", "format_time", "latency" };
+static const int first_timing = Transform;
+static const int n_timings = n_columns - first_timing;
+
+// Iterations counted one by one; more go into the last bucket.
+static const int max_iterations = 200;
+
+// Logarithmic histogram of positive values from floor up, buckets 1% wide.
+class LogHistogram {
+ public:
+  explicit LogHistogram(double floor = 1e-9) : floor_(floor), count_(0), sum_(0), max_(0), buckets_(n_buckets) {}
+
+  void Add(double value) {
+    value = fabs(value);
+    if (!(value == value)) {
+      return;
+    }
+    double scaled = value / floor_;
+    size_t bucket = scaled <= 1 ? 0 : min<size_t>(size_t(log(scaled) / log_width) + 1, n_buckets - 1);
+    buckets_[bucket]++;
+    count_++;
+    sum_ += value;
+    max_ = max(max_, value);
+  }
+
+  void Merge(const LogHistogram& other) {
+    for (size_t b = 0; b < n_buckets; b++) {
+      buckets_[b] += other.buckets_[b];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = max(max_, other.max_);
+  }
+
+  // The upper bound of the bucket of the p quantile, at most the maximum.
+  double Quantile(double p) const {
+    size_t rank = size_t(ceil(p * count_));
+    size_t seen = 0;
+    for (size_t b = 0; b < n_buckets; b++) {
+      seen += buckets_[b];
+      if (seen >= rank && seen > 0) {
+        return min(floor_ * exp(b * log_width), max_);
+      }
+    }
+    return max_;
+  }
+
+  size_t Count() const { return count_; }
+  double Mean() const { return count_ ? sum_ / count_ : 0; }
+  double Max() const { return max_; }
+
+ private:
+  // Up to 1e12 times the floor.
+  static const size_t n_buckets = 2800;
+  static constexpr double log_width = 0.00995033;  // log(1.01)
+
+  double floor_;
+  size_t count_;
+  double sum_;
+  double max_;
+  vector<size_t> buckets_;
+};
+
+struct Worst {
+  double value;
+  size_t log;
+  int vehicle;
+  double time;
+
+  bool operator<(const Worst& other) const { return value > other.value; }
+};
+
+// Keeps the k largest values seen.
+static void Keep(vector<Worst>& worst, size_t k, const Worst& frame) {
+  if (worst.size() < k) {
+    worst.push_back(frame);
+    push_heap(worst.begin(), worst.end());
+  } else if (k > 0 && frame.value > worst.front().value) {
+    pop_heap(worst.begin(), worst.end());
+    worst.back() = frame;
+    push_heap(worst.begin(), worst.end());
+  }
+}
+
+// What a thread gathers over the chunks it takes, merged at the end.
+struct Summary {
+  size_t frames;
+  size_t failures;
+  double cte_squares;
+  double epsi_squares;
+  LogHistogram timings[n_timings];
+  LogHistogram cte;
+  LogHistogram epsi;
+  vector<size_t> iterations;
+  vector<Worst> slowest;
+  vector<Worst> farthest;
+
+  Summary()
+      : frames(0), failures(0), cte_squares(0), epsi_squares(0), cte(1e-6), epsi(1e-7), iterations(max_iterations + 2) {}
+
+  void Merge(const Summary& other, size_t k) {
+    frames += other.frames;
+    failures += other.failures;
+    cte_squares += other.cte_squares;
+    epsi_squares += other.epsi_squares;
+    for (int t = 0; t < n_timings; t++) {
+      timings[t].Merge(other.timings[t]);
+    }
+    cte.Merge(other.cte);
+    epsi.Merge(other.epsi);
+    for (size_t i = 0; i < iterations.size(); i++) {
+      iterations[i] += other.iterations[i];
+    }
+    for (const Worst& frame : other.slowest) {
+      Keep(slowest, k, frame);
+    }
+    for (const Worst& frame : other.farthest) {
+      Keep(farthest, k, frame);
+    }
+  }
+};
+
+struct Task {
+  size_t log;
+  size_t chunk;
+};
+
+static void SummarizeChunk(const RunLogReader& log, const size_t* columns, const Task& task, size_t k,
+                           vector<double>* values, Summary& summary) {
+  for (int c = 0; c < n_columns; c++) {
+    log.ReadColumn(task.chunk, columns[c], values[c]);
+  }
+  const size_t rows = log.Rows(task.chunk);
+  for (size_t r = 0; r < rows; r++) {
+    summary.frames++;
+    summary.failures += values[Ok][r] == 0;
+    for (int t = 0; t < n_timings; t++) {
+      summary.timings[t].Add(values[first_timing + t][r]);
+    }
+    double cte = values[Cte][r];
+    double epsi = values[Epsi][r];
+    summary.cte.Add(cte);
+    summary.epsi.Add(epsi);
+    summary.cte_squares += cte * cte;
+    summary.epsi_squares += epsi * epsi;
+    int iterations = max(int(values[Iterations][r]), -1);
+    summary.iterations[min(iterations, max_iterations) + 1]++;
+    Worst frame = { values[SolveStage][r], task.log, int(values[Vehicle][r]), values[Time][r] };
+    Keep(summary.slowest, k, frame);
+    frame.value = fabs(cte);
+    Keep(summary.farthest, k, frame);
+  }
+  log.Release(task.chunk);
+}
+
+static void PrintWorst(const char* title, vector<Worst> worst, const vector<string>& paths, double scale,
+                       const char* unit) {
+  sort(worst.begin(), worst.end());
+  printf("\n%s\n", title);
+  for (const Worst& frame : worst) {
+    printf("  %10.3f %s  %s vehicle %d at %.3f s\n", frame.value * scale, unit, paths[frame.log].c_str(),
+           frame.vehicle, frame.time);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  vector<string> paths;
+  size_t threads = max<size_t>(thread::hardware_concurrency(), 1);
+  size_t k = 10;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      threads = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--worst" && i + 1 < argc) {
+      k = size_t(max(atoi(argv[++i]), 0));
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "usage: %s LOG... [--threads T] [--worst K]\n", argv[0]);
+    return 2;
+  }
+
+  Eigen::BenchTimer timer;
+  timer.start();
+  vector<unique_ptr<RunLogReader> > logs;
+  vector<size_t> columns;
+  vector<Task> tasks;
+  for (size_t l = 0; l < paths.size(); l++) {
+    logs.emplace_back(new RunLogReader);
+    RunLogReader& log = *logs.back();
+    if (!log.Open(paths[l])) {
+      fprintf(stderr, "Failed to read the run log %s\n", paths[l].c_str());
+      return 1;
+    }
+    for (int c = 0; c < n_columns; c++) {
+      columns.push_back(log.Find(column_names[c]));
+      if (columns.back() == log.Columns().size()) {
+        fprintf(stderr, "No column %s in %s\n", column_names[c], paths[l].c_str());
+        return 1;
+      }
+    }
+    for (size_t chunk = 0; chunk < log.Chunks(); chunk++) {
+      tasks.push_back({ l, chunk });
+    }
+  }
+
+  // Each thread takes the next chunk until none is left.
+  threads = min(threads, max<size_t>(tasks.size(), 1));
+  vector<Summary> summaries(threads);
+  atomic<size_t> next(0);
+  vector<thread> pool;
+  for (size_t t = 0; t < threads; t++) {
+    pool.emplace_back([&, t]() {
+      vector<double> values[n_columns];
+      for (size_t i; (i = next++) < tasks.size();) {
+        const Task& task = tasks[i];
+        SummarizeChunk(*logs[task.log], &columns[task.log * n_columns], task, k, values, summaries[t]);
+      }
+    });
+  }
+  for (auto& worker : pool) {
+    worker.join();
+  }
+  Summary total;
+  for (const Summary& summary : summaries) {
+    total.Merge(summary, k);
+  }
+  timer.stop();
+
+  printf("%zu frames in %zu logs, %zu chunks, summarized in %.3f s on %zu threads\n", total.frames, paths.size(),
+         tasks.size(), timer.value(Eigen::REAL_TIMER), threads);
+  if (total.frames == 0) {
+    return 0;
+  }
+  printf("%zu failed solves (%.2f%%)\n", total.failures, 100.0 * total.failures / total.frames);
+
+  printf("\n%-18s %9s %9s %9s %9s %9s %9s\n", "ms", "mean", "p50", "p90", "p99", "p99.9", "max");
+  for (int t = 0; t < n_timings; t++) {
+    const LogHistogram& h = total.timings[t];
+    const char* name = column_names[first_timing + t];
+    printf("%-18s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, h.Mean() * 1e3, h.Quantile(0.5) * 1e3,
+           h.Quantile(0.9) * 1e3, h.Quantile(0.99) * 1e3, h.Quantile(0.999) * 1e3, h.Max() * 1e3);
+  }
+
+  printf("\n%-18s %9s %9s %9s %9s %9s %9s\n", "error", "mean", "rms", "p50", "p95", "p99", "max");
+  printf("%-18s %9.4f %9.4f %9.4f %9.4f %9.4f %9.4f\n", "|cte| m", total.cte.Mean(),
+         sqrt(total.cte_squares / total.frames), total.cte.Quantile(0.5), total.cte.Quantile(0.95),
+         total.cte.Quantile(0.99), total.cte.Max());
+  printf("%-18s %9.4f %9.4f %9.4f %9.4f %9.4f %9.4f\n", "|epsi| rad", total.epsi.Mean(),
+         sqrt(total.epsi_squares / total.frames), total.epsi.Quantile(0.5), total.epsi.Quantile(0.95),
+         total.epsi.Quantile(0.99), total.epsi.Max());
+
+  printf("\n%-12s %10s %8s\n", "iterations", "frames", "share");
+  size_t iterated = 0;
+  double iterations = 0;
+  for (size_t i = 0; i < total.iterations.size(); i++) {
+    size_t n = total.iterations[i];
+    if (n == 0) {
+      continue;
+    }
+    int count = int(i) - 1;
+    if (count < 0) {
+      printf("%-12s", "none");
+    } else if (count == max_iterations) {
+      printf(">=%-10d", max_iterations);
+    } else {
+      printf("%-12d", count);
+    }
+    printf(" %10zu %7.2f%%\n", n, 100.0 * n / total.frames);
+    if (count >= 0) {
+      iterated += n;
+      iterations += double(count) * n;
+    }
+  }
+  if (iterated > 0) {
+    printf("mean %.2f iterations\n", iterations / iterated);
+  }
+
+  PrintWorst("Longest solve stages", total.slowest, paths, 1e3, "ms");
+  PrintWorst("Largest |cte|", total.farthest, paths, 1, "m ");
+  return 0;
+}
@@ -0,0 +1,145 @@
+// Solver benchmark: times MPC<11>::Solve on states and reference
+// polynomials taken around lake_track_waypoints.csv.
+//
+//   mpc_bench [--track FILE] [--reps R] [--backend NAME]...
+//
+// A case is a pose at a waypoint, offset sideways from the line, at one
+// of several speeds, with the reference fitted through the next waypoints
+// as main.cpp does. The cases are solved in order around the track, so
+// warm starts behave as when driving, R times over. NAME is one of ipopt,
+// kernels, autodiff, rti, riccati, admm and mppi; the default runs them all.
+//
+// Times are wall-clock per solve. Allocations per solve are only counted
+// in a build configured with -DMPC_COUNT_ALLOCS=ON, and read 0 otherwise.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "AllocCount.h"
+#include "Horner.h"
+#include "MPC.h"
+#include "Polyfit.h"
+#include "Track.h"
+#include "Transform.h"
+#include "Backends.h"
+
+using namespace std;
+
+// Waypoints in the window the simulator sends.
+static const size_t window = 6;
+
+struct Case {
+  StateVector state;
+  Eigen::Vector4d coeffs;
+};
+
+static vector<Case> MakeCases(const Track& track) {
+  const double speeds[] = { 20, 40, 60 };
+  const double offsets[] = { -1, 0, 1 };
+  vector<Case> cases;
+  double xs[window];
+  double ys[window];
+  double xvals[window];
+  double yvals[window];
+  for (double v : speeds) {
+    for (double offset : offsets) {
+      for (size_t i = 0; i < track.Size(); i++) {
+        // On the line at waypoint i, shifted to its left by offset.
+        double psi = track.Heading(i);
+        double px = track.x[i] - offset * sin(psi);
+        double py = track.y[i] + offset * cos(psi);
+        track.Window(i + 1, window, xs, ys);
+        ToVehicleFrame(xs, ys, window, px, py, psi, xvals, yvals);
+
+        Case c;
+        c.coeffs = Polyfit<3>(xvals, yvals, window);
+        c.state << 0, 0, 0, v, Polyval<3>(c.coeffs, 0.0), -atan(c.coeffs[1]);
+        cases.push_back(c);
+      }
+    }
+  }
+  return cases;
+}
+
+static double Percentile(const vector<double>& sorted, double p) {
+  size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+static void Run(const NamedBackend& named, const vector<Case>& cases, int reps) {
+  MPC<11> mpc;
+  mpc.Init(0, 0, 40);
+  mpc.SetBackend(named.backend);
+
+  Eigen::BenchTimer timer;
+  vector<double> times;
+  times.reserve(cases.size() * reps);
+  double iterations = 0;
+  int max_iterations = 0;
+  size_t allocs = 0;
+  size_t failed = 0;
+  for (int rep = 0; rep < reps; rep++) {
+    for (const Case& c : cases) {
+      size_t allocs_before = AllocCount();
+      timer.start();
+      const MPC<11>::Result& result = mpc.Solve(c.state, c.coeffs);
+      timer.stop();
+      allocs += AllocCount() - allocs_before;
+      escape((void*)&result);
+
+      times.push_back(timer.value(Eigen::REAL_TIMER));
+      iterations += result.iterations;
+      max_iterations = max(max_iterations, result.iterations);
+      failed += result.ok ? 0 : 1;
+    }
+  }
+
+  sort(times.begin(), times.end());
+  size_t n = times.size();
+  printf("%-8s %7zu %9.3f %9.3f %9.3f %9.3f %8.1f %5d %10.1f %7zu\n", named.name, n,
+         times.front() * 1e3, Percentile(times, 0.5) * 1e3, Percentile(times, 0.99) * 1e3,
+         times.back() * 1e3, iterations / n, max_iterations, double(allocs) / n, failed);
+}
+
+int main(int argc, char* argv[]) {
+  string track_path = "lake_track_waypoints.csv";
+  int reps = 5;
+  vector<NamedBackend> selected;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--track" && i + 1 < argc) {
+      track_path = argv[++i];
+    } else if (arg == "--reps" && i + 1 < argc) {
+      reps = max(atoi(argv[++i]), 1);
+    } else if (arg == "--backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      selected.push_back(*named);
+    }
+  }
+  if (selected.empty()) {
+    selected.assign(named_backends, named_backends + n_named_backends);
+  }
+
+  Track track;
+  if (!track.Load(track_path)) {
+    fprintf(stderr, "Failed to read the track %s\n", track_path.c_str());
+    return 1;
+  }
+  vector<Case> cases = MakeCases(track);
+
+  printf("%zu cases x %d passes, times in ms\n", cases.size(), reps);
+  printf("%-8s %7s %9s %9s %9s %9s %8s %5s %10s %7s\n", "backend", "solves", "min", "median",
+         "p99", "max", "iters", "max", "allocs", "failed");
+  for (const NamedBackend& named : selected) {
+    Run(named, cases, reps);
+  }
+  return 0;
+}
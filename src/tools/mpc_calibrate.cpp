@@ -0,0 +1,362 @@
+// Fits the vehicle model of the controllers to telemetry recorded with
+// mpc --record FILE, and writes it as a --model file (see
+// ModelCalibration.h).
+//
+//   mpc_calibrate LOG... [--out FILE] [--start FILE] [--threads T]
+//                 [--chunk K] [--max-gap S] [--max-iter I]
+//
+// Every pair of consecutive frames of a connection, at most S seconds
+// apart (default 0.5), is a residual: the pose of the later frame against
+// the one the model predicts for it from the earlier, driven by the
+// actuators the frames report, interpolated between them and delayed by
+// the lag. The residual is the position error in metres, the heading
+// error in heading_scale metres per radian and the speed error in m/s.
+// Levenberg-Marquardt (Eigen's LevenbergMarquardt) minimizes their sum of
+// squares over the lag, the understeer and the gains of the steering and
+// the throttle, from the model of --start, or the nominal one. Its
+// Jacobians are forward differences.
+//
+// The pairs are cut into chunks of K (default 256) that T threads (the
+// cores by default) evaluate in parallel, each its own rows of the
+// residuals and of their Jacobian. The RMS of the residuals before and
+// after the fit and the model, with the wheelbase it amounts to, are
+// printed; the model is written to --out, or to stdout.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+#include "Eigen-3.3/unsupported/Eigen/LevenbergMarquardt"
+#include "BinaryProtocol.h"
+#include "Kinematics.h"
+#include "Layout.h"
+#include "ModelCalibration.h"
+#include "Telemetry.h"
+#include "TelemetryLog.h"
+
+using namespace std;
+
+// Metres of residual per radian of heading error.
+static const double heading_scale = 10;
+
+// Longest step of the predictions, in seconds.
+static const double max_step = 0.01;
+
+// Parameters of the fit, in the order of the LM vector, with the steps of
+// their forward differences.
+enum { lag_s, understeer_k, steer_gain_k, throttle_gain_k, n_parameters };
+static const double difference_step[n_parameters] = { 1e-4, 1e-7, 1e-5, 1e-5 };
+
+// A frame of a connection: arrival time, pose and the actuators it
+// reports, in the model's sign of steering.
+struct Sample {
+  double t;
+  double pose[4];
+  double delta;
+  double a;
+};
+
+// Consecutive frames of a connection; the frames of k and k + 1 of a pair
+// are samples[k] and samples[k + 1].
+struct Series {
+  vector<Sample> samples;
+  vector<size_t> pairs;
+};
+
+// A pair of a series, as the residuals are numbered.
+struct Pair {
+  const Series* series;
+  size_t k;
+};
+
+static bool ReadLog(const string& path, double max_gap, vector<Series>& series) {
+  TelemetryReader reader;
+  if (!reader.Open(path)) {
+    return false;
+  }
+  // Series of every connection, and the waypoints its waypoints frames
+  // build on, indexed by connection.
+  vector<size_t> open;
+  vector<WaypointWindow> waypoints;
+  size_t first = series.size();
+  LoggedEvent event;
+  Telemetry frame;
+  Framing framing;
+  while (reader.Next(event)) {
+    if (event.connection >= open.size()) {
+      open.resize(event.connection + 1, size_t(-1));
+      waypoints.resize(event.connection + 1);
+    }
+    size_t& index = open[event.connection];
+    if (event.kind == LoggedKind::Connect || event.kind == LoggedKind::Disconnect) {
+      index = size_t(-1);
+      waypoints[event.connection].n = 0;
+      continue;
+    }
+    bool telemetry;
+    if (event.kind == LoggedKind::Binary) {
+      telemetry = DecodeBinary(event.data.data(), event.data.size(), framing, frame,
+                               &waypoints[event.connection]) == BinaryMessage::Telemetry;
+    } else {
+      telemetry = DecodeTelemetry(event.data.data(), event.data.size(), frame) == TelemetryMessage::Telemetry;
+    }
+    if (!telemetry) {
+      continue;
+    }
+    if (index == size_t(-1)) {
+      index = series.size();
+      series.push_back(Series());
+    }
+    Series& s = series[index];
+    Sample sample = { event.time_ns * 1e-9, { frame.px, frame.py, frame.psi, frame.v }, frame.delta, frame.a };
+    if (!s.samples.empty()) {
+      double gap = sample.t - s.samples.back().t;
+      if (gap > 0 && gap <= max_gap) {
+        s.pairs.push_back(s.samples.size() - 1);
+      }
+    }
+    s.samples.push_back(sample);
+  }
+  printf("%s: %zu connections\n", path.c_str(), series.size() - first);
+  return true;
+}
+
+// Actuators of s at time t, interpolated between its frames and held
+// before the first and after the last.
+static void Actuators(const vector<Sample>& s, double t, size_t& hint, double* u) {
+  while (hint > 0 && s[hint].t > t) {
+    hint--;
+  }
+  while (hint + 1 < s.size() && s[hint + 1].t <= t) {
+    hint++;
+  }
+  if (t <= s[hint].t || hint + 1 == s.size()) {
+    u[0] = s[hint].delta;
+    u[1] = s[hint].a;
+    return;
+  }
+  double w = (t - s[hint].t) / (s[hint + 1].t - s[hint].t);
+  u[0] = s[hint].delta + w * (s[hint + 1].delta - s[hint].delta);
+  u[1] = s[hint].a + w * (s[hint + 1].a - s[hint].a);
+}
+
+// The four residuals of pair under the parameters p.
+static void Residuals(const Pair& pair, const double* p, double* r) {
+  const vector<Sample>& s = pair.series->samples;
+  const Sample& from = s[pair.k];
+  const Sample& to = s[pair.k + 1];
+  BicycleModel<> model(Lf, max(p[understeer_k], 0.0));
+  double lag = max(p[lag_s], 0.0);
+  double pose[4] = { from.pose[0], from.pose[1], from.pose[2], from.pose[3] };
+  double span = to.t - from.t;
+  int steps = max(int(ceil(span / max_step)), 1);
+  double dt = span / steps;
+  size_t hint = pair.k;
+  for (int i = 0; i < steps; i++) {
+    // The actuators at the middle of the step, as reported lag earlier.
+    double u[2];
+    Actuators(s, from.t + (i + 0.5) * dt - lag, hint, u);
+    u[0] *= p[steer_gain_k];
+    u[1] *= p[throttle_gain_k];
+    double next[4];
+    model.Advance(pose, u, dt, next);
+    copy(next, next + 4, pose);
+  }
+  double heading = to.pose[2] - pose[2];
+  r[0] = to.pose[0] - pose[0];
+  r[1] = to.pose[1] - pose[1];
+  r[2] = heading_scale * atan2(sin(heading), cos(heading));
+  r[3] = to.pose[3] - pose[3];
+}
+
+// The residuals of the pairs as an LM functor, with their Jacobian, over
+// chunks of the pairs in parallel.
+struct Fit : Eigen::DenseFunctor<double> {
+  const vector<Pair>& pairs;
+  size_t chunk;
+  unique_ptr<Eigen::NonBlockingThreadPool> pool;
+  mutex chunks_mutex;
+  condition_variable chunks_done;
+  size_t chunks_pending;
+
+  Fit(const vector<Pair>& pairs, size_t chunk, size_t threads)
+      : Eigen::DenseFunctor<double>(n_parameters, int(4 * pairs.size())),
+        pairs(pairs),
+        chunk(chunk),
+        pool(threads > 1 ? new Eigen::NonBlockingThreadPool(int(threads - 1)) : NULL),
+        chunks_pending(0) {}
+
+  // Rows of the pairs of chunk c into f, and into J when there is one.
+  void Evaluate(size_t c, const Eigen::VectorXd& x, Eigen::VectorXd* f, Eigen::MatrixXd* J) {
+    size_t end = min(pairs.size(), (c + 1) * chunk);
+    for (size_t i = c * chunk; i < end; i++) {
+      double r[4];
+      Residuals(pairs[i], x.data(), r);
+      if (f) {
+        for (int j = 0; j < 4; j++) {
+          (*f)[4 * i + j] = r[j];
+        }
+      }
+      if (J) {
+        for (int k = 0; k < n_parameters; k++) {
+          double p[n_parameters];
+          copy(x.data(), x.data() + n_parameters, p);
+          p[k] += difference_step[k];
+          double rk[4];
+          Residuals(pairs[i], p, rk);
+          for (int j = 0; j < 4; j++) {
+            (*J)(4 * i + j, k) = (rk[j] - r[j]) / difference_step[k];
+          }
+        }
+      }
+    }
+  }
+
+  // Every chunk, chunk 0 on the calling thread.
+  void EvaluateAll(const Eigen::VectorXd& x, Eigen::VectorXd* f, Eigen::MatrixXd* J) {
+    size_t chunks = (pairs.size() + chunk - 1) / chunk;
+    if (!pool || chunks < 2) {
+      for (size_t c = 0; c < chunks; c++) {
+        Evaluate(c, x, f, J);
+      }
+      return;
+    }
+    chunks_pending = chunks - 1;
+    for (size_t c = 1; c < chunks; c++) {
+      pool->Schedule([this, c, &x, f, J]() {
+        Evaluate(c, x, f, J);
+        lock_guard<mutex> lock(chunks_mutex);
+        if (--chunks_pending == 0) {
+          chunks_done.notify_one();
+        }
+      });
+    }
+    Evaluate(0, x, f, J);
+    unique_lock<mutex> lock(chunks_mutex);
+    chunks_done.wait(lock, [this]() { return chunks_pending == 0; });
+  }
+
+  int operator()(const Eigen::VectorXd& x, Eigen::VectorXd& f) {
+    EvaluateAll(x, &f, NULL);
+    return 0;
+  }
+
+  int df(const Eigen::VectorXd& x, Eigen::MatrixXd& J) {
+    EvaluateAll(x, NULL, &J);
+    return 0;
+  }
+};
+
+// RMS of the position, heading and speed residuals.
+static void Report(const char* when, const Eigen::VectorXd& f) {
+  double squares[3] = { 0, 0, 0 };
+  size_t n = size_t(f.size()) / 4;
+  for (size_t i = 0; i < n; i++) {
+    squares[0] += f[4 * i] * f[4 * i] + f[4 * i + 1] * f[4 * i + 1];
+    squares[1] += f[4 * i + 2] * f[4 * i + 2] / (heading_scale * heading_scale);
+    squares[2] += f[4 * i + 3] * f[4 * i + 3];
+  }
+  printf("%-7s position %.4f m, heading %.5f rad, speed %.4f m/s RMS\n", when, sqrt(squares[0] / n),
+         sqrt(squares[1] / n), sqrt(squares[2] / n));
+}
+
+int main(int argc, char* argv[]) {
+  vector<string> logs;
+  string out_path;
+  ModelCalibration model;
+  size_t threads = max(thread::hardware_concurrency(), 1u);
+  size_t chunk = 256;
+  double max_gap = 0.5;
+  int max_iter = 100;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--out" && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if (arg == "--start" && i + 1 < argc) {
+      string error;
+      if (!LoadModelCalibration(argv[++i], model, error)) {
+        fprintf(stderr, "Failed to load the model: %s\n", error.c_str());
+        return 1;
+      }
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threads = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--chunk" && i + 1 < argc) {
+      chunk = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--max-gap" && i + 1 < argc) {
+      max_gap = atof(argv[++i]);
+    } else if (arg == "--max-iter" && i + 1 < argc) {
+      max_iter = max(atoi(argv[++i]), 1);
+    } else {
+      logs.push_back(arg);
+    }
+  }
+  if (logs.empty()) {
+    fprintf(stderr, "usage: mpc_calibrate LOG... [--out FILE] [--start FILE] [--threads T] [--chunk K]\n"
+                    "                     [--max-gap S] [--max-iter I]\n");
+    return 2;
+  }
+
+  vector<Series> series;
+  for (const string& log : logs) {
+    if (!ReadLog(log, max_gap, series)) {
+      fprintf(stderr, "Cannot read the telemetry log %s\n", log.c_str());
+      return 1;
+    }
+  }
+  vector<Pair> pairs;
+  for (const Series& s : series) {
+    for (size_t k : s.pairs) {
+      pairs.push_back({ &s, k });
+    }
+  }
+  if (pairs.size() < n_parameters) {
+    fprintf(stderr, "Only %zu pairs of frames to fit\n", pairs.size());
+    return 1;
+  }
+  printf("%zu pairs of frames, %zu threads over chunks of %zu\n", pairs.size(), threads, chunk);
+
+  Fit fit(pairs, chunk, threads);
+  Eigen::VectorXd x = Eigen::VectorXd::Zero(n_parameters);
+  x << model.lag_ms / 1000, model.understeer, model.steer_gain, model.throttle_gain;
+  Eigen::VectorXd f(fit.values());
+  fit(x, f);
+  Report("before", f);
+
+  Eigen::LevenbergMarquardt<Fit> lm(fit);
+  lm.setMaxfev(max_iter);
+  Eigen::LevenbergMarquardtSpace::Status status = lm.minimize(x);
+  fit(x, f);
+  Report("after", f);
+  printf("status %d after %ld evaluations and %ld Jacobians\n", int(status), long(lm.nfev()), long(lm.njev()));
+
+  model.lag_ms = max(x[lag_s], 0.0) * 1000;
+  model.understeer = max(x[understeer_k], 0.0);
+  model.steer_gain = x[steer_gain_k];
+  model.throttle_gain = x[throttle_gain_k];
+  if (!(model.steer_gain > 0) || !(model.throttle_gain > 0)) {
+    fprintf(stderr, "The fit found no positive gains (steering %g, throttle %g)\n", model.steer_gain,
+            model.throttle_gain);
+    return 1;
+  }
+  printf("wheelbase %.3f m at the compiled Lf %.2f m\n", Lf / model.steer_gain, Lf);
+
+  string text = FormatModelCalibration(model);
+  if (out_path.empty()) {
+    fputs(text.c_str(), stdout);
+    return 0;
+  }
+  FILE* out = fopen(out_path.c_str(), "w");
+  if (!out || fputs(text.c_str(), out) < 0 || fclose(out) != 0) {
+    fprintf(stderr, "Cannot write %s\n", out_path.c_str());
+    return 1;
+  }
+  printf("Wrote %s\n", out_path.c_str());
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Reads a run log written by mpc --run-log (RunLog.h).
+//
+//   mpc_columns LOG [--where COLUMN:LO:HI] [COLUMN...]
+//
+// Without columns, prints the schema: every column with its type, range
+// and bytes on disk. With columns, prints them as CSV, one row per frame.
+// --where keeps the rows whose COLUMN is within [LO, HI], and reads no
+// chunk whose range of it lies outside, e.g. --where vehicle:3:3 or
+// --where time:600:660. Only the named columns, and that of --where, are
+// read from the file.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "RunLog.h"
+
+using namespace std;
+
+static const char* TypeName(RunLogType type) {
+  switch (type) {
+    case RunLogType::Float64:
+      return "f64";
+    case RunLogType::Int32:
+      return "i32";
+    case RunLogType::UInt8:
+      return "u8";
+  }
+  return "?";
+}
+
+static void PrintSchema(const RunLogReader& log) {
+  size_t rows = 0;
+  for (size_t k = 0; k < log.Chunks(); k++) {
+    rows += log.Rows(k);
+  }
+  printf("%zu rows in %zu chunks\n", rows, log.Chunks());
+  printf("%-18s %4s %14s %14s %12s\n", "column", "type", "min", "max", "bytes");
+  for (size_t c = 0; c < log.Columns().size(); c++) {
+    const RunLogColumn& column = log.Columns()[c];
+    double lo = INFINITY;
+    double hi = -INFINITY;
+    for (size_t k = 0; k < log.Chunks(); k++) {
+      lo = fmin(lo, log.Min(k, c));
+      hi = fmax(hi, log.Max(k, c));
+    }
+    printf("%-18s %4s %14.6g %14.6g %12zu\n", column.name.c_str(), TypeName(column.type), lo, hi,
+           rows * RunLogWidth(column.type));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s LOG [--where COLUMN:LO:HI] [COLUMN...]\n", argv[0]);
+    return 2;
+  }
+  RunLogReader log;
+  if (!log.Open(argv[1])) {
+    fprintf(stderr, "Failed to read the run log %s\n", argv[1]);
+    return 1;
+  }
+  const size_t none = log.Columns().size();
+  vector<size_t> columns;
+  size_t where = none;
+  double lo = -INFINITY;
+  double hi = INFINITY;
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--where" && i + 1 < argc) {
+      string spec = argv[++i];
+      size_t colon = spec.find(':');
+      size_t second = colon == string::npos ? string::npos : spec.find(':', colon + 1);
+      if (second == string::npos || (where = log.Find(spec.substr(0, colon))) == none) {
+        fprintf(stderr, "--where takes COLUMN:LO:HI of a column of the log\n");
+        return 2;
+      }
+      lo = atof(spec.substr(colon + 1, second - colon - 1).c_str());
+      hi = atof(spec.substr(second + 1).c_str());
+    } else {
+      size_t column = log.Find(arg);
+      if (column == none) {
+        fprintf(stderr, "No column %s in %s\n", arg.c_str(), argv[1]);
+        return 2;
+      }
+      columns.push_back(column);
+    }
+  }
+  if (columns.empty()) {
+    PrintSchema(log);
+    return 0;
+  }
+
+  for (size_t j = 0; j < columns.size(); j++) {
+    printf("%s%s", j ? "," : "", log.Columns()[columns[j]].name.c_str());
+  }
+  printf("\n");
+  vector<vector<double> > values(columns.size());
+  vector<double> filter;
+  for (size_t k = 0; k < log.Chunks(); k++) {
+    if (where != none && (log.Max(k, where) < lo || log.Min(k, where) > hi)) {
+      continue;
+    }
+    if (where != none) {
+      log.ReadColumn(k, where, filter);
+    }
+    for (size_t j = 0; j < columns.size(); j++) {
+      log.ReadColumn(k, columns[j], values[j]);
+    }
+    for (size_t r = 0; r < log.Rows(k); r++) {
+      if (where != none && (filter[r] < lo || filter[r] > hi)) {
+        continue;
+      }
+      for (size_t j = 0; j < columns.size(); j++) {
+        printf("%s%.9g", j ? "," : "", values[j][r]);
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
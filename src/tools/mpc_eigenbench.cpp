@@ -0,0 +1,267 @@
+// Monitor of the vendored Eigen kernels the controller's hot path runs,
+// at exactly its shapes, so that an Eigen upgrade or a compiler change
+// that slows one of them shows:
+//
+//   lsq_6x4       the cubic fit of the six waypoints the simulator sends,
+//                 the 4x4 normal equations by LDLT (Polyfit.h)
+//   lsq_6x4_kkt   the same anchored at the vehicle, the 5x5 KKT system
+//                 by partial-pivoting LU (WeightedPolyfit)
+//   product_6x6   a product of two stage Jacobians, as the condensing of
+//                 the rti and admm backends chains them
+//   product_6x2   a stage Jacobian by an input Jacobian
+//   product_8x8   the Riccati recursion's 8x8 cost-to-go by the 8x8
+//                 stage matrix (RiccatiSQP.h)
+//   llt_2x2       the Riccati input block, factored and solved
+//   llt_20x20     the condensed Hessian of the rti backend at N = 11,
+//                 factored and solved (RTI.h)
+//   reduce_66     the squared norm and a dot product of stacked states
+//                 of N = 11, as the merit functions take them
+//
+//   mpc_eigenbench [--passes P] [--baseline FILE] [--write-baseline FILE]
+//
+// Every kernel runs over a ring of random inputs, so nothing folds into
+// a constant, P times over (default 50). Prints the nanoseconds per call
+// of the fastest and the median pass. The fastest pass is the figure of
+// the gate: --write-baseline writes it, with a margin, as the limit of
+// each kernel, in "name value" lines (# starts a comment) like those of
+// mpc_sim --baseline (Baseline.h), and --baseline fails, with exit
+// status 1, when a kernel is slower than its limit or the file names one
+// that does not exist. A kernel left out of the file is not checked.
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/LU"
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "Layout.h"
+#include "Polyfit.h"
+
+using namespace std;
+
+// Inputs of a ring, and calls of a kernel per pass.
+static const int ring = 64;
+static const int calls = 2000;
+// Margin of a written limit over the fastest pass.
+static const double margin = 1.25;
+
+// Waypoints per frame, as the simulator sends them.
+static const int n_waypoints = 6;
+// Sizes of the condensed problem and the stacked states at N = 11.
+enum : int { n_u = Layout<11>::n_inputs, n_x = Layout<11>::n_constraints };
+
+typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+typedef Eigen::Matrix<double, 6, 2> Matrix62d;
+typedef Eigen::Matrix<double, 8, 8> Matrix8d;
+typedef Eigen::Matrix<double, n_u, n_u> InputMatrix;
+typedef Eigen::Matrix<double, n_u, 1> InputVector;
+typedef Eigen::Matrix<double, n_x, 1> StackedVector;
+
+// Fastest and median nanoseconds per call of every kernel, in order.
+struct Timing {
+  string name;
+  double fastest;
+  double median;
+};
+
+template <class F>
+static Timing Time(const char* name, int passes, F kernel) {
+  Eigen::BenchTimer timer;
+  vector<double> times;
+  for (int pass = 0; pass < passes; pass++) {
+    timer.start();
+    for (int i = 0; i < calls; i++) {
+      kernel(i % ring);
+    }
+    timer.stop();
+    times.push_back(timer.value(Eigen::REAL_TIMER) / calls * 1e9);
+  }
+  sort(times.begin(), times.end());
+  Timing timing = { name, times.front(), times[times.size() / 2] };
+  printf("%-12s %10.1f %10.1f\n", name, timing.fastest, timing.median);
+  return timing;
+}
+
+// A symmetric positive definite matrix, as the Hessians are.
+template <class Matrix>
+static Matrix RandomSPD(mt19937& rng) {
+  uniform_real_distribution<double> u(-1, 1);
+  Matrix m;
+  for (int i = 0; i < m.size(); i++) {
+    m(i) = u(rng);
+  }
+  return m * m.transpose() + Matrix::Identity() * m.rows();
+}
+
+// Read the limits at path into limits, keyed by kernel.
+static bool LoadLimits(const string& path, map<string, double>& limits, string& error) {
+  ifstream in(path.c_str());
+  if (!in) {
+    error = "cannot read " + path;
+    return false;
+  }
+  string line;
+  for (int number = 1; getline(in, line); number++) {
+    line = line.substr(0, line.find('#'));
+    istringstream fields(line);
+    string name;
+    double value;
+    if (!(fields >> name)) {
+      continue;
+    }
+    if (!(fields >> value) || value <= 0) {
+      error = path + ":" + to_string(number) + ": bad value of " + name;
+      return false;
+    }
+    limits[name] = value;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  int passes = 50;
+  string baseline_path;
+  string write_baseline_path;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--passes" && i + 1 < argc) {
+      passes = max(atoi(argv[++i]), 1);
+    } else if (arg == "--baseline" && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else if (arg == "--write-baseline" && i + 1 < argc) {
+      write_baseline_path = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--passes P] [--baseline FILE] [--write-baseline FILE]\n", argv[0]);
+      return 2;
+    }
+  }
+  map<string, double> limits;
+  string error;
+  if (!baseline_path.empty() && !LoadLimits(baseline_path, limits, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 2;
+  }
+
+  // The inputs: waypoints ahead of the vehicle along gentle curves, and
+  // random Jacobians and Hessians.
+  mt19937 rng(1);
+  uniform_real_distribution<double> u(-1, 1);
+  vector<double> xs(ring * n_waypoints);
+  vector<double> ys(ring * n_waypoints);
+  vector<double> ws(ring * n_waypoints, 1.0);
+  vector<Matrix6d, Eigen::aligned_allocator<Matrix6d>> A(ring);
+  vector<Matrix62d, Eigen::aligned_allocator<Matrix62d>> B(ring);
+  vector<Matrix8d, Eigen::aligned_allocator<Matrix8d>> P(ring);
+  vector<Eigen::Matrix2d, Eigen::aligned_allocator<Eigen::Matrix2d>> R(ring);
+  vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> r(ring);
+  vector<InputMatrix, Eigen::aligned_allocator<InputMatrix>> H(ring);
+  vector<InputVector, Eigen::aligned_allocator<InputVector>> g(ring);
+  vector<StackedVector, Eigen::aligned_allocator<StackedVector>> X(ring);
+  for (int k = 0; k < ring; k++) {
+    double curvature = 0.02 * u(rng);
+    for (int j = 0; j < n_waypoints; j++) {
+      double x = 5 + 10 * j + u(rng);
+      xs[k * n_waypoints + j] = x;
+      ys[k * n_waypoints + j] = u(rng) + 0.5 * curvature * x * x;
+    }
+    A[k] = Matrix6d::Identity() + 0.1 * Matrix6d::Random();
+    B[k] = Matrix62d::Random();
+    P[k] = RandomSPD<Matrix8d>(rng);
+    R[k] = RandomSPD<Eigen::Matrix2d>(rng);
+    r[k] = Eigen::Vector2d::Random();
+    H[k] = RandomSPD<InputMatrix>(rng);
+    g[k] = InputVector::Random();
+    X[k] = StackedVector::Random();
+  }
+
+  printf("%d passes of %d calls, ns per call\n", passes, calls);
+  printf("%-12s %10s %10s\n", "kernel", "fastest", "median");
+  vector<Timing> timings;
+
+  Eigen::Vector4d coeffs;
+  timings.push_back(Time("lsq_6x4", passes, [&](int k) {
+    coeffs = Polyfit<3>(&xs[k * n_waypoints], &ys[k * n_waypoints], n_waypoints);
+    escape(&coeffs);
+  }));
+  timings.push_back(Time("lsq_6x4_kkt", passes, [&](int k) {
+    coeffs = WeightedPolyfit<3>(&xs[k * n_waypoints], &ys[k * n_waypoints], &ws[k * n_waypoints], n_waypoints,
+                                true, 0, 0);
+    escape(&coeffs);
+  }));
+
+  Matrix6d AA;
+  timings.push_back(Time("product_6x6", passes, [&](int k) {
+    AA.noalias() = A[k] * A[(k + 1) % ring];
+    escape(&AA);
+  }));
+  Matrix62d AB;
+  timings.push_back(Time("product_6x2", passes, [&](int k) {
+    AB.noalias() = A[k] * B[k];
+    escape(&AB);
+  }));
+  Matrix8d PP;
+  timings.push_back(Time("product_8x8", passes, [&](int k) {
+    PP.noalias() = P[k] * P[(k + 1) % ring];
+    escape(&PP);
+  }));
+
+  Eigen::LLT<Eigen::Matrix2d> llt_2;
+  Eigen::Vector2d du;
+  timings.push_back(Time("llt_2x2", passes, [&](int k) {
+    llt_2.compute(R[k]);
+    du = llt_2.solve(r[k]);
+    escape(&du);
+  }));
+  Eigen::LLT<InputMatrix> llt_u;
+  InputVector dU;
+  timings.push_back(Time("llt_20x20", passes, [&](int k) {
+    llt_u.compute(H[k]);
+    dU = llt_u.solve(g[k]);
+    escape(&dU);
+  }));
+
+  double sum = 0;
+  timings.push_back(Time("reduce_66", passes, [&](int k) {
+    sum += X[k].squaredNorm() + X[k].dot(X[(k + 1) % ring]);
+    escape(&sum);
+  }));
+
+  if (!write_baseline_path.empty()) {
+    ofstream out(write_baseline_path.c_str());
+    out << "# Limits of mpc_eigenbench --baseline in ns per call, written by --write-baseline\n";
+    for (const Timing& t : timings) {
+      out << t.name << " " << t.fastest * margin << "\n";
+    }
+    if (!out) {
+      fprintf(stderr, "Failed to write %s\n", write_baseline_path.c_str());
+      return 1;
+    }
+  }
+  bool ok = true;
+  for (const auto& limit : limits) {
+    bool known = false;
+    for (const Timing& t : timings) {
+      known = known || t.name == limit.first;
+    }
+    if (!known) {
+      printf("%s: no such kernel: REGRESSED\n", limit.first.c_str());
+      ok = false;
+    }
+  }
+  for (const Timing& t : timings) {
+    auto limit = limits.find(t.name);
+    if (limit != limits.end()) {
+      bool pass = t.fastest <= limit->second;
+      printf("%s %.1f ns, limit %.1f ns: %s\n", t.name.c_str(), t.fastest, limit->second,
+             pass ? "ok" : "REGRESSED");
+      ok = ok && pass;
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+// Reports the static memory of the embedded core (Embedded.h) for every
+// compiled horizon: the bytes of a controller, which is all the memory a
+// vehicle needs, and of its solver, and the stack of a step where the
+// compiler reports it (-fstack-usage writes the .su files next to the
+// objects of mpc_embedded). Then steps each controller once on a straight
+// road as a check that the float build solves.
+//
+//   mpc_footprint
+#include <stdio.h>
+#include "Embedded.h"
+
+template <size_t N>
+static void Report() {
+  EmbeddedController<N> controller(0.1f, 40 * 0.44704f, 0.1f);
+  float ptsx[6];
+  float ptsy[6];
+  for (int i = 0; i < 6; i++) {
+    ptsx[i] = 5.0f * i;
+    ptsy[i] = 0.5f;
+  }
+  EmbeddedFrame frame = { ptsx, ptsy, 6, 0, 0, 0, 10, 0, 0 };
+  EmbeddedCommand command = { 0, 0, 0 };
+  bool ok = controller.Step(frame, command);
+  printf("N = %2zu: controller %7zu bytes, solver %7zu bytes; step %s, delta %.4f, a %.4f\n", N,
+         sizeof(EmbeddedController<N>), sizeof(typename EmbeddedController<N>::Solver), ok ? "ok" : "failed",
+         command.delta, command.a);
+}
+
+int main() {
+#define MPC_REPORT(N) Report<N>();
+  MPC_FOR_EACH_HORIZON(MPC_REPORT)
+#undef MPC_REPORT
+  return 0;
+}
@@ -0,0 +1,306 @@
+// Microbenchmarks of the stages of a frame around the solve, on the text
+// telemetry of a log recorded with mpc --record:
+//
+//   json       the original path, the payload between the brackets found
+//              as hasData did and parsed into a json object
+//   decode     DecodeTelemetry, which replaced it (Telemetry.h)
+//   binary     DecodeBinary of the same frames as binary waypoints frames
+//              that send every waypoint (BinaryProtocol.h)
+//   waypoints  the same with only the waypoints new to the connection's
+//              window sent, the others taken from the window
+//   transform  the waypoints to the vehicle frame (Transform.h)
+//   polyfit    the cubic fit of the reference (Polyfit.h)
+//   window     the sliding-window fit of --window-fit (WindowPolyfit.h),
+//              one per recorded connection, fed in order
+//   window-ids the same with the waypoints numbered as in the waypoints
+//              frames
+//   polyval    the reference and its slope at the predicted pose (Horner.h)
+//   steer      the reply, with a plan of 10 points (SteerWriter.h)
+//   steer-viz  the same with the lines decimated within 5 cm and written
+//              in centimetres (see VizEncoding)
+//   observe    the JSON of the observation for /observe
+//
+//   mpc_iobench LOG [--passes P]
+//
+// Every stage runs on all the frames in turn, P times over (default 20),
+// each stage on the outputs of the one before it as computed once ahead.
+// Prints the nanoseconds per frame of the fastest and the median pass,
+// the mean size of the telemetry as text and in the binary frames, and
+// that of the two replies.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "BinaryProtocol.h"
+#include "Horner.h"
+#include "Polyfit.h"
+#include "SteerWriter.h"
+#include "Telemetry.h"
+#include "TelemetryLog.h"
+#include "Transform.h"
+#include "WindowPolyfit.h"
+#include "json.hpp"
+
+using namespace std;
+
+// Points of the plan in the reply, as MPC<11> sends.
+static const size_t plan_points = 10;
+
+// A recorded frame and the inputs every stage takes from it.
+struct Frame {
+  uint32_t connection;
+  string message;
+  // The frame as binary waypoints frames, all the window and only what is
+  // new to it, and the number of its first waypoint.
+  string binary;
+  string waypoints;
+  uint64_t first;
+  Telemetry telemetry;
+  double xs[Telemetry::max_points];
+  double ys[Telemetry::max_points];
+  Eigen::Vector4d coeffs;
+};
+
+// The payload of a Socket.IO event as the original hasData found it, or
+// an empty string.
+static string HasData(const string& s) {
+  auto found_null = s.find("null");
+  auto b1 = s.find_first_of("[");
+  auto b2 = s.find_first_of("}");
+  if (found_null != string::npos) {
+    return "";
+  } else if (b1 != string::npos && b2 != string::npos) {
+    return s.substr(b1, b2 - b1 + 2);
+  }
+  return "";
+}
+
+template <class F>
+static void Time(const char* name, size_t frames, int passes, F stage) {
+  Eigen::BenchTimer timer;
+  vector<double> times;
+  for (int pass = 0; pass < passes; pass++) {
+    timer.start();
+    for (size_t i = 0; i < frames; i++) {
+      stage(i);
+    }
+    timer.stop();
+    times.push_back(timer.value(Eigen::REAL_TIMER) / frames);
+  }
+  sort(times.begin(), times.end());
+  printf("%-10s %10.1f %10.1f\n", name, times.front() * 1e9, times[times.size() / 2] * 1e9);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s LOG [--passes P]\n", argv[0]);
+    return 2;
+  }
+  int passes = 20;
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--passes" && i + 1 < argc) {
+      passes = max(atoi(argv[++i]), 1);
+    }
+  }
+
+  TelemetryReader reader;
+  if (!reader.Open(argv[1])) {
+    fprintf(stderr, "Failed to read the log %s\n", argv[1]);
+    return 1;
+  }
+  vector<Frame> frames;
+  LoggedEvent event;
+  Frame frame;
+  // The last window of every connection and the number of its first
+  // waypoint, as a gateway numbers them.
+  map<uint32_t, pair<uint64_t, Telemetry> > windows;
+  while (reader.Next(event)) {
+    if (event.kind != LoggedKind::Text ||
+        DecodeTelemetry(event.data.data(), event.data.length(), frame.telemetry) != TelemetryMessage::Telemetry ||
+        frame.telemetry.n_points < 4) {
+      continue;
+    }
+    const Telemetry& t = frame.telemetry;
+    frame.connection = event.connection;
+    frame.message = event.data;
+    ToVehicleFrame(t.ptsx, t.ptsy, t.n_points, t.px, t.py, t.psi, frame.xs, frame.ys);
+    frame.coeffs = Polyfit<3>(frame.xs, frame.ys, t.n_points);
+
+    // The waypoints the window shares with the connection's last one are
+    // at its front, in the same order.
+    auto last = windows.find(event.connection);
+    size_t fresh = t.n_points;
+    frame.first = 0;
+    if (last != windows.end()) {
+      const Telemetry& w = last->second.second;
+      size_t dropped = 0;
+      while (dropped < w.n_points && !(w.ptsx[dropped] == t.ptsx[0] && w.ptsy[dropped] == t.ptsy[0])) {
+        dropped++;
+      }
+      size_t kept = w.n_points - dropped;
+      for (size_t i = 0; i < kept && i < t.n_points; i++) {
+        if (w.ptsx[dropped + i] != t.ptsx[i] || w.ptsy[dropped + i] != t.ptsy[i]) {
+          kept = 0;
+        }
+      }
+      fresh = kept <= t.n_points ? t.n_points - kept : t.n_points;
+      frame.first = last->second.first + (fresh < t.n_points ? dropped : w.n_points);
+    }
+    windows[event.connection] = make_pair(frame.first, t);
+    frame.telemetry.first_waypoint = frame.first;
+    WriteBinaryWaypoints(frame.binary, Framing::Binary64, t.px, t.py, t.psi, t.v / mph_to_mps, -t.delta, t.a,
+                         t.ptsx, t.ptsy, t.n_points, frame.first, t.n_points);
+    WriteBinaryWaypoints(frame.waypoints, Framing::Binary64, t.px, t.py, t.psi, t.v / mph_to_mps, -t.delta, t.a,
+                         t.ptsx, t.ptsy, t.n_points, frame.first, fresh);
+    frames.push_back(frame);
+  }
+  if (frames.empty()) {
+    fprintf(stderr, "No telemetry with four or more waypoints in %s\n", argv[1]);
+    return 1;
+  }
+  const size_t n = frames.size();
+
+  printf("%zu frames x %d passes, ns per frame\n", n, passes);
+  printf("%-10s %10s %10s\n", "stage", "fastest", "median");
+
+  nlohmann::json parsed;
+  Time("json", n, passes, [&](size_t i) {
+    string s = HasData(frames[i].message.substr(2));
+    parsed = nlohmann::json::parse(s);
+    escape(&parsed);
+  });
+
+  Telemetry decoded;
+  Time("decode", n, passes, [&](size_t i) {
+    const string& m = frames[i].message;
+    DecodeTelemetry(m.data(), m.length(), decoded);
+    escape(&decoded);
+  });
+
+  // A fresh window per connection and pass, as for the fitters below.
+  map<uint32_t, WaypointWindow> received;
+  size_t telemetry_bytes[3] = { 0, 0, 0 };
+  Framing framing;
+  Time("binary", n, passes, [&](size_t i) {
+    if (i == 0) {
+      received.clear();
+    }
+    const string& m = frames[i].binary;
+    DecodeBinary(m.data(), m.length(), framing, decoded, &received[frames[i].connection]);
+    escape(&decoded);
+  });
+  Time("waypoints", n, passes, [&](size_t i) {
+    if (i == 0) {
+      received.clear();
+    }
+    const string& m = frames[i].waypoints;
+    DecodeBinary(m.data(), m.length(), framing, decoded, &received[frames[i].connection]);
+    escape(&decoded);
+  });
+  for (const Frame& f : frames) {
+    telemetry_bytes[0] += f.message.size();
+    telemetry_bytes[1] += f.binary.size();
+    telemetry_bytes[2] += f.waypoints.size();
+  }
+
+  double xs[Telemetry::max_points];
+  double ys[Telemetry::max_points];
+  Time("transform", n, passes, [&](size_t i) {
+    const Telemetry& t = frames[i].telemetry;
+    ToVehicleFrame(t.ptsx, t.ptsy, t.n_points, t.px, t.py, t.psi, xs, ys);
+    escape(xs);
+  });
+
+  Eigen::Vector4d coeffs;
+  Time("polyfit", n, passes, [&](size_t i) {
+    coeffs = Polyfit<3>(frames[i].xs, frames[i].ys, frames[i].telemetry.n_points);
+    escape(coeffs.data());
+  });
+
+  // A fresh fitter per connection and pass, so every pass slides the same
+  // windows from the same anchors.
+  map<uint32_t, WindowPolyfit<3, Telemetry::max_points> > fitters;
+  Time("window", n, passes, [&](size_t i) {
+    if (i == 0) {
+      fitters.clear();
+    }
+    const Telemetry& t = frames[i].telemetry;
+    coeffs = fitters[frames[i].connection].Update(t.ptsx, t.ptsy, t.n_points, t.px, t.py, t.psi);
+    escape(coeffs.data());
+  });
+  Time("window-ids", n, passes, [&](size_t i) {
+    if (i == 0) {
+      fitters.clear();
+    }
+    const Telemetry& t = frames[i].telemetry;
+    coeffs = fitters[frames[i].connection].Update(t.ptsx, t.ptsy, t.n_points, t.px, t.py, t.psi, t.first_waypoint);
+    escape(coeffs.data());
+  });
+
+  double f_x;
+  double df_x;
+  Time("polyval", n, passes, [&](size_t i) {
+    // The pose 100 ms ahead on the x axis of the vehicle.
+    Polyval<3>(frames[i].coeffs, frames[i].telemetry.v * 0.1, f_x, df_x);
+    escape(&f_x);
+    escape(&df_x);
+  });
+
+  // The plan along the fitted reference, 2 m apart.
+  double plan_x[plan_points];
+  double plan_y[plan_points];
+  string reply;
+  VizEncoding exact;
+  VizEncoding encoded;
+  encoded.tolerance = 0.05;
+  encoded.resolution = 0.01;
+  VizEncoding viz;
+  size_t bytes[2] = { 0, 0 };
+  auto steer = [&](size_t i) {
+    const Frame& f = frames[i];
+    for (size_t k = 0; k < plan_points; k++) {
+      plan_x[k] = 2.0 * k;
+      plan_y[k] = Polyval<3>(f.coeffs, plan_x[k]);
+    }
+    WriteSteer(reply, -f.telemetry.delta, f.telemetry.a, plan_x, plan_y, plan_points, f.xs, f.ys,
+               f.telemetry.n_points, viz);
+    escape(&reply[0]);
+    bytes[viz.tolerance > 0] += reply.size();
+  };
+  viz = exact;
+  Time("steer", n, passes, steer);
+  viz = encoded;
+  Time("steer-viz", n, passes, steer);
+
+  Observation observation = Observation();
+  Time("observe", n, passes, [&](size_t i) {
+    const Frame& f = frames[i];
+    observation.vehicle = f.connection;
+    observation.px = f.telemetry.px;
+    observation.py = f.telemetry.py;
+    observation.psi = f.telemetry.psi;
+    observation.v = f.telemetry.v;
+    observation.steering_angle = -f.telemetry.delta;
+    observation.throttle = f.telemetry.a;
+    observation.ok = true;
+    observation.horizon = plan_points + 1;
+    observation.n_mpc = plan_points;
+    for (size_t k = 0; k < plan_points; k++) {
+      observation.mpc_x[k] = 2.0 * k;
+      observation.mpc_y[k] = Polyval<3>(f.coeffs, observation.mpc_x[k]);
+    }
+    WriteObservation(reply, observation);
+    escape(&reply[0]);
+  });
+  printf("telemetry of %.0f bytes as text, %.0f in binary frames, %.0f in waypoints frames\n",
+         double(telemetry_bytes[0]) / n, double(telemetry_bytes[1]) / n, double(telemetry_bytes[2]) / n);
+  printf("steer replies of %.0f bytes, %.0f with --viz-tolerance 0.05 --viz-resolution 0.01\n",
+         double(bytes[0]) / (n * passes), double(bytes[1]) / (n * passes));
+  return 0;
+}
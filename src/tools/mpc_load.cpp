@@ -0,0 +1,295 @@
+// Load generator for the server: opens M websocket connections to mpc,
+// sends simulator telemetry on each and reports the throughput and the
+// round trip of the replies.
+//
+//   mpc_load [--url URL] [--connections M] [--rate HZ] [--seconds S]
+//            [--log FILE] [--track CSV]
+//
+// The telemetry is the simulator's 42["telemetry",{...}] text messages.
+// With --log they are those of a log recorded with mpc --record:
+// connection m sends the telemetry of recorded connection m modulo their
+// number, in order and again from the start at the end. Without, they
+// are a vehicle driving the waypoints of --track (default
+// ../lake_track_waypoints.csv) at 40 mph, each connection starting at its
+// own place on the loop.
+//
+// --rate 0 (the default) runs closed loop, as a simulator that waits for
+// every command: a connection sends its next frame when the reply to the
+// last one arrives, and the round trip is exact. --rate HZ sends a frame
+// on every connection every 1/HZ s whatever the replies. The server may
+// then answer only the newest of the frames waiting, so a reply's round
+// trip is taken from the latest frame sent before it, a lower bound. The
+// server's emulated actuator latency (100 ms) is part of every round trip.
+//
+// Connections the server turns away or closes are counted and not opened
+// again. Exits with 1 when no connection could be opened.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uWS/uWS.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "Telemetry.h"
+#include "TelemetryLog.h"
+#include "Track.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+typedef uWS::WebSocket<uWS::CLIENT> Socket;
+
+// Speed of the synthetic vehicle, and its frame interval in closed loop.
+static const double synthetic_mph = 40;
+static const double synthetic_dt = 0.05;
+static const size_t synthetic_points = 6;
+
+struct Connection {
+  Socket* ws;
+  const vector<string>* messages;
+  size_t next;
+  Clock::time_point sent;
+  bool waiting;
+  uS::Timer* timer;
+};
+
+struct Load {
+  vector<Connection> connections;
+  vector<double> round_trips;
+  size_t sent;
+  size_t replies;
+  size_t opened;
+  size_t failed;
+  size_t closed;
+  bool closed_loop;
+  bool done;
+};
+
+static Load* load;
+
+static double Percentile(const vector<double>& sorted, double p) {
+  size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+// The telemetry of every recorded connection of the log, in order.
+static bool LoggedStreams(const string& path, vector<vector<string> >& streams) {
+  TelemetryReader reader;
+  if (!reader.Open(path)) {
+    return false;
+  }
+  map<uint32_t, vector<string> > recorded;
+  LoggedEvent event;
+  Telemetry frame;
+  while (reader.Next(event)) {
+    if (event.kind == LoggedKind::Text &&
+        DecodeTelemetry(event.data.data(), event.data.length(), frame) == TelemetryMessage::Telemetry) {
+      recorded[event.connection].push_back(event.data);
+    }
+  }
+  for (auto& connection : recorded) {
+    streams.push_back(connection.second);
+  }
+  return true;
+}
+
+// One lap of the track at synthetic_mph, a frame every dt seconds.
+static void SyntheticStream(const Track& track, double dt, vector<string>& stream) {
+  const double step = synthetic_mph * 0.44704 * dt;
+  double xs[synthetic_points];
+  double ys[synthetic_points];
+  char number[32];
+  double along = 0;
+  for (size_t i = 0; i < track.Size(); i++) {
+    size_t j = (i + 1) % track.Size();
+    double length = hypot(track.x[j] - track.x[i], track.y[j] - track.y[i]);
+    for (; along < length; along += step) {
+      double t = along / length;
+      track.Window(j, synthetic_points, xs, ys);
+      string msg = "42[\"telemetry\",{\"ptsx\":[";
+      for (size_t k = 0; k < synthetic_points; k++) {
+        snprintf(number, sizeof(number), "%s%.6f", k ? "," : "", xs[k]);
+        msg += number;
+      }
+      msg += "],\"ptsy\":[";
+      for (size_t k = 0; k < synthetic_points; k++) {
+        snprintf(number, sizeof(number), "%s%.6f", k ? "," : "", ys[k]);
+        msg += number;
+      }
+      char pose[160];
+      snprintf(pose, sizeof(pose),
+               "],\"x\":%.6f,\"y\":%.6f,\"psi\":%.6f,\"speed\":%.4f,\"steering_angle\":0,\"throttle\":0.3}]",
+               track.x[i] + t * (track.x[j] - track.x[i]), track.y[i] + t * (track.y[j] - track.y[i]),
+               track.Heading(i), synthetic_mph);
+      msg += pose;
+      stream.push_back(msg);
+    }
+    along -= length;
+  }
+}
+
+static void Send(Connection& connection) {
+  const string& msg = (*connection.messages)[connection.next];
+  connection.next = (connection.next + 1) % connection.messages->size();
+  connection.sent = Clock::now();
+  connection.waiting = true;
+  connection.ws->send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+  load->sent++;
+}
+
+static void OnSendTick(uS::Timer* timer) {
+  Connection* connection = static_cast<Connection*>(timer->getData());
+  if (connection->ws && !load->done) {
+    Send(*connection);
+  }
+}
+
+static void OnEnd(uS::Timer* timer) {
+  load->done = true;
+  for (auto& connection : load->connections) {
+    if (connection.timer) {
+      connection.timer->stop();
+      connection.timer->close();
+      connection.timer = NULL;
+    }
+    if (connection.ws) {
+      connection.ws->close();
+    }
+  }
+  timer->stop();
+  timer->close();
+}
+
+int main(int argc, char* argv[]) {
+  string url = "ws://localhost:4567";
+  string log_path;
+  string track_path = "../lake_track_waypoints.csv";
+  size_t connections = 1;
+  int rate = 0;
+  int seconds = 10;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--url" && i + 1 < argc) {
+      url = argv[++i];
+    } else if (arg == "--connections" && i + 1 < argc) {
+      connections = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--rate" && i + 1 < argc) {
+      rate = max(atoi(argv[++i]), 0);
+    } else if (arg == "--seconds" && i + 1 < argc) {
+      seconds = max(atoi(argv[++i]), 1);
+    } else if (arg == "--log" && i + 1 < argc) {
+      log_path = argv[++i];
+    } else if (arg == "--track" && i + 1 < argc) {
+      track_path = argv[++i];
+    } else {
+      fprintf(stderr,
+              "usage: %s [--url URL] [--connections M] [--rate HZ] [--seconds S]\n"
+              "          [--log FILE] [--track CSV]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  // The streams of telemetry, and where each connection starts in its own.
+  vector<vector<string> > streams;
+  bool synthetic = log_path.empty();
+  if (synthetic) {
+    Track track;
+    if (!track.Load(track_path)) {
+      fprintf(stderr, "Failed to read the track %s\n", track_path.c_str());
+      return 1;
+    }
+    streams.resize(1);
+    SyntheticStream(track, rate > 0 ? 1.0 / rate : synthetic_dt, streams[0]);
+  } else if (!LoggedStreams(log_path, streams)) {
+    fprintf(stderr, "Failed to read the log %s\n", log_path.c_str());
+    return 1;
+  }
+  if (streams.empty() || streams[0].empty()) {
+    fprintf(stderr, "No telemetry to send\n");
+    return 1;
+  }
+
+  Load state = Load();
+  state.closed_loop = rate == 0;
+  state.connections.resize(connections);
+  for (size_t m = 0; m < connections; m++) {
+    Connection& connection = state.connections[m];
+    connection.ws = NULL;
+    connection.messages = &streams[m % streams.size()];
+    connection.next = synthetic ? m * connection.messages->size() / connections : 0;
+    connection.waiting = false;
+    connection.timer = NULL;
+  }
+  load = &state;
+
+  uWS::Hub h;
+  h.onConnection([&h, rate, connections](Socket* ws, uWS::HttpRequest) {
+    Connection* connection = static_cast<Connection*>(ws->getUserData());
+    connection->ws = ws;
+    load->opened++;
+    if (load->closed_loop) {
+      Send(*connection);
+      return;
+    }
+    // Spread over the period, so the frames of all the connections do not
+    // arrive together.
+    int period_ms = max(1000 / rate, 1);
+    size_t m = size_t(connection - &load->connections[0]);
+    connection->timer = new uS::Timer(h.getLoop());
+    connection->timer->setData(connection);
+    connection->timer->start(OnSendTick, int(m * period_ms / connections) + 1, period_ms);
+  });
+  h.onMessage([](Socket* ws, char* data, size_t length, uWS::OpCode) {
+    static const char steer[] = "42[\"steer\"";
+    Connection* connection = static_cast<Connection*>(ws->getUserData());
+    if (length < sizeof(steer) - 1 || memcmp(data, steer, sizeof(steer) - 1) != 0 || !connection->waiting) {
+      return;
+    }
+    load->replies++;
+    load->round_trips.push_back(chrono::duration<double>(Clock::now() - connection->sent).count());
+    if (load->closed_loop) {
+      connection->waiting = false;
+      if (!load->done) {
+        Send(*connection);
+      }
+    }
+  });
+  h.onDisconnection([](Socket* ws, int, char*, size_t) {
+    Connection* connection = static_cast<Connection*>(ws->getUserData());
+    connection->ws = NULL;
+    if (connection->timer) {
+      connection->timer->stop();
+      connection->timer->close();
+      connection->timer = NULL;
+    }
+    if (!load->done) {
+      load->closed++;
+    }
+  });
+  h.onError([](void*) { load->failed++; });
+
+  for (auto& connection : state.connections) {
+    h.connect(url, &connection);
+  }
+  uS::Timer* end = new uS::Timer(h.getLoop());
+  end->start(OnEnd, seconds * 1000, 0);
+  Clock::time_point start = Clock::now();
+  h.run();
+  double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+  printf("%zu connections: %zu opened, %zu failed, %zu closed by the server\n", connections, state.opened,
+         state.failed, state.closed);
+  printf("%zu frames sent, %.1f/s; %zu replies, %.1f/s, over %.1f s (%s)\n", state.sent, state.sent / elapsed,
+         state.replies, state.replies / elapsed, elapsed, state.closed_loop ? "closed loop" : "open loop");
+  if (!state.round_trips.empty()) {
+    vector<double>& times = state.round_trips;
+    sort(times.begin(), times.end());
+    printf("round trip ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", Percentile(times, 0.5) * 1e3,
+           Percentile(times, 0.9) * 1e3, Percentile(times, 0.99) * 1e3, times.back() * 1e3);
+  }
+  return state.opened > 0 ? 0 : 1;
+}
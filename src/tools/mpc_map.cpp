@@ -0,0 +1,46 @@
+// Writes the binary map of a track for mpc --reference: the spline path
+// of ReferencePath.h, sampled and indexed, so a server maps it into memory
+// at startup instead of fitting the track.
+//
+//   mpc_map TRACK OUT [--spacing M]
+//
+// TRACK is an "x,y" CSV such as lake_track_waypoints.csv; --spacing sets
+// the arc length between samples in metres (default 0.5).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "ReferencePath.h"
+#include "Track.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s TRACK OUT [--spacing M]\n", argv[0]);
+    return 2;
+  }
+  double spacing = 0.5;
+  for (int i = 3; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--spacing" && i + 1 < argc) {
+      spacing = atof(argv[++i]);
+    }
+  }
+
+  Track track;
+  if (!track.Load(argv[1])) {
+    fprintf(stderr, "Failed to read the track %s\n", argv[1]);
+    return 1;
+  }
+  ReferencePath path;
+  if (!path.Build(track, spacing)) {
+    fprintf(stderr, "Failed to build the path of %s\n", argv[1]);
+    return 1;
+  }
+  if (!path.Save(argv[2])) {
+    fprintf(stderr, "Failed to write %s\n", argv[2]);
+    return 1;
+  }
+  printf("%.0f m in %zu samples\n", path.Length(), path.Size());
+  return 0;
+}
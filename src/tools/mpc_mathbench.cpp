@@ -0,0 +1,161 @@
+// Accuracy and speed of the polynomial sin, cos and atan that the
+// rollouts of the mppi backend and the batch prediction evaluate in place
+// of libm (SimdKernels.h), at every level of the build the CPU supports,
+// next to libm's own loop:
+//
+//   heading   sin and cos of headings in [-pi, pi]
+//   yaw       the same in [-100, 100], yaw wound up over many turns
+//   slope     atan of reference slopes in [-3, 3]
+//   wide      atan in [-1e4, 1e4], past every step of the reduction
+//
+//   mpc_mathbench [--passes P] [--n N]
+//
+// Every function runs over N random values (default 4096, a chunk of
+// rollouts), P times over (default 50). Prints the nanoseconds per value
+// of the fastest and the median pass, and the largest error against the
+// long double functions, absolute and in ulps of the exact value. The
+// levels follow MPC_CPU_LEVEL as CpuKernels does.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "SimdKernels.h"
+
+using namespace std;
+
+// A range of inputs, and whether it is one of sin and cos or of atan.
+struct Range {
+  const char* name;
+  double low;
+  double high;
+  bool trigonometric;
+};
+
+static const Range ranges[] = {
+  { "heading", -M_PI, M_PI, true },
+  { "yaw", -100, 100, true },
+  { "slope", -3, 3, false },
+  { "wide", -1e4, 1e4, false },
+};
+
+// Largest errors of a function against the long double one.
+struct Errors {
+  double absolute;
+  double ulps;
+
+  Errors() : absolute(0), ulps(0) {}
+
+  void Add(double approximate, long double exact) {
+    long double error = fabsl(approximate - exact);
+    double e = double(exact);
+    double ulp = nextafter(fabs(e), INFINITY) - fabs(e);
+    absolute = max(absolute, double(error));
+    ulps = max(ulps, double(error / ulp));
+  }
+};
+
+template <class F>
+static void Time(const char* range, const char* name, size_t n, int passes, const Errors& errors, F run) {
+  Eigen::BenchTimer timer;
+  vector<double> times;
+  for (int pass = 0; pass < passes; pass++) {
+    timer.start();
+    run();
+    timer.stop();
+    times.push_back(timer.value(Eigen::REAL_TIMER) / n * 1e9);
+  }
+  sort(times.begin(), times.end());
+  printf("%-8s %-8s %9.2f %9.2f %11.2e %8.2f\n", range, name, times.front(), times[times.size() / 2],
+         errors.absolute, errors.ulps);
+}
+
+int main(int argc, char* argv[]) {
+  int passes = 50;
+  size_t n = 4096;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--passes" && i + 1 < argc) {
+      passes = max(atoi(argv[++i]), 1);
+    } else if (arg == "--n" && i + 1 < argc) {
+      n = size_t(max(atoi(argv[++i]), 1));
+    } else {
+      fprintf(stderr, "usage: %s [--passes P] [--n N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // The levels up to that of CpuKernels, which MPC_CPU_LEVEL may cap.
+  vector<const SimdKernels*> levels;
+  for (int level = 0; level <= int(CpuKernels().level); level++) {
+    if (const SimdKernels* kernels = KernelsFor(CpuLevel(level))) {
+      levels.push_back(kernels);
+    }
+  }
+
+  mt19937 rng(1);
+  vector<double> x(n);
+  vector<double> s(n);
+  vector<double> c(n);
+  printf("%zu values, %d passes, ns per value\n", n, passes);
+  printf("%-8s %-8s %9s %9s %11s %8s\n", "range", "version", "fastest", "median", "max error", "ulps");
+  for (const Range& range : ranges) {
+    uniform_real_distribution<double> u(range.low, range.high);
+    for (size_t i = 0; i < n; i++) {
+      x[i] = u(rng);
+    }
+
+    // libm's loop, and the errors of libm itself.
+    Errors errors;
+    for (size_t i = 0; i < n; i++) {
+      if (range.trigonometric) {
+        errors.Add(sin(x[i]), sinl(x[i]));
+        errors.Add(cos(x[i]), cosl(x[i]));
+      } else {
+        errors.Add(atan(x[i]), atanl(x[i]));
+      }
+    }
+    Time(range.name, "libm", n, passes, errors, [&]() {
+      for (size_t i = 0; i < n; i++) {
+        if (range.trigonometric) {
+          s[i] = sin(x[i]);
+          c[i] = cos(x[i]);
+        } else {
+          s[i] = atan(x[i]);
+        }
+      }
+      escape(s.data());
+      escape(c.data());
+    });
+
+    for (const SimdKernels* kernels : levels) {
+      errors = Errors();
+      if (range.trigonometric) {
+        kernels->sin_cos(x.data(), n, s.data(), c.data());
+      } else {
+        kernels->arc_tangent(x.data(), n, s.data());
+      }
+      for (size_t i = 0; i < n; i++) {
+        if (range.trigonometric) {
+          errors.Add(s[i], sinl(x[i]));
+          errors.Add(c[i], cosl(x[i]));
+        } else {
+          errors.Add(s[i], atanl(x[i]));
+        }
+      }
+      Time(range.name, CpuLevelName(kernels->level), n, passes, errors, [&]() {
+        if (range.trigonometric) {
+          kernels->sin_cos(x.data(), n, s.data(), c.data());
+        } else {
+          kernels->arc_tangent(x.data(), n, s.data());
+        }
+        escape(s.data());
+        escape(c.data());
+      });
+    }
+  }
+  return 0;
+}
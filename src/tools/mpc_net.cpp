@@ -0,0 +1,222 @@
+// Trains the warm start net of WarmStartNet.h: solves MPC<11> from a cold
+// start at random problems around the nominal driving regime, the pose
+// displaced by latency as the controller predicts it, and fits the net to
+// the actuators of the solves that converged.
+//
+//   mpc_net OUT [--samples K] [--epochs E] [--seed S]
+//
+// --samples sets the number of solves (default 20000), of which a tenth
+// is held out to report the error of the net; --epochs the passes of
+// Adam over the rest (default 200).
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Horner.h"
+#include "Layout.h"
+#include "Logger.h"
+#include "MPC.h"
+#include "WarmStartNet.h"
+
+using namespace std;
+
+typedef WarmStartNet Net;
+typedef Eigen::MatrixXd Matrix;
+
+static const size_t horizon = 11;
+static const size_t outputs = 2 * (horizon - 1);
+static const size_t batch = 64;
+static const double learning_rate = 1e-3;
+
+// A random problem in the vehicle frame: the pose predicted over up to
+// 150 ms of latency and a reference near it.
+static void RandomProblem(mt19937& rng, StateVector& state, Eigen::Vector4d& coeffs) {
+  uniform_real_distribution<double> unit(-1, 1);
+  double v = 25 + 20 * (unit(rng) + 1) / 2;
+  double lag = 0.075 * (unit(rng) + 1);
+  double steer = 0.1 * unit(rng);
+  double px = v * lag;
+  double psi = -v * steer / Lf * lag;
+  double py = px * psi / 2;
+  coeffs << 1.5 * unit(rng), 0.15 * unit(rng), 0.006 * unit(rng), 1.2e-4 * unit(rng);
+  double f_px;
+  double df_px;
+  Polyval<3>(coeffs, px, f_px, df_px);
+  state << px, py, psi, v, f_px - py, psi - atan(df_px);
+}
+
+// Mean and standard deviation of every row of samples, by column.
+static void Standardization(const Matrix& samples, Eigen::VectorXd& mean, Eigen::VectorXd& scale) {
+  mean = samples.rowwise().mean();
+  scale = ((samples.colwise() - mean).array().square().rowwise().sum() / samples.cols()).sqrt();
+  scale = scale.cwiseMax(1e-9);
+}
+
+// Adam over one parameter block.
+struct Adam {
+  Matrix m;
+  Matrix v;
+
+  template <class P>
+  void Step(P& param, const Matrix& grad, size_t t) {
+    if (m.size() == 0) {
+      m = Matrix::Zero(grad.rows(), grad.cols());
+      v = Matrix::Zero(grad.rows(), grad.cols());
+    }
+    m = 0.9 * m + 0.1 * grad;
+    v = 0.999 * v + 0.001 * grad.cwiseProduct(grad);
+    double correction = sqrt(1 - pow(0.999, double(t))) / (1 - pow(0.9, double(t)));
+    param -= (learning_rate * correction * m.array() / (v.array().sqrt() + 1e-8)).matrix();
+  }
+};
+
+// Mean square error of the net over the standardized inputs and outputs.
+static double Loss(const Net::Layers& layers, const Matrix& in, const Matrix& out) {
+  Matrix h1 = ((layers.w1 * in).colwise() + layers.b1).array().tanh();
+  Matrix h2 = ((layers.w2 * h1).colwise() + layers.b2).array().tanh();
+  Matrix y = (layers.w3 * h2).colwise() + layers.b3;
+  return (y - out).squaredNorm() / out.size();
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s OUT [--samples K] [--epochs E] [--seed S]\n", argv[0]);
+    return 2;
+  }
+  string path = argv[1];
+  size_t samples = 20000;
+  size_t epochs = 200;
+  unsigned seed = 1;
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--samples" && i + 1 < argc) {
+      samples = size_t(max(atoi(argv[++i]), 10));
+    } else if (arg == "--epochs" && i + 1 < argc) {
+      epochs = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = unsigned(atoi(argv[++i]));
+    }
+  }
+
+  // The problems and the actuators of their cold solves.
+  MPC<horizon> mpc;
+  mpc.Init(0, 0, 40);
+  mt19937 rng(seed);
+  Matrix inputs(size_t(Net::n_inputs), samples);
+  Matrix targets(outputs, samples);
+  size_t n = 0;
+  for (size_t i = 0; i < samples; i++) {
+    StateVector state;
+    Eigen::Vector4d coeffs;
+    RandomProblem(rng, state, coeffs);
+    mpc.Reset();
+    const MPC<horizon>::Result& result = mpc.Solve(state, coeffs);
+    if (result.ok) {
+      inputs.col(n).head<6>() = state;
+      inputs.col(n).tail<4>() = coeffs;
+      targets.col(n).head<horizon - 1>() = result.delta;
+      targets.col(n).tail<horizon - 1>() = result.a;
+      n++;
+    }
+    if ((i + 1) % 1000 == 0 || i + 1 == samples) {
+      fprintf(stderr, "%zu/%zu solves, %zu without a solution\n", i + 1, samples, i + 1 - n);
+    }
+  }
+  if (n < 10) {
+    fprintf(stderr, "Too few solutions to train on\n");
+    return 1;
+  }
+  inputs.conservativeResize(Eigen::NoChange, n);
+  targets.conservativeResize(Eigen::NoChange, n);
+
+  Net::Layers layers;
+  Eigen::VectorXd in_mean;
+  Eigen::VectorXd in_scale;
+  Standardization(inputs, in_mean, in_scale);
+  layers.in_mean = in_mean;
+  layers.in_scale = in_scale;
+  Standardization(targets, layers.out_mean, layers.out_scale);
+  Matrix x = (inputs.colwise() - in_mean).array().colwise() / in_scale.array();
+  Matrix y = (targets.colwise() - layers.out_mean).array().colwise() / layers.out_scale.array();
+
+  // Glorot initialization.
+  normal_distribution<double> normal(0, 1);
+  auto random = [&](size_t rows, size_t cols) {
+    Matrix m(rows, cols);
+    double s = sqrt(2.0 / (rows + cols));
+    for (Eigen::Index k = 0; k < m.size(); k++) {
+      m.data()[k] = s * normal(rng);
+    }
+    return m;
+  };
+  layers.w1 = random(Net::n_hidden, Net::n_inputs);
+  layers.b1.setZero();
+  layers.w2 = random(Net::n_hidden, Net::n_hidden);
+  layers.b2.setZero();
+  layers.w3 = random(outputs, Net::n_hidden);
+  layers.b3 = Eigen::VectorXd::Zero(outputs);
+
+  // The last tenth is held out.
+  size_t held = max<size_t>(n / 10, 1);
+  size_t train = n - held;
+  vector<size_t> order(train);
+  for (size_t i = 0; i < train; i++) {
+    order[i] = i;
+  }
+  Adam adam[6];
+  size_t t = 0;
+  for (size_t epoch = 0; epoch < epochs; epoch++) {
+    shuffle(order.begin(), order.end(), rng);
+    for (size_t first = 0; first < train; first += batch) {
+      size_t m = min(batch, train - first);
+      Matrix in(size_t(Net::n_inputs), m);
+      Matrix out(outputs, m);
+      for (size_t j = 0; j < m; j++) {
+        in.col(j) = x.col(order[first + j]);
+        out.col(j) = y.col(order[first + j]);
+      }
+      Matrix h1 = ((layers.w1 * in).colwise() + layers.b1).array().tanh();
+      Matrix h2 = ((layers.w2 * h1).colwise() + layers.b2).array().tanh();
+      Matrix d3 = ((layers.w3 * h2).colwise() + layers.b3 - out) * (2.0 / (m * outputs));
+      Matrix d2 = (layers.w3.transpose() * d3).cwiseProduct((1.0 - h2.array().square()).matrix());
+      Matrix d1 = (layers.w2.transpose() * d2).cwiseProduct((1.0 - h1.array().square()).matrix());
+      t++;
+      adam[0].Step(layers.w3, d3 * h2.transpose(), t);
+      adam[1].Step(layers.b3, d3.rowwise().sum(), t);
+      adam[2].Step(layers.w2, d2 * h1.transpose(), t);
+      adam[3].Step(layers.b2, d2.rowwise().sum(), t);
+      adam[4].Step(layers.w1, d1 * in.transpose(), t);
+      adam[5].Step(layers.b1, d1.rowwise().sum(), t);
+    }
+    if ((epoch + 1) % 20 == 0 || epoch + 1 == epochs) {
+      fprintf(stderr, "epoch %zu: training loss %.4f, held out %.4f\n", epoch + 1,
+              Loss(layers, x.leftCols(train), y.leftCols(train)),
+              Loss(layers, x.rightCols(held), y.rightCols(held)));
+    }
+  }
+
+  // Error of the first actuators on the held-out problems, in their units.
+  Net net(layers, horizon);
+  double delta_error = 0;
+  double a_error = 0;
+  Eigen::VectorXd predicted(outputs);
+  for (size_t i = train; i < n; i++) {
+    StateVector state = inputs.col(i).head<6>();
+    Eigen::Vector4d coeffs = inputs.col(i).tail<4>();
+    net.Predict(state, coeffs, predicted.data());
+    delta_error += pow(predicted[0] - targets(0, i), 2);
+    a_error += pow(predicted[horizon - 1] - targets(horizon - 1, i), 2);
+  }
+  printf("held-out RMS error: delta_0 %.4f rad, a_0 %.4f\n", sqrt(delta_error / held), sqrt(a_error / held));
+
+  FlushLog();
+  if (!net.Save(path)) {
+    fprintf(stderr, "Failed to write %s\n", path.c_str());
+    return 1;
+  }
+  return 0;
+}
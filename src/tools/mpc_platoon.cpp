@@ -0,0 +1,332 @@
+// Platoon of vehicles around the lake track, each with an MPC of its own
+// coupled to its neighbours' by a least gap along the path through
+// consensus ADMM (Platoon.h):
+//
+//   mpc_platoon [--track FILE] [--vehicles K] [--gap M] [--rounds R]
+//               [--rho W] [--speed V] [--seconds T] [--backend NAME]
+//               [--threads T]
+//
+// The K vehicles (default 4) start on the line, 1.5 gaps of M metres
+// apart (default 10), at speed V (default 40). The leader's reference
+// speed is 0.8 V and the others' V, so that without the coupling they
+// close up on it. Every frame of default_dt each vehicle solves R rounds
+// (default 3) of its MPC<11>, exchanging its predicted progress after
+// each; W is PlatoonOptions::rho, and 0 leaves the vehicles uncoupled.
+// The vehicles are solved on T threads (default: one per vehicle, up to
+// the cores), and the first control of each vehicle's last round drives
+// the kinematic model until the next frame, for T seconds of simulated
+// time (default 60).
+//
+// Prints the least and the mean gap driven, the frames that broke the
+// gap, the mean planned shortfall and consensus residual after the last
+// round, and the solve time per vehicle and frame, which holds as the
+// platoon grows.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Backends.h"
+#include "ClosedLoop.h"
+#include "Horner.h"
+#include "Layout.h"
+#include "MPC.h"
+#include "Platoon.h"
+#include "Polyfit.h"
+#include "Track.h"
+#include "Transform.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Horizon of the vehicles' MPCs.
+static const size_t horizon = 11;
+
+struct Vehicle {
+  unique_ptr<MPC<horizon> > mpc;
+  PoseVector pose;
+  ActuatorVector actuators;
+  // Waypoints passed since the start of the track, laps included.
+  size_t passed;
+  double v_free;
+  // The solve of this frame.
+  StateVector state;
+  Eigen::Vector4d coeffs;
+  double solve_time;
+};
+
+// Rounds of the vehicles of every thread in turn: the calling thread is
+// thread 0 and runs the vehicles it owns along with the others.
+class Crew {
+ public:
+  Crew(size_t threads, vector<Vehicle>& vehicles, PlatoonConsensus& consensus)
+      : vehicles_(vehicles), consensus_(consensus), workers_(threads), generation_(0), pending_(0), stop_(false) {
+    for (size_t t = 1; t < threads; t++) {
+      threads_.push_back(thread(&Crew::Work, this, t));
+    }
+  }
+
+  ~Crew() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (thread& t : threads_) {
+      t.join();
+    }
+  }
+
+  // Solve a round of every vehicle and report its plan.
+  void Round() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      pending_ = workers_ - 1;
+      generation_++;
+    }
+    start_.notify_all();
+    Solve(0);
+    unique_lock<mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_ == 0; });
+  }
+
+ private:
+  vector<Vehicle>& vehicles_;
+  PlatoonConsensus& consensus_;
+  size_t workers_;
+  mutex mutex_;
+  condition_variable start_;
+  condition_variable done_;
+  size_t generation_;
+  size_t pending_;
+  bool stop_;
+  vector<thread> threads_;
+
+  void Solve(size_t worker) {
+    double v_ref[horizon];
+    for (size_t i = worker; i < vehicles_.size(); i += workers_) {
+      Vehicle& vehicle = vehicles_[i];
+      consensus_.References(i, vehicle.v_free, v_ref);
+      vehicle.mpc->SetStageReferences(NULL, NULL, v_ref);
+      const MPC<horizon>::Result& result = vehicle.mpc->Solve(vehicle.state, vehicle.coeffs);
+      vehicle.solve_time += result.solve_time;
+      vehicle.actuators << result.delta[0], result.a[0];
+      consensus_.Report(i, result.v.data());
+    }
+  }
+
+  void Work(size_t worker) {
+    if (!MPCSolverThread()) {
+      return;
+    }
+    size_t seen = 0;
+    for (;;) {
+      {
+        unique_lock<mutex> lock(mutex_);
+        start_.wait(lock, [this, seen]() { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+      }
+      Solve(worker);
+      lock_guard<mutex> lock(mutex_);
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+};
+
+int main(int argc, char* argv[]) {
+  string track_path = "lake_track_waypoints.csv";
+  size_t n_vehicles = 4;
+  PlatoonOptions options;
+  int rounds = 3;
+  double speed = 40;
+  double seconds = 60;
+  MPCBackend backend = MPCBackend::RTI;
+  size_t threads = 0;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--track" && i + 1 < argc) {
+      track_path = argv[++i];
+    } else if (arg == "--vehicles" && i + 1 < argc) {
+      n_vehicles = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--gap" && i + 1 < argc) {
+      options.gap = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--rounds" && i + 1 < argc) {
+      rounds = max(atoi(argv[++i]), 1);
+    } else if (arg == "--rho" && i + 1 < argc) {
+      options.rho = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--speed" && i + 1 < argc) {
+      speed = max(atof(argv[++i]), 1.0);
+    } else if (arg == "--seconds" && i + 1 < argc) {
+      seconds = max(atof(argv[++i]), default_dt);
+    } else if (arg == "--backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      backend = named->backend;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threads = size_t(max(atoi(argv[++i]), 1));
+    } else {
+      fprintf(stderr,
+              "usage: %s [--track FILE] [--vehicles K] [--gap M] [--rounds R] [--rho W] [--speed V]\n"
+              "       [--seconds T] [--backend NAME] [--threads T]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  Track track;
+  if (!track.Load(track_path)) {
+    fprintf(stderr, "Failed to read the track %s\n", track_path.c_str());
+    return 1;
+  }
+  const size_t n = track.Size();
+  // Distance along the line to every waypoint of the first lap, and of
+  // the lap.
+  vector<double> arc(n + 1, 0.0);
+  for (size_t i = 0; i < n; i++) {
+    size_t j = (i + 1) % n;
+    arc[i + 1] = arc[i] + hypot(track.x[j] - track.x[i], track.y[j] - track.y[i]);
+  }
+  const double lap = arc[n];
+  auto progress = [&](const Vehicle& vehicle) {
+    size_t i = vehicle.passed % n;
+    size_t j = (i + 1) % n;
+    double dx = track.x[j] - track.x[i];
+    double dy = track.y[j] - track.y[i];
+    double along = ((vehicle.pose(0) - track.x[i]) * dx + (vehicle.pose(1) - track.y[i]) * dy) / hypot(dx, dy);
+    return (vehicle.passed / n) * lap + arc[i] + along;
+  };
+
+  // The leader at the first waypoint far enough along for the others to
+  // start behind it.
+  const double spacing = 1.5 * options.gap;
+  size_t lead = 0;
+  while (lead < n && arc[lead] < spacing * (n_vehicles - 1)) {
+    lead++;
+  }
+  if (lead >= n) {
+    fprintf(stderr, "%zu vehicles %.1f m apart do not fit on the track\n", n_vehicles, spacing);
+    return 2;
+  }
+
+  if (threads == 0) {
+    threads = min<size_t>(n_vehicles, max(thread::hardware_concurrency(), 1u));
+  }
+  threads = min(threads, n_vehicles);
+  if (threads > 1) {
+    threads = min(threads, MPCParallelSetup(threads) + 1);
+  }
+
+  vector<Vehicle> vehicles(n_vehicles);
+  for (size_t k = 0; k < n_vehicles; k++) {
+    Vehicle& vehicle = vehicles[k];
+    size_t start = lead;
+    while (start > 0 && arc[lead] - arc[start] < spacing * k) {
+      start--;
+    }
+    vehicle.v_free = k == 0 ? 0.8 * speed : speed;
+    vehicle.mpc.reset(new MPC<horizon>());
+    vehicle.mpc->Init(0, 0, vehicle.v_free);
+    vehicle.mpc->SetBackend(backend);
+    vehicle.pose << track.x[start], track.y[start], track.Heading(start), speed;
+    vehicle.actuators << 0, 0;
+    vehicle.passed = start;
+    vehicle.solve_time = 0;
+  }
+
+  PlatoonConsensus consensus(n_vehicles, horizon, default_dt, options);
+  Crew crew(threads, vehicles, consensus);
+  printf("%zu vehicles, gap %.1f m, %d rounds per frame on %zu threads\n", n_vehicles, options.gap, rounds,
+         threads);
+
+  const size_t window = closed_loop::window;
+  double xs[window];
+  double ys[window];
+  double xvals[window];
+  double yvals[window];
+  vector<double> at(n_vehicles);
+  double least_gap = INFINITY;
+  double gap_sum = 0;
+  size_t gaps = 0;
+  size_t broken = 0;
+  double shortfall_sum = 0;
+  double residual_sum = 0;
+  size_t frames = 0;
+  bool off_track = false;
+  steady_clock::time_point wall_start = steady_clock::now();
+  for (double t = 0; t < seconds && !off_track; t += default_dt) {
+    for (size_t k = 0; k < n_vehicles; k++) {
+      Vehicle& vehicle = vehicles[k];
+      track.Window(vehicle.passed % n + 1, window, xs, ys);
+      ToVehicleFrame(xs, ys, window, vehicle.pose(0), vehicle.pose(1), vehicle.pose(2), xvals, yvals);
+      vehicle.coeffs = Polyfit<3>(xvals, yvals, window);
+      vehicle.state << 0, 0, 0, vehicle.pose(3), Polyval<3>(vehicle.coeffs, 0.0), -atan(vehicle.coeffs[1]);
+      at[k] = progress(vehicle);
+    }
+    consensus.Begin(at.data());
+    double residual = 0;
+    for (int r = 0; r < rounds; r++) {
+      crew.Round();
+      residual = consensus.Exchange();
+    }
+    shortfall_sum += max(consensus.Violation(), 0.0);
+    residual_sum += residual;
+    frames++;
+
+    bool breaks = false;
+    for (size_t k = 0; k < n_vehicles; k++) {
+      Vehicle& vehicle = vehicles[k];
+      PoseArrays pose = { 1, &vehicle.pose(0), &vehicle.pose(1), &vehicle.pose(2), &vehicle.pose(3),
+                          &vehicle.actuators(0), &vehicle.actuators(1) };
+      for (double step = 0; step < default_dt - 1e-9; step += closed_loop::sim_step) {
+        MPC<horizon>::PredictBatch(pose, min(closed_loop::sim_step, default_dt - step));
+      }
+      size_t i = vehicle.passed % n;
+      vehicle.passed += closed_loop::Advance(track, i, vehicle.pose(0), vehicle.pose(1));
+      double offset = min(closed_loop::Offset(track, vehicle.passed % n, vehicle.pose(0), vehicle.pose(1)),
+                          closed_loop::Offset(track, (vehicle.passed + n - 1) % n, vehicle.pose(0), vehicle.pose(1)));
+      if (offset > closed_loop::max_offset) {
+        fprintf(stderr, "Vehicle %zu left the track at t = %.1f s\n", k, t);
+        off_track = true;
+      }
+      at[k] = progress(vehicle);
+      if (k > 0) {
+        double gap = at[k - 1] - at[k];
+        least_gap = min(least_gap, gap);
+        gap_sum += gap;
+        gaps++;
+        breaks = breaks || gap < options.gap;
+      }
+    }
+    broken += breaks;
+  }
+  double wall = duration<double>(steady_clock::now() - wall_start).count();
+
+  double solve_time = 0;
+  for (const Vehicle& vehicle : vehicles) {
+    solve_time += vehicle.solve_time;
+  }
+  frames = max<size_t>(frames, 1);
+  if (gaps > 0) {
+    printf("gap: least %.2f m, mean %.2f m, broken in %zu of %zu frames\n", least_gap, gap_sum / gaps, broken,
+           frames);
+  }
+  printf("after the last round: planned shortfall %.3f m, residual %.3f m (means per frame)\n",
+         shortfall_sum / frames, residual_sum / frames);
+  printf("solve per vehicle and frame %.3f ms, wall per frame %.3f ms\n",
+         solve_time / (frames * n_vehicles) * 1e3, wall / frames * 1e3);
+  return off_track ? 1 : 0;
+}
@@ -0,0 +1,342 @@
+// Replays a telemetry log recorded with mpc --record FILE through the
+// server's pipeline: decoding, coordinate transform, fit, solve and
+// formatting of the reply, with one Controller per recorded connection.
+//
+//   mpc_replay LOG [--realtime] [--backend NAME] [--window-fit]
+//              [--multi-start K] [--table FILE] [--deadline MS]
+//              [--slowest N] [--trace FILE] [--adaptive-horizon]
+//              [--load-shedding] [--shed-backend NAME]
+//              [--mppi-threads T] [--mppi-seed S] [--check-threads T]
+//
+// By default frames are replayed back to back, as fast as they solve.
+// --realtime replays them at their recorded arrival times instead, and
+// reports how late each frame started when a solve overran the next
+// arrival. Replies are not sent anywhere, and unlike the server no frame
+// is ever dropped for a newer one. --trace writes the spans of the last
+// frames, as in the server's /trace, to FILE. --load-shedding gives up
+// optional work as the frames near their budget, as the server's does,
+// down to the backend --shed-backend (rti by default; see
+// LoadShedding.h).
+//
+// --check-threads T replays the log twice on the recorded clock instead,
+// once with the MPPI rollouts on one thread and once on T, and exits
+// with 1 unless every reply of the two is the same bit for bit. Solve
+// times do not reach the controller there: the latency estimate stays at
+// the configured latency, and deadlines, the adaptive horizon and the
+// load shedding are off.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Backends.h"
+#include "BinaryProtocol.h"
+#include "ControlTable.h"
+#include "Controller.h"
+#include "Logger.h"
+#include "TelemetryLog.h"
+#include "Trace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+struct Timing {
+  size_t index;
+  uint32_t connection;
+  double decode;
+  double solve;
+  double late;
+};
+
+static double Percentile(const vector<double>& sorted, double p) {
+  size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+static void Report(const char* name, vector<double> times) {
+  if (times.empty()) {
+    return;
+  }
+  sort(times.begin(), times.end());
+  printf("%-7s %9.3f %9.3f %9.3f %9.3f\n", name, Percentile(times, 0.5) * 1e3,
+         Percentile(times, 0.9) * 1e3, Percentile(times, 0.99) * 1e3, times.back() * 1e3);
+}
+
+// The actuators, cost and plan of every reply to a frame of the log.
+static bool ReplayOnRecordedClock(const string& path, const ControllerOptions& options,
+                                  vector<Observation>& replies) {
+  TelemetryReader reader;
+  if (!reader.Open(path)) {
+    return false;
+  }
+  map<uint32_t, unique_ptr<Controller>> controllers;
+  map<uint32_t, WaypointWindow> waypoints;
+  LoggedEvent event;
+  Telemetry frame;
+  Command command;
+  PipelineClock::time_point start = PipelineClock::now();
+  while (reader.Next(event)) {
+    if (event.kind == LoggedKind::Connect) {
+      controllers[event.connection].reset(new Controller(options));
+      waypoints[event.connection] = WaypointWindow();
+      continue;
+    }
+    if (event.kind == LoggedKind::Disconnect) {
+      controllers.erase(event.connection);
+      waypoints.erase(event.connection);
+      continue;
+    }
+    auto it = controllers.find(event.connection);
+    if (it == controllers.end()) {
+      continue;
+    }
+    bool telemetry;
+    if (event.kind == LoggedKind::Binary) {
+      Framing framing;
+      telemetry = DecodeBinary(event.data.data(), event.data.size(), framing, frame,
+                               &waypoints[event.connection]) == BinaryMessage::Telemetry;
+    } else {
+      telemetry = DecodeTelemetry(event.data.data(), event.data.size(), frame) == TelemetryMessage::Telemetry;
+    }
+    if (!telemetry) {
+      continue;
+    }
+    PipelineClock::time_point received = start + duration_cast<PipelineClock::duration>(nanoseconds(event.time_ns));
+    frame.ws = NULL;
+    frame.received = received;
+    frame.arrived = frame.received;
+    command.ws = NULL;
+    command.framing = frame.framing;
+    command.received = received;
+    command.arrived = command.received;
+    it->second->Solve(frame, command);
+    it->second->Delivered(command, received);
+    replies.push_back(command.observation);
+  }
+  return true;
+}
+
+// Whether two replies agree bit for bit in what the vehicle is sent and
+// planned, whatever the time each took.
+static bool SameReply(const Observation& a, const Observation& b) {
+  return memcmp(&a.steering_angle, &b.steering_angle, sizeof(double)) == 0 &&
+         memcmp(&a.throttle, &b.throttle, sizeof(double)) == 0 && memcmp(&a.cost, &b.cost, sizeof(double)) == 0 &&
+         a.ok == b.ok && a.iterations == b.iterations && a.n_mpc == b.n_mpc &&
+         memcmp(a.mpc_x, b.mpc_x, a.n_mpc * sizeof(double)) == 0 &&
+         memcmp(a.mpc_y, b.mpc_y, a.n_mpc * sizeof(double)) == 0;
+}
+
+static int CheckThreads(const string& path, ControllerOptions options, int threads) {
+  options.deadline_ms = 0;
+  options.adaptive_horizon = false;
+  options.load_shedding = false;
+  vector<Observation> serial;
+  vector<Observation> parallel;
+  options.sampling_threads = 1;
+  if (!ReplayOnRecordedClock(path, options, serial)) {
+    fprintf(stderr, "Failed to read the telemetry log %s\n", path.c_str());
+    return 1;
+  }
+  options.sampling_threads = threads;
+  ReplayOnRecordedClock(path, options, parallel);
+  FlushLog();
+  for (size_t i = 0; i < min(serial.size(), parallel.size()); i++) {
+    if (!SameReply(serial[i], parallel[i])) {
+      printf("frame %zu differs: steering %.17g, throttle %.17g on 1 thread; %.17g, %.17g on %d\n", i,
+             serial[i].steering_angle, serial[i].throttle, parallel[i].steering_angle, parallel[i].throttle,
+             threads);
+      return 1;
+    }
+  }
+  if (serial.size() != parallel.size()) {
+    printf("%zu frames on 1 thread, %zu on %d\n", serial.size(), parallel.size(), threads);
+    return 1;
+  }
+  printf("%zu frames, the same on 1 and %d threads\n", serial.size(), threads);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s LOG [--realtime] [--backend NAME] [--window-fit] [--multi-start K]"
+            " [--table FILE] [--deadline MS] [--slowest N] [--trace FILE] [--adaptive-horizon]"
+            " [--load-shedding] [--shed-backend NAME] [--mppi-threads T] [--mppi-seed S]"
+            " [--check-threads T]\n", argv[0]);
+    return 2;
+  }
+  string path = argv[1];
+  bool realtime = false;
+  size_t slowest = 5;
+  string trace_path;
+  int check_threads = 0;
+  ControllerOptions options;
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--realtime") {
+      realtime = true;
+    } else if (arg == "--backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      options.backend = named->backend;
+    } else if (arg == "--window-fit") {
+      options.window_fit = true;
+    } else if (arg == "--multi-start" && i + 1 < argc) {
+      options.multi_start = max(atoi(argv[++i]), 1);
+    } else if (arg == "--table" && i + 1 < argc) {
+      shared_ptr<ControlTable> table = make_shared<ControlTable>();
+      if (!table->Load(argv[++i])) {
+        fprintf(stderr, "Failed to read the control table %s\n", argv[i]);
+        return 1;
+      }
+      options.table = table;
+    } else if (arg == "--deadline" && i + 1 < argc) {
+      options.deadline_ms = max(atoi(argv[++i]), 0);
+    } else if (arg == "--slowest" && i + 1 < argc) {
+      slowest = size_t(max(atoi(argv[++i]), 0));
+    } else if (arg == "--trace" && i + 1 < argc) {
+      trace_path = argv[++i];
+      SetTracing(true);
+    } else if (arg == "--adaptive-horizon") {
+      options.adaptive_horizon = true;
+    } else if (arg == "--load-shedding") {
+      options.load_shedding = true;
+    } else if (arg == "--shed-backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      options.shed_backend = named->backend;
+    } else if (arg == "--mppi-threads" && i + 1 < argc) {
+      options.sampling_threads = max(atoi(argv[++i]), 1);
+    } else if (arg == "--mppi-seed" && i + 1 < argc) {
+      options.sampling_seed = strtoull(argv[++i], NULL, 10);
+    } else if (arg == "--check-threads" && i + 1 < argc) {
+      check_threads = max(atoi(argv[++i]), 1);
+    }
+  }
+  SetLogLevel(LogLevel::Warning);
+  if (check_threads > 0) {
+    return CheckThreads(path, options, check_threads);
+  }
+
+  TelemetryReader reader;
+  if (!reader.Open(path)) {
+    fprintf(stderr, "Failed to read the telemetry log %s\n", path.c_str());
+    return 1;
+  }
+
+  // Controllers of the connections currently open in the log, and the
+  // waypoints their waypoints frames build on.
+  map<uint32_t, unique_ptr<Controller>> controllers;
+  map<uint32_t, WaypointWindow> waypoints;
+  LoggedEvent event;
+  Telemetry frame;
+  Command command;
+  vector<Timing> timings;
+  size_t events = 0;
+  size_t invalid = 0;
+
+  PipelineClock::time_point start = PipelineClock::now();
+  while (reader.Next(event)) {
+    events++;
+    if (event.kind == LoggedKind::Connect) {
+      controllers[event.connection].reset(new Controller(options));
+      waypoints[event.connection] = WaypointWindow();
+      continue;
+    }
+    if (event.kind == LoggedKind::Disconnect) {
+      controllers.erase(event.connection);
+      waypoints.erase(event.connection);
+      continue;
+    }
+    auto it = controllers.find(event.connection);
+    if (it == controllers.end()) {
+      invalid++;
+      continue;
+    }
+
+    PipelineClock::time_point due = start + duration_cast<PipelineClock::duration>(nanoseconds(event.time_ns));
+    if (realtime) {
+      this_thread::sleep_until(due);
+    }
+    PipelineClock::time_point received = PipelineClock::now();
+
+    bool telemetry;
+    if (event.kind == LoggedKind::Binary) {
+      Framing framing;
+      telemetry = DecodeBinary(event.data.data(), event.data.size(), framing, frame,
+                               &waypoints[event.connection]) == BinaryMessage::Telemetry;
+    } else {
+      telemetry = DecodeTelemetry(event.data.data(), event.data.size(), frame) == TelemetryMessage::Telemetry;
+    }
+    if (!telemetry) {
+      continue;
+    }
+    PipelineClock::time_point decoded = PipelineClock::now();
+    frame.ws = NULL;
+    frame.received = received;
+    frame.arrived = frame.received;
+    command.ws = NULL;
+    command.framing = frame.framing;
+    command.received = received;
+    command.arrived = command.received;
+
+    it->second->Solve(frame, command);
+    PipelineClock::time_point solved = PipelineClock::now();
+    it->second->Delivered(command, solved);
+
+    Timing timing;
+    timing.index = events - 1;
+    timing.connection = event.connection;
+    timing.decode = duration<double>(decoded - received).count();
+    timing.solve = duration<double>(solved - decoded).count();
+    timing.late = realtime ? max(duration<double>(received - due).count(), 0.0) : 0;
+    timings.push_back(timing);
+  }
+  double wall = duration<double>(PipelineClock::now() - start).count();
+  FlushLog();
+  if (!trace_path.empty() && !WriteTraceFile(trace_path)) {
+    fprintf(stderr, "Failed to write the trace %s\n", trace_path.c_str());
+  }
+
+  printf("%zu events, %zu frames in %.3f s, %.0f frames/s%s\n", events, timings.size(), wall,
+         timings.size() / wall, realtime ? " (recorded cadence)" : "");
+  if (invalid > 0) {
+    printf("%zu messages outside a recorded connection\n", invalid);
+  }
+  if (timings.empty()) {
+    return 0;
+  }
+
+  vector<double> decode;
+  vector<double> solve;
+  vector<double> late;
+  for (const Timing& timing : timings) {
+    decode.push_back(timing.decode);
+    solve.push_back(timing.solve);
+    late.push_back(timing.late);
+  }
+  printf("%-7s %9s %9s %9s %9s   ms\n", "stage", "p50", "p90", "p99", "max");
+  Report("decode", decode);
+  Report("solve", solve);
+  if (realtime) {
+    Report("late", late);
+  }
+
+  // The frames behind the spikes, by event index in the log.
+  sort(timings.begin(), timings.end(), [](const Timing& a, const Timing& b) { return a.solve > b.solve; });
+  for (size_t i = 0; i < min(slowest, timings.size()); i++) {
+    printf("slowest #%zu: event %zu of connection %u, solve %.3f ms\n", i + 1, timings[i].index,
+           timings[i].connection, timings[i].solve * 1e3);
+  }
+  return 0;
+}
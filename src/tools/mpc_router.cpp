@@ -0,0 +1,364 @@
+// Router of simulator and gateway connections over many mpc processes, on
+// this host or others, so a fleet scales past one server:
+//
+//   mpc_router --backend HOST:PORT [--backend HOST:PORT ...] [--port P]
+//              [--capacity K] [--retry-ms MS] [--affinity-s S]
+//
+// Every connection to port P (default 4567) is forwarded to one backend,
+// on a websocket of its own with the path and query of the vehicle's, and
+// the frames go through both ways as they are, text or binary, without
+// being parsed. A vehicle that names a session (?session=ID) goes to the
+// backend its session was placed on, where the controller it left is
+// held warm for the backend's grace period (mpc --session-grace); a new
+// session, or one without, goes to the backend with the fewest sessions
+// routed to it, the first of them on a tie. The placement of a session is
+// remembered for S seconds after its last connection closes (default 600).
+//
+// --capacity K routes at most K sessions to a backend (default 0, no
+// limit), so that one whose controllers are all in use is passed over
+// rather than turning the vehicle away. A vehicle no backend takes is
+// closed, as mpc closes it when it is full. A backend that cannot be
+// connected to is passed over for MS milliseconds (default 2000), and the
+// vehicle tried on the next. When either side of a route closes, the
+// router closes the other, so a vehicle reconnects, with its session,
+// through the router again.
+//
+// Frames that arrive before the backend's socket opens are held, up to
+// max_held of them, and sent on in order once it does. /observe goes to
+// the backend numbered by ?backend=I, in the order of the flags (default
+// the first). GET /backends lists every backend: its URL, whether it is
+// up, the sessions routed to it now and in all, and its failures.
+//
+// The router is one event loop without TLS or compression; it does no
+// more per frame than copy it from one socket to the other.
+#include <stdio.h>
+#include <stdlib.h>
+#include <uWS/uWS.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+typedef uWS::WebSocket<uWS::SERVER> Vehicle;
+typedef uWS::WebSocket<uWS::CLIENT> Upstream;
+
+// Frames held for a route whose backend socket is still opening.
+static const size_t max_held = 64;
+
+// How often forgotten placements are pruned.
+static const int prune_ms = 10000;
+
+struct Backend {
+  string url;
+  // Sessions routed to it now, including those still connecting, and in
+  // all.
+  size_t sessions;
+  size_t routed;
+  size_t failures;
+  // Passed over until then, after a failed connection.
+  Clock::time_point down_until;
+};
+
+// A vehicle's connection and its backend's. It is freed once both sockets
+// are gone and no connection to a backend is pending.
+struct Route {
+  Vehicle* vehicle;
+  Upstream* upstream;
+  bool connecting;
+  // An /observe connection, which is not a session of its backend.
+  bool observer;
+  // The backend it is placed on, or -1.
+  int backend;
+  string target;
+  string session;
+  vector<bool> tried;
+  vector<pair<string, uWS::OpCode> > held;
+};
+
+struct Placement {
+  int backend;
+  // When its last connection closed, or the time_point zero while one is
+  // open.
+  Clock::time_point released;
+};
+
+struct Router {
+  uWS::Hub* hub;
+  vector<Backend> backends;
+  size_t capacity;
+  Clock::duration retry;
+  Clock::duration affinity;
+  map<string, Placement> placements;
+  size_t refused;
+};
+
+static Router* router;
+
+// The value of name in the query string of a URL, "name=value&...", or
+// empty.
+static string QueryValue(const string& query, const string& name) {
+  size_t begin = 0;
+  while (begin < query.size()) {
+    size_t end = min(query.find('&', begin), query.size());
+    if (query.compare(begin, name.size() + 1, name + "=") == 0) {
+      return query.substr(begin + name.size() + 1, end - begin - name.size() - 1);
+    }
+    begin = end + 1;
+  }
+  return string();
+}
+
+static bool Available(const Backend& backend, Clock::time_point now) {
+  return now >= backend.down_until && (router->capacity == 0 || backend.sessions < router->capacity);
+}
+
+// The backend for the route: its session's, if that one is available and
+// not tried yet, else the least loaded one left, or -1.
+static int Choose(const Route& route, Clock::time_point now) {
+  auto placed = router->placements.find(route.session);
+  if (!route.session.empty() && placed != router->placements.end()) {
+    int i = placed->second.backend;
+    if (!route.tried[i] && Available(router->backends[i], now)) {
+      return i;
+    }
+  }
+  int best = -1;
+  for (size_t i = 0; i < router->backends.size(); i++) {
+    const Backend& backend = router->backends[i];
+    if (!route.tried[i] && Available(backend, now) &&
+        (best < 0 || backend.sessions < router->backends[best].sessions)) {
+      best = int(i);
+    }
+  }
+  return best;
+}
+
+static void Release(Route* route) {
+  if (!route->vehicle && !route->upstream && !route->connecting) {
+    delete route;
+  }
+}
+
+// Take the route off its backend, remembering when its session left.
+static void Unplace(Route* route) {
+  if (route->backend < 0) {
+    return;
+  }
+  if (!route->observer) {
+    router->backends[route->backend].sessions--;
+  }
+  route->backend = -1;
+  if (!route->session.empty()) {
+    auto placed = router->placements.find(route->session);
+    if (placed != router->placements.end()) {
+      placed->second.released = Clock::now();
+    }
+  }
+}
+
+// Connect the route to its next backend, or close the vehicle when none is
+// left.
+static void Place(Route* route) {
+  Clock::time_point now = Clock::now();
+  int i = Choose(*route, now);
+  if (i < 0) {
+    router->refused++;
+    fprintf(stderr, "No backend for a vehicle%s%s, closing it\n", route->session.empty() ? "" : " of session ",
+            route->session.c_str());
+    route->vehicle->close();
+    return;
+  }
+  Backend& backend = router->backends[i];
+  route->tried[i] = true;
+  route->backend = i;
+  if (!route->observer) {
+    backend.sessions++;
+    backend.routed++;
+  }
+  if (!route->session.empty()) {
+    Placement placement = { i, Clock::time_point() };
+    router->placements[route->session] = placement;
+  }
+  route->connecting = true;
+  router->hub->connect(backend.url + route->target, route);
+}
+
+static void OnPrune(uS::Timer*) {
+  Clock::time_point now = Clock::now();
+  for (auto placed = router->placements.begin(); placed != router->placements.end();) {
+    const Placement& placement = placed->second;
+    if (placement.released != Clock::time_point() && now - placement.released > router->affinity) {
+      placed = router->placements.erase(placed);
+    } else {
+      ++placed;
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Router state;
+  state.capacity = 0;
+  state.retry = chrono::milliseconds(2000);
+  state.affinity = chrono::seconds(600);
+  state.refused = 0;
+  int port = 4567;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--backend" && i + 1 < argc) {
+      string url = argv[++i];
+      Backend backend = Backend();
+      backend.url = url.compare(0, 5, "ws://") == 0 ? url : "ws://" + url;
+      state.backends.push_back(backend);
+    } else if (arg == "--port" && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (arg == "--capacity" && i + 1 < argc) {
+      state.capacity = size_t(max(atoi(argv[++i]), 0));
+    } else if (arg == "--retry-ms" && i + 1 < argc) {
+      state.retry = chrono::milliseconds(max(atoi(argv[++i]), 0));
+    } else if (arg == "--affinity-s" && i + 1 < argc) {
+      state.affinity = chrono::seconds(max(atoi(argv[++i]), 0));
+    } else {
+      state.backends.clear();
+      break;
+    }
+  }
+  if (state.backends.empty()) {
+    fprintf(stderr,
+            "usage: %s --backend HOST:PORT [--backend HOST:PORT ...] [--port P]\n"
+            "          [--capacity K] [--retry-ms MS] [--affinity-s S]\n",
+            argv[0]);
+    return 2;
+  }
+
+  uWS::Hub h;
+  state.hub = &h;
+  router = &state;
+
+  h.onConnection([](Vehicle* ws, uWS::HttpRequest req) {
+    uWS::Header url = req.getUrl();
+    Route* route = new Route();
+    route->vehicle = ws;
+    route->upstream = NULL;
+    route->connecting = false;
+    route->observer = false;
+    route->backend = -1;
+    route->target = url ? string(url.value, url.valueLength) : string("/");
+    route->tried.assign(router->backends.size(), false);
+    ws->setUserData(route);
+    size_t query = min(route->target.find('?'), route->target.size());
+    string parameters = route->target.substr(min(query + 1, route->target.size()));
+    if (route->target.compare(0, query, "/observe") == 0) {
+      // Observers see the one backend they name, and are not placed by
+      // load: every other backend counts as tried.
+      size_t chosen = size_t(atoi(QueryValue(parameters, "backend").c_str()));
+      route->observer = true;
+      route->tried.assign(router->backends.size(), true);
+      if (chosen < router->backends.size()) {
+        route->tried[chosen] = false;
+      }
+    } else {
+      route->session = QueryValue(parameters, "session");
+    }
+    Place(route);
+  });
+
+  h.onConnection([](Upstream* ws, uWS::HttpRequest) {
+    Route* route = static_cast<Route*>(ws->getUserData());
+    route->connecting = false;
+    route->upstream = ws;
+    if (!route->vehicle) {
+      ws->close();
+      return;
+    }
+    for (auto& frame : route->held) {
+      ws->send(frame.first.data(), frame.first.length(), frame.second);
+    }
+    route->held.clear();
+  });
+
+  h.onError([](void* user) {
+    Route* route = static_cast<Route*>(user);
+    route->connecting = false;
+    Backend& backend = router->backends[route->backend];
+    backend.failures++;
+    backend.down_until = Clock::now() + router->retry;
+    fprintf(stderr, "Failed to connect to %s, passing it over for %lld ms\n", backend.url.c_str(),
+            (long long)chrono::duration_cast<chrono::milliseconds>(router->retry).count());
+    Unplace(route);
+    if (route->vehicle) {
+      Place(route);
+    } else {
+      Release(route);
+    }
+  });
+
+  h.onMessage([](Vehicle* ws, char* data, size_t length, uWS::OpCode opCode) {
+    Route* route = static_cast<Route*>(ws->getUserData());
+    if (route->upstream) {
+      route->upstream->send(data, length, opCode);
+    } else if (route->held.size() < max_held) {
+      route->held.push_back(make_pair(string(data, length), opCode));
+    }
+  });
+
+  h.onMessage([](Upstream* ws, char* data, size_t length, uWS::OpCode opCode) {
+    Route* route = static_cast<Route*>(ws->getUserData());
+    if (route->vehicle) {
+      route->vehicle->send(data, length, opCode);
+    }
+  });
+
+  h.onDisconnection([](Vehicle* ws, int, char*, size_t) {
+    Route* route = static_cast<Route*>(ws->getUserData());
+    ws->setUserData(NULL);
+    route->vehicle = NULL;
+    if (route->upstream) {
+      route->upstream->close();
+    }
+    Release(route);
+  });
+
+  h.onDisconnection([](Upstream* ws, int, char*, size_t) {
+    Route* route = static_cast<Route*>(ws->getUserData());
+    route->upstream = NULL;
+    Unplace(route);
+    if (route->vehicle) {
+      route->vehicle->close();
+    }
+    Release(route);
+  });
+
+  string listing;
+  h.onHttpRequest([&listing](uWS::HttpResponse* res, uWS::HttpRequest req, char*, size_t, size_t) {
+    uWS::Header url = req.getUrl();
+    string path(url.value, url.valueLength);
+    listing.clear();
+    if (path == "/backends") {
+      Clock::time_point now = Clock::now();
+      char line[512];
+      for (const Backend& backend : router->backends) {
+        snprintf(line, sizeof(line), "%s %s sessions %zu routed %zu failures %zu\n", backend.url.c_str(),
+                 now >= backend.down_until ? "up" : "down", backend.sessions, backend.routed, backend.failures);
+        listing += line;
+      }
+      snprintf(line, sizeof(line), "placements %zu refused %zu\n", router->placements.size(), router->refused);
+      listing += line;
+    }
+    res->end(listing.data(), listing.length());
+  });
+
+  if (!h.listen(port)) {
+    fprintf(stderr, "Failed to listen to port %d\n", port);
+    return 1;
+  }
+  fprintf(stderr, "Routing port %d over %zu backends\n", port, state.backends.size());
+  uS::Timer* prune = new uS::Timer(h.getLoop());
+  prune->start(OnPrune, prune_ms, prune_ms);
+  h.run();
+  return 0;
+}
@@ -0,0 +1,298 @@
+// Horizon scaling benchmark: how the solve time, memory and iterations of
+// every backend grow with the horizon, before committing to a longer
+// lookahead.
+//
+//   mpc_scaling [--backend NAME]... [--horizon N]... [--dt S]...
+//               [--samples S] [--reps R] [--max-iter I]
+//
+// The horizons are those instantiated: 7, 11 and 16, and with a build
+// configured with -DMPC_SCALING=ON also 5, 25, 50, 100 and 200 (see
+// MPC_FOR_EACH_SCALING_HORIZON, Layout.h). Every backend solves S
+// sampled cases (default 20) at every horizon and time step --dt
+// (default 0.1 s), each warm from the last, R times over (default 3)
+// after a first solve that records the tapes and sizes the buffers. The
+// cases keep to gentle curves and moderate speeds, so that the cubic
+// reference stays sensible over the 20 s of the longest horizon. The
+// Ipopt backends stop at I iterations (default 200) with their time limit
+// lifted.
+//
+// A line per backend, time step and horizon gives the median and p90
+// solve times in ms, the mean iterations, the memory of the instance in
+// KiB (MPC::AddFootprint: the tapes, the sparsity structures, the
+// estimated working set of Ipopt and the solver objects), the heap
+// allocations per solve (counted in a -DMPC_COUNT_ALLOCS=ON build only)
+// and the failed solves. The "slope" column is the exponent of the median
+// time in N from the horizon before, d log t / d log N, and the line that
+// closes each sweep fits one over all of them: about 1 for the linear
+// Riccati recursion and the banded sparse KKT systems of Ipopt, about 3
+// for the dense condensed QP of RTI once its factorization dominates.
+//
+// The first line names the BLAS of the build (MPC_BLAS in CMakeLists.txt)
+// and the GFLOP/s of its dgemm on 64 x 64 and 256 x 256 matrices: the
+// dgemm this process resolves, which is the one Ipopt and MUMPS call. A
+// reference BLAS shows as a fraction of the rate of a tuned one.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "AllocCount.h"
+#include "Backends.h"
+#include "Footprint.h"
+#include "Layout.h"
+#include "MPC.h"
+
+using namespace std;
+
+#ifndef MPC_BLAS_NAME
+#define MPC_BLAS_NAME ""
+#endif
+
+extern "C" void dgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+                       const double* alpha, const double* a, const int* lda, const double* b, const int* ldb,
+                       const double* beta, double* c, const int* ldc);
+
+// Ranges of the cases: cross-track and heading errors, curvature of the
+// reference at the vehicle (1 / m) and speed (m/s).
+static const double max_cte = 1;
+static const double max_epsi = 0.2;
+static const double max_curvature = 0.005;
+static const double min_speed = 5;
+static const double max_speed = 20;
+
+#define SCALING_HORIZON_VALUE(N) N,
+static const size_t scaling_horizons[] = { MPC_FOR_EACH_HORIZON(SCALING_HORIZON_VALUE)
+                                               MPC_FOR_EACH_SCALING_HORIZON(SCALING_HORIZON_VALUE) };
+#undef SCALING_HORIZON_VALUE
+static const size_t n_scaling_horizons = sizeof(scaling_horizons) / sizeof(scaling_horizons[0]);
+
+struct Case {
+  StateVector state;
+  Eigen::Vector4d coeffs;
+};
+
+struct Settings {
+  double dt;
+  int reps;
+  int max_iter;
+};
+
+// One line of the sweep.
+struct Row {
+  size_t horizon;
+  double median;
+  double p90;
+  double iterations;
+  size_t bytes;
+  double allocs;
+  size_t failed;
+};
+
+// Cases of the reference y = c0 + c1 x + c2 x^2 in the vehicle frame,
+// with the vehicle at the origin heading along x.
+static vector<Case> MakeCases(size_t samples) {
+  vector<Case> cases;
+  mt19937_64 random(1);
+  uniform_real_distribution<double> unit(-1, 1);
+  for (size_t i = 0; i < samples; i++) {
+    Case c;
+    double cte = max_cte * unit(random);
+    double epsi = max_epsi * unit(random);
+    double slope = -tan(epsi);
+    double curvature = max_curvature * unit(random);
+    c.coeffs << cte, slope, curvature * pow(1 + slope * slope, 1.5) / 2, 0;
+    c.state << 0, 0, 0, min_speed + (max_speed - min_speed) * (unit(random) + 1) / 2, cte, epsi;
+    cases.push_back(c);
+  }
+  return cases;
+}
+
+static double Percentile(const vector<double>& sorted, double p) {
+  size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+template <size_t N>
+static Row Run(const NamedBackend& named, const vector<Case>& cases, const Settings& settings) {
+  MPC<N> mpc;
+  mpc.Init(0, 0, max_speed);
+  mpc.SetBackend(named.backend);
+  mpc.SetTimestep(settings.dt);
+  IpoptOptions ipopt;
+  ipopt.max_iter = settings.max_iter;
+  ipopt.max_cpu_time = 1e6;
+  mpc.SetIpoptOptions(ipopt);
+  mpc.Solve(cases.front().state, cases.front().coeffs);
+
+  Eigen::BenchTimer timer;
+  vector<double> times;
+  times.reserve(cases.size() * settings.reps);
+  Row row = { N, 0, 0, 0, 0, 0, 0 };
+  size_t allocs = 0;
+  for (int rep = 0; rep < settings.reps; rep++) {
+    for (const Case& c : cases) {
+      size_t allocs_before = AllocCount();
+      timer.start();
+      const typename MPC<N>::Result& result = mpc.Solve(c.state, c.coeffs);
+      timer.stop();
+      allocs += AllocCount() - allocs_before;
+      escape((void*)&result);
+      times.push_back(timer.value(Eigen::REAL_TIMER));
+      row.iterations += result.iterations;
+      row.failed += result.ok ? 0 : 1;
+    }
+  }
+  Footprint footprint;
+  mpc.AddFootprint(footprint);
+
+  sort(times.begin(), times.end());
+  row.median = Percentile(times, 0.5);
+  row.p90 = Percentile(times, 0.9);
+  row.iterations /= times.size();
+  row.bytes = footprint.Total();
+  row.allocs = double(allocs) / times.size();
+  return row;
+}
+
+static void Print(const NamedBackend& named, double dt, const Row& row, const Row* previous) {
+  char slope[16] = "-";
+  if (previous && previous->median > 0 && row.median > 0) {
+    snprintf(slope, sizeof(slope), "%.2f",
+             log(row.median / previous->median) / log(double(row.horizon) / previous->horizon));
+  }
+  printf("%-8s %5.2f %4zu %9.3f %9.3f %7.1f %9.1f %8.1f %6zu %6s\n", named.name, dt, row.horizon,
+         row.median * 1e3, row.p90 * 1e3, row.iterations, row.bytes / 1024.0, row.allocs, row.failed, slope);
+}
+
+// Least-squares exponent k of t = c N^k over the sweep.
+static double FitExponent(const vector<Row>& rows) {
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  size_t n = 0;
+  for (const Row& row : rows) {
+    if (row.median <= 0) {
+      continue;
+    }
+    double x = log(double(row.horizon));
+    double y = log(row.median);
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    n++;
+  }
+  double det = n * sxx - sx * sx;
+  return n >= 2 && det > 0 ? (n * sxy - sx * sy) / det : 0;
+}
+
+static bool Instantiated(size_t n) {
+  return find(scaling_horizons, scaling_horizons + n_scaling_horizons, n) != scaling_horizons + n_scaling_horizons;
+}
+
+// GFLOP/s of dgemm on n x n matrices, over a tenth of a second.
+static double BlasRate(int n) {
+  vector<double> a(size_t(n) * n, 1.0);
+  vector<double> b(size_t(n) * n, 0.5);
+  vector<double> c(size_t(n) * n, 0.0);
+  const double one = 1;
+  const double zero = 0;
+  Eigen::BenchTimer timer;
+  size_t products = 0;
+  timer.start();
+  do {
+    dgemm_("N", "N", &n, &n, &n, &one, a.data(), &n, b.data(), &n, &zero, c.data(), &n);
+    products++;
+    timer.stop();
+  } while (timer.value(Eigen::REAL_TIMER) < 0.1);
+  return 2.0 * n * n * n * products / timer.value(Eigen::REAL_TIMER) * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+  vector<NamedBackend> selected;
+  vector<size_t> horizons;
+  vector<double> dts;
+  size_t samples = 20;
+  Settings settings;
+  settings.dt = default_dt;
+  settings.reps = 3;
+  settings.max_iter = 200;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      selected.push_back(*named);
+    } else if (arg == "--horizon" && i + 1 < argc) {
+      size_t n = size_t(max(atoi(argv[++i]), 0));
+      if (!Instantiated(n)) {
+        fprintf(stderr, "Horizon %s is not instantiated (see MPC_FOR_EACH_SCALING_HORIZON)\n", argv[i]);
+        return 2;
+      }
+      horizons.push_back(n);
+    } else if (arg == "--dt" && i + 1 < argc) {
+      double dt = atof(argv[++i]);
+      if (dt <= 0) {
+        fprintf(stderr, "Bad time step %s\n", argv[i]);
+        return 2;
+      }
+      dts.push_back(dt);
+    } else if (arg == "--samples" && i + 1 < argc) {
+      samples = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--reps" && i + 1 < argc) {
+      settings.reps = max(atoi(argv[++i]), 1);
+    } else if (arg == "--max-iter" && i + 1 < argc) {
+      settings.max_iter = max(atoi(argv[++i]), 1);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--backend NAME]... [--horizon N]... [--dt S]... [--samples S] [--reps R] "
+              "[--max-iter I]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (selected.empty()) {
+    selected.assign(named_backends, named_backends + n_named_backends);
+  }
+  if (horizons.empty()) {
+    horizons.assign(scaling_horizons, scaling_horizons + n_scaling_horizons);
+  }
+  sort(horizons.begin(), horizons.end());
+  horizons.erase(unique(horizons.begin(), horizons.end()), horizons.end());
+  if (dts.empty()) {
+    dts.push_back(default_dt);
+  }
+
+  vector<Case> cases = MakeCases(samples);
+  const char* blas = MPC_BLAS_NAME;
+  printf("BLAS %s: dgemm %.1f GFLOP/s at 64, %.1f at 256\n", blas[0] ? blas : "of Ipopt", BlasRate(64),
+         BlasRate(256));
+  printf("%zu cases x %d passes, Ipopt capped at %d iterations; times in ms, memory in KiB\n", cases.size(),
+         settings.reps, settings.max_iter);
+  printf("%-8s %5s %4s %9s %9s %7s %9s %8s %6s %6s\n", "backend", "dt", "N", "median", "p90", "iters", "memory",
+         "allocs", "failed", "slope");
+  for (const NamedBackend& named : selected) {
+    for (double dt : dts) {
+      settings.dt = dt;
+      vector<Row> rows;
+      for (size_t n : horizons) {
+#define RUN_HORIZON(N)                            \
+  if (n == N) {                                   \
+    rows.push_back(Run<N>(named, cases, settings)); \
+  }
+        MPC_FOR_EACH_HORIZON(RUN_HORIZON)
+        MPC_FOR_EACH_SCALING_HORIZON(RUN_HORIZON)
+#undef RUN_HORIZON
+        Print(named, dt, rows.back(), rows.size() > 1 ? &rows[rows.size() - 2] : NULL);
+      }
+      printf("%-8s %5.2f  time ~ N^%.2f over N = %zu..%zu\n", named.name, dt, FitExponent(rows),
+             horizons.front(), horizons.back());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,336 @@
+// Offline closed-loop simulator: drives the kinematic model of
+// MPC::Predict around lake_track_waypoints.csv with a Controller, the
+// pipeline main.cpp runs for every connection, and no websocket (see
+// ClosedLoop.h).
+//
+//   mpc_sim [--track FILE] [--laps L] [--latency MS] [--period MS]
+//           [--backend NAME] [--sensitivity-update U] [--mixed-precision R]
+//           [--window-fit] [--multi-start K]
+//           [--table FILE] [--warm-start-net FILE]
+//           [--weights FILE] [--weight NAME=VALUE]...
+//           [--horizon N] [--dt S] [--dt-growth G] [--adaptive-horizon]
+//           [--move-blocks L,L,...] [--reference] [--speed-profile]
+//           [--understeer K] [--plant-understeer K] [--terminal-cost] [--speculate]
+//           [--soft-boundary M] [--soft-steer-rate R] [--slack-weight W]
+//           [--max-steer-rate R] [--max-accel-rate R]
+//           [--linear-solver NAME] [--solver-threads T] [--tol T] [--mu-strategy S]
+//           [--limited-memory] [--gauss-newton] [--cold-start] [--user-scaling]
+//           [--fit-near-field M] [--fit-anchor]
+//           [--fit-points K] [--fit-spacing M] [--exact-cte]
+//           [--filter-state]
+//           [--event-trigger K] [--solution-cache K] [--hybrid]
+//           [--two-rate] [--plan-dt S] [--plan-interval MS]
+//           [--candidates O,O,...] [--scenarios MS:K,...]
+//           [--obstacles FILE] [--obstacle-margin M]
+//           [--baseline FILE] [--write-baseline FILE]
+//
+// Every period of simulated time the vehicle sends a frame with the six
+// waypoints nearest to it; its reply takes effect --latency MS later, as
+// the simulator's actuators do. Simulated time does not wait for the
+// solver, so this runs as fast as the solves do and is deterministic for
+// a given set of options. Exits with 1 when the vehicle leaves the track
+// or stops making progress.
+//
+// --weights reads the cost weights from FILE and each --weight sets one
+// more (see Weights.h); mpc_sweep runs many such settings at once.
+// --horizon picks one of the compiled horizons, --dt and --dt-growth its
+// time grid (see MPC::SetTimestep), and --adaptive-horizon lets the
+// controller switch between the horizons (see AdaptiveHorizon.h).
+// --move-blocks holds the actuators over blocks of stages of the given
+// lengths (see MPC::SetMoveBlocks). --reference takes the reference
+// polynomial from a spline through the track (see ReferencePath.h) rather
+// than from the waypoints of every frame, and --speed-profile the
+// reference speed from its speed profile as well. --plant-understeer gives the
+// simulated vehicle tires that slip with speed and --understeer the
+// controller's model of them (see MPC::SetUndersteer), both 0 by default.
+// --terminal-cost adds the LQR cost of the stages past the horizon to its
+// last stage (see MPC::SetTerminalCost).
+// --sensitivity-update answers frames of the Riccati backend with
+// first-order updates of its plan (see MPC::SetSensitivityUpdate).
+// --mixed-precision solves the QPs of the RTI and ADMM backends in float
+// with that many refinements (see MPC::SetMixedPrecision).
+// --speculate presolves every next frame between frames (see
+// MPC::Presolve); the solve times are those of the frames alone.
+// --soft-boundary, --soft-steer-rate and --slack-weight set the soft
+// constraints of the Ipopt backends, --max-steer-rate and --max-accel-rate
+// their hard rate limits (see LinearConstraints.h). --linear-solver,
+// --solver-threads, --tol, --mu-strategy, --limited-memory,
+// --gauss-newton, --cold-start and --user-scaling set the options of
+// Ipopt (see IpoptOptions.h); a multithreaded linear solver gets every
+// core without --solver-threads. --fit-near-field and
+// --fit-anchor weigh and anchor the fit of the waypoints, --fit-points
+// and --fit-spacing resample them first, --exact-cte measures the
+// errors from the nearest point of the fit, and --filter-state filters
+// the reported pose (see ControllerOptions). --event-trigger K answers the
+// frames the last plan still predicts from it, solving at least every
+// K-th (see ControllerOptions::replay_frames); the solve times then
+// include the replies made without a solve. --solution-cache K keeps
+// the solutions of the last K problems to answer them when met again (see
+// MPC::SetSolutionCache), which later laps do. --hybrid steers by pure
+// pursuit where the reference is gentle and solves elsewhere (see
+// ControllerOptions::hybrid). --two-rate, --plan-dt and --plan-interval
+// track the plan of a slow planner thread (see ControllerOptions::two_rate);
+// the planner runs in wall time, not simulated time. --candidates also
+// solves the reference shifted sideways by each offset and follows the
+// cheapest plan (see ControllerOptions::candidate_offsets). --scenarios
+// also solves for each extra latency and understeer and commands the
+// first control they agree on (see ControllerOptions::scenarios); the
+// simulated vehicle keeps its own --latency. --obstacles
+// and --obstacle-margin keep the plans clear of the circles of FILE (see
+// ControllerOptions::obstacles); the simulated vehicle does not collide
+// with them.
+//
+// In a build with MPC_COUNT_ALLOCS, allocations in the frames after the
+// first are listed per frame and stage (see AllocCount.h).
+//
+// --baseline FILE gates the run on the limits in FILE: the p99 solve
+// time, the heap allocations per frame after the first and the slowest
+// lap, and exits with 3 when any is exceeded (see Baseline.h).
+// --write-baseline FILE writes limits for later runs from this one, with
+// some margin.
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include "Backends.h"
+#include "Baseline.h"
+#include "ClosedLoop.h"
+#include "ControlTable.h"
+#include "Logger.h"
+#include "MoveBlocks.h"
+#include "ObstacleMap.h"
+#include "Scheduler.h"
+#include "Track.h"
+#include "TrackCache.h"
+#include "Weights.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  string track_path = "lake_track_waypoints.csv";
+  string obstacles_path;
+  bool reference = false;
+  ClosedLoopSettings settings;
+  ControllerOptions options;
+  Weights weights = default_weights;
+  string error;
+  string baseline_path;
+  string write_baseline_path;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--track" && i + 1 < argc) {
+      track_path = argv[++i];
+    } else if (arg == "--laps" && i + 1 < argc) {
+      settings.laps = max(atoi(argv[++i]), 1);
+    } else if (arg == "--latency" && i + 1 < argc) {
+      settings.latency = max(atoi(argv[++i]), 0) / 1000.0;
+    } else if (arg == "--period" && i + 1 < argc) {
+      settings.period = max(atoi(argv[++i]), 1) / 1000.0;
+    } else if (arg == "--sensitivity-update" && i + 1 < argc) {
+      options.sensitivity_update = atof(argv[++i]);
+    } else if (arg == "--mixed-precision" && i + 1 < argc) {
+      options.mixed_precision = max(atoi(argv[++i]), 0);
+    } else if (arg == "--backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      options.backend = named->backend;
+    } else if (arg == "--window-fit") {
+      options.window_fit = true;
+    } else if (arg == "--fit-near-field" && i + 1 < argc) {
+      options.fit_near_field = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--filter-state") {
+      options.filter_state = true;
+    } else if (arg == "--fit-anchor") {
+      options.fit_anchor = true;
+    } else if (arg == "--fit-points" && i + 1 < argc) {
+      options.fit_points = size_t(max(atoi(argv[++i]), 0));
+    } else if (arg == "--fit-spacing" && i + 1 < argc) {
+      options.fit_spacing = max(atof(argv[++i]), 0.1);
+    } else if (arg == "--exact-cte") {
+      options.exact_cte = true;
+    } else if (arg == "--event-trigger" && i + 1 < argc) {
+      options.replay_frames = max(atoi(argv[++i]), 0);
+    } else if (arg == "--solution-cache" && i + 1 < argc) {
+      options.solution_cache = size_t(max(atoi(argv[++i]), 0));
+    } else if (arg == "--hybrid") {
+      options.hybrid = true;
+    } else if (arg == "--two-rate") {
+      options.two_rate = true;
+    } else if (arg == "--plan-dt" && i + 1 < argc) {
+      options.plan_dt = max(atof(argv[++i]), 0.01);
+    } else if (arg == "--plan-interval" && i + 1 < argc) {
+      options.plan_interval_ms = max(atoi(argv[++i]), 0);
+    } else if (arg == "--candidates" && i + 1 < argc) {
+      if (!ParseOffsets(argv[++i], options.candidate_offsets)) {
+        fprintf(stderr, "Bad candidate offsets %s\n", argv[i]);
+        return 1;
+      }
+    } else if (arg == "--scenarios" && i + 1 < argc) {
+      if (!ParseScenarios(argv[++i], options.scenarios)) {
+        fprintf(stderr, "Bad scenarios %s\n", argv[i]);
+        return 1;
+      }
+    } else if (arg == "--multi-start" && i + 1 < argc) {
+      options.multi_start = max(atoi(argv[++i]), 1);
+    } else if (arg == "--table" && i + 1 < argc) {
+      shared_ptr<ControlTable> table = make_shared<ControlTable>();
+      if (!table->Load(argv[++i])) {
+        fprintf(stderr, "Failed to read the control table %s\n", argv[i]);
+        return 1;
+      }
+      options.table = table;
+    } else if (arg == "--warm-start-net" && i + 1 < argc) {
+      shared_ptr<WarmStartNet> net = make_shared<WarmStartNet>();
+      if (!net->Load(argv[++i])) {
+        fprintf(stderr, "Failed to read the warm start net %s\n", argv[i]);
+        return 1;
+      }
+      options.warm_start_net = net;
+    } else if (arg == "--horizon" && i + 1 < argc) {
+      options.horizon = size_t(max(atoi(argv[++i]), 0));
+    } else if (arg == "--dt" && i + 1 < argc) {
+      options.dt = max(atof(argv[++i]), 1e-3);
+    } else if (arg == "--dt-growth" && i + 1 < argc) {
+      options.dt_growth = max(atof(argv[++i]), 1e-3);
+    } else if (arg == "--adaptive-horizon") {
+      options.adaptive_horizon = true;
+    } else if (arg == "--understeer" && i + 1 < argc) {
+      options.understeer = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--terminal-cost") {
+      options.terminal_cost = true;
+    } else if (arg == "--plant-understeer" && i + 1 < argc) {
+      settings.understeer = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--soft-boundary" && i + 1 < argc) {
+      options.soft.boundary = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--soft-steer-rate" && i + 1 < argc) {
+      options.soft.max_ddelta = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--slack-weight" && i + 1 < argc) {
+      options.soft.weight = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--max-steer-rate" && i + 1 < argc) {
+      options.rate_limits.ddelta = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--max-accel-rate" && i + 1 < argc) {
+      options.rate_limits.da = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--linear-solver" && i + 1 < argc) {
+      options.ipopt.linear_solver = argv[++i];
+    } else if (arg == "--solver-threads" && i + 1 < argc) {
+      options.ipopt.linear_solver_threads = strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--tol" && i + 1 < argc) {
+      options.ipopt.tol = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--mu-strategy" && i + 1 < argc) {
+      options.ipopt.mu_strategy = argv[++i];
+    } else if (arg == "--limited-memory") {
+      options.ipopt.hessian_approximation = "limited-memory";
+    } else if (arg == "--gauss-newton") {
+      options.ipopt.gauss_newton = true;
+    } else if (arg == "--user-scaling") {
+      options.ipopt.user_scaling = true;
+    } else if (arg == "--cold-start") {
+      options.ipopt.warm_start = false;
+    } else if (arg == "--speculate") {
+      options.speculate = true;
+    } else if (arg == "--reference") {
+      reference = true;
+    } else if (arg == "--speed-profile") {
+      reference = true;
+      options.speed_profile = true;
+    } else if (arg == "--obstacles" && i + 1 < argc) {
+      obstacles_path = argv[++i];
+    } else if (arg == "--obstacle-margin" && i + 1 < argc) {
+      options.obstacle_margin = max(atof(argv[++i]), 0.0);
+    } else if (arg == "--move-blocks" && i + 1 < argc) {
+      if (!ParseMoveBlocks(argv[++i], options.move_blocks)) {
+        fprintf(stderr, "Bad move blocks %s\n", argv[i]);
+        return 2;
+      }
+    } else if (arg == "--weights" && i + 1 < argc) {
+      if (!LoadWeights(argv[++i], weights, error)) {
+        fprintf(stderr, "Failed to load the cost weights: %s\n", error.c_str());
+        return 1;
+      }
+    } else if (arg == "--baseline" && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else if (arg == "--write-baseline" && i + 1 < argc) {
+      write_baseline_path = argv[++i];
+    } else if (arg == "--weight" && i + 1 < argc) {
+      if (!ParseWeights(argv[++i], weights, error)) {
+        fprintf(stderr, "Bad weight %s: %s\n", argv[i], error.c_str());
+        return 2;
+      }
+    }
+  }
+  SetLogLevel(LogLevel::Warning);
+  SetCurrentWeights(weights);
+  if (MultithreadedLinearSolver(options.ipopt.linear_solver)) {
+    size_t threads = options.ipopt.linear_solver_threads;
+    MPCLinearSolverThreads(threads > 0 ? threads : ControlCoreBudget(1, 0));
+  }
+  PerfBaseline limits;
+  if (!baseline_path.empty() && !LoadBaseline(baseline_path, limits, error)) {
+    fprintf(stderr, "Failed to load the baseline: %s\n", error.c_str());
+    return 1;
+  }
+
+  Track track;
+  if (!track.Load(track_path)) {
+    fprintf(stderr, "Failed to read the track %s\n", track_path.c_str());
+    return 1;
+  }
+  if (reference) {
+    options.reference = TrackCache::Shared().Get(track_path);
+    if (!options.reference) {
+      fprintf(stderr, "Failed to build the reference path of %s\n", track_path.c_str());
+      return 1;
+    }
+  }
+  if (!obstacles_path.empty()) {
+    shared_ptr<ObstacleMap> obstacles = make_shared<ObstacleMap>();
+    if (!obstacles->Load(obstacles_path)) {
+      fprintf(stderr, "Failed to read the obstacles %s\n", obstacles_path.c_str());
+      return 1;
+    }
+    if (options.reference) {
+      obstacles->Index(*options.reference);
+    }
+    options.obstacles = obstacles;
+  }
+
+  ClosedLoopResult result = RunClosedLoop(track, settings, options);
+  FlushLog();
+
+  printf("%.2f laps in %.1f s simulated, %.3f s wall\n", result.laps, result.time, result.wall);
+  printf("%.2f laps/s, %.0f solves/s, %.1fx real time\n", result.laps / result.wall,
+         result.solves / result.wall, result.time / result.wall);
+  printf("offset from the line: mean %.3f m, max %.3f m, mean speed %.1f\n",
+         result.offset_mean, result.offset_max, result.speed_mean);
+  if (result.off_track) {
+    fprintf(stderr, "Off the track or stuck after %.1f s at (%g, %g)\n", result.time, result.px, result.py);
+    return 1;
+  }
+  if (result.steady_allocs > 0 && result.solves > 1) {
+    printf("allocations per frame after the first:");
+    for (int s = 0; s <= n_stages; s++) {
+      if (result.stage_allocs[s] > 0) {
+        printf(" %s %.2f", s < n_stages ? StageName(Stage(s)) : "other",
+               double(result.stage_allocs[s]) / (result.solves - 1));
+      }
+    }
+    printf("\n");
+  }
+  PerfBaseline measured = Measure(result);
+  if (!write_baseline_path.empty()) {
+    if (!SaveBaseline(write_baseline_path, measured)) {
+      fprintf(stderr, "Failed to write the baseline %s\n", write_baseline_path.c_str());
+      return 1;
+    }
+    printf("baseline written to %s\n", write_baseline_path.c_str());
+  }
+  if (!baseline_path.empty() && !CheckBaseline(limits, measured, result.lap_times.size())) {
+    fprintf(stderr, "Performance regressed against %s\n", baseline_path.c_str());
+    return 3;
+  }
+  return 0;
+}
@@ -0,0 +1,762 @@
+// Parameter sweep over the closed loop of mpc_sim: runs the laps of one
+// configuration of horizon, time step, reference speed and cost weights
+// per task, on every core at once, and writes a CSV line per
+// configuration.
+//
+//   mpc_sweep [--track FILE] [--laps L] [--latency MS] [--period MS]
+//             [--backend NAME] [--threads T] [--random K] [--seed S]
+//             [--set NAME=VALUES]... [--reference] [--speed-profile]
+//
+// NAME is N, dt, dt_growth (see MPC::SetTimestep), ref_v or the name of a
+// weight (see Weights.h); the rest
+// keep the values of the server. VALUES is a comma-separated list, or
+// LO:HI with --random. Without --random every combination of the lists is
+// run; with it, K configurations are drawn, each list giving one of its
+// values and each range a uniform one (log-uniform for weights with LO >
+// 0, since the weights matter by their ratios). N must be one of the
+// horizons MPC_FOR_EACH_HORIZON instantiates.
+//
+// The columns are the configuration, the laps driven, the mean time of
+// the completed laps, the maximum and mean offset from the line, the mean
+// speed, the p50, p90 and p99 solve times in ms and ok or off (left the
+// track or got stuck). Lines come in order of completion; the fastest
+// configurations that completed every lap are listed on stderr at the end.
+//
+// --reference takes the reference polynomial from a spline through the
+// track and --speed-profile the reference speed from its speed profile,
+// as in mpc_sim. The path is built once, on the first use, and shared by
+// every configuration and thread (see TrackCache.h).
+//
+// A sweep too large for one host runs on many:
+//
+//   mpc_sweep --coordinate PORT [--timeout S] [the flags above]
+//   mpc_sweep --worker HOST:PORT [--threads T]
+//
+// The coordinator draws the configurations as above, listens on PORT and
+// writes the CSV, but runs none itself. Each worker connects to it, gets
+// the track and the loop settings, and runs configurations on T threads
+// (default: every core), T of them leased to it at a time. A worker that
+// disconnects, or whose oldest lease is S seconds old (default 900), is
+// taken for failed: it is dropped and its leases go to the others. A
+// result that comes in twice is written once. The workers may start
+// before the coordinator, which they wait 30 s for, and exit when the
+// sweep is done. Workers given --reference build the path of the track
+// the coordinator sends them, once for all their threads.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <poll.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AdaptiveHorizon.h"
+#include "Backends.h"
+#include "ClosedLoop.h"
+#include "Layout.h"
+#include "LineSocket.h"
+#include "Logger.h"
+#include "Track.h"
+#include "TrackCache.h"
+
+using namespace std;
+
+// The swept parameters, the weights last and in the order of Weights.
+static const char* const parameter_names[] = { "N", "dt", "dt_growth", "ref_v", "cte", "epsi", "v", "delta", "a",
+                                                "ddelta", "da" };
+static const size_t n_parameters = sizeof(parameter_names) / sizeof(parameter_names[0]);
+static const size_t horizon_param = 0;
+static const size_t dt_param = 1;
+static const size_t dt_growth_param = 2;
+static const size_t ref_v_param = 3;
+static const size_t weights_param = 4;
+
+// How many of the fastest configurations to list at the end.
+static const size_t fastest = 5;
+
+struct Axis {
+  size_t parameter;
+  // The listed values, or the range LO:HI.
+  vector<double> values;
+  bool range;
+  double lo;
+  double hi;
+};
+
+struct Config {
+  double values[n_parameters];
+};
+
+// The columns of a configuration's line after its parameters, which a
+// worker sends back to the coordinator.
+struct Record {
+  double laps;
+  double lap_time;
+  double offset_max;
+  double offset_mean;
+  double speed;
+  double solve_p50;
+  double solve_p90;
+  double solve_p99;
+  bool ok;
+};
+
+struct Outcome {
+  size_t index;
+  double lap_time;
+  double offset_max;
+  bool ok;
+};
+
+static double Percentile(const vector<double>& sorted, double p) {
+  size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+static bool Horizon(double n) {
+  return n >= 0 && n == size_t(n) && HorizonIndex(size_t(n)) < n_horizons;
+}
+
+// Parse NAME=VALUES into axis; false with the reason in error.
+static bool ParseAxis(const string& text, Axis& axis, string& error) {
+  size_t eq = text.find('=');
+  if (eq == string::npos) {
+    error = "expected NAME=VALUES";
+    return false;
+  }
+  string name = text.substr(0, eq);
+  axis.parameter = n_parameters;
+  for (size_t p = 0; p < n_parameters; p++) {
+    if (name == parameter_names[p]) {
+      axis.parameter = p;
+    }
+  }
+  if (axis.parameter == n_parameters) {
+    error = "unknown parameter " + name;
+    return false;
+  }
+  string values = text.substr(eq + 1);
+  axis.range = values.find(':') != string::npos;
+  const char* s = values.c_str();
+  char* end;
+  if (axis.range) {
+    axis.lo = strtod(s, &end);
+    if (*end != ':') {
+      error = "bad range " + values;
+      return false;
+    }
+    axis.hi = strtod(end + 1, &end);
+    if (*end != '\0' || !(axis.lo <= axis.hi)) {
+      error = "bad range " + values;
+      return false;
+    }
+    axis.values.push_back(axis.lo);
+    axis.values.push_back(axis.hi);
+  } else {
+    for (;;) {
+      double v = strtod(s, &end);
+      if (end == s || (*end != ',' && *end != '\0')) {
+        error = "bad values " + values;
+        return false;
+      }
+      axis.values.push_back(v);
+      if (*end == '\0') {
+        break;
+      }
+      s = end + 1;
+    }
+  }
+  for (double v : axis.values) {
+    bool valid = isfinite(v) && (axis.parameter == horizon_param ? axis.range || Horizon(v)
+                                 : axis.parameter < weights_param ? v > 0 : v >= 0);
+    if (!valid) {
+      error = "bad value for " + name;
+      return false;
+    }
+  }
+  if (axis.parameter == horizon_param && axis.range) {
+    // Draw from the instantiated horizons in the range.
+    axis.values.clear();
+    axis.range = false;
+    for (size_t h : mpc_horizons) {
+      if (h >= axis.lo && h <= axis.hi) {
+        axis.values.push_back(double(h));
+      }
+    }
+    if (axis.values.empty()) {
+      error = "no horizon in the range of N";
+      return false;
+    }
+  }
+  return true;
+}
+
+static Config DefaultConfig() {
+  Config c;
+  c.values[horizon_param] = 11;
+  c.values[dt_param] = default_dt;
+  c.values[dt_growth_param] = 1;
+  c.values[ref_v_param] = ControllerOptions().ref_v;
+  const Weights& w = default_weights;
+  const double weights[] = { w.cte, w.epsi, w.v, w.delta, w.a, w.ddelta, w.da };
+  copy(weights, weights + n_parameters - weights_param, c.values + weights_param);
+  return c;
+}
+
+// Every combination of the axes' values.
+static vector<Config> Grid(const vector<Axis>& axes) {
+  vector<Config> configs(1, DefaultConfig());
+  for (const Axis& axis : axes) {
+    vector<Config> next;
+    for (const Config& c : configs) {
+      for (double v : axis.values) {
+        next.push_back(c);
+        next.back().values[axis.parameter] = v;
+      }
+    }
+    configs.swap(next);
+  }
+  return configs;
+}
+
+static vector<Config> Random(const vector<Axis>& axes, size_t n, uint64_t seed) {
+  mt19937_64 rng(seed);
+  uniform_real_distribution<double> uniform(0, 1);
+  vector<Config> configs(n, DefaultConfig());
+  for (Config& c : configs) {
+    for (const Axis& axis : axes) {
+      double& v = c.values[axis.parameter];
+      if (!axis.range) {
+        v = axis.values[min(size_t(uniform(rng) * axis.values.size()), axis.values.size() - 1)];
+      } else if (axis.parameter >= weights_param && axis.lo > 0) {
+        v = axis.lo * pow(axis.hi / axis.lo, uniform(rng));
+      } else {
+        v = axis.lo + (axis.hi - axis.lo) * uniform(rng);
+      }
+    }
+  }
+  return configs;
+}
+
+static Record Summarize(const ClosedLoopResult& result) {
+  vector<double> solves = result.solve_times;
+  sort(solves.begin(), solves.end());
+  double lap_time = NAN;
+  if (!result.lap_times.empty()) {
+    lap_time = 0;
+    for (double t : result.lap_times) {
+      lap_time += t;
+    }
+    lap_time /= result.lap_times.size();
+  }
+  Record record = { result.laps,
+                    lap_time,
+                    result.offset_max,
+                    result.offset_mean,
+                    result.speed_mean,
+                    solves.empty() ? NAN : Percentile(solves, 0.5) * 1e3,
+                    solves.empty() ? NAN : Percentile(solves, 0.9) * 1e3,
+                    solves.empty() ? NAN : Percentile(solves, 0.99) * 1e3,
+                    !result.off_track };
+  return record;
+}
+
+static void PrintHeader() {
+  printf("index");
+  for (size_t p = 0; p < n_parameters; p++) {
+    printf(",%s", parameter_names[p]);
+  }
+  printf(",laps,lap_time,offset_max,offset_mean,speed,solve_p50,solve_p90,solve_p99,status\n");
+  fflush(stdout);
+}
+
+static void PrintLine(size_t i, const Config& c, const Record& r) {
+  printf("%zu", i);
+  for (size_t p = 0; p < n_parameters; p++) {
+    printf(",%g", c.values[p]);
+  }
+  printf(",%.2f,%.2f,%.3f,%.3f,%.2f,%.3f,%.3f,%.3f,%s\n", r.laps, r.lap_time, r.offset_max, r.offset_mean,
+         r.speed, r.solve_p50, r.solve_p90, r.solve_p99, r.ok ? "ok" : "off");
+  fflush(stdout);
+}
+
+static ClosedLoopResult Run(const Track& track, const ClosedLoopSettings& settings,
+                            ControllerOptions options, const Config& c) {
+  const double* w = c.values + weights_param;
+  Weights weights = { w[0], w[1], w[2], w[3], w[4], w[5], w[6] };
+  options.weights = make_shared<const Weights>(weights);
+  options.dt = c.values[dt_param];
+  options.dt_growth = c.values[dt_growth_param];
+  options.ref_v = c.values[ref_v_param];
+  options.horizon = size_t(c.values[horizon_param]);
+  return RunClosedLoop(track, settings, options);
+}
+
+static void Report(vector<Outcome>& outcomes, size_t n_configs, double wall, const string& where) {
+  vector<Outcome> completed;
+  for (const Outcome& o : outcomes) {
+    if (o.ok) {
+      completed.push_back(o);
+    }
+  }
+  sort(completed.begin(), completed.end(),
+       [](const Outcome& a, const Outcome& b) { return a.lap_time < b.lap_time; });
+  fprintf(stderr, "%zu configurations in %.1f s on %s, %zu completed every lap\n", n_configs, wall, where.c_str(),
+          completed.size());
+  for (size_t i = 0; i < min(fastest, completed.size()); i++) {
+    fprintf(stderr, "fastest #%zu: configuration %zu, lap %.2f s, max offset %.3f m\n", i + 1,
+            completed[i].index, completed[i].lap_time, completed[i].offset_max);
+  }
+}
+
+// The lines of the protocol between the coordinator and a worker, in
+// their order:
+//   setup LAPS LATENCY PERIOD UNDERSTEER BACKEND WAYPOINTS X Y X Y...
+//                                  coordinator, on connection
+//   ready THREADS                  worker, which then gets THREADS leases
+//   task INDEX VALUE...            coordinator, a configuration leased
+//   result INDEX LAPS LAP_TIME OFFSET_MAX OFFSET_MEAN SPEED P50 P90 P99 OK
+//                                  worker, for every task
+//   done                           coordinator, when the sweep is done
+static string Number(double v) {
+  char text[32];
+  snprintf(text, sizeof(text), " %.17g", v);
+  return text;
+}
+
+// Read the numbers of line after its first word into values; false when
+// there are not n of them.
+static bool ParseNumbers(const string& line, double* values, size_t n) {
+  const char* s = line.c_str() + line.find(' ');
+  char* end;
+  for (size_t k = 0; k < n; k++) {
+    values[k] = strtod(s, &end);
+    if (end == s) {
+      return false;
+    }
+    s = end;
+  }
+  return true;
+}
+
+struct Peer {
+  int fd;
+  LineReader reader;
+  size_t threads;
+  // The configurations leased and when each was.
+  vector<size_t> leased;
+  vector<chrono::steady_clock::time_point> since;
+
+  explicit Peer(int fd) : fd(fd), reader(fd), threads(0) {}
+};
+
+static int Coordinate(const vector<Config>& configs, const Track& track, const ClosedLoopSettings& settings,
+                      const string& backend, int port, double timeout) {
+  int listener = ListenTcp(port);
+  if (listener < 0) {
+    fprintf(stderr, "Cannot listen on port %d\n", port);
+    return 1;
+  }
+  string setup = "setup" + Number(settings.laps) + Number(settings.latency) + Number(settings.period) +
+                 Number(settings.understeer) + " " + backend + Number(double(track.Size()));
+  for (size_t i = 0; i < track.Size(); i++) {
+    setup += Number(track.x[i]) + Number(track.y[i]);
+  }
+  fprintf(stderr, "Coordinating %zu configurations on port %d\n", configs.size(), port);
+  PrintHeader();
+
+  deque<size_t> pending;
+  for (size_t i = 0; i < configs.size(); i++) {
+    pending.push_back(i);
+  }
+  vector<bool> done(configs.size(), false);
+  size_t n_done = 0;
+  size_t workers = 0;
+  vector<Outcome> outcomes;
+  vector<unique_ptr<Peer> > peers;
+  string line;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  // Drop a failed worker and give its leases back, the oldest first.
+  auto drop = [&](size_t p, const char* why) {
+    Peer& peer = *peers[p];
+    for (size_t k = peer.leased.size(); k-- > 0;) {
+      if (!done[peer.leased[k]]) {
+        pending.push_front(peer.leased[k]);
+      }
+    }
+    fprintf(stderr, "Worker %d %s, %zu leases given back\n", peer.fd, why, peer.leased.size());
+    close(peer.fd);
+    peers.erase(peers.begin() + p);
+  };
+
+  while (n_done < configs.size()) {
+    vector<pollfd> fds(1 + peers.size());
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    for (size_t p = 0; p < peers.size(); p++) {
+      fds[1 + p].fd = peers[p]->fd;
+      fds[1 + p].events = POLLIN;
+    }
+    poll(fds.data(), fds.size(), 1000);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+    // Peers go from the back, so a dropped one leaves the indices before
+    // it in place.
+    for (size_t p = peers.size(); p-- > 0;) {
+      Peer& peer = *peers[p];
+      if (fds[1 + p].revents & (POLLIN | POLLERR | POLLHUP)) {
+        if (!peer.reader.Fill()) {
+          drop(p, "disconnected");
+          continue;
+        }
+        bool bad = false;
+        while (peer.reader.Next(line)) {
+          double values[10];
+          if (line.compare(0, 6, "ready ") == 0 && ParseNumbers(line, values, 1) && values[0] >= 1) {
+            peer.threads = size_t(values[0]);
+          } else if (line.compare(0, 7, "result ") == 0 && ParseNumbers(line, values, 10) && values[0] >= 0 &&
+                     values[0] < configs.size()) {
+            size_t i = size_t(values[0]);
+            for (size_t k = 0; k < peer.leased.size(); k++) {
+              if (peer.leased[k] == i) {
+                peer.leased.erase(peer.leased.begin() + k);
+                peer.since.erase(peer.since.begin() + k);
+                break;
+              }
+            }
+            if (done[i]) {
+              continue;
+            }
+            Record record = { values[1], values[2], values[3], values[4], values[5],
+                              values[6], values[7], values[8], values[9] != 0 };
+            PrintLine(i, configs[i], record);
+            Outcome outcome = { i, record.lap_time, record.offset_max, record.ok };
+            outcomes.push_back(outcome);
+            done[i] = true;
+            n_done++;
+          } else {
+            bad = true;
+            break;
+          }
+        }
+        if (bad) {
+          drop(p, "sent a bad line");
+          continue;
+        }
+      }
+      if (!peer.since.empty() && now - peer.since.front() > chrono::duration<double>(timeout)) {
+        drop(p, "timed out");
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listener, NULL, NULL);
+      if (fd >= 0) {
+        SetLineOptions(fd);
+        if (SendLine(fd, setup)) {
+          peers.emplace_back(new Peer(fd));
+          workers++;
+        } else {
+          close(fd);
+        }
+      }
+    }
+
+    // Lease the configurations left to the workers with threads free.
+    for (size_t p = peers.size(); p-- > 0;) {
+      Peer& peer = *peers[p];
+      while (peer.leased.size() < peer.threads && !pending.empty()) {
+        size_t i = pending.front();
+        pending.pop_front();
+        if (done[i]) {
+          continue;
+        }
+        string task = "task" + Number(double(i));
+        for (size_t v = 0; v < n_parameters; v++) {
+          task += Number(configs[i].values[v]);
+        }
+        peer.leased.push_back(i);
+        peer.since.push_back(now);
+        if (!SendLine(peer.fd, task)) {
+          drop(p, "disconnected");
+          break;
+        }
+      }
+    }
+  }
+  for (auto& peer : peers) {
+    SendLine(peer->fd, "done");
+    close(peer->fd);
+  }
+  close(listener);
+  double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  char where[64];
+  snprintf(where, sizeof(where), "%zu workers", workers);
+  Report(outcomes, configs.size(), wall, where);
+  return 0;
+}
+
+// Run the configurations the coordinator at address leases, on up to
+// threads threads.
+static int Work(const string& address, ControllerOptions options, bool reference, size_t threads) {
+  int fd = -1;
+  for (int attempt = 0; attempt < 30 && fd < 0; attempt++) {
+    if (attempt > 0) {
+      this_thread::sleep_for(chrono::seconds(1));
+    }
+    fd = ConnectTcp(address);
+  }
+  if (fd < 0) {
+    fprintf(stderr, "Cannot connect to the coordinator at %s\n", address.c_str());
+    return 1;
+  }
+  LineReader reader(fd);
+  string line;
+  if (!reader.ReadLine(line) || line.compare(0, 6, "setup ") != 0) {
+    fprintf(stderr, "No setup from the coordinator\n");
+    return 1;
+  }
+  // setup LAPS LATENCY PERIOD UNDERSTEER BACKEND WAYPOINTS X Y...
+  ClosedLoopSettings settings;
+  Track track;
+  char backend[32];
+  double loop[4];
+  int consumed = 0;
+  size_t waypoints = 0;
+  if (sscanf(line.c_str(), "setup %lf %lf %lf %lf %31s %zu%n", &loop[0], &loop[1], &loop[2], &loop[3], backend,
+             &waypoints, &consumed) != 6 || !FindBackend(backend)) {
+    fprintf(stderr, "Bad setup from the coordinator\n");
+    return 1;
+  }
+  settings.laps = int(loop[0]);
+  settings.latency = loop[1];
+  settings.period = loop[2];
+  settings.understeer = loop[3];
+  options.backend = FindBackend(backend)->backend;
+  const char* s = line.c_str() + consumed;
+  char* end;
+  for (size_t i = 0; i < 2 * waypoints; i++) {
+    double v = strtod(s, &end);
+    (i % 2 ? track.y : track.x).push_back(v);
+    s = end;
+  }
+  if (track.Size() < 2 || track.y.size() != track.x.size()) {
+    fprintf(stderr, "Bad track from the coordinator\n");
+    return 1;
+  }
+  if (reference) {
+    options.reference = TrackCache::Shared().Get(address, track);
+    if (!options.reference) {
+      fprintf(stderr, "Failed to build the reference path of the coordinator's track\n");
+      return 1;
+    }
+  }
+
+  // The reading thread takes no MPC of its own, but counts as CppAD's
+  // first thread.
+  threads = min(threads, MPCParallelSetup(threads + 1));
+  if (threads == 0 || !SendLine(fd, "ready" + Number(double(threads)))) {
+    return 1;
+  }
+  fprintf(stderr, "Working for %s on %zu threads\n", address.c_str(), threads);
+
+  mutex queue_mutex;
+  condition_variable queued;
+  deque<pair<size_t, Config> > tasks;
+  bool stop = false;
+  mutex send_mutex;
+  size_t runs = 0;
+  vector<thread> pool;
+  for (size_t t = 0; t < threads; t++) {
+    pool.push_back(thread([&]() {
+      if (!MPCSolverThread()) {
+        return;
+      }
+      for (;;) {
+        pair<size_t, Config> task;
+        {
+          unique_lock<mutex> lock(queue_mutex);
+          queued.wait(lock, [&]() { return stop || !tasks.empty(); });
+          if (tasks.empty()) {
+            return;
+          }
+          task = tasks.front();
+          tasks.pop_front();
+        }
+        Record r = Summarize(Run(track, settings, options, task.second));
+        string result = "result" + Number(double(task.first)) + Number(r.laps) + Number(r.lap_time) +
+                        Number(r.offset_max) + Number(r.offset_mean) + Number(r.speed) + Number(r.solve_p50) +
+                        Number(r.solve_p90) + Number(r.solve_p99) + Number(r.ok);
+        lock_guard<mutex> lock(send_mutex);
+        SendLine(fd, result);
+        runs++;
+      }
+    }));
+  }
+  bool finished = false;
+  while (reader.ReadLine(line)) {
+    double values[1 + n_parameters];
+    if (line == "done") {
+      finished = true;
+      break;
+    }
+    if (line.compare(0, 5, "task ") != 0 || !ParseNumbers(line, values, 1 + n_parameters)) {
+      fprintf(stderr, "Bad line from the coordinator\n");
+      break;
+    }
+    pair<size_t, Config> task;
+    task.first = size_t(values[0]);
+    copy(values + 1, values + 1 + n_parameters, task.second.values);
+    lock_guard<mutex> lock(queue_mutex);
+    tasks.push_back(task);
+    queued.notify_one();
+  }
+  {
+    // Leases still queued are the coordinator's to give to another.
+    lock_guard<mutex> lock(queue_mutex);
+    tasks.clear();
+    stop = true;
+  }
+  queued.notify_all();
+  // A lost coordinator leaves nobody to send the running ones to.
+  shutdown(fd, finished ? SHUT_WR : SHUT_RDWR);
+  for (thread& worker : pool) {
+    worker.join();
+  }
+  close(fd);
+  FlushLog();
+  fprintf(stderr, "%zu configurations run, %s\n", runs, finished ? "sweep done" : "coordinator lost");
+  return finished ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+  string track_path = "lake_track_waypoints.csv";
+  ClosedLoopSettings settings;
+  ControllerOptions options;
+  size_t threads = max(thread::hardware_concurrency(), 1u);
+  size_t random = 0;
+  uint64_t seed = 1;
+  string backend = "ipopt";
+  int coordinate = 0;
+  double timeout = 900;
+  string worker;
+  bool reference = false;
+  vector<Axis> axes;
+  string error;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--track" && i + 1 < argc) {
+      track_path = argv[++i];
+    } else if (arg == "--laps" && i + 1 < argc) {
+      settings.laps = max(atoi(argv[++i]), 1);
+    } else if (arg == "--latency" && i + 1 < argc) {
+      settings.latency = max(atoi(argv[++i]), 0) / 1000.0;
+    } else if (arg == "--period" && i + 1 < argc) {
+      settings.period = max(atoi(argv[++i]), 1) / 1000.0;
+    } else if (arg == "--backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      options.backend = named->backend;
+      backend = named->name;
+    } else if (arg == "--coordinate" && i + 1 < argc) {
+      coordinate = max(atoi(argv[++i]), 1);
+    } else if (arg == "--timeout" && i + 1 < argc) {
+      timeout = max(atof(argv[++i]), 1.0);
+    } else if (arg == "--worker" && i + 1 < argc) {
+      worker = argv[++i];
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threads = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--random" && i + 1 < argc) {
+      random = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (arg == "--reference") {
+      reference = true;
+    } else if (arg == "--speed-profile") {
+      reference = true;
+      options.speed_profile = true;
+    } else if (arg == "--set" && i + 1 < argc) {
+      Axis axis;
+      if (!ParseAxis(argv[++i], axis, error)) {
+        fprintf(stderr, "Bad --set %s: %s\n", argv[i], error.c_str());
+        return 2;
+      }
+      axes.push_back(axis);
+    }
+  }
+  for (const Axis& axis : axes) {
+    if (axis.range && random == 0) {
+      fprintf(stderr, "The range of %s needs --random\n", parameter_names[axis.parameter]);
+      return 2;
+    }
+  }
+  SetLogLevel(LogLevel::Warning);
+  if (!worker.empty()) {
+    return Work(worker, options, reference, threads);
+  }
+
+  Track track;
+  if (!track.Load(track_path)) {
+    fprintf(stderr, "Failed to read the track %s\n", track_path.c_str());
+    return 1;
+  }
+  if (reference) {
+    options.reference = TrackCache::Shared().Get(track_path);
+    if (!options.reference) {
+      fprintf(stderr, "Failed to build the reference path of %s\n", track_path.c_str());
+      return 1;
+    }
+  }
+
+  vector<Config> configs = random > 0 ? Random(axes, random, seed) : Grid(axes);
+  if (coordinate > 0) {
+    return Coordinate(configs, track, settings, backend, coordinate, timeout);
+  }
+  // The calling thread is the first worker; CppAD may cap the others.
+  threads = min(threads, configs.size());
+  threads = min(threads, MPCParallelSetup(threads) + 1);
+
+  PrintHeader();
+
+  atomic<size_t> next(0);
+  mutex out_mutex;
+  vector<Outcome> outcomes;
+  auto work = [&]() {
+    for (size_t i = next++; i < configs.size(); i = next++) {
+      const Config& c = configs[i];
+      Record record = Summarize(Run(track, settings, options, c));
+      lock_guard<mutex> lock(out_mutex);
+      PrintLine(i, c, record);
+      Outcome outcome = { i, record.lap_time, record.offset_max, record.ok };
+      outcomes.push_back(outcome);
+    }
+  };
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for (size_t t = 1; t < threads; t++) {
+    workers.push_back(thread([&work]() {
+      MPCSolverThread();
+      work();
+    }));
+  }
+  work();
+  for (thread& worker : workers) {
+    worker.join();
+  }
+  double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  FlushLog();
+  Report(outcomes, configs.size(), wall, to_string(threads) + " threads");
+  return 0;
+}
@@ -0,0 +1,77 @@
+// Builds the control table of ControlTable.h: solves MPC<11> from a cold
+// start at every point of a grid over [v, cte, epsi, c2, c3] around the
+// nominal driving regime and stores the first controls.
+//
+//   mpc_table OUT [--points N] [--kernels]
+//
+// --points sets the number of grid values per axis (default 7; the cubic
+// coefficient gets about half as many).
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include "Eigen-3.3/Eigen/Core"
+#include "ControlTable.h"
+#include "Logger.h"
+#include "MPC.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s OUT [--points N] [--kernels]\n", argv[0]);
+    return 2;
+  }
+  string out = argv[1];
+  int points = 7;
+  MPC<11> mpc;
+  mpc.Init(0, 0, 40);
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--points" && i + 1 < argc) {
+      points = max(atoi(argv[++i]), 2);
+    } else if (arg == "--kernels") {
+      mpc.SetBackend(MPC<11>::Backend::IpoptKernels);
+    }
+  }
+
+  // Near the reference speed, close to the line and on gentle curves.
+  const ControlTable::Axis axes[ControlTable::n_dims] = {
+    { 30, 50, points },                    // v
+    { -1, 1, points },                     // cte
+    { -0.1, 0.1, points },                 // epsi
+    { -0.005, 0.005, points },             // c2
+    { -1e-4, 1e-4, max(points / 2, 2) },  // c3
+  };
+  ControlTable table(axes, 11);
+
+  size_t failed = 0;
+  double p[ControlTable::n_dims];
+  StateVector state;
+  Eigen::Vector4d coeffs;
+  for (size_t i = 0; i < table.Size(); i++) {
+    table.Point(i, p);
+    state << 0, 0, 0, p[0], p[1], p[2];
+    coeffs << p[1], -tan(p[2]), p[3], p[4];
+    // Every point from scratch, so the table does not depend on the order
+    // of the grid.
+    mpc.Reset();
+    const MPC<11>::Result& result = mpc.Solve(state, coeffs);
+    if (result.ok) {
+      table.Set(i, result.delta[0], result.a[0]);
+    } else {
+      failed++;
+    }
+    if ((i + 1) % 1000 == 0 || i + 1 == table.Size()) {
+      fprintf(stderr, "%zu/%zu points, %zu without a solution\n", i + 1, table.Size(), failed);
+    }
+  }
+
+  FlushLog();
+  if (!table.Save(out)) {
+    fprintf(stderr, "Failed to write %s\n", out.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,262 @@
+// Worst-case solve time characterization: times MPC<N>::Solve of every
+// backend and compiled horizon on sampled and adversarial states and
+// reference polynomials, under fixed iteration caps, and reports the
+// largest time observed for each.
+//
+//   mpc_wcet [--backend NAME]... [--horizon N]... [--samples S] [--reps R]
+//            [--seed S] [--max-iter I] [--flush-cache MB]
+//            [--interference T] [--mixed-precision R]
+//
+// The sampled cases draw cte, epsi, the curvature of the reference at
+// the vehicle and its change, and the speed uniformly over the ranges
+// below, and are solved in order, each warm from the last. The
+// adversarial cases are the corners of those ranges, every combination
+// of the extremes; each is solved once cold, after MPC::Reset, and once
+// warm from the previous corner, which is as far from it as the ranges
+// allow. R passes over all of them give the timer noise its chances.
+//
+// The Ipopt backends stop at I iterations (default 100) and their time
+// limit is lifted, so the cap alone bounds them; the RTI, Riccati, ADMM
+// and MPPI backends run bounded iterations of their own. --flush-cache
+// writes a buffer of MB megabytes before every solve, so each starts
+// with the caches holding none of the solver's data, and --interference
+// runs T threads streaming through buffers of their own on the other
+// cores meanwhile. Both are off by default. --mixed-precision is
+// MPC::SetMixedPrecision.
+//
+// A line per backend and horizon gives the solves, the median, p99 and
+// maximum times in ms, the most iterations, the failed solves and the
+// case of the maximum. The first solve of each, which records the tapes
+// and sizes the buffers, is left out.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "AdaptiveHorizon.h"
+#include "Backends.h"
+#include "Layout.h"
+#include "MPC.h"
+
+using namespace std;
+
+// Ranges of the cases: cross-track and heading errors, curvature of the
+// reference at the vehicle (1 / m) and its change with x (1 / m^2), and
+// speed (m/s).
+static const double max_cte = 3;
+static const double max_epsi = 0.5;
+static const double max_curvature = 0.05;
+static const double max_curvature_change = 2e-3;
+static const double max_speed = 35;
+
+// Default cap of the Ipopt iterations.
+static const int default_max_iter = 100;
+
+struct Case {
+  StateVector state;
+  Eigen::Vector4d coeffs;
+  bool cold;
+  char label[64];
+};
+
+struct Settings {
+  int reps;
+  int max_iter;
+  size_t flush_bytes;
+  int mixed_precision;
+};
+
+// The case of the reference y = c0 + c1 x + c2 x^2 + c3 x^3 in the
+// vehicle frame with the vehicle at the origin, heading along x.
+static Case MakeCase(double cte, double epsi, double curvature, double change, double v, bool cold,
+                     const char* kind) {
+  Case c;
+  double slope = -tan(epsi);
+  double stretch = pow(1 + slope * slope, 1.5);
+  c.coeffs << cte, slope, curvature * stretch / 2, change * stretch / 6;
+  c.state << 0, 0, 0, v, cte, epsi;
+  c.cold = cold;
+  snprintf(c.label, sizeof(c.label), "%s cte %+.1f epsi %+.2f k %+.3f v %.0f", kind, cte, epsi, curvature, v);
+  return c;
+}
+
+static vector<Case> MakeCases(size_t samples, uint64_t seed) {
+  vector<Case> cases;
+  mt19937_64 random(seed);
+  uniform_real_distribution<double> unit(-1, 1);
+  for (size_t i = 0; i < samples; i++) {
+    cases.push_back(MakeCase(max_cte * unit(random), max_epsi * unit(random), max_curvature * unit(random),
+                             max_curvature_change * unit(random), max_speed * (unit(random) + 1) / 2, false,
+                             "sampled"));
+  }
+  // The 32 corners, cold and then warm from each other in turn.
+  for (int pass = 0; pass < 2; pass++) {
+    for (int corner = 0; corner < 32; corner++) {
+      double sign[5];
+      for (int b = 0; b < 5; b++) {
+        sign[b] = corner & (1 << b) ? 1 : -1;
+      }
+      cases.push_back(MakeCase(max_cte * sign[0], max_epsi * sign[1], max_curvature * sign[2],
+                               max_curvature_change * sign[3], sign[4] > 0 ? max_speed : 0, pass == 0,
+                               pass == 0 ? "cold" : "warm"));
+    }
+  }
+  return cases;
+}
+
+static double Percentile(const vector<double>& sorted, double p) {
+  size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+// Write every cache line of buffer, evicting what the caches held.
+static void Flush(vector<char>& buffer) {
+  for (size_t i = 0; i < buffer.size(); i += 64) {
+    buffer[i]++;
+  }
+  escape(buffer.data());
+}
+
+// Stream through a buffer of its own until stop is set.
+static void Interfere(const atomic<bool>& stop) {
+  vector<char> buffer(32 << 20);
+  while (!stop.load(memory_order_relaxed)) {
+    Flush(buffer);
+  }
+}
+
+template <size_t N>
+static void Run(const NamedBackend& named, const vector<Case>& cases, const Settings& settings,
+                vector<char>& flush) {
+  MPC<N> mpc;
+  mpc.Init(0, 0, 40);
+  mpc.SetBackend(named.backend);
+  IpoptOptions ipopt;
+  ipopt.max_iter = settings.max_iter;
+  ipopt.max_cpu_time = 1e6;
+  mpc.SetIpoptOptions(ipopt);
+  mpc.SetMixedPrecision(settings.mixed_precision);
+  mpc.Solve(cases.front().state, cases.front().coeffs);
+
+  Eigen::BenchTimer timer;
+  vector<double> times;
+  times.reserve(cases.size() * settings.reps);
+  int max_iterations = 0;
+  size_t failed = 0;
+  double worst = -1;
+  const Case* worst_case = NULL;
+  for (int rep = 0; rep < settings.reps; rep++) {
+    for (const Case& c : cases) {
+      if (c.cold) {
+        mpc.Reset();
+      }
+      if (!flush.empty()) {
+        Flush(flush);
+      }
+      timer.start();
+      const typename MPC<N>::Result& result = mpc.Solve(c.state, c.coeffs);
+      timer.stop();
+      escape((void*)&result);
+
+      double time = timer.value(Eigen::REAL_TIMER);
+      times.push_back(time);
+      max_iterations = max(max_iterations, result.iterations);
+      failed += result.ok ? 0 : 1;
+      if (time > worst) {
+        worst = time;
+        worst_case = &c;
+      }
+    }
+  }
+
+  sort(times.begin(), times.end());
+  printf("%-8s %3zu %7zu %9.3f %9.3f %9.3f %5d %7zu  %s\n", named.name, N, times.size(),
+         Percentile(times, 0.5) * 1e3, Percentile(times, 0.99) * 1e3, times.back() * 1e3, max_iterations, failed,
+         worst_case->label);
+}
+
+int main(int argc, char* argv[]) {
+  vector<NamedBackend> selected;
+  vector<size_t> horizons;
+  size_t samples = 200;
+  uint64_t seed = 1;
+  int interference = 0;
+  Settings settings;
+  settings.reps = 3;
+  settings.max_iter = default_max_iter;
+  settings.flush_bytes = 0;
+  settings.mixed_precision = 0;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--backend" && i + 1 < argc) {
+      const NamedBackend* named = FindBackend(argv[++i]);
+      if (!named) {
+        fprintf(stderr, "Unknown backend %s\n", argv[i]);
+        return 2;
+      }
+      selected.push_back(*named);
+    } else if (arg == "--horizon" && i + 1 < argc) {
+      size_t n = size_t(max(atoi(argv[++i]), 0));
+      if (HorizonIndex(n) == n_horizons) {
+        fprintf(stderr, "Horizon %s is not compiled\n", argv[i]);
+        return 2;
+      }
+      horizons.push_back(n);
+    } else if (arg == "--samples" && i + 1 < argc) {
+      samples = size_t(max(atoi(argv[++i]), 1));
+    } else if (arg == "--reps" && i + 1 < argc) {
+      settings.reps = max(atoi(argv[++i]), 1);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (arg == "--max-iter" && i + 1 < argc) {
+      settings.max_iter = max(atoi(argv[++i]), 1);
+    } else if (arg == "--flush-cache" && i + 1 < argc) {
+      settings.flush_bytes = size_t(max(atoi(argv[++i]), 0)) << 20;
+    } else if (arg == "--interference" && i + 1 < argc) {
+      interference = max(atoi(argv[++i]), 0);
+    } else if (arg == "--mixed-precision" && i + 1 < argc) {
+      settings.mixed_precision = max(atoi(argv[++i]), 0);
+    }
+  }
+  if (selected.empty()) {
+    selected.assign(named_backends, named_backends + n_named_backends);
+  }
+  if (horizons.empty()) {
+    horizons.assign(mpc_horizons, mpc_horizons + n_horizons);
+  }
+
+  vector<Case> cases = MakeCases(samples, seed);
+  vector<char> flush(settings.flush_bytes);
+  atomic<bool> stop(false);
+  vector<thread> interferers;
+  for (int t = 0; t < interference; t++) {
+    interferers.emplace_back(Interfere, cref(stop));
+  }
+
+  printf("%zu cases x %d passes, Ipopt capped at %d iterations, flush %zu MB, %d interfering threads; times in ms\n",
+         cases.size(), settings.reps, settings.max_iter, settings.flush_bytes >> 20, interference);
+  printf("%-8s %3s %7s %9s %9s %9s %5s %7s  %s\n", "backend", "N", "solves", "median", "p99", "max", "iters",
+         "failed", "worst case");
+  for (const NamedBackend& named : selected) {
+    for (size_t n : horizons) {
+#define RUN_HORIZON(N)                          \
+  if (n == N) {                                 \
+    Run<N>(named, cases, settings, flush);      \
+  }
+      MPC_FOR_EACH_HORIZON(RUN_HORIZON)
+#undef RUN_HORIZON
+    }
+  }
+
+  stop = true;
+  for (thread& t : interferers) {
+    t.join();
+  }
+  return 0;
+}